@@ -95,6 +95,18 @@ $(LOCAL_INSTALLED_MODULE): \
 endif
 
 
+# adb_bench, throughput and latency through the adb server
+# =========================================================
+ifneq ($(filter linux darwin,$(HOST_OS)),)
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := adb_bench.c
+LOCAL_MODULE := adb_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+endif
+
+
 # adbd device daemon
 # =========================================================
 
@@ -130,7 +142,7 @@ LOCAL_FORCE_STATIC_EXECUTABLE := true
 LOCAL_MODULE_PATH := $(TARGET_ROOT_OUT_SBIN)
 LOCAL_UNSTRIPPED_PATH := $(TARGET_ROOT_OUT_SBIN_UNSTRIPPED)
 
-LOCAL_STATIC_LIBRARIES := liblog libcutils libc libmincrypt
+LOCAL_STATIC_LIBRARIES := liblog libcutils libc libmincrypt libz
 include $(BUILD_EXECUTABLE)
 
 
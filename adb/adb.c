@@ -197,19 +197,97 @@ void adb_qemu_trace(const char* fmt, ...)
 }
 #endif  /* !ADB_HOST */
 
-apacket *get_apacket(void)
+ADB_MUTEX_DEFINE( apacket_pool_lock );
+
+#define APACKET_POOL_NONE APACKET_POOL_CLASSES
+
+static struct {
+    apacket *head;
+    unsigned count;
+} apacket_pool[APACKET_POOL_CLASSES];
+
+static struct apacket_pool_stats apacket_stats;
+
+/* returns the free list serving payload, or APACKET_POOL_NONE */
+static unsigned apacket_pool_class(size_t payload, size_t *class_size)
+{
+    size_t size = MAX_PAYLOAD_V1;
+    unsigned n;
+
+    for(n = 0; n < APACKET_POOL_CLASSES; n++, size <<= 1) {
+        if(payload <= size) {
+            *class_size = size;
+            return n;
+        }
+    }
+    *class_size = payload;
+    return APACKET_POOL_NONE;
+}
+
+apacket *get_apacket_sized(size_t payload)
 {
-    apacket *p = malloc(sizeof(apacket));
-    if(p == 0) fatal("failed to allocate an apacket");
-    memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
+    size_t size;
+    unsigned n = apacket_pool_class(payload, &size);
+    apacket *p = NULL;
+
+    adb_mutex_lock(&apacket_pool_lock);
+    apacket_stats.allocs++;
+    if(n != APACKET_POOL_NONE && apacket_pool[n].head) {
+        p = apacket_pool[n].head;
+        apacket_pool[n].head = p->next;
+        apacket_pool[n].count--;
+        apacket_stats.hits++;
+        apacket_stats.cached--;
+        apacket_stats.cached_bytes -= size;
+    }
+    if(++apacket_stats.in_use > apacket_stats.in_use_max) {
+        apacket_stats.in_use_max = apacket_stats.in_use;
+    }
+    adb_mutex_unlock(&apacket_pool_lock);
+
+    if(p == NULL) {
+        p = malloc(sizeof(apacket) + size);
+        if(p == 0) fatal("failed to allocate an apacket");
+    }
+    memset(p, 0, sizeof(apacket));
+    p->capacity = payload;
+    p->pool_class = n;
     return p;
 }
 
+apacket *get_apacket(void)
+{
+    return get_apacket_sized(MAX_PAYLOAD_V1);
+}
+
 void put_apacket(apacket *p)
 {
+    unsigned n = p->pool_class;
+    size_t size = (size_t) MAX_PAYLOAD_V1 << n;
+
+    adb_mutex_lock(&apacket_pool_lock);
+    apacket_stats.in_use--;
+    if(n != APACKET_POOL_NONE &&
+       (apacket_pool[n].count + 1) * size <= APACKET_POOL_CLASS_BYTES) {
+        p->next = apacket_pool[n].head;
+        apacket_pool[n].head = p;
+        apacket_pool[n].count++;
+        apacket_stats.cached++;
+        apacket_stats.cached_bytes += size;
+        p = NULL;
+    }
+    adb_mutex_unlock(&apacket_pool_lock);
+
     free(p);
 }
 
+void apacket_pool_get_stats(struct apacket_pool_stats *stats)
+{
+    adb_mutex_lock(&apacket_pool_lock);
+    *stats = apacket_stats;
+    adb_mutex_unlock(&apacket_pool_lock);
+}
+
 void handle_online(atransport *t)
 {
     D("adb: online\n");
@@ -265,16 +343,22 @@ void print_packet(const char *label, apacket *p)
 }
 #endif
 
-static void send_ready(unsigned local, unsigned remote, atransport *t)
+static void send_ready_count(unsigned local, unsigned remote, unsigned count,
+                             atransport *t)
 {
     D("Calling send_ready \n");
     apacket *p = get_apacket();
-    p->msg.command = A_OKAY;
+    fill_ready_packet(p, count);
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
     send_packet(p, t);
 }
 
+static void send_ready(unsigned local, unsigned remote, atransport *t)
+{
+    send_ready_count(local, remote, 1, t);
+}
+
 static void send_close(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_close \n");
@@ -285,9 +369,24 @@ static void send_close(unsigned local, unsigned remote, atransport *t)
     send_packet(p, t);
 }
 
+/* adbd always offers compression; the host only does when the server
+** was started with ADB_COMPRESS=1, so nothing changes unless asked for
+*/
+static int compression_wanted(void)
+{
+#if ADB_HOST
+    const char *env = getenv("ADB_COMPRESS");
+    return env != NULL && !strcmp(env, "1");
+#else
+    return 1;
+#endif
+}
+
 static size_t fill_connect_data(char *buf, size_t bufsize)
 {
 #if ADB_HOST
+    if (compression_wanted())
+        return snprintf(buf, bufsize, "host::features=deflate;") + 1;
     return snprintf(buf, bufsize, "host::") + 1;
 #else
     static const char *cnxn_props[] = {
@@ -310,6 +409,11 @@ static size_t fill_connect_data(char *buf, size_t bufsize)
         remaining -= len;
         buf += len;
     }
+    if (compression_wanted()) {
+        len = snprintf(buf, remaining, "features=deflate;");
+        remaining -= len;
+        buf += len;
+    }
 
     return bufsize - remaining + 1;
 #endif
@@ -323,7 +427,7 @@ static void send_connect(atransport *t)
     cp->msg.arg0 = A_VERSION;
     cp->msg.arg1 = MAX_PAYLOAD;
     cp->msg.data_length = fill_connect_data((char *)cp->data,
-                                            sizeof(cp->data));
+                                            cp->capacity);
     send_packet(cp, t);
 }
 
@@ -372,7 +476,7 @@ static void send_auth_publickey(atransport *t)
     apacket *p = get_apacket();
     int ret;
 
-    ret = adb_auth_get_userkey(p->data, sizeof(p->data));
+    ret = adb_auth_get_userkey(p->data, p->capacity);
     if (!ret) {
         D("Failed to get user public key\n");
         put_apacket(p);
@@ -385,12 +489,80 @@ static void send_auth_publickey(atransport *t)
     send_packet(p, t);
 }
 
+static void send_auth_ticket(atransport *t)
+{
+    D("Calling send_auth_ticket\n");
+    apacket *p = get_apacket();
+    int ret;
+
+    ret = adb_auth_issue_ticket(t, p->data);
+    if (!ret) {
+        put_apacket(p);
+        return;
+    }
+
+    p->msg.command = A_AUTH;
+    p->msg.arg0 = ADB_AUTH_TICKET;
+    p->msg.data_length = ret;
+    send_packet(p, t);
+}
+
+static int send_auth_session(uint8_t *token, size_t token_size, atransport *t)
+{
+    D("Calling send_auth_session\n");
+    apacket *p = get_apacket();
+    int ret;
+
+    ret = adb_auth_session_response(t, token, token_size, p->data);
+    if (!ret) {
+        put_apacket(p);
+        return 0;
+    }
+
+    p->msg.command = A_AUTH;
+    p->msg.arg0 = ADB_AUTH_SESSION;
+    p->msg.data_length = ret;
+    send_packet(p, t);
+    return 1;
+}
+
 void adb_auth_verified(atransport *t)
 {
+    /* a host let in by its ticket keeps it */
+    if (!t->session_resumed)
+        send_auth_ticket(t);
     handle_online(t);
     send_connect(t);
 }
 
+/* Record the protocol version and payload size proposed by the peer in
+** its A_CNXN message.  Both sides end up using the smaller of the two
+** proposals; peers older than A_VERSION_LARGE_PAYLOAD are held to
+** MAX_PAYLOAD_V1 whatever they advertise.
+*/
+static void update_transport_version(atransport *t, unsigned version,
+                                     unsigned max_payload)
+{
+    if (version > A_VERSION)
+        version = A_VERSION;
+    if (version < A_VERSION_LARGE_PAYLOAD && max_payload > MAX_PAYLOAD_V1)
+        max_payload = MAX_PAYLOAD_V1;
+    if (max_payload > MAX_PAYLOAD)
+        max_payload = MAX_PAYLOAD;
+
+    D("%s: protocol version %08x, max payload %u\n",
+      t->serial, version, max_payload);
+    t->protocol_version = version;
+    t->max_payload = max_payload;
+}
+
+size_t transport_max_payload(atransport *t)
+{
+    if (t == NULL || t->max_payload == 0)
+        return MAX_PAYLOAD_V1;
+    return t->max_payload;
+}
+
 static char *connection_state_name(atransport *t)
 {
     if (t == NULL) {
@@ -441,6 +613,7 @@ void parse_banner(char *banner, atransport *t)
     char *type;
 
     D("parse_banner: %s\n", banner);
+    t->compress = 0;
     type = banner;
     cp = strchr(type, ':');
     if (cp) {
@@ -461,6 +634,9 @@ void parse_banner(char *banner, atransport *t)
                         qual_overwrite(&t->model, cp);
                     else if (!strcmp(key, "ro.product.device"))
                         qual_overwrite(&t->device, cp);
+                    else if (!strcmp(key, "features"))
+                        t->compress = compression_wanted() &&
+                                      strstr(cp, "deflate") != NULL;
                 }
                 key = adb_strtok_r(NULL, prop_seps, &save);
             }
@@ -521,18 +697,26 @@ void handle_packet(apacket *p, atransport *t)
         return;
 
     case A_CNXN: /* CONNECT(version, maxdata, "system-id-string") */
-            /* XXX verify version, etc */
+        if(p->msg.arg0 < A_VERSION_MIN || p->msg.arg1 == 0) {
+            D("rejecting A_CNXN with version %08x, max payload %u\n",
+              p->msg.arg0, p->msg.arg1);
+            break;
+        }
         if(t->connection_state != CS_OFFLINE) {
             t->connection_state = CS_OFFLINE;
             handle_offline(t);
         }
 
+        update_transport_version(t, p->msg.arg0, p->msg.arg1);
+        p->data[p->msg.data_length > 0 ? p->msg.data_length - 1 : 0] = 0;
+
         parse_banner((char*) p->data, t);
 
         if (HOST || !auth_enabled) {
             handle_online(t);
             if(!HOST) send_connect(t);
         } else {
+            t->session_resumed = 0;
             send_auth_request(t);
         }
         break;
@@ -540,6 +724,14 @@ void handle_packet(apacket *p, atransport *t)
     case A_AUTH:
         if (p->msg.arg0 == ADB_AUTH_TOKEN) {
             t->connection_state = CS_UNAUTHORIZED;
+            if (!t->session_tried) {
+                t->session_tried = 1;
+                if (send_auth_session(p->data, p->msg.data_length, t))
+                    break;
+            } else if (!t->key) {
+                /* a new token right after our ticket: it was refused */
+                adb_auth_drop_ticket(t);
+            }
             t->key = adb_auth_nextkey(t->key);
             if (t->key) {
                 send_auth_response(p->data, p->msg.data_length, t);
@@ -558,6 +750,18 @@ void handle_packet(apacket *p, atransport *t)
             }
         } else if (p->msg.arg0 == ADB_AUTH_RSAPUBLICKEY) {
             adb_auth_confirm_key(p->data, p->msg.data_length, t);
+        } else if (HOST && p->msg.arg0 == ADB_AUTH_TICKET) {
+            adb_auth_store_ticket(t, p->data, p->msg.data_length);
+        } else if (!HOST && p->msg.arg0 == ADB_AUTH_SESSION) {
+            if (adb_auth_verify_session(t->token, p->data, p->msg.data_length)) {
+                t->session_resumed = 1;
+                adb_auth_verified(t);
+                t->failed_auth_attempts = 0;
+            } else {
+                if (t->failed_auth_attempts++ > 10)
+                    adb_sleep_ms(1000);
+                send_auth_request(t);
+            }
         }
         break;
 
@@ -569,9 +773,11 @@ void handle_packet(apacket *p, atransport *t)
             if(s == 0) {
                 send_close(0, p->msg.arg0, t);
             } else {
+                unsigned window = stream_window_for_open(t, p->msg.arg1);
                 s->peer = create_remote_socket(p->msg.arg0, t);
                 s->peer->peer = s;
-                send_ready(s->id, s->peer->id, t);
+                remote_socket_set_window(s->peer, window);
+                send_ready_count(s->id, s->peer->id, window, t);
                 s->ready(s);
             }
         }
@@ -580,11 +786,17 @@ void handle_packet(apacket *p, atransport *t)
     case A_OKAY: /* READY(local-id, remote-id, "") */
         if (t->online) {
             if((s = find_local_socket(p->msg.arg1))) {
+                unsigned count = ready_packet_count(p);
                 if(s->peer == 0) {
+                        /* the first READY carries the stream window */
                     s->peer = create_remote_socket(p->msg.arg0, t);
                     s->peer->peer = s;
+                    remote_socket_set_window(s->peer,
+                            stream_window_for_open(t, count));
+                    s->ready(s);
+                } else if(remote_socket_acked(s->peer, count)) {
+                    s->ready(s);
                 }
-                s->ready(s);
             }
         }
         break;
@@ -603,8 +815,13 @@ void handle_packet(apacket *p, atransport *t)
                 unsigned rid = p->msg.arg0;
                 p->len = p->msg.data_length;
 
+                    /* the READY is owed until the packet is consumed;
+                    ** note that enqueue may close s (and its peer)
+                    */
+                remote_socket_hold(s->peer);
                 if(s->enqueue(s, p) == 0) {
                     D("Enqueue the socket\n");
+                    remote_socket_release(s->peer);
                     send_ready(s->id, rid, t);
                 }
                 return;
@@ -1486,6 +1703,42 @@ int handle_host_request(char *service, transport_type ttype, char* serial, int r
         return 0;
     }
 
+    // returns the event loop counters, mostly useful with many devices
+    if (!strcmp(service, "fdevent-stats")) {
+        struct fdevent_stats st;
+        char stats[256];
+
+        fdevent_get_stats(&st);
+        snprintf(stats, sizeof stats,
+                 "backend: %s\nloops: %llu\nevents: %llu\n"
+                 "avg latency: %lld us\nmax latency: %lld us\n",
+                 st.backend,
+                 (unsigned long long) st.loop_iterations,
+                 (unsigned long long) st.events_dispatched,
+                 st.events_dispatched ?
+                     (long long) (st.total_latency_us / (int64_t) st.events_dispatched) : 0LL,
+                 (long long) st.max_latency_us);
+        snprintf(buf, sizeof buf, "OKAY%04x%s", (unsigned)strlen(stats), stats);
+        writex(reply_fd, buf, strlen(buf));
+        return 0;
+    }
+
+    // returns the packet pool counters
+    if (!strcmp(service, "packet-stats")) {
+        struct apacket_pool_stats st;
+        char stats[256];
+
+        apacket_pool_get_stats(&st);
+        snprintf(stats, sizeof stats,
+                 "allocs: %lu\npool hits: %lu\nin use: %u\n"
+                 "in use max: %u\ncached: %u (%lu bytes)\n",
+                 st.allocs, st.hits, st.in_use, st.in_use_max,
+                 st.cached, (unsigned long) st.cached_bytes);
+        snprintf(buf, sizeof buf, "OKAY%04x%s", (unsigned)strlen(stats), stats);
+        writex(reply_fd, buf, strlen(buf));
+        return 0;
+    }
+
     if(!strncmp(service,"get-serialno",strlen("get-serialno"))) {
         char *out = "unknown";
          transport = acquire_one_transport(CS_ANY, ttype, serial, NULL);
@@ -21,7 +21,13 @@
 
 #include "transport.h"  /* readx(), writex() */
 
-#define MAX_PAYLOAD 4096
+/* MAX_PAYLOAD_V1 is the payload limit of the original protocol and
+** the size used for control packets.  Peers that both speak
+** A_VERSION_LARGE_PAYLOAD or later may agree on anything up to
+** MAX_PAYLOAD during the A_CNXN handshake (see handle_packet()).
+*/
+#define MAX_PAYLOAD_V1 (4*1024)
+#define MAX_PAYLOAD    (256*1024)
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -30,8 +36,17 @@
 #define A_CLSE 0x45534c43
 #define A_WRTE 0x45545257
 #define A_AUTH 0x48545541
+#define A_WRTZ 0x5a545257   /* A_WRTE with a deflated payload, see protocol.txt */
+
+#define A_VERSION_MIN 0x01000000    // Oldest ADB protocol version we talk to
+#define A_VERSION_LARGE_PAYLOAD 0x01000001 // First version allowing > MAX_PAYLOAD_V1
+#define A_VERSION_STREAM_WINDOW 0x01000002 // First version with windowed streams
+#define A_VERSION 0x01000002        // ADB protocol version
 
-#define A_VERSION 0x01000000        // ADB protocol version
+/* number of A_WRTE packets a stream may have in flight before it
+** has to wait for a READY, when both ends support stream windows
+*/
+#define ADB_STREAM_WINDOW 16
 
 #define ADB_VERSION_MAJOR 1         // Used for help/version information
 #define ADB_VERSION_MINOR 0         // Used for help/version information
@@ -63,8 +78,16 @@ struct apacket
     unsigned len;
     unsigned char *ptr;
 
+        /* number of bytes available in data[]; packets are
+        ** allocated to fit the payload size they will carry
+        */
+    unsigned capacity;
+
+        /* free list of the packet pool this buffer returns to */
+    unsigned pool_class;
+
     amessage msg;
-    unsigned char data[MAX_PAYLOAD];
+    unsigned char data[];
 };
 
 /* An asocket represents one half of a connection between a local and
@@ -170,6 +193,10 @@ struct atransport
     atransport *next;
     atransport *prev;
 
+        /* chains of the serial and devpath hash tables in transport.c */
+    atransport *serial_next;
+    atransport *devpath_next;
+
     int (*read_from_remote)(apacket *p, atransport *t);
     int (*write_to_remote)(apacket *p, atransport *t);
     void (*close)(atransport *t);
@@ -181,6 +208,19 @@ struct atransport
     int ref_count;
     unsigned sync_token;
     int connection_state;
+
+        /* negotiated in the A_CNXN handshake. max_payload starts out at
+        ** MAX_PAYLOAD so that whatever the peer proposes still fits our
+        ** receive buffers, and is narrowed once both banners are seen.
+        */
+    unsigned protocol_version;
+    unsigned max_payload;
+
+        /* set when both banners list the "deflate" feature; A_WRTE
+        ** payloads are then compressed by the transport threads
+        */
+    int compress;
+
     int online;
     transport_type type;
 
@@ -196,6 +236,10 @@ struct atransport
     char *devpath;
     int adb_port; // Use for emulators (local transport)
 
+        /* what the device trackers were last told about this transport */
+    int announced;
+    int announced_state;
+
         /* a list of adisconnect callbacks called when the transport is kicked */
     int          kicked;
     adisconnect  disconnects;
@@ -204,6 +248,8 @@ struct atransport
     unsigned char token[TOKEN_SIZE];
     fdevent auth_fde;
     unsigned failed_auth_attempts;
+    int session_tried;      /* host: a session ticket was offered */
+    int session_resumed;    /* device: authorized by a session ticket */
 };
 
 
@@ -245,6 +291,22 @@ asocket *create_local_service_socket(const char *destination);
 
 asocket *create_remote_socket(unsigned id, atransport *t);
 void connect_to_remote(asocket *s, const char *destination);
+
+/* stream windows (see protocol.txt)
+** stream_window_for_open() returns the window to use for a stream on t
+** given the window proposed by the peer.  The count carried by a READY
+** is the stream window on the first READY and the number of A_WRTE
+** packets acknowledged on later ones.
+*/
+unsigned stream_window_for_open(atransport *t, unsigned proposed);
+void fill_ready_packet(apacket *p, unsigned count);
+unsigned ready_packet_count(apacket *p);
+void remote_socket_set_window(asocket *s, unsigned window);
+    /* returns nonzero if the stream may send again */
+int  remote_socket_acked(asocket *s, unsigned count);
+    /* account for A_WRTE packets received but not yet READY'd */
+void remote_socket_hold(asocket *s);
+void remote_socket_release(asocket *s);
 void connect_to_smartsocket(asocket *s);
 
 void fatal(const char *fmt, ...);
@@ -265,7 +327,7 @@ void init_transport_registration(void);
 int  list_transports(char *buf, size_t  bufsize, int long_listing);
 void update_transports(void);
 
-asocket*  create_device_tracker(void);
+asocket*  create_device_tracker(int  delta);
 
 /* Obtain a transport from the available transports.
 ** If state is != CS_ANY, only transports in that state are considered.
@@ -313,7 +375,7 @@ asocket *host_service_to_socket(const char*  name, const char *serial);
 #if !ADB_HOST
 int       init_jdwp(void);
 asocket*  create_jdwp_service_socket();
-asocket*  create_jdwp_tracker_service_socket();
+asocket*  create_jdwp_tracker_service_socket(int  delta);
 int       create_jdwp_connection_fd(int  jdwp_pid);
 #endif
 
@@ -329,10 +391,36 @@ void remount_service(int fd, void *cookie);
 char * get_log_file_path(const char * log_name);
 #endif
 
-/* packet allocator */
+/* packet allocator
+** get_apacket() returns a packet with room for MAX_PAYLOAD_V1 bytes,
+** which is enough for any control message.  Use get_apacket_sized()
+** for packets that carry stream data.
+*/
 apacket *get_apacket(void);
+apacket *get_apacket_sized(size_t payload);
 void put_apacket(apacket *p);
 
+/* Freed packets are kept on per-size free lists, one for each power of
+** two between MAX_PAYLOAD_V1 and MAX_PAYLOAD, each holding at most
+** APACKET_POOL_CLASS_BYTES worth of buffers.
+*/
+#define APACKET_POOL_CLASSES 7
+#define APACKET_POOL_CLASS_BYTES (4*1024*1024)
+
+struct apacket_pool_stats {
+    unsigned long allocs;       /* get_apacket*() calls */
+    unsigned long hits;         /* ... served from a free list */
+    unsigned in_use;            /* packets handed out right now */
+    unsigned in_use_max;        /* high-water mark of in_use */
+    unsigned cached;            /* packets sitting on the free lists */
+    size_t cached_bytes;
+};
+
+void apacket_pool_get_stats(struct apacket_pool_stats *stats);
+
+/* largest payload that may be sent over the transport */
+size_t transport_max_payload(atransport *t);
+
 int check_header(apacket *p);
 int check_data(apacket *p);
 
@@ -472,6 +560,9 @@ extern int SHELL_EXIT_NOTIFY_FD;
 
 #define CHUNK_SIZE (64*1024)
 
+/* smaller A_WRTE payloads are never worth compressing */
+#define ADB_COMPRESS_MIN 512
+
 #if !ADB_HOST
 #define USB_ADB_PATH     "/dev/android_adb"
 
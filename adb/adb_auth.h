@@ -28,26 +28,46 @@ void send_auth_request(atransport *t);
 /* Response */
 #define ADB_AUTH_SIGNATURE     2
 #define ADB_AUTH_RSAPUBLICKEY  3
+/* Session resumption, see protocol.txt */
+#define ADB_AUTH_TICKET        4
+#define ADB_AUTH_SESSION       5
+
+#define ADB_AUTH_TICKET_ID_SIZE     16
+#define ADB_AUTH_TICKET_SECRET_SIZE 32
+#define ADB_AUTH_TICKET_SEALED_SIZE 256 /* the secret, RSA encrypted to the host's key */
+#define ADB_AUTH_TICKET_SIZE    (ADB_AUTH_TICKET_ID_SIZE + ADB_AUTH_TICKET_SEALED_SIZE)
+#define ADB_AUTH_MAC_SIZE       32  /* HMAC-SHA256 */
+#define ADB_AUTH_SESSION_SIZE   (ADB_AUTH_TICKET_ID_SIZE + ADB_AUTH_MAC_SIZE)
 
 #if ADB_HOST
 
 int adb_auth_sign(void *key, void *token, size_t token_size, void *sig);
 void *adb_auth_nextkey(void *current);
 int adb_auth_get_userkey(unsigned char *data, size_t len);
+void adb_auth_store_ticket(atransport *t, void *ticket, size_t len);
+void adb_auth_drop_ticket(atransport *t);
+int adb_auth_session_response(atransport *t, void *token, size_t token_size, void *out);
 
 static inline int adb_auth_generate_token(void *token, size_t token_size) { return 0; }
 static inline int adb_auth_verify(void *token, void *sig, int siglen) { return 0; }
 static inline void adb_auth_confirm_key(unsigned char *data, size_t len, atransport *t) { }
+static inline int adb_auth_issue_ticket(atransport *t, void *out) { return 0; }
+static inline int adb_auth_verify_session(void *token, void *data, int len) { return 0; }
 
 #else // !ADB_HOST
 
 static inline int adb_auth_sign(void* key, void *token, size_t token_size, void *sig) { return 0; }
 static inline void *adb_auth_nextkey(void *current) { return NULL; }
 static inline int adb_auth_get_userkey(unsigned char *data, size_t len) { return 0; }
+static inline void adb_auth_store_ticket(atransport *t, void *ticket, size_t len) { }
+static inline void adb_auth_drop_ticket(atransport *t) { }
+static inline int adb_auth_session_response(atransport *t, void *token, size_t token_size, void *out) { return 0; }
 
 int adb_auth_generate_token(void *token, size_t token_size);
 int adb_auth_verify(void *token, void *sig, int siglen);
 void adb_auth_confirm_key(unsigned char *data, size_t len, atransport *t);
+int adb_auth_issue_ticket(atransport *t, void *out);
+int adb_auth_verify_session(void *token, void *data, int len);
 
 #endif // ADB_HOST
 
@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <resolv.h>
 #include <cutils/list.h>
 #include <cutils/sockets.h>
@@ -26,6 +27,7 @@
 #include "fdevent.h"
 #include "mincrypt/rsa.h"
 #include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
 
 #define TRACE_TAG TRACE_AUTH
 
@@ -49,13 +51,40 @@ static struct adisconnect usb_disconnect = { usb_disconnected, 0, 0, 0 };
 static atransport* usb_transport;
 static bool needs_retry = false;
 
+/*
+ * Decodes a key as adb_keys and the host have it, base64 optionally
+ * followed by a space and a comment.  buf is cut at the space.
+ */
+static bool parse_key(char *buf, RSAPublicKey *out)
+{
+    /* 4 extra bytes to decode the base64 data in */
+    uint8_t data[sizeof(RSAPublicKey) + 4];
+    char *sep;
+    int ret;
+
+    sep = strpbrk(buf, " \t");
+    if (sep)
+        *sep = '\0';
+
+    ret = __b64_pton(buf, data, sizeof(data));
+    if (ret != sizeof(*out)) {
+        D("Invalid base64 data ret=%d\n", ret);
+        return false;
+    }
+    memcpy(out, data, sizeof(*out));
+
+    if (out->len != RSANUMWORDS) {
+        D("Invalid key len %d\n", out->len);
+        return false;
+    }
+    return true;
+}
+
 static void read_keys(const char *file, struct listnode *list)
 {
     struct adb_public_key *key;
     FILE *f;
-    char buf[MAX_PAYLOAD];
-    char *sep;
-    int ret;
+    char buf[MAX_PAYLOAD_V1];
 
     f = fopen(file, "r");
     if (!f) {
@@ -64,26 +93,14 @@ static void read_keys(const char *file, struct listnode *list)
     }
 
     while (fgets(buf, sizeof(buf), f)) {
-        /* Allocate 4 extra bytes to decode the base64 data in-place */
-        key = calloc(1, sizeof(*key) + 4);
+        key = calloc(1, sizeof(*key));
         if (!key) {
             D("Can't malloc key\n");
             break;
         }
 
-        sep = strpbrk(buf, " \t");
-        if (sep)
-            *sep = '\0';
-
-        ret = __b64_pton(buf, (u_char *)&key->key, sizeof(key->key) + 4);
-        if (ret != sizeof(key->key)) {
-            D("%s: Invalid base64 data ret=%d\n", file, ret);
-            free(key);
-            continue;
-        }
-
-        if (key->key.len != RSANUMWORDS) {
-            D("%s: Invalid key len %d\n", file, key->key.len);
+        if (!parse_key(buf, &key->key)) {
+            D("%s: skipping an invalid key\n", file);
             free(key);
             continue;
         }
@@ -105,13 +122,126 @@ static void free_keys(struct listnode *list)
     }
 }
 
+/*
+ * The keys are kept across connections and only read again when one of
+ * the key files changes, which is what the framework does when the user
+ * allows a new computer.
+ */
+static list_declare(key_list);
+static struct stat key_stats[sizeof(key_paths) / sizeof(key_paths[0])];
+static bool keys_loaded = false;
+
+static bool same_stat(const struct stat *a, const struct stat *b)
+{
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev &&
+           a->st_size == b->st_size && a->st_mtime == b->st_mtime &&
+           a->st_ctime == b->st_ctime;
+}
+
+/*
+ * Session tickets let a host which was authorized over USB come back after
+ * a reconnect without an RSA round trip: the host proves it holds the
+ * ticket's secret with an HMAC of the new token.  A ticket is only issued
+ * to a host whose key is in adb_keys, and its secret is sent encrypted to
+ * that key, so only the host holding the private key can use it.  Tickets
+ * are only kept in memory, expire, and are all dropped when the key files
+ * change.
+ */
+#define MAX_TICKETS      16
+#define TICKET_LIFETIME  (12 * 60 * 60)   /* seconds */
+
+struct ticket {
+    uint8_t id[ADB_AUTH_TICKET_ID_SIZE];
+    uint8_t secret[ADB_AUTH_TICKET_SECRET_SIZE];
+    RSAPublicKey key;                   /* of the host it was issued to */
+    time_t expires;                     /* 0 if the slot is free */
+};
+
+static struct ticket tickets[MAX_TICKETS];
+
+/*
+ * The key in adb_keys that the host on the USB transport last proved it
+ * holds, or that the user always allowed; the next ticket goes to it.
+ */
+static RSAPublicKey ticket_key;
+static bool ticket_key_valid = false;
+
+/* The key the framework was last asked to confirm. */
+static RSAPublicKey confirm_key;
+static bool confirm_key_valid = false;
+
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void drop_tickets(void)
+{
+    memset(tickets, 0, sizeof(tickets));
+}
+
+static void hmac_sha256(const uint8_t *key, size_t key_len,
+                        const void *msg, size_t len, uint8_t *mac)
+{
+    SHA256_CTX ctx;
+    uint8_t pad[64];
+    uint8_t inner[SHA256_DIGEST_SIZE];
+    size_t i;
+
+    /* keys are never longer than a block here */
+    memset(pad, 0x36, sizeof(pad));
+    for (i = 0; i < key_len; i++)
+        pad[i] ^= key[i];
+    SHA256_init(&ctx);
+    SHA256_update(&ctx, pad, sizeof(pad));
+    SHA256_update(&ctx, msg, len);
+    memcpy(inner, SHA256_final(&ctx), sizeof(inner));
+
+    memset(pad, 0x5c, sizeof(pad));
+    for (i = 0; i < key_len; i++)
+        pad[i] ^= key[i];
+    SHA256_init(&ctx);
+    SHA256_update(&ctx, pad, sizeof(pad));
+    SHA256_update(&ctx, inner, sizeof(inner));
+    memcpy(mac, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+}
+
+/* Compares in constant time, so that the MAC can't be guessed bytewise. */
+static bool same_bytes(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t diff = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
 static void load_keys(struct listnode *list)
 {
     char *path;
     char **paths = key_paths;
     struct stat buf;
+    bool changed = !keys_loaded;
+    int i;
+
+    for (i = 0; key_paths[i]; i++) {
+        if (stat(key_paths[i], &buf))
+            memset(&buf, 0, sizeof(buf));
+        if (!same_stat(&buf, &key_stats[i])) {
+            key_stats[i] = buf;
+            changed = true;
+        }
+    }
+    if (!changed)
+        return;
 
-    list_init(list);
+    free_keys(list);
+    keys_loaded = true;
+    /* a key may have been revoked, and with it the hosts it let in */
+    drop_tickets();
 
     while ((path = *paths++)) {
         if (!stat(path, &buf)) {
@@ -140,9 +270,9 @@ int adb_auth_verify(void *token, void *sig, int siglen)
 {
     struct listnode *item;
     struct adb_public_key *key;
-    struct listnode key_list;
     int ret = 0;
 
+    ticket_key_valid = false;
     if (siglen != RSANUMBYTES)
         return 0;
 
@@ -151,15 +281,109 @@ int adb_auth_verify(void *token, void *sig, int siglen)
     list_for_each(item, &key_list) {
         key = node_to_item(item, struct adb_public_key, node);
         ret = RSA_verify(&key->key, sig, siglen, token, SHA_DIGEST_SIZE);
-        if (ret)
+        if (ret) {
+            ticket_key = key->key;
+            ticket_key_valid = true;
+            /* the computer that just connected is the likeliest to be back */
+            list_remove(item);
+            list_add_head(&key_list, item);
             break;
+        }
     }
 
-    free_keys(&key_list);
-
     return ret;
 }
 
+/* Whether key is, still, one of the keys in adb_keys. */
+static bool is_known_key(const RSAPublicKey *key)
+{
+    struct listnode *item;
+    struct adb_public_key *known;
+
+    load_keys(&key_list);
+
+    list_for_each(item, &key_list) {
+        known = node_to_item(item, struct adb_public_key, node);
+        if (!memcmp(&known->key, key, sizeof(*key)))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Fills out with a new ticket for the host on t, and returns its size, or
+ * 0 if t shouldn't get one: tickets only go to hosts over USB whose key is
+ * in adb_keys, so not to one the user only allowed once.  The ticket is
+ * its id followed by its secret encrypted to the host's key.
+ */
+int adb_auth_issue_ticket(atransport *t, void *out)
+{
+    struct ticket *ticket = &tickets[0];
+    uint8_t pad[RSANUMBYTES - 3 - ADB_AUTH_TICKET_SECRET_SIZE];
+    uint8_t *p = out;
+    time_t now = monotonic_seconds();
+    int i;
+
+    if (!ticket_key_valid)
+        return 0;
+    ticket_key_valid = false;
+    if (t->type != kTransportUsb)
+        return 0;
+
+    for (i = 1; i < MAX_TICKETS && ticket->expires > now; i++) {
+        if (tickets[i].expires < ticket->expires)
+            ticket = &tickets[i];
+    }
+
+    if (adb_auth_generate_token(ticket->id, sizeof(ticket->id)) != sizeof(ticket->id) ||
+        adb_auth_generate_token(ticket->secret, sizeof(ticket->secret)) != sizeof(ticket->secret) ||
+        adb_auth_generate_token(pad, sizeof(pad)) != sizeof(pad) ||
+        !RSA_encrypt(&ticket_key, ticket->secret, sizeof(ticket->secret), pad,
+                     p + ADB_AUTH_TICKET_ID_SIZE)) {
+        memset(ticket, 0, sizeof(*ticket));
+        return 0;
+    }
+    ticket->key = ticket_key;
+    ticket->expires = now + TICKET_LIFETIME;
+
+    memcpy(p, ticket->id, sizeof(ticket->id));
+    return ADB_AUTH_TICKET_SIZE;
+}
+
+int adb_auth_verify_session(void *token, void *data, int len)
+{
+    uint8_t mac[ADB_AUTH_MAC_SIZE];
+    uint8_t *p = data;
+    time_t now = monotonic_seconds();
+    int i;
+
+    if (len != ADB_AUTH_SESSION_SIZE)
+        return 0;
+
+    load_keys(&key_list);
+
+    for (i = 0; i < MAX_TICKETS; i++) {
+        struct ticket *ticket = &tickets[i];
+
+        if (ticket->expires <= now ||
+            !same_bytes(ticket->id, p, sizeof(ticket->id)))
+            continue;
+        if (!is_known_key(&ticket->key)) {
+            memset(ticket, 0, sizeof(*ticket));
+            return 0;
+        }
+
+        hmac_sha256(ticket->secret, sizeof(ticket->secret), token, TOKEN_SIZE, mac);
+        if (same_bytes(mac, p + ADB_AUTH_TICKET_ID_SIZE, sizeof(mac)))
+            return 1;
+        /* a wrong MAC burns the ticket, so it can't be guessed at */
+        memset(ticket, 0, sizeof(*ticket));
+        return 0;
+    }
+
+    return 0;
+}
+
 static void usb_disconnected(void* unused, atransport* t)
 {
     D("USB disconnect\n");
@@ -182,6 +406,9 @@ static void adb_auth_event(int fd, unsigned events, void *data)
             framework_fd = -1;
         }
         else if (ret == 2 && response[0] == 'O' && response[1] == 'K') {
+            /* only a key the user always allowed is in adb_keys by now */
+            ticket_key = confirm_key;
+            ticket_key_valid = confirm_key_valid && is_known_key(&confirm_key);
             if (usb_transport)
                 adb_auth_verified(usb_transport);
         }
@@ -190,7 +417,7 @@ static void adb_auth_event(int fd, unsigned events, void *data)
 
 void adb_auth_confirm_key(unsigned char *key, size_t len, atransport *t)
 {
-    char msg[MAX_PAYLOAD];
+    char msg[MAX_PAYLOAD_V1];
     int ret;
 
     if (!usb_transport) {
@@ -221,6 +448,8 @@ void adb_auth_confirm_key(unsigned char *key, size_t len, atransport *t)
         D("Failed to write PK, errno=%d\n", errno);
         return;
     }
+    /* done with msg, which parse_key() cuts at the comment */
+    confirm_key_valid = parse_key(msg + 2, &confirm_key);
 
     fdevent_install(&t->auth_fde, framework_fd, adb_auth_event, t);
     fdevent_add(&t->auth_fde, FDE_READ);
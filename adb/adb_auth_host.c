@@ -40,6 +40,7 @@
 #include <cutils/list.h>
 
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <openssl/objects.h>
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
@@ -133,7 +134,7 @@ static int write_public_keyfile(RSA *private_key, const char *private_key_path)
 {
     RSAPublicKey pkey;
     BIO *bio, *b64, *bfile;
-    char path[PATH_MAX], info[MAX_PAYLOAD];
+    char path[PATH_MAX], info[MAX_PAYLOAD_V1];
     int ret;
 
     ret = snprintf(path, sizeof(path), "%s.pub", private_key_path);
@@ -320,7 +321,7 @@ static int get_user_key(struct listnode *list)
 static void get_vendor_keys(struct listnode *list)
 {
     const char *adb_keys_path;
-    char keys_path[MAX_PAYLOAD];
+    char keys_path[MAX_PAYLOAD_V1];
     char *path;
     char *save;
     struct stat buf;
@@ -378,6 +379,115 @@ void *adb_auth_nextkey(void *current)
     return NULL;
 }
 
+/*
+ * The session tickets devices gave us, by serial number, so that a device
+ * which reconnects can let us back in with an HMAC instead of a signature.
+ * They only live as long as the server.
+ */
+#define MAX_TICKETS 256
+
+struct ticket {
+    char *serial;
+    unsigned char id[ADB_AUTH_TICKET_ID_SIZE];
+    unsigned char secret[ADB_AUTH_TICKET_SECRET_SIZE];
+};
+
+static struct ticket tickets[MAX_TICKETS];
+static int ticket_count;
+
+static struct ticket *find_ticket(atransport *t)
+{
+    int i;
+
+    if (t->type != kTransportUsb || !t->serial)
+        return NULL;
+    for (i = 0; i < ticket_count; i++) {
+        if (!strcmp(tickets[i].serial, t->serial))
+            return &tickets[i];
+    }
+    return NULL;
+}
+
+/*
+ * The device encrypts the ticket's secret to the key it let us in with;
+ * that is the only one of ours that decrypts it to the right size.
+ */
+static int open_ticket(unsigned char *sealed, unsigned char *secret)
+{
+    unsigned char buf[ADB_AUTH_TICKET_SEALED_SIZE];
+    struct listnode *item;
+
+    list_for_each(item, &key_list) {
+        struct adb_private_key *key = node_to_item(item, struct adb_private_key, node);
+
+        if (RSA_size(key->rsa) != ADB_AUTH_TICKET_SEALED_SIZE)
+            continue;
+        if (RSA_private_decrypt(ADB_AUTH_TICKET_SEALED_SIZE, sealed, buf, key->rsa,
+                                RSA_PKCS1_PADDING) == ADB_AUTH_TICKET_SECRET_SIZE) {
+            memcpy(secret, buf, ADB_AUTH_TICKET_SECRET_SIZE);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void adb_auth_store_ticket(atransport *t, void *ticket, size_t len)
+{
+    unsigned char secret[ADB_AUTH_TICKET_SECRET_SIZE];
+    unsigned char *p = ticket;
+    struct ticket *slot;
+
+    if (len != ADB_AUTH_TICKET_SIZE || t->type != kTransportUsb || !t->serial)
+        return;
+    if (!open_ticket(p + ADB_AUTH_TICKET_ID_SIZE, secret)) {
+        D("%s: cannot open the session ticket\n", t->serial);
+        return;
+    }
+
+    slot = find_ticket(t);
+    if (!slot) {
+        if (ticket_count == MAX_TICKETS)
+            return;
+        slot = &tickets[ticket_count];
+        slot->serial = strdup(t->serial);
+        if (!slot->serial)
+            return;
+        ticket_count++;
+    }
+    D("%s: got a session ticket\n", t->serial);
+    memcpy(slot->id, p, sizeof(slot->id));
+    memcpy(slot->secret, secret, sizeof(slot->secret));
+}
+
+void adb_auth_drop_ticket(atransport *t)
+{
+    struct ticket *slot = find_ticket(t);
+
+    if (slot) {
+        D("%s: session ticket refused\n", t->serial);
+        free(slot->serial);
+        *slot = tickets[--ticket_count];
+    }
+}
+
+int adb_auth_session_response(atransport *t, void *token, size_t token_size, void *out)
+{
+    struct ticket *slot = find_ticket(t);
+    unsigned char *p = out;
+    unsigned int len;
+
+    if (!slot)
+        return 0;
+
+    memcpy(p, slot->id, ADB_AUTH_TICKET_ID_SIZE);
+    if (!HMAC(EVP_sha256(), slot->secret,
+              ADB_AUTH_TICKET_SECRET_SIZE, token, token_size,
+              p + ADB_AUTH_TICKET_ID_SIZE, &len) || len != ADB_AUTH_MAC_SIZE) {
+        return 0;
+    }
+    return ADB_AUTH_SESSION_SIZE;
+}
+
 int adb_auth_get_userkey(unsigned char *data, size_t len)
 {
     char path[PATH_MAX];
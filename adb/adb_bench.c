@@ -0,0 +1,601 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures adb throughput and round trip latency through a running adb
+ * server, the way the adb client talks to it, so the same runs work over
+ * whatever transport the device is on (USB with -d, TCP with -e or a
+ * -s <host>:<port> serial):
+ *
+ *     push      sync: SEND of <size> bytes to /data/local/tmp
+ *     pull      sync: RECV of a <size> bytes file pushed beforehand
+ *     shell     shell: running dd to produce <size> bytes on stdout
+ *     latency   sync: STAT round trips, one small packet each way
+ *
+ * Each of the -j jobs opens its own connection and repeats the operation
+ * -n times. Every run prints one JSON object per line on stdout, with the
+ * wall clock throughput of all the jobs together and the distribution of
+ * the time each operation took, so that the output can be compared from
+ * one build, host or device to the next.
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "file_sync_service.h"
+
+#define DEFAULT_PORT        5037
+#define DEFAULT_ITERATIONS  10
+#define MAX_JOBS            64
+#define REMOTE_DIR          "/data/local/tmp"
+
+static int server_port = DEFAULT_PORT;
+static char transport_service[1024] = "host:transport-any";
+static const char *device_name = "any";
+static int iterations = DEFAULT_ITERATIONS;
+
+struct job {
+    int id;
+    const char *test;
+    size_t size;
+    char *buf;              /* the data pushed, or the pull buffer */
+    long long *times_us;    /* one per operation */
+    int ops;
+    unsigned long long bytes;
+    int failed;
+    pthread_t thread;
+};
+
+static long long now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int write_fully(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = write(fd, p, len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int read_fully(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+/* reads the server's OKAY, or prints its FAIL message */
+static int read_status(int fd, const char *service)
+{
+    char buf[256];
+    unsigned len;
+
+    if (read_fully(fd, buf, 4))
+        goto fail;
+    if (!memcmp(buf, "OKAY", 4))
+        return 0;
+    if (memcmp(buf, "FAIL", 4) || read_fully(fd, buf, 4))
+        goto fail;
+    buf[4] = 0;
+    len = strtoul(buf, NULL, 16);
+    if (len >= sizeof(buf) || read_fully(fd, buf, len))
+        goto fail;
+    buf[len] = 0;
+    fprintf(stderr, "adb_bench: %s: %s\n", service, buf);
+    return -1;
+
+fail:
+    fprintf(stderr, "adb_bench: %s: protocol error\n", service);
+    return -1;
+}
+
+static int send_request(int fd, const char *service)
+{
+    char head[5];
+    size_t len = strlen(service);
+
+    snprintf(head, sizeof(head), "%04x", (unsigned)len);
+    if (write_fully(fd, head, 4) || write_fully(fd, service, len)) {
+        fprintf(stderr, "adb_bench: %s: %s\n", service, strerror(errno));
+        return -1;
+    }
+    return read_status(fd, service);
+}
+
+/* opens a connection to 'service' on the device */
+static int open_service(const char *service)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd;
+
+    fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "adb_bench: socket: %s\n", strerror(errno));
+        return -1;
+    }
+    /* sync headers go out on their own, don't let them wait for an ACK */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "adb_bench: cannot connect to the adb server on "
+                "port %d: %s\n", server_port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (send_request(fd, transport_service) || send_request(fd, service)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int sync_request(int fd, unsigned id, const char *path)
+{
+    syncmsg msg;
+    size_t len = strlen(path);
+
+    msg.req.id = id;
+    msg.req.namelen = htoll(len);
+    if (write_fully(fd, &msg.req, sizeof(msg.req)) ||
+        write_fully(fd, path, len))
+        return -1;
+    return 0;
+}
+
+static int sync_fail(int fd, syncmsg *msg)
+{
+    char buf[256];
+    unsigned len = ltohl(msg->status.msglen);
+
+    if (msg->status.id == ID_FAIL && len < sizeof(buf) &&
+        !read_fully(fd, buf, len)) {
+        buf[len] = 0;
+        fprintf(stderr, "adb_bench: sync: %s\n", buf);
+    } else {
+        fprintf(stderr, "adb_bench: sync: protocol error\n");
+    }
+    return -1;
+}
+
+static int sync_push(int fd, const char *path, const char *data, size_t size)
+{
+    char spec[256];
+    syncmsg msg;
+
+    snprintf(spec, sizeof(spec), "%s,%u", path, 0100644);
+    if (sync_request(fd, ID_SEND, spec))
+        return -1;
+
+    while (size > 0) {
+        size_t n = size > SYNC_DATA_MAX ? SYNC_DATA_MAX : size;
+
+        msg.data.id = ID_DATA;
+        msg.data.size = htoll(n);
+        if (write_fully(fd, &msg.data, sizeof(msg.data)) ||
+            write_fully(fd, data, n))
+            return -1;
+        data += n;
+        size -= n;
+    }
+
+    msg.data.id = ID_DONE;
+    msg.data.size = htoll(time(NULL));
+    if (write_fully(fd, &msg.data, sizeof(msg.data)) ||
+        read_fully(fd, &msg.status, sizeof(msg.status)))
+        return -1;
+    if (msg.status.id != ID_OKAY)
+        return sync_fail(fd, &msg);
+    return 0;
+}
+
+static int sync_pull(int fd, const char *path, char *buf, size_t bufsize,
+                     unsigned long long *bytes)
+{
+    syncmsg msg;
+
+    if (sync_request(fd, ID_RECV, path))
+        return -1;
+
+    for (;;) {
+        unsigned n;
+
+        if (read_fully(fd, &msg.data, sizeof(msg.data)))
+            return -1;
+        if (msg.data.id == ID_DONE)
+            return 0;
+        if (msg.data.id != ID_DATA)
+            return sync_fail(fd, &msg);
+        n = ltohl(msg.data.size);
+        if (n > bufsize || read_fully(fd, buf, n))
+            return -1;
+        *bytes += n;
+    }
+}
+
+static int sync_stat(int fd, const char *path)
+{
+    syncmsg msg;
+
+    if (sync_request(fd, ID_STAT, path) ||
+        read_fully(fd, &msg.stat, sizeof(msg.stat)) ||
+        msg.stat.id != ID_STAT)
+        return -1;
+    return 0;
+}
+
+static void sync_quit(int fd)
+{
+    syncmsg msg;
+
+    msg.req.id = ID_QUIT;
+    msg.req.namelen = 0;
+    write_fully(fd, &msg.req, sizeof(msg.req));
+}
+
+/* reads a shell command's output to the end */
+static int read_to_eof(int fd, char *buf, size_t bufsize,
+                       unsigned long long *bytes)
+{
+    for (;;) {
+        ssize_t r = read(fd, buf, bufsize);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            return 0;
+        *bytes += r;
+    }
+}
+
+static void *job_main(void *arg)
+{
+    struct job *job = arg;
+    char path[64];
+    char cmd[128];
+    int fd = -1;
+    int i;
+
+    snprintf(path, sizeof(path), REMOTE_DIR "/adb_bench.%d", job->id);
+
+    if (strcmp(job->test, "shell")) {
+        if ((fd = open_service("sync:")) < 0)
+            goto fail;
+        /* untimed: the file the pulls read */
+        if (!strcmp(job->test, "pull") &&
+            sync_push(fd, path, job->buf, job->size))
+            goto fail;
+    } else {
+        size_t bs = job->size < SYNC_DATA_MAX ? job->size : SYNC_DATA_MAX;
+        snprintf(cmd, sizeof(cmd),
+                 "shell:dd if=/dev/zero bs=%zu count=%zu 2>/dev/null",
+                 bs, bs ? job->size / bs : 0);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        long long start = now_us();
+        int ret;
+
+        if (!strcmp(job->test, "push")) {
+            ret = sync_push(fd, path, job->buf, job->size);
+            job->bytes += job->size;
+        } else if (!strcmp(job->test, "pull")) {
+            ret = sync_pull(fd, path, job->buf, SYNC_DATA_MAX, &job->bytes);
+        } else if (!strcmp(job->test, "latency")) {
+            ret = sync_stat(fd, REMOTE_DIR);
+        } else {
+            int sfd = open_service(cmd);
+            ret = sfd < 0 ? -1 :
+                  read_to_eof(sfd, job->buf, SYNC_DATA_MAX, &job->bytes);
+            if (sfd >= 0)
+                close(sfd);
+        }
+        if (ret)
+            goto fail;
+
+        job->times_us[job->ops++] = now_us() - start;
+    }
+
+    if (fd >= 0) {
+        sync_quit(fd);
+        close(fd);
+    }
+    return NULL;
+
+fail:
+    job->failed = 1;
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+static int cmp_times(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        if ((unsigned char)*s >= 0x20)
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static void report(const char *test, size_t size, int jobs, struct job *job,
+                   long long elapsed_us)
+{
+    long long *times;
+    unsigned long long bytes = 0;
+    int ops = 0;
+    int failed = 0;
+    int i;
+
+    times = malloc(jobs * iterations * sizeof(*times));
+    if (times == NULL) {
+        fprintf(stderr, "adb_bench: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < jobs; i++) {
+        memcpy(times + ops, job[i].times_us, job[i].ops * sizeof(*times));
+        ops += job[i].ops;
+        bytes += job[i].bytes;
+        failed |= job[i].failed;
+    }
+    qsort(times, ops, sizeof(*times), cmp_times);
+    if (elapsed_us <= 0)
+        elapsed_us = 1;
+
+    printf("{\"test\":\"%s\",\"device\":", test);
+    print_json_string(device_name);
+    printf(",\"size\":%zu,\"jobs\":%d,\"ops\":%d,\"bytes\":%llu,"
+           "\"seconds\":%.6f,\"mb_per_s\":%.3f,\"ops_per_s\":%.1f",
+           size, jobs, ops, bytes, elapsed_us / 1e6,
+           bytes / (elapsed_us / 1e6) / (1024 * 1024),
+           ops / (elapsed_us / 1e6));
+    if (ops > 0) {
+        printf(",\"us\":{\"min\":%lld,\"p50\":%lld,\"p90\":%lld,"
+               "\"p99\":%lld,\"max\":%lld}",
+               times[0], times[ops * 50 / 100], times[ops * 90 / 100],
+               times[ops * 99 / 100], times[ops - 1]);
+    }
+    printf(",\"failed\":%s}\n", failed ? "true" : "false");
+    fflush(stdout);
+    free(times);
+}
+
+static int run(const char *test, size_t size, int jobs)
+{
+    struct job job[MAX_JOBS];
+    long long start;
+    int failed = 0;
+    int i;
+
+    memset(job, 0, sizeof(job));
+    for (i = 0; i < jobs; i++) {
+        job[i].id = i;
+        job[i].test = test;
+        job[i].size = size;
+        job[i].buf = malloc(size > SYNC_DATA_MAX ? size : SYNC_DATA_MAX);
+        job[i].times_us = malloc(iterations * sizeof(long long));
+        if (job[i].buf == NULL || job[i].times_us == NULL) {
+            fprintf(stderr, "adb_bench: out of memory\n");
+            exit(1);
+        }
+        memset(job[i].buf, i, size);
+    }
+
+    start = now_us();
+    for (i = 0; i < jobs; i++) {
+        if (pthread_create(&job[i].thread, NULL, job_main, &job[i])) {
+            fprintf(stderr, "adb_bench: cannot create thread\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < jobs; i++)
+        pthread_join(job[i].thread, NULL);
+
+    report(test, size, jobs, job, now_us() - start);
+
+    for (i = 0; i < jobs; i++) {
+        failed |= job[i].failed;
+        free(job[i].buf);
+        free(job[i].times_us);
+    }
+    return failed ? -1 : 0;
+}
+
+static void cleanup(void)
+{
+    char cmd[128];
+    char buf[256];
+    unsigned long long bytes = 0;
+    int fd;
+
+    snprintf(cmd, sizeof(cmd), "shell:rm -f " REMOTE_DIR "/adb_bench.*");
+    fd = open_service(cmd);
+    if (fd >= 0) {
+        read_to_eof(fd, buf, sizeof(buf), &bytes);
+        close(fd);
+    }
+}
+
+static size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    }
+    if (*end || end == s) {
+        fprintf(stderr, "adb_bench: bad size '%s'\n", s);
+        exit(1);
+    }
+    return n;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: adb_bench [-d|-e|-s <serial>] [-P <port>] [-n <iterations>]\n"
+        "                 [-j <jobs>[,<jobs>...]] <test> [<size>...]\n"
+        "\n"
+        "tests: push, pull, shell, latency, or all of them\n"
+        "sizes: in bytes, or with a k or m suffix (default 1m)\n"
+        "\n"
+        "Prints one JSON object per line for each test, size and number\n"
+        "of jobs, on stdout.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *all[] = { "push", "pull", "shell", "latency" };
+    const char **tests;
+    int ntests;
+    char *jobs_list = "1";
+    int failed = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "des:P:n:j:")) != -1) {
+        switch (c) {
+        case 'd':
+            strcpy(transport_service, "host:transport-usb");
+            device_name = "usb";
+            break;
+        case 'e':
+            strcpy(transport_service, "host:transport-local");
+            device_name = "local";
+            break;
+        case 's':
+            snprintf(transport_service, sizeof(transport_service),
+                     "host:transport:%s", optarg);
+            device_name = optarg;
+            break;
+        case 'P':
+            server_port = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            if (iterations <= 0)
+                usage();
+            break;
+        case 'j':
+            jobs_list = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+
+    if (!strcmp(argv[optind], "all")) {
+        tests = all;
+        ntests = sizeof(all) / sizeof(all[0]);
+    } else {
+        int i;
+        for (i = 0; i < (int)(sizeof(all) / sizeof(all[0])); i++) {
+            if (!strcmp(argv[optind], all[i]))
+                break;
+        }
+        if (i == (int)(sizeof(all) / sizeof(all[0])))
+            usage();
+        tests = &all[i];
+        ntests = 1;
+    }
+    optind++;
+
+    for (; ntests > 0; ntests--, tests++) {
+        char *jobs_str = strdup(jobs_list);
+        char *save = NULL;
+        char *tok;
+
+        for (tok = strtok_r(jobs_str, ",", &save); tok;
+             tok = strtok_r(NULL, ",", &save)) {
+            int jobs = atoi(tok);
+            int i;
+
+            if (jobs <= 0 || jobs > MAX_JOBS) {
+                fprintf(stderr, "adb_bench: jobs must be 1 to %d\n", MAX_JOBS);
+                exit(1);
+            }
+
+            /* the latency test doesn't move any data */
+            if (!strcmp(*tests, "latency")) {
+                failed |= run(*tests, 0, jobs);
+                continue;
+            }
+            if (optind == argc) {
+                failed |= run(*tests, 1024 * 1024, jobs);
+                continue;
+            }
+            for (i = optind; i < argc; i++)
+                failed |= run(*tests, parse_size(argv[i]), jobs);
+        }
+        free(jobs_str);
+    }
+
+    cleanup();
+    return failed ? 1 : 0;
+}
@@ -27,12 +27,24 @@ typedef struct {
     int fd;
 } backup_harvest_params;
 
+// Room for 'bu' to keep writing (or adbd to keep reading, for a restore)
+// while the other end waits on the transport; the default is ~200K.
+#define BACKUP_SOCKET_BUFSIZE (1024 * 1024)
+
 // socketpair but do *not* mark as close_on_exec
 static int backup_socketpair(int sv[2]) {
     int rc = unix_socketpair( AF_UNIX, SOCK_STREAM, 0, sv );
+    int bufsize = BACKUP_SOCKET_BUFSIZE;
+    int i;
+
     if (rc < 0)
         return -1;
 
+    // best effort: the kernel caps these at net.core.[rw]mem_max
+    for (i = 0; i < 2; i++) {
+        setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+        adb_socket_setbufsize(sv[i], bufsize);
+    }
     return 0;
 }
 
@@ -25,6 +25,9 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include <assert.h>
+#ifdef HAVE_FORKEXEC
+#include <sys/wait.h>
+#endif
 
 #include "sysdeps.h"
 
@@ -36,6 +39,7 @@
 #include "adb.h"
 #include "adb_client.h"
 #include "file_sync_service.h"
+#include "shell_service.h"
 
 static int do_cmd(transport_type ttype, char* serial, char *cmd, ...);
 
@@ -88,7 +92,9 @@ void help()
         "                                 returns an error if more than one emulator is running.\n"
         " -s <specific device>          - directs command to the device or emulator with the given\n"
         "                                 serial number or qualifier. Overrides ANDROID_SERIAL\n"
-        "                                 environment variable.\n"
+        "                                 environment variable. push and install also accept\n"
+        "                                 a comma separated list of serial numbers.\n"
+        " --all                         - directs push or install to every connected device.\n"
         " -p <product name or path>     - simple product name like 'sooner', or\n"
         "                                 a relative/absolute path to a product\n"
         "                                 out directory like 'out/target/product/sooner'.\n"
@@ -114,6 +120,8 @@ void help()
         "                                 (see 'adb help all')\n"
         "  adb shell                    - run remote shell interactively\n"
         "  adb shell <command>          - run remote shell command\n"
+        "  adb shell-batch              - run the remote shell commands read from\n"
+        "                                 stdin, one per line, over one connection\n"
         "  adb emu <command>            - run emulator console command\n"
         "  adb logcat [ <filter-spec> ] - View device log\n"
         "  adb forward --list           - list all forward socket connections.\n"
@@ -203,6 +211,8 @@ void help()
         "                                 1 or all, adb, sockets, packets, rwx, usb, sync, sysdeps, transport, jdwp\n"
         "  ANDROID_SERIAL               - The serial number to connect to. -s takes priority over this if given.\n"
         "  ANDROID_LOG_TAGS             - When used with the logcat option, only these debug tags are printed.\n"
+        "  ADB_COMPRESS                 - If set to 1 when the server starts, compress stream data for devices\n"
+        "                                 that support it.\n"
         );
 }
 
@@ -261,15 +271,242 @@ static void read_and_dump(int fd)
     }
 }
 
-static void copy_to_file(int inFd, int outFd) {
-    const size_t BUFSIZE = 32 * 1024;
-    char* buf = (char*) malloc(BUFSIZE);
-    int len;
+/* Runs each line of stdin as a command over one "shell-server:" stream.
+** Returns the exit code of the last command which failed, or 0.
+*/
+static int shell_batch()
+{
+    char *cmd = malloc(SHELL_COMMAND_MAX + 2);
+    char *buf = malloc(SHELL_DATA_MAX);
+    int ret = 0;
+    shmsg msg;
+    int fd;
+
+    if(cmd == NULL || buf == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        free(cmd);
+        free(buf);
+        return 1;
+    }
+
+    fd = adb_connect("shell-server:");
+    if(fd < 0) {
+        fprintf(stderr,"error: %s\n", adb_error());
+        free(cmd);
+        free(buf);
+        return 1;
+    }
+
+    while(fgets(cmd, SHELL_COMMAND_MAX + 2, stdin) != NULL) {
+        size_t len = strlen(cmd);
+        int done = 0;
+
+        if(len > 0 && cmd[len - 1] == '\n') {
+            cmd[--len] = 0;
+        } else if(len > SHELL_COMMAND_MAX) {
+            fprintf(stderr, "error: command longer than %d bytes\n",
+                    SHELL_COMMAND_MAX);
+            ret = 1;
+            break;
+        }
+        if(len == 0) continue;
+
+        msg.id = htoll(ID_EXEC);
+        msg.len = htoll(len);
+        if(writex(fd, &msg, sizeof(msg)) || writex(fd, cmd, len)) {
+            fprintf(stderr, "error: connection to the device lost\n");
+            ret = 1;
+            break;
+        }
+
+        while(!done) {
+            unsigned id, n;
+
+            if(readx(fd, &msg, sizeof(msg))) {
+                break;
+            }
+            id = ltohl(msg.id);
+            n = ltohl(msg.len);
+            if(id == ID_EXIT) {
+                /* the device's wait() status, whatever the host's is */
+                if(n & 0x7f) {
+                    ret = 128 + (n & 0x7f);
+                } else if((n >> 8) & 0xff) {
+                    ret = (n >> 8) & 0xff;
+                }
+                done = 1;
+            } else if((id == ID_SOUT || id == ID_SERR) && n <= SHELL_DATA_MAX) {
+                if(readx(fd, buf, n)) break;
+                fwrite(buf, 1, n, id == ID_SOUT ? stdout : stderr);
+            } else {
+                break;
+            }
+        }
+        fflush(stdout);
+        if(!done) {
+            fprintf(stderr, "error: connection to the device lost\n");
+            ret = 1;
+            break;
+        }
+    }
+
+    msg.id = htoll(ID_QUIT);
+    msg.len = 0;
+    writex(fd, &msg, sizeof(msg));
+    adb_close(fd);
+    free(cmd);
+    free(buf);
+    return ret;
+}
+
+static int write_fully(int fd, const char* buf, int len) {
+    while (len > 0) {
+        int n = adb_write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+#define COPY_BUFSIZE (256 * 1024)
+
+#ifndef _WIN32
+
+/* backup and restore move gigabytes, so the reads from one side and
+** the writes to the other are done on two threads: the transport keeps
+** streaming while the disk (or the device) catches up, with up to
+** COPY_BUFFERS chunks in flight.
+*/
+#define COPY_BUFFERS 4
+
+typedef struct {
+    int outFd;
+    char* buf[COPY_BUFFERS];
+    int len[COPY_BUFFERS];
+    int count;          /* filled buffers, starting at first */
+    int first;
+    int eof;            /* the reader is done */
+    int failed;         /* a write failed, stop reading */
+    adb_mutex_t lock;
+    adb_cond_t cond;
+} copy_state;
+
+static void* copy_writer_thread(void* arg) {
+    copy_state* cs = (copy_state*) arg;
+    int i, len;
+
+    adb_mutex_lock(&cs->lock);
+    for (;;) {
+        while (cs->count == 0 && !cs->eof)
+            adb_cond_wait(&cs->cond, &cs->lock);
+        if (cs->count == 0)
+            break;
+        i = cs->first;
+        len = cs->len[i];
+        adb_mutex_unlock(&cs->lock);
+
+        if (write_fully(cs->outFd, cs->buf[i], len)) {
+            D("copy_to_file() : write error %d\n", errno);
+            adb_mutex_lock(&cs->lock);
+            cs->failed = 1;
+            adb_cond_broadcast(&cs->cond);
+            break;
+        }
+
+        adb_mutex_lock(&cs->lock);
+        cs->first = (cs->first + 1) % COPY_BUFFERS;
+        cs->count--;
+        adb_cond_broadcast(&cs->cond);
+    }
+    adb_mutex_unlock(&cs->lock);
+    return NULL;
+}
+
+static int copy_to_file(int inFd, int outFd) {
+    copy_state cs;
+    pthread_t thr;
+    int i, len, ret;
+    long total = 0;
+
+    memset(&cs, 0, sizeof(cs));
+    cs.outFd = outFd;
+    for (i = 0; i < COPY_BUFFERS; i++) {
+        cs.buf[i] = (char*) malloc(COPY_BUFSIZE);
+        if (cs.buf[i] == NULL) {
+            while (i-- > 0) free(cs.buf[i]);
+            return -1;
+        }
+    }
+    adb_mutex_init(&cs.lock, NULL);
+    adb_cond_init(&cs.cond, NULL);
+
+    D("copy_to_file(%d -> %d)\n", inFd, outFd);
+    /* not adb_thread_create(): that one can't be joined */
+    if (pthread_create(&thr, NULL, copy_writer_thread, &cs)) {
+        ret = -1;
+        goto done;
+    }
+
+    adb_mutex_lock(&cs.lock);
+    for (;;) {
+        while (cs.count == COPY_BUFFERS && !cs.failed)
+            adb_cond_wait(&cs.cond, &cs.lock);
+        if (cs.failed)
+            break;
+        i = (cs.first + cs.count) % COPY_BUFFERS;
+        adb_mutex_unlock(&cs.lock);
+
+        len = adb_read(inFd, cs.buf[i], COPY_BUFSIZE);
+
+        adb_mutex_lock(&cs.lock);
+        if (len == 0) {
+            D("copy_to_file() : read 0 bytes; exiting\n");
+            break;
+        }
+        if (len < 0) {
+            if (errno == EINTR) {
+                D("copy_to_file() : EINTR, retrying\n");
+                continue;
+            }
+            D("copy_to_file() : error %d\n", errno);
+            break;
+        }
+        cs.len[i] = len;
+        cs.count++;
+        total += len;
+        adb_cond_broadcast(&cs.cond);
+    }
+    cs.eof = 1;
+    adb_cond_broadcast(&cs.cond);
+    adb_mutex_unlock(&cs.lock);
+
+    pthread_join(thr, NULL);
+    ret = cs.failed ? -1 : 0;
+    D("copy_to_file() finished after %lu bytes\n", total);
+
+done:
+    adb_cond_destroy(&cs.cond);
+    adb_mutex_destroy(&cs.lock);
+    for (i = 0; i < COPY_BUFFERS; i++) free(cs.buf[i]);
+    return ret;
+}
+
+#else /* _WIN32 */
+
+static int copy_to_file(int inFd, int outFd) {
+    char* buf = (char*) malloc(COPY_BUFSIZE);
+    int len, ret = 0;
     long total = 0;
 
+    if (buf == NULL) return -1;
+
     D("copy_to_file(%d -> %d)\n", inFd, outFd);
     for (;;) {
-        len = adb_read(inFd, buf, BUFSIZE);
+        len = adb_read(inFd, buf, COPY_BUFSIZE);
         if (len == 0) {
             D("copy_to_file() : read 0 bytes; exiting\n");
             break;
@@ -282,13 +519,19 @@ static void copy_to_file(int inFd, int outFd) {
             D("copy_to_file() : error %d\n", errno);
             break;
         }
-        adb_write(outFd, buf, len);
+        if (write_fully(outFd, buf, len)) {
+            ret = -1;
+            break;
+        }
         total += len;
     }
     D("copy_to_file() finished after %lu bytes\n", total);
     free(buf);
+    return ret;
 }
 
+#endif /* _WIN32 */
+
 static void *stdin_read_thread(void *x)
 {
     int fd, fdi;
@@ -700,7 +943,7 @@ static int backup(int argc, char** argv) {
     char buf[4096];
     char default_name[32];
     const char* filename = strcpy(default_name, "./backup.ab");
-    int fd, outFd;
+    int fd, outFd, ret;
     int i, j;
 
     /* find, extract, and use any -f argument */
@@ -745,16 +988,19 @@ static int backup(int argc, char** argv) {
     }
 
     printf("Now unlock your device and confirm the backup operation.\n");
-    copy_to_file(fd, outFd);
+    ret = copy_to_file(fd, outFd);
+    if (ret) {
+        fprintf(stderr, "adb: error writing %s: %s\n", filename, strerror(errno));
+    }
 
     adb_close(fd);
     adb_close(outFd);
-    return 0;
+    return ret;
 }
 
 static int restore(int argc, char** argv) {
     const char* filename;
-    int fd, tarFd;
+    int fd, tarFd, ret;
 
     if (argc != 2) return usage();
 
@@ -773,11 +1019,14 @@ static int restore(int argc, char** argv) {
     }
 
     printf("Now unlock your device and confirm the restore operation.\n");
-    copy_to_file(tarFd, fd);
+    ret = copy_to_file(tarFd, fd);
+    if (ret) {
+        fprintf(stderr, "adb: restore stopped by the device: %s\n", strerror(errno));
+    }
 
     adb_close(fd);
     adb_close(tarFd);
-    return 0;
+    return ret;
 }
 
 #define SENTINEL_FILE "config" OS_PATH_SEPARATOR_STR "envsetup.make"
@@ -921,6 +1170,126 @@ static const char *find_product_out_path(const char *hint)
     return path_buf;
 }
 
+/* push and install can be sent to several devices at once, named with
+** "-s serial1,serial2,..." or "--all".  Local files are mapped once up
+** front and every device is then served by its own process, so the
+** data is read from disk a single time no matter how many devices.
+*/
+#define MAX_FANOUT_DEVICES 256
+
+static int collect_all_serials(char **serials, int max)
+{
+    char *devices, *line, *tab, *next;
+    int count = 0;
+
+    devices = adb_query("host:devices");
+    if (devices == NULL) {
+        fprintf(stderr, "error: %s\n", adb_error());
+        return -1;
+    }
+    for (line = devices; line && *line && count < max; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = 0;
+        tab = strchr(line, '\t');
+        if (tab == NULL) continue;
+        *tab++ = 0;
+        if (!strcmp(tab, "device")) {
+            serials[count++] = strdup(line);
+        }
+    }
+    free(devices);
+    return count;
+}
+
+static int split_serials(const char *list, char **serials, int max)
+{
+    char *copy = strdup(list);
+    char *save = NULL;
+    char *serial;
+    int count = 0;
+
+    for (serial = adb_strtok_r(copy, ",", &save);
+         serial && count < max;
+         serial = adb_strtok_r(NULL, ",", &save)) {
+        serials[count++] = serial;
+    }
+    return count;
+}
+
+static int run_on_device(transport_type ttype, char *serial, int argc, char **argv)
+{
+    adb_set_transport(ttype, serial);
+    if (!strcmp(argv[0], "push")) {
+        return do_sync_push(argv[1], argv[2], 0 /* no verify APK */);
+    }
+    return install_app(ttype, serial, argc, argv);
+}
+
+static int fan_out(transport_type ttype, char **serials, int count,
+                   int argc, char **argv)
+{
+    int failed = 0;
+    int i;
+
+    if (strcmp(argv[0], "push") && strcmp(argv[0], "install")) {
+        fprintf(stderr, "error: only push and install can target several devices\n");
+        return 1;
+    }
+    if (!strcmp(argv[0], "push") ? argc != 3 : argc < 2) {
+        return usage();
+    }
+    if (count <= 0) {
+        fprintf(stderr, "error: no devices found\n");
+        return 1;
+    }
+
+        /* only regular files are preloaded; directories and anything
+        ** that is not a local path are left to the normal code paths
+        */
+    for (i = 1; i < argc; i++) {
+        sync_preload_file(argv[i]);
+    }
+
+#ifdef HAVE_FORKEXEC
+    pid_t pids[MAX_FANOUT_DEVICES];
+
+    for (i = 0; i < count; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            exit(run_on_device(ttype, serials[i], argc, argv));
+        }
+        if (pids[i] < 0) {
+            fprintf(stderr, "%s: cannot fork: %s\n", serials[i], strerror(errno));
+        }
+    }
+    for (i = 0; i < count; i++) {
+        int status = -1;
+
+        if (pids[i] > 0) {
+            while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR)
+                ;
+        }
+        if (pids[i] > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            fprintf(stderr, "%s: OK\n", serials[i]);
+        } else {
+            fprintf(stderr, "%s: FAILED\n", serials[i]);
+            failed++;
+        }
+    }
+#else
+    for (i = 0; i < count; i++) {
+        if (run_on_device(ttype, serials[i], argc, argv)) {
+            fprintf(stderr, "%s: FAILED\n", serials[i]);
+            failed++;
+        } else {
+            fprintf(stderr, "%s: OK\n", serials[i]);
+        }
+    }
+#endif
+
+    return failed ? 1 : 0;
+}
+
 int adb_commandline(int argc, char **argv)
 {
     char buf[4096];
@@ -933,6 +1302,7 @@ int adb_commandline(int argc, char **argv)
     transport_type ttype = kTransportAny;
     char* serial = NULL;
     char* server_port_str = NULL;
+    int all_devices = 0;
 
         /* If defined, this should be an absolute path to
          * the directory containing all of the various system images
@@ -997,6 +1367,8 @@ int adb_commandline(int argc, char **argv)
                 argc--;
                 argv++;
             }
+        } else if (!strcmp(argv[0],"--all")) {
+            all_devices = 1;
         } else if (!strcmp(argv[0],"-d")) {
             ttype = kTransportUsb;
         } else if (!strcmp(argv[0],"-e")) {
@@ -1065,6 +1437,19 @@ top:
         return usage();
     }
 
+    if (all_devices || (serial && strchr(serial, ','))) {
+        char *serials[MAX_FANOUT_DEVICES];
+        int count;
+
+        if (all_devices) {
+            count = collect_all_serials(serials, MAX_FANOUT_DEVICES);
+        } else {
+            count = split_serials(serial, serials, MAX_FANOUT_DEVICES);
+        }
+        if (count < 0) return 1;
+        return fan_out(ttype, serials, count, argc, argv);
+    }
+
     /* adb_connect() commands */
 
     if(!strcmp(argv[0], "devices")) {
@@ -1129,6 +1514,11 @@ top:
         return adb_send_emulator_command(argc, argv);
     }
 
+    if(!strcmp(argv[0], "shell-batch")) {
+        if(argc != 1) return usage();
+        return shell_batch();
+    }
+
     if(!strcmp(argv[0], "shell") || !strcmp(argv[0], "hell")) {
         int r;
         int fd;
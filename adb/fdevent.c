@@ -27,6 +27,7 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <sys/time.h>
 
 #include "fdevent.h"
 #include "transport.h"
@@ -88,6 +89,8 @@ static void dump_fde(fdevent *fde, const char *info)
 #define FDE_ACTIVE     0x0100
 #define FDE_PENDING    0x0200
 #define FDE_CREATED    0x0400
+#define FDE_IN_SET     0x0800   /* registered with the backend */
+#define FDE_POLLED     0x1000   /* refused by epoll, watched with poll() */
 
 static void fdevent_plist_enqueue(fdevent *node);
 static void fdevent_plist_remove(fdevent *node);
@@ -102,17 +105,39 @@ static fdevent list_pending = {
 static fdevent **fd_table = 0;
 static int fd_table_max = 0;
 
-#ifdef CRAPTASTIC
-//HAVE_EPOLL
+/* Loop counters, see fdevent_get_stats(). Latency is measured from
+** the moment the backend returns with events until each callback runs,
+** so it grows when one busy callback holds up everybody queued behind it.
+*/
+static struct fdevent_stats stats;
+static int64_t wakeup_us;
+
+static int64_t fdevent_now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
+#if defined(HAVE_EPOLL) || defined(__linux__)
+
+#include <poll.h>
 #include <sys/epoll.h>
 
+#define FDEVENT_BACKEND "epoll"
+#define FDEVENT_MAX_EVENTS 256
+
 static int epoll_fd = -1;
 
+/* fds epoll will not take (regular files, for one) are polled
+** alongside the epoll fd instead; see fdevent_wait_polled()
+*/
+static int polled_count = 0;
+
 static void fdevent_init()
 {
-        /* XXX: what's a good size for the passed in hint? */
-    epoll_fd = epoll_create(256);
+        /* the size is only a hint on current kernels */
+    epoll_fd = epoll_create(FDEVENT_MAX_EVENTS);
 
     if(epoll_fd < 0) {
         perror("epoll_create() failed");
@@ -125,24 +150,20 @@ static void fdevent_init()
 
 static void fdevent_connect(fdevent *fde)
 {
-    struct epoll_event ev;
-
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
-
-#if 0
-    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-        perror("epoll_ctl() failed\n");
-        exit(1);
-    }
-#endif
+        /* nothing to do until events are requested: the fd is
+        ** added to the epoll set by the first fdevent_update()
+        */
 }
 
 static void fdevent_disconnect(fdevent *fde)
 {
     struct epoll_event ev;
 
+    if(fde->state & FDE_POLLED) {
+        polled_count--;
+        return;
+    }
+
     memset(&ev, 0, sizeof(ev));
     ev.events = 0;
     ev.data.ptr = fde;
@@ -158,9 +179,7 @@ static void fdevent_disconnect(fdevent *fde)
 static void fdevent_update(fdevent *fde, unsigned events)
 {
     struct epoll_event ev;
-    int active;
-
-    active = (fde->state & FDE_EVENTMASK) != 0;
+    int op, rc;
 
     memset(&ev, 0, sizeof(ev));
     ev.events = 0;
@@ -172,48 +191,135 @@ static void fdevent_update(fdevent *fde, unsigned events)
 
     fde->state = (fde->state & FDE_STATEMASK) | events;
 
-    if(active) {
-            /* we're already active. if we're changing to *no*
-            ** events being monitored, we need to delete, otherwise
-            ** we need to just modify
+        /* fdevent_wait_polled() looks at the state on every pass */
+    if(fde->state & FDE_POLLED) return;
+
+    if(ev.events) {
+        op = (fde->state & FDE_IN_SET) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    } else if(fde->state & FDE_IN_SET) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        return;
+    }
+
+    rc = epoll_ctl(epoll_fd, op, fde->fd, &ev);
+    if(rc < 0) {
+            /* our idea of the set can be wrong when an fd was closed
+            ** and reused behind our back (the kernel drops it from the
+            ** set), or is still open elsewhere (it stays), so try the
+            ** other operation before giving up
             */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        } else {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
+        if(op == EPOLL_CTL_MOD && errno == ENOENT) {
+            op = EPOLL_CTL_ADD;
+            rc = epoll_ctl(epoll_fd, op, fde->fd, &ev);
+        } else if(op == EPOLL_CTL_ADD && errno == EEXIST) {
+            op = EPOLL_CTL_MOD;
+            rc = epoll_ctl(epoll_fd, op, fde->fd, &ev);
+        } else if(op == EPOLL_CTL_DEL && errno == ENOENT) {
+            rc = 0;
+        }
+    }
+    if(rc < 0) {
+        if(errno == EPERM) {
+                /* the fd doesn't support polling through epoll */
+            D("fd %d can't be watched with epoll, using poll\n", fde->fd);
+            fde->state = (fde->state & ~FDE_IN_SET) | FDE_POLLED;
+            polled_count++;
+            return;
+        }
+        if(errno == EBADF) {
+                /* closed under us; whoever owns it will remove it */
+            D("fd %d is no longer open\n", fde->fd);
+            fde->state &= ~FDE_IN_SET;
+            return;
         }
+        FATAL("epoll_ctl(%d) failed for fd %d: %s\n", op, fde->fd,
+              strerror(errno));
+    }
+
+    if(op == EPOLL_CTL_DEL) {
+        fde->state &= ~FDE_IN_SET;
     } else {
-            /* we're not active.  if we're watching events, we need
-            ** to add, otherwise we can just do nothing
-            */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
+        fde->state |= FDE_IN_SET;
+    }
+}
+
+    /* waits on the epoll fd together with the fds epoll refused, queues
+    ** those directly, and returns what epoll_wait() would
+    */
+static int fdevent_wait_polled(struct epoll_event *events)
+{
+    static struct pollfd *pfds = 0;
+    static int pfds_max = 0;
+    fdevent *fde;
+    int i, n = 1;
+
+    if(pfds_max < polled_count + 1) {
+        pfds_max = polled_count + 1;
+        pfds = realloc(pfds, sizeof(struct pollfd) * pfds_max);
+        if(pfds == 0) {
+            FATAL("could not expand poll set to %d entries\n", pfds_max);
         }
     }
+
+    pfds[0].fd = epoll_fd;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    for(i = 0; i < fd_table_max && n <= polled_count; i++) {
+        fde = fd_table[i];
+        if(fde == 0 || !(fde->state & FDE_POLLED)) continue;
+        pfds[n].fd = fde->fd;
+        pfds[n].events = 0;
+        pfds[n].revents = 0;
+        if(fde->state & FDE_READ) pfds[n].events |= POLLIN;
+        if(fde->state & FDE_WRITE) pfds[n].events |= POLLOUT;
+            /* poll() ignores negative fds, like epoll does empty masks */
+        if(!(fde->state & (FDE_READ | FDE_WRITE | FDE_ERROR))) pfds[n].fd = -1;
+        n++;
+    }
+
+    if(poll(pfds, n, -1) < 0) return -1;
+
+    for(i = 1; i < n; i++) {
+        if(pfds[i].fd < 0 || pfds[i].revents == 0) continue;
+        fde = fd_table[pfds[i].fd];
+        if(pfds[i].revents & POLLIN) {
+            fde->events |= FDE_READ;
+        }
+        if(pfds[i].revents & POLLOUT) {
+            fde->events |= FDE_WRITE;
+        }
+        if(pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            fde->events |= FDE_ERROR;
+        }
+        if(fde->events && !(fde->state & FDE_PENDING)) {
+            fde->state |= FDE_PENDING;
+            fdevent_plist_enqueue(fde);
+        }
+    }
+
+    if(!(pfds[0].revents & POLLIN)) return 0;
+    return epoll_wait(epoll_fd, events, FDEVENT_MAX_EVENTS, 0);
 }
 
 static void fdevent_process()
 {
-    struct epoll_event events[256];
+    struct epoll_event events[FDEVENT_MAX_EVENTS];
     fdevent *fde;
     int i, n;
 
-    n = epoll_wait(epoll_fd, events, 256, -1);
+    if(polled_count) {
+        n = fdevent_wait_polled(events);
+    } else {
+        n = epoll_wait(epoll_fd, events, FDEVENT_MAX_EVENTS, -1);
+    }
 
     if(n < 0) {
         if(errno == EINTR) return;
         perror("epoll_wait");
         exit(1);
     }
+    wakeup_us = fdevent_now_us();
 
     for(i = 0; i < n; i++) {
         struct epoll_event *ev = events + i;
@@ -236,6 +342,112 @@ static void fdevent_process()
     }
 }
 
+#elif defined(__APPLE__)
+
+#include <sys/types.h>
+#include <sys/event.h>
+
+#define FDEVENT_BACKEND "kqueue"
+#define FDEVENT_MAX_EVENTS 256
+
+static int kqueue_fd = -1;
+
+static void fdevent_init()
+{
+    kqueue_fd = kqueue();
+
+    if(kqueue_fd < 0) {
+        perror("kqueue() failed");
+        exit(1);
+    }
+
+        /* mark for close-on-exec */
+    fcntl(kqueue_fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void fdevent_connect(fdevent *fde)
+{
+}
+
+static void fdevent_disconnect(fdevent *fde)
+{
+        /* closing the fd drops its filters, but the fd may be
+        ** marked FDE_DONT_CLOSE, so delete them explicitly
+        */
+    fdevent_update(fde, 0);
+}
+
+/* kqueue has no separate error filter: errors and EOF are reported on
+** the read and write filters, much like select() where the exception
+** set practically never fires on its own.
+*/
+static void fdevent_update(fdevent *fde, unsigned events)
+{
+    struct kevent changes[2];
+    unsigned old = fde->state & FDE_EVENTMASK;
+    int want_read = (events & FDE_READ) != 0;
+    int had_read = (old & FDE_READ) != 0;
+    int want_write = (events & FDE_WRITE) != 0;
+    int had_write = (old & FDE_WRITE) != 0;
+    int n = 0;
+
+    if(want_read != had_read) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_READ,
+               want_read ? EV_ADD : EV_DELETE, 0, 0, fde);
+    }
+    if(want_write != had_write) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_WRITE,
+               want_write ? EV_ADD : EV_DELETE, 0, 0, fde);
+    }
+
+    fde->state = (fde->state & FDE_STATEMASK) | events;
+
+    if(n > 0 && kevent(kqueue_fd, changes, n, NULL, 0, NULL) < 0) {
+            /* deleting a filter the kernel already dropped is harmless */
+        if(events != 0 || errno != ENOENT) {
+            perror("kevent() failed\n");
+            exit(1);
+        }
+    }
+}
+
+static void fdevent_process()
+{
+    struct kevent events[FDEVENT_MAX_EVENTS];
+    fdevent *fde;
+    int i, n;
+
+    n = kevent(kqueue_fd, NULL, 0, events, FDEVENT_MAX_EVENTS, NULL);
+
+    if(n < 0) {
+        if(errno == EINTR) return;
+        perror("kevent");
+        exit(1);
+    }
+    wakeup_us = fdevent_now_us();
+
+    for(i = 0; i < n; i++) {
+        struct kevent *ev = events + i;
+        fde = ev->udata;
+
+        if(ev->flags & EV_ERROR) {
+            fde->events |= FDE_ERROR;
+        } else if(ev->filter == EVFILT_READ) {
+            fde->events |= FDE_READ;
+        } else if(ev->filter == EVFILT_WRITE) {
+            fde->events |= FDE_WRITE;
+        }
+        if((ev->flags & EV_EOF) && (fde->state & FDE_ERROR)) {
+            fde->events |= FDE_ERROR;
+        }
+        if(fde->events) {
+            if(fde->state & FDE_PENDING) continue;
+            fde->state |= FDE_PENDING;
+            fdevent_plist_enqueue(fde);
+        }
+    }
+}
+
 #else /* USE_SELECT */
 
 #ifdef HAVE_WINSOCK
@@ -244,6 +456,8 @@ static void fdevent_process()
 #include <sys/select.h>
 #endif
 
+#define FDEVENT_BACKEND "select"
+
 static fd_set read_fds;
 static fd_set write_fds;
 static fd_set error_fds;
@@ -378,6 +592,7 @@ static void fdevent_process()
     n = select(select_n, &rfd, &wfd, &efd, NULL);
     int saved_errno = errno;
     D("select() returned n=%d, errno=%d\n", n, n<0?saved_errno:0);
+    wakeup_us = fdevent_now_us();
 
     dump_all_fds("post select()");
 
@@ -447,7 +662,7 @@ static void fdevent_register(fdevent *fde)
         if(fd_table == 0) {
             FATAL("could not expand fd_table to %d entries\n", fd_table_max);
         }
-        memset(fd_table + oldmax, 0, sizeof(int) * (fd_table_max - oldmax));
+        memset(fd_table + oldmax, 0, sizeof(fdevent*) * (fd_table_max - oldmax));
     }
 
     fd_table[fde->fd] = fde;
@@ -511,6 +726,14 @@ static void fdevent_call_fdfunc(fdevent* fde)
     if(!(fde->state & FDE_PENDING)) return;
     fde->state &= (~FDE_PENDING);
     dump_fde(fde, "callback");
+    if(wakeup_us) {
+        int64_t latency = fdevent_now_us() - wakeup_us;
+        stats.events_dispatched++;
+        stats.total_latency_us += latency;
+        if(latency > stats.max_latency_us) {
+            stats.max_latency_us = latency;
+        }
+    }
     fde->func(fde->fd, events, fde->arg);
 }
 
@@ -687,9 +910,16 @@ void fdevent_loop()
         D("--- ---- waiting for events\n");
 
         fdevent_process();
+        stats.loop_iterations++;
 
         while((fde = fdevent_plist_dequeue())) {
             fdevent_call_fdfunc(fde);
         }
     }
 }
+
+void fdevent_get_stats(struct fdevent_stats *out)
+{
+    *out = stats;
+    out->backend = FDEVENT_BACKEND;
+}
@@ -64,6 +64,22 @@ void fdevent_set_timeout(fdevent *fde, int64_t  timeout_ms);
 */
 void fdevent_loop();
 
+/* Counters maintained by fdevent_loop(). Latencies are the time
+** between the poll returning and the callback for an event running.
+*/
+struct fdevent_stats
+{
+    const char *backend;
+    uint64_t loop_iterations;
+    uint64_t events_dispatched;
+    int64_t total_latency_us;
+    int64_t max_latency_us;
+};
+
+/* Take a snapshot of the counters. Must be called from the loop thread.
+*/
+void fdevent_get_stats(struct fdevent_stats *stats);
+
 struct fdevent 
 {
     fdevent *next;
@@ -25,6 +25,9 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <zipfile/zipfile.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include "sysdeps.h"
 #include "adb.h"
@@ -35,6 +38,9 @@
 static unsigned long long total_bytes;
 static long long start_time;
 
+/* set when the device offers the "sync2:" service */
+static int sync_pipelined;
+
 static long long NOW()
 {
     struct timeval tv;
@@ -62,6 +68,20 @@ static void END()
             total_bytes, (t / 1000000LL), (t % 1000000LL) / 1000LL);
 }
 
+/* prefer the pipelined service, falling back to plain "sync:" for
+** devices that do not know it
+*/
+static int sync_connect(void)
+{
+    int fd = adb_connect("sync2:");
+    if(fd >= 0) {
+        sync_pipelined = 1;
+        return fd;
+    }
+    sync_pipelined = 0;
+    return adb_connect("sync:");
+}
+
 void sync_quit(int fd)
 {
     syncmsg msg;
@@ -74,10 +94,9 @@ void sync_quit(int fd)
 
 typedef void (*sync_ls_cb)(unsigned mode, unsigned size, unsigned time, const char *name, void *cookie);
 
-int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
+static int sync_start_ls(int fd, const char *path)
 {
     syncmsg msg;
-    char buf[257];
     int len;
 
     len = strlen(path);
@@ -90,6 +109,18 @@ int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
        writex(fd, path, len)) {
         goto fail;
     }
+    return 0;
+
+fail:
+    adb_close(fd);
+    return -1;
+}
+
+static int sync_finish_ls(int fd, sync_ls_cb func, void *cookie)
+{
+    syncmsg msg;
+    char buf[257];
+    int len;
 
     for(;;) {
         if(readx(fd, &msg.dent, sizeof(msg.dent))) break;
@@ -108,11 +139,17 @@ int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
              buf, cookie);
     }
 
-fail:
     adb_close(fd);
     return -1;
 }
 
+int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
+{
+    if(sync_start_ls(fd, path))
+        return -1;
+    return sync_finish_ls(fd, func, cookie);
+}
+
 typedef struct syncsendbuf syncsendbuf;
 
 struct syncsendbuf {
@@ -123,6 +160,70 @@ struct syncsendbuf {
 
 static syncsendbuf send_buffer;
 
+/* files loaded by sync_preload_file(), normally by the parent of a
+** multi-device fan-out so the children share a single copy
+*/
+#define SYNC_PRELOAD_MAX 4
+
+static struct {
+    char *path;
+    char *data;
+    int size;
+} preloaded[SYNC_PRELOAD_MAX];
+
+int sync_preload_file(const char *lpath)
+{
+    struct stat st;
+    char *data;
+    int lfd, i;
+
+    for(i = 0; i < SYNC_PRELOAD_MAX && preloaded[i].path; i++) {
+        if(!strcmp(preloaded[i].path, lpath)) return 0;
+    }
+    if(i == SYNC_PRELOAD_MAX) return -1;
+
+    if(stat(lpath, &st) || !S_ISREG(st.st_mode) || st.st_size > INT_MAX)
+        return -1;
+
+    lfd = adb_open(lpath, O_RDONLY);
+    if(lfd < 0) return -1;
+
+#ifdef _WIN32
+    data = malloc(st.st_size ? st.st_size : 1);
+    if(data == NULL || readx(lfd, data, st.st_size)) {
+        free(data);
+        adb_close(lfd);
+        return -1;
+    }
+#else
+    data = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_SHARED, lfd, 0);
+    if(data == MAP_FAILED) {
+        adb_close(lfd);
+        return -1;
+    }
+#endif
+    adb_close(lfd);
+
+    preloaded[i].path = strdup(lpath);
+    preloaded[i].data = data;
+    preloaded[i].size = st.st_size;
+    return 0;
+}
+
+static int find_preloaded(const char *lpath, char **data, int *size)
+{
+    int i;
+
+    for(i = 0; i < SYNC_PRELOAD_MAX && preloaded[i].path; i++) {
+        if(!strcmp(preloaded[i].path, lpath)) {
+            *data = preloaded[i].data;
+            *size = preloaded[i].size;
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int sync_readtime(int fd, const char *path, unsigned *timestamp)
 {
     syncmsg msg;
@@ -294,14 +395,18 @@ static int write_data_link(int fd, const char *path, syncsendbuf *sbuf)
 }
 #endif
 
-static int sync_send(int fd, const char *lpath, const char *rpath,
-                     unsigned mtime, mode_t mode, int verifyApk)
+/* writes the whole SEND request; the status is read by sync_finish_send()
+** so that several files can be in flight at once
+*/
+static int sync_start_send(int fd, const char *lpath, const char *rpath,
+                           unsigned mtime, mode_t mode, int verifyApk)
 {
     syncmsg msg;
     int len, r;
     syncsendbuf *sbuf = &send_buffer;
     char* file_buffer = NULL;
     int size = 0;
+    int preload;
     char tmp[64];
 
     len = strlen(rpath);
@@ -310,6 +415,8 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     snprintf(tmp, sizeof(tmp), ",%d", mode);
     r = strlen(tmp);
 
+    preload = find_preloaded(lpath, &file_buffer, &size);
+
     if (verifyApk) {
         int lfd;
         zipfile_t zip;
@@ -319,6 +426,8 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
         // if we are transferring an APK file, then sanity check to make sure
         // we have a real zip file that contains an AndroidManifest.xml
         // this requires that we read the entire file into memory.
+        if (preload)
+            goto verify;
         lfd = adb_open(lpath, O_RDONLY);
         if(lfd < 0) {
             fprintf(stderr,"cannot open '%s': %s\n", lpath, strerror(errno));
@@ -349,11 +458,12 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
 
         adb_close(lfd);
 
+    verify:
         zip = init_zipfile(file_buffer, size);
         if (zip == NULL) {
             fprintf(stderr, "file '%s' is not a valid zip file\n",
                     lpath);
-            free(file_buffer);
+            if (!preload) free(file_buffer);
             return 1;
         }
 
@@ -362,7 +472,7 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
         if (entry == NULL) {
             fprintf(stderr, "file '%s' does not contain AndroidManifest.xml\n",
                     lpath);
-            free(file_buffer);
+            if (!preload) free(file_buffer);
             return 1;
         }
     }
@@ -372,13 +482,13 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
 
     if(writex(fd, &msg.req, sizeof(msg.req)) ||
        writex(fd, rpath, len) || writex(fd, tmp, r)) {
-        free(file_buffer);
+        if (!preload) free(file_buffer);
         goto fail;
     }
 
     if (file_buffer) {
         write_data_buffer(fd, file_buffer, size, sbuf);
-        free(file_buffer);
+        if (!preload) free(file_buffer);
     } else if (S_ISREG(mode))
         write_data_file(fd, lpath, sbuf);
 #ifdef HAVE_SYMLINKS
@@ -393,6 +503,20 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     if(writex(fd, &msg.data, sizeof(msg.data)))
         goto fail;
 
+    return 0;
+
+fail:
+    fprintf(stderr,"protocol failure\n");
+    adb_close(fd);
+    return -1;
+}
+
+static int sync_finish_send(int fd, const char *lpath, const char *rpath)
+{
+    syncmsg msg;
+    syncsendbuf *sbuf = &send_buffer;
+    int len;
+
     if(readx(fd, &msg.status, sizeof(msg.status)))
         return -1;
 
@@ -412,11 +536,15 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     }
 
     return 0;
+}
 
-fail:
-    fprintf(stderr,"protocol failure\n");
-    adb_close(fd);
-    return -1;
+static int sync_send(int fd, const char *lpath, const char *rpath,
+                     unsigned mtime, mode_t mode, int verifyApk)
+{
+    int r = sync_start_send(fd, lpath, rpath, mtime, mode, verifyApk);
+    if(r)
+        return r;
+    return sync_finish_send(fd, lpath, rpath);
 }
 
 static int mkdirs(char *name)
@@ -438,13 +566,10 @@ static int mkdirs(char *name)
     return 0;
 }
 
-int sync_recv(int fd, const char *rpath, const char *lpath)
+static int sync_start_recv(int fd, const char *rpath)
 {
     syncmsg msg;
     int len;
-    int lfd = -1;
-    char *buffer = send_buffer.data;
-    unsigned id;
 
     len = strlen(rpath);
     if(len > 1024) return -1;
@@ -455,6 +580,16 @@ int sync_recv(int fd, const char *rpath, const char *lpath)
        writex(fd, rpath, len)) {
         return -1;
     }
+    return 0;
+}
+
+static int sync_finish_recv(int fd, const char *rpath, const char *lpath)
+{
+    syncmsg msg;
+    int len;
+    int lfd = -1;
+    char *buffer = send_buffer.data;
+    unsigned id;
 
     if(readx(fd, &msg.data, sizeof(msg.data))) {
         return -1;
@@ -527,6 +662,13 @@ remote_error:
     return 0;
 }
 
+int sync_recv(int fd, const char *rpath, const char *lpath)
+{
+    if(sync_start_recv(fd, rpath))
+        return -1;
+    return sync_finish_recv(fd, rpath, lpath);
+}
+
 
 
 /* --- */
@@ -540,7 +682,7 @@ static void do_sync_ls_cb(unsigned mode, unsigned size, unsigned time,
 
 int do_sync_ls(const char *path)
 {
-    int fd = adb_connect("sync:");
+    int fd = sync_connect();
     if(fd < 0) {
         fprintf(stderr,"error: %s\n", adb_error());
         return 1;
@@ -671,10 +813,68 @@ static int local_build_list(copyinfo **filelist,
 }
 
 
+static void check_timestamp(copyinfo *ci, unsigned int timestamp,
+                            unsigned int mode, unsigned int size)
+{
+    if(size == ci->size) {
+        /* for links, we cannot update the atime/mtime */
+        if((S_ISREG(ci->mode & mode) && timestamp == ci->time) ||
+            (S_ISLNK(ci->mode & mode) && timestamp >= ci->time))
+            ci->flag = 1;
+    }
+}
+
+/* checks the remote timestamps of up to SYNC_STAT_BATCH_MAX entries
+** starting at first with a single ID_STAB round trip, and returns the
+** first entry that was not covered in *rest
+*/
+static int sync_check_timestamps_batch(int fd, copyinfo *first, copyinfo **rest)
+{
+    syncmsg msg;
+    char *buf = send_buffer.data;
+    copyinfo *ci;
+    unsigned count = 0;
+    unsigned len = 0;
+    unsigned n;
+
+    for(ci = first; ci != 0 && count < SYNC_STAT_BATCH_MAX; ci = ci->next) {
+        unsigned l = strlen(ci->dst) + 1;
+        if(len + l > SYNC_DATA_MAX) break;
+        memcpy(buf + len, ci->dst, l);
+        len += l;
+        count++;
+    }
+    *rest = ci;
+
+    msg.req.id = ID_STAB;
+    msg.req.namelen = htoll(len);
+    if(writex(fd, &msg.req, sizeof(msg.req)) ||
+       writex(fd, buf, len)) {
+        return -1;
+    }
+
+    if(readx(fd, &msg.req, sizeof(msg.req)))
+        return -1;
+    if(msg.req.id != ID_STAB || ltohl(msg.req.namelen) != count)
+        return -1;
+
+    for(ci = first, n = 0; n < count; ci = ci->next, n++) {
+        if(readx(fd, &msg.stat, sizeof(msg.stat)))
+            return -1;
+        if(msg.stat.id != ID_STAT)
+            return -1;
+        check_timestamp(ci, ltohl(msg.stat.time), ltohl(msg.stat.mode),
+                        ltohl(msg.stat.size));
+    }
+    return 0;
+}
+
 static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, int checktimestamps, int listonly)
 {
     copyinfo *filelist = 0;
     copyinfo *ci, *next;
+    copyinfo *inflight[SYNC_PIPELINE_DEPTH];
+    int head, count;
     int pushed = 0;
     int skipped = 0;
 
@@ -698,7 +898,12 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
         return -1;
     }
 
-    if(checktimestamps){
+    if(checktimestamps && sync_pipelined){
+        for(ci = filelist; ci != 0; ) {
+            if(sync_check_timestamps_batch(fd, ci, &ci))
+                return 1;
+        }
+    } else if(checktimestamps){
         for(ci = filelist; ci != 0; ci = ci->next) {
             if(sync_start_readtime(fd, ci->dst)) {
                 return 1;
@@ -708,27 +913,48 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
             unsigned int timestamp, mode, size;
             if(sync_finish_readtime(fd, &timestamp, &mode, &size))
                 return 1;
-            if(size == ci->size) {
-                /* for links, we cannot update the atime/mtime */
-                if((S_ISREG(ci->mode & mode) && timestamp == ci->time) ||
-                    (S_ISLNK(ci->mode & mode) && timestamp >= ci->time))
-                    ci->flag = 1;
-            }
+            check_timestamp(ci, timestamp, mode, size);
         }
     }
+        /* keep up to SYNC_PIPELINE_DEPTH files in flight, collecting
+        ** their statuses in order
+        */
+    head = 0;
+    count = 0;
     for(ci = filelist; ci != 0; ci = next) {
         next = ci->next;
         if(ci->flag == 0) {
             fprintf(stderr,"%spush: %s -> %s\n", listonly ? "would " : "", ci->src, ci->dst);
-            if(!listonly &&
-               sync_send(fd, ci->src, ci->dst, ci->time, ci->mode, 0 /* no verify APK */)){
-                return 1;
+            if(!listonly) {
+                if(sync_start_send(fd, ci->src, ci->dst, ci->time, ci->mode,
+                                   0 /* no verify APK */)) {
+                    return 1;
+                }
+                inflight[(head + count++) % SYNC_PIPELINE_DEPTH] = ci;
+                if(count == SYNC_PIPELINE_DEPTH) {
+                    copyinfo *done = inflight[head];
+                    head = (head + 1) % SYNC_PIPELINE_DEPTH;
+                    count--;
+                    if(sync_finish_send(fd, done->src, done->dst))
+                        return 1;
+                    free(done);
+                }
+            } else {
+                free(ci);
             }
             pushed++;
         } else {
             skipped++;
+            free(ci);
         }
-        free(ci);
+    }
+    while(count > 0) {
+        copyinfo *done = inflight[head];
+        head = (head + 1) % SYNC_PIPELINE_DEPTH;
+        count--;
+        if(sync_finish_send(fd, done->src, done->dst))
+            return 1;
+        free(done);
     }
 
     fprintf(stderr,"%d file%s pushed. %d file%s skipped.\n",
@@ -745,7 +971,7 @@ int do_sync_push(const char *lpath, const char *rpath, int verifyApk)
     unsigned mode;
     int fd;
 
-    fd = adb_connect("sync:");
+    fd = sync_connect();
     if(fd < 0) {
         fprintf(stderr,"error: %s\n", adb_error());
         return 1;
@@ -843,6 +1069,8 @@ static int remote_build_list(int syncfd, copyinfo **filelist,
                              const char *rpath, const char *lpath)
 {
     copyinfo *dirlist = NULL;
+    copyinfo *inflight[SYNC_PIPELINE_DEPTH];
+    int head = 0, count = 0;
     sync_ls_build_list_cb_args args;
 
     args.filelist = filelist;
@@ -855,14 +1083,30 @@ static int remote_build_list(int syncfd, copyinfo **filelist,
         return 1;
     }
 
-    /* Recurse into each directory we found. */
-    while (dirlist != NULL) {
-        copyinfo *next = dirlist->next;
-        if (remote_build_list(syncfd, filelist, dirlist->src, dirlist->dst)) {
+    /* Walk the directories we found breadth first, keeping several
+     * listings in flight; the replies come back in request order. */
+    while (dirlist != NULL || count > 0) {
+        copyinfo *ci;
+
+        while (dirlist != NULL && count < SYNC_PIPELINE_DEPTH) {
+            ci = dirlist;
+            dirlist = ci->next;
+            if (sync_start_ls(syncfd, ci->src)) {
+                return 1;
+            }
+            inflight[(head + count++) % SYNC_PIPELINE_DEPTH] = ci;
+        }
+
+        ci = inflight[head];
+        head = (head + 1) % SYNC_PIPELINE_DEPTH;
+        count--;
+
+        args.rpath = ci->src;
+        args.lpath = ci->dst;
+        if (sync_finish_ls(syncfd, sync_ls_build_list_cb, (void *)&args)) {
             return 1;
         }
-        free(dirlist);
-        dirlist = next;
+        free(ci);
     }
 
     return 0;
@@ -873,6 +1117,8 @@ static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
 {
     copyinfo *filelist = 0;
     copyinfo *ci, *next;
+    copyinfo *inflight[SYNC_PIPELINE_DEPTH];
+    int head = 0, count = 0;
     int pulled = 0;
     int skipped = 0;
 
@@ -919,18 +1165,37 @@ static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
         }
     }
 #endif
-    for (ci = filelist; ci != 0; ci = next) {
-        next = ci->next;
-        if (ci->flag == 0) {
-            fprintf(stderr, "pull: %s -> %s\n", ci->src, ci->dst);
-            if (sync_recv(fd, ci->src, ci->dst)) {
-                return 1;
+    /* Request up to SYNC_PIPELINE_DEPTH files ahead of the one being
+     * received so the device never waits for the next RECV. */
+    for (ci = filelist; ci != 0 || count > 0; ) {
+        copyinfo *done;
+
+        while (ci != 0 && count < SYNC_PIPELINE_DEPTH) {
+            next = ci->next;
+            if (ci->flag == 0) {
+                if (sync_start_recv(fd, ci->src)) {
+                    return 1;
+                }
+                inflight[(head + count++) % SYNC_PIPELINE_DEPTH] = ci;
+                pulled++;
+            } else {
+                skipped++;
+                free(ci);
             }
-            pulled++;
-        } else {
-            skipped++;
+            ci = next;
         }
-        free(ci);
+        if (count == 0) {
+            break;
+        }
+
+        done = inflight[head];
+        head = (head + 1) % SYNC_PIPELINE_DEPTH;
+        count--;
+        fprintf(stderr, "pull: %s -> %s\n", done->src, done->dst);
+        if (sync_finish_recv(fd, done->src, done->dst)) {
+            return 1;
+        }
+        free(done);
     }
 
     fprintf(stderr, "%d file%s pulled. %d file%s skipped.\n",
@@ -947,7 +1212,7 @@ int do_sync_pull(const char *rpath, const char *lpath)
 
     int fd;
 
-    fd = adb_connect("sync:");
+    fd = sync_connect();
     if(fd < 0) {
         fprintf(stderr,"error: %s\n", adb_error());
         return 1;
@@ -1007,7 +1272,7 @@ int do_sync_sync(const char *lpath, const char *rpath, int listonly)
 {
     fprintf(stderr,"syncing %s...\n",rpath);
 
-    int fd = adb_connect("sync:");
+    int fd = sync_connect();
     if(fd < 0) {
         fprintf(stderr,"error: %s\n", adb_error());
         return 1;
@@ -22,6 +22,8 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <utime.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 #include <errno.h>
 
@@ -31,6 +33,54 @@
 #include "adb.h"
 #include "file_sync_service.h"
 
+/* File data can be moved between the file and the service socket with
+** splice(2) through a pipe, which avoids copying every chunk through
+** user space.  The pipe lives for the whole sync session.  Files and
+** sockets that cannot be spliced fall back to read/write.
+*/
+#ifdef __NR_splice
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#define SPLICE_F_MORE 4
+#endif
+
+static ssize_t sync_splice(int fd_in, int fd_out, size_t len, unsigned flags)
+{
+    return syscall(__NR_splice, fd_in, NULL, fd_out, NULL, len, flags);
+}
+
+static int open_splice_pipe(int *zpipe)
+{
+    if(pipe(zpipe))
+        return -1;
+    close_on_exec(zpipe[0]);
+    close_on_exec(zpipe[1]);
+#ifdef F_SETPIPE_SZ
+    fcntl(zpipe[1], F_SETPIPE_SZ, SYNC_DATA_MAX);
+#endif
+    return 0;
+}
+#else
+static ssize_t sync_splice(int fd_in, int fd_out, size_t len, unsigned flags)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int open_splice_pipe(int *zpipe)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+static void close_splice_pipe(int *zpipe)
+{
+    if(zpipe[0] >= 0) adb_close(zpipe[0]);
+    if(zpipe[1] >= 0) adb_close(zpipe[1]);
+    zpipe[0] = zpipe[1] = -1;
+}
+
 static int mkdirs(char *name)
 {
     int ret;
@@ -53,33 +103,88 @@ static int mkdirs(char *name)
     return 0;
 }
 
-static int do_stat(int s, const char *path)
+static void fill_stat(syncmsg *msg, const char *path)
 {
-    syncmsg msg;
     struct stat st;
 
-    msg.stat.id = ID_STAT;
+    msg->stat.id = ID_STAT;
 
     if(lstat(path, &st)) {
-        msg.stat.mode = 0;
-        msg.stat.size = 0;
-        msg.stat.time = 0;
+        msg->stat.mode = 0;
+        msg->stat.size = 0;
+        msg->stat.time = 0;
     } else {
-        msg.stat.mode = htoll(st.st_mode);
-        msg.stat.size = htoll(st.st_size);
-        msg.stat.time = htoll(st.st_mtime);
+        msg->stat.mode = htoll(st.st_mode);
+        msg->stat.size = htoll(st.st_size);
+        msg->stat.time = htoll(st.st_mtime);
     }
+}
 
+static int do_stat(int s, const char *path)
+{
+    syncmsg msg;
+
+    fill_stat(&msg, path);
     return writex(s, &msg.stat, sizeof(msg.stat));
 }
 
-static int do_list(int s, const char *path)
+static int fail_message(int s, const char *reason);
+
+/* paths arrive NUL-terminated in buffer, and are overwritten by the
+** reply: one ID_STAB header followed by one stat record per path
+*/
+static int do_stat_batch(int s, unsigned len, char *buffer)
+{
+    syncmsg msg;
+    char *paths;
+    char *p;
+    char *out;
+    unsigned count = 0;
+
+    if(len > SYNC_DATA_MAX) {
+        fail_message(s, "invalid namelen");
+        return -1;
+    }
+
+    paths = malloc(len + 1);
+    if(paths == 0) {
+        fail_message(s, "out of memory");
+        return -1;
+    }
+    if(readx(s, paths, len)) {
+        free(paths);
+        return -1;
+    }
+    paths[len] = 0;
+
+    out = buffer + sizeof(msg.req);
+    for(p = paths; p < paths + len; p += strlen(p) + 1) {
+        if(count == SYNC_STAT_BATCH_MAX) {
+            free(paths);
+            fail_message(s, "too many paths in batch");
+            return -1;
+        }
+        fill_stat(&msg, p);
+        memcpy(out, &msg.stat, sizeof(msg.stat));
+        out += sizeof(msg.stat);
+        count++;
+    }
+    free(paths);
+
+    msg.req.id = ID_STAB;
+    msg.req.namelen = htoll(count);
+    memcpy(buffer, &msg.req, sizeof(msg.req));
+    return writex(s, buffer, out - buffer);
+}
+
+static int do_list(int s, const char *path, char *buffer)
 {
     DIR *d;
     struct dirent *de;
     struct stat st;
     syncmsg msg;
     int len;
+    int used = 0;
 
     char tmp[1024 + 256 + 1];
     char *fname;
@@ -108,10 +213,20 @@ static int do_list(int s, const char *path)
             msg.dent.time = htoll(st.st_mtime);
             msg.dent.namelen = htoll(len);
 
-            if(writex(s, &msg.dent, sizeof(msg.dent)) ||
-               writex(s, de->d_name, len)) {
-                return -1;
+                /* batch entries so a directory costs a few
+                ** writes rather than two per entry
+                */
+            if(used + sizeof(msg.dent) + len > SYNC_DATA_MAX) {
+                if(writex(s, buffer, used)) {
+                    closedir(d);
+                    return -1;
+                }
+                used = 0;
             }
+            memcpy(buffer + used, &msg.dent, sizeof(msg.dent));
+            used += sizeof(msg.dent);
+            memcpy(buffer + used, de->d_name, len);
+            used += len;
         }
     }
 
@@ -123,7 +238,14 @@ done:
     msg.dent.size = 0;
     msg.dent.time = 0;
     msg.dent.namelen = 0;
-    return writex(s, &msg.dent, sizeof(msg.dent));
+    if(used + sizeof(msg.dent) > SYNC_DATA_MAX) {
+        if(writex(s, buffer, used))
+            return -1;
+        used = 0;
+    }
+    memcpy(buffer + used, &msg.dent, sizeof(msg.dent));
+    used += sizeof(msg.dent);
+    return writex(s, buffer, used);
 }
 
 static int fail_message(int s, const char *reason)
@@ -148,7 +270,52 @@ static int fail_errno(int s)
     return fail_message(s, strerror(errno));
 }
 
-static int handle_send_file(int s, char *path, mode_t mode, char *buffer)
+/* moves one DATA chunk of len bytes from the socket into fd through
+** the splice pipe.  Returns 1 if nothing could be spliced (the caller
+** then copies the chunk itself), -1 on socket errors, and 0 once the
+** chunk has been consumed; *file_errno is set if writing fd failed.
+*/
+static int splice_chunk_to_file(int s, int fd, unsigned len, int *zpipe,
+                                char *buffer, int *file_errno)
+{
+    unsigned moved = 0;
+
+    *file_errno = 0;
+    while(moved < len) {
+        ssize_t n = sync_splice(s, zpipe[1], len - moved, SPLICE_F_MOVE);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && moved == 0 && (errno == EINVAL || errno == ENOSYS))
+            return 1;
+        if(n <= 0)
+            return -1;
+        moved += n;
+
+        while(n > 0) {
+            ssize_t w = -1;
+            if(*file_errno == 0)
+                w = sync_splice(zpipe[0], fd, n, SPLICE_F_MOVE);
+            if(w > 0) {
+                n -= w;
+                continue;
+            }
+            if(w < 0 && *file_errno == 0 && errno == EINTR)
+                continue;
+                /* the file will not take spliced data (or failed):
+                ** empty the pipe and write the bytes the slow way
+                */
+            if(readx(zpipe[0], buffer, n))
+                return -1;
+            if(*file_errno == 0 && writex(fd, buffer, n))
+                *file_errno = errno ? errno : EIO;
+            n = 0;
+        }
+    }
+    return 0;
+}
+
+static int handle_send_file(int s, char *path, mode_t mode, char *buffer,
+                            int *zpipe)
 {
     syncmsg msg;
     unsigned int timestamp = 0;
@@ -187,13 +354,32 @@ static int handle_send_file(int s, char *path, mode_t mode, char *buffer)
             fail_message(s, "oversize data message");
             goto fail;
         }
+
+        if(fd >= 0 && zpipe[0] >= 0) {
+            int file_errno;
+            int r = splice_chunk_to_file(s, fd, len, zpipe, buffer,
+                                         &file_errno);
+            if(r < 0)
+                goto fail;
+            if(r == 0) {
+                if(file_errno == 0)
+                    continue;
+                errno = file_errno;
+                goto write_failed;
+            }
+            D("sync: cannot splice into '%s', copying\n", path);
+            close_splice_pipe(zpipe);
+        }
+
         if(readx(s, buffer, len))
             goto fail;
 
         if(fd < 0)
             continue;
         if(writex(fd, buffer, len)) {
-            int saved_errno = errno;
+            int saved_errno;
+write_failed:
+            saved_errno = errno;
             adb_close(fd);
             adb_unlink(path);
             fd = -1;
@@ -273,7 +459,7 @@ static int handle_send_link(int s, char *path, char *buffer)
 }
 #endif /* HAVE_SYMLINKS */
 
-static int do_send(int s, char *path, char *buffer)
+static int do_send(int s, char *path, char *buffer, int *zpipe)
 {
     char *tmp;
     mode_t mode;
@@ -310,13 +496,55 @@ static int do_send(int s, char *path, char *buffer)
         mode |= ((mode >> 3) & 0070);
         mode |= ((mode >> 3) & 0007);
 
-        ret = handle_send_file(s, path, mode, buffer);
+        ret = handle_send_file(s, path, mode, buffer, zpipe);
     }
 
     return ret;
 }
 
-static int do_recv(int s, const char *path, char *buffer)
+/* sends fd as DATA chunks, moving the data file -> pipe -> socket.
+** Returns 1 if the file cannot be spliced and nothing was sent, 0 once
+** the whole file was sent, and -1 on errors.
+*/
+static int splice_file_to_socket(int s, int fd, int *zpipe, char *buffer)
+{
+    syncmsg msg;
+    int sent = 0;
+
+    msg.data.id = ID_DATA;
+    for(;;) {
+        ssize_t n = sync_splice(fd, zpipe[1], SYNC_DATA_MAX, SPLICE_F_MOVE);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(!sent && (errno == EINVAL || errno == ENOSYS)) return 1;
+            return -1;
+        }
+        if(n == 0)
+            return 0;
+
+        msg.data.size = htoll(n);
+        if(writex(s, &msg.data, sizeof(msg.data)))
+            return -1;
+        sent = 1;
+
+        while(n > 0) {
+            ssize_t w = sync_splice(zpipe[0], s, n,
+                                    SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(w > 0) {
+                n -= w;
+                continue;
+            }
+            if(w < 0 && errno == EINTR)
+                continue;
+                /* the header is already out; copy the rest */
+            if(readx(zpipe[0], buffer, n) || writex(s, buffer, n))
+                return -1;
+            n = 0;
+        }
+    }
+}
+
+static int do_recv(int s, const char *path, char *buffer, int *zpipe)
 {
     syncmsg msg;
     int fd, r;
@@ -327,6 +555,18 @@ static int do_recv(int s, const char *path, char *buffer)
         return 0;
     }
 
+    if(zpipe[0] >= 0) {
+        r = splice_file_to_socket(s, fd, zpipe, buffer);
+        if(r < 0) {
+            r = fail_errno(s);
+            adb_close(fd);
+            return r;
+        }
+        if(r == 0)
+            goto done;
+        D("sync: cannot splice from '%s', copying\n", path);
+    }
+
     msg.data.id = ID_DATA;
     for(;;) {
         r = adb_read(fd, buffer, SYNC_DATA_MAX);
@@ -345,6 +585,7 @@ static int do_recv(int s, const char *path, char *buffer)
         }
     }
 
+done:
     adb_close(fd);
 
     msg.data.id = ID_DONE;
@@ -356,13 +597,21 @@ static int do_recv(int s, const char *path, char *buffer)
     return 0;
 }
 
-void file_sync_service(int fd, void *cookie)
+static void sync_service(int fd, int pipelined)
 {
     syncmsg msg;
     char name[1025];
     unsigned namelen;
+    int zpipe[2] = { -1, -1 };
+
+    if(open_splice_pipe(zpipe)) {
+        D("sync: no splice pipe (%s), copying file data\n", strerror(errno));
+        zpipe[0] = zpipe[1] = -1;
+    }
 
-    char *buffer = malloc(SYNC_DATA_MAX);
+        /* room for a full ID_STAB reply as well as a data chunk */
+    char *buffer = malloc(SYNC_DATA_MAX + sizeof(msg.req) +
+                          SYNC_STAT_BATCH_MAX * sizeof(msg.stat));
     if(buffer == 0) goto fail;
 
     for(;;) {
@@ -373,6 +622,10 @@ void file_sync_service(int fd, void *cookie)
             break;
         }
         namelen = ltohl(msg.req.namelen);
+        if(pipelined && msg.req.id == ID_STAB) {
+            if(do_stat_batch(fd, namelen, buffer)) goto fail;
+            continue;
+        }
         if(namelen > 1024) {
             fail_message(fd, "invalid namelen");
             break;
@@ -391,13 +644,13 @@ void file_sync_service(int fd, void *cookie)
             if(do_stat(fd, name)) goto fail;
             break;
         case ID_LIST:
-            if(do_list(fd, name)) goto fail;
+            if(do_list(fd, name, buffer)) goto fail;
             break;
         case ID_SEND:
-            if(do_send(fd, name, buffer)) goto fail;
+            if(do_send(fd, name, buffer, zpipe)) goto fail;
             break;
         case ID_RECV:
-            if(do_recv(fd, name, buffer)) goto fail;
+            if(do_recv(fd, name, buffer, zpipe)) goto fail;
             break;
         case ID_QUIT:
             goto fail;
@@ -409,6 +662,17 @@ void file_sync_service(int fd, void *cookie)
 
 fail:
     if(buffer != 0) free(buffer);
+    close_splice_pipe(zpipe);
     D("sync: done\n");
     adb_close(fd);
 }
+
+void file_sync_service(int fd, void *cookie)
+{
+    sync_service(fd, 0);
+}
+
+void file_sync_service_pipelined(int fd, void *cookie)
+{
+    sync_service(fd, 1);
+}
@@ -45,6 +45,7 @@ static inline unsigned __swap_uint32(unsigned x)
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
+#define ID_STAB MKID('S','T','A','B')
 
 typedef union {
     unsigned id;
@@ -77,11 +78,29 @@ typedef union {
 
 
 void file_sync_service(int fd, void *cookie);
+void file_sync_service_pipelined(int fd, void *cookie);
 int do_sync_ls(const char *path);
 int do_sync_push(const char *lpath, const char *rpath, int verifyApk);
 int do_sync_sync(const char *lpath, const char *rpath, int listonly);
 int do_sync_pull(const char *rpath, const char *lpath);
 
+/* Map a local file once so that pushes of lpath, including those done
+** by processes forked afterwards, send it from memory instead of
+** reading it again. Returns 0 on success.
+*/
+int sync_preload_file(const char *lpath);
+
 #define SYNC_DATA_MAX (64*1024)
 
+/* The "sync2:" service accepts ID_STAB in addition to the classic
+** requests.  An ID_STAB request carries up to SYNC_STAT_BATCH_MAX
+** NUL-terminated paths and is answered by an ID_STAB message whose
+** namelen is the path count, followed by one stat record per path.
+**
+** Clients keep at most SYNC_PIPELINE_DEPTH requests outstanding so
+** that unread replies never fill the socket buffers.
+*/
+#define SYNC_STAT_BATCH_MAX 256
+#define SYNC_PIPELINE_DEPTH 64
+
 #endif
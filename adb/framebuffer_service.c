@@ -23,6 +23,8 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <zlib.h>
+
 #include "fdevent.h"
 #include "adb.h"
 
@@ -33,6 +35,17 @@
 /* TODO:
 ** - sync with vsync to avoid tearing
 */
+
+/* "framebuffer:" takes a comma-separated list of options (see SERVICES.TXT):
+**   deflate  everything after the fbinfo header is one zlib stream,
+**            flushed at the end of each frame
+**   tiles    keep sending frames, each one made of the TILE_SIZE square
+**            tiles which changed since the previous one
+** With none, it sends the one raw frame ddms expects.
+*/
+#define TILE_SIZE 32
+#define COPY_SIZE (64 * 1024)
+
 /* This version number defines the format of the fbinfo struct.
    It must match versioning in ddms where this data is consumed. */
 #define DDMS_RAWIMAGE_VERSION 1
@@ -52,21 +65,125 @@ struct fbinfo {
     unsigned int alpha_length;
 } __attribute__((packed));
 
-void framebuffer_service(int fd, void *cookie)
+/* Framing of the tiles mode: each frame is this, then count tiles of
+   a (x, y) pair of uint16_t tile indexes followed by the tile's pixels,
+   row after row, cut short on the right and bottom edges. */
+struct fbtiles {
+    unsigned int width;
+    unsigned int height;
+    unsigned int tile_size;
+    unsigned int count;
+} __attribute__((packed));
+
+struct fbout {
+    int fd;
+    int deflate;
+    z_stream zs;
+    unsigned char buf[COPY_SIZE];
+};
+
+static int fbinfo_from_format(struct fbinfo *fbinfo, int w, int h, int f)
+{
+    fbinfo->version = DDMS_RAWIMAGE_VERSION;
+    /* see hardware/hardware.h */
+    switch (f) {
+        case 1: /* RGBA_8888 */
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
+            break;
+        case 2: /* RGBX_8888 */
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
+            break;
+        case 3: /* RGB_888 */
+            fbinfo->bpp = 24;
+            fbinfo->size = w * h * 3;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
+            break;
+        case 4: /* RGB_565 */
+            fbinfo->bpp = 16;
+            fbinfo->size = w * h * 2;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 11;
+            fbinfo->red_length = 5;
+            fbinfo->green_offset = 5;
+            fbinfo->green_length = 6;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 5;
+            fbinfo->alpha_offset = 0;
+            fbinfo->alpha_length = 0;
+            break;
+        case 5: /* BGRA_8888 */
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 16;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
+           break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+static void screencap_close(pid_t pid, int fd)
+{
+    close(fd);
+    TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+}
+
+/* Starts screencap and reads what it says of the frame. */
+static int screencap_open(pid_t *pid, int *w, int *h, int *f)
 {
-    struct fbinfo fbinfo;
-    unsigned int i;
-    char buf[640];
-    int fd_screencap;
-    int w, h, f;
     int fds[2];
 
-    if (pipe(fds) < 0) goto done;
+    if (pipe(fds) < 0) return -1;
 
-    pid_t pid = fork();
-    if (pid < 0) goto done;
+    *pid = fork();
+    if (*pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
 
-    if (pid == 0) {
+    if (*pid == 0) {
         dup2(fds[1], STDOUT_FILENO);
         close(fds[0]);
         close(fds[1]);
@@ -75,106 +192,216 @@ void framebuffer_service(int fd, void *cookie)
         execvp(command, (char**)args);
         exit(1);
     }
-
-    fd_screencap = fds[0];
+    close(fds[1]);
 
     /* read w, h & format */
-    if(readx(fd_screencap, &w, 4)) goto done;
-    if(readx(fd_screencap, &h, 4)) goto done;
-    if(readx(fd_screencap, &f, 4)) goto done;
+    if(readx(fds[0], w, 4) || readx(fds[0], h, 4) || readx(fds[0], f, 4)) {
+        screencap_close(*pid, fds[0]);
+        return -1;
+    }
+    return fds[0];
+}
 
-    fbinfo.version = DDMS_RAWIMAGE_VERSION;
-    /* see hardware/hardware.h */
-    switch (f) {
-        case 1: /* RGBA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
-            break;
-        case 2: /* RGBX_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
-            break;
-        case 3: /* RGB_888 */
-            fbinfo.bpp = 24;
-            fbinfo.size = w * h * 3;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
-            break;
-        case 4: /* RGB_565 */
-            fbinfo.bpp = 16;
-            fbinfo.size = w * h * 2;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 11;
-            fbinfo.red_length = 5;
-            fbinfo.green_offset = 5;
-            fbinfo.green_length = 6;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 5;
-            fbinfo.alpha_offset = 0;
-            fbinfo.alpha_length = 0;
-            break;
-        case 5: /* BGRA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 16;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
-           break;
-        default:
+static int fbout_write(struct fbout *out, const void *data, size_t len, int flush)
+{
+    if (!out->deflate) return writex(out->fd, data, len);
+
+    out->zs.next_in = (Bytef *) data;
+    out->zs.avail_in = len;
+    do {
+        out->zs.next_out = out->buf;
+        out->zs.avail_out = sizeof(out->buf);
+        if (deflate(&out->zs, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+            return -1;
+        if (writex(out->fd, out->buf, sizeof(out->buf) - out->zs.avail_out))
+            return -1;
+    } while (out->zs.avail_out == 0);
+    return 0;
+}
+
+/* Copies size bytes of frame from screencap, without keeping them. */
+static int send_frame(struct fbout *out, int fd_screencap, unsigned int size)
+{
+    char buf[COPY_SIZE];
+    unsigned int n;
+
+    while (size > 0) {
+        n = size < sizeof(buf) ? size : sizeof(buf);
+        if(readx(fd_screencap, buf, n)) return -1;
+        size -= n;
+        if(fbout_write(out, buf, n, size == 0)) return -1;
+    }
+    return 0;
+}
+
+/* Sends the tiles of frame which differ from prev, or all of them without prev. */
+static int send_tiles(struct fbout *out, const struct fbinfo *fbinfo,
+                      const unsigned char *frame, const unsigned char *prev)
+{
+    unsigned int pixel = fbinfo->bpp / 8;
+    unsigned int stride = fbinfo->width * pixel;
+    unsigned int tiles_x = (fbinfo->width + TILE_SIZE - 1) / TILE_SIZE;
+    unsigned int tiles_y = (fbinfo->height + TILE_SIZE - 1) / TILE_SIZE;
+    unsigned int tx, ty, y, rows, row_len, count;
+    unsigned short xy[2];
+    struct fbtiles hdr;
+    unsigned char *changed;
+    const unsigned char *p;
+
+    changed = calloc(tiles_x * tiles_y, 1);
+    if (changed == NULL) return -1;
+
+    count = 0;
+    for (ty = 0; ty < tiles_y; ty++) {
+        rows = fbinfo->height - ty * TILE_SIZE;
+        if (rows > TILE_SIZE) rows = TILE_SIZE;
+        for (tx = 0; tx < tiles_x; tx++) {
+            row_len = fbinfo->width - tx * TILE_SIZE;
+            if (row_len > TILE_SIZE) row_len = TILE_SIZE;
+            row_len *= pixel;
+            p = frame + ty * TILE_SIZE * stride + tx * TILE_SIZE * pixel;
+            for (y = 0; y < rows; y++) {
+                if (prev == NULL || memcmp(p + y * stride, prev + (p - frame) + y * stride, row_len))
+                    break;
+            }
+            if (y < rows) {
+                changed[ty * tiles_x + tx] = 1;
+                count++;
+            }
+        }
+    }
+
+    hdr.width = fbinfo->width;
+    hdr.height = fbinfo->height;
+    hdr.tile_size = TILE_SIZE;
+    hdr.count = count;
+    if (fbout_write(out, &hdr, sizeof(hdr), count == 0)) goto fail;
+
+    for (ty = 0; ty < tiles_y; ty++) {
+        rows = fbinfo->height - ty * TILE_SIZE;
+        if (rows > TILE_SIZE) rows = TILE_SIZE;
+        for (tx = 0; tx < tiles_x; tx++) {
+            if (!changed[ty * tiles_x + tx]) continue;
+            row_len = fbinfo->width - tx * TILE_SIZE;
+            if (row_len > TILE_SIZE) row_len = TILE_SIZE;
+            row_len *= pixel;
+            xy[0] = tx;
+            xy[1] = ty;
+            if (fbout_write(out, xy, sizeof(xy), 0)) goto fail;
+            p = frame + ty * TILE_SIZE * stride + tx * TILE_SIZE * pixel;
+            count--;
+            for (y = 0; y < rows; y++) {
+                if (fbout_write(out, p + y * stride, row_len, count == 0 && y == rows - 1))
+                    goto fail;
+            }
+        }
+    }
+
+    free(changed);
+    return 0;
+fail:
+    free(changed);
+    return -1;
+}
+
+/* Frames until the client goes away, or the pixel format changes under us. */
+static void send_tile_frames(struct fbout *out, struct fbinfo *fbinfo, int format,
+                             pid_t pid, int fd_screencap)
+{
+    unsigned char *frame, *prev = NULL, *tmp;
+    struct fbinfo next;
+    int w, h, f;
+
+    frame = malloc(fbinfo->size);
+    while (frame != NULL) {
+        if (readx(fd_screencap, frame, fbinfo->size)) break;
+        screencap_close(pid, fd_screencap);
+        fd_screencap = -1;
+
+        if (send_tiles(out, fbinfo, frame, prev)) break;
+
+        if (prev == NULL && (prev = malloc(fbinfo->size)) == NULL) break;
+        tmp = prev;
+        prev = frame;
+        frame = tmp;
+
+        fd_screencap = screencap_open(&pid, &w, &h, &f);
+        if (fd_screencap < 0) break;
+        if (f != format || fbinfo_from_format(&next, w, h, f)) break;
+        if (next.width != fbinfo->width || next.height != fbinfo->height) {
+            /* rotated: the client gets every tile again, at the new size */
+            free(prev);
+            prev = NULL;
+            free(frame);
+            frame = malloc(next.size);
+        }
+        *fbinfo = next;
+    }
+
+    if (fd_screencap >= 0) screencap_close(pid, fd_screencap);
+    free(frame);
+    free(prev);
+}
+
+void framebuffer_service(int fd, void *cookie)
+{
+    struct fbinfo fbinfo;
+    struct fbout *out;
+    char *options = cookie;
+    char *opt, *save;
+    int tiles = 0;
+    int fd_screencap;
+    int w, h, f;
+    pid_t pid;
+
+    out = calloc(1, sizeof(*out));
+    if (out == NULL) goto done;
+    out->fd = fd;
+
+    for (opt = strtok_r(options, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+        if (!strcmp(opt, "deflate")) {
+            out->deflate = 1;
+        } else if (!strcmp(opt, "tiles")) {
+            tiles = 1;
+        } else {
+            /* asked by a newer client, which can fall back to fewer options */
             goto done;
+        }
+    }
+
+    fd_screencap = screencap_open(&pid, &w, &h, &f);
+    if (fd_screencap < 0) goto done;
+
+    if (fbinfo_from_format(&fbinfo, w, h, f)) {
+        screencap_close(pid, fd_screencap);
+        goto done;
     }
 
     /* write header */
-    if(writex(fd, &fbinfo, sizeof(fbinfo))) goto done;
+    if(writex(fd, &fbinfo, sizeof(fbinfo))) {
+        screencap_close(pid, fd_screencap);
+        goto done;
+    }
+
+    /* Speed over ratio: most of a screen is flat colour anyway. */
+    if (out->deflate && deflateInit(&out->zs, Z_BEST_SPEED) != Z_OK) {
+        out->deflate = 0;
+        screencap_close(pid, fd_screencap);
+        goto done;
+    }
 
     /* write data */
-    for(i = 0; i < fbinfo.size; i += sizeof(buf)) {
-      if(readx(fd_screencap, buf, sizeof(buf))) goto done;
-      if(writex(fd, buf, sizeof(buf))) goto done;
+    if (tiles) {
+        send_tile_frames(out, &fbinfo, f, pid, fd_screencap);
+    } else {
+        send_frame(out, fd_screencap, fbinfo.size);
+        screencap_close(pid, fd_screencap);
     }
-    if(readx(fd_screencap, buf, fbinfo.size % sizeof(buf))) goto done;
-    if(writex(fd, buf, fbinfo.size % sizeof(buf))) goto done;
 
-done:
-    TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+    if (out->deflate) deflateEnd(&out->zs);
 
-    close(fds[0]);
-    close(fds[1]);
+done:
+    free(out);
+    free(options);
     close(fd);
 }
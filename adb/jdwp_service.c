@@ -118,48 +118,122 @@ struct JdwpProcess {
 
 static JdwpProcess  _jdwp_list;
 
+/* the pid lists sent to the "jdwp" and "track-jdwp" clients grow with
+ * the number of debuggable processes, so they are built in this and sent
+ * in as many packets as it takes.
+ */
+typedef struct {
+    char*  data;
+    int    len;
+    int    capacity;
+} JdwpBuffer;
+
 static int
-jdwp_process_list( char*  buffer, int  bufferlen )
+jdwp_buffer_reserve( JdwpBuffer*  b, int  len )
+{
+    if (b->len + len > b->capacity) {
+        int    capacity = b->capacity ? b->capacity : 256;
+        char*  data;
+
+        while (capacity < b->len + len)
+            capacity *= 2;
+
+        data = realloc(b->data, capacity);
+        if (data == NULL)
+            return -1;
+        b->data     = data;
+        b->capacity = capacity;
+    }
+    return 0;
+}
+
+static void
+jdwp_buffer_add_pid( JdwpBuffer*  b, const char*  prefix, int  pid )
+{
+    char  line[16];
+    int   len = snprintf(line, sizeof line, "%s%d\n", prefix, pid);
+
+    if (jdwp_buffer_reserve(b, len) == 0) {
+        memcpy(b->data + b->len, line, len);
+        b->len += len;
+    }
+}
+
+static void
+jdwp_process_list( JdwpBuffer*  b )
 {
-    char*         end  = buffer + bufferlen;
-    char*         p    = buffer;
     JdwpProcess*  proc = _jdwp_list.next;
 
     for ( ; proc != &_jdwp_list; proc = proc->next ) {
-        int  len;
-
         /* skip transient connections */
         if (proc->pid < 0)
             continue;
 
-        len = snprintf(p, end-p, "%d\n", proc->pid);
-        if (p + len >= end)
-            break;
-        p += len;
+        jdwp_buffer_add_pid(b, "", proc->pid);
     }
-    p[0] = 0;
-    return (p - buffer);
 }
 
-
-static int
-jdwp_process_list_msg( char*  buffer, int  bufferlen )
+/* frames what was added to b since start with its <hex4> length */
+static void
+jdwp_buffer_frame( JdwpBuffer*  b, int  start )
 {
     char  head[5];
-    int   len = jdwp_process_list( buffer+4, bufferlen-4 );
+    int   len = b->len - start - 4;
+
+    /* that's a lot of processes: drop the lines which don't fit */
+    while (len > 0xffff) {
+        char*  p = b->data + b->len - 1;
+        while (p[-1] != '\n')
+            p--;
+        len    -= b->data + b->len - p;
+        b->len  = p - b->data;
+    }
     snprintf(head, sizeof head, "%04x", len);
-    memcpy(buffer, head, 4);
-    return len + 4;
+    memcpy(b->data + start, head, 4);
+}
+
+static void
+jdwp_process_list_msg( JdwpBuffer*  b )
+{
+    int  start = b->len;
+
+    if (jdwp_buffer_reserve(b, 4) < 0)
+        return;
+    b->len += 4;
+    jdwp_process_list(b);
+    jdwp_buffer_frame(b, start);
+}
+
+/* always sends a packet, even an empty one: the "jdwp" service waits
+ * for it to be acknowledged before closing the connection.
+ */
+static void
+jdwp_buffer_send( JdwpBuffer*  b, asocket*  peer )
+{
+    int  pos = 0;
+
+    do {
+        apacket*  p   = get_apacket();
+        int       len = b->len - pos;
+
+        if (len > (int)p->capacity)
+            len = p->capacity;
+        memcpy(p->data, b->data + pos, len);
+        p->len = len;
+        pos   += len;
+        peer->enqueue(peer, p);
+    } while (pos < b->len);
 }
 
 
-static void  jdwp_process_list_updated(void);
+static void  jdwp_process_list_changed( int  pid, int  added );
 
 static void
 jdwp_process_free( JdwpProcess*  proc )
 {
     if (proc) {
         int  n;
+        int  pid = proc->pid;
 
         proc->prev->next = proc->next;
         proc->next->prev = proc->prev;
@@ -183,7 +257,9 @@ jdwp_process_free( JdwpProcess*  proc )
 
         free(proc);
 
-        jdwp_process_list_updated();
+        /* a connection which never told us its pid was never listed */
+        if (pid >= 0)
+            jdwp_process_list_changed(pid, 0);
     }
 }
 
@@ -274,7 +350,7 @@ jdwp_process_event( int  socket, unsigned  events, void*  _proc )
 
             /* all is well, keep reading to detect connection closure */
             D("Adding pid %d to jdwp process list\n", proc->pid);
-            jdwp_process_list_updated();
+            jdwp_process_list_changed(proc->pid, 1);
         }
         else
         {
@@ -587,9 +663,10 @@ jdwp_socket_ready( asocket*  s )
     * on the second one, close the connection
     */
     if (jdwp->pass == 0) {
-        apacket*  p = get_apacket();
-        p->len = jdwp_process_list((char*)p->data, MAX_PAYLOAD);
-        peer->enqueue(peer, p);
+        JdwpBuffer  b = { NULL, 0, 0 };
+        jdwp_process_list(&b);
+        jdwp_buffer_send(&b, peer);
+        free(b.data);
         jdwp->pass = 1;
     }
     else {
@@ -616,8 +693,9 @@ create_jdwp_service_socket( void )
 }
 
 /** "track-jdwp" local service implementation
- ** this periodically sends the list of known JDWP process pids
- ** to the client...
+ ** this sends the list of known JDWP process pids to the client
+ ** each time it changes. "track-jdwp-delta" sends it once, then
+ ** only the pids which come and go.
  **/
 
 typedef struct JdwpTracker  JdwpTracker;
@@ -627,27 +705,42 @@ struct JdwpTracker {
     JdwpTracker*  next;
     JdwpTracker*  prev;
     int           need_update;
+    int           delta;
 };
 
 static JdwpTracker   _jdwp_trackers_list;
 
 
 static void
-jdwp_process_list_updated(void)
+jdwp_process_list_changed( int  pid, int  added )
 {
-    char             buffer[1024];
-    int              len;
+    JdwpBuffer    list  = { NULL, 0, 0 };
+    JdwpBuffer    delta = { NULL, 0, 0 };
     JdwpTracker*  t = _jdwp_trackers_list.next;
 
-    len = jdwp_process_list_msg(buffer, sizeof(buffer));
-
     for ( ; t != &_jdwp_trackers_list; t = t->next ) {
-        apacket*  p    = get_apacket();
-        asocket*  peer = t->socket.peer;
-        memcpy(p->data, buffer, len);
-        p->len = len;
-        peer->enqueue( peer, p );
+        JdwpBuffer*  b = t->delta ? &delta : &list;
+
+        /* the first list, still to be sent, will be up to date */
+        if (t->need_update)
+            continue;
+
+        /* built once for all the trackers which want it */
+        if (b->len == 0) {
+            if (t->delta) {
+                if (jdwp_buffer_reserve(b, 4) < 0)
+                    continue;
+                b->len = 4;
+                jdwp_buffer_add_pid(b, added ? "+" : "-", pid);
+                jdwp_buffer_frame(b, 0);
+            } else {
+                jdwp_process_list_msg(b);
+            }
+        }
+        jdwp_buffer_send(b, t->socket.peer);
     }
+    free(list.data);
+    free(delta.data);
 }
 
 static void
@@ -675,10 +768,11 @@ jdwp_tracker_ready( asocket*  s )
     JdwpTracker*  t = (JdwpTracker*) s;
 
     if (t->need_update) {
-        apacket*  p = get_apacket();
+        JdwpBuffer  b = { NULL, 0, 0 };
         t->need_update = 0;
-        p->len = jdwp_process_list_msg((char*)p->data, sizeof(p->data));
-        s->peer->enqueue(s->peer, p);
+        jdwp_process_list_msg(&b);
+        jdwp_buffer_send(&b, s->peer);
+        free(b.data);
     }
 }
 
@@ -693,7 +787,7 @@ jdwp_tracker_enqueue( asocket*  s, apacket*  p )
 
 
 asocket*
-create_jdwp_tracker_service_socket( void )
+create_jdwp_tracker_service_socket( int  delta )
 {
     JdwpTracker*  t = calloc(sizeof(*t),1);
 
@@ -712,6 +806,7 @@ create_jdwp_tracker_service_socket( void )
     t->socket.enqueue = jdwp_tracker_enqueue;
     t->socket.close   = jdwp_tracker_close;
     t->need_update    = 1;
+    t->delta          = delta;
 
     return &t->socket;
 }
@@ -26,6 +26,7 @@
 #define  TRACE_TAG  TRACE_SERVICES
 #include "adb.h"
 #include "file_sync_service.h"
+#include "shell_service.h"
 
 #if ADB_HOST
 #  ifndef HAVE_WINSOCK
@@ -34,6 +35,9 @@
 #    include <sys/ioctl.h>
 #  endif
 #else
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/wait.h>
 #  include <cutils/android_reboot.h>
 #  include <cutils/properties.h>
 #endif
@@ -186,6 +190,20 @@ static int create_service_thread(void (*func)(int, void *), void *cookie)
 }
 
 #if !ADB_HOST
+// set OOM adjustment to zero, in a child about to exec
+static void reset_oom_adj(void)
+{
+    char text[64];
+    snprintf(text, sizeof text, "/proc/%d/oom_adj", getpid());
+    int fd = adb_open(text, O_WRONLY);
+    if (fd >= 0) {
+        adb_write(fd, "0", 1);
+        adb_close(fd);
+    } else {
+       D("adb: unable to open %s\n", text);
+    }
+}
+
 static int create_subprocess(const char *cmd, const char *arg0, const char *arg1, pid_t *pid)
 {
 #ifdef HAVE_WIN32_PROC
@@ -235,16 +253,7 @@ static int create_subprocess(const char *cmd, const char *arg0, const char *arg1
         adb_close(pts);
         adb_close(ptm);
 
-        // set OOM adjustment to zero
-        char text[64];
-        snprintf(text, sizeof text, "/proc/%d/oom_adj", getpid());
-        int fd = adb_open(text, O_WRONLY);
-        if (fd >= 0) {
-            adb_write(fd, "0", 1);
-            adb_close(fd);
-        } else {
-           D("adb: unable to open %s\n", text);
-        }
+        reset_oom_adj();
         execl(cmd, cmd, arg0, arg1, NULL);
         fprintf(stderr, "- exec '%s' failed: %s (%d) -\n",
                 cmd, strerror(errno), errno);
@@ -329,6 +338,171 @@ static int create_subproc_thread(const char *name)
 }
 #endif
 
+#if !ADB_HOST
+static int send_shmsg(int fd, unsigned id, const void *data, unsigned len)
+{
+    shmsg msg;
+
+    msg.id = htoll(id);
+    msg.len = htoll(len);
+    if(writex(fd, &msg, sizeof(msg))) return -1;
+    if(len > 0 && data != NULL && writex(fd, data, len)) return -1;
+    return 0;
+}
+
+/* Runs one command for shell_server_service(), with its stdout and
+** stderr on pipes which are forwarded to fd as they are read.  Returns
+** -1 once the client has gone away.
+*/
+static int run_shell_command(int fd, const char *cmd, char *buf)
+{
+    struct pollfd pfds[2];
+    unsigned ids[2] = { ID_SOUT, ID_SERR };
+    int out[2], err[2];
+    int open_count = 2;
+    int ret = 0;
+    int status;
+    pid_t pid;
+    int i;
+
+        /* close-on-exec from the start, all four ends: other threads
+        ** fork too, and a child holding a write end open would keep us
+        ** from ever seeing EOF.  dup2() clears it on the child's 1 and 2.
+        */
+    if(pipe2(out, O_CLOEXEC)) {
+        snprintf(buf, SHELL_DATA_MAX, "- pipe failed: %s -\n", strerror(errno));
+        goto fail;
+    }
+    if(pipe2(err, O_CLOEXEC)) {
+        snprintf(buf, SHELL_DATA_MAX, "- pipe failed: %s -\n", strerror(errno));
+        adb_close(out[0]);
+        adb_close(out[1]);
+        goto fail;
+    }
+
+    pid = fork();
+    if(pid < 0) {
+        snprintf(buf, SHELL_DATA_MAX, "- fork failed: %s -\n", strerror(errno));
+        adb_close(out[0]);
+        adb_close(out[1]);
+        adb_close(err[0]);
+        adb_close(err[1]);
+        goto fail;
+    }
+
+    if(pid == 0) {
+        int nul = unix_open("/dev/null", O_RDONLY);
+        if(nul >= 0) {
+            dup2(nul, 0);
+            adb_close(nul);
+        }
+        dup2(out[1], 1);
+        dup2(err[1], 2);
+        adb_close(out[1]);
+        adb_close(err[1]);
+
+        // adbd ignores SIGPIPE, which the command would inherit
+        signal(SIGPIPE, SIG_DFL);
+        reset_oom_adj();
+        execl(SHELL_COMMAND, SHELL_COMMAND, "-c", cmd, NULL);
+        fprintf(stderr, "- exec '%s' failed: %s (%d) -\n",
+                SHELL_COMMAND, strerror(errno), errno);
+        _exit(127);
+    }
+
+    adb_close(out[1]);
+    adb_close(err[1]);
+    pfds[0].fd = out[0];
+    pfds[1].fd = err[0];
+    pfds[0].events = pfds[1].events = POLLIN;
+
+    while(open_count > 0) {
+        if(poll(pfds, 2, -1) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        for(i = 0; i < 2; i++) {
+            int len;
+
+            if(pfds[i].fd < 0 || pfds[i].revents == 0) continue;
+            len = adb_read(pfds[i].fd, buf, SHELL_DATA_MAX);
+            if(len < 0 && errno == EINTR) continue;
+            if(len <= 0) {
+                adb_close(pfds[i].fd);
+                pfds[i].fd = -1;
+                open_count--;
+                continue;
+            }
+            if(send_shmsg(fd, ids[i], buf, len)) {
+                ret = -1;
+                goto done;
+            }
+        }
+    }
+
+done:
+    if(ret < 0) {
+        D("shell-server client went away, killing pid=%d\n", pid);
+        kill(pid, SIGKILL);
+    }
+    for(i = 0; i < 2; i++) {
+        if(pfds[i].fd >= 0) adb_close(pfds[i].fd);
+    }
+    while(waitpid(pid, &status, 0) < 0) {
+        if(errno != EINTR) {
+            status = 127 << 8;
+            break;
+        }
+    }
+    D("shell-server pid=%d status=%04x\n", pid, status);
+    if(ret == 0) {
+        ret = send_shmsg(fd, ID_EXIT, NULL, (unsigned) status);
+    }
+    return ret;
+
+fail:
+    if(send_shmsg(fd, ID_SERR, buf, strlen(buf))) return -1;
+    return send_shmsg(fd, ID_EXIT, NULL, 127 << 8);
+}
+
+/* Unlike shell:, which forks a shell on a new pty for every stream,
+** this runs command after command on one stream, see shell_service.h.
+*/
+void shell_server_service(int fd, void *cookie)
+{
+    char *cmd = malloc(SHELL_COMMAND_MAX + 1);
+    char *buf = malloc(SHELL_DATA_MAX);
+    shmsg msg;
+
+    if(cmd == NULL || buf == NULL) {
+        goto done;
+    }
+
+    for(;;) {
+        unsigned id, len;
+
+        if(readx(fd, &msg, sizeof(msg))) break;
+        id = ltohl(msg.id);
+        len = ltohl(msg.len);
+        if(id == ID_QUIT) break;
+        if(id != ID_EXEC || len > SHELL_COMMAND_MAX) {
+            D("shell-server: bad message %08x len=%u\n", id, len);
+            break;
+        }
+        if(readx(fd, cmd, len)) break;
+        cmd[len] = 0;
+
+        D("shell-server: exec '%s'\n", cmd);
+        if(run_shell_command(fd, cmd, buf)) break;
+    }
+
+done:
+    free(cmd);
+    free(buf);
+    adb_close(fd);
+}
+#endif
+
 int service_to_fd(const char *name)
 {
     int ret = -1;
@@ -365,7 +539,9 @@ int service_to_fd(const char *name)
     } else if(!strncmp("dev:", name, 4)) {
         ret = unix_open(name + 4, O_RDWR);
     } else if(!strncmp(name, "framebuffer:", 12)) {
-        ret = create_service_thread(framebuffer_service, 0);
+        void* arg = strdup(name + 12);
+        if(arg == 0) return -1;
+        ret = create_service_thread(framebuffer_service, arg);
     } else if (!strncmp(name, "jdwp:", 5)) {
         ret = create_jdwp_connection_fd(atoi(name+5));
     } else if (!strncmp(name, "log:", 4)) {
@@ -376,8 +552,12 @@ int service_to_fd(const char *name)
         } else {
             ret = create_subproc_thread(0);
         }
+    } else if(!HOST && !strncmp(name, "shell-server:", 13)) {
+        ret = create_service_thread(shell_server_service, NULL);
     } else if(!strncmp(name, "sync:", 5)) {
         ret = create_service_thread(file_sync_service, NULL);
+    } else if(!strncmp(name, "sync2:", 6)) {
+        ret = create_service_thread(file_sync_service_pipelined, NULL);
     } else if(!strncmp(name, "remount:", 8)) {
         ret = create_service_thread(remount_service, NULL);
     } else if(!strncmp(name, "reboot:", 7)) {
@@ -559,7 +739,9 @@ static void connect_service(int fd, void* cookie)
 asocket*  host_service_to_socket(const char*  name, const char *serial)
 {
     if (!strcmp(name,"track-devices")) {
-        return create_device_tracker();
+        return create_device_tracker(0);
+    } else if (!strcmp(name,"track-devices-delta")) {
+        return create_device_tracker(1);
     } else if (!strncmp(name, "wait-for-", strlen("wait-for-"))) {
         struct state_info* sinfo = malloc(sizeof(struct state_info));
 
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SHELL_SERVICE_H_
+#define _SHELL_SERVICE_H_
+
+#include "file_sync_service.h"  /* MKID(), htoll(), ltohl() */
+
+/* The "shell-server:" service runs any number of commands over one
+** stream, one after the other, without a pty.  Every message is a
+** shmsg header, little-endian, followed by len bytes of payload.
+**
+** The client sends ID_EXEC with the command line as payload, or
+** ID_QUIT to end the session.  For each ID_EXEC the server answers
+** with any number of ID_SOUT and ID_SERR messages carrying what the
+** command wrote to stdout and stderr, then one ID_EXIT message whose
+** len is the wait() status of the command; it has no payload.
+*/
+#define ID_EXEC MKID('E','X','E','C')
+#define ID_SOUT MKID('S','O','U','T')
+#define ID_SERR MKID('S','E','R','R')
+#define ID_EXIT MKID('E','X','I','T')
+#define ID_QUIT MKID('Q','U','I','T')
+
+typedef struct {
+    unsigned id;
+    unsigned len;
+} shmsg;
+
+#define SHELL_COMMAND_MAX (64*1024)
+#define SHELL_DATA_MAX (64*1024)
+
+void shell_server_service(int fd, void *cookie);
+
+#endif
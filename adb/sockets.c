@@ -260,6 +260,17 @@ static void local_socket_close_locked(asocket *s)
     insert_local_socket(s, &local_socket_closing_list);
 }
 
+/* data read from a local socket is sized for the transport that will
+** carry it; sockets that are not (yet) bound to a transport stick to
+** the original payload limit.
+*/
+static size_t local_socket_max_payload(asocket *s)
+{
+    if (s->peer && s->peer->transport)
+        return transport_max_payload(s->peer->transport);
+    return transport_max_payload(s->transport);
+}
+
 static void local_socket_event_func(int fd, unsigned ev, void *_s)
 {
     asocket *s = _s;
@@ -318,9 +329,10 @@ static void local_socket_event_func(int fd, unsigned ev, void *_s)
 
 
     if(ev & FDE_READ){
-        apacket *p = get_apacket();
+        size_t max_payload = local_socket_max_payload(s);
+        apacket *p = get_apacket_sized(max_payload);
         unsigned char *x = p->data;
-        size_t avail = MAX_PAYLOAD;
+        size_t avail = max_payload;
         int r;
         int is_eof = 0;
 
@@ -343,10 +355,10 @@ static void local_socket_event_func(int fd, unsigned ev, void *_s)
         }
         D("LS(%d): fd=%d post avail loop. r=%d is_eof=%d forced_eof=%d\n",
           s->id, s->fd, r, is_eof, s->fde.force_eof);
-        if((avail == MAX_PAYLOAD) || (s->peer == 0)) {
+        if((avail == max_payload) || (s->peer == 0)) {
             put_apacket(p);
         } else {
-            p->len = MAX_PAYLOAD - avail;
+            p->len = max_payload - avail;
 
             r = s->peer->enqueue(s->peer, p);
             D("LS(%d): fd=%d post peer->enqueue(). r=%d\n", s->id, s->fd, r);
@@ -417,7 +429,10 @@ asocket *create_local_service_socket(const char *name)
         return create_jdwp_service_socket();
     }
     if (!strcmp(name,"track-jdwp")) {
-        return create_jdwp_tracker_service_socket();
+        return create_jdwp_tracker_service_socket(0);
+    }
+    if (!strcmp(name,"track-jdwp-delta")) {
+        return create_jdwp_tracker_service_socket(1);
     }
 #endif
     fd = service_to_fd(name);
@@ -460,10 +475,92 @@ static asocket *create_host_service_socket(const char *name, const char* serial)
 typedef struct aremotesocket {
     asocket      socket;
     adisconnect  disconnect;
+
+        /* stream window agreed at A_OPEN time: the number of
+        ** A_WRTE packets that may be in flight in each direction
+        ** before a READY is required.  1 for legacy peers.
+        */
+    unsigned     window;
+        /* A_WRTE packets we sent that the peer has not READY'd yet */
+    unsigned     in_flight;
+        /* A_WRTE packets we received that we have not READY'd yet */
+    unsigned     owed;
 } aremotesocket;
 
+unsigned stream_window_for_open(atransport *t, unsigned proposed)
+{
+    if(t == NULL || t->protocol_version < A_VERSION_STREAM_WINDOW ||
+       proposed == 0)
+        return 1;
+    return (proposed > ADB_STREAM_WINDOW) ? ADB_STREAM_WINDOW : proposed;
+}
+
+static void put_le32(unsigned char *x, unsigned n)
+{
+    x[0] = n;
+    x[1] = n >> 8;
+    x[2] = n >> 16;
+    x[3] = n >> 24;
+}
+
+static unsigned get_le32(const unsigned char *x)
+{
+    return x[0] | (x[1] << 8) | (x[2] << 16) | ((unsigned)x[3] << 24);
+}
+
+void fill_ready_packet(apacket *p, unsigned count)
+{
+    p->msg.command = A_OKAY;
+    p->msg.data_length = 0;
+    if(count > 1) {
+        put_le32(p->data, count);
+        p->msg.data_length = 4;
+    }
+}
+
+unsigned ready_packet_count(apacket *p)
+{
+    if(p->msg.data_length == 4)
+        return get_le32(p->data);
+    return 1;
+}
+
+static int is_remote_socket(asocket *s);
+
+void remote_socket_set_window(asocket *s, unsigned window)
+{
+    D("RS(%d): stream window %d\n", s->id, window);
+    ((aremotesocket*)s)->window = window ? window : 1;
+}
+
+int remote_socket_acked(asocket *s, unsigned count)
+{
+    aremotesocket *rs = (aremotesocket*)s;
+
+    if(!is_remote_socket(s)) return 1;
+
+    rs->in_flight = (count > rs->in_flight) ? 0 : rs->in_flight - count;
+    return rs->in_flight < rs->window;
+}
+
+void remote_socket_hold(asocket *s)
+{
+    if(s && is_remote_socket(s))
+        ((aremotesocket*)s)->owed++;
+}
+
+void remote_socket_release(asocket *s)
+{
+    aremotesocket *rs = (aremotesocket*)s;
+
+    if(s && is_remote_socket(s) && rs->owed > 0)
+        rs->owed--;
+}
+
 static int remote_socket_enqueue(asocket *s, apacket *p)
 {
+    aremotesocket *rs = (aremotesocket*)s;
+
     D("entered remote_socket_enqueue RS(%d) WRITE fd=%d peer.fd=%d\n",
       s->id, s->fd, s->peer->fd);
     p->msg.command = A_WRTE;
@@ -471,15 +568,30 @@ static int remote_socket_enqueue(asocket *s, apacket *p)
     p->msg.arg1 = s->id;
     p->msg.data_length = p->len;
     send_packet(p, s->transport);
-    return 1;
+
+        /* keep accepting data until the window is full */
+    rs->in_flight++;
+    return (rs->in_flight < rs->window) ? 0 : 1;
 }
 
 static void remote_socket_ready(asocket *s)
 {
+    aremotesocket *rs = (aremotesocket*)s;
+    unsigned count = rs->owed;
+
     D("entered remote_socket_ready RS(%d) OKAY fd=%d peer.fd=%d\n",
       s->id, s->fd, s->peer->fd);
+
+        /* with a window we acknowledge everything that was
+        ** backlogged in one READY; legacy streams keep sending
+        ** a READY whatever the count.
+        */
+    if(rs->window > 1 && count == 0)
+        return;
+    rs->owed = 0;
+
     apacket *p = get_apacket();
-    p->msg.command = A_OKAY;
+    fill_ready_packet(p, rs->window > 1 ? count : 1);
     p->msg.arg0 = s->peer->id;
     p->msg.arg1 = s->id;
     send_packet(p, s->transport);
@@ -505,6 +617,11 @@ static void remote_socket_close(asocket *s)
     free(s);
 }
 
+static int is_remote_socket(asocket *s)
+{
+    return s->enqueue == remote_socket_enqueue;
+}
+
 static void remote_socket_disconnect(void*  _s, atransport*  t)
 {
     asocket*  s    = _s;
@@ -530,6 +647,7 @@ asocket *create_remote_socket(unsigned id, atransport *t)
     s->ready = remote_socket_ready;
     s->close = remote_socket_close;
     s->transport = t;
+    ((aremotesocket*)s)->window = 1;
 
     dis->func   = remote_socket_disconnect;
     dis->opaque = s;
@@ -544,13 +662,18 @@ void connect_to_remote(asocket *s, const char *destination)
     apacket *p = get_apacket();
     int len = strlen(destination) + 1;
 
-    if(len > (MAX_PAYLOAD-1)) {
+    if(len > (int)(p->capacity - 1)) {
         fatal("destination oversized");
     }
 
     D("LS(%d): connect('%s')\n", s->id, destination);
     p->msg.command = A_OPEN;
     p->msg.arg0 = s->id;
+        /* propose a stream window to peers that understand one */
+    if(s->transport &&
+       s->transport->protocol_version >= A_VERSION_STREAM_WINDOW) {
+        p->msg.arg1 = ADB_STREAM_WINDOW;
+    }
     p->msg.data_length = len;
     strcpy((char*) p->data, destination);
     send_packet(p, s->transport);
@@ -667,7 +790,7 @@ static int smart_socket_enqueue(asocket *s, apacket *p)
         s->pkt_first = p;
         s->pkt_last = p;
     } else {
-        if((s->pkt_first->len + p->len) > MAX_PAYLOAD) {
+        if((s->pkt_first->len + p->len) > s->pkt_first->capacity) {
             D("SS(%d): overflow\n", s->id);
             put_apacket(p);
             goto fail;
@@ -1933,6 +1933,12 @@ void fdevent_loop()
     }
 }
 
+void fdevent_get_stats(struct fdevent_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->backend = "win32";
+}
+
 /**  FILE EVENT HOOKS
  **/
 
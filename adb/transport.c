@@ -20,6 +20,8 @@
 #include <string.h>
 #include <errno.h>
 
+#include <zlib.h>
+
 #include "sysdeps.h"
 
 #define   TRACE_TAG  TRACE_TRANSPORT
@@ -39,6 +41,117 @@ static atransport pending_list = {
 
 ADB_MUTEX_DEFINE( transport_lock );
 
+/* the transports on transport_list are also hashed by serial and by
+ * devpath, so that "adb -s" finds its device without comparing it with
+ * every other one. all of this is protected by transport_lock.
+ */
+#define TRANSPORT_HASH_SIZE  256
+
+static atransport*  serial_hash[TRANSPORT_HASH_SIZE];
+static atransport*  devpath_hash[TRANSPORT_HASH_SIZE];
+
+static unsigned transport_hash(const char*  key)
+{
+    unsigned  h = 0;
+
+    while (*key)
+        h = h * 31 + (unsigned char)*key++;
+    return h % TRANSPORT_HASH_SIZE;
+}
+
+static void transport_hash_add_locked(atransport*  t)
+{
+    if (t->serial) {
+        atransport**  head = &serial_hash[transport_hash(t->serial)];
+        t->serial_next = *head;
+        *head = t;
+    }
+    if (t->devpath) {
+        atransport**  head = &devpath_hash[transport_hash(t->devpath)];
+        t->devpath_next = *head;
+        *head = t;
+    }
+}
+
+static void transport_hash_remove_locked(atransport*  t)
+{
+    atransport**  pnode;
+
+    if (t->serial) {
+        pnode = &serial_hash[transport_hash(t->serial)];
+        while (*pnode && *pnode != t)
+            pnode = &(*pnode)->serial_next;
+        if (*pnode)
+            *pnode = t->serial_next;
+    }
+    if (t->devpath) {
+        pnode = &devpath_hash[transport_hash(t->devpath)];
+        while (*pnode && *pnode != t)
+            pnode = &(*pnode)->devpath_next;
+        if (*pnode)
+            *pnode = t->devpath_next;
+    }
+}
+
+#if ADB_HOST
+static const char *statename(atransport *t);
+
+/* the changes the delta trackers haven't been sent yet, one line each,
+ * collected under transport_lock until the next update_transports()
+ */
+static char*   tracker_delta;
+static size_t  tracker_delta_len;
+static size_t  tracker_delta_size;
+
+static void tracker_delta_add_locked(char  op, atransport*  t)
+{
+    const char*  serial = t->serial;
+    size_t       need;
+
+    if (!serial || !serial[0])
+        serial = "????????????";
+
+    need = strlen(serial) + 32;
+    if (tracker_delta_len + need > tracker_delta_size) {
+        size_t  size = tracker_delta_size ? tracker_delta_size : 1024;
+        char*   delta;
+
+        while (size < tracker_delta_len + need)
+            size *= 2;
+        delta = realloc(tracker_delta, size);
+        if (delta == NULL) {
+            D("cannot grow the device tracker delta\n");
+            return;
+        }
+        tracker_delta = delta;
+        tracker_delta_size = size;
+    }
+
+    if (op == '-') {
+        tracker_delta_len += snprintf(tracker_delta + tracker_delta_len,
+                                      need, "-%s\n", serial);
+    } else {
+        tracker_delta_len += snprintf(tracker_delta + tracker_delta_len,
+                                      need, "%c%s\t%s\n", op, serial,
+                                      statename(t));
+    }
+}
+#endif
+
+/* takes t off transport_list; transport_lock must be held */
+static void transport_unlink_locked(atransport*  t)
+{
+    t->next->prev = t->prev;
+    t->prev->next = t->next;
+    transport_hash_remove_locked(t);
+#if ADB_HOST
+    if (t->announced) {
+        t->announced = 0;
+        tracker_delta_add_locked('-', t);
+    }
+#endif
+}
+
 #if ADB_TRACE
 #define MAX_DUMP_HEX_LEN 16
 static void  dump_hex( const unsigned char*  ptr, size_t  len )
@@ -200,6 +313,13 @@ write_packet(int  fd, const char* name, apacket** ppacket)
     return 0;
 }
 
+/* Packets from every transport are handled here, on the one fdevent
+** loop thread.  Each transport has its own input and output threads for
+** the device I/O, but the sockets, services and fdevent state that
+** handle_packet() drives are not thread-safe, so there is no event loop
+** per transport.  Only per-byte work that needs none of that state, like
+** the checksums below, is moved out to the transport threads.
+*/
 static void transport_socket_events(int fd, unsigned events, void *_t)
 {
     atransport *t = _t;
@@ -214,22 +334,12 @@ static void transport_socket_events(int fd, unsigned events, void *_t)
     }
 }
 
+/* The header checksum and magic are filled in by the transport's input
+** thread right before the packet goes out, so that summing payloads for
+** every attached device does not all happen on the fdevent loop thread.
+*/
 void send_packet(apacket *p, atransport *t)
 {
-    unsigned char *x;
-    unsigned sum;
-    unsigned count;
-
-    p->msg.magic = p->msg.command ^ 0xffffffff;
-
-    count = p->msg.data_length;
-    x = (unsigned char *) p->data;
-    sum = 0;
-    while(count-- > 0){
-        sum += *x++;
-    }
-    p->msg.data_check = sum;
-
     print_packet("send", p);
 
     if (t == NULL) {
@@ -244,6 +354,82 @@ void send_packet(apacket *p, atransport *t)
     }
 }
 
+/* Payload compression. When both ends advertise "features=deflate"
+** in their CONNECT banners, A_WRTE payloads larger than ADB_COMPRESS_MIN
+** are deflated by the input thread and sent as A_WRTZ, and inflated back
+** into A_WRTE by the peer's output thread. Every packet is compressed on
+** its own, so the streams can be reset freely and nothing above the
+** transport threads ever sees an A_WRTZ packet.
+*/
+
+static void compute_packet_check(apacket *p)
+{
+    unsigned count = p->msg.data_length;
+    unsigned char *x = p->data;
+    unsigned sum = 0;
+
+    while(count-- > 0){
+        sum += *x++;
+    }
+    p->msg.data_check = sum;
+    p->msg.magic = p->msg.command ^ 0xffffffff;
+}
+
+/* returns a new A_WRTZ packet carrying p's payload, or NULL to send p as is */
+static apacket *deflate_packet(z_stream *zs, apacket *p)
+{
+    apacket *z;
+
+    if(p->msg.command != A_WRTE || p->msg.data_length < ADB_COMPRESS_MIN) {
+        return NULL;
+    }
+
+    z = get_apacket_sized(p->msg.data_length);
+    zs->next_in = p->data;
+    zs->avail_in = p->msg.data_length;
+    zs->next_out = z->data;
+    zs->avail_out = p->msg.data_length - 1;
+    if(deflate(zs, Z_FINISH) != Z_STREAM_END) {
+            /* incompressible, or no smaller than the original */
+        deflateReset(zs);
+        put_apacket(z);
+        return NULL;
+    }
+
+    z->msg = p->msg;
+    z->msg.command = A_WRTZ;
+    z->msg.data_length = zs->total_out;
+    deflateReset(zs);
+    compute_packet_check(z);
+    return z;
+}
+
+/* returns the A_WRTE packet for an A_WRTZ one, or NULL if it is corrupt */
+static apacket *inflate_packet(z_stream *zs, apacket *z, atransport *t)
+{
+    apacket *p = get_apacket_sized(t->max_payload);
+    int r;
+
+    zs->next_in = z->data;
+    zs->avail_in = z->msg.data_length;
+    zs->next_out = p->data;
+    zs->avail_out = p->capacity;
+    r = inflate(zs, Z_FINISH);
+    if(r != Z_STREAM_END) {
+        D("%s: cannot inflate packet (%d)\n", t->serial, r);
+        inflateReset(zs);
+        put_apacket(p);
+        return NULL;
+    }
+
+    p->msg = z->msg;
+    p->msg.command = A_WRTE;
+    p->msg.data_length = zs->total_out;
+    inflateReset(zs);
+    compute_packet_check(p);
+    return p;
+}
+
 /* The transport is opened by transport_register_func before
 ** the input and output threads are started.
 **
@@ -261,6 +447,8 @@ static void *output_thread(void *_t)
 {
     atransport *t = _t;
     apacket *p;
+    z_stream zs;
+    int zs_ready = 0;
 
     D("%s: starting transport output thread on fd %d, SYNC online (%d)\n",
        t->serial, t->fd, t->sync_token + 1);
@@ -277,11 +465,31 @@ static void *output_thread(void *_t)
 
     D("%s: data pump started\n", t->serial);
     for(;;) {
-        p = get_apacket();
+            /* size the buffer for the largest payload the peer
+            ** is allowed to send us on this transport
+            */
+        p = get_apacket_sized(t->max_payload);
 
         if(t->read_from_remote(p, t) == 0){
             D("%s: received remote packet, sending to transport\n",
               t->serial);
+            if(p->msg.command == A_WRTZ) {
+                apacket *unz = NULL;
+
+                if(!zs_ready) {
+                    memset(&zs, 0, sizeof(zs));
+                    zs_ready = (inflateInit(&zs) == Z_OK);
+                }
+                if(zs_ready) {
+                    unz = inflate_packet(&zs, p, t);
+                }
+                put_apacket(p);
+                if(unz == NULL) {
+                    D("%s: dropping transport on bad WRTZ packet\n", t->serial);
+                    break;
+                }
+                p = unz;
+            }
             if(write_packet(t->fd, t->serial, &p)){
                 put_apacket(p);
                 D("%s: failed to write apacket to transport\n", t->serial);
@@ -306,6 +514,9 @@ static void *output_thread(void *_t)
     }
 
 oops:
+    if(zs_ready) {
+        inflateEnd(&zs);
+    }
     D("%s: transport output thread is exiting\n", t->serial);
     kick_transport(t);
     transport_unref(t);
@@ -317,6 +528,8 @@ static void *input_thread(void *_t)
     atransport *t = _t;
     apacket *p;
     int active = 0;
+    z_stream zs;
+    int zs_ready = 0;
 
     D("%s: starting transport input thread, reading from fd %d\n",
        t->serial, t->fd);
@@ -343,8 +556,23 @@ static void *input_thread(void *_t)
             }
         } else {
             if(active) {
+                apacket *z = NULL;
+
                 D("%s: transport got packet, sending to remote\n", t->serial);
-                t->write_to_remote(p, t);
+                if(t->compress && !zs_ready) {
+                    memset(&zs, 0, sizeof(zs));
+                    zs_ready = (deflateInit(&zs, Z_BEST_SPEED) == Z_OK);
+                }
+                if(t->compress && zs_ready) {
+                    z = deflate_packet(&zs, p);
+                }
+                if(z) {
+                    t->write_to_remote(z, t);
+                    put_apacket(z);
+                } else {
+                    compute_packet_check(p);
+                    t->write_to_remote(p, t);
+                }
             } else {
                 D("%s: transport ignoring packet while offline\n", t->serial);
             }
@@ -357,6 +585,9 @@ static void *input_thread(void *_t)
     // while a client socket is still active.
     close_all_sockets(t);
 
+    if(zs_ready) {
+        deflateEnd(&zs);
+    }
     D("%s: transport input thread is exiting, fd %d\n", t->serial, t->fd);
     kick_transport(t);
     transport_unref(t);
@@ -391,12 +622,18 @@ typedef struct device_tracker  device_tracker;
 struct device_tracker {
     asocket          socket;
     int              update_needed;
+    int              delta;
     device_tracker*  next;
 };
 
 /* linked list of all device trackers */
 static device_tracker*   device_tracker_list;
 
+/* big enough for a list of a few thousand devices, however many
+ * trackers there are: it is only used from the fdevent thread
+ */
+static char  tracker_list[4 + 0xffff];
+
 static void
 device_tracker_remove( device_tracker*  tracker )
 {
@@ -444,7 +681,8 @@ device_tracker_send( device_tracker*  tracker,
                      const char*      buffer,
                      int              len )
 {
-    apacket*  p = get_apacket();
+    /* the peer is a local socket, so a long list can go in one packet */
+    apacket*  p = get_apacket_sized(len);
     asocket*  peer = tracker->socket.peer;
 
     memcpy(p->data, buffer, len);
@@ -461,19 +699,18 @@ device_tracker_ready( asocket*  socket )
     /* we want to send the device list when the tracker connects
     * for the first time, even if no update occured */
     if (tracker->update_needed > 0) {
-        char  buffer[1024];
         int   len;
 
         tracker->update_needed = 0;
 
-        len = list_transports_msg(buffer, sizeof(buffer));
-        device_tracker_send(tracker, buffer, len);
+        len = list_transports_msg(tracker_list, sizeof(tracker_list));
+        device_tracker_send(tracker, tracker_list, len);
     }
 }
 
 
 asocket*
-create_device_tracker(void)
+create_device_tracker(int  delta)
 {
     device_tracker*  tracker = calloc(1,sizeof(*tracker));
 
@@ -485,6 +722,7 @@ create_device_tracker(void)
     tracker->socket.ready   = device_tracker_ready;
     tracker->socket.close   = device_tracker_close;
     tracker->update_needed  = 1;
+    tracker->delta          = delta;
 
     tracker->next       = device_tracker_list;
     device_tracker_list = tracker;
@@ -493,22 +731,88 @@ create_device_tracker(void)
 }
 
 
+/* frames the delta lines in as many <hex4> messages as they need,
+ * splitting them between two lines */
+static char*
+frame_tracker_delta( const char*  lines, size_t  len, size_t*  framed_len )
+{
+    char*   framed = malloc(len + 4 * (len / 0x8000 + 1));
+    char*   q = framed;
+
+    if (framed == NULL)
+        return NULL;
+
+    while (len > 0) {
+        size_t  n = len;
+        char    head[5];
+
+        if (n > 0xffff) {
+            n = 0xffff;
+            while (n > 1 && lines[n - 1] != '\n')
+                n--;
+        }
+        snprintf(head, sizeof(head), "%04x", (unsigned)n);
+        memcpy(q, head, 4);
+        memcpy(q + 4, lines, n);
+        q     += 4 + n;
+        lines += n;
+        len   -= n;
+    }
+    *framed_len = q - framed;
+    return framed;
+}
+
 /* call this function each time the transport list has changed */
 void  update_transports(void)
 {
-    char             buffer[1024];
-    int              len;
+    char*            delta = NULL;
+    size_t           delta_len = 0;
+    int              list_len = -1;
+    atransport*      t;
     device_tracker*  tracker;
 
-    len = list_transports_msg(buffer, sizeof(buffer));
+    /* find out what changed since the trackers were last told */
+    adb_mutex_lock(&transport_lock);
+    for (t = transport_list.next; t != &transport_list; t = t->next) {
+        if (t->announced && t->announced_state == t->connection_state)
+            continue;
+        tracker_delta_add_locked(t->announced ? '=' : '+', t);
+        t->announced       = 1;
+        t->announced_state = t->connection_state;
+    }
+    if (tracker_delta_len > 0) {
+        delta = frame_tracker_delta(tracker_delta, tracker_delta_len,
+                                    &delta_len);
+        tracker_delta_len = 0;
+    }
+    adb_mutex_unlock(&transport_lock);
+
+    /* a tracker never gets the same list twice in a row */
+    if (delta == NULL)
+        return;
 
     tracker = device_tracker_list;
     while (tracker != NULL) {
         device_tracker*  next = tracker->next;
+
+        /* the ones which haven't had their first list yet will
+         * get the current one when they are ready */
+        if (tracker->update_needed) {
+            tracker = next;
+            continue;
+        }
         /* note: this may destroy the tracker if the connection is closed */
-        device_tracker_send(tracker, buffer, len);
+        if (tracker->delta) {
+            device_tracker_send(tracker, delta, delta_len);
+        } else {
+            if (list_len < 0)
+                list_len = list_transports_msg(tracker_list,
+                                               sizeof(tracker_list));
+            device_tracker_send(tracker, tracker_list, list_len);
+        }
         tracker = next;
     }
+    free(delta);
 }
 #else
 void  update_transports(void)
@@ -596,8 +900,7 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
         adb_close(t->fd);
 
         adb_mutex_lock(&transport_lock);
-        t->next->prev = t->prev;
-        t->prev->next = t->next;
+        transport_unlink_locked(t);
         adb_mutex_unlock(&transport_lock);
 
         run_transport_disconnects(t);
@@ -659,6 +962,7 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
     t->prev = transport_list.prev;
     t->next->prev = t;
     t->prev->next = t;
+    transport_hash_add_locked(t);
     adb_mutex_unlock(&transport_lock);
 
     t->disconnects.next = t->disconnects.prev = &t->disconnects;
@@ -791,6 +1095,59 @@ static int qual_match(const char *to_test,
     return !*to_test;
 }
 
+/* a serial which isn't a product:, model: or device: qualifier can only
+ * match the serials and devpaths of the hash tables */
+static int serial_is_plain(const char *serial)
+{
+    return serial[0] &&
+           strncmp(serial, "product:", 8) &&
+           strncmp(serial, "model:", 6) &&
+           strncmp(serial, "device:", 7);
+}
+
+static int add_serial_match(atransport *t, atransport **result,
+                            char **error_out, int *ambiguous)
+{
+    if (t->connection_state == CS_NOPERM) {
+        if (error_out)
+            *error_out = "insufficient permissions for device";
+        return 1;
+    }
+    if (*result) {
+        if (error_out)
+            *error_out = "more than one device";
+        *ambiguous = 1;
+        *result = NULL;
+        return 0;
+    }
+    *result = t;
+    return 1;
+}
+
+static atransport *find_serial_locked(const char *serial, char **error_out,
+                                      int *ambiguous)
+{
+    unsigned h = transport_hash(serial);
+    atransport *t;
+    atransport *result = NULL;
+
+    for (t = serial_hash[h]; t; t = t->serial_next) {
+        if (strcmp(serial, t->serial))
+            continue;
+        if (!add_serial_match(t, &result, error_out, ambiguous))
+            return NULL;
+    }
+    for (t = devpath_hash[h]; t; t = t->devpath_next) {
+        /* counted already if its serial is the same */
+        if (strcmp(serial, t->devpath) ||
+            (t->serial && !strcmp(serial, t->serial)))
+            continue;
+        if (!add_serial_match(t, &result, error_out, ambiguous))
+            return NULL;
+    }
+    return result;
+}
+
 atransport *acquire_one_transport(int state, transport_type ttype, const char* serial, char** error_out)
 {
     atransport *t;
@@ -802,6 +1159,11 @@ retry:
         *error_out = "device not found";
 
     adb_mutex_lock(&transport_lock);
+    if (serial && serial_is_plain(serial)) {
+        result = find_serial_locked(serial, error_out, &ambiguous);
+        adb_mutex_unlock(&transport_lock);
+        goto found;
+    }
     for (t = transport_list.next; t != &transport_list; t = t->next) {
         if (t->connection_state == CS_NOPERM) {
         if (error_out)
@@ -858,6 +1220,7 @@ retry:
     }
     adb_mutex_unlock(&transport_lock);
 
+found:
     if (result) {
         if (result->connection_state == CS_UNAUTHORIZED) {
             if (error_out)
@@ -1022,8 +1385,8 @@ int register_socket_transport(int s, const char *serial, int port, int local)
         }
     }
 
-    for (n = transport_list.next; n != &transport_list; n = n->next) {
-        if (n->serial && !strcmp(serial, n->serial)) {
+    for (n = serial_hash[transport_hash(serial)]; n; n = n->serial_next) {
+        if (!strcmp(serial, n->serial)) {
             adb_mutex_unlock(&transport_lock);
             free(t);
             return -1;
@@ -1047,24 +1410,20 @@ atransport *find_transport(const char *serial)
     atransport *t;
 
     adb_mutex_lock(&transport_lock);
-    for(t = transport_list.next; t != &transport_list; t = t->next) {
-        if (t->serial && !strcmp(serial, t->serial)) {
+    for(t = serial_hash[transport_hash(serial)]; t; t = t->serial_next) {
+        if (!strcmp(serial, t->serial)) {
             break;
         }
      }
     adb_mutex_unlock(&transport_lock);
 
-    if (t != &transport_list)
-        return t;
-    else
-        return 0;
+    return t;
 }
 
 void unregister_transport(atransport *t)
 {
     adb_mutex_lock(&transport_lock);
-    t->next->prev = t->prev;
-    t->prev->next = t->next;
+    transport_unlink_locked(t);
     adb_mutex_unlock(&transport_lock);
 
     kick_transport(t);
@@ -1079,8 +1438,7 @@ void unregister_all_tcp_transports()
     for (t = transport_list.next; t != &transport_list; t = next) {
         next = t->next;
         if (t->type == kTransportLocal && t->adb_port == 0) {
-            t->next->prev = t->prev;
-            t->prev->next = next;
+            transport_unlink_locked(t);
             // we cannot call kick_transport when holding transport_lock
             if (!t->kicked)
             {
@@ -1126,8 +1484,7 @@ void unregister_usb_transport(usb_handle *usb)
     adb_mutex_lock(&transport_lock);
     for(t = transport_list.next; t != &transport_list; t = t->next) {
         if (t->usb == usb && t->connection_state == CS_NOPERM) {
-            t->next->prev = t->prev;
-            t->prev->next = t->next;
+            transport_unlink_locked(t);
             break;
         }
      }
@@ -1204,8 +1561,9 @@ int check_header(apacket *p)
         return -1;
     }
 
-    if(p->msg.data_length > MAX_PAYLOAD) {
-        D("check_header(): %d > MAX_PAYLOAD\n", p->msg.data_length);
+    if(p->msg.data_length > p->capacity) {
+        D("check_header(): %d > packet capacity %d\n",
+          p->msg.data_length, p->capacity);
         return -1;
     }
 
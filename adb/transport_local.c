@@ -413,6 +413,8 @@ int init_socket_transport(atransport *t, int s, int adb_port, int local)
     t->sfd = s;
     t->sync_token = 1;
     t->connection_state = CS_OFFLINE;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD;
     t->type = kTransportLocal;
     t->adb_port = 0;
 
@@ -118,6 +118,8 @@ void init_usb_transport(atransport *t, usb_handle *h, int state)
     t->write_to_remote = remote_write;
     t->sync_token = 1;
     t->connection_state = state;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD;
     t->type = kTransportUsb;
     t->usb = h;
 
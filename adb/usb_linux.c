@@ -45,6 +45,14 @@
 /* usb scan debugging is waaaay too verbose */
 #define DBGX(x...)
 
+/* A transfer is split into URBs of USB_URB_SIZE, the most any kernel
+** takes in one bulk URB, and up to USB_URBS of them are queued on the
+** endpoint at once so that the host controller always has the next one.
+** That covers a whole MAX_PAYLOAD packet in one go.
+*/
+#define USB_URB_SIZE    (16*1024)
+#define USB_URBS        (MAX_PAYLOAD / USB_URB_SIZE)
+
 ADB_MUTEX_DEFINE( usb_lock );
 
 struct usb_handle
@@ -60,9 +68,10 @@ struct usb_handle
     unsigned zero_mask;
     unsigned writeable;
 
-    struct usbdevfs_urb urb_in;
-    struct usbdevfs_urb urb_out;
+    struct usbdevfs_urb urb_in[USB_URBS];
+    struct usbdevfs_urb urb_out[USB_URBS];
 
+    // number of URBs of each array still queued
     int urb_in_busy;
     int urb_out_busy;
     int dead;
@@ -308,20 +317,89 @@ void usb_cleanup()
 {
 }
 
+/* Queues len bytes of data on ep as up to USB_URBS URBs of urbs[], and
+** returns how many were queued. Those after the first continue the same
+** transfer: if the device ends it early, the kernel drops them instead
+** of filling them from the next one.
+*/
+static int submit_urbs(usb_handle *h, struct usbdevfs_urb *urbs,
+                       unsigned char ep, void *data, int len)
+{
+    int offset = 0;
+    int n = 0;
+    int res;
+
+    do {
+        struct usbdevfs_urb *urb = &urbs[n];
+        int xfer = (len - offset > USB_URB_SIZE) ? USB_URB_SIZE : len - offset;
+
+        memset(urb, 0, sizeof(*urb));
+        urb->type = USBDEVFS_URB_TYPE_BULK;
+        urb->endpoint = ep;
+        urb->status = -1;
+        urb->buffer = (char*) data + offset;
+        urb->buffer_length = xfer;
+#if defined(USBDEVFS_URB_SHORT_NOT_OK) && defined(USBDEVFS_URB_BULK_CONTINUATION)
+        if((ep & USB_DIR_IN) && offset + xfer < len)
+            urb->flags |= USBDEVFS_URB_SHORT_NOT_OK;
+        if((ep & USB_DIR_IN) && n > 0)
+            urb->flags |= USBDEVFS_URB_BULK_CONTINUATION;
+#endif
+
+        do {
+            res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
+        } while((res < 0) && (errno == EINTR));
+        if(res < 0) {
+            D("[ submit urb %d failed, errno = %d ]\n", n, errno);
+            break;
+        }
+
+        offset += xfer;
+        n++;
+    } while(offset < len && n < USB_URBS);
+
+    return n;
+}
+
+/* Adds up the bytes the completed urbs[] moved, up to and including the
+** first one which failed or came up short; errno is set from its status.
+*/
+static int urbs_result(struct usbdevfs_urb *urbs, int n)
+{
+    int count = 0;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        count += urbs[i].actual_length;
+        if(urbs[i].status != 0) {
+            errno = (urbs[i].status < 0) ? -urbs[i].status : EIO;
+            break;
+        }
+        if(urbs[i].actual_length != urbs[i].buffer_length)
+            break;
+    }
+    return count;
+}
+
+static void discard_urbs(usb_handle *h, struct usbdevfs_urb *urbs, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++) {
+        ioctl(h->desc, USBDEVFS_DISCARDURB, &urbs[i]);
+    }
+}
+
+/* The write URBs are reaped by the thread in usb_bulk_read(), which
+** wakes us up once they are all done.
+*/
 static int usb_bulk_write(usb_handle *h, const void *data, int len)
 {
-    struct usbdevfs_urb *urb = &h->urb_out;
     int res;
+    int n, total;
     struct timeval tv;
     struct timespec ts;
 
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_out;
-    urb->status = -1;
-    urb->buffer = (void*) data;
-    urb->buffer_length = len;
-
     D("++ write ++\n");
 
     adb_mutex_lock(&h->lock);
@@ -329,16 +407,20 @@ static int usb_bulk_write(usb_handle *h, const void *data, int len)
         res = -1;
         goto fail;
     }
-    do {
-        res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
-    } while((res < 0) && (errno == EINTR));
 
-    if(res < 0) {
+    total = (len + USB_URB_SIZE - 1) / USB_URB_SIZE;
+    if(total == 0) total = 1;
+    n = submit_urbs(h, h->urb_out, h->ep_out, (void*) data, len);
+    if(n == 0) {
+        res = -1;
         goto fail;
     }
+    if(n < total) {
+        discard_urbs(h, h->urb_out, n);
+    }
 
     res = -1;
-    h->urb_out_busy = 1;
+    h->urb_out_busy = n;
     for(;;) {
         /* time out after five seconds */
         gettimeofday(&tv, NULL);
@@ -349,8 +431,9 @@ static int usb_bulk_write(usb_handle *h, const void *data, int len)
             break;
         }
         if(h->urb_out_busy == 0) {
-            if(urb->status == 0) {
-                res = urb->actual_length;
+            res = urbs_result(h->urb_out, n);
+            if(n < total) {
+                res = -1;
             }
             break;
         }
@@ -363,32 +446,27 @@ fail:
 
 static int usb_bulk_read(usb_handle *h, void *data, int len)
 {
-    struct usbdevfs_urb *urb = &h->urb_in;
     struct usbdevfs_urb *out = NULL;
     int res;
-
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_in;
-    urb->status = -1;
-    urb->buffer = data;
-    urb->buffer_length = len;
-
+    int n, total;
 
     adb_mutex_lock(&h->lock);
     if(h->dead) {
         res = -1;
         goto fail;
     }
-    do {
-        res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
-    } while((res < 0) && (errno == EINTR));
 
-    if(res < 0) {
+    total = (len + USB_URB_SIZE - 1) / USB_URB_SIZE;
+    n = submit_urbs(h, h->urb_in, h->ep_in, data, len);
+    if(n == 0) {
+        res = -1;
         goto fail;
     }
+    if(n < total) {
+        discard_urbs(h, h->urb_in, n);
+    }
 
-    h->urb_in_busy = 1;
+    h->urb_in_busy = n;
     for(;;) {
         D("[ reap urb - wait ]\n");
         h->reaper_thread = pthread_self();
@@ -411,20 +489,22 @@ static int usb_bulk_read(usb_handle *h, void *data, int len)
         D("[ urb @%p status = %d, actual = %d ]\n",
             out, out->status, out->actual_length);
 
-        if(out == &h->urb_in) {
+        if(out >= h->urb_in && out < h->urb_in + USB_URBS) {
+            if(--h->urb_in_busy > 0) {
+                continue;
+            }
             D("[ reap urb - IN complete ]\n");
-            h->urb_in_busy = 0;
-            if(urb->status == 0) {
-                res = urb->actual_length;
-            } else {
+            res = urbs_result(h->urb_in, n);
+            if(n < total) {
                 res = -1;
             }
             break;
         }
-        if(out == &h->urb_out) {
-            D("[ reap urb - OUT compelete ]\n");
-            h->urb_out_busy = 0;
-            adb_cond_broadcast(&h->notify);
+        if(out >= h->urb_out && out < h->urb_out + USB_URBS) {
+            if(--h->urb_out_busy == 0) {
+                D("[ reap urb - OUT compelete ]\n");
+                adb_cond_broadcast(&h->notify);
+            }
         }
     }
 fail:
@@ -450,7 +530,7 @@ int usb_write(usb_handle *h, const void *_data, int len)
     }
 
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > USB_URBS * USB_URB_SIZE) ? USB_URBS * USB_URB_SIZE : len;
 
         n = usb_bulk_write(h, data, xfer);
         if(n != xfer) {
@@ -478,7 +558,7 @@ int usb_read(usb_handle *h, void *_data, int len)
 
     D("++ usb_read ++\n");
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > USB_URBS * USB_URB_SIZE) ? USB_URBS * USB_URB_SIZE : len;
 
         D("[ usb read %d fd = %d], fname=%s\n", xfer, h->desc, h->fname);
         n = usb_bulk_read(h, data, xfer);
@@ -507,6 +587,8 @@ int usb_read(usb_handle *h, void *_data, int len)
 
 void usb_kick(usb_handle *h)
 {
+    int i;
+
     D("[ kicking %p (fd = %d) ]\n", h, h->desc);
     adb_mutex_lock(&h->lock);
     if(h->dead == 0) {
@@ -526,10 +608,12 @@ void usb_kick(usb_handle *h)
             ** but this ensures that a reader blocked on REAPURB
             ** will get unblocked
             */
-            ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_in);
-            ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_out);
-            h->urb_in.status = -ENODEV;
-            h->urb_out.status = -ENODEV;
+            for(i = 0; i < USB_URBS; i++) {
+                ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_in[i]);
+                ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_out[i]);
+                h->urb_in[i].status = -ENODEV;
+                h->urb_out[i].status = -ENODEV;
+            }
             h->urb_in_busy = 0;
             h->urb_out_busy = 0;
             adb_cond_broadcast(&h->notify);
@@ -21,7 +21,9 @@
 
 #include <linux/usb/ch9.h>
 #include <linux/usb/functionfs.h>
+#include <linux/aio_abi.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
@@ -34,9 +36,30 @@
 #define MAX_PACKET_SIZE_FS	64
 #define MAX_PACKET_SIZE_HS	512
 
+/* the legacy f_adb driver rejects transfers larger than its
+** internal request buffer, so larger packets are split up
+*/
+#define MAX_LEGACY_XFER		4096
+
+/* FunctionFS transfers larger than one chunk are split into chunks that
+** are queued on the endpoint together, so the controller always has the
+** next request ready.  Kernels without AIO support on FunctionFS fall
+** back to one blocking read/write at a time.
+*/
+#define USB_FFS_AIO_CHUNK	(16*1024)
+#define USB_FFS_AIO_NUM		16
+
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
+struct usb_ffs_aio
+{
+    aio_context_t ctx;
+    struct iocb iocb[USB_FFS_AIO_NUM];
+    struct iocb *iocbs[USB_FFS_AIO_NUM];
+    struct io_event events[USB_FFS_AIO_NUM];
+};
+
 struct usb_handle
 {
     adb_cond_t notify;
@@ -53,6 +76,12 @@ struct usb_handle
     int control;
     int bulk_out; /* "out" from the host's perspective => source for adbd */
     int bulk_in;  /* "in" from the host's perspective => sink for adbd */
+
+    // FunctionFS AIO; reads and writes run on different threads,
+    // so each direction has its own context
+    int aio_enabled;
+    struct usb_ffs_aio read_aio;
+    struct usb_ffs_aio write_aio;
 };
 
 static const struct {
@@ -183,31 +212,45 @@ static void *usb_adb_open_thread(void *x)
     return 0;
 }
 
-static int usb_adb_write(usb_handle *h, const void *data, int len)
+static int usb_adb_write(usb_handle *h, const void *_data, int len)
 {
+    const char *data = _data;
     int n;
 
     D("about to write (fd=%d, len=%d)\n", h->fd, len);
-    n = adb_write(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
-            h->fd, n, errno, strerror(errno));
-        return -1;
+    while (len > 0) {
+        int xfer = (len > MAX_LEGACY_XFER) ? MAX_LEGACY_XFER : len;
+
+        n = adb_write(h->fd, data, xfer);
+        if(n != xfer) {
+            D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
+                h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        data += xfer;
+        len -= xfer;
     }
     D("[ done fd=%d ]\n", h->fd);
     return 0;
 }
 
-static int usb_adb_read(usb_handle *h, void *data, int len)
+static int usb_adb_read(usb_handle *h, void *_data, int len)
 {
+    char *data = _data;
     int n;
 
     D("about to read (fd=%d, len=%d)\n", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
-            h->fd, n, errno, strerror(errno));
-        return -1;
+    while (len > 0) {
+        int xfer = (len > MAX_LEGACY_XFER) ? MAX_LEGACY_XFER : len;
+
+        n = adb_read(h->fd, data, xfer);
+        if(n != xfer) {
+            D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
+                h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        data += xfer;
+        len -= xfer;
     }
     D("[ done fd=%d ]\n", h->fd);
     return 0;
@@ -360,12 +403,186 @@ static int bulk_write(int bulk_in, const char *buf, size_t length)
     return count;
 }
 
+#ifdef __NR_io_submit
+static int usb_ffs_aio_init(struct usb_ffs_aio *aio)
+{
+    int i;
+
+    memset(aio, 0, sizeof(*aio));
+    for (i = 0; i < USB_FFS_AIO_NUM; i++)
+        aio->iocbs[i] = &aio->iocb[i];
+    return syscall(__NR_io_setup, USB_FFS_AIO_NUM, &aio->ctx);
+}
+
+/* Cancels the chunks after first that are still queued.  Kernels that
+** complete a cancelled iocb synchronously hand back its event here, so
+** those are stored from events on; returns how many were.
+*/
+static int usb_ffs_aio_cancel(struct usb_ffs_aio *aio, int first, int num,
+                              struct io_event *events)
+{
+    int i, n = 0;
+
+    for (i = first; i < num; i++) {
+        if (syscall(__NR_io_cancel, aio->ctx, &aio->iocb[i], &events[n]) == 0)
+            n++;
+    }
+    return n;
+}
+
+/* Queues up to USB_FFS_AIO_NUM chunks of buf on fd at once and waits
+** for all of them.  Returns the number of bytes transferred, or -1.
+** errno is EINVAL if the endpoint does not support AIO at all.
+**
+** A short completion ends the transfer, as it does for a single read():
+** the chunks queued behind it would otherwise wait for whatever the host
+** sends next, so they are cancelled, anything they did receive is moved
+** up against it, and the bytes received so far are returned.
+*/
+static int usb_ffs_aio_xfer(struct usb_ffs_aio *aio, int fd, char *buf,
+                            size_t length, int write)
+{
+    size_t count = 0;
+
+    while (count < length) {
+        long long res[USB_FFS_AIO_NUM];
+        int num = 0, submitted, reaped = 0, cut = -1, i;
+        size_t offset = count;
+        char *base = buf + count;
+
+        while (offset < length && num < USB_FFS_AIO_NUM) {
+            size_t chunk = length - offset;
+            struct iocb *cb = &aio->iocb[num];
+
+            if (chunk > USB_FFS_AIO_CHUNK)
+                chunk = USB_FFS_AIO_CHUNK;
+            memset(cb, 0, sizeof(*cb));
+            cb->aio_fildes = fd;
+            cb->aio_lio_opcode = write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+            cb->aio_buf = (unsigned long)(buf + offset);
+            cb->aio_nbytes = chunk;
+                /* events come back in any order; this puts them back */
+            cb->aio_data = num;
+            res[num] = -ECANCELED;
+            offset += chunk;
+            num++;
+        }
+
+        submitted = syscall(__NR_io_submit, aio->ctx, num, aio->iocbs);
+        if (submitted <= 0) {
+            if (submitted == 0)
+                errno = EIO;
+            return -1;
+        }
+
+        while (reaped < submitted) {
+            int n = syscall(__NR_io_getevents, aio->ctx, 1,
+                            submitted - reaped, aio->events + reaped, NULL);
+            int short_at = -1;
+
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            for (i = reaped; i < reaped + n; i++) {
+                struct io_event *ev = &aio->events[i];
+                res[ev->data] = ev->res;
+                if (ev->res >= 0 &&
+                        (unsigned long long)ev->res < aio->iocb[ev->data].aio_nbytes &&
+                        (short_at < 0 || (int)ev->data < short_at))
+                    short_at = ev->data;
+            }
+            reaped += n;
+
+            if (short_at >= 0 && cut < 0) {
+                D("[ aio short %s fd=%d: %lld of %lld ]\n",
+                  write ? "write" : "read", fd, res[short_at],
+                  (long long)aio->iocb[short_at].aio_nbytes);
+                n = usb_ffs_aio_cancel(aio, short_at + 1, submitted,
+                                       aio->events + reaped);
+                for (i = reaped; i < reaped + n; i++)
+                    res[aio->events[i].data] = aio->events[i].res;
+                reaped += n;
+                cut = short_at;
+            }
+        }
+
+            /* chunks complete in order, so what arrived is contiguous
+            ** once the gaps left by short chunks are closed up
+            */
+        for (i = 0; i < submitted; i++) {
+                /* however the cancelled ones ended, they come after */
+            if (cut >= 0 && i > cut && res[i] < 0)
+                continue;
+            if (res[i] < 0) {
+                errno = -res[i];
+                return -1;
+            }
+            if (buf + count != base + (size_t)i * USB_FFS_AIO_CHUNK)
+                memmove(buf + count, base + (size_t)i * USB_FFS_AIO_CHUNK, res[i]);
+            count += res[i];
+        }
+        if (cut >= 0)
+            break;
+    }
+
+    return count;
+}
+#else
+static int usb_ffs_aio_init(struct usb_ffs_aio *aio)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int usb_ffs_aio_xfer(struct usb_ffs_aio *aio, int fd, char *buf,
+                            size_t length, int write)
+{
+    errno = EINVAL;
+    return -1;
+}
+#endif
+
+static int bulk_read(int bulk_out, char *buf, size_t length);
+
+/* large transfers go through AIO when it is available; the first
+** EINVAL means FunctionFS on this kernel has no AIO support
+*/
+static int usb_ffs_xfer(usb_handle *h, struct usb_ffs_aio *aio, int fd,
+                        char *buf, size_t length, int write)
+{
+    size_t count = 0;
+    int n;
+
+    if (h->aio_enabled && length > USB_FFS_AIO_CHUNK) {
+            /* reads carry on past a short transfer, like bulk_read() */
+        do {
+            n = usb_ffs_aio_xfer(aio, fd, buf + count, length - count, write);
+            if (n < 0)
+                break;
+            count += n;
+        } while (!write && n > 0 && length - count > USB_FFS_AIO_CHUNK);
+        if (n < 0 && errno == EINVAL && count == 0) {
+            D("[ FunctionFS AIO not supported, disabling ]\n");
+            h->aio_enabled = 0;
+        } else if (n < 0 || write || count == length) {
+            return n < 0 ? n : (int)count;
+        }
+    }
+    if (count == length)
+        return count;
+    n = write ? bulk_write(fd, buf + count, length - count)
+              : bulk_read(fd, buf + count, length - count);
+    return n < 0 ? n : (int)(count + n);
+}
+
 static int usb_ffs_write(usb_handle *h, const void *data, int len)
 {
     int n;
 
     D("about to write (fd=%d, len=%d)\n", h->bulk_in, len);
-    n = bulk_write(h->bulk_in, data, len);
+    n = usb_ffs_xfer(h, &h->write_aio, h->bulk_in, (char *)data, len, 1);
     if (n != len) {
         D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
             h->bulk_in, n, errno, strerror(errno));
@@ -401,7 +618,7 @@ static int usb_ffs_read(usb_handle *h, void *data, int len)
     int n;
 
     D("about to read (fd=%d, len=%d)\n", h->bulk_out, len);
-    n = bulk_read(h->bulk_out, data, len);
+    n = usb_ffs_xfer(h, &h->read_aio, h->bulk_out, data, len, 0);
     if (n != len) {
         D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
             h->bulk_out, n, errno, strerror(errno));
@@ -451,6 +668,13 @@ static void usb_ffs_init()
     h->bulk_out = -1;
     h->bulk_out = -1;
 
+    if (usb_ffs_aio_init(&h->read_aio) == 0 &&
+        usb_ffs_aio_init(&h->write_aio) == 0) {
+        h->aio_enabled = 1;
+    } else {
+        D("[ usb_init - no AIO (errno=%d), using blocking I/O ]\n", errno);
+    }
+
     adb_cond_init(&h->notify, 0);
     adb_mutex_init(&h->lock, 0);
 
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/poll.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -66,6 +67,10 @@
 
 #define BATTERY_FULL_THRESH     95
 
+/* how late the kernel may wake us up, so that it can batch our timers
+ * with other wakeups: nothing here needs to be any more precise */
+#define TIMER_SLACK_MS          50
+
 #define LAST_KMSG_PATH          "/proc/last_kmsg"
 #define LAST_KMSG_MAX_SZ        (32 * 1024)
 
@@ -126,6 +131,12 @@ struct charger {
     struct animation *batt_anim;
     gr_surface surf_unknown;
 
+    /* what the last frame drew, so that the next one only redraws that
+     * part of the screen; NULL when that isn't known */
+    gr_surface shown;
+    int shown_x;
+    int shown_y;
+
     struct power_supply *battery;
 };
 
@@ -635,6 +646,10 @@ static int draw_surface_centered(struct charger *charger, gr_surface surface)
 
     LOGV("drawing surface %dx%d+%d+%d\n", w, h, x, y);
     gr_blit(surface, 0, 0, w, h, x, y);
+
+    charger->shown = surface;
+    charger->shown_x = x;
+    charger->shown_y = y;
     return y + h;
 }
 
@@ -650,30 +665,66 @@ static void draw_unknown(struct charger *charger)
     }
 }
 
-static void draw_battery(struct charger *charger)
+/* the frames are only decoded the first time they are shown, so those
+ * below the current battery level usually never are */
+static gr_surface load_frame(struct animation *anim, struct frame *frame)
+{
+    if (!frame->surface &&
+        res_create_surface(frame->name, &frame->surface) < 0) {
+        LOGE("Cannot load image %s\n", frame->name);
+        frame->surface = NULL;
+        /* show the unknown state for the rest of this cycle only */
+        anim->num_frames = 0;
+        anim->num_cycles = anim->cur_cycle + 1;
+    }
+    return frame->surface;
+}
+
+static void draw_battery(struct charger *charger, gr_surface surface)
 {
     struct animation *batt_anim = charger->batt_anim;
     struct frame *frame = &batt_anim->frames[batt_anim->cur_frame];
 
-    if (batt_anim->num_frames != 0) {
-        draw_surface_centered(charger, frame->surface);
-        LOGV("drawing frame #%d name=%s min_cap=%d time=%d\n",
-             batt_anim->cur_frame, frame->name, frame->min_capacity,
-             frame->disp_time);
-    }
+    draw_surface_centered(charger, surface);
+    LOGV("drawing frame #%d name=%s min_cap=%d time=%d\n",
+         batt_anim->cur_frame, frame->name, frame->min_capacity,
+         frame->disp_time);
 }
 
 static void redraw_screen(struct charger *charger)
 {
     struct animation *batt_anim = charger->batt_anim;
+    gr_surface surface = NULL;
+
+    if (batt_anim->capacity >= 0 && batt_anim->num_frames != 0)
+        surface = load_frame(batt_anim,
+                             &batt_anim->frames[batt_anim->cur_frame]);
+
+    /* same frame as the one on screen, e.g. a full battery: nothing to
+     * draw, and no need to flip either */
+    if (charger->shown &&
+        charger->shown == (surface ? surface : charger->surf_unknown)) {
+        LOGV("frame unchanged\n");
+        return;
+    }
 
-    clear_screen();
+    /* only the last frame was drawn on the black background, so it is
+     * enough to clear that */
+    if (charger->shown) {
+        gr_color(0, 0, 0, 255);
+        gr_fill(charger->shown_x, charger->shown_y,
+                charger->shown_x + gr_get_width(charger->shown),
+                charger->shown_y + gr_get_height(charger->shown));
+    } else {
+        clear_screen();
+    }
+    charger->shown = NULL;
 
     /* try to display *something* */
-    if (batt_anim->capacity < 0 || batt_anim->num_frames == 0)
-        draw_unknown(charger);
+    if (surface)
+        draw_battery(charger, surface);
     else
-        draw_battery(charger);
+        draw_unknown(charger);
     gr_flip();
 }
 
@@ -735,9 +786,12 @@ static void update_screen_state(struct charger *charger, int64_t now)
         batt_anim->capacity = batt_cap;
     }
 
-    /* unblank the screen  on first cycle */
-    if (batt_anim->cur_cycle == 0)
+    /* unblank the screen  on first cycle. what was on it may not have
+     * survived the blanking, so redraw all of it */
+    if (batt_anim->cur_cycle == 0) {
         gr_fb_blank(false);
+        charger->shown = NULL;
+    }
 
     /* draw the new frame (@ cur_frame) */
     redraw_screen(charger);
@@ -954,13 +1008,14 @@ int main(int argc, char **argv)
     struct charger *charger = &charger_state;
     int64_t now = curr_time_ms() - 1;
     int fd;
-    int i;
 
     list_init(&charger->supplies);
 
     klog_init();
     klog_set_level(CHARGER_KLOG_LEVEL);
 
+    prctl(PR_SET_TIMERSLACK, TIMER_SLACK_MS * NSEC_PER_MSEC);
+
     dump_last_kmsg();
 
     LOGI("--------------- STARTING CHARGER MODE ---------------\n");
@@ -984,19 +1039,6 @@ int main(int argc, char **argv)
         charger->surf_unknown = NULL;
     }
 
-    for (i = 0; i < charger->batt_anim->num_frames; i++) {
-        struct frame *frame = &charger->batt_anim->frames[i];
-
-        ret = res_create_surface(frame->name, &frame->surface);
-        if (ret < 0) {
-            LOGE("Cannot load image %s\n", frame->name);
-            /* TODO: free the already allocated surfaces... */
-            charger->batt_anim->num_frames = 0;
-            charger->batt_anim->num_cycles = 1;
-            break;
-        }
-    }
-
     ev_sync_key_state(set_key_callback, charger);
 
 #ifndef CHARGER_DISABLE_INIT_BLANK
@@ -8,6 +8,8 @@ LOCAL_SRC_FILES := \
 
 LOCAL_MODULE := mkbootfs
 
+LOCAL_LDLIBS := -lpthread
+
 include $(BUILD_HOST_EXECUTABLE)
 
 $(call dist-for-goals,dist_files,$(LOCAL_BUILT_MODULE))
@@ -11,6 +11,8 @@
 
 #include <stdarg.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <private/android_filesystem_config.h>
 
@@ -21,6 +23,8 @@
 ** - dotfiles are ignored
 ** - directories named 'root' are ignored
 ** - device notes, pipes, etc are not supported (error)
+** - files hard linked together are stored once, and the other names
+**   are empty records with the same inode, which the kernel links
 */
 
 void die(const char *why, ...)
@@ -53,6 +57,43 @@ static struct fs_config_entry* canned_config = NULL;
 static int verbose = 0;
 static int total_size = 0;
 
+/* Everything to archive, in output order.  The tree is walked (and each
+ * entry lstat()ed) once, before any of it is written out.
+ */
+struct entry {
+    char *in;
+    char *out;
+    struct stat s;
+    int link;           /* entry holding the data of this hard link, or -1 */
+    int nlink;          /* names of this file in the archive */
+    unsigned ino;
+
+    /* prefetch state, under prefetch_lock */
+    int state;
+    char *data;
+    int error;
+};
+
+static struct entry *all_entries = NULL;
+static int entry_count = 0;
+static int entry_alloc = 0;
+
+enum { NOT_READ, READING, READ_DONE, TAKEN };
+
+/* Files this big or smaller are read ahead by the -j threads, the others
+ * are streamed straight to the output when we get to them.
+ */
+#define PREFETCH_MAX_FILE   (1024 * 1024)
+#define PREFETCH_WINDOW     (64 * 1024 * 1024)
+#define MAX_THREADS         16
+#define COPY_BUF_SIZE       (1024 * 1024)
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static int prefetch_next = 0;
+static int prefetch_bytes = 0;  /* read ahead but not written out yet */
+static int prefetch_quit = 0;
+
 static void fix_stat(const char *path, struct stat *s)
 {
     uint64_t capabilities;
@@ -83,13 +124,14 @@ static void fix_stat(const char *path, struct stat *s)
     }
 }
 
-static void _eject(struct stat *s, char *out, int olen, char *data, unsigned datasize)
-{
-    // Nothing is special about this value, just picked something in the
-    // approximate range that was being used already, and avoiding small
-    // values which may be special.
-    static unsigned next_inode = 300000;
+// Nothing is special about this value, just picked something in the
+// approximate range that was being used already, and avoiding small
+// values which may be special.
+static unsigned next_inode = 300000;
 
+static void _eject_header(struct stat *s, char *out, int olen, unsigned ino,
+                          int nlink, unsigned datasize)
+{
     while(total_size & 3) {
         total_size++;
         putchar(0);
@@ -101,11 +143,11 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
     printf("%06x%08x%08x%08x%08x%08x%08x"
            "%08x%08x%08x%08x%08x%08x%08x%s%c",
            0x070701,
-           next_inode++,  //  s.st_ino,
+           ino,  //  s.st_ino,
            s->st_mode,
            0, // s.st_uid,
            0, // s.st_gid,
-           1, // s.st_nlink,
+           nlink, // s.st_nlink,
            0, // s.st_mtime,
            datasize,
            0, // volmajor
@@ -126,6 +168,11 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
         total_size++;
         putchar(0);
     }
+}
+
+static void _eject(struct stat *s, char *out, int olen, char *data, unsigned datasize)
+{
+    _eject_header(s, out, olen, next_inode++, 1, datasize);
 
     if(datasize) {
         fwrite(data, datasize, 1, stdout);
@@ -145,20 +192,20 @@ static void _eject_trailer()
     }
 }
 
-static void _archive(char *in, char *out, int ilen, int olen);
+static void _collect(char *in, char *out, int ilen, int olen);
 
 static int compare(const void* a, const void* b) {
   return strcmp(*(const char**)a, *(const char**)b);
 }
 
-static void _archive_dir(char *in, char *out, int ilen, int olen)
+static void _collect_dir(char *in, char *out, int ilen, int olen)
 {
     int i, t;
     DIR *d;
     struct dirent *de;
 
     if(verbose) {
-        fprintf(stderr,"_archive_dir('%s','%s',%d,%d)\n",
+        fprintf(stderr,"_collect_dir('%s','%s',%d,%d)\n",
                 in, out, ilen, olen);
     }
 
@@ -197,6 +244,7 @@ static void _archive_dir(char *in, char *out, int ilen, int olen)
         }
         ++entries;
     }
+    closedir(d);
 
     qsort(names, entries, sizeof(char*), compare);
 
@@ -208,10 +256,10 @@ static void _archive_dir(char *in, char *out, int ilen, int olen)
         if(olen > 0) {
             out[olen] = '/';
             memcpy(out + olen + 1, names[i], t + 1);
-            _archive(in, out, ilen + t + 1, olen + t + 1);
+            _collect(in, out, ilen + t + 1, olen + t + 1);
         } else {
             memcpy(out, names[i], t + 1);
-            _archive(in, out, ilen + t + 1, t);
+            _collect(in, out, ilen + t + 1, t);
         }
 
         in[ilen] = 0;
@@ -222,50 +270,83 @@ static void _archive_dir(char *in, char *out, int ilen, int olen)
     free(names);
 }
 
-static void _archive(char *in, char *out, int ilen, int olen)
+/* Returns the first entry with the same file as e, or -1. */
+static int find_link(const struct entry *e)
 {
-    struct stat s;
+    /* hash of the regular files with more than one link, by (dev, ino) */
+    static int *table = NULL;
+    static unsigned table_size = 0;
+    static unsigned table_used = 0;
+    unsigned h, i;
+
+    if (table_used * 2 >= table_size) {
+        int *old = table;
+        unsigned old_size = table_size;
+
+        table_size = table_size ? table_size * 2 : 1024;
+        table = malloc(table_size * sizeof(int));
+        if (table == NULL) die("cannot allocate the hard link table");
+        memset(table, -1, table_size * sizeof(int));
+        table_used = 0;
+        for (i = 0; i < old_size; i++) {
+            if (old[i] >= 0) find_link(&all_entries[old[i]]);
+        }
+        free(old);
+    }
 
-    if(verbose) {
-        fprintf(stderr,"_archive('%s','%s',%d,%d)\n",
-                in, out, ilen, olen);
+    h = ((unsigned)e->s.st_ino * 31 + (unsigned)e->s.st_dev) & (table_size - 1);
+    while (table[h] >= 0) {
+        const struct entry *o = &all_entries[table[h]];
+        if (o->s.st_ino == e->s.st_ino && o->s.st_dev == e->s.st_dev) {
+            return table[h];
+        }
+        h = (h + 1) & (table_size - 1);
     }
+    table[h] = e - all_entries;
+    table_used++;
+    return -1;
+}
 
-    if(lstat(in, &s)) die("could not stat '%s'\n", in);
+static void _collect(char *in, char *out, int ilen, int olen)
+{
+    struct entry *e;
 
-    if(S_ISREG(s.st_mode)){
-        char *tmp;
-        int fd;
+    if(verbose) {
+        fprintf(stderr,"_collect('%s','%s',%d,%d)\n",
+                in, out, ilen, olen);
+    }
 
-        fd = open(in, O_RDONLY);
-        if(fd < 0) die("cannot open '%s' for read", in);
+    if (entry_count >= entry_alloc) {
+        entry_alloc = entry_alloc ? entry_alloc * 2 : 256;
+        all_entries = realloc(all_entries, entry_alloc * sizeof(struct entry));
+        if (all_entries == NULL) die("cannot allocate %d entries", entry_alloc);
+    }
+    e = &all_entries[entry_count];
+    memset(e, 0, sizeof(*e));
+    e->link = -1;
+    e->nlink = 1;
+
+    if(lstat(in, &e->s)) die("could not stat '%s'\n", in);
+    if(!S_ISREG(e->s.st_mode) && !S_ISDIR(e->s.st_mode) && !S_ISLNK(e->s.st_mode)) {
+        die("Unknown '%s' (mode %d)?\n", in, e->s.st_mode);
+    }
 
-        tmp = (char*) malloc(s.st_size);
-        if(tmp == 0) die("cannot allocate %d bytes", s.st_size);
+    e->in = strdup(in);
+    e->out = strdup(out);
+    if (e->in == NULL || e->out == NULL) die("cannot allocate '%s'", in);
+    entry_count++;
 
-        if(read(fd, tmp, s.st_size) != s.st_size) {
-            die("cannot read %d bytes", s.st_size);
+    if (S_ISREG(e->s.st_mode) && e->s.st_nlink > 1) {
+        e->link = find_link(e);
+        if (e->link >= 0) {
+            all_entries[e->link].nlink++;
         }
-
-        _eject(&s, out, olen, tmp, s.st_size);
-
-        free(tmp);
-        close(fd);
-    } else if(S_ISDIR(s.st_mode)) {
-        _eject(&s, out, olen, 0, 0);
-        _archive_dir(in, out, ilen, olen);
-    } else if(S_ISLNK(s.st_mode)) {
-        char buf[1024];
-        int size;
-        size = readlink(in, buf, 1024);
-        if(size < 0) die("cannot read symlink '%s'", in);
-        _eject(&s, out, olen, buf, size);
-    } else {
-        die("Unknown '%s' (mode %d)?\n", in, s.st_mode);
+    } else if (S_ISDIR(e->s.st_mode)) {
+        _collect_dir(in, out, ilen, olen);
     }
 }
 
-void archive(const char *start, const char *prefix)
+static void collect(const char *start, const char *prefix)
 {
     char in[8192];
     char out[8192];
@@ -273,7 +354,173 @@ void archive(const char *start, const char *prefix)
     strcpy(in, start);
     strcpy(out, prefix);
 
-    _archive_dir(in, out, strlen(in), strlen(out));
+    _collect_dir(in, out, strlen(in), strlen(out));
+}
+
+static int prefetchable(const struct entry *e)
+{
+    return S_ISREG(e->s.st_mode) && e->link < 0 &&
+            e->s.st_size > 0 && e->s.st_size <= PREFETCH_MAX_FILE;
+}
+
+/* Reads the file of e into memory, or returns the errno. */
+static int read_whole(struct entry *e, char **data)
+{
+    int fd, err = 0;
+    char *tmp;
+
+    fd = open(e->in, O_RDONLY);
+    if(fd < 0) return errno;
+
+    tmp = (char*) malloc(e->s.st_size);
+    if(tmp == 0) {
+        err = ENOMEM;
+    } else if(read(fd, tmp, e->s.st_size) != e->s.st_size) {
+        err = EIO;
+        free(tmp);
+        tmp = NULL;
+    }
+    close(fd);
+    *data = tmp;
+    return err;
+}
+
+static void *prefetch_thread(void *arg)
+{
+    struct entry *e;
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (1) {
+        while (prefetch_next < entry_count &&
+                (!prefetchable(&all_entries[prefetch_next]) ||
+                 all_entries[prefetch_next].state != NOT_READ)) {
+            prefetch_next++;
+        }
+        if (prefetch_quit || prefetch_next >= entry_count) break;
+
+        e = &all_entries[prefetch_next];
+        if (prefetch_bytes > 0 && prefetch_bytes + e->s.st_size > PREFETCH_WINDOW) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+            continue;
+        }
+        prefetch_next++;
+        e->state = READING;
+        prefetch_bytes += e->s.st_size;
+        pthread_mutex_unlock(&prefetch_lock);
+
+        e->error = read_whole(e, &e->data);
+
+        pthread_mutex_lock(&prefetch_lock);
+        e->state = READ_DONE;
+        pthread_cond_broadcast(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+    return NULL;
+}
+
+/* Writes the contents of e, which the -j threads may have read already. */
+static void _eject_data(struct entry *e)
+{
+    static char *buf = NULL;
+    ssize_t done = 0;
+    int fd;
+
+    if (prefetchable(e)) {
+        pthread_mutex_lock(&prefetch_lock);
+        if (e->state == NOT_READ) {
+            e->state = TAKEN;
+        } else {
+            while (e->state != READ_DONE) {
+                pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+            }
+            prefetch_bytes -= e->s.st_size;
+            pthread_cond_broadcast(&prefetch_cond);
+        }
+        pthread_mutex_unlock(&prefetch_lock);
+
+        if (e->state == READ_DONE) {
+            if (e->error == EIO) die("cannot read %d bytes", e->s.st_size);
+            if (e->error == ENOMEM) die("cannot allocate %d bytes", e->s.st_size);
+            if (e->error) die("cannot open '%s' for read", e->in);
+            fwrite(e->data, e->s.st_size, 1, stdout);
+            total_size += e->s.st_size;
+            free(e->data);
+            e->data = NULL;
+            return;
+        }
+    }
+
+    if (buf == NULL) {
+        buf = malloc(COPY_BUF_SIZE);
+        if (buf == NULL) die("cannot allocate %d bytes", COPY_BUF_SIZE);
+    }
+
+    fd = open(e->in, O_RDONLY);
+    if(fd < 0) die("cannot open '%s' for read", e->in);
+
+    while (done < e->s.st_size) {
+        ssize_t want = e->s.st_size - done;
+        ssize_t n;
+
+        if (want > COPY_BUF_SIZE) want = COPY_BUF_SIZE;
+        n = read(fd, buf, want);
+        if (n <= 0) die("cannot read %d bytes", e->s.st_size);
+        fwrite(buf, n, 1, stdout);
+        done += n;
+    }
+    total_size += done;
+    close(fd);
+}
+
+static void archive_all(int threads)
+{
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+    int i;
+
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, prefetch_thread, NULL) != 0) break;
+        started++;
+    }
+
+    for (i = 0; i < entry_count; i++) {
+        struct entry *e = &all_entries[i];
+
+        if(verbose) {
+            fprintf(stderr,"_archive('%s','%s')\n", e->in, e->out);
+        }
+
+        if(S_ISREG(e->s.st_mode)) {
+            if (e->link >= 0) {
+                /* an empty record, the kernel links it to the first name */
+                struct entry *first = &all_entries[e->link];
+                _eject_header(&e->s, e->out, strlen(e->out), first->ino,
+                              first->nlink, 0);
+                continue;
+            }
+            e->ino = next_inode++;
+            _eject_header(&e->s, e->out, strlen(e->out), e->ino, e->nlink,
+                          e->s.st_size);
+            _eject_data(e);
+        } else if(S_ISDIR(e->s.st_mode)) {
+            _eject(&e->s, e->out, strlen(e->out), 0, 0);
+        } else {
+            char buf[1024];
+            int size;
+            size = readlink(e->in, buf, 1024);
+            if(size < 0) die("cannot read symlink '%s'", e->in);
+            _eject(&e->s, e->out, strlen(e->out), buf, size);
+        }
+    }
+
+    pthread_mutex_lock(&prefetch_lock);
+    prefetch_quit = 1;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
 }
 
 static void read_canned_config(char* filename)
@@ -322,6 +569,8 @@ static void read_canned_config(char* filename)
 
 int main(int argc, char *argv[])
 {
+    int threads = 0;
+
     argc--;
     argv++;
 
@@ -331,6 +580,13 @@ int main(int argc, char *argv[])
         argv += 2;
     }
 
+    /* -j N reads the small files ahead with N threads */
+    if (argc > 1 && strcmp(argv[0], "-j") == 0) {
+        threads = atoi(argv[1]);
+        argc -= 2;
+        argv += 2;
+    }
+
     if(argc == 0) die("no directories to process?!");
 
     while(argc-- > 0){
@@ -341,11 +597,13 @@ int main(int argc, char *argv[])
             x = "";
         }
 
-        archive(*argv, x);
+        collect(*argv, x);
 
         argv++;
     }
 
+    setvbuf(stdout, NULL, _IOFBF, COPY_BUF_SIZE);
+    archive_all(threads);
     _eject_trailer();
 
     return 0;
@@ -22,10 +22,8 @@
 #include <time.h>
 #include <errno.h>
 #include <limits.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/ptrace.h>
 
 #include <corkscrew/backtrace.h>
 
@@ -62,14 +60,13 @@ static void dump_process_footer(log_t* log, pid_t pid) {
     _LOG(log, SCOPE_AT_FAULT, "\n----- end %d -----\n", pid);
 }
 
-static void dump_thread(log_t* log, pid_t tid, ptrace_context_t* context, bool attached,
-        bool* detach_failed, int* total_sleep_time_usec) {
+static void dump_thread(log_t* log, const thread_backtrace_t* thread) {
     char path[PATH_MAX];
     char threadnamebuf[1024];
     char* threadname = NULL;
     FILE* fp;
 
-    snprintf(path, sizeof(path), "/proc/%d/comm", tid);
+    snprintf(path, sizeof(path), "/proc/%d/comm", thread->tid);
     if ((fp = fopen(path, "r"))) {
         threadname = fgets(threadnamebuf, sizeof(threadnamebuf), fp);
         fclose(fp);
@@ -82,34 +79,22 @@ static void dump_thread(log_t* log, pid_t tid, ptrace_context_t* context, bool a
     }
 
     _LOG(log, SCOPE_AT_FAULT, "\n\"%s\" sysTid=%d\n",
-            threadname ? threadname : "<unknown>", tid);
+            threadname ? threadname : "<unknown>", thread->tid);
 
-    if (!attached && ptrace(PTRACE_ATTACH, tid, 0, 0) < 0) {
-        _LOG(log, SCOPE_AT_FAULT, "Could not attach to thread: %s\n", strerror(errno));
+    if (thread->error) {
+        _LOG(log, SCOPE_AT_FAULT, "Could not attach to thread: %s\n", strerror(thread->error));
         return;
     }
 
-    wait_for_stop(tid, total_sleep_time_usec);
-
-    backtrace_frame_t backtrace[STACK_DEPTH];
-    ssize_t frames = unwind_backtrace_ptrace(tid, context, backtrace, 0, STACK_DEPTH);
-    if (frames <= 0) {
+    if (thread->frame_count <= 0) {
         _LOG(log, SCOPE_AT_FAULT, "Could not obtain stack trace for thread.\n");
     } else {
-        backtrace_symbol_t backtrace_symbols[STACK_DEPTH];
-        get_backtrace_symbols_ptrace(context, backtrace, frames, backtrace_symbols);
-        for (size_t i = 0; i < (size_t)frames; i++) {
+        for (size_t i = 0; i < (size_t)thread->frame_count; i++) {
             char line[MAX_BACKTRACE_LINE_LENGTH];
-            format_backtrace_line(i, &backtrace[i], &backtrace_symbols[i],
+            format_backtrace_line(i, &thread->frames[i], &thread->symbols[i],
                     line, MAX_BACKTRACE_LINE_LENGTH);
             _LOG(log, SCOPE_AT_FAULT, "  %s\n", line);
         }
-        free_backtrace_symbols(backtrace_symbols, frames);
-    }
-
-    if (!attached && ptrace(PTRACE_DETACH, tid, 0, 0) != 0) {
-        LOG("ptrace detach from %d failed: %s\n", tid, strerror(errno));
-        *detach_failed = true;
     }
 }
 
@@ -122,27 +107,23 @@ void dump_backtrace(int fd, int amfd, pid_t pid, pid_t tid, bool* detach_failed,
 
     ptrace_context_t* context = load_ptrace_context(tid);
     dump_process_header(&log, pid);
-    dump_thread(&log, tid, context, true, detach_failed, total_sleep_time_usec);
-
-    char task_path[64];
-    snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
-    DIR* d = opendir(task_path);
-    if (d != NULL) {
-        struct dirent* de = NULL;
-        while ((de = readdir(d)) != NULL) {
-            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
-                continue;
-            }
 
-            char* end;
-            pid_t new_tid = strtoul(de->d_name, &end, 10);
-            if (*end || new_tid == tid) {
-                continue;
+    /* tid is already stopped; unwind_backtrace_process() stops the rest of the
+     * threads together and lets each go again as soon as its stack is walked. */
+    wait_for_stop(tid, total_sleep_time_usec);
+    thread_backtrace_t* threads;
+    ssize_t count = unwind_backtrace_process(pid, tid, context, STACK_DEPTH, &threads);
+    if (count < 0) {
+        _LOG(&log, SCOPE_AT_FAULT, "Could not obtain stack traces for process.\n");
+    } else {
+        for (ssize_t i = 0; i < count; i++) {
+            dump_thread(&log, &threads[i]);
+            if (threads[i].detach_failed) {
+                LOG("ptrace detach from %d failed\n", threads[i].tid);
+                *detach_failed = true;
             }
-
-            dump_thread(&log, new_tid, context, false, detach_failed, total_sleep_time_usec);
         }
-        closedir(d);
+        free_process_backtrace(threads, count);
     }
 
     dump_process_footer(&log, pid);
@@ -49,6 +49,14 @@
 #include "tombstone.h"
 #include "utility.h"
 
+/* Crashes are handled in parallel, by up to this many children */
+#define MAX_CONCURRENT_REQUESTS 4
+
+/* Request children still running.  Any other children are the log
+ * dumpers finish_tombstone() leaves behind when a request is handled inline. */
+static pid_t request_pids[MAX_CONCURRENT_REQUESTS];
+static int active_requests;
+
 typedef struct {
     debugger_action_t action;
     pid_t pid, tid;
@@ -295,6 +303,7 @@ static void handle_request(int fd) {
         } else {
             bool detach_failed = false;
             bool attach_gdb = should_attach_gdb(&request);
+            int tombstone_log_fd = -1;
             if (TEMP_FAILURE_RETRY(write(fd, "\0", 1)) != 1) {
                 LOG("failed responding to client: %s\n", strerror(errno));
             } else {
@@ -318,7 +327,7 @@ static void handle_request(int fd) {
                             XLOG("stopped -- dumping to tombstone\n");
                             tombstone_path = engrave_tombstone(request.pid, request.tid,
                                     signal, request.abort_msg_address, true, true, &detach_failed,
-                                    &total_sleep_time_usec);
+                                    &total_sleep_time_usec, &tombstone_log_fd);
                         } else if (request.action == DEBUGGER_ACTION_DUMP_BACKTRACE) {
                             XLOG("stopped -- dumping to fd\n");
                             dump_backtrace(fd, -1,
@@ -356,7 +365,7 @@ static void handle_request(int fd) {
                          * makes the process less reliable, apparently... */
                         tombstone_path = engrave_tombstone(request.pid, request.tid,
                                 signal, request.abort_msg_address, !attach_gdb, false,
-                                &detach_failed, &total_sleep_time_usec);
+                                &detach_failed, &total_sleep_time_usec, &tombstone_log_fd);
                         break;
                     }
 
@@ -407,6 +416,11 @@ static void handle_request(int fd) {
             /* resume stopped process (so it can crash in peace). */
             kill(request.pid, SIGCONT);
 
+            /* the logs don't need the process stopped, so they come last */
+            if (tombstone_log_fd >= 0) {
+                finish_tombstone(tombstone_log_fd, request.pid);
+            }
+
             /* If we didn't successfully detach, we're still the parent, and the
              * actual parent won't receive a death notification via wait(2).  At this point
              * there's not much we can do about that. */
@@ -422,6 +436,31 @@ static void handle_request(int fd) {
     }
 }
 
+/* Reaps finished children, if block waiting for a request child to finish */
+static void reap_requests(bool block) {
+    for (;;) {
+        int i;
+        pid_t pid = waitpid(-1, NULL, block && active_requests > 0 ? 0 : WNOHANG);
+        if (pid < 0 && errno == EINTR) {
+            continue;
+        }
+        if (pid <= 0) {
+            if (pid < 0) {
+                /* ECHILD: nothing left to reap, so our list is off */
+                active_requests = 0;
+            }
+            break;
+        }
+        for (i = 0; i < active_requests; i++) {
+            if (request_pids[i] == pid) {
+                request_pids[i] = request_pids[--active_requests];
+                block = false;
+                break;
+            }
+        }
+    }
+}
+
 static int do_server() {
     int s;
     struct sigaction act;
@@ -451,10 +490,11 @@ static int do_server() {
         fcntl(logsocket, F_SETFD, FD_CLOEXEC);
     }
 
+    /* children, request and log alike, are reaped by reap_requests() */
     act.sa_handler = SIG_DFL;
     sigemptyset(&act.sa_mask);
     sigaddset(&act.sa_mask,SIGCHLD);
-    act.sa_flags = SA_NOCLDWAIT;
+    act.sa_flags = 0;
     sigaction(SIGCHLD, &act, 0);
 
     s = socket_local_server(DEBUGGER_SOCKET_NAME,
@@ -469,6 +509,8 @@ static int do_server() {
         socklen_t alen;
         int fd;
 
+        reap_requests(active_requests >= MAX_CONCURRENT_REQUESTS);
+
         alen = sizeof(addr);
         XLOG("waiting for connection\n");
         fd = accept(s, &addr, &alen);
@@ -479,7 +521,26 @@ static int do_server() {
 
         fcntl(fd, F_SETFD, FD_CLOEXEC);
 
-        handle_request(fd);
+        /*
+         * Each request keeps its target stopped until it is done, so handle
+         * it in a child of its own rather than queue the next crash behind.
+         */
+        pid_t child = fork();
+        if (child == 0) {
+            close(s);
+            /* its own children (see finish_tombstone) are never waited for */
+            act.sa_flags = SA_NOCLDWAIT;
+            sigaction(SIGCHLD, &act, 0);
+            handle_request(fd);
+            _exit(0);
+        }
+        if (child > 0) {
+            request_pids[active_requests++] = child;
+            close(fd);
+        } else {
+            XLOG("fork failed, handling request inline: %s\n", strerror(errno));
+            handle_request(fd);
+        }
     }
     return 0;
 }
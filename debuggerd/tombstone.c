@@ -20,12 +20,15 @@
 #include <signal.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
 #include <time.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 
 #include <private/android_filesystem_config.h>
 
@@ -48,6 +51,9 @@
 #define STACK_WORDS 16
 
 #define MAX_TOMBSTONES  10
+/* In a crash storm, at most this many tombstone files per window */
+#define MAX_RECENT_TOMBSTONES       5
+#define RECENT_TOMBSTONE_WINDOW_SEC 60
 #define TOMBSTONE_DIR   "/data/tombstones"
 
 /* Must match the path defined in NativeCrashListener.java */
@@ -247,11 +253,11 @@ static void dump_backtrace(const ptrace_context_t* context __attribute((unused))
     free_backtrace_symbols(backtrace_symbols, frames);
 }
 
-static void dump_stack_segment(const ptrace_context_t* context, log_t* log, pid_t tid,
-        int scopeFlags, uintptr_t* sp, size_t words, int label) {
+static void dump_stack_segment(const ptrace_context_t* context, const memory_t* memory,
+        log_t* log, int scopeFlags, uintptr_t* sp, size_t words, int label) {
     for (size_t i = 0; i < words; i++) {
         uint32_t stack_content;
-        if (!try_get_word_ptrace(tid, *sp, &stack_content)) {
+        if (!try_get_word(memory, *sp, &stack_content)) {
             break;
         }
 
@@ -315,9 +321,13 @@ static void dump_stack(const ptrace_context_t* context, log_t* log, pid_t tid, b
     int scopeFlags = SCOPE_SENSITIVE | (at_fault ? SCOPE_AT_FAULT : 0);
     _LOG(log, scopeFlags, "\nstack:\n");
 
+    // Read the stack a page at a time rather than a word at a time.
+    memory_t memory;
+    init_memory_ptrace_context(&memory, context, tid);
+
     // Dump a few words before the first frame.
     uintptr_t sp = backtrace[first].stack_top - STACK_WORDS * sizeof(uint32_t);
-    dump_stack_segment(context, log, tid, scopeFlags, &sp, STACK_WORDS, -1);
+    dump_stack_segment(context, &memory, log, scopeFlags, &sp, STACK_WORDS, -1);
 
     // Dump a few words from all successive frames.
     // Only log the first 3 frames, put the rest in the tombstone.
@@ -331,7 +341,7 @@ static void dump_stack(const ptrace_context_t* context, log_t* log, pid_t tid, b
             scopeFlags &= (~SCOPE_AT_FAULT);
         }
         if (i == last) {
-            dump_stack_segment(context, log, tid, scopeFlags, &sp, STACK_WORDS, i);
+            dump_stack_segment(context, &memory, log, scopeFlags, &sp, STACK_WORDS, i);
             if (sp < frame->stack_top + frame->stack_size) {
                 _LOG(log, scopeFlags, "         ........  ........\n");
             }
@@ -342,7 +352,7 @@ static void dump_stack(const ptrace_context_t* context, log_t* log, pid_t tid, b
             } else if (words > STACK_WORDS) {
                 words = STACK_WORDS;
             }
-            dump_stack_segment(context, log, tid, scopeFlags, &sp, words, i);
+            dump_stack_segment(context, &memory, log, scopeFlags, &sp, words, i);
         }
     }
 }
@@ -480,23 +490,49 @@ static bool dump_sibling_thread_report(const ptrace_context_t* context,
     return detach_failed;
 }
 
+/* The output lines of one log device that came from the crashing process */
+typedef struct {
+    const char* filename;
+    char* lines;            /* each line is NUL-terminated, oldest first */
+    size_t len;
+    size_t cap;
+    int entries;            /* how many lines are log entries */
+} log_lines_t;
+
+static void add_log_line(log_lines_t* ll, const char* fmt, ...)
+        __attribute__ ((format(printf, 2, 3)));
+
+static void add_log_line(log_lines_t* ll, const char* fmt, ...)
+{
+    char line[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    size_t len = strlen(line) + 1;
+    if (ll->len + len > ll->cap) {
+        size_t cap = ll->cap ? ll->cap * 2 : 16384;
+        char* lines = realloc(ll->lines, cap);
+        if (lines == NULL) {
+            return;
+        }
+        ll->lines = lines;
+        ll->cap = cap;
+    }
+    memcpy(ll->lines + ll->len, line, len);
+    ll->len += len;
+}
+
 /*
- * Reads the contents of the specified log device, filters out the entries
- * that don't match the specified pid, and writes them to the tombstone file.
- *
- * If "tailOnly" is set, we only print the last few lines.
+ * Reads the contents of the specified log device once, and keeps the
+ * entries that match the specified pid, formatted for the tombstone.
  */
-static void dump_log_file(log_t* log, pid_t pid, const char* filename,
-    bool tailOnly)
+static void read_log_file(log_lines_t* ll, pid_t pid, const char* filename)
 {
-    bool first = true;
-
-    /* circular buffer, for "tailOnly" mode */
-    const int kShortLogMaxLines = 5;
-    const int kShortLogLineLen = 256;
-    char shortLog[kShortLogMaxLines][kShortLogLineLen];
-    int shortLogCount = 0;
-    int shortLogNext = 0;
+    memset(ll, 0, sizeof(*ll));
+    ll->filename = filename;
 
     int logfd = open(filename, O_RDONLY | O_NONBLOCK);
     if (logfd < 0) {
@@ -519,12 +555,12 @@ static void dump_log_file(log_t* log, pid_t pid, const char* filename,
                 /* non-blocking EOF; we're done */
                 break;
             } else {
-                _LOG(log, 0, "Error while reading log: %s\n",
+                add_log_line(ll, "Error while reading log: %s",
                     strerror(errno));
                 break;
             }
         } else if (actual == 0) {
-            _LOG(log, 0, "Got zero bytes while reading log: %s\n",
+            add_log_line(ll, "Got zero bytes while reading log: %s",
                 strerror(errno));
             break;
         }
@@ -543,12 +579,6 @@ static void dump_log_file(log_t* log, pid_t pid, const char* filename,
             continue;
         }
 
-        if (first) {
-            _LOG(log, 0, "--------- %slog %s\n",
-                tailOnly ? "tail end of " : "", filename);
-            first = false;
-        }
-
         /*
          * Msg format is: <priority:1><tag:N>\0<message:N>\0
          *
@@ -578,50 +608,70 @@ static void dump_log_file(log_t* log, pid_t pid, const char* filename,
         ptm = localtime_r(&sec, &tmBuf);
         strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
 
-        if (tailOnly) {
-            snprintf(shortLog[shortLogNext], kShortLogLineLen,
-                "%s.%03d %5d %5d %c %-8s: %s",
-                timeBuf, entry->nsec / 1000000, entry->pid, entry->tid,
-                prioChar, tag, msg);
-            shortLogNext = (shortLogNext + 1) % kShortLogMaxLines;
-            shortLogCount++;
-        } else {
-            _LOG(log, 0, "%s.%03d %5d %5d %c %-8s: %s\n",
-                timeBuf, entry->nsec / 1000000, entry->pid, entry->tid,
-                prioChar, tag, msg);
-        }
+        add_log_line(ll, "%s.%03d %5d %5d %c %-8s: %s",
+            timeBuf, entry->nsec / 1000000, entry->pid, entry->tid,
+            prioChar, tag, msg);
+        ll->entries++;
     }
 
-    if (tailOnly) {
-        int i;
+    close(logfd);
+}
 
-        /*
-         * If we filled the buffer, we want to start at "next", which has
-         * the oldest entry.  If we didn't, we want to start at zero.
-         */
-        if (shortLogCount < kShortLogMaxLines) {
-            shortLogNext = 0;
-        } else {
-            shortLogCount = kShortLogMaxLines;  /* cap at window size */
-        }
+/*
+ * Writes the lines read from one log device to the tombstone.
+ *
+ * If "tailOnly" is set, we only print the last few lines.
+ */
+static void write_log_lines(log_t* log, const log_lines_t* ll, bool tailOnly)
+{
+    const int kShortLogMaxLines = 5;
+    const char* line = ll->lines;
+    const char* end = ll->lines + ll->len;
 
-        for (i = 0; i < shortLogCount; i++) {
-            _LOG(log, 0, "%s\n", shortLog[shortLogNext]);
-            shortLogNext = (shortLogNext + 1) % kShortLogMaxLines;
+    if (ll->entries) {
+        _LOG(log, 0, "--------- %slog %s\n",
+            tailOnly ? "tail end of " : "", ll->filename);
+    }
+
+    if (tailOnly) {
+        /* walk back from the end to the start of the last few lines */
+        int count = 0;
+        const char* p = end;
+        while (p > ll->lines && count <= kShortLogMaxLines) {
+            p--;
+            while (p > ll->lines && p[-1] != '\0') {
+                p--;
+            }
+            count++;
         }
+        line = count > kShortLogMaxLines ? p + strlen(p) + 1 : p;
     }
 
-    close(logfd);
+    while (line < end) {
+        _LOG(log, 0, "%s\n", line);
+        line += strlen(line) + 1;
+    }
 }
 
 /*
  * Dumps the logs generated by the specified pid to the tombstone, from both
- * "system" and "main" log devices.  Ideally we'd interleave the output.
+ * "system" and "main" log devices: the tail end of each, then all of each.
+ * Each device is read only once.  Ideally we'd interleave the output.
  */
-static void dump_logs(log_t* log, pid_t pid, bool tailOnly)
+static void dump_logs(log_t* log, pid_t pid)
 {
-    dump_log_file(log, pid, "/dev/log/system", tailOnly);
-    dump_log_file(log, pid, "/dev/log/main", tailOnly);
+    log_lines_t system_log, main_log;
+
+    read_log_file(&system_log, pid, "/dev/log/system");
+    read_log_file(&main_log, pid, "/dev/log/main");
+
+    write_log_lines(log, &system_log, true);
+    write_log_lines(log, &main_log, true);
+    write_log_lines(log, &system_log, false);
+    write_log_lines(log, &main_log, false);
+
+    free(system_log.lines);
+    free(main_log.lines);
 }
 
 static void dump_abort_message(log_t* log, pid_t tid, uintptr_t address) {
@@ -660,16 +710,12 @@ static void dump_abort_message(log_t* log, pid_t tid, uintptr_t address) {
 }
 
 /*
- * Dumps all information about the specified pid to the tombstone.
+ * Dumps everything about the specified pid that needs it stopped to the
+ * tombstone.  The logs are left for finish_tombstone().
  */
 static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, uintptr_t abort_msg_address,
                        bool dump_sibling_threads, int* total_sleep_time_usec)
 {
-    /* don't copy log messages to tombstone unless this is a dev device */
-    char value[PROPERTY_VALUE_MAX];
-    property_get("ro.debuggable", value, "0");
-    bool want_logs = (value[0] == '1');
-
     if (log->amfd >= 0) {
         /*
          * Activity Manager protocol: binary 32-bit network-byte-order ints for the
@@ -695,10 +741,6 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, uintptr_t a
     ptrace_context_t* context = load_ptrace_context(tid);
     dump_thread(context, log, tid, true, total_sleep_time_usec);
 
-    if (want_logs) {
-        dump_logs(log, pid, true);
-    }
-
     bool detach_failed = false;
     if (dump_sibling_threads) {
         detach_failed = dump_sibling_thread_report(context, log, pid, tid, total_sleep_time_usec);
@@ -706,10 +748,6 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, uintptr_t a
 
     free_ptrace_context(context);
 
-    if (want_logs) {
-        dump_logs(log, pid, false);
-    }
-
     /* send EOD to the Activity Manager, then wait for its ack to avoid racing ahead
      * and killing the target out from under it */
     if (log->amfd >= 0) {
@@ -728,10 +766,14 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, uintptr_t a
  * file is available, we reuse the least-recently-modified file.
  *
  * Returns the path of the tombstone file, allocated using malloc().  Caller must free() it.
+ * Returns NULL without a file if MAX_RECENT_TOMBSTONES were written in the
+ * last RECENT_TOMBSTONE_WINDOW_SEC seconds.
  */
 static char* find_and_open_tombstone(int* fd)
 {
     unsigned long mtime = ULONG_MAX;
+    unsigned long recent = time(NULL) - RECENT_TOMBSTONE_WINDOW_SEC;
+    int recent_count = 0;
     struct stat sb;
 
     /*
@@ -754,6 +796,10 @@ static char* find_and_open_tombstone(int* fd)
                 oldest = i;
                 mtime = sb.st_mtime;
             }
+            if ((unsigned long) sb.st_mtime >= recent && ++recent_count >= MAX_RECENT_TOMBSTONES) {
+                LOG("too many recent tombstones, not writing another\n");
+                return NULL;
+            }
             continue;
         }
         if (errno != ENOENT)
@@ -809,7 +855,9 @@ static int activity_manager_connect() {
 
 char* engrave_tombstone(pid_t pid, pid_t tid, int signal, uintptr_t abort_msg_address,
         bool dump_sibling_threads, bool quiet, bool* detach_failed,
-        int* total_sleep_time_usec) {
+        int* total_sleep_time_usec, int* log_fd) {
+    *log_fd = -1;
+
     mkdir(TOMBSTONE_DIR, 0755);
     chown(TOMBSTONE_DIR, AID_SYSTEM, AID_SYSTEM);
 
@@ -818,21 +866,63 @@ char* engrave_tombstone(pid_t pid, pid_t tid, int signal, uintptr_t abort_msg_ad
         return NULL;
     }
 
-    int fd;
+    /* other crashes may be handled at the same time, so pick a slot alone */
+    int dirfd = open(TOMBSTONE_DIR, O_RDONLY);
+    if (dirfd >= 0) {
+        TEMP_FAILURE_RETRY( flock(dirfd, LOCK_EX) );
+    }
+    int fd = -1;
     char* path = find_and_open_tombstone(&fd);
-    if (!path) {
-        *detach_failed = false;
-        return NULL;
+    if (dirfd >= 0) {
+        close(dirfd);
     }
 
+    /* without a file, the crash still goes to the log and Activity Manager */
     log_t log;
-    log.tfd = fd;
+    log.tfd = path ? fd : -1;
     log.amfd = activity_manager_connect();
     log.quiet = quiet;
     *detach_failed = dump_crash(&log, pid, tid, signal, abort_msg_address, dump_sibling_threads,
             total_sleep_time_usec);
 
     close(log.amfd);
-    close(fd);
+    if (!path) {
+        return NULL;
+    }
+
+    /* don't copy log messages to tombstone unless this is a dev device */
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.debuggable", value, "0");
+    if (value[0] == '1') {
+        *log_fd = fd;
+    } else {
+        close(fd);
+    }
     return path;
 }
+
+void finish_tombstone(int fd, pid_t pid) {
+    /*
+     * Reading the logs can take a while, so do it in a child and get back to
+     * serving crashes.  SIGCHLD is set to SA_NOCLDWAIT, so nobody need reap it.
+     */
+    pid_t child = fork();
+    if (child > 0) {
+        close(fd);
+        return;
+    }
+    if (child < 0) {
+        XLOG("fork failed, dumping logs inline: %s\n", strerror(errno));
+    }
+
+    log_t log;
+    log.tfd = fd;
+    log.amfd = -1;
+    log.quiet = true;
+    dump_logs(&log, pid);
+    close(fd);
+
+    if (child == 0) {
+        _exit(0);
+    }
+}
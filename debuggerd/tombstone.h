@@ -24,8 +24,16 @@
 #include <corkscrew/ptrace.h>
 
 /* Creates a tombstone file and writes the crash dump to it.
- * Returns the path of the tombstone, which must be freed using free(). */
+ * Returns the path of the tombstone, which must be freed using free().
+ * If the process logs belong in the tombstone, *log_fd is left open for
+ * finish_tombstone(), otherwise it is set to -1. */
 char* engrave_tombstone(pid_t pid, pid_t tid, int signal, uintptr_t abort_msg_address,
-        bool dump_sibling_threads, bool quiet, bool* detach_failed, int* total_sleep_time_usec);
+        bool dump_sibling_threads, bool quiet, bool* detach_failed, int* total_sleep_time_usec,
+        int* log_fd);
+
+/* Appends the logs of pid to the tombstone open on fd, and closes it.
+ * Call once the process has been released; the work is done in the
+ * background. */
+void finish_tombstone(int fd, pid_t pid);
 
 #endif // _DEBUGGERD_TOMBSTONE_H
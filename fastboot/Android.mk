@@ -24,6 +24,7 @@ LOCAL_MODULE_TAGS := debug
 
 ifeq ($(HOST_OS),linux)
   LOCAL_SRC_FILES += usb_linux.c util_linux.c
+  LOCAL_LDLIBS += -lpthread
 endif
 
 ifeq ($(HOST_OS),darwin)
@@ -74,6 +75,25 @@ LOCAL_MODULE := usbtest
 include $(BUILD_HOST_EXECUTABLE)
 endif
 
+ifneq ($(filter linux darwin,$(HOST_OS)),)
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := fastboot_bench.c protocol.c
+LOCAL_MODULE := fastboot_bench
+LOCAL_MODULE_TAGS := optional
+ifeq ($(HOST_OS),linux)
+  LOCAL_SRC_FILES += usb_linux.c
+  LOCAL_LDLIBS += -lpthread
+endif
+ifeq ($(HOST_OS),darwin)
+  LOCAL_SRC_FILES += usb_osx.c
+  LOCAL_LDLIBS += -lpthread -framework CoreFoundation -framework IOKit \
+	-framework Carbon
+endif
+LOCAL_STATIC_LIBRARIES := libsparse_host libz
+include $(BUILD_HOST_EXECUTABLE)
+endif
+
 ifeq ($(HOST_OS),windows)
 $(LOCAL_INSTALLED_MODULE): $(HOST_OUT_EXECUTABLES)/AdbWinApi.dll
 endif
+
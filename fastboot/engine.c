@@ -573,19 +573,82 @@ void fb_queue_notice(const char *notice)
     a->data = (void*) notice;
 }
 
+/* Whether the device keeps writing a flashed image in the background,
+ * letting the next download overlap with it.  Such writes are waited
+ * for with "sync" before any other command is sent.
+ */
+static int fb_pipelined_flash(usb_handle *usb)
+{
+    char resp[FB_RESPONSE_SZ+1];
+
+    if (fb_getvar(usb, resp, "pipelined-flash")) return 0;
+    return !strcmp(resp, "yes");
+}
+
+static int sync_writes(usb_handle *usb)
+{
+    double start = now();
+    int status;
+
+    fprintf(stderr,"waiting for writes to finish...\n");
+    status = fb_command(usb, "sync");
+    if (status) {
+        fprintf(stderr,"FAILED (%s)\n", fb_get_error());
+    } else {
+        fprintf(stderr,"OKAY [%7.3fs]\n", (now() - start));
+    }
+    return status;
+}
+
+/* Hand every sparse image in the queue to the prefetch thread, so that
+ * the next one is read and packed while the current one is sent.
+ */
+static void prefetch_queue(void)
+{
+    static struct sparse_file **files;
+    Action *a;
+    int count = 0;
+
+    for (a = action_list; a; a = a->next) {
+        if (a->op == OP_DOWNLOAD_SPARSE) count++;
+    }
+    if (count == 0) return;
+
+    free(files);
+    files = malloc(count * sizeof(*files));
+    if (files == 0) return;
+
+    count = 0;
+    for (a = action_list; a; a = a->next) {
+        if (a->op == OP_DOWNLOAD_SPARSE) files[count++] = a->data;
+    }
+    fb_prefetch_sparse(files, count);
+}
+
 int fb_execute_queue(usb_handle *usb)
 {
     Action *a;
     char resp[FB_RESPONSE_SZ+1];
     int status = 0;
+    int pipelined;
+    int pending = 0;
 
     a = action_list;
     if (!a)
         return status;
     resp[FB_RESPONSE_SZ] = 0;
 
+    pipelined = fb_pipelined_flash(usb);
+    prefetch_queue();
+
     double start = -1;
     for (a = action_list; a; a = a->next) {
+        if (pending && a->op != OP_DOWNLOAD && a->op != OP_DOWNLOAD_SPARSE &&
+                a->op != OP_NOTICE && strncmp(a->cmd, "flash:", 6)) {
+            status = sync_writes(usb);
+            pending = 0;
+            if (status) break;
+        }
         a->start = now();
         if (start < 0) start = a->start;
         if (a->msg) {
@@ -600,6 +663,7 @@ int fb_execute_queue(usb_handle *usb)
             status = fb_command(usb, a->cmd);
             status = a->func(a, status, status ? fb_get_error() : "");
             if (status) break;
+            if (pipelined && !strncmp(a->cmd, "flash:", 6)) pending = 1;
         } else if (a->op == OP_QUERY) {
             status = fb_command_response(usb, a->cmd, resp);
             status = a->func(a, status, status ? fb_get_error() : resp);
@@ -618,6 +682,10 @@ int fb_execute_queue(usb_handle *usb)
             die("bogus action");
         }
     }
+    if (pending && !status) {
+        status = sync_writes(usb);
+    }
+    fb_prefetch_stop();
 
     fprintf(stderr,"finished. total time: %.3fs\n", (now() - start));
     return status;
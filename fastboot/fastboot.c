@@ -44,6 +44,11 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef USE_MINGW
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <poll.h>
+#endif
 
 #include <bootimg.h>
 #include <sparse/sparse.h>
@@ -69,6 +74,8 @@ boot_img_hdr *mkbootimg(void *kernel, unsigned kernel_size, unsigned kernel_offs
 
 static usb_handle *usb = 0;
 static const char *serial = 0;
+static char *serials[64];
+static int serial_count = 0;
 static const char *product = 0;
 static const char *cmdline = 0;
 static int wipe_data = 0;
@@ -169,6 +176,12 @@ static int64_t file_size(int fd)
     return ret ? -1 : st.st_size;
 }
 
+/* Images are mapped rather than read, so that sending a large one
+ * doesn't need as much memory, and the pages are only faulted in as the
+ * download gets to them.  The mapping is private and writable because
+ * boot images get their command line patched in place, and is never
+ * unmapped: the data is used until fastboot exits.
+ */
 static void *load_fd(int fd, unsigned *_sz)
 {
     char *data;
@@ -182,10 +195,32 @@ static void *load_fd(int fd, unsigned *_sz)
         goto oops;
     }
 
+#ifdef USE_MINGW
+    int count = 0;
+
     data = (char*) malloc(sz);
     if(data == 0) goto oops;
 
-    if(read(fd, data, sz) != sz) goto oops;
+    while (count < sz) {
+        int r = read(fd, data + count, sz - count);
+        if (r == 0) {
+            errno = EIO;
+            goto oops;
+        }
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            goto oops;
+        }
+        count += r;
+    }
+#else
+    /* mmap() refuses empty mappings */
+    data = mmap(NULL, sz ? sz : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        data = 0;
+        goto oops;
+    }
+#endif
     close(fd);
 
     if(_sz) *_sz = sz;
@@ -194,7 +229,9 @@ static void *load_fd(int fd, unsigned *_sz)
 oops:
     errno_tmp = errno;
     close(fd);
+#ifdef USE_MINGW
     if(data != 0) free(data);
+#endif
     errno = errno_tmp;
     return 0;
 }
@@ -265,11 +302,9 @@ int list_devices_callback(usb_ifc_info *info)
 
 usb_handle *open_device(void)
 {
-    static usb_handle *usb = 0;
+    usb_handle *usb;
     int announce = 1;
 
-    if(usb) return usb;
-
     for(;;) {
         usb = usb_open(match_fastboot);
         if(usb) return usb;
@@ -316,6 +351,8 @@ void usage(void)
             "                                           formatting\n"
             "  -s <specific device>                     specify device serial number\n"
             "                                           or path to device port\n"
+            "  -s <device>,<device>[,...]               run the commands on all these\n"
+            "                                           devices at once\n"
             "  -l                                       with \"devices\", lists device paths\n"
             "  -p <product>                             specify product name\n"
             "  -c <cmdline>                             override kernel commandline\n"
@@ -878,6 +915,141 @@ static int64_t parse_num(const char *arg)
     return num;
 }
 
+static void parse_serials(char *list)
+{
+    char *s;
+
+    serial_count = 0;
+    for (s = strtok(list, ","); s; s = strtok(NULL, ",")) {
+        if (serial_count == ARRAY_SIZE(serials)) die("too many devices");
+        serials[serial_count++] = s;
+    }
+    if (serial_count == 0) die("no device given to -s");
+}
+
+#ifndef USE_MINGW
+
+/* Running the queue on several devices.
+ *
+ * The queue is built once, against the first device, so every image is
+ * loaded, mapped and resparsed only once; the devices are expected to be
+ * of the same kind.  Each device then gets its own process, forked with
+ * the loaded images in place, so that its USB transfers, its errors and
+ * its die() calls stay its own.  The output of each one is relayed with
+ * its serial number in front of every line.
+ */
+struct device_run {
+    const char *serial;
+    pid_t pid;
+    int fd;
+    int len;
+    char line[256];
+};
+
+static void relay_output(struct device_run *run, int flush)
+{
+    char *start = run->line;
+    char *end = run->line + run->len;
+    char *nl;
+
+    while ((nl = memchr(start, '\n', end - start)) != NULL) {
+        fprintf(stderr, "%s: %.*s\n", run->serial, (int)(nl - start), start);
+        start = nl + 1;
+    }
+    if (start == run->line && (flush || run->len == sizeof(run->line))) {
+        fprintf(stderr, "%s: %.*s\n", run->serial, run->len, start);
+        start = end;
+    }
+    run->len = end - start;
+    memmove(run->line, start, run->len);
+}
+
+static int execute_on_devices(void)
+{
+    struct device_run runs[ARRAY_SIZE(serials)];
+    struct pollfd fds[ARRAY_SIZE(serials)];
+    int running = 0;
+    int failed = 0;
+    int i, n, status;
+
+    for (i = 0; i < serial_count; i++) {
+        int pfd[2];
+
+        runs[i].serial = serials[i];
+        runs[i].len = 0;
+        runs[i].fd = -1;
+        if (pipe(pfd) < 0) die("pipe failed: %s", strerror(errno));
+
+        runs[i].pid = fork();
+        if (runs[i].pid < 0) die("fork failed: %s", strerror(errno));
+        if (runs[i].pid == 0) {
+            dup2(pfd[1], STDOUT_FILENO);
+            dup2(pfd[1], STDERR_FILENO);
+            close(pfd[0]);
+            close(pfd[1]);
+            serial = serials[i];
+            usb = open_device();
+            exit(fb_execute_queue(usb) ? 1 : 0);
+        }
+        close(pfd[1]);
+        runs[i].fd = pfd[0];
+        running++;
+    }
+
+    while (running > 0) {
+        for (i = 0, n = 0; i < serial_count; i++) {
+            if (runs[i].fd < 0) continue;
+            fds[n].fd = runs[i].fd;
+            fds[n].events = POLLIN;
+            n++;
+        }
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            die("poll failed: %s", strerror(errno));
+        }
+        for (i = 0, n = 0; i < serial_count; i++) {
+            struct device_run *run = &runs[i];
+            int r;
+
+            if (run->fd < 0) continue;
+            if (!fds[n++].revents) continue;
+
+            r = read(run->fd, run->line + run->len, sizeof(run->line) - run->len);
+            if (r < 0 && errno == EINTR) continue;
+            if (r > 0) {
+                run->len += r;
+                relay_output(run, 0);
+            } else {
+                relay_output(run, 1);
+                close(run->fd);
+                run->fd = -1;
+                running--;
+            }
+        }
+    }
+
+    for (i = 0; i < serial_count; i++) {
+        if (waitpid(runs[i].pid, &status, 0) < 0 ||
+                !WIFEXITED(status) || WEXITSTATUS(status)) {
+            fprintf(stderr, "%s: FAILED\n", runs[i].serial);
+            failed++;
+        }
+    }
+    fprintf(stderr, "finished on %d of %d devices\n",
+            serial_count - failed, serial_count);
+    return failed ? 1 : 0;
+}
+
+#else
+
+static int execute_on_devices(void)
+{
+    die("running on several devices at once is not supported on this host");
+    return 1;
+}
+
+#endif
+
 int main(int argc, char **argv)
 {
     int wants_wipe = 0;
@@ -946,6 +1118,10 @@ int main(int argc, char **argv)
             break;
         case 's':
             serial = optarg;
+            if (strchr(optarg, ',')) {
+                parse_serials(optarg);
+                serial = serials[0];
+            }
             break;
         case 'S':
             sparse_limit = parse_num(optarg);
@@ -1107,6 +1283,11 @@ int main(int argc, char **argv)
     if (fb_queue_is_empty())
         return 0;
 
+    if (serial_count > 1) {
+        usb_close(usb);
+        return execute_on_devices();
+    }
+
     status = fb_execute_queue(usb);
     return (status) ? 1 : 0;
 }
@@ -38,6 +38,8 @@ int fb_command(usb_handle *usb, const char *cmd);
 int fb_command_response(usb_handle *usb, const char *cmd, char *response);
 int fb_download_data(usb_handle *usb, const void *data, unsigned size);
 int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s);
+void fb_prefetch_sparse(struct sparse_file **files, int count);
+void fb_prefetch_stop(void);
 char *fb_get_error(void);
 
 #define FB_COMMAND_SZ 64
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Measures the fastboot protocol the way fastboot itself drives it:
+ *
+ *     download  download:<size> of a buffer in memory
+ *     flash     the same download, then flash:<partition> (only with -p,
+ *               as it overwrites the partition)
+ *     latency   getvar:version round trips
+ *
+ * Each run repeats the operation -n times and prints one JSON object on
+ * stdout, with the throughput and the distribution of the time each
+ * operation took, so that bootloaders, hosts and cables can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "fastboot.h"
+
+#define DEFAULT_ITERATIONS  10
+
+static const char *serial = NULL;
+static const char *partition = NULL;
+static int iterations = DEFAULT_ITERATIONS;
+
+static int match_fastboot(usb_ifc_info *info)
+{
+    if(info->ifc_class != 0xff) return -1;
+    if(info->ifc_subclass != 0x42) return -1;
+    if(info->ifc_protocol != 0x03) return -1;
+    if(serial && strcmp(serial, info->serial_number) &&
+       strcmp(serial, info->device_path)) return -1;
+    return 0;
+}
+
+static long long now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int cmp_times(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        if ((unsigned char)*s >= 0x20)
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static void report(const char *test, unsigned size, long long *times, int ops,
+                   int failed)
+{
+    unsigned long long bytes = (unsigned long long)size * ops;
+    long long total = 0;
+    int i;
+
+    for (i = 0; i < ops; i++)
+        total += times[i];
+    if (total <= 0)
+        total = 1;
+    qsort(times, ops, sizeof(*times), cmp_times);
+
+    printf("{\"test\":\"%s\",\"device\":", test);
+    print_json_string(serial ? serial : "any");
+    if (partition && !strcmp(test, "flash")) {
+        printf(",\"partition\":");
+        print_json_string(partition);
+    }
+    printf(",\"size\":%u,\"ops\":%d,\"bytes\":%llu,\"seconds\":%.6f,"
+           "\"mb_per_s\":%.3f,\"ops_per_s\":%.1f",
+           size, ops, bytes, total / 1e6,
+           bytes / (total / 1e6) / (1024 * 1024), ops / (total / 1e6));
+    if (ops > 0) {
+        printf(",\"us\":{\"min\":%lld,\"p50\":%lld,\"p90\":%lld,"
+               "\"p99\":%lld,\"max\":%lld}",
+               times[0], times[ops * 50 / 100], times[ops * 90 / 100],
+               times[ops * 99 / 100], times[ops - 1]);
+    }
+    printf(",\"failed\":%s}\n", failed ? "true" : "false");
+    fflush(stdout);
+}
+
+static int run(usb_handle *usb, const char *test, unsigned size)
+{
+    char response[65];
+    char cmd[64];
+    long long *times;
+    void *data = NULL;
+    int failed = 0;
+    int ops;
+
+    times = malloc(iterations * sizeof(*times));
+    if (size > 0)
+        data = malloc(size);
+    if (times == NULL || (size > 0 && data == NULL)) {
+        fprintf(stderr, "fastboot_bench: out of memory\n");
+        exit(1);
+    }
+    memset(data, 0xa5, size);
+    snprintf(cmd, sizeof(cmd), "flash:%s", partition ? partition : "");
+
+    for (ops = 0; ops < iterations; ops++) {
+        long long start = now_us();
+        int ret;
+
+        if (!strcmp(test, "latency")) {
+            ret = fb_command_response(usb, "getvar:version", response);
+        } else {
+            ret = fb_download_data(usb, data, size);
+            if (ret == 0 && !strcmp(test, "flash"))
+                ret = fb_command(usb, cmd);
+        }
+        if (ret) {
+            fprintf(stderr, "fastboot_bench: %s: %s\n", test, fb_get_error());
+            failed = 1;
+            break;
+        }
+        times[ops] = now_us() - start;
+    }
+
+    report(test, size, times, ops, failed);
+    free(data);
+    free(times);
+    return failed ? -1 : 0;
+}
+
+static unsigned parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    }
+    if (*end || end == s || n > 0xffffffffULL) {
+        fprintf(stderr, "fastboot_bench: bad size '%s'\n", s);
+        exit(1);
+    }
+    return n;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: fastboot_bench [-s <serial>] [-n <iterations>] [-p <partition>]\n"
+        "                      <test> [<size>...]\n"
+        "\n"
+        "tests: download, latency, flash (needs -p, and erases the\n"
+        "       partition), or all of them\n"
+        "sizes: in bytes, or with a k or m suffix (default 1m)\n"
+        "\n"
+        "Prints one JSON object per line for each test and size, on stdout.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *all[] = { "download", "latency", "flash" };
+    usb_handle *usb;
+    const char *test;
+    int failed = 0;
+    int c, i, t;
+
+    while ((c = getopt(argc, argv, "s:n:p:")) != -1) {
+        switch (c) {
+        case 's':
+            serial = optarg;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            if (iterations <= 0)
+                usage();
+            break;
+        case 'p':
+            partition = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+    test = argv[optind++];
+    if (strcmp(test, "all") && strcmp(test, "download") &&
+        strcmp(test, "latency") && strcmp(test, "flash"))
+        usage();
+    if (!strcmp(test, "flash") && partition == NULL) {
+        fprintf(stderr, "fastboot_bench: flash needs -p <partition>\n");
+        exit(1);
+    }
+
+    usb = usb_open(match_fastboot);
+    if (usb == NULL) {
+        fprintf(stderr, "fastboot_bench: no device\n");
+        exit(1);
+    }
+
+    /* protocol.c closes the device when a command fails: stop there */
+    for (t = 0; !failed && t < (int)(sizeof(all) / sizeof(all[0])); t++) {
+        if (strcmp(test, "all") && strcmp(test, all[t]))
+            continue;
+        /* "all" leaves the partitions alone unless one was given */
+        if (!strcmp(all[t], "flash") && partition == NULL)
+            continue;
+        if (!strcmp(all[t], "latency")) {
+            failed |= run(usb, all[t], 0);
+            continue;
+        }
+        if (optind == argc)
+            failed |= run(usb, all[t], 1024 * 1024);
+        for (i = optind; !failed && i < argc; i++)
+            failed |= run(usb, all[t], parse_size(argv[i]));
+    }
+
+    usb_close(usb);
+    return failed ? 1 : 0;
+}
@@ -35,6 +35,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
 
 #include <sparse/sparse.h>
 
@@ -288,6 +291,249 @@ static int fb_download_data_sparse_flush(usb_handle *usb)
     return 0;
 }
 
+#ifndef USE_MINGW
+
+/*
+ * The sparse images queued for download are produced by a thread ahead of
+ * time: while one is being sent, or while the device is writing it, the
+ * next one is already being read from disk and packed into sparse format,
+ * up to PREFETCH_BUFS buffers ahead.  Images are produced in the order in
+ * which fb_prefetch_sparse() was given them, and must be downloaded in
+ * that order.
+ */
+#define PREFETCH_BUF_SIZE (1024 * 1024)
+#define PREFETCH_BUFS 16
+
+struct prefetch_buf {
+    struct prefetch_buf *next;
+    struct sparse_file *s;
+    int len;
+    int last;       /* final buffer of s */
+    int error;
+    char data[PREFETCH_BUF_SIZE];
+};
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static struct prefetch_buf *prefetch_head;
+static struct prefetch_buf *prefetch_tail;
+static struct prefetch_buf *prefetch_free;
+static struct prefetch_buf *prefetch_cur;   /* being filled */
+static int prefetch_allocated;
+static int prefetch_running;
+static int prefetch_stop;
+static int prefetch_done;   /* thread has pushed everything it will */
+static pthread_t prefetch_thread;
+static struct sparse_file **prefetch_files;
+static int prefetch_count;
+
+static struct prefetch_buf *prefetch_get_free(void)
+{
+    struct prefetch_buf *buf = NULL;
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (!prefetch_stop) {
+        if (prefetch_free) {
+            buf = prefetch_free;
+            prefetch_free = buf->next;
+            break;
+        }
+        if (prefetch_allocated < PREFETCH_BUFS) {
+            buf = malloc(sizeof(*buf));
+            if (buf) prefetch_allocated++;
+            break;
+        }
+        pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+
+    return buf;
+}
+
+static void prefetch_push(struct prefetch_buf *buf)
+{
+    pthread_mutex_lock(&prefetch_lock);
+    buf->next = NULL;
+    if (prefetch_tail) {
+        prefetch_tail->next = buf;
+    } else {
+        prefetch_head = buf;
+    }
+    prefetch_tail = buf;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+static int prefetch_write(void *priv, const void *data, int len)
+{
+    struct sparse_file *s = priv;
+    const char *ptr = data;
+    int n;
+
+    while (len > 0) {
+        if (!prefetch_cur) {
+            prefetch_cur = prefetch_get_free();
+            if (!prefetch_cur) return -1;
+            prefetch_cur->s = s;
+            prefetch_cur->len = 0;
+            prefetch_cur->last = 0;
+            prefetch_cur->error = 0;
+        }
+        n = min(len, PREFETCH_BUF_SIZE - prefetch_cur->len);
+        memcpy(prefetch_cur->data + prefetch_cur->len, ptr, n);
+        prefetch_cur->len += n;
+        ptr += n;
+        len -= n;
+        if (prefetch_cur->len == PREFETCH_BUF_SIZE) {
+            prefetch_push(prefetch_cur);
+            prefetch_cur = NULL;
+        }
+    }
+    return 0;
+}
+
+static void *prefetch_main(void *arg)
+{
+    int i, r;
+
+    for (i = 0; i < prefetch_count; i++) {
+        r = sparse_file_callback(prefetch_files[i], true, false,
+                prefetch_write, prefetch_files[i]);
+        if (!prefetch_cur) {
+            prefetch_cur = prefetch_get_free();
+            if (!prefetch_cur) break;
+            prefetch_cur->s = prefetch_files[i];
+            prefetch_cur->len = 0;
+        }
+        prefetch_cur->last = 1;
+        prefetch_cur->error = r < 0;
+        prefetch_push(prefetch_cur);
+        prefetch_cur = NULL;
+        if (r < 0) break;
+    }
+
+    pthread_mutex_lock(&prefetch_lock);
+    prefetch_done = 1;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_lock);
+    return NULL;
+}
+
+void fb_prefetch_sparse(struct sparse_file **files, int count)
+{
+    fb_prefetch_stop();
+    if (count == 0) return;
+
+    prefetch_files = files;
+    prefetch_count = count;
+    prefetch_stop = 0;
+    prefetch_done = 0;
+    if (pthread_create(&prefetch_thread, NULL, prefetch_main, NULL) == 0) {
+        prefetch_running = 1;
+    }
+}
+
+void fb_prefetch_stop(void)
+{
+    struct prefetch_buf *buf;
+
+    if (!prefetch_running) return;
+
+    pthread_mutex_lock(&prefetch_lock);
+    prefetch_stop = 1;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_lock);
+    pthread_join(prefetch_thread, NULL);
+    prefetch_running = 0;
+
+    free(prefetch_cur);
+    prefetch_cur = NULL;
+    while ((buf = prefetch_head)) {
+        prefetch_head = buf->next;
+        free(buf);
+    }
+    prefetch_tail = NULL;
+    while ((buf = prefetch_free)) {
+        prefetch_free = buf->next;
+        free(buf);
+    }
+    prefetch_allocated = 0;
+}
+
+/* Sends the prefetched stream of s. Returns 1 if s wasn't prefetched. */
+static int fb_download_prefetched(usb_handle *usb, struct sparse_file *s)
+{
+    struct prefetch_buf *buf;
+    int last = 0;
+    int r = 0;
+
+    if (!prefetch_running) return 1;
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (!prefetch_head && !prefetch_done) {
+        pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+    }
+    if (!prefetch_head || prefetch_head->s != s) {
+        pthread_mutex_unlock(&prefetch_lock);
+        fb_prefetch_stop();
+        return 1;
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+
+    while (!last && r == 0) {
+        pthread_mutex_lock(&prefetch_lock);
+        while (!prefetch_head && !prefetch_done) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+        }
+        buf = prefetch_head;
+        if (!buf) {
+            pthread_mutex_unlock(&prefetch_lock);
+            sprintf(ERROR, "failed to read sparse image");
+            r = -1;
+            break;
+        }
+        prefetch_head = buf->next;
+        if (!prefetch_head) prefetch_tail = NULL;
+        pthread_mutex_unlock(&prefetch_lock);
+
+        last = buf->last;
+        if (buf->error) {
+            sprintf(ERROR, "failed to read sparse image");
+            r = -1;
+        } else {
+            r = fb_download_data_sparse_write(usb, buf->data, buf->len);
+        }
+
+        pthread_mutex_lock(&prefetch_lock);
+        buf->next = prefetch_free;
+        prefetch_free = buf;
+        pthread_cond_broadcast(&prefetch_cond);
+        pthread_mutex_unlock(&prefetch_lock);
+    }
+
+    if (r < 0) {
+        fb_prefetch_stop();
+    }
+    return r;
+}
+
+#else
+
+void fb_prefetch_sparse(struct sparse_file **files, int count)
+{
+}
+
+void fb_prefetch_stop(void)
+{
+}
+
+static int fb_download_prefetched(usb_handle *usb, struct sparse_file *s)
+{
+    return 1;
+}
+
+#endif
+
 int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s)
 {
     char cmd[64];
@@ -303,7 +549,10 @@ int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s)
         return -1;
     }
 
-    r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, usb);
+    r = fb_download_prefetched(usb, s);
+    if (r == 1) {
+        r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, usb);
+    }
     if (r < 0) {
         return -1;
     }
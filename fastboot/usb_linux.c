@@ -67,12 +67,22 @@
  */
 #define MAX_USBFS_BULK_SIZE (16 * 1024)
 
+/* Big writes are queued as this many URBs, so that the host controller
+ * always has the next one when it is done with the last. Kernels which
+ * don't hold URBs to the bulk limit (USBDEVFS_CAP_NO_PACKET_SIZE_LIM)
+ * take bigger ones; all of them together still fit well within the
+ * usbfs_memory_mb default of 16 MB.
+ */
+#define MAX_URBS 8
+#define MAX_URB_SIZE (256 * 1024)
+
 struct usb_handle
 {
     char fname[64];
     int desc;
     unsigned char ep_in;
     unsigned char ep_out;
+    int urb_size;   /* 0 until the first write, -1 without SUBMITURB */
 };
 
 static inline int badname(const char *name)
@@ -308,6 +318,106 @@ static usb_handle *find_usb_device(const char *base, ifc_match_func callback)
     return usb;
 }
 
+/* Drops the URBs still queued after an error. The kernel may still be
+ * using them, so they have to be reaped before their memory goes away.
+ */
+static void discard_urbs(usb_handle *h, struct usbdevfs_urb *urbs,
+                         int next, int pending)
+{
+    struct usbdevfs_urb *urb;
+    int i;
+
+    for(i = 0; i < pending; i++) {
+        ioctl(h->desc, USBDEVFS_DISCARDURB, &urbs[(next + i) % MAX_URBS]);
+    }
+    while(pending > 0) {
+        if(ioctl(h->desc, USBDEVFS_REAPURB, &urb) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        pending--;
+    }
+}
+
+/* Writes len bytes with up to MAX_URBS asynchronous URBs in flight, and
+ * returns -2 if this kernel can't, for usb_write() to do it the slow way.
+ */
+static int usb_write_urbs(usb_handle *h, const unsigned char *data, int len)
+{
+    struct usbdevfs_urb urbs[MAX_URBS];
+    struct usbdevfs_urb *urb;
+    int next = 0;       /* oldest URB in flight; they complete in order */
+    int pending = 0;
+    int offset = 0;
+    int count = 0;
+#ifdef USBDEVFS_GET_CAPABILITIES
+    unsigned caps;
+#endif
+
+    if(h->urb_size == 0) {
+        h->urb_size = MAX_USBFS_BULK_SIZE;
+#ifdef USBDEVFS_GET_CAPABILITIES
+        if(ioctl(h->desc, USBDEVFS_GET_CAPABILITIES, &caps) == 0 &&
+           (caps & USBDEVFS_CAP_NO_PACKET_SIZE_LIM)) {
+            h->urb_size = MAX_URB_SIZE;
+        }
+#endif
+    }
+    if(h->urb_size < 0) return -2;
+
+    while(count < len) {
+        while(pending < MAX_URBS && offset < len) {
+            int xfer = (len - offset > h->urb_size) ? h->urb_size : len - offset;
+
+            urb = &urbs[(next + pending) % MAX_URBS];
+            memset(urb, 0, sizeof(*urb));
+            urb->type = USBDEVFS_URB_TYPE_BULK;
+            urb->endpoint = h->ep_out;
+            urb->buffer = (void*) (data + offset);
+            urb->buffer_length = xfer;
+
+            if(ioctl(h->desc, USBDEVFS_SUBMITURB, urb) < 0) {
+                DBG("ERROR: submit urb, errno = %d (%s)\n",
+                    errno, strerror(errno));
+                if(pending > 0) break;
+                if((errno == ENOMEM || errno == EINVAL) &&
+                   h->urb_size > MAX_USBFS_BULK_SIZE) {
+                    /* over usbfs_memory_mb, or an older kernel */
+                    h->urb_size = MAX_USBFS_BULK_SIZE;
+                    continue;
+                }
+                if(offset == 0 && (errno == ENOTTY || errno == EINVAL)) {
+                    h->urb_size = -1;
+                    return -2;
+                }
+                return -1;
+            }
+            offset += xfer;
+            pending++;
+        }
+
+        if(ioctl(h->desc, USBDEVFS_REAPURB, &urb) < 0) {
+            if(errno == EINTR) continue;
+            DBG("ERROR: reap urb, errno = %d (%s)\n", errno, strerror(errno));
+            discard_urbs(h, urbs, next, pending);
+            return -1;
+        }
+        next = (next + 1) % MAX_URBS;
+        pending--;
+
+        if(urb->status != 0 || urb->actual_length != urb->buffer_length) {
+            DBG("ERROR: urb status = %d, %d of %d bytes\n", urb->status,
+                urb->actual_length, urb->buffer_length);
+            discard_urbs(h, urbs, next, pending);
+            errno = urb->status ? -urb->status : EIO;
+            return -1;
+        }
+        count += urb->actual_length;
+    }
+
+    return count;
+}
+
 int usb_write(usb_handle *h, const void *_data, int len)
 {
     unsigned char *data = (unsigned char*) _data;
@@ -334,6 +444,11 @@ int usb_write(usb_handle *h, const void *_data, int len)
         return 0;
     }
 
+    if(len > MAX_USBFS_BULK_SIZE) {
+        n = usb_write_urbs(h, data, len);
+        if(n != -2) return n;
+    }
+
     while(len > 0) {
         int xfer;
         xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
@@ -20,6 +20,7 @@ LOCAL_SRC_FILES := \
     config.c \
     commands.c \
     fastbootd.c \
+    flash.c \
     protocol.c \
     transport.c \
     usb_linux_client.c
@@ -29,12 +29,15 @@
  * SUCH DAMAGE.
  */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 
 #include "bootimg.h"
 #include "debug.h"
+#include "flash.h"
 #include "protocol.h"
 
 static void cmd_boot(struct protocol_handle *phandle, const char *arg)
@@ -104,43 +107,55 @@ static void cmd_erase(struct protocol_handle *phandle, const char *arg)
 
 static void cmd_flash(struct protocol_handle *phandle, const char *arg)
 {
-#if 0
-    struct ptentry *ptn;
-    struct ptable *ptable;
-    unsigned extra = 0;
-
-    ptable = flash_get_ptable();
-    if (ptable == NULL) {
-        fastboot_fail(phandle, "partition table doesn't exist");
+    struct flash_writer w;
+    char magic[BOOT_MAGIC_SIZE];
+    ssize_t len;
+    int fd;
+    int ret;
+
+    fd = protocol_get_download(phandle);
+    if (fd < 0) {
+        fastboot_fail(phandle, "no image downloaded");
         return;
     }
 
-    ptn = ptable_find(ptable, arg);
-    if (ptn == NULL) {
-        fastboot_fail(phandle, "unknown partition name");
-        return;
+    len = pread(fd, magic, sizeof(magic), 0);
+    if (len < 0) {
+        fastboot_fail(phandle, "cannot read downloaded image");
+        goto out;
     }
 
-    if (!strcmp(ptn->name, "boot") || !strcmp(ptn->name, "recovery")) {
-        if (memcmp((void *)data, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
+    if (!strcmp(arg, "boot") || !strcmp(arg, "recovery")) {
+        if (len < BOOT_MAGIC_SIZE || memcmp(magic, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
             fastboot_fail(phandle, "image is not a boot image");
-            return;
+            goto out;
         }
     }
 
-    if (!strcmp(ptn->name, "system") || !strcmp(ptn->name, "userdata"))
-        extra = 64;
-    else
-        sz = ROUND_TO_PAGE(sz);
+    if (flash_open(&w, arg)) {
+        fastboot_fail(phandle, "unknown partition name");
+        goto out;
+    }
 
-    D(INFO, "writing %d bytes to '%s'\n", sz, ptn->name);
-    if (flash_write(ptn, extra, data, sz)) {
-        fastboot_fail(phandle, "flash write failure");
-        return;
+    /* sparse images are expanded here, skipping their don't care chunks */
+    lseek(fd, 0, SEEK_SET);
+    ret = flash_image_fd(&w, fd, flash_is_sparse(magic, len));
+    if (ret == 0) {
+        ret = flash_close(&w);
+    } else {
+        flash_close(&w);
     }
-    D(INFO, "partition '%s' updated\n", ptn->name);
-#endif
+    if (ret < 0) {
+        D(ERR, "writing '%s' failed: %s", arg, strerror(-ret));
+        fastboot_fail(phandle, ret == -ENOSPC ? "image too large" : "flash write failure");
+        goto out;
+    }
+
+    D(INFO, "partition '%s' updated", arg);
     fastboot_okay(phandle, "");
+
+out:
+    close(fd);
 }
 
 static void cmd_continue(struct protocol_handle *phandle, const char *arg)
@@ -192,6 +207,52 @@ static void cmd_download(struct protocol_handle *phandle, const char *arg)
     fastboot_okay(phandle, "");
 }
 
+/*
+ * "flash-stream:%08x:%s" - like download followed by flash, except that
+ * the image is written while it is received, so it doesn't have to fit
+ * in memory, and the eMMC writes overlap with the transfer.
+ */
+static void cmd_flash_stream(struct protocol_handle *phandle, const char *arg)
+{
+    struct flash_writer w;
+    char *ptn;
+    unsigned len;
+    int ret;
+
+    len = strtoul(arg, &ptn, 16);
+    if (ptn == arg || *ptn != ':') {
+        fastboot_fail(phandle, "usage: flash-stream:<size>:<partition>");
+        return;
+    }
+    ptn++;
+
+    if (flash_open(&w, ptn)) {
+        fastboot_fail(phandle, "unknown partition name");
+        return;
+    }
+
+    fastboot_data(phandle, len);
+
+    ret = flash_stream(&w, phandle, len);
+    if (ret == 0) {
+        ret = flash_close(&w);
+    } else {
+        flash_close(&w);
+    }
+    if (ret == -EIO) {
+        D(ERR, "transfer to '%s' failed", ptn);
+        return;
+    }
+    if (ret < 0) {
+        D(ERR, "writing '%s' failed: %s", ptn, strerror(-ret));
+        fastboot_fail(phandle, ret == -ENOSPC ? "image too large" : "flash write failure");
+        return;
+    }
+
+    D(INFO, "partition '%s' updated", ptn);
+    fastboot_okay(phandle, "");
+}
+
 void commands_init()
 {
     fastboot_register("boot", cmd_boot);
@@ -200,6 +261,8 @@ void commands_init()
     fastboot_register("continue", cmd_continue);
     fastboot_register("getvar:", cmd_getvar);
     fastboot_register("download:", cmd_download);
+    fastboot_register("flash-stream:", cmd_flash_stream);
+    fastboot_publish("flash-stream", "yes");
     //fastboot_publish("version", "0.5");
     //fastboot_publish("product", "swordfish");
     //fastboot_publish("kernel", "lk");
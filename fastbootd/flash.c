@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <sparse/sparse.h>
+
+#include "debug.h"
+#include "flash.h"
+#include "protocol.h"
+
+/* from libsparse/sparse_format.h */
+#define SPARSE_HEADER_MAGIC 0xed26ff3a
+
+#define FLASH_BUF_SIZE (1024 * 1024)
+#define FLASH_BUF_ALIGN 4096
+#define STREAM_BUF_SIZE (256 * 1024)
+
+int flash_open(struct flash_writer *w, const char *ptn)
+{
+    char path[PATH_MAX];
+    uint64_t size;
+    int ret;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+
+    if (strchr(ptn, '/')) {
+        return -EINVAL;
+    }
+    snprintf(path, sizeof(path), PARTITION_PATH "%s", ptn);
+
+    w->fd = open(path, O_WRONLY | O_DIRECT);
+    if (w->fd < 0 && errno == EINVAL) {
+        w->fd = open(path, O_WRONLY);
+    }
+    if (w->fd < 0) {
+        D(ERR, "cannot open %s: %s", path, strerror(errno));
+        return -errno;
+    }
+
+    if (ioctl(w->fd, BLKGETSIZE64, &size) < 0) {
+        D(ERR, "cannot get size of %s: %s", path, strerror(errno));
+        goto err;
+    }
+    w->size = size;
+    w->discard = 1;
+
+    errno = posix_memalign((void **)&w->buf, FLASH_BUF_ALIGN, FLASH_BUF_SIZE);
+    if (errno) {
+        w->buf = NULL;
+        goto err;
+    }
+
+    D(INFO, "writing to %s, %lld bytes", path, w->size);
+    return 0;
+
+err:
+    ret = -errno;
+    close(w->fd);
+    w->fd = -1;
+    return ret;
+}
+
+static int flash_flush(struct flash_writer *w)
+{
+    size_t n = 0;
+    ssize_t ret;
+
+    if ((w->buf_off | w->buf_len) & (FLASH_BUF_ALIGN - 1)) {
+        /* only the tail of a raw image can be unaligned */
+        int flags = fcntl(w->fd, F_GETFL);
+        fcntl(w->fd, F_SETFL, flags & ~O_DIRECT);
+    }
+
+    while (n < w->buf_len) {
+        ret = pwrite64(w->fd, w->buf + n, w->buf_len - n, w->buf_off + n);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            D(ERR, "write at %lld failed: %s", w->buf_off + n, strerror(errno));
+            return -errno;
+        }
+        n += ret;
+    }
+
+    w->buf_off += w->buf_len;
+    w->buf_len = 0;
+    return 0;
+}
+
+/*
+ * Make room in the staging buffer for data at off, which is flushed first
+ * when it is full or off does not follow what it already holds.
+ */
+static int flash_seek(struct flash_writer *w, int64_t off, int64_t len)
+{
+    int ret;
+
+    if (off < 0 || len > w->size - off) {
+        return -ENOSPC;
+    }
+    if (w->buf_len == FLASH_BUF_SIZE ||
+            (w->buf_len && off != w->buf_off + (int64_t)w->buf_len)) {
+        ret = flash_flush(w);
+        if (ret < 0)
+            return ret;
+    }
+    if (w->buf_len == 0) {
+        w->buf_off = off;
+    }
+    return 0;
+}
+
+static int flash_write(struct flash_writer *w, int64_t off,
+        const void *data, size_t len)
+{
+    const char *ptr = data;
+    size_t n;
+    int ret;
+
+    while (len > 0) {
+        ret = flash_seek(w, off, len);
+        if (ret < 0)
+            return ret;
+
+        n = FLASH_BUF_SIZE - w->buf_len;
+        if (n > len)
+            n = len;
+        memcpy(w->buf + w->buf_len, ptr, n);
+        w->buf_len += n;
+        off += n;
+        ptr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int flash_fill(struct flash_writer *w, int64_t off,
+        uint32_t fill_val, int64_t len)
+{
+    uint32_t *p;
+    size_t n, i;
+    int ret;
+
+    while (len > 0) {
+        ret = flash_seek(w, off, len);
+        if (ret < 0)
+            return ret;
+
+        n = FLASH_BUF_SIZE - w->buf_len;
+        if ((int64_t)n > len)
+            n = len;
+        p = (uint32_t *)(w->buf + w->buf_len);
+        for (i = 0; i < n / sizeof(uint32_t); i++)
+            p[i] = fill_val;
+        w->buf_len += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int flash_close(struct flash_writer *w)
+{
+    int ret;
+
+    ret = flash_flush(w);
+    if (ret == 0 && fsync(w->fd) < 0) {
+        ret = -errno;
+    }
+    close(w->fd);
+    free(w->buf);
+    w->fd = -1;
+    w->buf = NULL;
+    return ret;
+}
+
+/* Let the device forget the contents of a region nothing is written to. */
+static void flash_discard(struct flash_writer *w, int64_t off, int64_t len)
+{
+    uint64_t range[2];
+
+    if (!w->discard || len <= 0)
+        return;
+
+    range[0] = off;
+    range[1] = len;
+    if (ioctl(w->fd, BLKDISCARD, &range) < 0) {
+        D(INFO, "discard not supported: %s", strerror(errno));
+        w->discard = 0;
+    }
+}
+
+/* Called before writing at off, discards what was skipped to get there. */
+static void flash_skip_to(struct flash_writer *w, int64_t off, int64_t len)
+{
+    if (off > w->next_off) {
+        flash_discard(w, w->next_off, off - w->next_off);
+    }
+    w->next_off = off + len;
+}
+
+static int sparse_header_cb(void *priv, unsigned int block_size, int64_t len)
+{
+    struct flash_writer *w = priv;
+
+    if (len > w->size) {
+        D(ERR, "image of %lld bytes does not fit in %lld", len, w->size);
+        return -ENOSPC;
+    }
+    w->block_size = block_size;
+    w->image_len = len;
+    w->next_off = 0;
+    return 0;
+}
+
+static int sparse_data_cb(void *priv, unsigned int block, const void *data,
+        unsigned int len)
+{
+    struct flash_writer *w = priv;
+    int64_t off = (int64_t)block * w->block_size;
+
+    flash_skip_to(w, off, len);
+    return flash_write(w, off, data, len);
+}
+
+static int sparse_fill_cb(void *priv, unsigned int block, uint32_t fill_val,
+        int64_t len)
+{
+    struct flash_writer *w = priv;
+    int64_t off = (int64_t)block * w->block_size;
+
+    flash_skip_to(w, off, len);
+    return flash_fill(w, off, fill_val, len);
+}
+
+static int flash_raw_fd(struct flash_writer *w, int fd)
+{
+    ssize_t ret;
+
+    for (;;) {
+        if (w->buf_len == FLASH_BUF_SIZE) {
+            ret = flash_flush(w);
+            if (ret < 0)
+                return ret;
+        }
+        ret = read(fd, w->buf + w->buf_len, FLASH_BUF_SIZE - w->buf_len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (ret == 0)
+            return 0;
+        if (ret > w->size - (w->buf_off + (int64_t)w->buf_len)) {
+            D(ERR, "image does not fit in %lld bytes", w->size);
+            return -ENOSPC;
+        }
+        w->buf_len += ret;
+    }
+}
+
+int flash_image_fd(struct flash_writer *w, int fd, int sparse)
+{
+    int ret;
+
+    if (!sparse) {
+        return flash_raw_fd(w, fd);
+    }
+    ret = sparse_file_import_stream(fd, false, false, sparse_header_cb,
+            sparse_data_cb, sparse_fill_cb, w);
+    if (ret == 0) {
+        /* a trailing don't care chunk */
+        flash_skip_to(w, w->image_len, 0);
+    }
+    return ret;
+}
+
+int flash_is_sparse(const void *data, size_t len)
+{
+    uint32_t magic;
+
+    if (len < sizeof(magic))
+        return 0;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == SPARSE_HEADER_MAGIC;
+}
+
+struct flash_stream {
+    struct flash_writer *w;
+    int fd;
+    int sparse;
+    int ret;
+};
+
+static void *flash_stream_thread(void *arg)
+{
+    struct flash_stream *st = arg;
+    char drain[4096];
+
+    st->ret = flash_image_fd(st->w, st->fd, st->sparse);
+
+    /* swallow the rest after an error, the host is still sending it */
+    for (;;) {
+        ssize_t ret = read(st->fd, drain, sizeof(drain));
+        if (ret > 0 || (ret < 0 && errno == EINTR))
+            continue;
+        break;
+    }
+
+    return NULL;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, buf, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+int flash_stream(struct flash_writer *w, struct protocol_handle *phandle,
+        size_t len)
+{
+    struct flash_stream st;
+    pthread_t thread;
+    char *buf;
+    size_t n = 0;
+    size_t got = 0;
+    ssize_t ret;
+    int pfd[2];
+    int started = 0;
+    int running = 0;
+    int err = 0;
+
+    buf = malloc(STREAM_BUF_SIZE);
+    if (buf == NULL)
+        return -ENOMEM;
+
+    if (pipe(pfd) < 0) {
+        free(buf);
+        return -errno;
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(pfd[1], F_SETPIPE_SZ, FLASH_BUF_SIZE);
+#endif
+
+    st.w = w;
+    st.fd = pfd[0];
+    st.ret = 0;
+
+    while (got < len) {
+        size_t to_read = len - got;
+        if (to_read > STREAM_BUF_SIZE - n)
+            to_read = STREAM_BUF_SIZE - n;
+
+        ret = protocol_handle_read(phandle, buf + n, to_read);
+        if (ret <= 0) {
+            D(WARN, "transport read failed after %u of %u bytes", got, len);
+            err = -EIO;
+            break;
+        }
+        n += ret;
+        got += ret;
+
+        /* the decoder can start once the magic is in */
+        if (!started) {
+            if (n < sizeof(uint32_t) && got < len)
+                continue;
+            st.sparse = flash_is_sparse(buf, n);
+            started = 1;
+            if (pthread_create(&thread, NULL, flash_stream_thread, &st) == 0) {
+                running = 1;
+            } else {
+                /* keep reading, the host must get to send all of it */
+                err = -ENOMEM;
+            }
+        }
+
+        if (err == 0) {
+            err = write_all(pfd[1], buf, n);
+        }
+        n = 0;
+    }
+
+    close(pfd[1]);
+    if (running) {
+        pthread_join(thread, NULL);
+    }
+    close(pfd[0]);
+    free(buf);
+
+    if (err)
+        return err;
+    return st.ret;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FASTBOOTD_FLASH_H_
+#define _FASTBOOTD_FLASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PARTITION_PATH "/dev/block/by-name/"
+
+struct protocol_handle;
+
+/*
+ * Writes an image to a partition through an aligned staging buffer, so
+ * the block device can be opened with O_DIRECT: data goes to the eMMC
+ * in large writes instead of through the page cache.
+ */
+struct flash_writer {
+    int fd;
+    int64_t size;       /* of the partition */
+    unsigned int block_size;    /* of the sparse image being written */
+    int64_t image_len;  /* expanded length of the sparse image */
+    int64_t next_off;   /* end of the last data written */
+    int discard;        /* discard the gaps left by don't care chunks */
+    char *buf;
+    int64_t buf_off;    /* partition offset of buf[0] */
+    size_t buf_len;
+};
+
+int flash_open(struct flash_writer *w, const char *ptn);
+int flash_close(struct flash_writer *w);
+
+/*
+ * Write a raw or sparse image read from fd until EOF.  Regions of a sparse
+ * image that are skipped are discarded rather than written, when the
+ * device supports it.
+ */
+int flash_image_fd(struct flash_writer *w, int fd, int sparse);
+int flash_is_sparse(const void *data, size_t len);
+
+/*
+ * Receive a len byte raw or sparse image from the host and write it as it
+ * arrives.  The image is decoded on a second thread, so the eMMC writes
+ * overlap with the USB transfer.
+ */
+int flash_stream(struct flash_writer *w, struct protocol_handle *phandle,
+        size_t len);
+
+#endif
@@ -104,6 +104,12 @@ int protocol_handle_download(struct protocol_handle *phandle, size_t len)
     return transport_handle_download(phandle->transport_handle, len);
 }
 
+ssize_t protocol_handle_read(struct protocol_handle *phandle,
+        void *buffer, size_t len)
+{
+    return transport_handle_read(phandle->transport_handle, buffer, len);
+}
+
 static ssize_t protocol_handle_write(struct protocol_handle *phandle,
         char *buffer, size_t len)
 {
@@ -53,6 +53,7 @@ struct protocol_handle *create_protocol_handle(struct transport_handle *t);
 void protocol_handle_command(struct protocol_handle *handle, char *buffer);
 int protocol_handle_download(struct protocol_handle *phandle, size_t len);
 int protocol_get_download(struct protocol_handle *phandle);
+ssize_t protocol_handle_read(struct protocol_handle *phandle, void *buffer, size_t len);
 
 void fastboot_fail(struct protocol_handle *handle, const char *reason);
 void fastboot_okay(struct protocol_handle *handle, const char *reason);
@@ -32,6 +32,11 @@ ssize_t transport_handle_write(struct transport_handle *thandle, char *buffer, s
     return thandle->transport->write(thandle, buffer, len);
 }
 
+ssize_t transport_handle_read(struct transport_handle *thandle, void *buffer, size_t len)
+{
+    return thandle->transport->read(thandle, buffer, len);
+}
+
 void transport_handle_close(struct transport_handle *thandle)
 {
     thandle->transport->close(thandle);
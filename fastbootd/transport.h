@@ -36,6 +36,7 @@ struct transport {
 
 void transport_register(struct transport *transport);
 ssize_t transport_handle_write(struct transport_handle *handle, char *buffer, size_t len);
+ssize_t transport_handle_read(struct transport_handle *handle, void *buffer, size_t len);
 int transport_handle_download(struct transport_handle *handle, size_t len);
 
 #endif
@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -27,6 +28,9 @@
 #include <sys/wait.h>
 #include <libgen.h>
 #include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <sys/swap.h>
 /* XXX These need to be obtained from kernel headers. See b/9336527 */
 #define SWAP_FLAG_PREFER        0x8000
@@ -95,6 +99,7 @@ static struct flag_list fs_mgr_flags[] = {
     { "zramsize=",   MF_ZRAMSIZE },
     { "verify",      MF_VERIFY },
     { "noemulatedsd", MF_NOEMULATEDSD },
+    { "parallel",    MF_PARALLEL },
     { "defaults",    0 },
     { 0,             0 },
 };
@@ -109,32 +114,107 @@ struct fs_mgr_flag_values {
 };
 
 /*
- * gettime() - returns the time in seconds of the system's monotonic clock or
- * zero on error.
+ * gettime_ms() - returns the time in milliseconds of the system's monotonic
+ * clock.
  */
-static time_t gettime(void)
+static long long gettime_ms(void)
 {
     struct timespec ts;
-    int ret;
 
-    ret = clock_gettime(CLOCK_MONOTONIC, &ts);
-    if (ret < 0) {
-        ERROR("clock_gettime(CLOCK_MONOTONIC) failed: %s\n", strerror(errno));
-        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static fs_mgr_timing_callback timing_callback;
+
+void fs_mgr_set_timing_callback(fs_mgr_timing_callback callback)
+{
+    timing_callback = callback;
+}
+
+long long fs_mgr_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void fs_mgr_report_time(const char *event, const char *mount_point, long long start)
+{
+    if (timing_callback) {
+        timing_callback(event, mount_point, start, fs_mgr_time_us());
     }
+}
+
+/*
+ * Watch the closest existing directory on the way to filename, so that
+ * we are woken up when ueventd creates the next component of the path,
+ * or the file itself.
+ */
+static int watch_parent(int fd, const char *filename)
+{
+    char path[PATH_MAX];
+    struct stat info;
+    char *slash;
 
-    return ts.tv_sec;
+    strlcpy(path, filename, sizeof(path));
+    for (;;) {
+        slash = strrchr(path, '/');
+        if (slash == NULL) {
+            return -1;
+        }
+        if (slash == path) {
+            slash[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+        if (stat(path, &info) == 0) {
+            return inotify_add_watch(fd, path, IN_CREATE | IN_MOVED_TO);
+        }
+        if (slash == path) {
+            return -1;
+        }
+    }
 }
 
-static int wait_for_file(const char *filename, int timeout)
+int fs_mgr_wait_for_file(const char *filename, int timeout)
 {
     struct stat info;
-    time_t timeout_time = gettime() + timeout;
-    int ret = -1;
+    struct pollfd pfd;
+    long long timeout_time = gettime_ms() + timeout * 1000LL;
+    long long now;
+    char events[1024];
+    int ret;
 
-    while (gettime() < timeout_time && ((ret = stat(filename, &info)) < 0))
-        usleep(10000);
+    if ((ret = stat(filename, &info)) == 0) {
+        return ret;
+    }
+
+    pfd.fd = inotify_init();
+    pfd.events = POLLIN;
+    if (pfd.fd < 0) {
+        while (gettime_ms() < timeout_time && ((ret = stat(filename, &info)) < 0))
+            usleep(10000);
+        return ret;
+    }
 
+    for (;;) {
+        watch_parent(pfd.fd, filename);
+        /* it may have shown up before the watch was in place */
+        if ((ret = stat(filename, &info)) == 0) {
+            break;
+        }
+        now = gettime_ms();
+        if (now >= timeout_time) {
+            break;
+        }
+        if (poll(&pfd, 1, timeout_time - now) > 0) {
+            read(pfd.fd, events, sizeof(events));
+        }
+    }
+
+    close(pfd.fd);
     return ret;
 }
 
@@ -570,82 +650,221 @@ static int fs_match(char *in1, char *in2)
     return ret;
 }
 
+/*
+ * Wait, check, verify and mount a single entry of fs_mgr_mount_all().
+ * Returns 0 on success or if the entry was skipped, 1 if a tmpfs was
+ * mounted in place of an encrypted filesystem, and -1 on error.
+ */
+static int mount_rec(struct fstab_rec *rec)
+{
+    int mret;
+
+    if (rec->fs_mgr_flags & MF_WAIT) {
+        fs_mgr_wait_for_file(rec->blk_device, WAIT_TIMEOUT);
+    }
+
+    if (rec->fs_mgr_flags & MF_CHECK) {
+        check_fs(rec->blk_device, rec->fs_type, rec->mount_point);
+    }
+
+    if (rec->fs_mgr_flags & MF_VERIFY) {
+        if (fs_mgr_setup_verity(rec) < 0) {
+            ERROR("Could not set up verified partition, skipping!");
+            return 0;
+        }
+    }
+
+    mret = __mount(rec->blk_device, rec->mount_point, rec->fs_type,
+                   rec->flags, rec->fs_options);
+
+    if (!mret) {
+        /* Success!  Go get the next one */
+        return 0;
+    }
+
+    /* mount(2) returned an error, check if it's encrypted and deal with it */
+    if ((rec->fs_mgr_flags & MF_CRYPT) && !partition_wiped(rec->blk_device)) {
+        /* Need to mount a tmpfs at this mountpoint for now, and set
+         * properties that vold will query later for decrypting
+         */
+        if (mount("tmpfs", rec->mount_point, "tmpfs",
+              MS_NOATIME | MS_NOSUID | MS_NODEV, CRYPTO_TMPFS_OPTIONS) < 0) {
+            ERROR("Cannot mount tmpfs filesystem for encrypted fs at %s\n",
+                    rec->mount_point);
+            return -1;
+        }
+        return 1;
+    }
+
+    ERROR("Cannot mount filesystem on %s at %s\n",
+            rec->blk_device, rec->mount_point);
+    return -1;
+}
+
+/*
+ * Entries flagged "parallel" are waited for, checked and mounted on a
+ * thread of their own, while fs_mgr_mount_all() goes on with the next
+ * entries.  Any entry still waits for the earlier ones it is mounted
+ * on or under, so /data is mounted before /data/media whatever their
+ * flags are.
+ */
+struct mount_job {
+    struct mount_job *jobs;     /* all of them, indexed like the fstab */
+    struct fstab *fstab;
+    int index;
+    int queued;     /* to be mounted at all */
+    int running;    /* has a thread to join */
+    int done;
+    int ret;        /* mount_rec() result */
+    pthread_t thread;
+};
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+
+/* Whether mount point b is mount point a or below it. */
+static int mount_point_under(const char *a, const char *b)
+{
+    size_t len = strlen(a);
+
+    while (len > 0 && a[len - 1] == '/') {
+        len--;
+    }
+    return !strncmp(a, b, len) && (b[len] == '/' || b[len] == '\0');
+}
+
+static int wait_for_parents(struct mount_job *jobs, int index)
+{
+    struct fstab_rec *rec = &jobs[index].fstab->recs[index];
+    int ret = 0;
+    int i;
+
+    pthread_mutex_lock(&jobs_lock);
+    for (i = 0; i < index; i++) {
+        if (!jobs[i].queued ||
+                !mount_point_under(jobs[i].fstab->recs[i].mount_point,
+                                   rec->mount_point)) {
+            continue;
+        }
+        while (!jobs[i].done) {
+            pthread_cond_wait(&jobs_cond, &jobs_lock);
+        }
+        if (jobs[i].ret < 0) {
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    return ret;
+}
+
+static void run_mount_job(struct mount_job *jobs, int index)
+{
+    int ret;
+
+    ret = wait_for_parents(jobs, index);
+    if (ret < 0) {
+        ERROR("Not mounting %s, a filesystem it depends on failed\n",
+                jobs[index].fstab->recs[index].mount_point);
+    } else {
+        ret = mount_rec(&jobs[index].fstab->recs[index]);
+    }
+
+    pthread_mutex_lock(&jobs_lock);
+    jobs[index].ret = ret;
+    jobs[index].done = 1;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+static void *mount_job_thread(void *arg)
+{
+    struct mount_job *job = arg;
+
+    run_mount_job(job->jobs, job->index);
+    return NULL;
+}
+
+static int mounted_by_mount_all(struct fstab_rec *rec)
+{
+    /* Don't mount entries that are managed by vold */
+    if (rec->fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)) {
+        return 0;
+    }
+
+    /* Skip swap and raw partition entries such as boot, recovery, etc */
+    if (!strcmp(rec->fs_type, "swap") ||
+        !strcmp(rec->fs_type, "emmc") ||
+        !strcmp(rec->fs_type, "mtd")) {
+        return 0;
+    }
+
+    return 1;
+}
+
 int fs_mgr_mount_all(struct fstab *fstab)
 {
+    struct mount_job *jobs;
     int i = 0;
     int encrypted = 0;
     int ret = -1;
-    int mret;
 
     if (!fstab) {
         return ret;
     }
 
+    jobs = calloc(fstab->num_entries, sizeof(*jobs));
+    if (!jobs) {
+        return ret;
+    }
+
     for (i = 0; i < fstab->num_entries; i++) {
-        /* Don't mount entries that are managed by vold */
-        if (fstab->recs[i].fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)) {
-            continue;
-        }
+        jobs[i].jobs = jobs;
+        jobs[i].fstab = fstab;
+        jobs[i].index = i;
+        jobs[i].queued = mounted_by_mount_all(&fstab->recs[i]);
 
-        /* Skip swap and raw partition entries such as boot, recovery, etc */
-        if (!strcmp(fstab->recs[i].fs_type, "swap") ||
-            !strcmp(fstab->recs[i].fs_type, "emmc") ||
-            !strcmp(fstab->recs[i].fs_type, "mtd")) {
-            continue;
+        if (jobs[i].queued && (fstab->recs[i].fs_mgr_flags & MF_VERIFY)) {
+            fs_mgr_verity_prefetch(&fstab->recs[i]);
         }
+    }
 
-        if (fstab->recs[i].fs_mgr_flags & MF_WAIT) {
-            wait_for_file(fstab->recs[i].blk_device, WAIT_TIMEOUT);
+    for (i = 0; i < fstab->num_entries; i++) {
+        if (!jobs[i].queued) {
+            continue;
         }
 
-        if (fstab->recs[i].fs_mgr_flags & MF_CHECK) {
-            check_fs(fstab->recs[i].blk_device, fstab->recs[i].fs_type,
-                     fstab->recs[i].mount_point);
+        if ((fstab->recs[i].fs_mgr_flags & MF_PARALLEL) &&
+                !pthread_create(&jobs[i].thread, NULL, mount_job_thread, &jobs[i])) {
+            jobs[i].running = 1;
+            continue;
         }
 
-        if (fstab->recs[i].fs_mgr_flags & MF_VERIFY) {
-            if (fs_mgr_setup_verity(&fstab->recs[i]) < 0) {
-                ERROR("Could not set up verified partition, skipping!");
-                continue;
-            }
+        run_mount_job(jobs, i);
+        if (jobs[i].ret < 0) {
+            goto out;
         }
+    }
 
-        mret = __mount(fstab->recs[i].blk_device, fstab->recs[i].mount_point,
-                     fstab->recs[i].fs_type, fstab->recs[i].flags,
-                     fstab->recs[i].fs_options);
+    ret = 0;
 
-        if (!mret) {
-            /* Success!  Go get the next one */
-            continue;
+out:
+    for (i = 0; i < fstab->num_entries; i++) {
+        if (jobs[i].running) {
+            pthread_join(jobs[i].thread, NULL);
         }
-
-        /* mount(2) returned an error, check if it's encrypted and deal with it */
-        if ((fstab->recs[i].fs_mgr_flags & MF_CRYPT) &&
-            !partition_wiped(fstab->recs[i].blk_device)) {
-            /* Need to mount a tmpfs at this mountpoint for now, and set
-             * properties that vold will query later for decrypting
-             */
-            if (mount("tmpfs", fstab->recs[i].mount_point, "tmpfs",
-                  MS_NOATIME | MS_NOSUID | MS_NODEV, CRYPTO_TMPFS_OPTIONS) < 0) {
-                ERROR("Cannot mount tmpfs filesystem for encrypted fs at %s\n",
-                        fstab->recs[i].mount_point);
-                goto out;
-            }
+        if (jobs[i].done && jobs[i].ret < 0) {
+            ret = -1;
+        } else if (jobs[i].done && jobs[i].ret > 0) {
             encrypted = 1;
-        } else {
-            ERROR("Cannot mount filesystem on %s at %s\n",
-                    fstab->recs[i].blk_device, fstab->recs[i].mount_point);
-            goto out;
         }
     }
+    fs_mgr_verity_prefetch_cancel();
+    free(jobs);
 
-    if (encrypted) {
+    if (ret == 0 && encrypted) {
         ret = 1;
-    } else {
-        ret = 0;
     }
-
-out:
     return ret;
 }
 
@@ -680,7 +899,7 @@ int fs_mgr_do_mount(struct fstab *fstab, char *n_name, char *n_blk_device,
 
         /* First check the filesystem if requested */
         if (fstab->recs[i].fs_mgr_flags & MF_WAIT) {
-            wait_for_file(n_blk_device, WAIT_TIMEOUT);
+            fs_mgr_wait_for_file(n_blk_device, WAIT_TIMEOUT);
         }
 
         if (fstab->recs[i].fs_mgr_flags & MF_CHECK) {
@@ -802,7 +1021,7 @@ int fs_mgr_swapon_all(struct fstab *fstab)
         }
 
         if (fstab->recs[i].fs_mgr_flags & MF_WAIT) {
-            wait_for_file(fstab->recs[i].blk_device, WAIT_TIMEOUT);
+            fs_mgr_wait_for_file(fstab->recs[i].blk_device, WAIT_TIMEOUT);
         }
 
         /* Initialize the swap area */
@@ -48,6 +48,9 @@
  *                     the <source> file exists, and "check", which requests that the fs_mgr 
  *                     run an fscheck program on the <source> before mounting the filesystem.
  *                     If check is specifed on a read-only filesystem, it is ignored.
+ *                     "parallel" lets the fs_mgr wait for, check and mount the
+ *                     filesystem while it goes on with the next entries; entries
+ *                     mounted on or under its mount point still wait for it.
  *                     Also, "encryptable" means that filesystem can be encrypted.
  *                     The "encryptable" flag _MUST_ be followed by a = and a string which
  *                     is the location of the encryption keys.  It can either be a path
@@ -78,8 +81,16 @@
  * a la the Nexus One.
  */
 #define MF_NOEMULATEDSD 0x400
+#define MF_PARALLEL     0x800
 
 #define DM_BUF_SIZE 4096
 
+int fs_mgr_wait_for_file(const char *filename, int timeout);
+long long fs_mgr_time_us(void);
+/* Passes an event that began at start (from fs_mgr_time_us()) and ends now
+ * to the callback set with fs_mgr_set_timing_callback(), if any.
+ */
+void fs_mgr_report_time(const char *event, const char *mount_point, long long start);
+
 #endif /* __CORE_FS_MGR_PRIV_H */
 
@@ -14,4 +14,11 @@
  * limitations under the License.
  */
 
-int fs_mgr_setup_verity(struct fstab_rec *fstab);
\ No newline at end of file
+int fs_mgr_setup_verity(struct fstab_rec *fstab);
+
+/* Start reading and verifying the verity table of fstab in the background,
+ * for fs_mgr_setup_verity() to pick up later.
+ */
+void fs_mgr_verity_prefetch(struct fstab_rec *fstab);
+/* Wait for and drop the prefetches fs_mgr_setup_verity() didn't use. */
+void fs_mgr_verity_prefetch_cancel(void);
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include <sys/wait.h>
 #include <libgen.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <private/android_filesystem_config.h>
 #include <logwrap/logwrap.h>
@@ -83,110 +84,121 @@ static RSAPublicKey *load_key(char *path)
     return key;
 }
 
+/* The key is the same for every partition, so it is only read once. */
+static pthread_once_t verity_key_once = PTHREAD_ONCE_INIT;
+static RSAPublicKey *verity_key;
+
+static void load_verity_key(void)
+{
+    verity_key = load_key(VERITY_TABLE_RSA_KEY);
+}
+
 static int verify_table(char *signature, char *table, int table_length)
 {
-    int fd;
-    RSAPublicKey *key;
     uint8_t hash_buf[SHA_DIGEST_SIZE];
-    int retval = -1;
 
     // Hash the table
     SHA_hash((uint8_t*)table, table_length, hash_buf);
 
     // Now get the public key from the keyfile
-    key = load_key(VERITY_TABLE_RSA_KEY);
-    if (!key) {
+    pthread_once(&verity_key_once, load_verity_key);
+    if (!verity_key) {
         ERROR("Couldn't load verity keys");
-        goto out;
+        return -1;
     }
 
     // verify the result
-    if (!RSA_verify(key,
+    if (!RSA_verify(verity_key,
                     (uint8_t*) signature,
                     RSANUMBYTES,
                     (uint8_t*) hash_buf,
                     SHA_DIGEST_SIZE)) {
         ERROR("Couldn't verify table.");
-        goto out;
+        return -1;
     }
 
-    retval = 0;
-
-out:
-    free(key);
-    return retval;
+    return 0;
 }
 
-static int get_target_device_size(char *blk_device, uint64_t *device_size)
+/* ext4_parse_sb() fills in the global info, so only one caller at a time. */
+static pthread_mutex_t sb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int get_target_device_size(int data_device, uint64_t *device_size)
 {
-    int data_device;
     struct ext4_super_block sb;
 
-    data_device = open(blk_device, O_RDONLY);
-    if (data_device < 0) {
-        ERROR("Error opening block device (%s)", strerror(errno));
-        return -1;
-    }
-
-    if (lseek64(data_device, 1024, SEEK_SET) < 0) {
-        ERROR("Error seeking to superblock");
-        close(data_device);
-        return -1;
-    }
-
-    if (read(data_device, &sb, sizeof(sb)) != sizeof(sb)) {
+    if (pread64(data_device, &sb, sizeof(sb), 1024) != sizeof(sb)) {
         ERROR("Error reading superblock");
-        close(data_device);
         return -1;
     }
 
+    pthread_mutex_lock(&sb_lock);
     ext4_parse_sb(&sb);
     *device_size = info.len;
+    pthread_mutex_unlock(&sb_lock);
 
-    close(data_device);
     return 0;
 }
 
-static int read_verity_metadata(char *block_device, char **signature, char **table)
+/*
+ * The verity metadata block that follows the filesystem holds, in order,
+ * a magic number, a protocol version, the signature of the table, the
+ * length of the table and the table itself.  All of it is read with one
+ * pread() instead of a handful of small stdio reads.
+ */
+static int read_verity_metadata(char *block_device, uint64_t *device_size,
+                                char **signature, char **table)
 {
     unsigned magic_number;
     unsigned table_length;
     uint64_t device_length;
     int protocol_version;
-    FILE *device;
+    char *metadata = NULL;
+    char *p;
+    char *table_end;
+    ssize_t len;
+    int device;
     int retval = -1;
 
-    device = fopen(block_device, "r");
-    if (!device) {
+    *signature = NULL;
+    *table = NULL;
+
+    device = open(block_device, O_RDONLY);
+    if (device < 0) {
         ERROR("Could not open block device %s (%s).\n", block_device, strerror(errno));
-        goto out;
+        return -1;
     }
 
     // find the start of the verity metadata
-    if (get_target_device_size(block_device, &device_length) < 0) {
+    if (get_target_device_size(device, &device_length) < 0) {
         ERROR("Could not get target device size.\n");
         goto out;
     }
-    if (fseek(device, device_length, SEEK_SET) < 0) {
-        ERROR("Could not seek to start of verity metadata block.\n");
+
+    metadata = malloc(VERITY_METADATA_SIZE + 1);
+    if (!metadata) {
+        ERROR("Couldn't allocate memory for verity metadata!\n");
         goto out;
     }
-
-    // check the magic number
-    if (!fread(&magic_number, sizeof(int), 1, device)) {
-        ERROR("Couldn't read magic number!\n");
+    len = pread64(device, metadata, VERITY_METADATA_SIZE, device_length);
+    if (len < (ssize_t) (3 * sizeof(int) + RSANUMBYTES)) {
+        ERROR("Couldn't read verity metadata at offset %llu!\n", device_length);
         goto out;
     }
+    metadata[len] = '\0';
+    p = metadata;
+
+    // check the magic number
+    memcpy(&magic_number, p, sizeof(int));
+    p += sizeof(int);
     if (magic_number != VERITY_METADATA_MAGIC_NUMBER) {
         ERROR("Couldn't find verity metadata at offset %llu!\n", device_length);
         goto out;
     }
 
     // check the protocol version
-    if (!fread(&protocol_version, sizeof(int), 1, device)) {
-        ERROR("Couldn't read verity metadata protocol version!\n");
-        goto out;
-    }
+    memcpy(&protocol_version, p, sizeof(int));
+    p += sizeof(int);
     if (protocol_version != 0) {
         ERROR("Got unknown verity metadata protocol version %d!\n", protocol_version);
         goto out;
@@ -198,38 +210,35 @@ static int read_verity_metadata(char *block_device, char **signature, char **tab
         ERROR("Couldn't allocate memory for signature!\n");
         goto out;
     }
-    if (!fread(*signature, RSANUMBYTES, 1, device)) {
-        ERROR("Couldn't read signature from verity metadata!\n");
-        free(*signature);
-        goto out;
-    }
+    memcpy(*signature, p, RSANUMBYTES);
+    p += RSANUMBYTES;
 
     // get the size of the table
-    if (!fread(&table_length, sizeof(int), 1, device)) {
-        ERROR("Couldn't get the size of the verity table from metadata!\n");
-        free(*signature);
+    memcpy(&table_length, p, sizeof(int));
+    p += sizeof(int);
+    if (table_length > (size_t) (metadata + len - p)) {
+        ERROR("Verity table of %u bytes doesn't fit in the metadata!\n", table_length);
         goto out;
     }
 
-    // get the table + null terminator
-    table_length += 1;
-    *table = malloc(table_length);
-    if(!*table) {
+    // get the table + null terminator, which like fgets() stops at a newline
+    table_end = memchr(p, '\n', table_length);
+    *table = strndup(p, table_end ? (size_t) (table_end - p + 1) : table_length);
+    if (!*table) {
         ERROR("Couldn't allocate memory for verity table!\n");
         goto out;
     }
-    if (!fgets(*table, table_length, device)) {
-        ERROR("Couldn't read the verity table from metadata!\n");
-        free(*table);
-        free(*signature);
-        goto out;
-    }
 
+    *device_size = device_length;
     retval = 0;
 
 out:
-    if (device)
-        fclose(device);
+    if (retval < 0) {
+        free(*signature);
+        *signature = NULL;
+    }
+    free(metadata);
+    close(device);
     return retval;
 }
 
@@ -272,15 +281,10 @@ static int get_verity_device_name(struct dm_ioctl *io, char *name, int fd, char
     return 0;
 }
 
-static int load_verity_table(struct dm_ioctl *io, char *name, char *blockdev, int fd, char *table)
+static int load_verity_table(struct dm_ioctl *io, char *name, uint64_t device_size, int fd, char *table)
 {
     char *verity_params;
     char *buffer = (char*) io;
-    uint64_t device_size = 0;
-
-    if (get_target_device_size(blockdev, &device_size) < 0) {
-        return -1;
-    }
 
     verity_ioctl_init(io, name, DM_STATUS_TABLE_FLAG);
 
@@ -334,27 +338,168 @@ static int test_access(char *device) {
     return -1;
 }
 
+/* Waits for the block device and reads and verifies its verity table. */
+static int read_verified_table(struct fstab_rec *fstab, uint64_t *device_size,
+                               char **signature, char **table)
+{
+    long long start;
+
+    if (fstab->fs_mgr_flags & MF_WAIT) {
+        fs_mgr_wait_for_file(fstab->blk_device, WAIT_TIMEOUT);
+    }
+
+    // read the verity block at the end of the block device
+    start = fs_mgr_time_us();
+    if (read_verity_metadata(fstab->blk_device, device_size, signature, table) < 0) {
+        return -1;
+    }
+    fs_mgr_report_time("verity_read", fstab->mount_point, start);
+
+    // verify the signature on the table
+    start = fs_mgr_time_us();
+    if (verify_table(*signature, *table, strlen(*table)) < 0) {
+        free(*signature);
+        free(*table);
+        return -1;
+    }
+    fs_mgr_report_time("verity_verify", fstab->mount_point, start);
+
+    return 0;
+}
+
+/*
+ * The metadata of every verified partition is read and checked on a
+ * thread of its own as soon as fs_mgr_mount_all() starts, instead of
+ * one partition after the other as each is mounted.
+ */
+struct verity_prefetch {
+    struct verity_prefetch *next;
+    struct fstab_rec *fstab;
+    pthread_t thread;
+    int ret;
+    uint64_t device_size;
+    char *signature;
+    char *table;
+};
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct verity_prefetch *prefetches;
+
+static void *verity_prefetch_thread(void *arg)
+{
+    struct verity_prefetch *pf = arg;
+
+    pf->ret = read_verified_table(pf->fstab, &pf->device_size,
+                                  &pf->signature, &pf->table);
+    return NULL;
+}
+
+void fs_mgr_verity_prefetch(struct fstab_rec *fstab)
+{
+    struct verity_prefetch *pf;
+
+    pf = calloc(1, sizeof(*pf));
+    if (!pf) {
+        return;
+    }
+    pf->fstab = fstab;
+    if (pthread_create(&pf->thread, NULL, verity_prefetch_thread, pf)) {
+        free(pf);
+        return;
+    }
+
+    pthread_mutex_lock(&prefetch_lock);
+    pf->next = prefetches;
+    prefetches = pf;
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+/* Takes the prefetch of fstab off the list, once its thread is done. */
+static struct verity_prefetch *get_prefetch(struct fstab_rec *fstab)
+{
+    struct verity_prefetch **pp;
+    struct verity_prefetch *pf = NULL;
+
+    pthread_mutex_lock(&prefetch_lock);
+    for (pp = &prefetches; *pp; pp = &(*pp)->next) {
+        if ((*pp)->fstab == fstab) {
+            pf = *pp;
+            *pp = pf->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+
+    if (pf) {
+        pthread_join(pf->thread, NULL);
+    }
+    return pf;
+}
+
+void fs_mgr_verity_prefetch_cancel(void)
+{
+    struct verity_prefetch *pf;
+
+    pthread_mutex_lock(&prefetch_lock);
+    while ((pf = prefetches) != NULL) {
+        prefetches = pf->next;
+        pthread_join(pf->thread, NULL);
+        if (pf->ret == 0) {
+            free(pf->signature);
+            free(pf->table);
+        }
+        free(pf);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
 int fs_mgr_setup_verity(struct fstab_rec *fstab) {
 
     int retval = -1;
 
     char *verity_blk_name;
-    char *verity_table;
-    char *verity_table_signature;
+    char *verity_table = NULL;
+    char *verity_table_signature = NULL;
+    uint64_t device_size;
+    struct verity_prefetch *pf;
+    long long start;
 
     char buffer[DM_BUF_SIZE];
     struct dm_ioctl *io = (struct dm_ioctl *) buffer;
-    char *mount_point = basename(fstab->mount_point);
+    char *mount_point;
+    int fd = -1;
+
+    // basename() isn't thread safe and the mount point has no trailing slash
+    mount_point = strrchr(fstab->mount_point, '/');
+    mount_point = mount_point ? mount_point + 1 : fstab->mount_point;
+
+    // get the table read and verified ahead of time, or do it now
+    pf = get_prefetch(fstab);
+    if (pf) {
+        retval = pf->ret;
+        device_size = pf->device_size;
+        verity_table_signature = pf->signature;
+        verity_table = pf->table;
+        free(pf);
+        if (retval < 0) {
+            return retval;
+        }
+        retval = -1;
+    } else if (read_verified_table(fstab, &device_size,
+                                   &verity_table_signature, &verity_table) < 0) {
+        return retval;
+    }
+
+    start = fs_mgr_time_us();
 
     // set the dm_ioctl flags
     io->flags |= 1;
     io->target_count = 1;
 
     // get the device mapper fd
-    int fd;
     if ((fd = open("/dev/device-mapper", O_RDWR)) < 0) {
         ERROR("Error opening device mapper (%s)", strerror(errno));
-        return retval;
+        goto out;
     }
 
     // create the device
@@ -369,22 +514,8 @@ int fs_mgr_setup_verity(struct fstab_rec *fstab) {
         goto out;
     }
 
-    // read the verity block at the end of the block device
-    if (read_verity_metadata(fstab->blk_device,
-                                    &verity_table_signature,
-                                    &verity_table) < 0) {
-        goto out;
-    }
-
-    // verify the signature on the table
-    if (verify_table(verity_table_signature,
-                            verity_table,
-                            strlen(verity_table)) < 0) {
-        goto out;
-    }
-
     // load the verity mapping table
-    if (load_verity_table(io, mount_point, fstab->blk_device, fd, verity_table) < 0) {
+    if (load_verity_table(io, mount_point, device_size, fd, verity_table) < 0) {
         goto out;
     }
 
@@ -402,9 +533,13 @@ int fs_mgr_setup_verity(struct fstab_rec *fstab) {
         goto out;
     }
 
+    fs_mgr_report_time("verity_setup", fstab->mount_point, start);
     retval = 0;
 
 out:
-    close(fd);
+    if (fd >= 0)
+        close(fd);
+    free(verity_table_signature);
+    free(verity_table);
     return retval;
 }
@@ -64,6 +64,16 @@ int fs_mgr_is_nonremovable(struct fstab_rec *fstab);
 int fs_mgr_is_encryptable(struct fstab_rec *fstab);
 int fs_mgr_is_noemulatedsd(struct fstab_rec *fstab);
 int fs_mgr_swapon_all(struct fstab *fstab);
+
+/*
+ * Called with the CLOCK_MONOTONIC start and end times, in microseconds, of
+ * the steps of mounting an entry that can take a while, such as reading
+ * and verifying its verity table.  It may be called from more than one
+ * thread at a time.
+ */
+typedef void (*fs_mgr_timing_callback)(const char *event, const char *mount_point,
+                                       long long start, long long end);
+void fs_mgr_set_timing_callback(fs_mgr_timing_callback callback);
 #ifdef __cplusplus
 }
 #endif
@@ -92,18 +92,49 @@ int BatteryMonitor::getBatteryHealth(const char* status) {
     return ret;
 }
 
+static bool sameProperties(const struct BatteryProperties& a,
+                           const struct BatteryProperties& b) {
+    return a.chargerAcOnline == b.chargerAcOnline &&
+        a.chargerUsbOnline == b.chargerUsbOnline &&
+        a.chargerWirelessOnline == b.chargerWirelessOnline &&
+        a.batteryStatus == b.batteryStatus &&
+        a.batteryHealth == b.batteryHealth &&
+        a.batteryPresent == b.batteryPresent &&
+        a.batteryLevel == b.batteryLevel &&
+        a.batteryVoltage == b.batteryVoltage &&
+        a.batteryCurrentNow == b.batteryCurrentNow &&
+        a.batteryChargeCounter == b.batteryChargeCounter &&
+        a.batteryTemperature == b.batteryTemperature &&
+        a.batteryTechnology == b.batteryTechnology;
+}
+
 int BatteryMonitor::readFromFile(const String8& path, char* buf, size_t size) {
     char *cp = NULL;
 
     if (path.isEmpty())
         return -1;
-    int fd = open(path.string(), O_RDONLY, 0);
-    if (fd == -1) {
-        KLOG_ERROR(LOG_TAG, "Could not open '%s'\n", path.string());
-        return -1;
+
+    // sysfs regenerates an attribute on every read from offset 0, so the
+    // files are opened once and re-read in place.
+    ssize_t index = mSysfsFds.indexOfKey(path);
+    int fd;
+    if (index >= 0) {
+        fd = mSysfsFds.valueAt(index);
+    } else {
+        fd = open(path.string(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd == -1) {
+            KLOG_ERROR(LOG_TAG, "Could not open '%s'\n", path.string());
+            return -1;
+        }
+        mSysfsFds.add(path, fd);
     }
 
-    ssize_t count = TEMP_FAILURE_RETRY(read(fd, buf, size));
+    ssize_t count = TEMP_FAILURE_RETRY(pread(fd, buf, size, 0));
+    if (count < 0) {
+        // The supply may have gone away; open it afresh next time.
+        close(fd);
+        mSysfsFds.removeItem(path);
+    }
     if (count > 0)
             cp = (char *)memrchr(buf, '\n', count);
 
@@ -112,7 +143,6 @@ int BatteryMonitor::readFromFile(const String8& path, char* buf, size_t size) {
     else
         buf[0] = '\0';
 
-    close(fd);
     return count;
 }
 
@@ -169,7 +199,7 @@ int BatteryMonitor::getIntField(const String8& path) {
     return value;
 }
 
-bool BatteryMonitor::update(void) {
+bool BatteryMonitor::update(bool force) {
     struct BatteryProperties props;
     bool logthis;
 
@@ -265,7 +295,13 @@ bool BatteryMonitor::update(void) {
                   props.chargerWirelessOnline ? "w" : "");
     }
 
-    if (mBatteryPropertiesRegistrar != NULL)
+    mPropertiesChanged = !mHaveLastProps || !sameProperties(props, mLastProps);
+    if (mPropertiesChanged) {
+        mLastProps = props;
+        mHaveLastProps = true;
+    }
+
+    if (mBatteryPropertiesRegistrar != NULL && (mPropertiesChanged || force))
         mBatteryPropertiesRegistrar->notifyListeners(props);
 
     return props.chargerAcOnline | props.chargerUsbOnline |
@@ -276,6 +312,8 @@ void BatteryMonitor::init(struct healthd_config *hc, bool nosvcmgr) {
     String8 path;
 
     mHealthdConfig = hc;
+    mHaveLastProps = false;
+    mPropertiesChanged = false;
     DIR* dir = opendir(POWER_SUPPLY_SYSFS_PATH);
     if (dir == NULL) {
         KLOG_ERROR(LOG_TAG, "Could not open %s\n", POWER_SUPPLY_SYSFS_PATH);
@@ -18,6 +18,8 @@
 #define HEALTHD_BATTERYMONITOR_H
 
 #include <binder/IInterface.h>
+#include <batteryservice/BatteryService.h>
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
@@ -40,12 +42,23 @@ class BatteryMonitor {
     };
 
     void init(struct healthd_config *hc, bool nosvcmgr);
-    bool update(void);
+    // Listeners are only notified when a property has changed since the
+    // last notification, or when force is set.
+    bool update(bool force = false);
+    // Whether the last update() saw any property change.
+    bool propertiesChanged() const { return mPropertiesChanged; }
 
   private:
     struct healthd_config *mHealthdConfig;
     Vector<String8> mChargerNames;
 
+    // sysfs attributes are kept open and re-read with pread() from 0.
+    KeyedVector<String8, int> mSysfsFds;
+
+    struct BatteryProperties mLastProps;
+    bool mHaveLastProps;
+    bool mPropertiesChanged;
+
     sp<BatteryPropertiesRegistrar> mBatteryPropertiesRegistrar;
 
     int getBatteryStatus(const char* status);
@@ -25,19 +25,71 @@
 
 namespace android {
 
+// Minimum time between two rounds of listener notifications
+static const nsecs_t NOTIFY_MIN_INTERVAL = ms2ns(250);
+
 BatteryPropertiesRegistrar::BatteryPropertiesRegistrar(BatteryMonitor* monitor) {
     mBatteryMonitor = monitor;
+    mHavePendingProps = false;
+    mLastNotifyTime = 0;
 }
 
 void BatteryPropertiesRegistrar::publish() {
+    mNotifyThread = new NotifyThread(this);
+    mNotifyThread->run("healthd_notify");
     defaultServiceManager()->addService(String16("batterypropreg"), this);
 }
 
 void BatteryPropertiesRegistrar::notifyListeners(struct BatteryProperties props) {
-    Mutex::Autolock _l(mRegistrationLock);
-    for (size_t i = 0; i < mListeners.size(); i++) {
-        mListeners[i]->batteryPropertiesChanged(props);
+    Mutex::Autolock _l(mNotifyLock);
+    mPendingProps = props;
+    mHavePendingProps = true;
+    mNotifyCond.signal();
+}
+
+BatteryPropertiesRegistrar::NotifyThread::NotifyThread(BatteryPropertiesRegistrar* registrar)
+    : Thread(false), mRegistrar(registrar) {
+}
+
+bool BatteryPropertiesRegistrar::NotifyThread::threadLoop() {
+    return mRegistrar->deliverPending();
+}
+
+/*
+ * Waits for pending properties and sends them to every listener.  The
+ * listener list is copied so that neither the healthd loop nor listener
+ * registration waits on the binder calls.
+ */
+bool BatteryPropertiesRegistrar::deliverPending() {
+    struct BatteryProperties props;
+    Vector<sp<IBatteryPropertiesListener> > listeners;
+
+    {
+        Mutex::Autolock _l(mNotifyLock);
+        while (!mHavePendingProps)
+            mNotifyCond.wait(mNotifyLock);
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t next = mLastNotifyTime + NOTIFY_MIN_INTERVAL;
+        if (mLastNotifyTime && now < next) {
+            // Too soon; anything arriving meanwhile replaces mPendingProps.
+            mNotifyCond.waitRelative(mNotifyLock, next - now);
+            return true;
+        }
+
+        props = mPendingProps;
+        mHavePendingProps = false;
+        mLastNotifyTime = now;
+    }
+
+    {
+        Mutex::Autolock _l(mRegistrationLock);
+        listeners = mListeners;
+    }
+    for (size_t i = 0; i < listeners.size(); i++) {
+        listeners[i]->batteryPropertiesChanged(props);
     }
+    return true;
 }
 
 void BatteryPropertiesRegistrar::registerListener(const sp<IBatteryPropertiesListener>& listener) {
@@ -53,7 +105,8 @@ void BatteryPropertiesRegistrar::registerListener(const sp<IBatteryPropertiesLis
         mListeners.add(listener);
         listener->asBinder()->linkToDeath(this);
     }
-    mBatteryMonitor->update();
+    // The new listener needs the current values even if nothing changed.
+    mBatteryMonitor->update(true);
 }
 
 void BatteryPropertiesRegistrar::unregisterListener(const sp<IBatteryPropertiesListener>& listener) {
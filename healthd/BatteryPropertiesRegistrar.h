@@ -20,7 +20,10 @@
 #include "BatteryMonitor.h"
 
 #include <binder/IBinder.h>
+#include <utils/Condition.h>
 #include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
 #include <utils/Vector.h>
 #include <batteryservice/BatteryService.h>
 #include <batteryservice/IBatteryPropertiesListener.h>
@@ -38,10 +41,30 @@ public:
     void notifyListeners(struct BatteryProperties props);
 
 private:
+    // Delivers notifications off the healthd loop, at most one per
+    // NOTIFY_MIN_INTERVAL; updates arriving in between are merged and only
+    // the latest properties are sent.
+    class NotifyThread : public Thread {
+    public:
+        NotifyThread(BatteryPropertiesRegistrar* registrar);
+    private:
+        BatteryPropertiesRegistrar* mRegistrar;
+        virtual bool threadLoop();
+    };
+
     BatteryMonitor* mBatteryMonitor;
     Mutex mRegistrationLock;
     Vector<sp<IBatteryPropertiesListener> > mListeners;
 
+    Mutex mNotifyLock;
+    Condition mNotifyCond;
+    struct BatteryProperties mPendingProps;
+    bool mHavePendingProps;
+    nsecs_t mLastNotifyTime;
+    sp<NotifyThread> mNotifyThread;
+
+    bool deliverPending();
+
     void registerListener(const sp<IBatteryPropertiesListener>& listener);
     void unregisterListener(const sp<IBatteryPropertiesListener>& listener);
     void binderDied(const wp<IBinder>& who);
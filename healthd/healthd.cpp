@@ -63,6 +63,10 @@ static int binder_fd;
 // -1 for no epoll timeout
 static int awake_poll_interval = -1;
 
+// Awake polls back off from the fast interval towards the slow one while
+// the battery properties stay the same, and snap back once they change.
+static int awake_poll_backoff = 1;
+
 static int wakealarm_wake_interval = DEFAULT_PERIODIC_CHORES_INTERVAL_FAST;
 
 static BatteryMonitor* gBatteryMonitor;
@@ -105,12 +109,24 @@ static void battery_update(void) {
     // poll at fast rate while awake and let alarm wake up at slow rate when
     // asleep.
 
-    if (healthd_config.periodic_chores_interval_fast == -1)
+    if (gBatteryMonitor->propertiesChanged())
+        awake_poll_backoff = 1;
+    else if (healthd_config.periodic_chores_interval_fast * awake_poll_backoff <
+             healthd_config.periodic_chores_interval_slow)
+        awake_poll_backoff *= 2;
+
+    if (healthd_config.periodic_chores_interval_fast == -1) {
         awake_poll_interval = -1;
-    else
-        awake_poll_interval =
-            new_wake_interval == healthd_config.periodic_chores_interval_fast ?
-                -1 : healthd_config.periodic_chores_interval_fast * 1000;
+    } else if (new_wake_interval == healthd_config.periodic_chores_interval_fast) {
+        awake_poll_interval = -1;
+    } else {
+        int interval = healthd_config.periodic_chores_interval_fast *
+            awake_poll_backoff;
+        if (healthd_config.periodic_chores_interval_slow != -1 &&
+            interval > healthd_config.periodic_chores_interval_slow)
+            interval = healthd_config.periodic_chores_interval_slow;
+        awake_poll_interval = interval * 1000;
+    }
 }
 
 static void periodic_chores() {
@@ -131,27 +147,34 @@ static void uevent_event(void) {
     char msg[UEVENT_MSG_LEN+2];
     char *cp;
     int n;
-
-    n = uevent_kernel_multicast_recv(uevent_fd, msg, UEVENT_MSG_LEN);
-    if (n <= 0)
-        return;
-    if (n >= UEVENT_MSG_LEN)   /* overflow -- discard */
-        return;
-
-    msg[n] = '\0';
-    msg[n+1] = '\0';
-    cp = msg;
-
-    while (*cp) {
-        if (!strcmp(cp, "SUBSYSTEM=" POWER_SUPPLY_SUBSYSTEM)) {
-            battery_update();
-            break;
+    bool power_supply = false;
+
+    // Drain every queued uevent first, so that a burst from one supply
+    // costs a single battery_update().
+    while ((n = uevent_kernel_multicast_recv(uevent_fd, msg, UEVENT_MSG_LEN)) > 0) {
+        if (n >= UEVENT_MSG_LEN)   /* overflow -- discard */
+            continue;
+        if (power_supply)
+            continue;
+
+        msg[n] = '\0';
+        msg[n+1] = '\0';
+        cp = msg;
+
+        while (*cp) {
+            if (!strcmp(cp, "SUBSYSTEM=" POWER_SUPPLY_SUBSYSTEM)) {
+                power_supply = true;
+                break;
+            }
+
+            /* advance to after the next \0 */
+            while (*cp++)
+                ;
         }
-
-        /* advance to after the next \0 */
-        while (*cp++)
-            ;
     }
+
+    if (power_supply)
+        battery_update();
 }
 
 static void wakealarm_init(void) {
@@ -97,6 +97,53 @@ void get_backtrace_symbols_ptrace(const ptrace_context_t* context,
  */
 void free_backtrace_symbols(backtrace_symbol_t* backtrace_symbols, size_t frames);
 
+/*
+ * Describes the backtrace of one thread of a remote process.
+ */
+typedef struct {
+    pid_t tid;
+    int error;                   /* errno if the thread could not be attached, or 0 */
+    bool detach_failed;          /* true if the thread could not be detached */
+    ssize_t frame_count;         /* number of frames, or -1 if the stack could not be unwound */
+    backtrace_frame_t* frames;
+    backtrace_symbol_t* symbols; /* one per frame */
+} thread_backtrace_t;
+
+/*
+ * Unwinds the call stacks of every thread of a remote process using ptrace().
+ *
+ * All of the threads are attached before any of them is waited for, so they stop
+ * together instead of one after another, and each is detached as soon as its stack
+ * has been walked.  Symbols are looked up afterwards, while the process runs again,
+ * using the maps and symbol tables shared through the context.
+ *
+ * If attached_tid is not 0, the caller must already have attached to and stopped that
+ * thread; it is reported first and is left attached.
+ *
+ * Returns the number of threads stored in *out_threads, or -1 if an error occurred.
+ * The threads must later be freed using free_process_backtrace.
+ */
+ssize_t unwind_backtrace_process(pid_t pid, pid_t attached_tid,
+        const ptrace_context_t* context, size_t max_depth,
+        thread_backtrace_t** out_threads);
+
+/*
+ * Frees the storage associated with a process backtrace.
+ */
+void free_process_backtrace(thread_backtrace_t* threads, size_t count);
+
+/*
+ * Unwinds the call stacks of several threads within this process.
+ *
+ * All of the threads are signalled before any of them is waited for, so they unwind
+ * their own stacks at the same time instead of one after another.  The caller fills in
+ * each thread's tid and frames, with room for max_depth frames; frame_count is set to
+ * the number of frames collected, or -1 if the stack could not be unwound.  The symbols
+ * are not looked up.
+ */
+void unwind_backtrace_threads(thread_backtrace_t* threads, size_t count,
+        size_t ignore_depth, size_t max_depth);
+
 enum {
     // A hint for how big to make the line buffer for format_backtrace_line
     MAX_BACKTRACE_LINE_LENGTH = 800,
@@ -29,6 +29,7 @@ extern "C" {
 
 typedef struct map_info {
     struct map_info* next;
+    struct map_index* index; // for find_map_info(), on the head of a loaded list
     uintptr_t start;
     uintptr_t end;
     bool is_readable;
@@ -44,7 +45,8 @@ map_info_t* load_map_info_list(pid_t tid);
 /* Frees memory map. */
 void free_map_info_list(map_info_t* milist);
 
-/* Finds the memory map that contains the specified address. */
+/* Finds the memory map that contains the specified address.
+ * Lists from load_map_info_list() are searched by bisection. */
 const map_info_t* find_map_info(const map_info_t* milist, uintptr_t addr);
 
 /* Returns true if the addr is in a readable map. */
@@ -30,16 +30,21 @@
 extern "C" {
 #endif
 
+/* A few pages of a remote process, read in bulk. */
+typedef struct memory_cache memory_cache_t;
+
 /* Stores information about a process that is used for several different
  * ptrace() based operations. */
 typedef struct {
     map_info_t* map_info_list;
+    memory_cache_t* memory_cache;
 } ptrace_context_t;
 
 /* Describes how to access memory from a process. */
 typedef struct {
     pid_t tid;
     const map_info_t* map_info_list;
+    memory_cache_t* cache;
 } memory_t;
 
 #if __i386__
@@ -89,6 +94,13 @@ void init_memory(memory_t* memory, const map_info_t* map_info_list);
  */
 void init_memory_ptrace(memory_t* memory, pid_t tid);
 
+/*
+ * Like init_memory_ptrace(), but reads a page at a time through the page
+ * cache of the context.  The cache is emptied, so memory that changed since
+ * the last call is seen afresh; only use this while the process is stopped.
+ */
+void init_memory_ptrace_context(memory_t* memory, const ptrace_context_t* context, pid_t tid);
+
 /*
  * Reads a word of memory safely.
  * If the memory is local, ensures that the address is readable before dereferencing it.
@@ -37,6 +37,8 @@ typedef struct {
 
 /*
  * Loads a symbol table from a given file.
+ * Tables are shared within the process, and symbols are only read from the
+ * file when first looked up.
  * Returns NULL on error.
  */
 symbol_table_t* load_symbol_table(const char* filename);
@@ -22,6 +22,33 @@ int ashmem_pin_region(int fd, size_t offset, size_t len);
 int ashmem_unpin_region(int fd, size_t offset, size_t len);
 int ashmem_get_size_region(int fd);
 
+/*
+ * A pool of unshared regions recycled by size.  ashmem_pool_get() returns a
+ * pinned region, reusing one handed back with ashmem_pool_put() if it can;
+ * ashmem_pool_put() unpins the region and keeps up to max_free of them.
+ * Contents of a reused region are undefined.  Never put back a region whose
+ * fd has been passed to another process.
+ */
+struct ashmem_pool;
+
+struct ashmem_pool *ashmem_pool_create(const char *name, size_t max_free);
+void ashmem_pool_destroy(struct ashmem_pool *pool);
+int ashmem_pool_get(struct ashmem_pool *pool, size_t size);
+void ashmem_pool_put(struct ashmem_pool *pool, int fd);
+
+/*
+ * Pin or unpin a list of ranges, with one ioctl for each run of ranges that
+ * follow on from each other.  ashmem_pin_ranges() returns ASHMEM_WAS_PURGED
+ * if any range was purged.
+ */
+struct ashmem_range {
+	size_t offset;
+	size_t len;
+};
+
+int ashmem_pin_ranges(int fd, const struct ashmem_range *ranges, size_t count);
+int ashmem_unpin_ranges(int fd, const struct ashmem_range *ranges, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CUTILS_ATOMIC_EXPLICIT_H
+#define ANDROID_CUTILS_ATOMIC_EXPLICIT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Atomic operations on 32- and 64-bit values with an explicit memory
+ * order, modelled on the C11 <stdatomic.h> functions of the same names.
+ *
+ * Unlike the ones in <cutils/atomic.h>, which always issue a full
+ * barrier, these only provide the ordering asked for:
+ *   - ANDROID_MEMORY_ORDER_RELAXED: atomicity only, no ordering.  Enough
+ *     for statistics counters, and for incrementing a reference count.
+ *   - ANDROID_MEMORY_ORDER_ACQUIRE: nothing after the operation can be
+ *     moved before it.  For taking a lock, or reading what a release
+ *     published.
+ *   - ANDROID_MEMORY_ORDER_RELEASE: nothing before the operation can be
+ *     moved after it.  For releasing a lock, or publishing data.
+ *   - ANDROID_MEMORY_ORDER_ACQ_REL: both, for read-modify-write operations
+ *     such as decrementing a reference count.
+ *   - ANDROID_MEMORY_ORDER_SEQ_CST: all such operations also happen in a
+ *     single total order.
+ *
+ * They are all inline, and map to the compiler's __atomic builtins.  When
+ * built with a compiler that lacks them, they fall back to the __sync
+ * builtins, which order everything as SEQ_CST.
+ *
+ * The addresses must be aligned on the size of the value.  64-bit values
+ * may need to be aligned explicitly on 32-bit platforms, where int64_t is
+ * not always 8-byte aligned in structs.
+ *
+ * As with <cutils/atomic.h>, read-modify-write operations return the
+ * previous value, and android_atomic_cas_explicit() returns zero if the
+ * new value was stored.
+ */
+
+#ifndef ANDROID_ATOMIC_EXPLICIT_INLINE
+#define ANDROID_ATOMIC_EXPLICIT_INLINE static inline __attribute__((always_inline))
+#endif
+
+#if defined(__ATOMIC_RELAXED)
+
+typedef enum {
+    ANDROID_MEMORY_ORDER_RELAXED = __ATOMIC_RELAXED,
+    ANDROID_MEMORY_ORDER_ACQUIRE = __ATOMIC_ACQUIRE,
+    ANDROID_MEMORY_ORDER_RELEASE = __ATOMIC_RELEASE,
+    ANDROID_MEMORY_ORDER_ACQ_REL = __ATOMIC_ACQ_REL,
+    ANDROID_MEMORY_ORDER_SEQ_CST = __ATOMIC_SEQ_CST
+} android_memory_order_t;
+
+/*
+ * A CAS that fails only reads, so its failure order is what is left of
+ * the requested one once the release part is removed.
+ */
+#define ANDROID_ATOMIC_FAILURE_ORDER(order) \
+    ((order) == ANDROID_MEMORY_ORDER_ACQ_REL ? ANDROID_MEMORY_ORDER_ACQUIRE : \
+     (order) == ANDROID_MEMORY_ORDER_RELEASE ? ANDROID_MEMORY_ORDER_RELAXED : (order))
+
+#define ANDROID_ATOMIC_EXPLICIT_OPS(suffix, type)                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_load_explicit(volatile const type* addr,                   \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    return __atomic_load_n(addr, order);                                            \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE void                                                 \
+android_atomic##suffix##_store_explicit(type value, volatile type* addr,            \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    __atomic_store_n(addr, value, order);                                           \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_exchange_explicit(type value, volatile type* addr,         \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    return __atomic_exchange_n(addr, value, order);                                 \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_add_explicit(type value, volatile type* addr,              \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    return __atomic_fetch_add(addr, value, order);                                  \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_and_explicit(type value, volatile type* addr,              \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    return __atomic_fetch_and(addr, value, order);                                  \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_or_explicit(type value, volatile type* addr,               \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    return __atomic_fetch_or(addr, value, order);                                   \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE int                                                  \
+android_atomic##suffix##_cas_explicit(type oldvalue, type newvalue,                 \
+        volatile type* addr, android_memory_order_t order)                          \
+{                                                                                   \
+    return !__atomic_compare_exchange_n(addr, &oldvalue, newvalue, 0, order,        \
+            ANDROID_ATOMIC_FAILURE_ORDER(order));                                   \
+}
+
+ANDROID_ATOMIC_EXPLICIT_INLINE void
+android_atomic_thread_fence(android_memory_order_t order)
+{
+    __atomic_thread_fence(order);
+}
+
+#else /* !__ATOMIC_RELAXED */
+
+typedef enum {
+    ANDROID_MEMORY_ORDER_RELAXED,
+    ANDROID_MEMORY_ORDER_ACQUIRE,
+    ANDROID_MEMORY_ORDER_RELEASE,
+    ANDROID_MEMORY_ORDER_ACQ_REL,
+    ANDROID_MEMORY_ORDER_SEQ_CST
+} android_memory_order_t;
+
+#define ANDROID_ATOMIC_EXPLICIT_OPS(suffix, type)                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_load_explicit(volatile const type* addr,                   \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    (void) order;                                                                   \
+    return __sync_fetch_and_add((volatile type*) addr, 0);                          \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_exchange_explicit(type value, volatile type* addr,         \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    type old;                                                                       \
+    (void) order;                                                                   \
+    do {                                                                            \
+        old = *addr;                                                                \
+    } while (!__sync_bool_compare_and_swap(addr, old, value));                      \
+    return old;                                                                     \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE void                                                 \
+android_atomic##suffix##_store_explicit(type value, volatile type* addr,            \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    android_atomic##suffix##_exchange_explicit(value, addr, order);                 \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_add_explicit(type value, volatile type* addr,              \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    (void) order;                                                                   \
+    return __sync_fetch_and_add(addr, value);                                       \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_and_explicit(type value, volatile type* addr,              \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    (void) order;                                                                   \
+    return __sync_fetch_and_and(addr, value);                                       \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE type                                                 \
+android_atomic##suffix##_or_explicit(type value, volatile type* addr,               \
+        android_memory_order_t order)                                               \
+{                                                                                   \
+    (void) order;                                                                   \
+    return __sync_fetch_and_or(addr, value);                                        \
+}                                                                                   \
+ANDROID_ATOMIC_EXPLICIT_INLINE int                                                  \
+android_atomic##suffix##_cas_explicit(type oldvalue, type newvalue,                 \
+        volatile type* addr, android_memory_order_t order)                          \
+{                                                                                   \
+    (void) order;                                                                   \
+    return !__sync_bool_compare_and_swap(addr, oldvalue, newvalue);                 \
+}
+
+ANDROID_ATOMIC_EXPLICIT_INLINE void
+android_atomic_thread_fence(android_memory_order_t order)
+{
+    if (order != ANDROID_MEMORY_ORDER_RELAXED) {
+        __sync_synchronize();
+    }
+}
+
+#endif /* __ATOMIC_RELAXED */
+
+/*
+ * android_atomic_load_explicit(), android_atomic_store_explicit(),
+ * android_atomic_exchange_explicit(), android_atomic_add_explicit(),
+ * android_atomic_and_explicit(), android_atomic_or_explicit() and
+ * android_atomic_cas_explicit() on int32_t, and the same with an
+ * android_atomic64_ prefix on int64_t.
+ */
+ANDROID_ATOMIC_EXPLICIT_OPS(, int32_t)
+ANDROID_ATOMIC_EXPLICIT_OPS(64, int64_t)
+
+#undef ANDROID_ATOMIC_EXPLICIT_OPS
+
+ANDROID_ATOMIC_EXPLICIT_INLINE int32_t
+android_atomic_inc_explicit(volatile int32_t* addr, android_memory_order_t order)
+{
+    return android_atomic_add_explicit(1, addr, order);
+}
+
+ANDROID_ATOMIC_EXPLICIT_INLINE int32_t
+android_atomic_dec_explicit(volatile int32_t* addr, android_memory_order_t order)
+{
+    return android_atomic_add_explicit(-1, addr, order);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* ANDROID_CUTILS_ATOMIC_EXPLICIT_H */
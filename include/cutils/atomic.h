@@ -56,6 +56,9 @@ extern "C" {
  *
  * NOTE: all int32_t* values are expected to be aligned on 32-bit boundaries.
  * If they are not, atomicity is not guaranteed.
+ *
+ * <cutils/atomic-explicit.h> has operations that only provide the ordering
+ * asked for, including none, and operations on 64-bit values.
  */
 
 /*
@@ -95,7 +95,8 @@ size_t hashmapSize(Hashmap* map);
 
 /**
  * Invokes the given callback on each entry in the map. Stops iterating if
- * the callback returns false.
+ * the callback returns false. The callback may remove entries from the map,
+ * but must not add any.
  */
 void hashmapForEach(Hashmap* map, 
         bool (*callback)(void* key, void* value, void* context),
@@ -27,6 +27,15 @@ void klog_close(void);
 void klog_write(int level, const char *fmt, ...)
     __attribute__ ((format(printf, 2, 3)));
 
+/* In buffered mode, messages less urgent than errors are held and written
+ * out in batches, one write per run of messages of the same level, once
+ * the oldest is 100ms old or an error is logged.  klog_flush() writes them
+ * out at once; callers should use it before they sleep.  It also runs at
+ * exit and when buffering is turned off.
+ */
+void klog_set_buffered(int buffered);
+void klog_flush(void);
+
 __END_DECLS
 
 #define KLOG_ERROR(tag,x...)   klog_write(3, "<3>" tag ": " x)
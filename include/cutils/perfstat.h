@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CUTILS_PERFSTAT_H
+#define __CUTILS_PERFSTAT_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include <cutils/atomic-explicit.h>
+
+__BEGIN_DECLS
+
+/*
+ * Named performance counters and histograms that a daemon keeps in shared
+ * memory, for "toolbox perfstat" to read while it runs.
+ *
+ * Each process that calls perfstat_init(name) gets a file of its own,
+ * PERFSTAT_DIR "/" name, on tmpfs, which it maps shared; like the property
+ * area, it has a single writer and any number of lock-free readers.  The
+ * file is a header slot followed by entries of one or more 64-byte slots.
+ * An entry is filled in first and then published by a release store of
+ * the area's slot count, so readers that load the count with acquire
+ * semantics only ever see complete entries.  Entries are never removed.
+ *
+ * Values are updated with relaxed atomic adds, so updates are cheap and
+ * safe from any thread, but a reader might see a histogram's sample
+ * count and its buckets out of step by a sample or two.
+ *
+ * The perfstat_* lookups return NULL until perfstat_init() succeeds, or
+ * once the area is full, and perfstat_add() and perfstat_record() do
+ * nothing with NULL, so callers need not check.  Look a stat up once and
+ * keep the pointer; the lookup takes a lock and compares names.
+ */
+
+#define PERFSTAT_DIR            "/dev/perfstat"
+#define PERFSTAT_AREA_SIZE      (64 * 1024)
+
+/* "PERF" */
+#define PERFSTAT_MAGIC          0x46524550
+#define PERFSTAT_VERSION        1
+
+#define PERFSTAT_NAME_MAX       40
+
+#define PERFSTAT_COUNTER        1
+#define PERFSTAT_HISTOGRAM      2
+
+/*
+ * Histogram bucket 0 counts samples of 0, bucket i samples from 2^(i-1)
+ * to 2^i - 1, and the last one everything from 2^30 up.
+ */
+#define PERFSTAT_BUCKETS        32
+
+struct perfstat_area {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;                 /* slots in the file, this one included */
+    volatile int32_t used;          /* slots published, this one included */
+    int32_t pid;                    /* of the writer */
+    char name[PERFSTAT_NAME_MAX + 4];
+};
+
+struct perfstat {
+    char name[PERFSTAT_NAME_MAX];
+    uint32_t type;
+    uint32_t slots;                 /* this one and the ones after it */
+    volatile int64_t value;         /* the counter, or the sample count */
+    volatile int64_t sum;           /* of the histogram's samples */
+    /* followed, for a histogram, by PERFSTAT_BUCKETS int64_t buckets */
+};
+
+#define PERFSTAT_SLOT_SIZE      64
+#define PERFSTAT_HISTOGRAM_SLOTS \
+    (1 + PERFSTAT_BUCKETS * 8 / PERFSTAT_SLOT_SIZE)
+
+/*
+ * Creates the calling process's area, replacing any left by an earlier
+ * process of that name.  Returns 0, or -1 with errno set.  Calling it
+ * again does nothing.
+ */
+int perfstat_init(const char *name);
+
+/*
+ * Return the counter or histogram of that name, adding it if need be.
+ */
+struct perfstat *perfstat_counter(const char *name);
+struct perfstat *perfstat_histogram(const char *name);
+
+static inline volatile int64_t *perfstat_buckets(const struct perfstat *stat)
+{
+    return (volatile int64_t *) (stat + 1);
+}
+
+static inline void perfstat_add(struct perfstat *stat, int64_t n)
+{
+    if (stat)
+        android_atomic64_add_explicit(n, &stat->value,
+                ANDROID_MEMORY_ORDER_RELAXED);
+}
+
+static inline int perfstat_bucket(uint64_t value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    return bucket < PERFSTAT_BUCKETS ? bucket : PERFSTAT_BUCKETS - 1;
+}
+
+/* Adds value to the histogram; in whatever unit its name says. */
+static inline void perfstat_record(struct perfstat *stat, uint64_t value)
+{
+    if (stat) {
+        android_atomic64_add_explicit(1, &stat->value,
+                ANDROID_MEMORY_ORDER_RELAXED);
+        android_atomic64_add_explicit((int64_t) value, &stat->sum,
+                ANDROID_MEMORY_ORDER_RELAXED);
+        android_atomic64_add_explicit(1,
+                &perfstat_buckets(stat)[perfstat_bucket(value)],
+                ANDROID_MEMORY_ORDER_RELAXED);
+    }
+}
+
+__END_DECLS
+
+#endif /* __CUTILS_PERFSTAT_H */
@@ -47,9 +47,60 @@ int property_get(const char *key, char *value, const char *default_value);
 /* property_set: returns 0 on success, < 0 on failure
 */
 int property_set(const char *key, const char *value);
+
+/* property_set_batch: set count properties in one trip to the property
+** service.  Each entry is checked and applied exactly as property_set()
+** would; entries the caller may not set are skipped by the service.
+** Returns 0 once the service has applied the batch, -1 if it could not
+** be delivered.  At most PROPERTY_BATCH_MAX entries are accepted.
+*/
+int property_set_batch(const char * const *keys, const char * const *values,
+        size_t count);
+
+/* prop_msg command used by property_set_batch(); every entry of a batch
+** is a prop_msg carrying this command, sent back to back on one socket.
+*/
+#define PROPERTY_MSG_SETPROP_BATCH  0x100
+#define PROPERTY_BATCH_MAX          128
     
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);    
 
+/* property_wait: block until the property named key differs from the
+** version identified by *serial (pass 0 the first time), including the
+** property being created.  On return *serial identifies the version
+** read into value, and the value length is returned.  Sleeps on the
+** property area's change futex rather than polling.
+*/
+int property_wait(const char *key, unsigned *serial, char *value);
+
+/* A property_watcher reports changes to every property whose name starts
+** with a given prefix ("" matches all).  property_watcher_wait() blocks
+** until at least one of them has changed since the previous call, or
+** since the watcher was created, calls propfn for each one, and returns
+** how many were reported.
+*/
+typedef struct property_watcher property_watcher;
+
+property_watcher *property_watcher_create(const char *prefix);
+int property_watcher_wait(property_watcher *watcher,
+        void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);
+void property_watcher_destroy(property_watcher *watcher);
+
+/* A property_handle caches one property for a caller that reads it often,
+** e.g. once a frame.  property_handle_get() returns the value (or the
+** default given at creation, if the property is unset or empty) from a
+** buffer owned by the handle, valid until the next call on it.  The
+** property is only looked up again while it does not exist, and only
+** copied again when its serial has changed; *changed (if nonnull) tells
+** whether the value differs from the previous call.  A handle must not be
+** used from several threads at once.
+*/
+typedef struct property_handle property_handle_t;
+
+property_handle_t *property_handle_create(const char *key, const char *default_value);
+const char *property_handle_get(property_handle_t *handle, int *changed);
+void property_handle_destroy(property_handle_t *handle);
+
 #if defined(__BIONIC_FORTIFY)
 
 extern int __property_get_real(const char *, char *, const char *)
@@ -35,6 +35,15 @@ extern int qtaguid_tagSocket(int sockfd, int tag, uid_t uid);
 */
 extern int qtaguid_untagSocket(int sockfd);
 
+/*
+ * Like qtaguid_tagSocket() and qtaguid_untagSocket(), for count sockets at
+ * once, with a fraction of the syscalls.
+ * Returns the number of sockets done before the first that failed, like a
+ * short write(2), or -errno if the first one failed.
+ */
+extern int qtaguid_tagSockets(const int *sockfds, int count, int tag, uid_t uid);
+extern int qtaguid_untagSockets(const int *sockfds, int count);
+
 /*
  * For the given uid, switch counter sets.
  * The kernel only keeps a limited number of sets.
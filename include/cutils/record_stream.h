@@ -21,6 +21,8 @@
 #ifndef _CUTILS_RECORD_STREAM_H
 #define _CUTILS_RECORD_STREAM_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,6 +36,9 @@ extern void record_stream_free(RecordStream *p_rs);
 extern int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord, 
                                     size_t *p_outRecordLen);
 
+extern int record_stream_get_batch (RecordStream *p_rs, void **p_outRecords,
+                                    size_t *p_outRecordLens, size_t maxRecords);
+
 #ifdef __cplusplus
 }
 #endif
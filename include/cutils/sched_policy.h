@@ -17,6 +17,8 @@
 #ifndef __CUTILS_SCHED_POLICY_H
 #define __CUTILS_SCHED_POLICY_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,6 +44,21 @@ typedef enum {
  */
 extern int set_sched_policy(int tid, SchedPolicy policy);
 
+/* Assign each of the count threads in tids to the cgroup associated with
+ * the specified policy, as set_sched_policy() would, without repeating the
+ * per-call setup.  Threads which have exited are skipped.
+ * Return value: 0 for success, or -errno for the last error.
+ */
+extern int set_sched_policy_tids(const int *tids, size_t count, SchedPolicy policy);
+
+/* Assign every thread of process pid to the cgroup associated with the
+ * specified policy.  Where the kernel supports cgroup.procs this is a single
+ * write; otherwise the threads in /proc/<pid>/task are moved one by one.
+ * Zero pid means the current process.
+ * Return value: 0 for success, or -errno for error.
+ */
+extern int set_process_sched_policy(int pid, SchedPolicy policy);
+
 /* Return the policy associated with the cgroup of thread tid via policy pointer.
  * On platforms which support gettid(), zero tid means current thread.
  * Return value: 0 for success, or -1 for error and set errno.
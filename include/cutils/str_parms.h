@@ -17,6 +17,7 @@
 #ifndef __CUTILS_STR_PARMS_H
 #define __CUTILS_STR_PARMS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct str_parms;
@@ -43,6 +44,32 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
 
 char *str_parms_to_str(struct str_parms *str_parms);
 
+/*
+ * A key/value pair within a "key1=value1;key2=value2" string.  Neither the
+ * key nor the value is null-terminated.
+ */
+struct str_parms_view {
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+};
+
+/*
+ * Parses the string in place, the way str_parms_create_str() would, without
+ * allocating: stores at most max_pairs pairs, pointing into str, in pairs,
+ * and returns the number of pairs in str, which may be more.
+ */
+int str_parms_parse(const char *str, struct str_parms_view *pairs, int max_pairs);
+
+/*
+ * Returns the pair for the given key among those returned by
+ * str_parms_parse(), or NULL.  As with str_parms_create_str(), a key that
+ * appears more than once has its last value.
+ */
+const struct str_parms_view *str_parms_find(const struct str_parms_view *pairs,
+                                            int count, const char *key);
+
 /* debug */
 void str_parms_dump(struct str_parms *str_parms);
 
@@ -136,6 +136,19 @@ extern uint64_t atrace_enabled_tags;
  */
 extern int atrace_marker_fd;
 
+/**
+ * Write the trace events to the trace buffer.  They should not be called
+ * directly, as they do not check whether the tag is enabled; use the
+ * atrace_* functions below instead.  They are out of line, to keep the
+ * formatting out of the code of every caller.
+ */
+void atrace_begin_body(const char* name);
+void atrace_end_body();
+void atrace_async_begin_body(const char* name, int32_t cookie);
+void atrace_async_end_body(const char* name, int32_t cookie);
+void atrace_int_body(const char* name, int32_t value);
+void atrace_int64_body(const char* name, int64_t value);
+
 /**
  * atrace_init readies the process for tracing by opening the trace_marker file.
  * Calling any trace function causes this to be run, so calling it is optional.
@@ -180,11 +193,7 @@ static inline uint64_t atrace_is_tag_enabled(uint64_t tag)
 static inline void atrace_begin(uint64_t tag, const char* name)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char buf[ATRACE_MESSAGE_LENGTH];
-        size_t len;
-
-        len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "B|%d|%s", getpid(), name);
-        write(atrace_marker_fd, buf, len);
+        atrace_begin_body(name);
     }
 }
 
@@ -196,8 +205,7 @@ static inline void atrace_begin(uint64_t tag, const char* name)
 static inline void atrace_end(uint64_t tag)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char c = 'E';
-        write(atrace_marker_fd, &c, 1);
+        atrace_end_body();
     }
 }
 
@@ -214,12 +222,7 @@ static inline void atrace_async_begin(uint64_t tag, const char* name,
         int32_t cookie)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char buf[ATRACE_MESSAGE_LENGTH];
-        size_t len;
-
-        len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "S|%d|%s|%d", getpid(),
-                name, cookie);
-        write(atrace_marker_fd, buf, len);
+        atrace_async_begin_body(name, cookie);
     }
 }
 
@@ -232,12 +235,7 @@ static inline void atrace_async_end(uint64_t tag, const char* name,
         int32_t cookie)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char buf[ATRACE_MESSAGE_LENGTH];
-        size_t len;
-
-        len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "F|%d|%s|%d", getpid(),
-                name, cookie);
-        write(atrace_marker_fd, buf, len);
+        atrace_async_end_body(name, cookie);
     }
 }
 
@@ -250,12 +248,7 @@ static inline void atrace_async_end(uint64_t tag, const char* name,
 static inline void atrace_int(uint64_t tag, const char* name, int32_t value)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char buf[ATRACE_MESSAGE_LENGTH];
-        size_t len;
-
-        len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "C|%d|%s|%d",
-                getpid(), name, value);
-        write(atrace_marker_fd, buf, len);
+        atrace_int_body(name, value);
     }
 }
 
@@ -267,12 +260,7 @@ static inline void atrace_int(uint64_t tag, const char* name, int32_t value)
 static inline void atrace_int64(uint64_t tag, const char* name, int64_t value)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char buf[ATRACE_MESSAGE_LENGTH];
-        size_t len;
-
-        len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "C|%d|%s|%lld",
-                getpid(), name, value);
-        write(atrace_marker_fd, buf, len);
+        atrace_int64_body(name, value);
     }
 }
 
@@ -286,6 +274,7 @@ static inline void atrace_int64(uint64_t tag, const char* name, int64_t value)
 #define ATRACE_ASYNC_BEGIN(name, cookie)
 #define ATRACE_ASYNC_END(name, cookie)
 #define ATRACE_INT(name, value)
+#define ATRACE_INT64(name, value)
 
 #endif // not HAVE_ANDROID_OS
 
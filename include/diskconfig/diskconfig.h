@@ -94,6 +94,7 @@ struct disk_info {
     uint32_t num_lba;    /* the size of the disk in LBA units */
     struct part_info *part_lst;
     int num_parts;
+    int direct_io;       /* write the partition table with O_DIRECT */
 };
 
 struct write_list {
@@ -109,6 +110,7 @@ void free_wl(struct write_list *item);
 struct write_list *wlist_add(struct write_list **lst, struct write_list *item);
 void wlist_free(struct write_list *lst);
 int wlist_commit(int fd, struct write_list *lst, int test);
+int wlist_commit_aligned(int fd, struct write_list *lst, int sect_size, int test);
 
 struct disk_info *load_diskconfig(const char *fn, char *path_override);
 int dump_disk_config(struct disk_info *dinfo);
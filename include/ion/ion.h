@@ -38,6 +38,21 @@ int ion_map(int fd, struct ion_handle *handle, size_t length, int prot,
 int ion_share(int fd, struct ion_handle *handle, int *share_fd);
 int ion_import(int fd, int share_fd, struct ion_handle **handle);
 
+/*
+ * Pool of buffer fds, as from ion_alloc_fd(), recycled by size, alignment,
+ * heap mask and flags.  Up to max_free released buffers are kept for reuse.
+ * Mappings from ion_pool_map() are made on first use and stay valid until
+ * the buffer is dropped from the pool; callers must not munmap or close.
+ */
+struct ion_pool;
+
+struct ion_pool *ion_pool_create(int fd, size_t max_free);
+void ion_pool_destroy(struct ion_pool *pool);
+int ion_pool_alloc(struct ion_pool *pool, size_t len, size_t align,
+                   unsigned int heap_mask, unsigned int flags, int *handle_fd);
+int ion_pool_map(struct ion_pool *pool, int handle_fd, unsigned char **ptr);
+int ion_pool_release(struct ion_pool *pool, int handle_fd);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_ION_H */
@@ -23,6 +23,13 @@ extern "C" {
 
 #define EVENT_TAG_MAP_FILE  "/system/etc/event-log-tags"
 
+/*
+ * Precompiled index of a tag map file, at EVENT_TAG_MAP_FILE plus this
+ * suffix, built with "eventtagmap_compile".  android_openEventTagMap()
+ * uses it without parsing when it is up to date.
+ */
+#define EVENT_TAG_MAP_INDEX_SUFFIX  ".idx"
+
 struct EventTagMap;
 typedef struct EventTagMap EventTagMap;
 
@@ -33,6 +40,13 @@ typedef struct EventTagMap EventTagMap;
  */
 EventTagMap* android_openEventTagMap(const char* fileName);
 
+/*
+ * Write a precompiled index for a map opened from a text file.
+ *
+ * Returns 0 on success.
+ */
+int android_writeEventTagMapIndex(const EventTagMap* map, const char* indexName);
+
 /*
  * Close the map.
  */
@@ -40,6 +54,7 @@ void android_closeEventTagMap(EventTagMap* map);
 
 /*
  * Look up a tag by index.  Returns the tag string, or NULL if not found.
+ * With a precompiled index this is a hash probe.
  */
 const char* android_lookupEventTag(const EventTagMap* map, int tag);
 
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBS_LOG_EVENT_WRITER_H
+#define _LIBS_LOG_EVENT_WRITER_H
+
+#ifdef __cplusplus
+
+#include <stdint.h>
+#include <string.h>
+
+#include <log/log.h>
+#include <log/logd.h>
+
+namespace android {
+
+/*
+ * Typed writer for the binary event log.  Fields are appended with
+ * operator<<, and their type markers come from the overload chosen at
+ * compile time, so callers no longer hand-assemble EVENT_TYPE_* bytes:
+ *
+ *     EventLogWriter(TAG_GC_DONE) << heapSize << freed << "zygote";
+ *
+ * Each field is kept in the writer as its marker and value laid out as
+ * they go on the wire, and strings are referenced in place, so the record
+ * is written straight from an iovec array with no intermediate buffer.
+ * Strings must therefore outlive the write, which happens when the writer
+ * is destroyed, or earlier with write().  A single field is written as a
+ * plain value, several as an EVENT_TYPE_LIST.  Fields beyond MAX_FIELDS
+ * are dropped.
+ */
+class EventLogWriter {
+public:
+    enum { MAX_FIELDS = 16 };
+
+    explicit EventLogWriter(int32_t tag) : mTag(tag), mCount(0), mWritten(false) { }
+    ~EventLogWriter() { write(); }
+
+    EventLogWriter& operator<<(int32_t value) {
+        if (Field* f = next(EVENT_TYPE_INT)) {
+            memcpy(f->value, &value, sizeof(value));
+            f->len = 1 + sizeof(value);
+        }
+        return *this;
+    }
+
+    EventLogWriter& operator<<(int64_t value) {
+        if (Field* f = next(EVENT_TYPE_LONG)) {
+            memcpy(f->value, &value, sizeof(value));
+            f->len = 1 + sizeof(value);
+        }
+        return *this;
+    }
+
+    EventLogWriter& operator<<(const char* value) {
+        return string(value, value ? strlen(value) : 0);
+    }
+
+    EventLogWriter& string(const char* value, size_t len) {
+        if (Field* f = next(EVENT_TYPE_STRING)) {
+            int32_t n = len;
+            memcpy(f->value, &n, sizeof(n));
+            f->len = 1 + sizeof(n);
+            f->str = value;
+            f->strLen = len;
+        }
+        return *this;
+    }
+
+    /* Writes the record now; later calls, and the destructor, do nothing. */
+    int write() {
+        if (mWritten)
+            return 0;
+        mWritten = true;
+
+        struct iovec vec[2 + 2 * MAX_FIELDS];
+        size_t n = 0;
+        if (mCount != 1) {
+            mListHeader[0] = EVENT_TYPE_LIST;
+            mListHeader[1] = mCount;
+            vec[n].iov_base = mListHeader;
+            vec[n++].iov_len = sizeof(mListHeader);
+        }
+        for (unsigned i = 0; i < mCount; i++) {
+            vec[n].iov_base = &mFields[i].type;
+            vec[n++].iov_len = mFields[i].len;
+            if (mFields[i].type == EVENT_TYPE_STRING && mFields[i].strLen) {
+                vec[n].iov_base = (void*) mFields[i].str;
+                vec[n++].iov_len = mFields[i].strLen;
+            }
+        }
+        return __android_log_bwritev(mTag, vec, n);
+    }
+
+private:
+    /* the wire encoding of one field: marker, then value or string length */
+    struct Field {
+        uint8_t type;
+        uint8_t value[sizeof(int64_t)];
+        size_t len;             /* bytes of type + value that go out */
+        const char* str;
+        size_t strLen;
+    };
+
+    Field* next(uint8_t type) {
+        if (mCount == MAX_FIELDS)
+            return NULL;
+        Field* f = &mFields[mCount++];
+        f->type = type;
+        f->str = NULL;
+        f->strLen = 0;
+        return f;
+    }
+
+    EventLogWriter(const EventLogWriter&);
+    EventLogWriter& operator=(const EventLogWriter&);
+
+    int32_t mTag;
+    unsigned mCount;
+    bool mWritten;
+    uint8_t mListHeader[2];
+    Field mFields[MAX_FIELDS];
+};
+
+}; // namespace android
+
+#endif // __cplusplus
+
+#endif // _LIBS_LOG_EVENT_WRITER_H
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBS_LOG_FAKE_LOG_DEVICE_H
+#define _LIBS_LOG_FAKE_LOG_DEVICE_H
+
+/*
+ * The log device used by host builds of liblog (FAKE_LOG_DEVICE).  Records
+ * are filtered by ANDROID_LOG_TAGS, formatted as ANDROID_PRINTF_LOG says
+ * and printed to stderr.
+ *
+ * With ANDROID_LOG_BUFFERED=1 each thread collects its lines in a buffer of
+ * its own and writes them out when it is full, when the thread exits, at
+ * exit() and on fakeLogFlush().  Errors flush their thread's buffer right
+ * away and asserts flush every thread's, so nothing that leads up to an
+ * abort() is lost; a crash can still lose buffered lines.
+ */
+
+#include <sys/types.h>
+#include <log/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int fakeLogOpen(const char *pathName, int flags);
+int fakeLogClose(int fd);
+ssize_t fakeLogWritev(int fd, const struct iovec* vector, int count);
+
+/*
+ * Returns the minimum priority ANDROID_LOG_TAGS sets for tag, or
+ * ANDROID_LOG_DEFAULT if records are passed to a real device instead.
+ * This is what __android_log_is_loggable() checks on the host.
+ */
+int fakeLogTagLevel(const char *tag);
+
+/*
+ * Writes out whatever the threads of this process have buffered.
+ */
+void fakeLogFlush(void);
+
+/*
+ * For tests that check what was logged: after fakeLogCaptureStart(),
+ * records that pass the filter are kept in memory, formatted as they
+ * would have been printed, instead of being written to stderr.
+ * fakeLogCaptureStop() ends the capture and returns the text, which the
+ * caller must free(), or NULL if out of memory.
+ */
+void fakeLogCaptureStart(void);
+char *fakeLogCaptureStop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBS_LOG_FAKE_LOG_DEVICE_H */
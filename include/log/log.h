@@ -435,7 +435,8 @@ extern "C" {
  */
 #ifndef LOG_PRI
 #define LOG_PRI(priority, tag, ...) \
-    android_printLog(priority, tag, __VA_ARGS__)
+    (android_testLog(priority, tag) ? \
+        android_printLog(priority, tag, __VA_ARGS__) : 0)
 #endif
 
 /*
@@ -443,7 +444,8 @@ extern "C" {
  */
 #ifndef LOG_PRI_VA
 #define LOG_PRI_VA(priority, tag, fmt, args) \
-    android_vprintLog(priority, NULL, tag, fmt, args)
+    (android_testLog(priority, tag) ? \
+        android_vprintLog(priority, NULL, tag, fmt, args) : 0)
 #endif
 
 /*
@@ -531,8 +533,10 @@ typedef enum {
 #define android_btWriteLog(tag, type, payload, len) \
     __android_log_btwrite(tag, type, payload, len)
 
+#define android_testLog(prio, tag) \
+    __android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE)
+
 // TODO: remove these prototypes and their users
-#define android_testLog(prio, tag) (1)
 #define android_writevLog(vec,num) do{}while(0)
 #define android_write1Log(str,len) do{}while (0)
 #define android_setMinPriority(tag, prio) do{}while(0)
@@ -555,6 +559,16 @@ typedef enum {
 int __android_log_buf_write(int bufID, int prio, const char *tag, const char *text);
 int __android_log_buf_print(int bufID, int prio, const char *tag, const char *fmt, ...);
 
+/*
+ * Returns nonzero if a message of priority prio for tag would be logged.
+ * The level set by the "log.tag.<tag>" property (V, D, I, W, E, F or S)
+ * applies when present, default_prio otherwise; host builds take the
+ * levels from ANDROID_LOG_TAGS.  Levels are cached per tag, so the check
+ * is cheap enough to make before formatting anything; ALOG and friends
+ * do so.
+ */
+int __android_log_is_loggable(int prio, const char *tag, int default_prio);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOG_LOGCAT_STREAM_H
+#define _LOG_LOGCAT_STREAM_H
+
+#include <stdint.h>
+#include <log/logger.h>
+
+/*
+ * Layout of the framed binary stream written by "logcat -F".
+ *
+ * The stream starts with a logcat_stream_header, followed by one
+ * { uint8_t length; char name[length]; } record per log buffer, in the
+ * order the buffers were given with -b. The rest of the stream is a
+ * sequence of frames, each one a logcat_stream_frame followed by
+ * 'size' bytes holding 'count' records of the form
+ *
+ *     uint8_t             buffer;     index into the buffer names
+ *     struct logger_entry entry;      as returned by the driver
+ *     char                payload[entry.len];
+ *
+ * Records are only filtered, never reformatted, so a decoder can hand
+ * them to android_log_processLogBuffer() and friends as they are. All
+ * fields are in the byte order of the device; the stream is never
+ * split in the middle of a frame, including across rotated files,
+ * each of which starts with its own header.
+ */
+
+#define LOGCAT_STREAM_MAGIC     "LCS1"
+#define LOGCAT_STREAM_VERSION   1
+
+struct logcat_stream_header {
+    char        magic[4];       /* LOGCAT_STREAM_MAGIC */
+    uint16_t    version;        /* LOGCAT_STREAM_VERSION */
+    uint16_t    buffer_count;   /* number of buffer names that follow */
+};
+
+struct logcat_stream_frame {
+    uint32_t    size;           /* bytes of records in this frame */
+    uint32_t    count;          /* number of records in this frame */
+};
+
+#endif /* _LOG_LOGCAT_STREAM_H */
@@ -42,6 +42,14 @@ int __android_log_bwrite(int32_t tag, const void *payload, size_t len);
 int __android_log_btwrite(int32_t tag, char type, const void *payload,
     size_t len);
 
+/*
+ * Like __android_log_bwrite, but the payload is gathered from count
+ * iovecs (at most LOG_BWRITEV_MAX) so it never has to be assembled in a
+ * separate buffer.  See <log/event_writer.h>.
+ */
+#define LOG_BWRITEV_MAX 64
+int __android_log_bwritev(int32_t tag, const struct iovec *vec, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -147,6 +147,70 @@ int android_log_printLogLine(
     int fd,
     const AndroidLogEntry *entry);
 
+/**
+ * Formats a log message into buf without allocating.  buf is only written
+ * if the whole line and a terminating NUL fit in size bytes.
+ *
+ * Returns the length of the formatted line, not counting the NUL, so a
+ * return value >= size means the line did not fit.
+ */
+size_t android_log_formatLogLineInto(
+    AndroidLogFormat *p_format,
+    char *buf,
+    size_t size,
+    const AndroidLogEntry *entry);
+
+/**
+ * Output buffer that many formatted lines are collected in, so they reach
+ * fd in few large writes.  Not thread-safe.
+ */
+#define LOG_WRITE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * Alternative sink for the buffered data, must consume all of it.
+ * Returns 0, or -1 on error.
+ */
+typedef int (*AndroidLogWriteFunc)(void *cookie, const char *data, size_t len);
+
+typedef struct AndroidLogWriteBuffer_t {
+    int fd;
+    AndroidLogWriteFunc write;
+    void *cookie;
+    size_t len;
+    char data[LOG_WRITE_BUFFER_SIZE];
+} AndroidLogWriteBuffer;
+
+void android_log_initWriteBuffer(AndroidLogWriteBuffer *out, int fd);
+
+/**
+ * Like android_log_initWriteBuffer, but the buffer is handed to
+ * write(cookie, ...) instead of written to a file descriptor.
+ */
+void android_log_initWriteBufferFunc(AndroidLogWriteBuffer *out,
+        AndroidLogWriteFunc write, void *cookie);
+
+/**
+ * Formats a log message into out, writing out what is buffered first if
+ * it does not fit.
+ *
+ * Returns the number of bytes added, or -1 on write error.
+ */
+int android_log_bufferLogLine(
+    AndroidLogFormat *p_format,
+    AndroidLogWriteBuffer *out,
+    const AndroidLogEntry *entry);
+
+/**
+ * Adds raw bytes to out.  Returns len, or -1 on write error.
+ */
+int android_log_writeToBuffer(AndroidLogWriteBuffer *out,
+        const void *data, size_t len);
+
+/**
+ * Writes out everything buffered.  Returns 0, or -1 on write error.
+ */
+int android_log_flushWriteBuffer(AndroidLogWriteBuffer *out);
+
 
 #ifdef __cplusplus
 }
@@ -140,6 +140,37 @@ ssize_t memtrack_proc_other_total(struct memtrack_proc *p);
  */
 ssize_t memtrack_proc_other_pss(struct memtrack_proc *p);
 
+/**
+ * struct memtrack_proc_totals
+ *
+ * The sums returned by the memtrack_proc_*_total and memtrack_proc_*_pss
+ * calls above for one process, filled in by memtrack_proc_get_totals.
+ * error is 0 if the sums are valid, -errno otherwise.
+ */
+struct memtrack_proc_totals {
+    pid_t pid;
+    int error;
+    ssize_t graphics_total;
+    ssize_t graphics_pss;
+    ssize_t gl_total;
+    ssize_t gl_pss;
+    ssize_t other_total;
+    ssize_t other_pss;
+};
+
+/**
+ * memtrack_proc_get_totals
+ *
+ * Fill totals[i] with the memory stats of pids[i] for each of num_pids
+ * processes, using p as scratch space.  Once p has been used for the
+ * largest process, repeated calls do not allocate, so the same handle and
+ * totals array can be kept for periodic sampling.
+ *
+ * Returns the number of processes whose totals are valid, -errno on error.
+ */
+int memtrack_proc_get_totals(struct memtrack_proc *p, const pid_t *pids,
+        size_t num_pids, struct memtrack_proc_totals *totals);
+
 #ifdef __cplusplus
 }
 #endif
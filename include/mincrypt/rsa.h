@@ -51,6 +51,12 @@ int RSA_verify(const RSAPublicKey *key,
                const uint8_t* hash,
                const int hash_len);
 
+int RSA_encrypt(const RSAPublicKey *key,
+                const uint8_t *msg,
+                const int len,
+                const uint8_t *pad,
+                uint8_t *out);
+
 #ifdef __cplusplus
 }
 #endif
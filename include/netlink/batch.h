@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* NOTICE: This is a clean room re-implementation of libnl */
+
+#ifndef NETLINK_BATCH_H_
+#define NETLINK_BATCH_H_
+
+/*
+ * libnl_2 extensions that libnl 2.0 does not have, so the libnl headers
+ * in external/libnl-headers do not declare them.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct nl_sock;
+struct nl_msg;
+
+/* Most messages nl_send_batch() takes at once */
+#define NL_BATCH_MAX (64)
+
+/* Completes count messages as nl_send_auto_complete() would and sends
+ * them all with one sendmsg(). Returns what sendmsg() does. */
+extern int nl_send_batch(struct nl_sock *sk, struct nl_msg **msgs, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETLINK_BATCH_H_ */
@@ -69,6 +69,30 @@ extern int ifc_configure(const char *ifname, in_addr_t address,
                          uint32_t prefixLength, in_addr_t gateway,
                          in_addr_t dns1, in_addr_t dns2);
 
+/*
+ * Link, address and route changes to one interface, sent to the kernel
+ * together over rtnetlink and applied in order. The queueing functions
+ * return 0 or a negative errno, which ifc_batch_commit() returns again
+ * without sending anything, so the caller can check only the commit.
+ * The commit frees the batch, and returns the first error the kernel
+ * reported; it doesn't undo the changes that did go through.
+ */
+typedef struct ifc_batch ifc_batch;
+
+extern ifc_batch *ifc_batch_begin(const char *name);
+extern int ifc_batch_up(ifc_batch *b);
+extern int ifc_batch_down(ifc_batch *b);
+extern int ifc_batch_add_address(ifc_batch *b, const char *address,
+                                 int prefixlen);
+extern int ifc_batch_del_address(ifc_batch *b, const char *address,
+                                 int prefixlen);
+extern int ifc_batch_add_route(ifc_batch *b, const char *dst,
+                               int prefix_length, const char *gw);
+extern int ifc_batch_remove_route(ifc_batch *b, const char *dst,
+                                  int prefix_length, const char *gw);
+extern int ifc_batch_commit(ifc_batch *b);
+extern void ifc_batch_abort(ifc_batch *b);
+
 extern in_addr_t prefixLengthToIpv4Netmask(int prefix_length);
 
 __END_DECLS
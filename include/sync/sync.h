@@ -20,6 +20,7 @@
 #define __SYS_CORE_SYNC_H
 
 #include <sys/cdefs.h>
+#include <stddef.h>
 #include <stdint.h>
 
 __BEGIN_DECLS
@@ -49,6 +50,38 @@ struct sync_pt_info *sync_pt_info(struct sync_fence_info_data *info,
                                   struct sync_pt_info *itr);
 void sync_fence_info_free(struct sync_fence_info_data *info);
 
+/* Fill a caller supplied buffer of len bytes rather than allocating one */
+int sync_fence_info_buf(int fd, struct sync_fence_info_data *info, size_t len);
+
+/* 1 if signaled, 0 if still active, -1 on error; never blocks */
+int sync_fence_status(int fd);
+
+/*
+ * Wait on up to 64 fences at once, timeout in msecs.  sync_wait_any returns
+ * the index of a fence that has signaled; sync_wait_all returns 0 once all
+ * have.  Both return -1 with errno ETIME on timeout.
+ */
+int sync_wait_any(const int *fds, int count, int timeout);
+int sync_wait_all(const int *fds, int count, int timeout);
+
+/*
+ * Call back as fences signal.  The waiter's fd can be polled, or added to
+ * the caller's own epoll set, to learn when sync_waiter_dispatch has work.
+ * Each callback runs once, from sync_waiter_dispatch, with status 1 or -1
+ * for a fence that has signaled or errored.
+ */
+typedef void (*sync_callback_t)(int status, void *data);
+
+struct sync_waiter;
+
+struct sync_waiter *sync_waiter_create(void);
+void sync_waiter_destroy(struct sync_waiter *waiter);
+int sync_waiter_get_fd(struct sync_waiter *waiter);
+int sync_waiter_add(struct sync_waiter *waiter, int fd,
+                    sync_callback_t callback, void *data);
+/* returns the number of callbacks run, or -1 on error */
+int sync_waiter_dispatch(struct sync_waiter *waiter, int timeout);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_SYNC_H */
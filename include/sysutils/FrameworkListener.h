@@ -16,6 +16,8 @@
 #ifndef _FRAMEWORKSOCKETLISTENER_H
 #define _FRAMEWORKSOCKETLISTENER_H
 
+#include <cutils/hashmap.h>
+
 #include "SocketListener.h"
 #include "FrameworkCommand.h"
 
@@ -32,11 +34,14 @@ private:
     int mCommandCount;
     bool mWithSeq;
     FrameworkCommandCollection *mCommands;
+    /* Commands by name, and the unfinished command of each client */
+    Hashmap *mCommandMap;
+    Hashmap *mPartials;
 
 public:
     FrameworkListener(const char *socketName);
     FrameworkListener(const char *socketName, bool withSeq);
-    virtual ~FrameworkListener() {}
+    virtual ~FrameworkListener();
 
 protected:
     void registerCmd(FrameworkCommand *cmd);
@@ -44,6 +49,8 @@ protected:
 
 private:
     void dispatchCommand(SocketClient *c, char *data);
+    void savePartial(SocketClient *c, const char *data, size_t len);
+    void dropPartial(SocketClient *c);
     void init(const char *socketName, bool withSeq);
 };
 #endif
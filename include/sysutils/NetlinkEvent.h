@@ -26,6 +26,8 @@ class NetlinkEvent {
     int  mAction;
     char *mSubsystem;
     char *mParams[NL_PARAMS_MAX];
+    /* Path, subsystem and params point into the decoded buffer */
+    bool mBorrowed;
 
 public:
     const static int NlActionUnknown;
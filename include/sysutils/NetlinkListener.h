@@ -20,6 +20,9 @@
 
 class NetlinkEvent;
 
+/* Number of messages picked up per wakeup */
+#define NL_BATCH_SIZE 8
+
 class NetlinkListener : public SocketListener {
     char mBuffer[64 * 1024];
     int mFormat;
@@ -43,6 +46,10 @@ public:
 protected:
     virtual bool onDataAvailable(SocketClient *cli);
     virtual void onEvent(NetlinkEvent *evt) = 0;
+
+private:
+    int receiveBatch(int socket);
+    void dispatch(char *buffer, ssize_t length);
 };
 
 #endif
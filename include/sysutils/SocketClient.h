@@ -7,6 +7,9 @@
 #include <cutils/atomic.h>
 #include <sys/types.h>
 
+struct iovec;
+class SocketListener;
+
 class SocketClient {
     int             mSocket;
     bool            mSocketOwned;
@@ -29,6 +32,22 @@ class SocketClient {
 
     bool mUseCmdNum;
 
+    /* Messages collected by addReply() and not yet sent */
+    char *mReply;
+    size_t mReplyLen;
+    size_t mReplyCap;
+
+    /* Queued mode: bytes the socket would not take yet, and the limit on them */
+    bool mAsync;
+    size_t mMaxQueued;
+    char *mQueue;
+    size_t mQueueLen;
+    size_t mQueueCap;
+
+    /* The listener watching us, and whether it is waiting for us to be ready */
+    SocketListener *mListener;
+    bool mArmed;
+
 public:
     SocketClient(int sock, bool owned);
     SocketClient(int sock, bool owned, bool useCmdNum);
@@ -57,6 +76,22 @@ public:
     // Sending binary data:
     int sendData(const void *data, int len);
 
+    // Batched replies: messages passed to addReply() are formatted as
+    // sendMsg() would and held back until sendReply() writes them all out
+    // at once.  Meant for multi-line responses built by the thread handling
+    // the client's command.
+    int addReply(int code, const char *msg, bool addErrno);
+    int sendReply();
+
+    // Queued mode.  With maxQueued > 0, sends never block: whatever the
+    // socket will not take right away is queued and sent as it drains, in
+    // order.  Once more than maxQueued bytes are queued further sends fail
+    // with EAGAIN, and the caller decides whether to drop or retry.
+    // SocketListener flushes the queue when the socket becomes writable.
+    void setQueued(size_t maxQueued);
+    bool hasQueued();
+    int flushQueued();
+
     // Optional reference counting.  Reference count starts at 1.  If
     // it's decremented to 0, it deletes itself.
     // SocketListener creates a SocketClient (at refcount 1) and calls
@@ -68,6 +103,8 @@ public:
     static char *quoteArg(const char *arg);
 
 private:
+    friend class SocketListener;
+
     // Send null-terminated C strings
     int sendMsg(const char *msg);
     void init(int socket, bool owned, bool useCmdNum);
@@ -77,6 +114,10 @@ private:
     // returns 0 if successful, -1 if there is a 0 byte write and -2 if any other
     // error occurred (use errno to get the error)
     int sendDataLocked(const void *data, int len);
+    int sendvLocked(struct iovec *iov, int iovcnt);
+    int queueLocked(const struct iovec *iov, int iovcnt);
+    int flushQueuedLocked();
+    int appendReply(const char *fmt, ...);
 };
 
 typedef android::sysutils::List<SocketClient *> SocketClientCollection;
@@ -29,6 +29,18 @@ class SocketListener {
     int                     mCtrlPipe[2];
     pthread_t               mThread;
     bool                    mUseCmdNum;
+    int                     mEpollFd;
+
+    /* Worker threads, and the clients waiting for one */
+    int                     mWorkerCount;
+    pthread_t               *mWorkers;
+    SocketClientCollection  *mPending;
+    pthread_mutex_t         mPendingLock;
+    pthread_cond_t          mPendingCond;
+    bool                    mWorkersExiting;
+
+    /* Set while a wakeup is sitting in the control pipe */
+    volatile int32_t        mWakePending;
 
 public:
     SocketListener(const char *socketName, bool listen);
@@ -41,12 +53,32 @@ public:
 
     void sendBroadcast(int code, const char *msg, bool addErrno);
 
+    /*
+     * Hands clients with data over to a pool of count threads, instead of
+     * calling onDataAvailable() on the listener thread, so that a slow
+     * client does not hold up the others.  A client is only ever handled by
+     * one thread at a time, so its requests are still handled in order, but
+     * onDataAvailable() must cope with different clients concurrently.
+     * Must be called before startListener().
+     */
+    void setWorkerCount(int count);
+
 protected:
     virtual bool onDataAvailable(SocketClient *c) = 0;
 
 private:
+    friend class SocketClient;
+
     static void *threadStart(void *obj);
+    static void *workerStart(void *obj);
     void runListener();
+    void runWorker();
+    int watchClient(SocketClient *c, int op);
+    void handleClient(SocketClient *c);
+    void addClient(SocketClient *c);
+    void wakeup();
+    void watchQueued();
+    void stopWorkers();
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
 #endif
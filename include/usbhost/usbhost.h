@@ -142,6 +142,7 @@ const struct usb_device_descriptor* usb_device_get_device_descriptor(struct usb_
 /* Returns a USB descriptor string for the given string ID.
  * Used to implement usb_device_get_manufacturer_name,
  * usb_device_get_product_name and usb_device_get_serial.
+ * Strings are read from the device once and cached until it is closed.
  * Call free() to free the result when you are done with it.
  */
 char* usb_device_get_string(struct usb_device *device, int id);
@@ -226,6 +227,50 @@ struct usb_request *usb_request_wait(struct usb_device *dev);
 /* Cancels a pending usb_request_queue() operation. */
 int usb_request_cancel(struct usb_request *req);
 
+/* A usb_stream keeps several requests on one endpoint in flight at once,
+ * each with its own buffer of buffer_size bytes allocated up front.  Where
+ * the kernel allows it the buffers are mapped from usbfs to avoid copying,
+ * and buffers larger than 16K are passed down whole.
+ *
+ * For IN endpoints, usb_stream_start() queues every request; completed ones
+ * come back from usb_stream_reap() and go out again with usb_stream_queue()
+ * once their data has been consumed.  For OUT endpoints, take a request with
+ * usb_stream_get_idle(), fill its buffer, set buffer_length and queue it;
+ * reaped requests are handed back with usb_stream_release().
+ *
+ * Completions are reaped for the whole device, so requests queued outside
+ * the stream on the same device may be returned too.
+ */
+struct usb_stream;
+
+struct usb_stream *usb_stream_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc,
+        int num_requests, int buffer_size);
+
+/* Releases the stream and its requests; none may still be queued. */
+void usb_stream_free(struct usb_stream *stream);
+
+/* Queues every idle request, for IN endpoints. */
+int usb_stream_start(struct usb_stream *stream);
+
+/* Returns a request that is not queued, or NULL if all are in flight. */
+struct usb_request *usb_stream_get_idle(struct usb_stream *stream);
+
+/* Queues req again; on failure it is returned to the idle requests. */
+int usb_stream_queue(struct usb_stream *stream, struct usb_request *req);
+
+/* Returns a reaped request to the idle requests without queueing it. */
+void usb_stream_release(struct usb_stream *stream, struct usb_request *req);
+
+/* Stores up to max completed requests in reqs, waiting for the first
+ * unless nowait is set, and returns how many, or -1 for error.
+ */
+int usb_stream_reap(struct usb_stream *stream, struct usb_request **reqs,
+        int max, int nowait);
+
+/* Cancels every request of the stream that is still queued. */
+void usb_stream_cancel(struct usb_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
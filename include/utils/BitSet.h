@@ -119,6 +119,259 @@ struct BitSet32 {
 
 ANDROID_BASIC_TYPES_TRAITS(BitSet32)
 
+// A simple set of 64 bits that can be individually marked or cleared.
+// Bit 0 is the most significant bit of the value, as in BitSet32.
+struct BitSet64 {
+    uint64_t value;
+
+    inline BitSet64() : value(0) { }
+    explicit inline BitSet64(uint64_t value) : value(value) { }
+
+    // Gets the value associated with a particular bit index.
+    static inline uint64_t valueForBit(uint32_t n) { return 0x8000000000000000ULL >> n; }
+
+    // Clears the bit set.
+    inline void clear() { value = 0; }
+
+    // Returns the number of marked bits in the set.
+    inline uint32_t count() const { return __builtin_popcountll(value); }
+
+    // Returns true if the bit set does not contain any marked bits.
+    inline bool isEmpty() const { return ! value; }
+
+    // Returns true if the bit set does not contain any unmarked bits.
+    inline bool isFull() const { return value == 0xffffffffffffffffULL; }
+
+    // Returns true if the specified bit is marked.
+    inline bool hasBit(uint32_t n) const { return value & valueForBit(n); }
+
+    // Marks the specified bit.
+    inline void markBit(uint32_t n) { value |= valueForBit(n); }
+
+    // Clears the specified bit.
+    inline void clearBit(uint32_t n) { value &= ~ valueForBit(n); }
+
+    // Finds the first marked bit in the set.
+    // Result is undefined if all bits are unmarked.
+    inline uint32_t firstMarkedBit() const { return __builtin_clzll(value); }
+
+    // Finds the first unmarked bit in the set.
+    // Result is undefined if all bits are marked.
+    inline uint32_t firstUnmarkedBit() const { return __builtin_clzll(~ value); }
+
+    // Finds the last marked bit in the set.
+    // Result is undefined if all bits are unmarked.
+    inline uint32_t lastMarkedBit() const { return 63 - __builtin_ctzll(value); }
+
+    // Finds the first marked bit in the set and clears it.  Returns the bit index.
+    // Result is undefined if all bits are unmarked.
+    inline uint32_t clearFirstMarkedBit() {
+        uint32_t n = firstMarkedBit();
+        clearBit(n);
+        return n;
+    }
+
+    // Finds the first unmarked bit in the set and marks it.  Returns the bit index.
+    // Result is undefined if all bits are marked.
+    inline uint32_t markFirstUnmarkedBit() {
+        uint32_t n = firstUnmarkedBit();
+        markBit(n);
+        return n;
+    }
+
+    // Finds the last marked bit in the set and clears it.  Returns the bit index.
+    // Result is undefined if all bits are unmarked.
+    inline uint32_t clearLastMarkedBit() {
+        uint32_t n = lastMarkedBit();
+        clearBit(n);
+        return n;
+    }
+
+    // Gets the index of the specified bit in the set, which is the number of
+    // marked bits that appear before the specified bit.
+    inline uint32_t getIndexOfBit(uint32_t n) const {
+        return __builtin_popcountll(value & ~(0xffffffffffffffffULL >> n));
+    }
+
+    inline bool operator== (const BitSet64& other) const { return value == other.value; }
+    inline bool operator!= (const BitSet64& other) const { return value != other.value; }
+    inline BitSet64 operator& (const BitSet64& other) const {
+        return BitSet64(value & other.value);
+    }
+    inline BitSet64& operator&= (const BitSet64& other) {
+        value &= other.value;
+        return *this;
+    }
+    inline BitSet64 operator| (const BitSet64& other) const {
+        return BitSet64(value | other.value);
+    }
+    inline BitSet64& operator|= (const BitSet64& other) {
+        value |= other.value;
+        return *this;
+    }
+};
+
+ANDROID_BASIC_TYPES_TRAITS(BitSet64)
+
+// A set of N bits, for bitmaps too wide for BitSet64 (a free block map,
+// a set of tids). The bits are numbered the same way, bit 0 being the most
+// significant bit of the first word, and are kept in a plain array of
+// 64-bit words so that the set operations are simple loops the compiler
+// can vectorize.
+//
+// The queries return N, rather than being undefined, when there is no
+// such bit. To visit the marked bits without copying the set:
+//
+//     for (uint32_t n = set.firstMarkedBit(); n < N; n = set.nextMarkedBit(n + 1)) {
+//         ...
+//     }
+template <uint32_t N>
+struct BitSetN {
+    enum { WORDS = (N + 63) / 64 };
+
+    uint64_t value[WORDS];
+
+    inline BitSetN() { clear(); }
+
+    // Gets the value associated with a particular bit index within its word.
+    static inline uint64_t valueForBit(uint32_t n) { return 0x8000000000000000ULL >> (n % 64); }
+
+    // Clears the bit set.
+    inline void clear() {
+        for (uint32_t i = 0; i < WORDS; i++) value[i] = 0;
+    }
+
+    // Returns the number of marked bits in the set.
+    inline uint32_t count() const {
+        uint32_t c = 0;
+        for (uint32_t i = 0; i < WORDS; i++) c += __builtin_popcountll(value[i]);
+        return c;
+    }
+
+    // Returns true if the bit set does not contain any marked bits.
+    inline bool isEmpty() const {
+        for (uint32_t i = 0; i < WORDS; i++) {
+            if (value[i]) return false;
+        }
+        return true;
+    }
+
+    // Returns true if the bit set does not contain any unmarked bits.
+    inline bool isFull() const { return count() == N; }
+
+    // Returns true if the specified bit is marked.
+    inline bool hasBit(uint32_t n) const { return value[n / 64] & valueForBit(n); }
+
+    // Marks the specified bit.
+    inline void markBit(uint32_t n) { value[n / 64] |= valueForBit(n); }
+
+    // Clears the specified bit.
+    inline void clearBit(uint32_t n) { value[n / 64] &= ~ valueForBit(n); }
+
+    // Finds the first marked bit at or after n, or returns N.
+    inline uint32_t nextMarkedBit(uint32_t n) const {
+        if (n >= N) return N;
+        uint32_t i = n / 64;
+        uint64_t word = value[i] & (0xffffffffffffffffULL >> (n % 64));
+        while (!word) {
+            if (++i == WORDS) return N;
+            word = value[i];
+        }
+        return i * 64 + __builtin_clzll(word);
+    }
+
+    // Finds the first unmarked bit at or after n, or returns N.
+    inline uint32_t nextUnmarkedBit(uint32_t n) const {
+        if (n >= N) return N;
+        uint32_t i = n / 64;
+        uint64_t word = ~value[i] & (0xffffffffffffffffULL >> (n % 64));
+        while (!word) {
+            if (++i == WORDS) return N;
+            word = ~value[i];
+        }
+        n = i * 64 + __builtin_clzll(word);
+        return n < N ? n : N;
+    }
+
+    // Finds the first marked bit in the set, or returns N.
+    inline uint32_t firstMarkedBit() const { return nextMarkedBit(0); }
+
+    // Finds the first unmarked bit in the set, or returns N.
+    inline uint32_t firstUnmarkedBit() const { return nextUnmarkedBit(0); }
+
+    // Finds the last marked bit in the set, or returns N.
+    inline uint32_t lastMarkedBit() const {
+        for (uint32_t i = WORDS; i-- > 0; ) {
+            if (value[i]) return i * 64 + 63 - __builtin_ctzll(value[i]);
+        }
+        return N;
+    }
+
+    // Finds the first marked bit in the set and clears it.  Returns the bit
+    // index, or N if all bits are unmarked.
+    inline uint32_t clearFirstMarkedBit() {
+        uint32_t n = firstMarkedBit();
+        if (n < N) clearBit(n);
+        return n;
+    }
+
+    // Finds the first unmarked bit in the set and marks it.  Returns the bit
+    // index, or N if all bits are marked.
+    inline uint32_t markFirstUnmarkedBit() {
+        uint32_t n = firstUnmarkedBit();
+        if (n < N) markBit(n);
+        return n;
+    }
+
+    // Finds the last marked bit in the set and clears it.  Returns the bit
+    // index, or N if all bits are unmarked.
+    inline uint32_t clearLastMarkedBit() {
+        uint32_t n = lastMarkedBit();
+        if (n < N) clearBit(n);
+        return n;
+    }
+
+    // Gets the index of the specified bit in the set, which is the number of
+    // marked bits that appear before the specified bit.
+    inline uint32_t getIndexOfBit(uint32_t n) const {
+        uint32_t c = 0;
+        for (uint32_t i = 0; i < n / 64; i++) c += __builtin_popcountll(value[i]);
+        if (n % 64) {
+            c += __builtin_popcountll(value[n / 64] & ~(0xffffffffffffffffULL >> (n % 64)));
+        }
+        return c;
+    }
+
+    inline bool operator== (const BitSetN& other) const {
+        for (uint32_t i = 0; i < WORDS; i++) {
+            if (value[i] != other.value[i]) return false;
+        }
+        return true;
+    }
+    inline bool operator!= (const BitSetN& other) const { return !(*this == other); }
+    inline BitSetN operator& (const BitSetN& other) const {
+        BitSetN result(*this);
+        return result &= other;
+    }
+    inline BitSetN& operator&= (const BitSetN& other) {
+        for (uint32_t i = 0; i < WORDS; i++) value[i] &= other.value[i];
+        return *this;
+    }
+    inline BitSetN operator| (const BitSetN& other) const {
+        BitSetN result(*this);
+        return result |= other;
+    }
+    inline BitSetN& operator|= (const BitSetN& other) {
+        for (uint32_t i = 0; i < WORDS; i++) value[i] |= other.value[i];
+        return *this;
+    }
+};
+
+template<uint32_t N> struct trait_trivial_ctor< BitSetN<N> > { enum { value = true }; };
+template<uint32_t N> struct trait_trivial_dtor< BitSetN<N> > { enum { value = true }; };
+template<uint32_t N> struct trait_trivial_copy< BitSetN<N> > { enum { value = true }; };
+template<uint32_t N> struct trait_trivial_move< BitSetN<N> > { enum { value = true }; };
+
 } // namespace android
 
 #endif // UTILS_BITSET_H
@@ -20,12 +20,14 @@
 #include <stddef.h>
 
 #include <utils/Flattenable.h>
+#include <utils/LruCache.h>
 #include <utils/RefBase.h>
-#include <utils/SortedVector.h>
 #include <utils/threads.h>
 
 namespace android {
 
+class FileMap;
+
 // A BlobCache is an in-memory cache for binary key/value pairs.  A BlobCache
 // does NOT provide any thread-safety guarantees.
 //
@@ -101,18 +103,40 @@ public:
     //
     status_t unflatten(void const* buffer, size_t size);
 
+    // unflatten replaces the contents of the cache with the serialized cache
+    // contents of a mapped file, as written by flatten.  Rather than being
+    // copied, the cache entries point into the mapping and keep a reference
+    // to it; entries replaced or evicted later on release it, and the cache
+    // never writes to it.  The file must therefore not be changed while it
+    // is mapped: write the new contents of the cache to a temporary file and
+    // rename it over the old one instead.
+    status_t unflatten(FileMap* map);
+
+    // getHitCount, getMissCount and getEvictionCount return how many calls to
+    // get found their key, how many did not, and how many entries were
+    // evicted to make room for new ones, since the BlobCache was created.
+    size_t getHitCount() const { return mHitCount; }
+    size_t getMissCount() const { return mMissCount; }
+    size_t getEvictionCount() const { return mEvictionCount; }
+
 private:
     // Copying is disallowed.
     BlobCache(const BlobCache&);
     void operator=(const BlobCache&);
 
-    // A random function helper to get around MinGW not having nrand48()
-    long int blob_random();
-
-    // clean evicts a randomly chosen set of entries from the cache such that
-    // the total size of all remaining entries is less than mMaxTotalSize/2.
+    // clean evicts the least recently used entries from the cache until the
+    // total size of all remaining entries is less than mMaxTotalSize/2.
     void clean();
 
+    // insert is set, with entries pointing into map rather than copied when
+    // map is not NULL.
+    void insert(const void* key, size_t keySize, const void* value,
+            size_t valueSize, FileMap* map);
+
+    // unflattenEntries is unflatten, with entries pointing into map when map
+    // is not NULL.
+    status_t unflattenEntries(void const* buffer, size_t size, FileMap* map);
+
     // isCleanable returns true if the cache is full enough for the clean method
     // to have some effect, and false otherwise.
     bool isCleanable() const;
@@ -121,10 +145,9 @@ private:
     class Blob : public RefBase {
     public:
         Blob(const void* data, size_t size, bool copyData);
+        Blob(const void* data, size_t size, FileMap* map);
         ~Blob();
 
-        bool operator<(const Blob& rhs) const;
-
         const void* getData() const;
         size_t getSize() const;
 
@@ -142,30 +165,37 @@ private:
         // mOwnsData indicates whether or not this Blob object should free the
         // memory pointed to by mData when the Blob gets destructed.
         bool mOwnsData;
+
+        // mMap is the mapping mData points into, if any, which this Blob
+        // object holds a reference to.
+        FileMap* mMap;
     };
 
-    // A CacheEntry is a single key/value pair in the cache.
-    class CacheEntry {
+    // A BlobKey is the key of a cache entry, along with its hash.
+    class BlobKey {
     public:
-        CacheEntry();
-        CacheEntry(const sp<Blob>& key, const sp<Blob>& value);
-        CacheEntry(const CacheEntry& ce);
+        BlobKey();
+        BlobKey(const sp<Blob>& blob);
 
-        bool operator<(const CacheEntry& rhs) const;
-        const CacheEntry& operator=(const CacheEntry&);
+        bool operator==(const BlobKey& rhs) const;
 
-        sp<Blob> getKey() const;
-        sp<Blob> getValue() const;
+        const sp<Blob>& getBlob() const { return mBlob; }
 
-        void setValue(const sp<Blob>& value);
+        // Found by the hash tables through argument-dependent lookup.
+        friend hash_t hash_type(const BlobKey& key) { return key.mHash; }
 
     private:
+        sp<Blob> mBlob;
+        hash_t mHash;
+    };
 
-        // mKey is the key that identifies the cache entry.
-        sp<Blob> mKey;
-
-        // mValue is the cached data associated with the key.
-        sp<Blob> mValue;
+    // An EntryRemoved keeps mTotalSize up to date as entries leave mCache.
+    class EntryRemoved : public OnEntryRemoved<BlobKey, sp<Blob> > {
+    public:
+        EntryRemoved(BlobCache* cache) : mCache(cache) { }
+        virtual void operator()(BlobKey& key, sp<Blob>& value);
+    private:
+        BlobCache* const mCache;
     };
 
     // A Header is the header for the entire BlobCache serialization format. No
@@ -229,13 +259,19 @@ private:
     // the cache.
     size_t mTotalSize;
 
-    // mRandState is the pseudo-random number generator state. It is passed to
-    // nrand48 to generate random numbers when needed.
-    unsigned short mRandState[3];
+    // mHitCount, mMissCount and mEvictionCount are the statistics returned by
+    // getHitCount, getMissCount and getEvictionCount.
+    size_t mHitCount;
+    size_t mMissCount;
+    size_t mEvictionCount;
+
+    // mEntryRemoved is the listener mCache calls as it removes entries.
+    EntryRemoved mEntryRemoved;
 
-    // mCacheEntries stores all the cache entries that are resident in memory.
-    // Cache entries are added to it by the 'set' method.
-    SortedVector<CacheEntry> mCacheEntries;
+    // mCache stores all the cache entries that are resident in memory, and
+    // keeps track of the order in which they were last used.  Cache entries
+    // are added to it by the 'set' method.
+    LruCache<BlobKey, sp<Blob> > mCache;
 };
 
 }
@@ -19,6 +19,7 @@
 
 #include <android/log.h>
 #include <utils/String8.h>
+#include <utils/TypeHelpers.h>
 #include <corkscrew/backtrace.h>
 
 #include <stdint.h>
@@ -68,6 +69,12 @@ public:
     // Immediately collect the stack traces for the specified thread.
     void update(int32_t ignoreDepth=1, int32_t maxDepth=MAX_DEPTH, pid_t tid=CURRENT_THREAD);
 
+    // Immediately collect the stack traces for several other threads of this process,
+    // stacks[i] getting that of tids[i].  The threads unwind their stacks at the same
+    // time, which is much quicker than calling update() for each in turn.
+    static void updateThreads(CallStack* const* stacks, const pid_t* tids, size_t count,
+            int32_t maxDepth=MAX_DEPTH);
+
     // Dump a stack trace to the log using the supplied logtag.
     void log(const char* logtag,
              android_LogPriority priority = ANDROID_LOG_DEBUG,
@@ -85,6 +92,10 @@ public:
     // Get the count of stack frames that are in this call stack.
     size_t size() const { return mCount; }
 
+    // Hash the PC addresses of the stack frames, e.g. to find identical
+    // call stacks quickly.
+    hash_t hash() const;
+
 private:
     size_t mCount;
     backtrace_frame_t mStack[MAX_DEPTH];
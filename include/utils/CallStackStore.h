@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CALLSTACK_STORE_H
+#define ANDROID_CALLSTACK_STORE_H
+
+#include <utils/BasicHashtable.h>
+#include <utils/CallStack.h>
+#include <utils/Mutex.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android {
+
+class Printer;
+
+// Collect call stacks as they are hit, e.g. at allocations or contended
+// locks, and count each distinct one.  Identical call stacks are stored once,
+// and only symbolized when the store is printed, so that recording a call
+// stack costs an unwind and a hash table lookup.  The unwinder itself caches
+// the process's memory map between captures.
+//
+// Recording can be sampled, so that it can be left enabled: only one in
+// every samplingInterval calls to record() captures the call stack.
+//
+// A CallStackStore is thread-safe.
+class CallStackStore {
+public:
+    // Create an empty store that captures one in samplingInterval calls.
+    CallStackStore(uint32_t samplingInterval = 1);
+    ~CallStackStore();
+
+    // Capture the current thread's call stack, if this call is sampled, and add
+    // it to the store.  Returns true if the call stack was captured.
+    bool record(int32_t ignoreDepth = 1, int32_t maxDepth = CallStack::MAX_DEPTH);
+
+    // Add a call stack captured by the caller.
+    void add(const CallStack& stack);
+
+    // Forget all the call stacks.
+    void clear();
+
+    // Print every distinct call stack, with the number of times it was added,
+    // to the log using the supplied logtag.
+    void log(const char* logtag, android_LogPriority priority = ANDROID_LOG_DEBUG,
+             const char* prefix = 0) const;
+
+    // Same, to the specified file descriptor.
+    void dump(int fd, int indent = 0, const char* prefix = 0) const;
+
+    // Same, to the specified printer.
+    void print(Printer& printer) const;
+
+    // Get the number of distinct call stacks in the store.
+    size_t size() const;
+
+    // Get the number of call stacks added, including duplicates.
+    size_t getTotalCount() const;
+
+private:
+    CallStackStore(const CallStackStore&);
+    CallStackStore& operator=(const CallStackStore&);
+
+    struct Entry {
+        hash_t hash;
+        CallStack stack;
+        size_t count;
+
+        inline const hash_t& getKey() const { return hash; }
+    };
+
+    const uint32_t mSamplingInterval;
+    volatile int32_t mCalls;
+
+    mutable Mutex mLock;
+    BasicHashtable<hash_t, Entry> mEntries;     // guarded by mLock
+    size_t mTotalCount;                         // guarded by mLock
+};
+
+}; // namespace android
+
+#endif // ANDROID_CALLSTACK_STORE_H
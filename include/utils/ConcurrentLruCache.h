@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_CONCURRENT_LRU_CACHE_H
+#define ANDROID_UTILS_CONCURRENT_LRU_CACHE_H
+
+#include <utils/JenkinsHash.h>
+#include <utils/LruCache.h>
+#include <utils/Mutex.h>
+
+namespace android {
+
+/**
+ * ConcurrentLruCache callback used to weigh an entry, e.g. by its size in
+ * bytes.  It must always return the same cost for the same entry.
+ */
+template<typename EntryKey, typename EntryValue>
+class EntryCost {
+public:
+    virtual ~EntryCost() { };
+    virtual size_t operator()(const EntryKey& key, const EntryValue& value) = 0;
+}; // class EntryCost
+
+/**
+ * A thread-safe LruCache, split into shards by key hash so that threads
+ * working on different keys rarely contend for the same lock.
+ *
+ * Least recently used entries are evicted per shard, once the total cost of
+ * the shard's entries goes over its share of maxCost.  Without a cost
+ * function, every entry costs 1 and maxCost is a number of entries.
+ *
+ * The listener and cost function must be set before the cache is shared
+ * between threads.  The listener is called with the shard's lock held, so it
+ * must not call back into the cache.
+ */
+template <typename TKey, typename TValue>
+class ConcurrentLruCache {
+public:
+    enum {
+        DEFAULT_SHARD_COUNT = 8,
+    };
+
+    ConcurrentLruCache(size_t maxCost, size_t shardCount = DEFAULT_SHARD_COUNT);
+    ~ConcurrentLruCache();
+
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    void setEntryCost(EntryCost<TKey, TValue>* cost);
+
+    size_t size() const;
+    size_t getCost() const;
+
+    /**
+     * Returns a copy of the value, since the entry may be evicted as soon as
+     * the shard lock is released, or a value made from NULL if there is none.
+     */
+    TValue get(const TKey& key);
+
+    /**
+     * Returns false, leaving the cache unchanged, if the key is already in the
+     * cache or the entry alone costs more than a shard can hold.
+     */
+    bool put(const TKey& key, const TValue& value);
+
+    bool remove(const TKey& key);
+    void clear();
+
+private:
+    ConcurrentLruCache(const ConcurrentLruCache& that);  // disallow copy constructor
+    ConcurrentLruCache& operator=(const ConcurrentLruCache& that);
+
+    struct Shard : public OnEntryRemoved<TKey, TValue> {
+        Shard() : cache(LruCache<TKey, TValue>::kUnlimitedCapacity), cost(0), owner(NULL) {
+            cache.setOnEntryRemovedListener(this);
+        }
+
+        virtual void operator()(TKey& key, TValue& value) {
+            cost -= owner->costOf(key, value);
+            if (owner->mListener) {
+                (*owner->mListener)(key, value);
+            }
+        }
+
+        mutable Mutex lock;
+        LruCache<TKey, TValue> cache;   // guarded by lock
+        size_t cost;                    // guarded by lock
+        ConcurrentLruCache* owner;
+    };
+
+    size_t costOf(const TKey& key, const TValue& value) const {
+        return mCost ? (*mCost)(key, value) : 1;
+    }
+
+    Shard& shardFor(const TKey& key) const {
+        // Mix the hash again, so that the shard does not follow from the same
+        // bits as the bucket within it.
+        hash_t hash = JenkinsHashWhiten(JenkinsHashMix(0, hash_type(key)));
+        return mShards[hash % mShardCount];
+    }
+
+    Shard* mShards;
+    const size_t mShardCount;
+    size_t mShardMaxCost;
+    OnEntryRemoved<TKey, TValue>* mListener;
+    EntryCost<TKey, TValue>* mCost;
+};
+
+// Implementation is here, because it's fully templated
+template <typename TKey, typename TValue>
+ConcurrentLruCache<TKey, TValue>::ConcurrentLruCache(size_t maxCost, size_t shardCount) :
+        mShards(new Shard[shardCount ? shardCount : 1]), mShardCount(shardCount ? shardCount : 1),
+        mListener(NULL), mCost(NULL) {
+    mShardMaxCost = maxCost / mShardCount;
+    if (mShardMaxCost == 0) {
+        mShardMaxCost = 1;
+    }
+    for (size_t i = 0; i < mShardCount; i++) {
+        mShards[i].owner = this;
+    }
+}
+
+template <typename TKey, typename TValue>
+ConcurrentLruCache<TKey, TValue>::~ConcurrentLruCache() {
+    delete[] mShards;
+}
+
+template <typename K, typename V>
+void ConcurrentLruCache<K, V>::setOnEntryRemovedListener(OnEntryRemoved<K, V>* listener) {
+    mListener = listener;
+}
+
+template <typename K, typename V>
+void ConcurrentLruCache<K, V>::setEntryCost(EntryCost<K, V>* cost) {
+    mCost = cost;
+}
+
+template <typename TKey, typename TValue>
+size_t ConcurrentLruCache<TKey, TValue>::size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < mShardCount; i++) {
+        Mutex::Autolock _l(mShards[i].lock);
+        size += mShards[i].cache.size();
+    }
+    return size;
+}
+
+template <typename TKey, typename TValue>
+size_t ConcurrentLruCache<TKey, TValue>::getCost() const {
+    size_t cost = 0;
+    for (size_t i = 0; i < mShardCount; i++) {
+        Mutex::Autolock _l(mShards[i].lock);
+        cost += mShards[i].cost;
+    }
+    return cost;
+}
+
+template <typename TKey, typename TValue>
+TValue ConcurrentLruCache<TKey, TValue>::get(const TKey& key) {
+    Shard& shard = shardFor(key);
+    Mutex::Autolock _l(shard.lock);
+    return shard.cache.get(key);
+}
+
+template <typename TKey, typename TValue>
+bool ConcurrentLruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
+    size_t cost = costOf(key, value);
+    if (cost > mShardMaxCost) {
+        return false;
+    }
+
+    Shard& shard = shardFor(key);
+    Mutex::Autolock _l(shard.lock);
+    if (!shard.cache.put(key, value)) {
+        return false;
+    }
+    shard.cost += cost;
+    while (shard.cost > mShardMaxCost && shard.cache.removeOldest()) {
+        // The shard takes the cost of the evicted entry off as it goes.
+    }
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool ConcurrentLruCache<TKey, TValue>::remove(const TKey& key) {
+    Shard& shard = shardFor(key);
+    Mutex::Autolock _l(shard.lock);
+    return shard.cache.remove(key);
+}
+
+template <typename TKey, typename TValue>
+void ConcurrentLruCache<TKey, TValue>::clear() {
+    for (size_t i = 0; i < mShardCount; i++) {
+        Mutex::Autolock _l(mShards[i].lock);
+        mShards[i].cache.clear();
+    }
+}
+
+}
+
+#endif // ANDROID_UTILS_CONCURRENT_LRU_CACHE_H
@@ -59,6 +59,37 @@ public:
     bool create(const char* origFileName, int fd,
                 off64_t offset, size_t length, bool readOnly);
 
+    /*
+     * Flags for create().
+     *
+     * POPULATE faults the whole mapping in up front, with read-ahead,
+     * rather than a page at a time as it is first touched.  It is ignored
+     * where the system does not support it.
+     */
+    enum CreateFlags {
+        POPULATE = 0x01
+    };
+
+    /*
+     * Same as above, with a combination of CreateFlags.
+     */
+    bool create(const char* origFileName, int fd,
+                off64_t offset, size_t length, bool readOnly, int createFlags);
+
+    /*
+     * Return a read-only mapping of the file, shared with every other caller
+     * asking for the same range of the same file, as identified by its
+     * device and inode.  Only the first caller creates the mapping.
+     *
+     * The mapping is released with release() as usual, and is unmapped once
+     * no caller holds it any more.  Acquiring and releasing shared mappings
+     * is thread-safe.
+     *
+     * Returns NULL on failure.
+     */
+    static FileMap* createShared(const char* origFileName, int fd,
+                off64_t offset, size_t length, int createFlags = 0);
+
     /*
      * Return the name of the file this map came from, if known.
      */
@@ -82,12 +113,20 @@ public:
     /*
      * Get a "copy" of the object.
      */
-    FileMap* acquire(void) { mRefCount++; return this; }
+    FileMap* acquire(void) {
+        if (mShared) return acquireShared();
+        mRefCount++;
+        return this;
+    }
 
     /*
      * Call this when mapping is no longer needed.
      */
     void release(void) {
+        if (mShared) {
+            releaseShared();
+            return;
+        }
         if (--mRefCount <= 0)
             delete this;
     }
@@ -107,6 +146,15 @@ public:
      */
     int advise(MapAdvice advice);
 
+    /*
+     * Same as above, on a range of the data, e.g. to prefetch the part of a
+     * file about to be read with WILLNEED.  The range is relative to
+     * getDataPtr(), and is extended to whole pages.
+     *
+     * Returns 0 on success, -1 on failure.
+     */
+    int advise(MapAdvice advice, size_t offset, size_t length);
+
 protected:
     // don't delete objects; call release()
     ~FileMap(void);
@@ -116,6 +164,11 @@ private:
     FileMap(const FileMap& src);
     const FileMap& operator=(const FileMap& src);
 
+    static FileMap* findShared(dev_t device, ino_t inode, off64_t offset,
+                size_t length);
+    FileMap* acquireShared(void);
+    void releaseShared(void);
+
     int         mRefCount;      // reference count
     char*       mFileName;      // original file name, if known
     void*       mBasePtr;       // base of mmap area; page aligned
@@ -123,6 +176,9 @@ private:
     off64_t     mDataOffset;    // offset used when map was created
     void*       mDataPtr;       // start of requested data, offset from base
     size_t      mDataLength;    // length, measured from "mDataPtr"
+    bool        mShared;        // in the table of shared mappings
+    dev_t       mDevice;        // device of the file, if shared
+    ino_t       mInode;         // inode of the file, if shared
 #ifdef HAVE_WIN32_FILEMAP
     HANDLE      mFileHandle;    // Win32 file handle
     HANDLE      mFileMapping;   // Win32 file mapping handle
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HASH_MAP_H
+#define ANDROID_HASH_MAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <cutils/log.h>
+
+#include <utils/Errors.h>
+#include <utils/TypeHelpers.h>
+
+namespace android {
+
+/*
+ * A hash map with open addressing, for lookups on large maps where the
+ * binary search of a KeyedVector shows up.
+ *
+ * Entries live in one flat array, next to an array of their hash codes.
+ * Collisions are resolved by linear probing with Robin Hood ordering: an
+ * entry takes the place of one that is closer to its home bucket, so that
+ * probe sequences stay short and a lookup can stop as soon as it passes
+ * where its key would be.  Removal shifts the following entries back
+ * instead of leaving tombstones.
+ *
+ * Keys need a hash_type() specialization and operator==, as for
+ * BasicHashtable; the hash code is scrambled here, so hash_type() can be
+ * the identity for integers.
+ *
+ * Unlike BasicHashtable, the storage is not shared between copies, and the
+ * index of an entry changes when other entries are added or removed: only
+ * use indices between modifications.
+ */
+template <typename TKey, typename TValue>
+class HashMap {
+public:
+    typedef key_value_pair_t<TKey, TValue> entry_t;
+
+    HashMap();
+    HashMap(const HashMap& other);
+    ~HashMap();
+
+    HashMap& operator =(const HashMap& other);
+
+    inline size_t size() const { return mSize; }
+    inline bool isEmpty() const { return mSize == 0; }
+    inline size_t capacity() const { return mBucketCount; }
+
+    /* Makes room for at least count entries without rehashing. */
+    void setCapacity(size_t count);
+
+    void clear();
+
+    /* Returns the index of the entry for key, or -1 if there is none. */
+    ssize_t indexOfKey(const TKey& key) const;
+
+    /* Returns the value for key, or NULL if there is none. */
+    inline const TValue* find(const TKey& key) const {
+        ssize_t index = indexOfKey(key);
+        return index >= 0 ? &entryAt(index).value : NULL;
+    }
+
+    /* Returns the value for key, which must be present. */
+    const TValue& valueFor(const TKey& key) const;
+    TValue& editValueFor(const TKey& key);
+
+    inline const TKey& keyAt(size_t index) const { return entryAt(index).key; }
+    inline const TValue& valueAt(size_t index) const { return entryAt(index).value; }
+    inline TValue& editValueAt(size_t index) { return editEntryAt(index).value; }
+
+    /*
+     * Iterates over the entries, in no particular order: returns the index
+     * of the first entry after index, or -1 when there are no more.  Start
+     * with -1.
+     */
+    ssize_t next(ssize_t index) const;
+
+    /*
+     * Sets the value for key, adding an entry if there is none.  Returns the
+     * index of the entry.
+     */
+    ssize_t add(const TKey& key, const TValue& value);
+
+    /* Removes the entry for key.  Returns NAME_NOT_FOUND if there is none. */
+    status_t removeItem(const TKey& key);
+
+private:
+    // Grow when more than this many eighths of the buckets are in use.
+    enum { MAX_LOAD_EIGHTHS = 7, MIN_BUCKET_COUNT = 8 };
+
+    hash_t* mHashes;        // 0 for an empty bucket
+    entry_t* mEntries;      // constructed where mHashes is not 0
+    size_t mBucketCount;    // a power of 2, or 0
+    size_t mSize;
+
+    static inline hash_t hashOf(const TKey& key) {
+        // Fibonacci hashing spreads the low bits of hash_type() over all of
+        // them; 0 marks an empty bucket.
+        hash_t hash = hash_type(key) * 0x9e3779b1U;
+        return hash ? hash : 1;
+    }
+
+    inline size_t homeOf(hash_t hash) const {
+        // the high bits are the best mixed
+        return (hash >> 16 | hash << 16) & (mBucketCount - 1);
+    }
+
+    inline size_t distanceOf(size_t index) const {
+        return (index - homeOf(mHashes[index])) & (mBucketCount - 1);
+    }
+
+    inline const entry_t& entryAt(size_t index) const { return mEntries[index]; }
+    inline entry_t& editEntryAt(size_t index) { return mEntries[index]; }
+
+    ssize_t find(const TKey& key, hash_t hash) const;
+    size_t place(hash_t hash);
+    size_t insert(hash_t hash, const TKey& key, const TValue& value);
+    void rehash(size_t bucketCount);
+    void copyFrom(const HashMap& other);
+    void dispose();
+};
+
+// ---------------------------------------------------------------------------
+// No user serviceable parts below here.
+
+template <typename TKey, typename TValue>
+HashMap<TKey, TValue>::HashMap() :
+        mHashes(NULL), mEntries(NULL), mBucketCount(0), mSize(0) {
+}
+
+template <typename TKey, typename TValue>
+HashMap<TKey, TValue>::HashMap(const HashMap& other) :
+        mHashes(NULL), mEntries(NULL), mBucketCount(0), mSize(0) {
+    copyFrom(other);
+}
+
+template <typename TKey, typename TValue>
+HashMap<TKey, TValue>::~HashMap() {
+    dispose();
+}
+
+template <typename TKey, typename TValue>
+HashMap<TKey, TValue>& HashMap<TKey, TValue>::operator =(const HashMap& other) {
+    if (this != &other) {
+        dispose();
+        copyFrom(other);
+    }
+    return *this;
+}
+
+template <typename TKey, typename TValue>
+void HashMap<TKey, TValue>::setCapacity(size_t count) {
+    size_t bucketCount = MIN_BUCKET_COUNT;
+    while (bucketCount * MAX_LOAD_EIGHTHS / 8 < count) {
+        bucketCount *= 2;
+    }
+    if (bucketCount > mBucketCount) {
+        rehash(bucketCount);
+    }
+}
+
+template <typename TKey, typename TValue>
+void HashMap<TKey, TValue>::clear() {
+    if (mSize) {
+        for (size_t i = 0; i < mBucketCount; i++) {
+            if (mHashes[i]) {
+                destroy_type(&mEntries[i], 1);
+                mHashes[i] = 0;
+            }
+        }
+        mSize = 0;
+    }
+}
+
+template <typename TKey, typename TValue>
+ssize_t HashMap<TKey, TValue>::indexOfKey(const TKey& key) const {
+    if (!mSize) {
+        return -1;
+    }
+    return find(key, hashOf(key));
+}
+
+template <typename TKey, typename TValue>
+const TValue& HashMap<TKey, TValue>::valueFor(const TKey& key) const {
+    ssize_t index = indexOfKey(key);
+    LOG_ALWAYS_FATAL_IF(index < 0, "%s: key not found", __PRETTY_FUNCTION__);
+    return mEntries[index].value;
+}
+
+template <typename TKey, typename TValue>
+TValue& HashMap<TKey, TValue>::editValueFor(const TKey& key) {
+    ssize_t index = indexOfKey(key);
+    LOG_ALWAYS_FATAL_IF(index < 0, "%s: key not found", __PRETTY_FUNCTION__);
+    return mEntries[index].value;
+}
+
+template <typename TKey, typename TValue>
+ssize_t HashMap<TKey, TValue>::next(ssize_t index) const {
+    for (size_t i = index + 1; i < mBucketCount; i++) {
+        if (mHashes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+template <typename TKey, typename TValue>
+ssize_t HashMap<TKey, TValue>::add(const TKey& key, const TValue& value) {
+    hash_t hash = hashOf(key);
+    if (mSize) {
+        ssize_t index = find(key, hash);
+        if (index >= 0) {
+            mEntries[index].value = value;
+            return index;
+        }
+    }
+    if ((mSize + 1) * 8 > mBucketCount * MAX_LOAD_EIGHTHS) {
+        rehash(mBucketCount ? mBucketCount * 2 : size_t(MIN_BUCKET_COUNT));
+    }
+    return insert(hash, key, value);
+}
+
+template <typename TKey, typename TValue>
+status_t HashMap<TKey, TValue>::removeItem(const TKey& key) {
+    ssize_t found = indexOfKey(key);
+    if (found < 0) {
+        return NAME_NOT_FOUND;
+    }
+
+    // Shift back the entries that follow, up to one that is empty or at
+    // home already.
+    const size_t mask = mBucketCount - 1;
+    size_t index = found;
+    destroy_type(&mEntries[index], 1);
+    for (;;) {
+        size_t nextIndex = (index + 1) & mask;
+        if (!mHashes[nextIndex] || distanceOf(nextIndex) == 0) {
+            break;
+        }
+        move_forward_type(&mEntries[index], &mEntries[nextIndex]);
+        mHashes[index] = mHashes[nextIndex];
+        index = nextIndex;
+    }
+    mHashes[index] = 0;
+    mSize -= 1;
+    return OK;
+}
+
+template <typename TKey, typename TValue>
+ssize_t HashMap<TKey, TValue>::find(const TKey& key, hash_t hash) const {
+    const size_t mask = mBucketCount - 1;
+    size_t index = homeOf(hash);
+    for (size_t distance = 0; ; distance++) {
+        hash_t bucketHash = mHashes[index];
+        if (!bucketHash || distanceOf(index) < distance) {
+            // the key would have taken this bucket
+            return -1;
+        }
+        if (bucketHash == hash && mEntries[index].key == key) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+template <typename TKey, typename TValue>
+size_t HashMap<TKey, TValue>::place(hash_t hash) {
+    // The entries of a run are ordered by home bucket: the new one goes
+    // before the first that is closer to home than it would be, and the
+    // rest of the run moves up by one.
+    const size_t mask = mBucketCount - 1;
+    size_t index = homeOf(hash);
+    for (size_t distance = 0; mHashes[index] && distanceOf(index) >= distance; distance++) {
+        index = (index + 1) & mask;
+    }
+
+    size_t empty = index;
+    while (mHashes[empty]) {
+        empty = (empty + 1) & mask;
+    }
+    while (empty != index) {
+        size_t prev = (empty - 1) & mask;
+        move_forward_type(&mEntries[empty], &mEntries[prev]);
+        mHashes[empty] = mHashes[prev];
+        empty = prev;
+    }
+
+    mHashes[index] = hash;
+    mSize += 1;
+    return index;
+}
+
+template <typename TKey, typename TValue>
+size_t HashMap<TKey, TValue>::insert(hash_t hash, const TKey& key, const TValue& value) {
+    size_t index = place(hash);
+    new (&mEntries[index]) entry_t(key, value);
+    return index;
+}
+
+template <typename TKey, typename TValue>
+void HashMap<TKey, TValue>::rehash(size_t bucketCount) {
+    hash_t* oldHashes = mHashes;
+    entry_t* oldEntries = mEntries;
+    size_t oldBucketCount = mBucketCount;
+
+    mHashes = static_cast<hash_t*>(calloc(bucketCount, sizeof(hash_t)));
+    mEntries = static_cast<entry_t*>(malloc(bucketCount * sizeof(entry_t)));
+    LOG_ALWAYS_FATAL_IF(!mHashes || !mEntries, "Could not allocate %d buckets.",
+            int(bucketCount));
+    mBucketCount = bucketCount;
+    mSize = 0;
+
+    for (size_t i = 0; i < oldBucketCount; i++) {
+        if (oldHashes[i]) {
+            size_t index = place(oldHashes[i]);
+            move_forward_type(&mEntries[index], &oldEntries[i]);
+        }
+    }
+
+    free(oldHashes);
+    free(oldEntries);
+}
+
+template <typename TKey, typename TValue>
+void HashMap<TKey, TValue>::copyFrom(const HashMap& other) {
+    if (!other.mBucketCount) {
+        return;
+    }
+    mHashes = static_cast<hash_t*>(malloc(other.mBucketCount * sizeof(hash_t)));
+    mEntries = static_cast<entry_t*>(malloc(other.mBucketCount * sizeof(entry_t)));
+    LOG_ALWAYS_FATAL_IF(!mHashes || !mEntries, "Could not allocate %d buckets.",
+            int(other.mBucketCount));
+    memcpy(mHashes, other.mHashes, other.mBucketCount * sizeof(hash_t));
+    for (size_t i = 0; i < other.mBucketCount; i++) {
+        if (mHashes[i]) {
+            new (&mEntries[i]) entry_t(other.mEntries[i]);
+        }
+    }
+    mBucketCount = other.mBucketCount;
+    mSize = other.mSize;
+}
+
+template <typename TKey, typename TValue>
+void HashMap<TKey, TValue>::dispose() {
+    clear();
+    free(mHashes);
+    free(mEntries);
+    mHashes = NULL;
+    mEntries = NULL;
+    mBucketCount = 0;
+}
+
+}; // namespace android
+
+#endif // ANDROID_HASH_MAP_H
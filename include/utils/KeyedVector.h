@@ -86,12 +86,23 @@ public:
             ssize_t         replaceValueFor(const KEY& key, const VALUE& item);
             ssize_t         replaceValueAt(size_t index, const VALUE& item);
 
+            /*!
+             * add many items at once, as if each was add()ed in turn;
+             * to build a large KeyedVector, collect its items in a
+             * Vector and merge them in with a single call.
+             */
+
+            ssize_t         merge(const Vector< key_value_pair_t<KEY, VALUE> >& items);
+            ssize_t         merge(const KeyedVector& other);
+
     /*!
      * remove items
      */
 
             ssize_t         removeItem(const KEY& key);
             ssize_t         removeItemsAt(size_t index, size_t count = 1);
+            //! indices must be in increasing order
+            ssize_t         removeItemsAt(const Vector<size_t>& indices);
             
 private:
             SortedVector< key_value_pair_t<KEY, VALUE> >    mVector;
@@ -193,6 +204,16 @@ ssize_t KeyedVector<KEY,VALUE>::replaceValueAt(size_t index, const VALUE& item)
     return BAD_INDEX;
 }
 
+template<typename KEY, typename VALUE> inline
+ssize_t KeyedVector<KEY,VALUE>::merge(const Vector< key_value_pair_t<KEY,VALUE> >& items) {
+    return mVector.merge(items);
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t KeyedVector<KEY,VALUE>::merge(const KeyedVector<KEY,VALUE>& other) {
+    return mVector.merge(other.mVector);
+}
+
 template<typename KEY, typename VALUE> inline
 ssize_t KeyedVector<KEY,VALUE>::removeItem(const KEY& key) {
     return mVector.remove(key_value_pair_t<KEY,VALUE>(key));
@@ -203,6 +224,11 @@ ssize_t KeyedVector<KEY, VALUE>::removeItemsAt(size_t index, size_t count) {
     return mVector.removeItemsAt(index, count);
 }
 
+template<typename KEY, typename VALUE> inline
+ssize_t KeyedVector<KEY, VALUE>::removeItemsAt(const Vector<size_t>& indices) {
+    return mVector.removeItemsAt(indices);
+}
+
 // ---------------------------------------------------------------------------
 
 template<typename KEY, typename VALUE> inline
@@ -27,6 +27,7 @@
 #define ANDROID_LINEARALLOCATOR_H
 
 #include <stddef.h>
+#include <new>
 
 namespace android {
 
@@ -35,12 +36,55 @@ namespace android {
  * the overhead of malloc when many objects are allocated. It is most useful when creating many
  * small objects with a similar lifetime, and doesn't add significant overhead for large
  * allocations.
+ *
+ * A LinearAllocator is not thread-safe: each thread should use its own, such as the one returned
+ * by forThread().
  */
 class LinearAllocator {
+    class Page;
+    struct Destructor;
+
 public:
     LinearAllocator();
     ~LinearAllocator();
 
+    /**
+     * A position in the allocator, as returned by mark(), to go back to with rewind().
+     */
+    class Mark {
+    public:
+        Mark() : mPage(0), mNext(0), mDedicatedPages(0), mDestructors(0), mUsedSize(0) {}
+    private:
+        friend class LinearAllocator;
+        Page* mPage;
+        void* mNext;
+        Page* mDedicatedPages;
+        Destructor* mDestructors;
+        size_t mUsedSize;
+    };
+
+    /**
+     * Marks the current position and rewinds to it when going out of scope.
+     */
+    class AutoRewind {
+    public:
+        inline AutoRewind(LinearAllocator& allocator)
+            : mAllocator(allocator), mMark(allocator.mark()) {}
+        inline ~AutoRewind() { mAllocator.rewind(mMark); }
+    private:
+        AutoRewind(const AutoRewind&);
+        AutoRewind& operator=(const AutoRewind&);
+        LinearAllocator& mAllocator;
+        const Mark mMark;
+    };
+
+    /**
+     * Returns the allocator of the calling thread, which is created on first use and destroyed,
+     * running the destructors registered with it, when the thread exits. Code using it should
+     * rewind what it allocated before returning, typically with an AutoRewind.
+     */
+    static LinearAllocator& forThread();
+
     /**
      * Reserves and returns a region of memory of at least size 'size', aligning as needed.
      * Typically this is used in an object's overridden new() method or as a replacement for malloc.
@@ -57,6 +101,39 @@ public:
      */
     void rewindIfLastAlloc(void* ptr, size_t allocSize);
 
+    /**
+     * Has 'destructor' called with 'object' when the allocator is rewound past this point,
+     * reset or destroyed. Destructors run in the reverse order of their registration.
+     */
+    void registerDestructor(void (*destructor)(void*), void* object);
+
+    /**
+     * Allocates an object of type T, constructed with its default constructor and destroyed
+     * along with the allocations made after it.
+     */
+    template<typename T>
+    T* create() {
+        T* object = new (alloc(sizeof(T))) T();
+        registerDestructor(destroy<T>, object);
+        return object;
+    }
+
+    /**
+     * Returns the current position, to rewind to later.
+     */
+    Mark mark() const;
+
+    /**
+     * Releases everything allocated since 'mark' was taken, calling the destructors registered
+     * since then. Marks taken after 'mark' become invalid.
+     */
+    void rewind(const Mark& mark);
+
+    /**
+     * Releases everything, keeping the first page for reuse.
+     */
+    void reset();
+
     /**
      * Dump memory usage statistics to the log (allocated and wasted space)
      */
@@ -71,19 +148,24 @@ public:
 private:
     LinearAllocator(const LinearAllocator& other);
 
-    class Page;
+    template<typename T>
+    static void destroy(void* object) { static_cast<T*>(object)->~T(); }
 
     Page* newPage(size_t pageSize);
+    void freePage(Page* p);
     bool fitsInCurrentPage(size_t size);
     void ensureNext(size_t size);
     void* start(Page *p);
     void* end(Page* p);
+    void runDestructors(Destructor* last);
 
     size_t mPageSize;
     size_t mMaxAllocSize;
     void* mNext;
     Page* mCurrentPage;
     Page* mPages;
+    Page* mDedicatedPages;
+    Destructor* mDestructors;
 
     // Memory usage tracking
     size_t mTotalAllocated;
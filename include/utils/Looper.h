@@ -119,6 +119,76 @@ private:
 };
 
 
+/**
+ * The queue of messages waiting for their delivery time, used by Looper and
+ * LooperPool.  Not thread safe: the owner guards it with its own lock.
+ *
+ * Messages are kept in a binary heap ordered by uptime, with messages due at
+ * the same time delivered in the order they were enqueued.  The messages of
+ * each handler are also linked together, so removing them only visits the
+ * messages of that handler.
+ */
+class MessageQueue {
+public:
+    MessageQueue();
+
+    inline size_t size() const { return mHeap.size(); }
+    inline bool isEmpty() const { return mHeap.isEmpty(); }
+
+    /**
+     * Returns the uptime of the first message due, LLONG_MAX if there are none.
+     */
+    nsecs_t nextUptime() const;
+
+    /**
+     * Adds a message, returns true if it is now the first message due.
+     */
+    bool enqueue(nsecs_t uptime, const sp<MessageHandler>& handler, const Message& message);
+
+    /**
+     * Removes the first message due.  The queue must not be empty.
+     */
+    void dequeue(sp<MessageHandler>* outHandler, Message* outMessage);
+
+    /**
+     * Removes the messages of a handler, or only those with the given what.
+     * Returns the number of messages removed.
+     */
+    size_t remove(const sp<MessageHandler>& handler);
+    size_t remove(const sp<MessageHandler>& handler, int what);
+
+    void clear();
+
+private:
+    struct Entry {
+        nsecs_t uptime;
+        uint64_t seq;           // enqueue order, breaks ties between equal uptimes
+        sp<MessageHandler> handler;
+        Message message;
+        size_t heapIndex;
+        ssize_t prev;           // messages of the same handler, -1 at the ends
+        ssize_t next;
+    };
+
+    Vector<Entry> mEntries;     // slots, referred to by index
+    Vector<size_t> mFreeSlots;
+    Vector<size_t> mHeap;       // slots, ordered by (uptime, seq)
+    KeyedVector<MessageHandler*, size_t> mFirstByHandler;
+    uint64_t mNextSeq;
+
+    inline bool isBefore(size_t a, size_t b) const {
+        const Entry& ea = mEntries.itemAt(a);
+        const Entry& eb = mEntries.itemAt(b);
+        return ea.uptime < eb.uptime || (ea.uptime == eb.uptime && ea.seq < eb.seq);
+    }
+
+    void setHeapItem(size_t heapIndex, size_t slot);
+    void siftUp(size_t heapIndex);
+    void siftDown(size_t heapIndex);
+    void removeSlot(size_t slot);
+};
+
+
 /**
  * A polling loop that supports monitoring file descriptor events, optionally
  * using callbacks.  The implementation uses epoll() internally.
@@ -328,7 +398,9 @@ public:
 
 private:
     struct Request {
-        int fd;
+        Request() : fd(-1), ident(0), data(NULL) { }
+
+        int fd;     // -1 for an unused entry of mRequests
         int ident;
         sp<LooperCallback> callback;
         void* data;
@@ -339,17 +411,8 @@ private:
         Request request;
     };
 
-    struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
-
-        MessageEnvelope(nsecs_t uptime, const sp<MessageHandler> handler,
-                const Message& message) : uptime(uptime), handler(handler), message(message) {
-        }
-
-        nsecs_t uptime;
-        sp<MessageHandler> handler;
-        Message message;
-    };
+    // Maximum number of file descriptors for which to retrieve poll events each iteration.
+    enum { EPOLL_MAX_EVENTS = 16 };
 
     const bool mAllowNonCallbacks; // immutable
 
@@ -357,7 +420,7 @@ private:
     int mWakeWritePipeFd; // immutable
     Mutex mLock;
 
-    Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    MessageQueue mMessages; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
     // Whether we are currently waiting for work.  Not protected by a lock,
@@ -366,18 +429,20 @@ private:
 
     int mEpollFd; // immutable
 
-    // Locked list of file descriptor monitoring requests.
-    KeyedVector<int, Request> mRequests;  // guarded by mLock
+    // Locked table of file descriptor monitoring requests, indexed by fd.
+    Vector<Request> mRequests;  // guarded by mLock
 
     // This state is only used privately by pollOnce and does not require a lock since
-    // it runs on a single thread.
-    Vector<Response> mResponses;
+    // it runs on a single thread.  There is at most one response per epoll event.
+    Response mResponses[EPOLL_MAX_EVENTS];
+    size_t mResponseCount;
     size_t mResponseIndex;
     nsecs_t mNextMessageUptime; // set to LLONG_MAX when none
 
     int pollInner(int timeoutMillis);
     void awoken();
     void pushResponse(int events, const Request& request);
+    const Request* getRequestLocked(int fd) const;
 
     static void initTLSKey();
     static void threadDestructor(void *st);
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UTILS_LOOPER_POOL_H
+#define UTILS_LOOPER_POOL_H
+
+#include <utils/Looper.h>
+#include <utils/List.h>
+#include <utils/Thread.h>
+
+namespace android {
+
+/**
+ * A set of threads that share the work of monitoring file descriptors and
+ * delivering messages, using the same LooperCallback and MessageHandler
+ * types as a Looper.
+ *
+ * All the threads wait on a single epoll instance.  File descriptors are
+ * registered with EPOLLONESHOT so that an event is handed to exactly one
+ * thread, and the file descriptor is only re-armed after its callback
+ * returns: a given callback never runs concurrently for the same fd.
+ *
+ * Each thread has a queue of its own for messages that are due.  A message
+ * sent from a pool thread goes to that thread's queue, one sent from
+ * elsewhere goes to the queues in turn, and a thread that runs out of work
+ * takes messages from the other queues before it goes back to waiting.
+ *
+ * Unlike a Looper, there is no ordering guarantee between messages, and
+ * handlers and callbacks may run on any of the threads, concurrently with
+ * each other.  Only callbacks are supported: there is no pollOnce() to
+ * return an identifier to.
+ */
+class LooperPool : public RefBase {
+protected:
+    virtual ~LooperPool();
+
+public:
+    /**
+     * Creates a pool of threadCount threads, which are not started yet.
+     */
+    LooperPool(size_t threadCount);
+
+    /**
+     * Starts the threads.  This method can only be called once.
+     */
+    status_t start(const char* name = "LooperPool");
+
+    /**
+     * Asks the threads to exit once they are done with what they are
+     * running, and waits for them.  Pending messages are dropped.  Must not be
+     * called from one of the pool's threads.  The destructor stops the pool
+     * too, so the last reference must not be released on one of them either.
+     */
+    void stop();
+
+    size_t getThreadCount() const { return mWorkers.size(); }
+
+    /**
+     * Adds or replaces a file descriptor to be polled.  The callback is run
+     * by one of the threads each time the fd is signalled, and is
+     * unregistered when it returns 0, as with Looper::addFd().
+     *
+     * Returns 1 if the file descriptor was added, -1 on error.
+     */
+    int addFd(int fd, int events, const sp<LooperCallback>& callback, void* data);
+    int addFd(int fd, int events, ALooper_callbackFunc callback, void* data);
+
+    /**
+     * Removes a file descriptor.  As with Looper::removeFd(), its callback may
+     * still be running on another thread when this returns.
+     *
+     * Returns 1 if the file descriptor was removed, 0 if none was registered.
+     */
+    int removeFd(int fd);
+
+    void sendMessage(const sp<MessageHandler>& handler, const Message& message);
+    void sendMessageDelayed(nsecs_t uptimeDelay, const sp<MessageHandler>& handler,
+            const Message& message);
+    void sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
+            const Message& message);
+
+    void removeMessages(const sp<MessageHandler>& handler);
+    void removeMessages(const sp<MessageHandler>& handler, int what);
+
+private:
+    struct Request {
+        int events;
+        sp<LooperCallback> callback;
+        void* data;
+        uint32_t seq;   // tells a re-added fd apart from the one a callback ran for
+    };
+
+    struct MessageEnvelope {
+        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope(nsecs_t uptime, const sp<MessageHandler>& handler,
+                const Message& message) : uptime(uptime), handler(handler), message(message) {
+        }
+
+        nsecs_t uptime;
+        sp<MessageHandler> handler;
+        Message message;
+    };
+
+    class Worker : public Thread {
+    public:
+        Worker(LooperPool* pool, size_t index);
+
+        LooperPool* const mPool;
+        const size_t mIndex;
+
+        Mutex mLock;
+        List<MessageEnvelope> mQueue;   // due messages, guarded by mLock
+
+    private:
+        virtual status_t readyToRun();
+        virtual bool threadLoop();
+    };
+
+    int mEpollFd;           // immutable
+    int mWakeReadPipeFd;    // immutable
+    int mWakeWritePipeFd;   // immutable
+    Vector<sp<Worker> > mWorkers;   // immutable once started
+
+    Mutex mLock;
+    KeyedVector<int, Request> mRequests;        // guarded by mLock
+    MessageQueue mTimedMessages;                // guarded by mLock
+    uint32_t mNextSeq;                          // guarded by mLock
+    size_t mIdleCount;                          // guarded by mLock
+    size_t mNextQueue;                          // guarded by mLock
+    bool mExiting;                              // guarded by mLock
+
+    void runOnce(size_t index);
+    bool takeMessage(size_t index, MessageEnvelope* outMessage);
+    bool hasQueuedMessages();
+    void queueMessage(ssize_t index, const MessageEnvelope& message);
+    int pollTimeoutLocked(nsecs_t now);
+    size_t moveDueMessagesLocked(nsecs_t now, size_t index);
+    void handleEvent(int fd, uint32_t epollEvents);
+    void wake();
+    void awoken();
+    void rearmWakePipe();
+};
+
+} // namespace android
+
+#endif // UTILS_LOOPER_POOL_H
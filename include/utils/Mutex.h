@@ -58,6 +58,19 @@ public:
     // lock if possible; returns 0 on success, error otherwise
     status_t    tryLock();
 
+#if defined(HAVE_PTHREADS)
+    // Contention profiling.  When enabled, one in every samplePeriod calls to
+    // lock() that find the mutex held records how long it waited, for the
+    // mutex and the code that called lock().  0 disables it, which is the
+    // default.  Only the calls that have to wait ever pay for it.  Not
+    // available on Win32.
+    static void setContentionSampling(uint32_t samplePeriod);
+
+    // Writes the sites that waited the longest, in total, to fd, then
+    // forgets about them if reset is true.
+    static void dumpContention(int fd, bool reset = false);
+#endif
+
     // Manages the mutex automatically. It'll be locked when Autolock is
     // constructed and released when Autolock goes out of scope.
     class Autolock {
@@ -77,6 +90,8 @@ private:
     Mutex&      operator = (const Mutex&);
     
 #if defined(HAVE_PTHREADS)
+    status_t    lockContended();
+
     pthread_mutex_t mMutex;
 #else
     void    _init();
@@ -109,7 +124,11 @@ inline Mutex::~Mutex() {
     pthread_mutex_destroy(&mMutex);
 }
 inline status_t Mutex::lock() {
-    return -pthread_mutex_lock(&mMutex);
+    // The uncontended case costs the same as pthread_mutex_lock().
+    if (__builtin_expect(pthread_mutex_trylock(&mMutex) == 0, 1)) {
+        return NO_ERROR;
+    }
+    return lockContended();
 }
 inline void Mutex::unlock() {
     pthread_mutex_unlock(&mMutex);
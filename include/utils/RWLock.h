@@ -24,7 +24,10 @@
 # include <pthread.h>
 #endif
 
+#include <cutils/atomic-explicit.h>
+#include <utils/Condition.h>
 #include <utils/Errors.h>
+#include <utils/Mutex.h>
 #include <utils/ThreadDefs.h>
 
 // ---------------------------------------------------------------------------
@@ -117,6 +120,106 @@ inline void RWLock::unlock() {
     pthread_rwlock_unlock(&mRWLock);
 }
 
+// ---------------------------------------------------------------------------
+
+/*
+ * A reader-writer lock for data that is read much more often than it is
+ * written, such as configuration shared by many threads.  It has the same
+ * interface as RWLock.
+ *
+ * Each reader only updates one of several counters, picked by thread and
+ * each on a cache line of its own, so that readers on different CPUs do
+ * not contend.  This makes writing more expensive: the writer has to wait
+ * for all the counters to drop to zero.  Writers have priority: once a
+ * writer is waiting, new readers wait for it to be done.
+ *
+ * As with RWLock, it is not recursive, and unlock() releases whichever
+ * lock the calling thread holds.
+ */
+class BigReaderLock {
+public:
+                BigReaderLock();
+                ~BigReaderLock();
+
+    status_t    readLock();
+    status_t    tryReadLock();
+    status_t    writeLock();
+    status_t    tryWriteLock();
+    void        unlock();
+
+    class AutoRLock {
+    public:
+        inline AutoRLock(BigReaderLock& lock) : mLock(lock)  { mLock.readLock(); }
+        inline ~AutoRLock() { mLock.unlock(); }
+    private:
+        BigReaderLock& mLock;
+    };
+
+    class AutoWLock {
+    public:
+        inline AutoWLock(BigReaderLock& lock) : mLock(lock)  { mLock.writeLock(); }
+        inline ~AutoWLock() { mLock.unlock(); }
+    private:
+        BigReaderLock& mLock;
+    };
+
+private:
+    enum {
+        SLOT_COUNT = 16,
+        CACHE_LINE_SIZE = 64
+    };
+
+    struct Slot {
+        volatile int32_t readers;
+        char padding[CACHE_LINE_SIZE - sizeof(int32_t)];
+    };
+
+    // A BigReaderLock cannot be copied
+                BigReaderLock(const BigReaderLock&);
+    BigReaderLock& operator = (const BigReaderLock&);
+
+    inline Slot& slotForThread();
+    inline bool writerPending() const;
+    status_t    readLockSlow(Slot& slot);
+    void        readUnlockSlow();
+    void        writeUnlock();
+    bool        hasReaders() const;
+    void        wakeWaiters();
+
+    Slot mSlots[SLOT_COUNT];
+    volatile int32_t mWriter;   // non-zero while a writer waits or holds the lock
+    pthread_t mWriterThread;    // the writer, valid while mWriter is set
+    Mutex mWriterLock;          // held by the writer
+    Mutex mWaitLock;
+    Condition mWaitCondition;   // signalled when readers or a writer leave
+};
+
+inline BigReaderLock::Slot& BigReaderLock::slotForThread() {
+    uint32_t hash = uint32_t(uintptr_t(pthread_self())) * 0x9e3779b1U;
+    return mSlots[(hash >> 24) % SLOT_COUNT];
+}
+inline bool BigReaderLock::writerPending() const {
+    return android_atomic_load_explicit(&mWriter, ANDROID_MEMORY_ORDER_SEQ_CST) != 0;
+}
+inline status_t BigReaderLock::readLock() {
+    Slot& slot = slotForThread();
+    android_atomic_inc_explicit(&slot.readers, ANDROID_MEMORY_ORDER_SEQ_CST);
+    if (__builtin_expect(!writerPending(), 1)) {
+        return NO_ERROR;
+    }
+    return readLockSlow(slot);
+}
+inline void BigReaderLock::unlock() {
+    if (writerPending() && pthread_equal(mWriterThread, pthread_self())) {
+        writeUnlock();
+        return;
+    }
+    android_atomic_dec_explicit(&slotForThread().readers, ANDROID_MEMORY_ORDER_SEQ_CST);
+    if (__builtin_expect(writerPending(), 0)) {
+        readUnlockSlow();
+    }
+}
+
 #endif // HAVE_PTHREADS
 
 // ---------------------------------------------------------------------------
@@ -33,6 +33,11 @@ public:
         eKeepStorage = 0x00000001
     };
 
+    /* number of size classes small buffers are allocated from */
+    enum {
+        kSizeClassCount = 8
+    };
+
     /*! allocate a buffer of size 'size' and acquire() it.
      *  call release() to free it.
      */
@@ -87,6 +92,15 @@ public:
     //! returns wether or not we're the only owner
     inline          bool                    onlyOwner() const;
     
+    //! largest size of a buffer in the given size class
+    static          size_t                  sizeClassLimit(size_t sizeClass);
+
+    /*! get the number of buffers allocated so far by all threads: counts[i]
+     * for those of size class i, counts[kSizeClassCount] for the larger ones
+     */
+    static          void                    getAllocationCounts(
+                                                    uint64_t counts[kSizeClassCount + 1]);
+
 
 private:
         inline SharedBuffer() { }
@@ -94,10 +108,14 @@ private:
         SharedBuffer(const SharedBuffer&);
         SharedBuffer& operator = (const SharedBuffer&);
  
+        static SharedBuffer* allocBlock(size_t size);
+        static void freeBlock(SharedBuffer* sb);
+
         // 16 bytes. must be sized to preserve correct alignment.
         mutable int32_t        mRefs;
                 size_t         mSize;
-                uint32_t       mReserved[2];
+                uint32_t       mSizeClass;  // of the block, which may be larger than mSize
+                uint32_t       mReserved;
 };
 
 // ---------------------------------------------------------------------------
@@ -111,7 +111,9 @@ public:
                 return *( static_cast<TYPE *>(VectorImpl::editItemLocation(index)) );
             }
 
-            //! merges a vector into this one
+            //! merges a vector into this one, as if each item was add()ed in turn.
+            //! The vector is sorted once, so filling a Vector and merging it is
+            //! the fast way to add many items.
             ssize_t         merge(const Vector<TYPE>& vector);
             ssize_t         merge(const SortedVector<TYPE>& vector);
             
@@ -120,6 +122,8 @@ public:
 
     //! remove several items
     inline  ssize_t         removeItemsAt(size_t index, size_t count = 1);
+    //! remove the items at the given indices, which must be in increasing order
+    inline  ssize_t         removeItemsAt(const Vector<size_t>& indices);
     //! remove one item
     inline  ssize_t         removeAt(size_t index)  { return removeItemsAt(index); }
             
@@ -237,6 +241,11 @@ ssize_t SortedVector<TYPE>::removeItemsAt(size_t index, size_t count) {
     return VectorImpl::removeItemsAt(index, count);
 }
 
+template<class TYPE> inline
+ssize_t SortedVector<TYPE>::removeItemsAt(const Vector<size_t>& indices) {
+    return VectorImpl::removeItemsAtIndices(indices.array(), indices.size());
+}
+
 // ---------------------------------------------------------------------------
 
 template<class TYPE>
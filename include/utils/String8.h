@@ -63,6 +63,16 @@ public:
     static String8              format(const char* fmt, ...) __attribute__((format (printf, 1, 2)));
     static String8              formatV(const char* fmt, va_list args);
 
+    /*
+     * Returns a string equal to str that shares its storage with all the
+     * other strings interned with that value.  Looking up a value that is
+     * already in the pool does not allocate, which helps with identifiers
+     * that come up again and again.  Interned values are never freed.
+     */
+    static String8              intern(const char* str);
+    static String8              intern(const char* str, size_t numChars);
+    static String8              intern(const String8& str);
+
     inline  const char*         string() const;
     inline  size_t              size() const;
     inline  size_t              length() const;
@@ -233,6 +243,40 @@ private:
 // require any change to the underlying SharedBuffer contents or reference count.
 ANDROID_TRIVIAL_MOVE_TRAIT(String8)
 
+/*
+ * Builds a String8 out of many appends, such as a dump written line by
+ * line.  String8::append() resizes the buffer to fit each time; this
+ * doubles it, and formats straight into the spare room, so building the
+ * string takes time linear in its length.
+ */
+class String8Builder
+{
+public:
+                                String8Builder();
+    explicit                    String8Builder(size_t capacity);
+
+            status_t            append(const String8& other);
+            status_t            append(const char* other);
+            status_t            append(const char* other, size_t numChars);
+
+            status_t            appendFormat(const char* fmt, ...)
+                    __attribute__((format (printf, 2, 3)));
+            status_t            appendFormatV(const char* fmt, va_list args);
+
+    inline  size_t              length() const { return mLength; }
+    inline  const char*         string() const { return mString.string(); }
+
+            // Returns the string built so far and leaves the builder empty.
+            String8             toString();
+
+private:
+            char*               reserve(size_t numChars);
+
+            String8 mString;
+            size_t mLength;
+            size_t mCapacity;
+};
+
 // ---------------------------------------------------------------------------
 // No user servicable parts below.
 
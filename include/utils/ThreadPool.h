@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UTILS_THREAD_POOL_H
+#define UTILS_THREAD_POOL_H
+
+#include <utils/List.h>
+#include <utils/Thread.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/**
+ * A unit of work to run on a ThreadPool.
+ */
+class Task : public virtual RefBase {
+protected:
+    virtual ~Task() { }
+
+public:
+    virtual void run() = 0;
+};
+
+/**
+ * Counts tasks posted to a ThreadPool, so that their completion can be
+ * waited for.  A TaskGroup must outlive its tasks: the destructor waits for
+ * them.
+ */
+class TaskGroup {
+public:
+    TaskGroup();
+    ~TaskGroup();
+
+    /**
+     * Waits for all the tasks posted with this group so far, and the ones
+     * they post with it, to be done.  When called from one of the threads of
+     * a pool, runs the pool's queued tasks meanwhile rather than sitting idle,
+     * so that tasks can wait for the tasks they post.
+     */
+    void wait();
+
+    size_t getPendingCount() const;
+
+private:
+    friend class ThreadPool;
+
+    TaskGroup(const TaskGroup&);
+    TaskGroup& operator=(const TaskGroup&);
+
+    void add();
+    void done();
+
+    mutable Mutex mLock;
+    Condition mCondition;
+    size_t mPending;            // guarded by mLock
+};
+
+/**
+ * A set of threads that run tasks.
+ *
+ * Each thread has a queue of its own.  A task posted from one of the pool's
+ * threads goes to that thread's queue, and one posted from elsewhere goes to
+ * the queues in turn.  A thread runs the task it queued last first, which is
+ * the one most likely to find its data in the cache, and one that runs out of
+ * work takes the oldest tasks from the other queues.
+ *
+ * Tasks have the priority of a thread, one of the ANDROID_PRIORITY_*
+ * constants, and the thread that runs a task takes its priority, along with
+ * the matching scheduling group, for the time being.  There is no ordering
+ * between tasks.
+ */
+class ThreadPool : public RefBase {
+protected:
+    virtual ~ThreadPool();
+
+public:
+    /**
+     * Creates a pool of threadCount threads, which are not started yet.
+     */
+    ThreadPool(size_t threadCount);
+
+    /**
+     * Starts the threads.  This method can only be called once.
+     */
+    status_t start(const char* name = "ThreadPool");
+
+    /**
+     * Waits for the queued tasks to be run, then for the threads to exit.
+     * Must not be called from one of the pool's threads.  The destructor
+     * stops the pool too, so the last reference must not be released on one
+     * of them either.
+     */
+    void stop();
+
+    size_t getThreadCount() const { return mWorkers.size(); }
+
+    /**
+     * Queues a task.  Returns INVALID_OPERATION, without queueing the task,
+     * once the pool is stopping.
+     */
+    status_t post(const sp<Task>& task, int priority = ANDROID_PRIORITY_NORMAL,
+            TaskGroup* group = NULL);
+
+private:
+    friend class TaskGroup;
+
+    struct Entry {
+        sp<Task> task;
+        int priority;
+        TaskGroup* group;
+    };
+
+    class Worker : public Thread {
+    public:
+        Worker(ThreadPool* pool, size_t index);
+
+        ThreadPool* const mPool;
+        const size_t mIndex;
+        int mPriority;              // only used by the worker
+
+        Mutex mLock;
+        List<Entry> mQueue;         // guarded by mLock
+
+    private:
+        virtual status_t readyToRun();
+        virtual bool threadLoop();
+    };
+
+    Vector<sp<Worker> > mWorkers;   // immutable
+
+    Mutex mLock;
+    Condition mCondition;           // signalled when tasks are queued
+    size_t mIdleCount;              // guarded by mLock
+    size_t mNextQueue;              // guarded by mLock
+    bool mExiting;                  // guarded by mLock
+
+    bool runOnce(Worker* worker);
+    bool takeTask(size_t index, Entry* outEntry);
+    bool hasQueuedTasks();
+    void runTask(Worker* worker, const Entry& entry);
+
+    // Runs a queued task of the pool the calling thread belongs to, if any.
+    static bool runTaskOnCurrentThread();
+};
+
+} // namespace android
+
+#endif // UTILS_THREAD_POOL_H
@@ -79,7 +79,9 @@ enum {
     SYSTEM_TIME_MONOTONIC = 1, // monotonic time since unspecified starting point
     SYSTEM_TIME_PROCESS = 2,   // high-resolution per-process clock
     SYSTEM_TIME_THREAD = 3,    // high-resolution per-thread clock
-    SYSTEM_TIME_BOOTTIME = 4   // same as SYSTEM_TIME_MONOTONIC, but including CPU suspend time
+    SYSTEM_TIME_BOOTTIME = 4,  // same as SYSTEM_TIME_MONOTONIC, but including CPU suspend time
+    SYSTEM_TIME_REALTIME_COARSE = 5,  // SYSTEM_TIME_REALTIME as of the last tick; cheaper
+    SYSTEM_TIME_MONOTONIC_COARSE = 6  // SYSTEM_TIME_MONOTONIC as of the last tick; cheaper
 };
 
 // return the system-time according to the specified clock
@@ -99,6 +101,25 @@ nsecs_t systemTime(int clock);
  */
 int toMillisecondTimeoutDelay(nsecs_t referenceTime, nsecs_t timeoutTime);
 
+/**
+ * A counter that is cheaper to read than any clock, for timing intervals on
+ * hot paths.  It is the ARM generic timer (CNTVCT) on 64-bit ARM and the TSC
+ * on x86 CPUs whose TSC runs at a constant rate; its frequency is read from
+ * CNTFRQ or calibrated against SYSTEM_TIME_MONOTONIC on first use.
+ * Elsewhere it is SYSTEM_TIME_MONOTONIC itself, counting nanoseconds.
+ *
+ * Counts start at an unspecified point and don't advance in suspend, so only
+ * differences between them are meaningful; convert those with
+ * cyclesToNanoseconds().
+ */
+uint64_t systemCycles(void);
+
+// counts per second of systemCycles()
+uint64_t systemCyclesFrequency(void);
+
+nsecs_t cyclesToNanoseconds(uint64_t cycles);
+uint64_t nanosecondsToCycles(nsecs_t ns);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
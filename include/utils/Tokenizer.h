@@ -18,6 +18,7 @@
 #define _UTILS_TOKENIZER_H
 
 #include <assert.h>
+#include <string.h>
 #include <utils/Errors.h>
 #include <utils/FileMap.h>
 #include <utils/String8.h>
@@ -32,6 +33,26 @@ class Tokenizer {
             bool ownBuffer, size_t length);
 
 public:
+    /**
+     * A run of characters in the tokenizer's buffer.  It is not null-terminated,
+     * and remains valid for as long as the tokenizer does, so that tokens can
+     * be looked at without copying them, and only copied if they are kept.
+     */
+    struct View {
+        const char* data;
+        size_t length;
+
+        inline bool isEmpty() const { return length == 0; }
+
+        inline bool contains(char ch) const { return memchr(data, ch, length) != NULL; }
+
+        inline bool equals(const char* str) const {
+            return strlen(str) == length && memcmp(data, str, length) == 0;
+        }
+
+        inline String8 toString8() const { return String8(data, length); }
+    };
+
     ~Tokenizer();
 
     /**
@@ -88,6 +109,11 @@ public:
      */
     String8 peekRemainderOfLine() const;
 
+    /**
+     * Same as peekRemainderOfLine(), without copying.
+     */
+    View peekRemainderOfLineView() const;
+
     /**
      * Gets the character at the current position and advances past it.
      * Returns null at end of file.
@@ -103,6 +129,11 @@ public:
      */
     String8 nextToken(const char* delimiters);
 
+    /**
+     * Same as nextToken(), without copying.
+     */
+    View nextTokenView(const char* delimiters);
+
     /**
      * Advances to the next line.
      * Does nothing if already at the end of the file.
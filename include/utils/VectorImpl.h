@@ -85,6 +85,8 @@ public:
 
             /*! remove items */
             ssize_t         removeItemsAt(size_t index, size_t count = 1);
+            //! indices must be in increasing order; each survivor moves once
+            ssize_t         removeItemsAtIndices(const size_t* indices, size_t count);
             void            clear();
 
             const void*     itemLocation(size_t index) const;
@@ -129,6 +131,11 @@ private:
         inline void _do_move_forward(void* dest, const void* from, size_t num) const;
         inline void _do_move_backward(void* dest, const void* from, size_t num) const;
 
+        // Reallocation moves the items when nothing else shares the storage.
+        bool _can_move_storage() const;
+        void _do_relocate(void* dest, const void* from, size_t num, bool move) const;
+        void _release_relocated_storage(bool moved);
+
             // These 2 fields are exposed in the inlines below,
             // so they're set in stone.
             void *      mStorage;   // base address of the vector
@@ -182,6 +189,8 @@ protected:
 
 private:
             ssize_t         _indexOrderOf(const void* item, size_t* order = 0) const;
+            ssize_t         _merge(const void* array, size_t length, bool sorted);
+            void            _sortItems(const void** items, const void** temp, size_t n) const;
 
             // these are made private, because they can't be used on a SortedVector
             // (they don't have an implementation either)
@@ -18,6 +18,7 @@
 #define _ZIPFILE_ZIPFILE_H
 
 #include <stddef.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,6 +26,7 @@ extern "C" {
 
 typedef void* zipfile_t;
 typedef void* zipentry_t;
+typedef void* zipstream_t;
 
 // Provide a buffer.  Returns NULL on failure.
 zipfile_t init_zipfile(const void* data, size_t size);
@@ -47,6 +49,28 @@ char* get_zipentry_name(zipentry_t entry);
 // by get_zipentry_size.  Returns nonzero on failure.
 int decompress_zipentry(zipentry_t entry, void* buf, int bufsize);
 
+// Start reading the contents of an entry piece by piece, without
+// needing a buffer for all of it.  Returns NULL on failure.
+zipstream_t open_zipentry_stream(zipentry_t entry);
+
+// Point *data to the next piece of the entry and return its size, 0 at
+// the end of the entry or a negative value on failure.  The data stays
+// valid until the next call.  Stored entries come back in one piece,
+// pointing into the zip file buffer.
+ssize_t read_zipentry_stream(zipstream_t stream, const void** data);
+
+// Release the stream resources.
+void close_zipentry_stream(zipstream_t stream);
+
+// Write the contents of an entry to fd.  Returns nonzero on failure.
+int extract_zipentry(zipentry_t entry, int fd);
+
+// Write the contents of each of the count entries to the matching fd,
+// extracting up to threads entries at a time.  Returns the number of
+// entries which couldn't be extracted.
+int extract_zipentries(zipentry_t* entries, const int* fds, int count,
+        int threads);
+
 // iterate through the entries in the zip file.  pass a pointer to
 // a void* initialized to NULL to start.  Returns NULL when done
 zipentry_t iterate_zipfile(zipfile_t file, void** cookie);
@@ -4,12 +4,14 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
+	boottrace.c \
 	builtins.c \
 	init.c \
 	devices.c \
 	property_service.c \
 	util.c \
 	parser.c \
+	rc_cache.c \
 	logo.c \
 	keychords.c \
 	signal_handler.c \
@@ -63,3 +65,33 @@ ALL_DEFAULT_INSTALLED_MODULES += $(SYMLINKS)
 # local module name
 ALL_MODULES.$(LOCAL_MODULE).INSTALLED := \
     $(ALL_MODULES.$(LOCAL_MODULE).INSTALLED) $(SYMLINKS)
+
+# Host tool that pre-tokenizes .rc files for init, see rc_cache.h
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	init_rc_compile.c \
+	rc_cache.c \
+	parser.c
+
+LOCAL_MODULE:= init_rc_compile
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host tool that converts binary bootchart recordings, see bootchart.h
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= bootchart_convert.c
+
+LOCAL_MODULE:= bootchart_convert
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host tool that reports the critical path of a boot, see bootchart_analyze.c
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= bootchart_analyze.c
+
+LOCAL_MODULE:= bootchart_analyze
+
+include $(BUILD_HOST_EXECUTABLE)
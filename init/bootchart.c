@@ -31,6 +31,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include "bootchart.h"
 
@@ -42,6 +43,7 @@
 #define LOG_DISK        LOG_ROOT"/proc_diskstats.log"
 #define LOG_HEADER      LOG_ROOT"/header"
 #define LOG_ACCT        LOG_ROOT"/kernel_pacct"
+#define LOG_BINARY      LOG_ROOT"/bootchart.bin"
 
 #define LOG_STARTFILE   "/data/bootchart-start"
 #define LOG_STOPFILE    "/data/bootchart-stop"
@@ -291,6 +293,237 @@ do_log_procs(FileBuff  log)
     do_log_ln(log);
 }
 
+/* Binary recording.
+ *
+ * The /proc/uptime, /proc/stat and /proc/diskstats files are kept open
+ * and re-read from the start, processes whose stat line did not change
+ * since the last sample are not written out (nor is their cmdline read),
+ * and everything goes through a single buffered file.
+ */
+
+#define BIN_READ_SIZE   16384
+
+typedef struct {
+    int           pid;
+    unsigned int  hash;
+    int           seen;
+} BinProc;
+
+static int      bin_mode;
+static int      bin_uptime_fd = -1;
+static int      bin_stat_fd = -1;
+static int      bin_disk_fd = -1;
+static BinProc* bin_procs;
+static int      bin_nprocs;
+static int      bin_procs_size;
+static char     bin_buff[BIN_READ_SIZE];
+
+static FileBuffRec  log_bin[1];
+
+static unsigned int
+bin_hash(const char*  data, int  len)
+{
+    unsigned int  hash = 2166136261u;
+    while (len-- > 0)
+        hash = (hash ^ (unsigned char)*data++) * 16777619u;
+    return hash;
+}
+
+static void
+bin_record(unsigned int  type, unsigned int  pid, const void*  data, int  len)
+{
+    struct bootchart_record  rec;
+
+    rec.type = type;
+    rec.pid  = pid;
+    rec.len  = len;
+    file_buff_write(log_bin, &rec, sizeof(rec));
+    if (len > 0)
+        file_buff_write(log_bin, data, len);
+}
+
+/* re-read an already opened proc file from its start */
+static int
+bin_reread(int  fd, char*  buff, int  size)
+{
+    int  len = 0;
+
+    if (fd < 0 || lseek(fd, 0, SEEK_SET) < 0)
+        return -1;
+    while (len < size) {
+        int  ret = unix_read(fd, buff + len, size - len);
+        if (ret <= 0)
+            break;
+        len += ret;
+    }
+    return len;
+}
+
+static int
+bin_proc_open(const char*  path)
+{
+    int  fd = open(path, O_RDONLY);
+    if (fd >= 0)
+        close_on_exec(fd);
+    return fd;
+}
+
+static void
+bin_log_file(int  fd, unsigned int  type)
+{
+    int  len = bin_reread(fd, bin_buff, sizeof(bin_buff));
+    if (len >= 0)
+        bin_record(type, 0, bin_buff, len);
+}
+
+/* find pid in the sorted process table, or the slot it should go in */
+static int
+bin_find_proc(int  pid, int*  found)
+{
+    int  lo = 0, hi = bin_nprocs;
+
+    while (lo < hi) {
+        int  mid = (lo + hi) / 2;
+        if (bin_procs[mid].pid < pid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = (lo < bin_nprocs && bin_procs[lo].pid == pid);
+    return lo;
+}
+
+static void
+bin_log_proc(int  pid)
+{
+    char  filename[32];
+    char  cmdline[1024];
+    char  buff[1024];
+    unsigned int  hash;
+    int   len, found, idx;
+    BinProc*  proc;
+
+    snprintf(filename,sizeof(filename),"/proc/%d/stat",pid);
+    len = proc_read(filename, buff, sizeof(buff));
+    if (len <= 0)
+        return;
+    hash = bin_hash(buff, len);
+
+    idx = bin_find_proc(pid, &found);
+    if (!found) {
+        if (bin_nprocs == bin_procs_size) {
+            int       size = bin_procs_size ? bin_procs_size*2 : 256;
+            BinProc*  procs = realloc(bin_procs, size*sizeof(BinProc));
+            if (procs == NULL)
+                return;
+            bin_procs = procs;
+            bin_procs_size = size;
+        }
+        memmove(bin_procs + idx + 1, bin_procs + idx,
+                (bin_nprocs - idx)*sizeof(BinProc));
+        bin_nprocs++;
+        bin_procs[idx].pid  = pid;
+        bin_procs[idx].hash = ~hash;
+    }
+    proc = &bin_procs[idx];
+    proc->seen = 1;
+    if (proc->hash == hash)
+        return;
+    proc->hash = hash;
+
+    /* substitute the process name with its real name, as do_log_procs does */
+    snprintf(filename,sizeof(filename),"/proc/%d/cmdline",pid);
+    proc_read(filename, cmdline, sizeof(cmdline));
+    if (cmdline[0] != 0) {
+        const char*  p1 = strchr(buff, '(');
+        const char*  p2 = p1 ? strchr(p1, ')') : NULL;
+        if (p2) {
+            char  line[2048];
+            int   n = snprintf(line, sizeof(line), "%.*s%s%s",
+                               (int)(p1+1-buff), buff, cmdline, p2);
+            if (n >= (int)sizeof(line))
+                n = sizeof(line)-1;
+            bin_record(BOOTCHART_REC_PROC, pid, line, n);
+            return;
+        }
+    }
+    bin_record(BOOTCHART_REC_PROC, pid, buff, len);
+}
+
+static void
+bin_log_procs(void)
+{
+    DIR*  dir = opendir("/proc");
+    struct dirent*  entry;
+    int   i, j;
+
+    if (dir == NULL)
+        return;
+
+    for (i = 0; i < bin_nprocs; i++)
+        bin_procs[i].seen = 0;
+
+    while ((entry = readdir(dir)) != NULL) {
+        char*  end;
+        int    pid = strtol( entry->d_name, &end, 10);
+        if (end != NULL && end > entry->d_name && *end == 0)
+            bin_log_proc(pid);
+    }
+    closedir(dir);
+
+    /* whatever was not seen has exited */
+    for (i = j = 0; i < bin_nprocs; i++) {
+        if (!bin_procs[i].seen) {
+            bin_record(BOOTCHART_REC_EXIT, bin_procs[i].pid, NULL, 0);
+            continue;
+        }
+        bin_procs[j++] = bin_procs[i];
+    }
+    bin_nprocs = j;
+}
+
+static void
+bin_step(void)
+{
+    long long  jiffies = 0;
+    int        len;
+
+    len = bin_reread(bin_uptime_fd, bin_buff, 64);
+    if (len > 0) {
+        bin_buff[len] = 0;
+        jiffies = 100LL*strtod(bin_buff,NULL);
+    }
+    bin_record(BOOTCHART_REC_SAMPLE, 0, &jiffies, sizeof(jiffies));
+    bin_log_file(bin_stat_fd, BOOTCHART_REC_STAT);
+    bin_log_file(bin_disk_fd, BOOTCHART_REC_DISKSTATS);
+    bin_log_procs();
+}
+
+static void
+bin_init(void)
+{
+    file_buff_open(log_bin, LOG_BINARY);
+    close_on_exec(log_bin->fd);
+    file_buff_write(log_bin, BOOTCHART_BIN_MAGIC, 4);
+
+    bin_uptime_fd = bin_proc_open("/proc/uptime");
+    bin_stat_fd   = bin_proc_open("/proc/stat");
+    bin_disk_fd   = bin_proc_open("/proc/diskstats");
+}
+
+static void
+bin_finish(void)
+{
+    file_buff_done(log_bin);
+    close(log_bin->fd);
+    close(bin_uptime_fd);
+    close(bin_stat_fd);
+    close(bin_disk_fd);
+    free(bin_procs);
+    bin_procs = NULL;
+    bin_nprocs = bin_procs_size = 0;
+}
+
 static FileBuffRec  log_stat[1];
 static FileBuffRec  log_procs[1];
 static FileBuffRec  log_disks[1];
@@ -299,13 +532,15 @@ static FileBuffRec  log_disks[1];
 int   bootchart_init( void )
 {
     int  ret;
-    char buff[4];
+    char buff[32];
     int  timeout = 0, count = 0;
 
     buff[0] = 0;
     proc_read( LOG_STARTFILE, buff, sizeof(buff) );
     if (buff[0] != 0) {
         timeout = atoi(buff);
+        /* "<timeout> binary" selects the compact recording format */
+        bin_mode = (strstr(buff, "binary") != NULL);
     }
     else {
         /* when running with emulator, androidboot.bootchart=<timeout>
@@ -333,9 +568,19 @@ int   bootchart_init( void )
 
     do {ret=mkdir(LOG_ROOT,0755);}while (ret < 0 && errno == EINTR);
 
-    file_buff_open(log_stat,  LOG_STAT);
-    file_buff_open(log_procs, LOG_PROCS);
-    file_buff_open(log_disks, LOG_DISK);
+    /* don't leave the other format's output from an earlier run lying
+     * around, where grab-bootchart.sh would pick it up with this one */
+    if (bin_mode) {
+        unlink(LOG_STAT);
+        unlink(LOG_PROCS);
+        unlink(LOG_DISK);
+        bin_init();
+    } else {
+        unlink(LOG_BINARY);
+        file_buff_open(log_stat,  LOG_STAT);
+        file_buff_open(log_procs, LOG_PROCS);
+        file_buff_open(log_disks, LOG_DISK);
+    }
 
     /* create kernel process accounting file */
     {
@@ -353,9 +598,13 @@ int   bootchart_init( void )
 /* called each time you want to perform a bootchart sampling op */
 int  bootchart_step( void )
 {
-    do_log_file(log_stat,   "/proc/stat");
-    do_log_file(log_disks,  "/proc/diskstats");
-    do_log_procs(log_procs);
+    if (bin_mode) {
+        bin_step();
+    } else {
+        do_log_file(log_stat,   "/proc/stat");
+        do_log_file(log_disks,  "/proc/diskstats");
+        do_log_procs(log_procs);
+    }
 
     /* we stop when /data/bootchart-stop contains 1 */
     {
@@ -371,8 +620,12 @@ int  bootchart_step( void )
 void  bootchart_finish( void )
 {
     unlink( LOG_STOPFILE );
-    file_buff_done(log_stat);
-    file_buff_done(log_disks);
-    file_buff_done(log_procs);
+    if (bin_mode) {
+        bin_finish();
+    } else {
+        file_buff_done(log_stat);
+        file_buff_done(log_disks);
+        file_buff_done(log_procs);
+    }
     acct(NULL);
 }
@@ -33,4 +33,31 @@ extern void  bootchart_finish(void);
 
 #endif /* BOOTCHART */
 
+/* Binary recording format, written to /data/bootchart/bootchart.bin when
+ * /data/bootchart-start contains "<timeout> binary", and turned back into
+ * the usual log files on the host by bootchart_convert.
+ *
+ * The file is BOOTCHART_BIN_MAGIC followed by records, each a
+ * bootchart_record header and 'len' bytes of payload, in host byte order
+ * of the device.  Every sample starts with a BOOTCHART_REC_SAMPLE record
+ * whose payload is the uptime in jiffies as a 64-bit integer.  Process
+ * lines are only recorded when they changed since the previous sample;
+ * a process keeps its last line until a BOOTCHART_REC_EXIT record.
+ */
+#define BOOTCHART_BIN_MAGIC     "BCB1"
+
+enum {
+    BOOTCHART_REC_SAMPLE = 1,   /* payload: uint64 jiffies */
+    BOOTCHART_REC_STAT,         /* payload: /proc/stat */
+    BOOTCHART_REC_DISKSTATS,    /* payload: /proc/diskstats */
+    BOOTCHART_REC_PROC,         /* payload: /proc/<pid>/stat, name substituted */
+    BOOTCHART_REC_EXIT,         /* no payload, process is gone */
+};
+
+struct bootchart_record {
+    unsigned int type;
+    unsigned int pid;
+    unsigned int len;
+};
+
 #endif /* _BOOTCHART_H */
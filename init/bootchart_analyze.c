@@ -0,0 +1,735 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* bootchart_analyze reads the boot timelines that init and ueventd keep
+ * (see boottrace.h) and, if there are any, the bootchart samples from the
+ * same boot, and reports the boot's phases, its critical path and, given
+ * the report of an earlier boot, what got slower.
+ *
+ * The report is one record per line, its type first and any name last
+ * since names can have spaces; times are in ms since the kernel started:
+ *
+ *   boot <end> <how>                  how = sys.boot_completed or last_event
+ *   phase <start> <duration> <init busy> <cpu busy %> <iowait %> <name>
+ *   critical <start> <duration> <type> <name>
+ *   service <start> <name>
+ *   regression <baseline> <now> <delta> <phase|service|boot> <name>
+ *
+ * Lines starting with '#' are comments, and "-" stands for anything
+ * unknown.  The cpu figures cover the bootchart samples around each phase,
+ * so short phases get those of the interval they fall in.  The critical
+ * path is found by walking back from the end of the boot to whatever
+ * finished last before the current point; time where nothing did is a
+ * "gap" named after the process that used the most cpu during it,
+ * according to bootchart.  The exit status is 2 if anything regressed.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "boottrace.h"
+
+typedef struct {
+    long long  start;       /* us */
+    long long  end;
+    int        type;
+    char*      name;
+} Event;
+
+typedef struct {
+    long long  time;        /* us */
+    long long  busy;        /* jiffies */
+    long long  idle;
+    long long  iowait;
+} CpuSample;
+
+typedef struct {
+    int        pid;
+    long long  cpu;         /* jiffies */
+    char*      name;
+} ProcTime;
+
+typedef struct {
+    long long  time;
+    ProcTime*  procs;
+    int        nprocs;
+} PsSample;
+
+typedef struct {
+    const char*  name;
+    long long    start;
+    long long    end;
+} Phase;
+
+typedef struct {
+    char*   key;            /* "<what> <name>" */
+    double  value;          /* ms */
+} BaselineEntry;
+
+#define JIFFY_US  10000LL
+
+static const char*  type_names[] = {
+    [BOOTTRACE_ACTION] = "action",
+    [BOOTTRACE_COMMAND] = "command",
+    [BOOTTRACE_SERVICE_START] = "service_start",
+    [BOOTTRACE_SERVICE_EXIT] = "service_exit",
+    [BOOTTRACE_WAIT] = "wait",
+    [BOOTTRACE_COLDBOOT] = "coldboot",
+    [BOOTTRACE_UEVENT] = "uevent",
+    [BOOTTRACE_FS] = "fs",
+    [BOOTTRACE_RESTORECON] = "restorecon",
+    [BOOTTRACE_MARK] = "mark",
+};
+#define NTYPES  (int)(sizeof(type_names)/sizeof(type_names[0]))
+
+/* The actions that init queues in order as it boots, see init.c:main() */
+static const char*  phase_names[] = {
+    "early-init", "wait_for_coldboot_done", "init", "early-fs", "fs",
+    "post-fs", "post-fs-data", "charger", "early-boot", "boot",
+};
+#define NPHASES  (int)(sizeof(phase_names)/sizeof(phase_names[0]))
+
+static Event*      events;
+static int         nevents, events_size;
+
+static CpuSample*  cpu_samples;
+static int         ncpu_samples, cpu_samples_size;
+
+static PsSample*   ps_samples;
+static int         nps_samples, ps_samples_size;
+
+static BaselineEntry*  baseline;
+static int             nbaseline, baseline_size;
+
+static void*
+grow(void*  array, int*  size, int  count, size_t  elem)
+{
+    void*  p;
+    int    n;
+
+    if (count < *size)
+        return array;
+    n = *size ? *size * 2 : 64;
+    p = realloc(array, n * elem);
+    if (p == NULL) {
+        fprintf(stderr, "bootchart_analyze: out of memory\n");
+        exit(1);
+    }
+    *size = n;
+    return p;
+}
+
+static char*
+xstrdup(const char*  s)
+{
+    char*  p = strdup(s);
+
+    if (p == NULL) {
+        fprintf(stderr, "bootchart_analyze: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void
+chomp(char*  line)
+{
+    size_t  len = strlen(line);
+
+    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+        line[--len] = 0;
+}
+
+static FILE*
+open_input(const char*  dir, const char*  name)
+{
+    char  path[4096];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return fopen(path, "r");
+}
+
+static void
+print_ms(long long  us)
+{
+    printf(" %lld.%03lld", us / 1000, (us < 0 ? -us : us) % 1000);
+}
+
+/* Reads "<start ms> <duration us> <type> <name>" lines, see boottrace_dump() */
+static int
+read_boottrace(const char*  dir, const char*  name)
+{
+    FILE*  f = open_input(dir, name);
+    char   line[1024];
+    int    count = 0;
+
+    if (f == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), f)) {
+        char       type[32];
+        double     start_ms;
+        long long  duration;
+        int        pos = 0, i;
+        Event*     e;
+
+        chomp(line);
+        if (line[0] == '#') {
+            printf("# %s: %s\n", name, line + 2);
+            continue;
+        }
+        if (sscanf(line, "%lf %lld %31s %n", &start_ms, &duration, type, &pos) < 3)
+            continue;
+        for (i = 0; i < NTYPES; i++)
+            if (type_names[i] && !strcmp(type, type_names[i]))
+                break;
+        if (i == NTYPES)
+            continue;
+
+        events = grow(events, &events_size, nevents, sizeof(Event));
+        e = &events[nevents++];
+        e->start = (long long)(start_ms * 1000 + 0.5);
+        e->end = e->start + duration;
+        e->type = i;
+        e->name = xstrdup(pos ? line + pos : "");
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static int
+is_number(const char*  line)
+{
+    if (!*line)
+        return 0;
+    for ( ; *line; line++)
+        if (!isdigit((unsigned char)*line))
+            return 0;
+    return 1;
+}
+
+/* Each sample of proc_stat.log is the uptime in jiffies, /proc/stat and a
+ * blank line; only the "cpu" line matters here.
+ */
+static void
+read_proc_stat(const char*  dir)
+{
+    FILE*      f = open_input(dir, "proc_stat.log");
+    char       line[1024];
+    long long  time = -1;
+
+    if (f == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f)) {
+        long long  v[8] = { 0 };
+        CpuSample* s;
+
+        chomp(line);
+        if (line[0] == 0) {
+            time = -1;
+        } else if (time < 0 && is_number(line)) {
+            time = atoll(line) * JIFFY_US;
+        } else if (time >= 0 && !strncmp(line, "cpu ", 4)) {
+            sscanf(line + 4, "%lld %lld %lld %lld %lld %lld %lld %lld",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+            cpu_samples = grow(cpu_samples, &cpu_samples_size, ncpu_samples,
+                               sizeof(CpuSample));
+            s = &cpu_samples[ncpu_samples++];
+            s->time = time;
+            s->busy = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+            s->idle = v[3];
+            s->iowait = v[4];
+        }
+    }
+    fclose(f);
+}
+
+/* Each sample of proc_ps.log is the uptime in jiffies, the stat line of
+ * every process with its name replaced by its command line, and a blank
+ * line.
+ */
+static void
+read_proc_ps(const char*  dir)
+{
+    FILE*      f = open_input(dir, "proc_ps.log");
+    char       line[2048];
+    PsSample*  s = NULL;
+    int        procs_size = 0;
+
+    if (f == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f)) {
+        char*      lparen;
+        char*      rparen;
+        long long  utime, stime;
+        int        pid;
+
+        chomp(line);
+        if (line[0] == 0) {
+            s = NULL;
+            continue;
+        }
+        if (s == NULL) {
+            if (!is_number(line))
+                continue;
+            ps_samples = grow(ps_samples, &ps_samples_size, nps_samples,
+                              sizeof(PsSample));
+            s = &ps_samples[nps_samples++];
+            s->time = atoll(line) * JIFFY_US;
+            s->procs = NULL;
+            s->nprocs = 0;
+            procs_size = 0;
+            continue;
+        }
+
+        lparen = strchr(line, '(');
+        rparen = strrchr(line, ')');
+        if (lparen == NULL || rparen == NULL || rparen < lparen)
+            continue;
+        pid = atoi(line);
+        /* state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime */
+        if (sscanf(rparen + 1, " %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %lld %lld",
+                   &utime, &stime) != 2)
+            continue;
+        *rparen = 0;
+
+        s->procs = grow(s->procs, &procs_size, s->nprocs, sizeof(ProcTime));
+        s->procs[s->nprocs].pid = pid;
+        s->procs[s->nprocs].cpu = utime + stime;
+        s->procs[s->nprocs].name = xstrdup(lparen + 1);
+        s->nprocs++;
+    }
+    fclose(f);
+}
+
+/* The last sample taken at or before time, else the first one. */
+static int
+sample_before(long long  time, long long (*sample_time)(int), int  count)
+{
+    int  i;
+
+    for (i = count - 1; i > 0; i--)
+        if (sample_time(i) <= time)
+            break;
+    return i;
+}
+
+/* The first sample taken at or after time, else the last one. */
+static int
+sample_after(long long  time, long long (*sample_time)(int), int  count)
+{
+    int  i;
+
+    for (i = 0; i < count - 1; i++)
+        if (sample_time(i) >= time)
+            break;
+    return i;
+}
+
+static long long cpu_sample_time(int  i) { return cpu_samples[i].time; }
+static long long ps_sample_time(int  i)  { return ps_samples[i].time; }
+
+static void
+print_cpu(long long  start, long long  end)
+{
+    CpuSample  *a, *b;
+    long long  total;
+
+    if (ncpu_samples < 2) {
+        printf(" - -");
+        return;
+    }
+    a = &cpu_samples[sample_before(start, cpu_sample_time, ncpu_samples)];
+    b = &cpu_samples[sample_after(end, cpu_sample_time, ncpu_samples)];
+    total = (b->busy - a->busy) + (b->idle - a->idle) + (b->iowait - a->iowait);
+    if (b->time <= a->time || total <= 0) {
+        printf(" - -");
+        return;
+    }
+    printf(" %.1f %.1f", 100.0 * (b->busy - a->busy) / total,
+           100.0 * (b->iowait - a->iowait) / total);
+}
+
+/* Names the process that used the most cpu between start and end. */
+static const char*
+busiest_process(long long  start, long long  end)
+{
+    PsSample   *a, *b;
+    const char*  busiest = "-";
+    long long  most = 0;
+    int        i, j;
+
+    if (nps_samples < 2)
+        return busiest;
+    a = &ps_samples[sample_before(start, ps_sample_time, nps_samples)];
+    b = &ps_samples[sample_after(end, ps_sample_time, nps_samples)];
+    if (b->time <= a->time)
+        return busiest;
+
+    for (i = 0; i < b->nprocs; i++) {
+        long long  cpu = b->procs[i].cpu;
+
+        for (j = 0; j < a->nprocs; j++) {
+            if (a->procs[j].pid == b->procs[i].pid) {
+                cpu -= a->procs[j].cpu;
+                break;
+            }
+        }
+        if (cpu > most) {
+            most = cpu;
+            busiest = b->procs[i].name;
+        }
+    }
+    return busiest;
+}
+
+static long long
+find_boot_end(const char**  how)
+{
+    long long  end = 0;
+    int        i;
+
+    for (i = 0; i < nevents; i++) {
+        if (events[i].type == BOOTTRACE_MARK &&
+            !strcmp(events[i].name, "sys.boot_completed")) {
+            *how = "sys.boot_completed";
+            return events[i].start;
+        }
+    }
+    for (i = 0; i < nevents; i++)
+        if (events[i].end > end)
+            end = events[i].end;
+    *how = "last_event";
+    return end;
+}
+
+static int
+find_phases(Phase*  phases, long long  boot_end)
+{
+    int  nphases = 0, i, p;
+
+    /* the kernel's, up to the first thing init did */
+    phases[0].name = "kernel";
+    phases[0].start = 0;
+    phases[0].end = boot_end;
+    for (i = 0; i < nevents; i++)
+        if (events[i].start < phases[0].end)
+            phases[0].end = events[i].start;
+    nphases = 1;
+
+    for (p = 0; p < NPHASES; p++) {
+        for (i = 0; i < nevents; i++) {
+            if (events[i].type == BOOTTRACE_ACTION &&
+                !strcmp(events[i].name, phase_names[p]) &&
+                events[i].start < boot_end) {
+                phases[nphases].name = phase_names[p];
+                phases[nphases].start = events[i].start;
+                nphases++;
+                break;
+            }
+        }
+    }
+
+    /* each phase lasts until the next one starts, the last until the end */
+    for (i = 1; i < nphases; i++) {
+        phases[i].end = i + 1 < nphases ? phases[i+1].start : boot_end;
+        if (phases[i].end < phases[i].start)
+            phases[i].end = phases[i].start;
+    }
+    return nphases;
+}
+
+/* How long init spent running actions between start and end. */
+static long long
+init_busy(long long  start, long long  end)
+{
+    long long  busy = 0;
+    int        i;
+
+    for (i = 0; i < nevents; i++) {
+        long long  s, e;
+
+        if (events[i].type != BOOTTRACE_ACTION)
+            continue;
+        s = events[i].start > start ? events[i].start : start;
+        e = events[i].end < end ? events[i].end : end;
+        if (e > s)
+            busy += e - s;
+    }
+    return busy;
+}
+
+static int
+can_block(int  type)
+{
+    switch (type) {
+    case BOOTTRACE_COMMAND:
+    case BOOTTRACE_SERVICE_EXIT:
+    case BOOTTRACE_WAIT:
+    case BOOTTRACE_COLDBOOT:
+    case BOOTTRACE_FS:
+    case BOOTTRACE_RESTORECON:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void
+print_critical_path(long long  boot_end)
+{
+    Event*     path[4096];
+    long long  gap_start[4096];
+    int        npath = 0, i;
+    long long  t = boot_end;
+
+    /* walk back, picking what finished last before t */
+    while (npath < (int)(sizeof(path)/sizeof(path[0]))) {
+        Event*  best = NULL;
+
+        for (i = 0; i < nevents; i++) {
+            Event*  e = &events[i];
+
+            if (!can_block(e->type) || e->end > t || e->start >= t)
+                continue;
+            if (best == NULL || e->end > best->end ||
+                (e->end == best->end && e->start < best->start))
+                best = e;
+        }
+        path[npath] = best;
+        gap_start[npath] = best ? best->end : 0;
+        npath++;
+        if (best == NULL)
+            break;
+        t = best->start;
+    }
+
+    for (i = npath - 1; i >= 0; i--) {
+        /* the time between this and the next one on the path */
+        long long  end = i > 0 && path[i-1] ? path[i-1]->start : boot_end;
+
+        if (path[i]) {
+            printf("critical");
+            print_ms(path[i]->start);
+            print_ms(path[i]->end - path[i]->start);
+            printf(" %s %s\n", type_names[path[i]->type], path[i]->name);
+        }
+        if (end - gap_start[i] >= 1000) {
+            printf("critical");
+            print_ms(gap_start[i]);
+            print_ms(end - gap_start[i]);
+            printf(" %s %s\n", path[i] ? "gap" : "kernel",
+                   path[i] ? busiest_process(gap_start[i], end) : "-");
+        }
+    }
+}
+
+/* Whether events[i] is the first start of its service during the boot. */
+static int
+is_first_start(int  i, long long  boot_end)
+{
+    int  j;
+
+    if (events[i].type != BOOTTRACE_SERVICE_START || events[i].start > boot_end)
+        return 0;
+    for (j = 0; j < i; j++)
+        if (events[j].type == BOOTTRACE_SERVICE_START &&
+            !strcmp(events[j].name, events[i].name))
+            return 0;
+    return 1;
+}
+
+static void
+print_services(long long  boot_end)
+{
+    int  i;
+
+    for (i = 0; i < nevents; i++) {
+        if (!is_first_start(i, boot_end))
+            continue;
+        printf("service");
+        print_ms(events[i].start);
+        printf(" %s\n", events[i].name);
+    }
+}
+
+static int
+compare_events(const void*  a, const void*  b)
+{
+    const Event*  ea = a;
+    const Event*  eb = b;
+
+    if (ea->start != eb->start)
+        return ea->start < eb->start ? -1 : 1;
+    return ea->end > eb->end ? -1 : ea->end < eb->end;
+}
+
+/* Keeps the boot, phase durations and service starts of an earlier report. */
+static int
+read_baseline(const char*  path)
+{
+    FILE*  f = fopen(path, "r");
+    char   line[1024];
+
+    if (f == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), f)) {
+        char    key[1024];
+        double  a, b;
+        int     pos = 0;
+
+        chomp(line);
+        if (sscanf(line, "boot %lf", &a) == 1) {
+            snprintf(key, sizeof(key), "boot -");
+        } else if (sscanf(line, "phase %lf %lf %*s %*s %*s %n", &a, &b, &pos) == 2 && pos) {
+            snprintf(key, sizeof(key), "phase %s", line + pos);
+            a = b;
+        } else if (sscanf(line, "service %lf %n", &a, &pos) == 1 && pos) {
+            snprintf(key, sizeof(key), "service %s", line + pos);
+        } else {
+            continue;
+        }
+        baseline = grow(baseline, &baseline_size, nbaseline, sizeof(BaselineEntry));
+        baseline[nbaseline].key = xstrdup(key);
+        baseline[nbaseline].value = a;
+        nbaseline++;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int
+check_regression(const char*  what, const char*  name, long long  now_us,
+                 double  min_ms, double  percent)
+{
+    char    key[1024];
+    double  now = now_us / 1000.0;
+    int     i;
+
+    if (baseline == NULL)
+        return 0;
+    snprintf(key, sizeof(key), "%s %s", what, name);
+    for (i = 0; i < nbaseline; i++) {
+        double  base = baseline[i].value;
+
+        if (strcmp(baseline[i].key, key))
+            continue;
+        if (now - base > min_ms && now - base > base * percent / 100) {
+            printf("regression %.3f %.3f %.3f %s %s\n", base, now, now - base, what, name);
+            return 1;
+        }
+        return 0;
+    }
+    return 0;
+}
+
+static int
+usage(void)
+{
+    fprintf(stderr,
+            "usage: bootchart_analyze [-b <baseline>] [-t <ms>] [-p <percent>] <dir>\n"
+            "\n"
+            "<dir> holds boottrace_init and, if there are any, boottrace_ueventd,\n"
+            "proc_stat.log and proc_ps.log from the same boot (see grab-bootchart.sh).\n"
+            "With -b, reports as regressions the phases and service starts that\n"
+            "came more than <ms> (default 50) and <percent> (default 10) later\n"
+            "than in <baseline>, an earlier report.\n");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char*  baseline_path = NULL;
+    const char*  how;
+    double       min_ms = 50, percent = 10;
+    Phase        phases[NPHASES + 1];
+    long long    boot_end;
+    int          nphases, regressions = 0;
+    int          c, i;
+
+    while ((c = getopt(argc, argv, "b:t:p:")) != -1) {
+        switch (c) {
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 't':
+            min_ms = atof(optarg);
+            break;
+        case 'p':
+            percent = atof(optarg);
+            break;
+        default:
+            return usage();
+        }
+    }
+    if (optind != argc - 1)
+        return usage();
+
+    if (baseline_path && read_baseline(baseline_path) < 0) {
+        fprintf(stderr, "bootchart_analyze: cannot read %s\n", baseline_path);
+        return 1;
+    }
+
+    printf("# bootchart_analyze %s\n", argv[optind]);
+    if (read_boottrace(argv[optind], "boottrace_init") <= 0) {
+        fprintf(stderr, "bootchart_analyze: no events in %s/boottrace_init\n", argv[optind]);
+        return 1;
+    }
+    read_boottrace(argv[optind], "boottrace_ueventd");
+    read_proc_stat(argv[optind]);
+    read_proc_ps(argv[optind]);
+    qsort(events, nevents, sizeof(Event), compare_events);
+
+    boot_end = find_boot_end(&how);
+    printf("boot");
+    print_ms(boot_end);
+    printf(" %s\n", how);
+
+    nphases = find_phases(phases, boot_end);
+    for (i = 0; i < nphases; i++) {
+        printf("phase");
+        print_ms(phases[i].start);
+        print_ms(phases[i].end - phases[i].start);
+        if (i > 0)
+            print_ms(init_busy(phases[i].start, phases[i].end));
+        else
+            printf(" -");
+        print_cpu(phases[i].start, phases[i].end);
+        printf(" %s\n", phases[i].name);
+    }
+
+    print_critical_path(boot_end);
+    print_services(boot_end);
+
+    regressions += check_regression("boot", "-", boot_end, min_ms, percent);
+    for (i = 0; i < nphases; i++)
+        regressions += check_regression("phase", phases[i].name,
+                                        phases[i].end - phases[i].start,
+                                        min_ms, percent);
+    for (i = 0; i < nevents; i++)
+        if (is_first_start(i, boot_end))
+            regressions += check_regression("service", events[i].name,
+                                            events[i].start, min_ms, percent);
+
+    return regressions ? 2 : 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* bootchart_convert turns the bootchart.bin file recorded by init in
+ * binary mode back into the proc_stat.log, proc_diskstats.log and
+ * proc_ps.log files that the bootchart tools expect, see bootchart.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bootchart.h"
+
+typedef struct {
+    unsigned int  pid;
+    char*         line;
+} Proc;
+
+static Proc*  procs;
+static int    nprocs;
+static int    procs_size;
+
+static int
+find_proc(unsigned int  pid, int*  found)
+{
+    int  lo = 0, hi = nprocs;
+
+    while (lo < hi) {
+        int  mid = (lo + hi) / 2;
+        if (procs[mid].pid < pid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = (lo < nprocs && procs[lo].pid == pid);
+    return lo;
+}
+
+static int
+set_proc(unsigned int  pid, const char*  data, unsigned int  len)
+{
+    int  found, idx = find_proc(pid, &found);
+    char*  line;
+
+    line = malloc(len + 1);
+    if (line == NULL)
+        return -1;
+    memcpy(line, data, len);
+    line[len] = 0;
+
+    if (found) {
+        free(procs[idx].line);
+    } else {
+        if (nprocs == procs_size) {
+            int    size = procs_size ? procs_size*2 : 256;
+            Proc*  p = realloc(procs, size*sizeof(Proc));
+            if (p == NULL) {
+                free(line);
+                return -1;
+            }
+            procs = p;
+            procs_size = size;
+        }
+        memmove(procs + idx + 1, procs + idx, (nprocs - idx)*sizeof(Proc));
+        nprocs++;
+        procs[idx].pid = pid;
+    }
+    procs[idx].line = line;
+    return 0;
+}
+
+static void
+remove_proc(unsigned int  pid)
+{
+    int  found, idx = find_proc(pid, &found);
+
+    if (!found)
+        return;
+    free(procs[idx].line);
+    memmove(procs + idx, procs + idx + 1, (nprocs - idx - 1)*sizeof(Proc));
+    nprocs--;
+}
+
+static void
+write_procs(FILE*  out, long long  jiffies)
+{
+    int  i;
+
+    fprintf(out, "%lld\n", jiffies);
+    for (i = 0; i < nprocs; i++)
+        fputs(procs[i].line, out);
+    fputc('\n', out);
+}
+
+static FILE*
+open_log(const char*  dir, const char*  name)
+{
+    char   path[4096];
+    FILE*  f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f = fopen(path, "w");
+    if (f == NULL)
+        fprintf(stderr, "bootchart_convert: cannot create %s\n", path);
+    return f;
+}
+
+int main(int argc, char **argv)
+{
+    FILE  *in, *stat_log, *disk_log, *ps_log;
+    struct bootchart_record  rec;
+    char   magic[4];
+    char*  data = NULL;
+    unsigned int  data_size = 0;
+    long long  jiffies = 0;
+    int    in_sample = 0, samples = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: bootchart_convert <bootchart.bin> <outdir>\n");
+        return 1;
+    }
+
+    in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        fprintf(stderr, "bootchart_convert: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, BOOTCHART_BIN_MAGIC, 4)) {
+        fprintf(stderr, "bootchart_convert: %s is not a bootchart recording\n", argv[1]);
+        return 1;
+    }
+
+    stat_log = open_log(argv[2], "proc_stat.log");
+    disk_log = open_log(argv[2], "proc_diskstats.log");
+    ps_log   = open_log(argv[2], "proc_ps.log");
+    if (!stat_log || !disk_log || !ps_log)
+        return 1;
+
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        if (rec.len > data_size) {
+            char*  d = realloc(data, rec.len);
+            if (d == NULL) {
+                fprintf(stderr, "bootchart_convert: out of memory\n");
+                return 1;
+            }
+            data = d;
+            data_size = rec.len;
+        }
+        if (rec.len && fread(data, 1, rec.len, in) != rec.len) {
+            /* the recording was cut short, keep what we have */
+            break;
+        }
+
+        switch (rec.type) {
+        case BOOTCHART_REC_SAMPLE:
+            if (in_sample)
+                write_procs(ps_log, jiffies);
+            if (rec.len >= sizeof(jiffies))
+                memcpy(&jiffies, data, sizeof(jiffies));
+            in_sample = 1;
+            samples++;
+            break;
+        case BOOTCHART_REC_STAT:
+        case BOOTCHART_REC_DISKSTATS: {
+            FILE*  out = (rec.type == BOOTCHART_REC_STAT) ? stat_log : disk_log;
+            fprintf(out, "%lld\n", jiffies);
+            fwrite(data, 1, rec.len, out);
+            fputc('\n', out);
+            break;
+        }
+        case BOOTCHART_REC_PROC:
+            if (set_proc(rec.pid, data, rec.len) < 0) {
+                fprintf(stderr, "bootchart_convert: out of memory\n");
+                return 1;
+            }
+            break;
+        case BOOTCHART_REC_EXIT:
+            remove_proc(rec.pid);
+            break;
+        default:
+            fprintf(stderr, "bootchart_convert: skipping unknown record %u\n", rec.type);
+            break;
+        }
+    }
+    if (in_sample)
+        write_procs(ps_log, jiffies);
+
+    fclose(in);
+    fclose(stat_log);
+    fclose(disk_log);
+    fclose(ps_log);
+    free(data);
+    printf("converted %d samples\n", samples);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "boottrace.h"
+#include "log.h"
+
+#define BOOTTRACE_ENTRIES   2048
+#define BOOTTRACE_NAME_LEN  48
+
+struct boottrace_entry {
+    long long start;
+    unsigned int duration;
+    unsigned int type;
+    char name[BOOTTRACE_NAME_LEN];
+};
+
+static struct boottrace_entry ring[BOOTTRACE_ENTRIES];
+static unsigned int ring_next;      /* total events recorded */
+
+static const char *type_names[] = {
+    [BOOTTRACE_ACTION] = "action",
+    [BOOTTRACE_COMMAND] = "command",
+    [BOOTTRACE_SERVICE_START] = "service_start",
+    [BOOTTRACE_SERVICE_EXIT] = "service_exit",
+    [BOOTTRACE_WAIT] = "wait",
+    [BOOTTRACE_COLDBOOT] = "coldboot",
+    [BOOTTRACE_UEVENT] = "uevent",
+    [BOOTTRACE_FS] = "fs",
+    [BOOTTRACE_RESTORECON] = "restorecon",
+    [BOOTTRACE_MARK] = "mark",
+};
+
+long long boottrace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static struct boottrace_entry *new_entry(enum boottrace_type type, long long start,
+                                         long long end)
+{
+    struct boottrace_entry *e = &ring[ring_next++ % BOOTTRACE_ENTRIES];
+    long long duration = end > start ? end - start : 0;
+
+    e->start = start;
+    e->duration = duration > 0xffffffffLL ? 0xffffffff : (unsigned int) duration;
+    e->type = type;
+    return e;
+}
+
+void boottrace_event(enum boottrace_type type, const char *name, long long start)
+{
+    struct boottrace_entry *e = new_entry(type, start, boottrace_now());
+
+    strlcpy(e->name, name ? name : "", sizeof(e->name));
+}
+
+void boottrace_span(enum boottrace_type type, const char *name,
+                    const char *detail, long long start, long long end)
+{
+    struct boottrace_entry *e = new_entry(type, start, end);
+
+    snprintf(e->name, sizeof(e->name), "%s %s", name ? name : "", detail ? detail : "");
+}
+
+void boottrace_event2(enum boottrace_type type, const char *name,
+                      const char *detail, long long start)
+{
+    boottrace_span(type, name, detail, start, boottrace_now());
+}
+
+int boottrace_dump(const char *path)
+{
+    char tmp[PATH_MAX];
+    unsigned int i, first;
+    FILE *f;
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ERROR("boottrace: cannot create %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    f = fdopen(fd, "w");
+    if (!f) {
+        close(fd);
+        return -1;
+    }
+
+    first = ring_next > BOOTTRACE_ENTRIES ? ring_next - BOOTTRACE_ENTRIES : 0;
+    if (first)
+        fprintf(f, "# %u earlier events dropped\n", first);
+    for (i = first; i < ring_next; i++) {
+        struct boottrace_entry *e = &ring[i % BOOTTRACE_ENTRIES];
+
+        fprintf(f, "%lld.%03lld %u %s %s\n", e->start / 1000, e->start % 1000,
+                e->duration, type_names[e->type], e->name);
+    }
+
+    if (fclose(f) || rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
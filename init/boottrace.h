@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_BOOTTRACE_H_
+#define _INIT_BOOTTRACE_H_
+
+/*
+ * A fixed size ring of timestamped events covering what init and ueventd
+ * spend their time on during boot.  Each process keeps its own ring and
+ * writes it out as text with boottrace_dump():
+ *
+ *   <start ms> <duration us> <type> <name>
+ *
+ * init dumps to BOOTTRACE_INIT_FILE when sys.boot_completed is set, or
+ * whenever BOOTTRACE_DUMP_PROPERTY is set to 1.  ueventd dumps to
+ * BOOTTRACE_UEVENTD_FILE after coldboot and then at most once a second
+ * while it handles events.  The ring is not locked, so events must only
+ * be recorded from each process's main thread.
+ */
+
+#define BOOTTRACE_INIT_FILE      "/dev/.boottrace_init"
+#define BOOTTRACE_UEVENTD_FILE   "/dev/.boottrace_ueventd"
+#define BOOTTRACE_DUMP_PROPERTY  "sys.boottrace.dump"
+
+enum boottrace_type {
+    BOOTTRACE_ACTION,           /* an action was dequeued */
+    BOOTTRACE_COMMAND,          /* one command of an action ran */
+    BOOTTRACE_SERVICE_START,    /* fork of a service, parent side */
+    BOOTTRACE_SERVICE_EXIT,     /* a service was reaped, duration is its lifetime */
+    BOOTTRACE_WAIT,             /* wait_for_file() */
+    BOOTTRACE_COLDBOOT,
+    BOOTTRACE_UEVENT,
+    BOOTTRACE_FS,               /* a step of mounting, passed on from fs_mgr */
+    BOOTTRACE_RESTORECON,       /* restorecon_recursive(), detail is relabeled/files */
+    BOOTTRACE_MARK,             /* a point in time, such as sys.boot_completed */
+};
+
+/* CLOCK_MONOTONIC in microseconds */
+long long boottrace_now(void);
+
+/* Records an event of the given type that began at start (from
+ * boottrace_now()) and ends now.  name is truncated as needed.
+ */
+void boottrace_event(enum boottrace_type type, const char *name, long long start);
+
+/* Same, with two name parts joined by a space. */
+void boottrace_event2(enum boottrace_type type, const char *name,
+                      const char *detail, long long start);
+
+/* Same, for an event that ended at end rather than now. */
+void boottrace_span(enum boottrace_type type, const char *name,
+                    const char *detail, long long start, long long end);
+
+/* Writes the ring, oldest event first, to path. */
+int boottrace_dump(const char *path);
+
+#endif
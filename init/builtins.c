@@ -46,6 +46,7 @@
 #include "init_parser.h"
 #include "util.h"
 #include "log.h"
+#include "boottrace.h"
 
 #include <private/android_filesystem_config.h>
 
@@ -494,6 +495,45 @@ exit_success:
 
 }
 
+/*
+ * The child of do_mount_all() sends the times fs_mgr reports back to init
+ * through a pipe, one fixed size record per write(2), which is atomic as
+ * long as it is under PIPE_BUF.
+ */
+struct mount_timing {
+    long long start;
+    long long end;
+    char event[16];
+    char mount_point[32];
+};
+
+static int mount_timing_fd = -1;
+
+static void send_mount_timing(const char *event, const char *mount_point,
+                              long long start, long long end)
+{
+    struct mount_timing t;
+
+    memset(&t, 0, sizeof(t));
+    t.start = start;
+    t.end = end;
+    strlcpy(t.event, event, sizeof(t.event));
+    strlcpy(t.mount_point, mount_point, sizeof(t.mount_point));
+    /* the pipe is non-blocking, so a full pipe drops the record */
+    write(mount_timing_fd, &t, sizeof(t));
+}
+
+static void read_mount_timings(int fd)
+{
+    struct mount_timing t;
+
+    while (read(fd, &t, sizeof(t)) == sizeof(t)) {
+        t.event[sizeof(t.event) - 1] = '\0';
+        t.mount_point[sizeof(t.mount_point) - 1] = '\0';
+        boottrace_span(BOOTTRACE_FS, t.event, t.mount_point, t.start, t.end);
+    }
+}
+
 int do_mount_all(int nargs, char **args)
 {
     pid_t pid;
@@ -502,11 +542,19 @@ int do_mount_all(int nargs, char **args)
     int status;
     const char *prop;
     struct fstab *fstab;
+    int timing_pipe[2] = { -1, -1 };
 
     if (nargs != 2) {
         return -1;
     }
 
+    if (pipe(timing_pipe) == 0) {
+        fcntl(timing_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(timing_pipe[1], F_SETFD, FD_CLOEXEC);
+        fcntl(timing_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(timing_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
     /*
      * Call fs_mgr_mount_all() to mount all filesystems.  We fork(2) and
      * do the call in the child to provide protection to the main init
@@ -516,15 +564,26 @@ int do_mount_all(int nargs, char **args)
     pid = fork();
     if (pid > 0) {
         /* Parent.  Wait for the child to return */
+        if (timing_pipe[1] >= 0)
+            close(timing_pipe[1]);
         waitpid(pid, &status, 0);
         if (WIFEXITED(status)) {
             ret = WEXITSTATUS(status);
         } else {
             ret = -1;
         }
+        if (timing_pipe[0] >= 0) {
+            read_mount_timings(timing_pipe[0]);
+            close(timing_pipe[0]);
+        }
     } else if (pid == 0) {
         /* child, call fs_mgr_mount_all() */
         klog_set_level(6);  /* So we can see what fs_mgr_mount_all() does */
+        if (timing_pipe[0] >= 0) {
+            close(timing_pipe[0]);
+            mount_timing_fd = timing_pipe[1];
+            fs_mgr_set_timing_callback(send_mount_timing);
+        }
         fstab = fs_mgr_read_fstab(args[1]);
         child_ret = fs_mgr_mount_all(fstab);
         fs_mgr_free_fstab(fstab);
@@ -534,6 +593,10 @@ int do_mount_all(int nargs, char **args)
         exit(child_ret);
     } else {
         /* fork failed, return an error */
+        if (timing_pipe[0] >= 0) {
+            close(timing_pipe[0]);
+            close(timing_pipe[1]);
+        }
         return -1;
     }
 
@@ -841,6 +904,16 @@ int do_restorecon(int nargs, char **args) {
     return 0;
 }
 
+int do_restorecon_recursive(int nargs, char **args) {
+    int i;
+
+    for (i = 1; i < nargs; i++) {
+        if (restorecon_recursive(args[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
 int do_setsebool(int nargs, char **args) {
     const char *name = args[1];
     const char *value = args[2];
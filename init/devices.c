@@ -25,6 +25,9 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -38,13 +41,17 @@
 #include <sys/time.h>
 #include <asm/page.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <time.h>
 
+#include <cutils/hashmap.h>
 #include <cutils/list.h>
 #include <cutils/uevent.h>
 
 #include "devices.h"
 #include "util.h"
 #include "log.h"
+#include "boottrace.h"
 
 #define SYSFS_PREFIX    "/sys"
 #define FIRMWARE_DIR1   "/etc/firmware"
@@ -54,6 +61,8 @@
 extern struct selabel_handle *sehandle;
 
 static int device_fd = -1;
+/* set when the socket overflowed and the kernel dropped uevents */
+static int device_fd_overrun;
 
 struct uevent {
     const char *action;
@@ -78,7 +87,24 @@ struct perms_ {
 
 struct perm_node {
     struct perms_ dp;
-    struct listnode plist;
+        /* parse order; later rules override earlier ones */
+    unsigned seq;
+        /* next rule, in parse order, with the same name or prefix */
+    struct perm_node *next;
+};
+
+/* Prefix rules are kept in a byte trie, children as sibling lists. */
+struct perm_trie {
+    struct perm_trie *child;
+    struct perm_trie *sibling;
+    struct perm_node *rules;
+    char c;
+};
+
+/* Rules indexed by name: exact names in a hash, "name*" rules in a trie. */
+struct perm_index {
+    Hashmap *exact;
+    struct perm_trie prefixes;
 };
 
 struct platform_node {
@@ -88,10 +114,93 @@ struct platform_node {
     struct listnode list;
 };
 
-static list_declare(sys_perms);
-static list_declare(dev_perms);
+static struct perm_index sys_perms;
+static struct perm_index dev_perms;
+static unsigned perm_seq;
 static list_declare(platform_names);
 
+static int perm_name_hash(void *key)
+{
+    return hashmapHash(key, strlen(key));
+}
+
+static bool perm_name_equals(void *keyA, void *keyB)
+{
+    return strcmp(keyA, keyB) == 0;
+}
+
+static void append_rule(struct perm_node **list, struct perm_node *node)
+{
+    while (*list)
+        list = &(*list)->next;
+    *list = node;
+}
+
+static int index_perm(struct perm_index *index, const char *key, struct perm_node *node)
+{
+    if (!node->dp.prefix) {
+        struct perm_node *head;
+
+        if (!index->exact) {
+            index->exact = hashmapCreate(64, perm_name_hash, perm_name_equals);
+            if (!index->exact)
+                return -ENOMEM;
+        }
+        head = hashmapGet(index->exact, (void *) key);
+        if (head)
+            append_rule(&head, node);
+        else
+            hashmapPut(index->exact, (void *) key, node);
+    } else {
+        struct perm_trie *t = &index->prefixes;
+
+        for (; *key; key++) {
+            struct perm_trie *c;
+
+            for (c = t->child; c && c->c != *key; c = c->sibling)
+                ;
+            if (!c) {
+                c = calloc(1, sizeof(*c));
+                if (!c)
+                    return -ENOMEM;
+                c->c = *key;
+                c->sibling = t->child;
+                t->child = c;
+            }
+            t = c;
+        }
+        append_rule(&t->rules, node);
+    }
+    return 0;
+}
+
+/* Call func on every rule matching path, in no particular order. */
+static void for_each_matching_perm(struct perm_index *index, const char *path,
+        void (*func)(struct perm_node *node, void *cookie), void *cookie)
+{
+    struct perm_trie *t = &index->prefixes;
+    struct perm_node *node;
+
+    if (index->exact) {
+        for (node = hashmapGet(index->exact, (void *) path); node; node = node->next)
+            func(node, cookie);
+    }
+    for (;;) {
+        struct perm_trie *c;
+
+        for (node = t->rules; node; node = node->next)
+            func(node, cookie);
+        if (!*path)
+            break;
+        for (c = t->child; c && c->c != *path; c = c->sibling)
+            ;
+        if (!c)
+            break;
+        t = c;
+        path++;
+    }
+}
+
 int add_dev_perms(const char *name, const char *attr,
                   mode_t perm, unsigned int uid, unsigned int gid,
                   unsigned short prefix) {
@@ -113,37 +222,64 @@ int add_dev_perms(const char *name, const char *attr,
     node->dp.uid = uid;
     node->dp.gid = gid;
     node->dp.prefix = prefix;
+    node->seq = perm_seq++;
 
-    if (attr)
-        list_add_tail(&sys_perms, &node->plist);
-    else
-        list_add_tail(&dev_perms, &node->plist);
+        /* sys paths in ueventd.rc carry the "/sys" that upaths omit, so
+         * they are indexed without it */
+    if (attr) {
+        if (strncmp(node->dp.name, "/sys", 4))
+            return 0;
+        return index_perm(&sys_perms, node->dp.name + 4, node);
+    }
+    return index_perm(&dev_perms, node->dp.name, node);
+}
 
-    return 0;
+struct sys_perm_matches {
+    struct perm_node **nodes;
+    int count;
+    int capacity;
+};
+
+static void collect_sys_perm(struct perm_node *node, void *cookie)
+{
+    struct sys_perm_matches *matches = cookie;
+
+    if (matches->count == matches->capacity) {
+        int capacity = matches->capacity ? matches->capacity * 2 : 8;
+        struct perm_node **nodes = realloc(matches->nodes, sizeof(*nodes) * capacity);
+        if (!nodes)
+            return;
+        matches->nodes = nodes;
+        matches->capacity = capacity;
+    }
+    matches->nodes[matches->count++] = node;
+}
+
+static int compare_perm_seq(const void *a, const void *b)
+{
+    const struct perm_node *x = *(struct perm_node * const *) a;
+    const struct perm_node *y = *(struct perm_node * const *) b;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
 }
 
 void fixup_sys_perms(const char *upath)
 {
     char buf[512];
-    struct listnode *node;
+    struct sys_perm_matches matches;
     struct perms_ *dp;
     char *secontext;
+    int i;
 
-        /* upaths omit the "/sys" that paths in this list
-         * contain, so we add 4 when comparing...
-         */
-    list_for_each(node, &sys_perms) {
-        dp = &(node_to_item(node, struct perm_node, plist))->dp;
-        if (dp->prefix) {
-            if (strncmp(upath, dp->name + 4, strlen(dp->name + 4)))
-                continue;
-        } else {
-            if (strcmp(upath, dp->name + 4))
-                continue;
-        }
+    memset(&matches, 0, sizeof(matches));
+    for_each_matching_perm(&sys_perms, upath, collect_sys_perm, &matches);
+
+        /* apply every matching rule, in ueventd.rc order */
+    qsort(matches.nodes, matches.count, sizeof(*matches.nodes), compare_perm_seq);
+    for (i = 0; i < matches.count; i++) {
+        dp = &matches.nodes[i]->dp;
 
         if ((strlen(upath) + strlen(dp->attr) + 6) > sizeof(buf))
-            return;
+            break;
 
         sprintf(buf,"/sys%s/%s", upath, dp->attr);
         INFO("fixup %s %d %d 0%o\n", buf, dp->uid, dp->gid, dp->perm);
@@ -158,32 +294,29 @@ void fixup_sys_perms(const char *upath)
            }
         }
     }
+    free(matches.nodes);
+}
+
+static void pick_latest_perm(struct perm_node *node, void *cookie)
+{
+    struct perm_node **best = cookie;
+
+    if (!*best || node->seq > (*best)->seq)
+        *best = node;
 }
 
 static mode_t get_device_perm(const char *path, unsigned *uid, unsigned *gid)
 {
-    mode_t perm;
-    struct listnode *node;
-    struct perm_node *perm_node;
-    struct perms_ *dp;
+    struct perm_node *best = NULL;
 
-    /* search the perms list in reverse so that ueventd.$hardware can
+    /* the last matching rule wins, so that ueventd.$hardware can
      * override ueventd.rc
      */
-    list_for_each_reverse(node, &dev_perms) {
-        perm_node = node_to_item(node, struct perm_node, plist);
-        dp = &perm_node->dp;
-
-        if (dp->prefix) {
-            if (strncmp(path, dp->name, strlen(dp->name)))
-                continue;
-        } else {
-            if (strcmp(path, dp->name))
-                continue;
-        }
-        *uid = dp->uid;
-        *gid = dp->gid;
-        return dp->perm;
+    for_each_matching_perm(&dev_perms, path, pick_latest_perm, &best);
+    if (best) {
+        *uid = best->dp.uid;
+        *gid = best->dp.gid;
+        return best->dp.perm;
     }
     /* Default if nothing found. */
     *uid = 0;
@@ -245,6 +378,9 @@ static void add_platform_device(const char *path)
                 !strncmp(path, bus->path, bus->path_len))
             /* subdevice of an existing platform, ignore it */
             return;
+        if (bus->path_len == path_len && !strcmp(path, bus->path))
+            /* already known, from a coldboot that had to be redone */
+            return;
     }
 
     INFO("adding platform device %s (%s)\n", name, path);
@@ -660,44 +796,190 @@ static void handle_device_event(struct uevent *uevent)
     }
 }
 
-static int load_firmware(int fw_fd, int loading_fd, int data_fd)
+/* Firmware loading.
+**
+** Requests are queued to a small pool of worker threads so that one slow
+** or missing blob does not hold up the uevent loop or other devices.  The
+** image is mmap'd and streamed to the sysfs data file in large writes, and
+** the most recently used images stay mapped so devices that are reset or
+** probed twice during boot do not read them again.
+*/
+
+#define FIRMWARE_THREADS        4
+#define FIRMWARE_WRITE_CHUNK    (256 * 1024)
+#define FIRMWARE_RETRY_MS       100
+#define FIRMWARE_CACHE_ENTRIES  4
+#define FIRMWARE_CACHE_BYTES    (16 * 1024 * 1024)
+
+struct firmware_image {
+    char *name;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    void *data;
+    size_t size;
+    int refs;
+    struct listnode list;
+};
+
+struct firmware_request {
+    char *path;
+    char *firmware;
+    int loading_fd;
+    int data_fd;
+        /* CLOCK_MONOTONIC ms before which a retry should not run */
+    long long not_before;
+    struct listnode list;
+};
+
+static pthread_mutex_t firmware_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t firmware_cond = PTHREAD_COND_INITIALIZER;
+static list_declare(firmware_queue);
+static list_declare(firmware_cache);   /* most recently used last */
+static size_t firmware_cache_bytes;
+static int firmware_cache_count;
+static int firmware_threads;
+static int firmware_idle;
+
+static long long firmware_now_ms(void)
 {
-    struct stat st;
-    long len_to_copy;
-    int ret = 0;
+    struct timespec ts;
 
-    if(fstat(fw_fd, &st) < 0)
-        return -1;
-    len_to_copy = st.st_size;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
-    write(loading_fd, "1", 1);  /* start transfer */
+static void release_firmware_image(struct firmware_image *img)
+{
+    munmap(img->data, img->size);
+    free(img->name);
+    free(img);
+}
 
-    while (len_to_copy > 0) {
-        char buf[PAGE_SIZE];
-        ssize_t nr;
+/* Called with firmware_lock held. */
+static void put_firmware_image(struct firmware_image *img)
+{
+    if (--img->refs == 0)
+        release_firmware_image(img);
+}
+
+/* Called with firmware_lock held.  Drops least recently used images that
+** nobody is writing until the cache is back within its limits.
+*/
+static void trim_firmware_cache(void)
+{
+    struct listnode *node = list_head(&firmware_cache);
+
+    while (node != &firmware_cache &&
+           (firmware_cache_count > FIRMWARE_CACHE_ENTRIES ||
+            firmware_cache_bytes > FIRMWARE_CACHE_BYTES)) {
+        struct firmware_image *img = node_to_item(node, struct firmware_image, list);
+
+        node = node->next;
+        list_remove(&img->list);
+        firmware_cache_count--;
+        firmware_cache_bytes -= img->size;
+        put_firmware_image(img);
+    }
+}
+
+/* Returns a referenced image for name from the cache, provided the file
+** it came from has not changed since, or NULL.
+*/
+static struct firmware_image *lookup_firmware_image(const char *name, const struct stat *st)
+{
+    struct listnode *node;
+
+    pthread_mutex_lock(&firmware_lock);
+    list_for_each(node, &firmware_cache) {
+        struct firmware_image *img = node_to_item(node, struct firmware_image, list);
 
-        nr = read(fw_fd, buf, sizeof(buf));
-        if(!nr)
+        if (strcmp(img->name, name))
+            continue;
+        if (img->dev != st->st_dev || img->ino != st->st_ino ||
+            img->mtime != st->st_mtime || img->size != (size_t) st->st_size)
             break;
-        if(nr < 0) {
-            ret = -1;
+        list_remove(&img->list);
+        list_add_tail(&firmware_cache, &img->list);
+        img->refs++;
+        pthread_mutex_unlock(&firmware_lock);
+        return img;
+    }
+    pthread_mutex_unlock(&firmware_lock);
+    return NULL;
+}
+
+static struct firmware_image *map_firmware_image(const char *name, int fw_fd,
+                                                 const struct stat *st)
+{
+    struct firmware_image *img;
+    struct listnode *node;
+
+    img = calloc(1, sizeof(*img));
+    if (!img)
+        return NULL;
+    img->name = strdup(name);
+    if (!img->name) {
+        free(img);
+        return NULL;
+    }
+    img->dev = st->st_dev;
+    img->ino = st->st_ino;
+    img->mtime = st->st_mtime;
+    img->size = st->st_size;
+    img->data = mmap(NULL, img->size, PROT_READ, MAP_SHARED, fw_fd, 0);
+    if (img->data == MAP_FAILED) {
+        free(img->name);
+        free(img);
+        return NULL;
+    }
+    madvise(img->data, img->size, MADV_SEQUENTIAL);
+    img->refs = 2;  /* the caller's, and the cache's */
+
+    pthread_mutex_lock(&firmware_lock);
+        /* drop a stale image for the same name */
+    list_for_each(node, &firmware_cache) {
+        struct firmware_image *old = node_to_item(node, struct firmware_image, list);
+        if (!strcmp(old->name, name)) {
+            list_remove(&old->list);
+            firmware_cache_count--;
+            firmware_cache_bytes -= old->size;
+            put_firmware_image(old);
             break;
         }
+    }
+    list_add_tail(&firmware_cache, &img->list);
+    firmware_cache_count++;
+    firmware_cache_bytes += img->size;
+    trim_firmware_cache();
+    pthread_mutex_unlock(&firmware_lock);
+    return img;
+}
+
+static int load_firmware(const struct firmware_image *img, int loading_fd, int data_fd)
+{
+    const char *buf = img->data;
+    size_t len_to_copy = img->size;
+    int ret = 0;
 
-        len_to_copy -= nr;
-        while (nr > 0) {
-            ssize_t nw = 0;
+    write(loading_fd, "1", 1);  /* start transfer */
 
-            nw = write(data_fd, buf + nw, nr);
-            if(nw <= 0) {
-                ret = -1;
-                goto out;
-            }
-            nr -= nw;
+    while (len_to_copy > 0) {
+        size_t chunk = len_to_copy < FIRMWARE_WRITE_CHUNK ?
+                       len_to_copy : FIRMWARE_WRITE_CHUNK;
+        ssize_t nw;
+
+        nw = write(data_fd, buf, chunk);
+        if (nw < 0 && errno == EINTR)
+            continue;
+        if (nw <= 0) {
+            ret = -1;
+            break;
         }
+        buf += nw;
+        len_to_copy -= nw;
     }
 
-out:
     if(!ret)
         write(loading_fd, "0", 1);  /* successful end of transfer */
     else
@@ -711,95 +993,154 @@ static int is_booting(void)
     return access("/dev/.booting", F_OK) == 0;
 }
 
-static void process_firmware_event(struct uevent *uevent)
+static int open_firmware(const char *firmware)
 {
-    char *root, *loading, *data, *file1 = NULL, *file2 = NULL, *file3 = NULL;
-    int l, loading_fd, data_fd, fw_fd;
-    int booting = is_booting();
+    static const char *dirs[] = { FIRMWARE_DIR1, FIRMWARE_DIR2, FIRMWARE_DIR3 };
+    char file[PATH_MAX];
+    unsigned i;
+    int fd;
 
-    INFO("firmware: loading '%s' for '%s'\n",
-         uevent->firmware, uevent->path);
+    for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        if (snprintf(file, sizeof(file), "%s/%s", dirs[i], firmware) >= (int) sizeof(file))
+            return -1;
+        fd = open(file, O_RDONLY);
+        if (fd >= 0)
+            return fd;
+    }
+    return -1;
+}
 
-    l = asprintf(&root, SYSFS_PREFIX"%s/", uevent->path);
-    if (l == -1)
-        return;
+static void free_firmware_request(struct firmware_request *req)
+{
+    close(req->data_fd);
+    close(req->loading_fd);
+    free(req->path);
+    free(req->firmware);
+    free(req);
+}
+
+/* Returns 0 when req is done with, or -1 if it should be retried later. */
+static int process_firmware_request(struct firmware_request *req)
+{
+    struct firmware_image *img;
+    struct stat st;
+    int fw_fd;
 
-    l = asprintf(&loading, "%sloading", root);
-    if (l == -1)
-        goto root_free_out;
-
-    l = asprintf(&data, "%sdata", root);
-    if (l == -1)
-        goto loading_free_out;
-
-    l = asprintf(&file1, FIRMWARE_DIR1"/%s", uevent->firmware);
-    if (l == -1)
-        goto data_free_out;
-
-    l = asprintf(&file2, FIRMWARE_DIR2"/%s", uevent->firmware);
-    if (l == -1)
-        goto data_free_out;
-
-    l = asprintf(&file3, FIRMWARE_DIR3"/%s", uevent->firmware);
-    if (l == -1)
-        goto data_free_out;
-
-    loading_fd = open(loading, O_WRONLY);
-    if(loading_fd < 0)
-        goto file_free_out;
-
-    data_fd = open(data, O_WRONLY);
-    if(data_fd < 0)
-        goto loading_close_out;
-
-try_loading_again:
-    fw_fd = open(file1, O_RDONLY);
-    if(fw_fd < 0) {
-        fw_fd = open(file2, O_RDONLY);
-        if (fw_fd < 0) {
-            fw_fd = open(file3, O_RDONLY);
-            if (fw_fd < 0) {
-                if (booting) {
-                        /* If we're not fully booted, we may be missing
-                         * filesystems needed for firmware, wait and retry.
-                         */
-                    usleep(100000);
-                    booting = is_booting();
-                    goto try_loading_again;
+    fw_fd = open_firmware(req->firmware);
+    if (fw_fd < 0) {
+        if (is_booting()) {
+                /* If we're not fully booted, we may be missing
+                 * filesystems needed for firmware, wait and retry.
+                 */
+            return -1;
+        }
+        INFO("firmware: could not open '%s' %d\n", req->firmware, errno);
+        write(req->loading_fd, "-1", 2);
+        return 0;
+    }
+
+    if (fstat(fw_fd, &st) < 0) {
+        write(req->loading_fd, "-1", 2);
+        close(fw_fd);
+        return 0;
+    }
+
+    img = lookup_firmware_image(req->firmware, &st);
+    if (!img)
+        img = map_firmware_image(req->firmware, fw_fd, &st);
+    close(fw_fd);
+
+    if (img && !load_firmware(img, req->loading_fd, req->data_fd))
+        INFO("firmware: copy success { '%s', '%s' }\n", req->path, req->firmware);
+    else {
+        if (!img)
+            write(req->loading_fd, "-1", 2);
+        INFO("firmware: copy failure { '%s', '%s' }\n", req->path, req->firmware);
+    }
+
+    if (img) {
+        pthread_mutex_lock(&firmware_lock);
+        put_firmware_image(img);
+        pthread_mutex_unlock(&firmware_lock);
+    }
+    return 0;
+}
+
+static void *firmware_worker(void *arg)
+{
+    pthread_mutex_lock(&firmware_lock);
+    for (;;) {
+        struct firmware_request *req = NULL;
+        long long now = firmware_now_ms();
+        long long wake = 0;
+        struct listnode *node;
+
+        list_for_each(node, &firmware_queue) {
+            struct firmware_request *r = node_to_item(node, struct firmware_request, list);
+
+            if (r->not_before <= now) {
+                req = r;
+                break;
+            }
+            if (!wake || r->not_before < wake)
+                wake = r->not_before;
+        }
+
+        if (!req) {
+            firmware_idle++;
+            if (wake) {
+                struct timespec ts;
+
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += (wake - now) / 1000;
+                ts.tv_nsec += ((wake - now) % 1000) * 1000000;
+                if (ts.tv_nsec >= 1000000000) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000;
                 }
-                INFO("firmware: could not open '%s' %d\n", uevent->firmware, errno);
-                write(loading_fd, "-1", 2);
-                goto data_close_out;
+                pthread_cond_timedwait(&firmware_cond, &firmware_lock, &ts);
+            } else {
+                pthread_cond_wait(&firmware_cond, &firmware_lock);
             }
+            firmware_idle--;
+            continue;
         }
+
+        list_remove(&req->list);
+        pthread_mutex_unlock(&firmware_lock);
+
+        if (process_firmware_request(req) < 0) {
+            pthread_mutex_lock(&firmware_lock);
+            req->not_before = firmware_now_ms() + FIRMWARE_RETRY_MS;
+            list_add_tail(&firmware_queue, &req->list);
+            continue;
+        }
+        free_firmware_request(req);
+        pthread_mutex_lock(&firmware_lock);
     }
+    return NULL;
+}
 
-    if(!load_firmware(fw_fd, loading_fd, data_fd))
-        INFO("firmware: copy success { '%s', '%s' }\n", root, uevent->firmware);
-    else
-        INFO("firmware: copy failure { '%s', '%s' }\n", root, uevent->firmware);
+/* Called with firmware_lock held. */
+static void start_firmware_worker(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
 
-    close(fw_fd);
-data_close_out:
-    close(data_fd);
-loading_close_out:
-    close(loading_fd);
-file_free_out:
-    free(file1);
-    free(file2);
-    free(file3);
-data_free_out:
-    free(data);
-loading_free_out:
-    free(loading);
-root_free_out:
-    free(root);
+    if (firmware_threads >= FIRMWARE_THREADS)
+        return;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (!pthread_create(&thread, &attr, firmware_worker, NULL))
+        firmware_threads++;
+    pthread_attr_destroy(&attr);
 }
 
 static void handle_firmware_event(struct uevent *uevent)
 {
-    pid_t pid;
-    int ret;
+    struct firmware_request *req;
+    char *root = NULL, *loading = NULL, *data = NULL;
 
     if(strcmp(uevent->subsystem, "firmware"))
         return;
@@ -807,12 +1148,50 @@ static void handle_firmware_event(struct uevent *uevent)
     if(strcmp(uevent->action, "add"))
         return;
 
-    /* we fork, to avoid making large memory allocations in init proper */
-    pid = fork();
-    if (!pid) {
-        process_firmware_event(uevent);
-        exit(EXIT_SUCCESS);
-    }
+    INFO("firmware: loading '%s' for '%s'\n",
+         uevent->firmware, uevent->path);
+
+    req = calloc(1, sizeof(*req));
+    if (!req)
+        return;
+    req->loading_fd = -1;
+    req->data_fd = -1;
+
+    if (asprintf(&root, SYSFS_PREFIX"%s/", uevent->path) == -1)
+        root = NULL;
+    if (!root || asprintf(&loading, "%sloading", root) == -1)
+        loading = NULL;
+    if (!root || asprintf(&data, "%sdata", root) == -1)
+        data = NULL;
+    req->firmware = strdup(uevent->firmware);
+    if (!loading || !data || !req->firmware)
+        goto fail;
+
+    req->loading_fd = open(loading, O_WRONLY | O_CLOEXEC);
+    if (req->loading_fd < 0)
+        goto fail;
+
+    req->data_fd = open(data, O_WRONLY | O_CLOEXEC);
+    if (req->data_fd < 0)
+        goto fail;
+
+    req->path = root;
+    free(loading);
+    free(data);
+
+    pthread_mutex_lock(&firmware_lock);
+    list_add_tail(&firmware_queue, &req->list);
+    if (!firmware_idle)
+        start_firmware_worker();
+    pthread_cond_signal(&firmware_cond);
+    pthread_mutex_unlock(&firmware_lock);
+    return;
+
+fail:
+    req->path = root;
+    free(loading);
+    free(data);
+    free_firmware_request(req);
 }
 
 #define UEVENT_MSG_LEN  1024
@@ -828,11 +1207,15 @@ void handle_device_fd()
         msg[n+1] = '\0';
 
         struct uevent uevent;
+        long long start = boottrace_now();
         parse_event(msg, &uevent);
 
         handle_device_event(&uevent);
         handle_firmware_event(&uevent);
+        boottrace_event2(BOOTTRACE_UEVENT, uevent.action, uevent.path, start);
     }
+    if (n < 0 && errno == ENOBUFS)
+        device_fd_overrun = 1;
 }
 
 /* Coldboot walks parts of the /sys tree and pokes the uevent files
@@ -841,10 +1224,10 @@ void handle_device_fd()
 **
 ** We drain any pending events from the netlink socket every time
 ** we poke another uevent file to make sure we don't overrun the
-** socket's buffer.  
+** socket's buffer, unless another thread is doing the draining.
 */
 
-static void do_coldboot(DIR *d)
+static void do_coldboot(DIR *d, int drain)
 {
     struct dirent *de;
     int dfd, fd;
@@ -855,7 +1238,8 @@ static void do_coldboot(DIR *d)
     if(fd >= 0) {
         write(fd, "add\n", 4);
         close(fd);
-        handle_device_fd();
+        if (drain)
+            handle_device_fd();
     }
 
     while((de = readdir(d))) {
@@ -872,7 +1256,7 @@ static void do_coldboot(DIR *d)
         if(d2 == 0)
             close(fd);
         else {
-            do_coldboot(d2);
+            do_coldboot(d2, drain);
             closedir(d2);
         }
     }
@@ -882,11 +1266,164 @@ static void coldboot(const char *path)
 {
     DIR *d = opendir(path);
     if(d) {
-        do_coldboot(d);
+        do_coldboot(d, 1);
         closedir(d);
     }
 }
 
+/* Parallel coldboot of /sys/devices.
+**
+** Poking a uevent file is synchronous in the kernel and makes up most of
+** the coldboot time, so the subtrees below /sys/devices/<bus>/ are handed
+** to worker threads that only walk and poke.  Every directory is still
+** poked before anything below it, and a whole subtree stays on one
+** worker, so a device's add event always follows its parent's.  The
+** events themselves are handled here on the main thread, in the order
+** the kernel queued them, while the workers run.
+*/
+
+#define COLDBOOT_MAX_THREADS 8
+
+struct coldboot_work {
+    pthread_mutex_t lock;
+    char **paths;
+    int count;
+    int next;
+    int running;
+};
+
+static void *coldboot_worker(void *arg)
+{
+    struct coldboot_work *work = arg;
+
+    for (;;) {
+        char *path = NULL;
+        DIR *d;
+
+        pthread_mutex_lock(&work->lock);
+        if (work->next < work->count)
+            path = work->paths[work->next++];
+        pthread_mutex_unlock(&work->lock);
+        if (!path)
+            break;
+
+        d = opendir(path);
+        if (d) {
+            do_coldboot(d, 0);
+            closedir(d);
+        }
+    }
+
+    pthread_mutex_lock(&work->lock);
+    work->running--;
+    pthread_mutex_unlock(&work->lock);
+    return NULL;
+}
+
+/* Poke path and its children here, and queue its grandchildren. */
+static void coldboot_collect(struct coldboot_work *work, const char *path, int depth)
+{
+    char child[PATH_MAX];
+    struct dirent *de;
+    DIR *d;
+    int fd;
+
+    d = opendir(path);
+    if (!d)
+        return;
+
+    fd = openat(dirfd(d), "uevent", O_WRONLY);
+    if (fd >= 0) {
+        write(fd, "add\n", 4);
+        close(fd);
+    }
+
+    while ((de = readdir(d))) {
+        if (de->d_type != DT_DIR || de->d_name[0] == '.')
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+        if (depth > 0) {
+            coldboot_collect(work, child, depth - 1);
+        } else {
+            char **paths = realloc(work->paths, sizeof(char *) * (work->count + 1));
+            if (!paths)
+                continue;
+            work->paths = paths;
+            work->paths[work->count] = strdup(child);
+            if (work->paths[work->count])
+                work->count++;
+        }
+    }
+    closedir(d);
+}
+
+static void coldboot_parallel(const char *path)
+{
+    struct coldboot_work work;
+    pthread_t threads[COLDBOOT_MAX_THREADS];
+    struct pollfd ufd;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads, i;
+
+    nthreads = ncpus < 2 ? 0 : (ncpus > COLDBOOT_MAX_THREADS ? COLDBOOT_MAX_THREADS : ncpus);
+    if (nthreads == 0) {
+        coldboot(path);
+        return;
+    }
+
+    memset(&work, 0, sizeof(work));
+    pthread_mutex_init(&work.lock, NULL);
+    coldboot_collect(&work, path, 1);
+    handle_device_fd();
+    device_fd_overrun = 0;
+
+    for (i = 0; i < nthreads; i++) {
+        work.running++;
+        if (pthread_create(&threads[i], NULL, coldboot_worker, &work)) {
+            work.running--;
+            break;
+        }
+    }
+    nthreads = i;
+
+    ufd.fd = device_fd;
+    ufd.events = POLLIN;
+    for (;;) {
+        int running;
+
+        pthread_mutex_lock(&work.lock);
+        running = work.running;
+        pthread_mutex_unlock(&work.lock);
+        if (!running)
+            break;
+        if (poll(&ufd, 1, 10) > 0)
+            handle_device_fd();
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    /* anything left over if no worker could be started */
+    for (i = work.next; i < work.count; i++)
+        coldboot(work.paths[i]);
+
+    /* the writes are synchronous, so every event is queued by now */
+    handle_device_fd();
+
+    for (i = 0; i < work.count; i++)
+        free(work.paths[i]);
+    free(work.paths);
+    pthread_mutex_destroy(&work.lock);
+
+    /* The workers outran us and the kernel dropped events.  There is no
+     * telling which, so walk again the slow way, draining after every
+     * write; devices that already exist are simply added again. */
+    if (device_fd_overrun) {
+        ERROR("uevents were dropped during coldboot, redoing %s serially\n", path);
+        device_fd_overrun = 0;
+        coldboot(path);
+    }
+}
+
 void device_init(void)
 {
     suseconds_t t0, t1;
@@ -898,8 +1435,9 @@ void device_init(void)
         sehandle = selinux_android_file_context_handle();
     }
 
-    /* is 256K enough? udev uses 16MB! */
-    device_fd = uevent_open_socket(256*1024, true);
+    /* is 1M enough? udev uses 16MB!  Coldboot workers can queue events
+     * faster than a single poker draining after every write could. */
+    device_fd = uevent_open_socket(1024*1024, true);
     if(device_fd < 0)
         return;
 
@@ -907,14 +1445,16 @@ void device_init(void)
     fcntl(device_fd, F_SETFL, O_NONBLOCK);
 
     if (stat(coldboot_done, &info) < 0) {
+        long long start = boottrace_now();
         t0 = get_usecs();
         coldboot("/sys/class");
         coldboot("/sys/block");
-        coldboot("/sys/devices");
+        coldboot_parallel("/sys/devices");
         t1 = get_usecs();
         fd = open(coldboot_done, O_WRONLY|O_CREAT, 0000);
         close(fd);
         log_event_print("coldboot %ld uS\n", ((long) (t1 - t0)));
+        boottrace_event(BOOTTRACE_COLDBOOT, "", start);
     } else {
         log_event_print("skipping coldboot, already done\n");
     }
@@ -14,9 +14,23 @@ TARBALL=bootchart.tgz
 
 FILES="header proc_stat.log proc_ps.log proc_diskstats.log kernel_pacct"
 
-for f in $FILES; do
+for f in $FILES bootchart.bin; do
     adb pull $LOGROOT/$f $TMPDIR/$f 2>&1 > /dev/null
 done
+
+# recordings made in binary mode are converted back to the usual logs
+if [ -f $TMPDIR/bootchart.bin ]; then
+    bootchart_convert $TMPDIR/bootchart.bin $TMPDIR || exit 1
+fi
 (cd $TMPDIR && tar -czf $TARBALL $FILES)
 cp -f $TMPDIR/$TARBALL ./$TARBALL
 echo "look at $TARBALL"
+
+# init's and ueventd's timelines of the same boot, for bootchart_analyze
+for f in boottrace_init boottrace_ueventd; do
+    adb pull /dev/.$f $TMPDIR/$f 2>&1 > /dev/null
+done
+if [ -f $TMPDIR/boottrace_init ] && which bootchart_analyze > /dev/null 2>&1; then
+    bootchart_analyze $TMPDIR > bootchart_analysis.txt
+    echo "and at bootchart_analysis.txt"
+fi
@@ -24,7 +24,7 @@
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <mtd/mtd-user.h>
@@ -53,6 +53,7 @@
 #include "log.h"
 #include "property_service.h"
 #include "bootchart.h"
+#include "boottrace.h"
 #include "signal_handler.h"
 #include "keychords.h"
 #include "init_parser.h"
@@ -79,10 +80,19 @@ static struct action *cur_action = NULL;
 static struct command *cur_command = NULL;
 static struct listnode *command_queue = NULL;
 
+/*
+ * Pending services are only rechecked when some service has changed state
+ * (that is what "after" waits for), or while any of them waits for a file.
+ */
+static int service_states_changed;
+static int services_waiting_path;
+
 void notify_service_state(const char *name, const char *state)
 {
     char pname[PROP_NAME_MAX];
     int len = strlen(name);
+
+    service_states_changed = 1;
     if ((len + 10) > PROP_NAME_MAX)
         return;
     snprintf(pname, sizeof(pname), "init.svc.%s", name);
@@ -151,6 +161,73 @@ static void publish_socket(const char *name, int fd)
     fcntl(fd, F_SETFD, 0);
 }
 
+/*
+ * A service is ready to start once every service it is "after" is running
+ * (or, for a oneshot, has run and exited) and its "wait_for" file exists.
+ * A missing file stops holding the service back after its timeout.
+ */
+static int service_ready(struct service *svc)
+{
+    struct stat s;
+    int i;
+
+    for (i = 0; i < svc->nr_after; i++) {
+        struct service *dep = service_find_by_name(svc->after[i]);
+
+        if (!dep)
+            continue;
+        if (dep->flags & SVC_ONESHOT) {
+            if ((dep->flags & (SVC_RUNNING|SVC_PENDING)) || !dep->time_started)
+                return 0;
+        } else if (!(dep->flags & SVC_RUNNING)) {
+            return 0;
+        }
+    }
+
+    if (svc->wait_path && stat(svc->wait_path, &s) < 0) {
+        if (!(svc->flags & SVC_PENDING) ||
+                gettime() < svc->pending_since + svc->wait_timeout)
+            return 0;
+        ERROR("timed out waiting for '%s', starting '%s' anyway\n",
+              svc->wait_path, svc->name);
+    }
+    return 1;
+}
+
+/*
+ * Services waiting to be restarted are kept in restart_queue, soonest
+ * first, so the main loop only looks at the ones that are due.
+ */
+static list_declare(restart_queue);
+
+void service_queue_restart(struct service *svc)
+{
+    struct listnode *node;
+
+    if (svc->flags & SVC_RESTARTING)
+        list_remove(&svc->rlist);
+    svc->flags |= SVC_RESTARTING;
+    svc->restart_time = svc->time_started + 5;
+
+    list_for_each(node, &restart_queue) {
+        struct service *s = node_to_item(node, struct service, rlist);
+        if (s->restart_time > svc->restart_time)
+            break;
+    }
+    /* insert before node, or at the tail */
+    list_add_tail(node, &svc->rlist);
+    if (!process_needs_restart || svc->restart_time < process_needs_restart)
+        process_needs_restart = svc->restart_time;
+}
+
+static void service_unqueue_restart(struct service *svc)
+{
+    if (svc->flags & SVC_RESTARTING) {
+        list_remove(&svc->rlist);
+        svc->flags &= (~SVC_RESTARTING);
+    }
+}
+
 void service_start(struct service *svc, const char *dynamic_args)
 {
     struct stat s;
@@ -159,12 +236,14 @@ void service_start(struct service *svc, const char *dynamic_args)
     int n;
     char *scon = NULL;
     int rc;
+    long long start;
 
         /* starting a service removes it from the disabled or reset
          * state and immediately takes it out of the restarting
          * state if it was in there
          */
-    svc->flags &= (~(SVC_DISABLED|SVC_RESTARTING|SVC_RESET|SVC_RESTART));
+    service_unqueue_restart(svc);
+    svc->flags &= (~(SVC_DISABLED|SVC_RESET|SVC_RESTART));
     svc->time_started = 0;
 
         /* running processes require no additional work -- if
@@ -176,6 +255,20 @@ void service_start(struct service *svc, const char *dynamic_args)
         return;
     }
 
+    if (!service_ready(svc)) {
+        if (!(svc->flags & SVC_PENDING)) {
+            INFO("deferring '%s' until its prerequisites are met\n", svc->name);
+            svc->flags |= SVC_PENDING;
+            svc->pending_since = gettime();
+            free(svc->pending_args);
+            svc->pending_args = dynamic_args ? strdup(dynamic_args) : NULL;
+            if (svc->wait_path)
+                services_waiting_path++;
+        }
+        return;
+    }
+    svc->flags &= ~SVC_PENDING;
+
     needs_console = (svc->flags & SVC_CONSOLE) ? 1 : 0;
     if (needs_console && (!have_console)) {
         ERROR("service '%s' requires console\n", svc->name);
@@ -232,6 +325,7 @@ void service_start(struct service *svc, const char *dynamic_args)
 
     NOTICE("starting '%s'\n", svc->name);
 
+    start = boottrace_now();
     pid = fork();
 
     if (pid == 0) {
@@ -347,13 +441,14 @@ void service_start(struct service *svc, const char *dynamic_args)
 
     if (pid < 0) {
         ERROR("failed to start '%s'\n", svc->name);
-        svc->pid = 0;
+        service_set_pid(svc, 0);
         return;
     }
 
     svc->time_started = gettime();
-    svc->pid = pid;
+    service_set_pid(svc, pid);
     svc->flags |= SVC_RUNNING;
+    boottrace_event(BOOTTRACE_SERVICE_START, svc->name, start);
 
     if (properties_inited())
         notify_service_state(svc->name, "running");
@@ -364,7 +459,10 @@ static void service_stop_or_reset(struct service *svc, int how)
 {
     /* The service is still SVC_RUNNING until its process exits, but if it has
      * already exited it shoudn't attempt a restart yet. */
-    svc->flags &= (~SVC_RESTARTING);
+    service_unqueue_restart(svc);
+    svc->flags &= (~SVC_PENDING);
+    free(svc->pending_args);
+    svc->pending_args = NULL;
 
     if ((how != SVC_DISABLED) && (how != SVC_RESET) && (how != SVC_RESTART)) {
         /* Hrm, an illegal flag.  Default to SVC_DISABLED */
@@ -413,29 +511,56 @@ void property_changed(const char *name, const char *value)
 {
     if (property_triggers_enabled)
         queue_property_triggers(name, value);
+
+    if (!strcmp(name, "sys.boot_completed") && !strcmp(value, "1"))
+        boottrace_event(BOOTTRACE_MARK, name, boottrace_now());
+
+    if ((!strcmp(name, "sys.boot_completed") || !strcmp(name, BOOTTRACE_DUMP_PROPERTY)) &&
+        !strcmp(value, "1"))
+        boottrace_dump(BOOTTRACE_INIT_FILE);
 }
 
-static void restart_service_if_needed(struct service *svc)
+static void restart_processes()
 {
-    time_t next_start_time = svc->time_started + 5;
+    time_t now = gettime();
 
-    if (next_start_time <= gettime()) {
-        svc->flags &= (~SVC_RESTARTING);
+    while (!list_empty(&restart_queue)) {
+        struct service *svc = node_to_item(list_head(&restart_queue),
+                                           struct service, rlist);
+        if (svc->restart_time > now)
+            break;
         service_start(svc, NULL);
-        return;
     }
+    process_needs_restart = 0;
+    if (!list_empty(&restart_queue)) {
+        struct service *svc = node_to_item(list_head(&restart_queue),
+                                           struct service, rlist);
+        process_needs_restart = svc->restart_time;
+    }
+}
+
+static void start_pending_service(struct service *svc)
+{
+    char *args;
 
-    if ((next_start_time < process_needs_restart) ||
-        (process_needs_restart == 0)) {
-        process_needs_restart = next_start_time;
+    if (service_ready(svc)) {
+        args = svc->pending_args;
+        svc->pending_args = NULL;
+        svc->flags &= ~SVC_PENDING;
+        service_start(svc, args);
+        free(args);
     }
+    if ((svc->flags & SVC_PENDING) && svc->wait_path)
+        services_waiting_path++;
 }
 
-static void restart_processes()
+static void start_pending_services()
 {
-    process_needs_restart = 0;
-    service_for_each_flags(SVC_RESTARTING,
-                           restart_service_if_needed);
+    if (!service_states_changed && !services_waiting_path)
+        return;
+    service_states_changed = 0;
+    services_waiting_path = 0;
+    service_for_each_flags(SVC_PENDING, start_pending_service);
 }
 
 static void msg_start(const char *name)
@@ -530,6 +655,8 @@ static int is_last_command(struct action *act, struct command *cmd)
 
 void execute_one_command(void)
 {
+    static long long action_start;
+    long long start;
     int ret;
 
     if (!cur_action || !cur_command || is_last_command(cur_action, cur_command)) {
@@ -538,6 +665,7 @@ void execute_one_command(void)
         if (!cur_action)
             return;
         INFO("processing action %p (%s)\n", cur_action, cur_action->name);
+        action_start = boottrace_now();
         cur_command = get_first_command(cur_action);
     } else {
         cur_command = get_next_command(cur_action, cur_command);
@@ -546,8 +674,12 @@ void execute_one_command(void)
     if (!cur_command)
         return;
 
+    start = boottrace_now();
     ret = cur_command->func(cur_command->nargs, cur_command->args);
     INFO("command '%s' r=%d\n", cur_command->args[0], ret);
+    boottrace_event2(BOOTTRACE_COMMAND, cur_action->name, cur_command->args[0], start);
+    if (is_last_command(cur_action, cur_command))
+        boottrace_event(BOOTTRACE_ACTION, cur_action->name, action_start);
 }
 
 static int wait_for_coldboot_done_action(int nargs, char **args)
@@ -638,9 +770,31 @@ ret:
     return result;
 }
 
+/*
+ * The main loop waits on a single epoll set.  Each registered fd carries
+ * the handler that services it, so adding a source does not make every
+ * wakeup more expensive.
+ */
+static int epoll_fd = -1;
+
+void register_epoll_handler(int fd, void (*fn)(void))
+{
+    struct epoll_event ev;
+
+    if (fd < 0)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = (void *) fn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        ERROR("epoll_ctl failed for fd %d: %s\n", fd, strerror(errno));
+}
+
 static int keychord_init_action(int nargs, char **args)
 {
     keychord_init();
+    register_epoll_handler(get_keychord_fd(), handle_keychord);
     return 0;
 }
 
@@ -794,12 +948,14 @@ static int property_service_init_action(int nargs, char **args)
      * that /data/local.prop cannot interfere with them.
      */
     start_property_service();
+    register_epoll_handler(get_property_set_fd(), handle_property_set_fd);
     return 0;
 }
 
 static int signal_init_action(int nargs, char **args)
 {
     signal_init();
+    register_epoll_handler(get_signal_fd(), handle_signal);
     return 0;
 }
 
@@ -961,14 +1117,9 @@ static void selinux_initialize(void)
 
 int main(int argc, char **argv)
 {
-    int fd_count = 0;
-    struct pollfd ufds[4];
     char *tmpdev;
     char* debuggable;
     char tmp[32];
-    int property_set_fd_init = 0;
-    int signal_fd_init = 0;
-    int keychord_fd_init = 0;
     bool is_charger = false;
 
     if (!strcmp(basename(argv[0]), "ueventd"))
@@ -1006,12 +1157,26 @@ int main(int argc, char **argv)
          */
     open_devnull_stdio();
     klog_init();
+
+    epoll_fd = epoll_create(8);
+    if (epoll_fd < 0) {
+        ERROR("epoll_create failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
     property_init();
 
     get_hardware_name(hardware, &revision);
 
     process_kernel_cmdline();
 
+    /* androidboot.klog_buffered=1 batches up the logging of boot */
+    {
+        char value[PROP_VALUE_MAX];
+        if (property_get("ro.boot.klog_buffered", value) && !strcmp(value, "1"))
+            klog_set_buffered(1);
+    }
+
     union selinux_callback cb;
     cb.func_log = klog_write;
     selinux_set_callback(SELINUX_CB_LOG, cb);
@@ -1081,32 +1246,12 @@ int main(int argc, char **argv)
 #endif
 
     for(;;) {
+        struct epoll_event events[8];
         int nr, i, timeout = -1;
 
         execute_one_command();
         restart_processes();
-
-        if (!property_set_fd_init && get_property_set_fd() > 0) {
-            ufds[fd_count].fd = get_property_set_fd();
-            ufds[fd_count].events = POLLIN;
-            ufds[fd_count].revents = 0;
-            fd_count++;
-            property_set_fd_init = 1;
-        }
-        if (!signal_fd_init && get_signal_fd() > 0) {
-            ufds[fd_count].fd = get_signal_fd();
-            ufds[fd_count].events = POLLIN;
-            ufds[fd_count].revents = 0;
-            fd_count++;
-            signal_fd_init = 1;
-        }
-        if (!keychord_fd_init && get_keychord_fd() > 0) {
-            ufds[fd_count].fd = get_keychord_fd();
-            ufds[fd_count].events = POLLIN;
-            ufds[fd_count].revents = 0;
-            fd_count++;
-            keychord_fd_init = 1;
-        }
+        start_pending_services();
 
         if (process_needs_restart) {
             timeout = (process_needs_restart - gettime()) * 1000;
@@ -1114,6 +1259,10 @@ int main(int argc, char **argv)
                 timeout = 0;
         }
 
+        /* wait_for files are polled, like the wait command does */
+        if (services_waiting_path && (timeout < 0 || timeout > PENDING_POLL_MS))
+            timeout = PENDING_POLL_MS;
+
         if (!action_queue_empty() || cur_action)
             timeout = 0;
 
@@ -1128,19 +1277,15 @@ int main(int argc, char **argv)
         }
 #endif
 
-        nr = poll(ufds, fd_count, timeout);
+        if (timeout != 0)
+            klog_flush();
+        nr = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), timeout);
         if (nr <= 0)
             continue;
 
-        for (i = 0; i < fd_count; i++) {
-            if (ufds[i].revents == POLLIN) {
-                if (ufds[i].fd == get_property_set_fd())
-                    handle_property_set_fd();
-                else if (ufds[i].fd == get_keychord_fd())
-                    handle_keychord();
-                else if (ufds[i].fd == get_signal_fd())
-                    handle_signal();
-            }
+        for (i = 0; i < nr; i++) {
+            if (events[i].events & EPOLLIN)
+                ((void (*)(void)) events[i].data.ptr)();
         }
     }
 
@@ -43,6 +43,8 @@ struct action {
 
     unsigned hash;
     const char *name;
+        /* next "property:" action on the same property name */
+    struct action *prop_next;
     
     struct listnode commands;
     struct command *current;
@@ -73,10 +75,12 @@ struct svcenvinfo {
                                  so it can be restarted with its class */
 #define SVC_RC_DISABLED 0x80  /* Remember if the disabled flag was set in the rc script */
 #define SVC_RESTART     0x100 /* Use to safely restart (stop, wait, start) a service */
+#define SVC_PENDING     0x200 /* started, but waiting for its prerequisites */
 
 #define NR_SVC_SUPP_GIDS 12    /* twelve supplementary groups */
 
 #define COMMAND_RETRY_TIMEOUT 5
+#define PENDING_POLL_MS 10    /* how often pending services recheck wait_for */
 
 struct service {
         /* list of all services */
@@ -90,6 +94,10 @@ struct service {
     time_t time_started;    /* time of last start */
     time_t time_crashed;    /* first crash within inspection window */
     int nr_crashed;         /* number of times crashed within window */
+
+        /* restart queue, ordered by restart_time, while SVC_RESTARTING */
+    struct listnode rlist;
+    time_t restart_time;
     
     uid_t uid;
     gid_t gid;
@@ -111,6 +119,16 @@ struct service {
     int ioprio_class;
     int ioprio_pri;
 
+    /* Prerequisites from the "after" and "wait_for" options.  A service
+     * whose prerequisites are unmet when it is started stays SVC_PENDING,
+     * and the main loop starts it once they are met. */
+    char **after;
+    int nr_after;
+    const char *wait_path;
+    int wait_timeout;
+    time_t pending_since;
+    char *pending_args;
+
     int nargs;
     /* "MUST BE AT THE END OF THE STRUCT" */
     char *args[1];
@@ -120,6 +138,11 @@ void notify_service_state(const char *name, const char *state);
 
 struct service *service_find_by_name(const char *name);
 struct service *service_find_by_pid(pid_t pid);
+void service_set_pid(struct service *svc, pid_t pid);
+void service_queue_restart(struct service *svc);
+
+/* Calls fn from the main loop whenever fd is readable. */
+void register_epoll_handler(int fd, void (*fn)(void));
 struct service *service_find_by_keychord(int keychord_id);
 void service_for_each(void (*func)(struct service *svc));
 void service_for_each_class(const char *classname,
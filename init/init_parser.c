@@ -21,15 +21,20 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "init.h"
 #include "parser.h"
 #include "init_parser.h"
 #include "log.h"
+#include "rc_cache.h"
 #include "property_service.h"
 #include "util.h"
 
+#include <cutils/hashmap.h>
 #include <cutils/iosched_policy.h>
 #include <cutils/list.h>
 
@@ -76,95 +81,41 @@ struct {
 #define kw_func(kw) (keyword_info[kw].func)
 #define kw_nargs(kw) (keyword_info[kw].nargs)
 
+/*
+ * Keyword names in strcmp order, built from keyword_info on first use so
+ * that each token costs a binary search rather than a chain of strcmps.
+ */
+static unsigned char sorted_keywords[KEYWORD_COUNT - 1];
+
+static int compare_keywords(const void *a, const void *b)
+{
+    return strcmp(kw_name(*(const unsigned char *) a),
+                  kw_name(*(const unsigned char *) b));
+}
+
 int lookup_keyword(const char *s)
 {
-    switch (*s++) {
-    case 'c':
-    if (!strcmp(s, "opy")) return K_copy;
-        if (!strcmp(s, "apability")) return K_capability;
-        if (!strcmp(s, "hdir")) return K_chdir;
-        if (!strcmp(s, "hroot")) return K_chroot;
-        if (!strcmp(s, "lass")) return K_class;
-        if (!strcmp(s, "lass_start")) return K_class_start;
-        if (!strcmp(s, "lass_stop")) return K_class_stop;
-        if (!strcmp(s, "lass_reset")) return K_class_reset;
-        if (!strcmp(s, "onsole")) return K_console;
-        if (!strcmp(s, "hown")) return K_chown;
-        if (!strcmp(s, "hmod")) return K_chmod;
-        if (!strcmp(s, "ritical")) return K_critical;
-        break;
-    case 'd':
-        if (!strcmp(s, "isabled")) return K_disabled;
-        if (!strcmp(s, "omainname")) return K_domainname;
-        break;
-    case 'e':
-        if (!strcmp(s, "xec")) return K_exec;
-        if (!strcmp(s, "xport")) return K_export;
-        break;
-    case 'g':
-        if (!strcmp(s, "roup")) return K_group;
-        break;
-    case 'h':
-        if (!strcmp(s, "ostname")) return K_hostname;
-        break;
-    case 'i':
-        if (!strcmp(s, "oprio")) return K_ioprio;
-        if (!strcmp(s, "fup")) return K_ifup;
-        if (!strcmp(s, "nsmod")) return K_insmod;
-        if (!strcmp(s, "mport")) return K_import;
-        break;
-    case 'k':
-        if (!strcmp(s, "eycodes")) return K_keycodes;
-        break;
-    case 'l':
-        if (!strcmp(s, "oglevel")) return K_loglevel;
-        if (!strcmp(s, "oad_persist_props")) return K_load_persist_props;
-        break;
-    case 'm':
-        if (!strcmp(s, "kdir")) return K_mkdir;
-        if (!strcmp(s, "ount_all")) return K_mount_all;
-        if (!strcmp(s, "ount")) return K_mount;
-        break;
-    case 'o':
-        if (!strcmp(s, "n")) return K_on;
-        if (!strcmp(s, "neshot")) return K_oneshot;
-        if (!strcmp(s, "nrestart")) return K_onrestart;
-        break;
-    case 'p':
-        if (!strcmp(s, "owerctl")) return K_powerctl;
-    case 'r':
-        if (!strcmp(s, "estart")) return K_restart;
-        if (!strcmp(s, "estorecon")) return K_restorecon;
-        if (!strcmp(s, "mdir")) return K_rmdir;
-        if (!strcmp(s, "m")) return K_rm;
-        break;
-    case 's':
-        if (!strcmp(s, "eclabel")) return K_seclabel;
-        if (!strcmp(s, "ervice")) return K_service;
-        if (!strcmp(s, "etcon")) return K_setcon;
-        if (!strcmp(s, "etenforce")) return K_setenforce;
-        if (!strcmp(s, "etenv")) return K_setenv;
-        if (!strcmp(s, "etkey")) return K_setkey;
-        if (!strcmp(s, "etprop")) return K_setprop;
-        if (!strcmp(s, "etrlimit")) return K_setrlimit;
-        if (!strcmp(s, "etsebool")) return K_setsebool;
-        if (!strcmp(s, "ocket")) return K_socket;
-        if (!strcmp(s, "tart")) return K_start;
-        if (!strcmp(s, "top")) return K_stop;
-        if (!strcmp(s, "wapon_all")) return K_swapon_all;
-        if (!strcmp(s, "ymlink")) return K_symlink;
-        if (!strcmp(s, "ysclktz")) return K_sysclktz;
-        break;
-    case 't':
-        if (!strcmp(s, "rigger")) return K_trigger;
-        break;
-    case 'u':
-        if (!strcmp(s, "ser")) return K_user;
-        break;
-    case 'w':
-        if (!strcmp(s, "rite")) return K_write;
-        if (!strcmp(s, "ait")) return K_wait;
-        break;
+    int lo = 0, hi = KEYWORD_COUNT - 1;
+
+    if (!sorted_keywords[0]) {
+        int kw;
+        for (kw = K_UNKNOWN + 1; kw < KEYWORD_COUNT; kw++)
+            sorted_keywords[kw - 1] = kw;
+        qsort(sorted_keywords, KEYWORD_COUNT - 1, sizeof(sorted_keywords[0]),
+              compare_keywords);
+    }
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int kw = sorted_keywords[mid];
+        int cmp = strcmp(s, kw_name(kw));
+
+        if (!cmp)
+            return kw;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
     return K_UNKNOWN;
 }
@@ -344,11 +295,37 @@ void parse_new_section(struct parse_state *state, int kw,
     state->parse_line = parse_line_no_op;
 }
 
+static void parse_config_line(struct parse_state *state, int nargs, char **args)
+{
+    int kw = lookup_keyword(args[0]);
+    if (kw_is(kw, SECTION)) {
+        state->parse_line(state, 0, 0);
+        parse_new_section(state, kw, nargs, args);
+    } else {
+        state->parse_line(state, nargs, args);
+    }
+}
+
+static void parse_config_imports(const char *fn, struct listnode *import_list)
+{
+    struct listnode *node;
+
+    list_for_each(node, import_list) {
+         struct import *import = node_to_item(node, struct import, list);
+         int ret;
+
+         INFO("importing '%s'", import->filename);
+         ret = init_parse_config_file(import->filename);
+         if (ret)
+             ERROR("could not import file '%s' from '%s'\n",
+                   import->filename, fn);
+    }
+}
+
 static void parse_config(const char *fn, char *s)
 {
     struct parse_state state;
     struct listnode import_list;
-    struct listnode *node;
     char *args[INIT_PARSER_MAXARGS];
     int nargs;
 
@@ -370,13 +347,7 @@ static void parse_config(const char *fn, char *s)
         case T_NEWLINE:
             state.line++;
             if (nargs) {
-                int kw = lookup_keyword(args[0]);
-                if (kw_is(kw, SECTION)) {
-                    state.parse_line(&state, 0, 0);
-                    parse_new_section(&state, kw, nargs, args);
-                } else {
-                    state.parse_line(&state, nargs, args);
-                }
+                parse_config_line(&state, nargs, args);
                 nargs = 0;
             }
             break;
@@ -389,25 +360,107 @@ static void parse_config(const char *fn, char *s)
     }
 
 parser_done:
-    list_for_each(node, &import_list) {
-         struct import *import = node_to_item(node, struct import, list);
-         int ret;
+    parse_config_imports(fn, &import_list);
+}
 
-         INFO("importing '%s'", import->filename);
-         ret = init_parse_config_file(import->filename);
-         if (ret)
-             ERROR("could not import file '%s' from '%s'\n",
-                   import->filename, fn);
+/* Walk the lines of a cache image; with state NULL only checks it is intact. */
+static int parse_cache_lines(const char *image, unsigned size, struct parse_state *state)
+{
+    const struct rc_cache_header *header = (const void *) image;
+    char *args[INIT_PARSER_MAXARGS];
+    unsigned pos = sizeof(*header);
+    uint32_t i, line, nargs, n;
+
+    for (i = 0; i < header->nlines; i++) {
+        if (size - pos < 2 * sizeof(uint32_t))
+            return -1;
+        memcpy(&line, image + pos, sizeof(line));
+        memcpy(&nargs, image + pos + sizeof(line), sizeof(nargs));
+        pos += 2 * sizeof(uint32_t);
+        if (nargs == 0 || nargs > INIT_PARSER_MAXARGS)
+            return -1;
+        for (n = 0; n < nargs; n++) {
+            const char *end = memchr(image + pos, 0, size - pos);
+            if (!end)
+                return -1;
+            args[n] = (char *) image + pos;
+            pos = end - image + 1;
+        }
+        if (state) {
+            state->line = line;
+            parse_config_line(state, nargs, args);
+        }
     }
+    return pos == size ? 0 : -1;
+}
+
+/*
+ * Load fn from its pre-tokenized image if there is one built from exactly
+ * this text.  The image is mapped privately and never unmapped: parsed
+ * services and actions point straight into it, as they would into the text.
+ */
+static int parse_config_cached(const char *fn, const char *text, unsigned text_size)
+{
+    char cache_fn[PATH_MAX];
+    const struct rc_cache_header *header;
+    struct parse_state state;
+    struct listnode import_list;
+    struct stat sb;
+    char *image;
+    int fd;
+
+    snprintf(cache_fn, sizeof(cache_fn), "%s%s", fn, RC_CACHE_SUFFIX);
+    fd = open(cache_fn, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    /* same rule as read_file(): never trust group or world writable files */
+    if (fstat(fd, &sb) < 0 || (sb.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+            sb.st_size < (off_t) sizeof(*header)) {
+        close(fd);
+        return -1;
+    }
+    image = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return -1;
+
+    header = (const void *) image;
+    if (header->magic != RC_CACHE_MAGIC ||
+            header->source_size != text_size ||
+            header->source_hash != rc_cache_hash(text, text_size) ||
+            parse_cache_lines(image, sb.st_size, NULL) < 0) {
+        ERROR("ignoring stale or damaged '%s'\n", cache_fn);
+        munmap(image, sb.st_size);
+        return -1;
+    }
+
+    state.filename = fn;
+    state.line = 0;
+    state.ptr = 0;
+    state.nexttoken = 0;
+    state.parse_line = parse_line_no_op;
+
+    list_init(&import_list);
+    state.priv = &import_list;
+
+    parse_cache_lines(image, sb.st_size, &state);
+    state.parse_line(&state, 0, 0);
+    parse_config_imports(fn, &import_list);
+    return 0;
 }
 
 int init_parse_config_file(const char *fn)
 {
     char *data;
-    data = read_file(fn, 0);
+    unsigned size;
+    data = read_file(fn, &size);
     if (!data) return -1;
 
-    parse_config(fn, data);
+    if (parse_config_cached(fn, data, size) == 0) {
+        free(data);
+    } else {
+        parse_config(fn, data);
+    }
     DUMP();
     return 0;
 }
@@ -439,10 +492,45 @@ struct service *service_find_by_name(const char *name)
     return 0;
 }
 
+/* Running services, indexed by pid so SIGCHLD handling does not scan
+ * service_list for every reaped child. */
+static Hashmap *services_by_pid;
+
+static int pid_hash(void *key)
+{
+    return (int) (intptr_t) key;
+}
+
+static bool pid_equals(void *keyA, void *keyB)
+{
+    return keyA == keyB;
+}
+
+void service_set_pid(struct service *svc, pid_t pid)
+{
+    if (!services_by_pid) {
+        services_by_pid = hashmapCreate(64, pid_hash, pid_equals);
+        if (!services_by_pid) {
+            ERROR("cannot allocate the service pid index\n");
+            svc->pid = pid;
+            return;
+        }
+    }
+    if (svc->pid)
+        hashmapRemove(services_by_pid, (void *) (intptr_t) svc->pid);
+    svc->pid = pid;
+    if (pid)
+        hashmapPut(services_by_pid, (void *) (intptr_t) pid, svc);
+}
+
 struct service *service_find_by_pid(pid_t pid)
 {
     struct listnode *node;
     struct service *svc;
+
+    if (services_by_pid)
+        return hashmapGet(services_by_pid, (void *) (intptr_t) pid);
+
     list_for_each(node, &service_list) {
         svc = node_to_item(node, struct service, slist);
         if (svc->pid == pid) {
@@ -475,14 +563,55 @@ void service_for_each(void (*func)(struct service *svc))
     }
 }
 
+static int string_hash(void *key)
+{
+    return hashmapHash(key, strlen(key));
+}
+
+static bool string_equals(void *keyA, void *keyB)
+{
+    return strcmp(keyA, keyB) == 0;
+}
+
+/*
+ * Service class names are interned, so that matching a class is a pointer
+ * comparison and a class that no service uses is found without a scan.
+ */
+static Hashmap *class_names;
+
+static const char *intern_class_name(const char *name)
+{
+    const char *interned;
+
+    if (!class_names) {
+        class_names = hashmapCreate(16, string_hash, string_equals);
+        if (!class_names)
+            return NULL;
+    }
+    interned = hashmapGet(class_names, (void *) name);
+    if (!interned) {
+        interned = strdup(name);
+        if (!interned)
+            return NULL;
+        hashmapPut(class_names, (void *) interned, (void *) interned);
+    }
+    return interned;
+}
+
 void service_for_each_class(const char *classname,
                             void (*func)(struct service *svc))
 {
     struct listnode *node;
     struct service *svc;
+
+    if (class_names) {
+        classname = hashmapGet(class_names, (void *) classname);
+        if (!classname)
+            return;
+    }
     list_for_each(node, &service_list) {
         svc = node_to_item(node, struct service, slist);
-        if (!strcmp(svc->classname, classname)) {
+        if (svc->classname == classname) {
             func(svc);
         }
     }
@@ -514,22 +643,53 @@ void action_for_each_trigger(const char *trigger,
     }
 }
 
+/*
+ * "on property:<name>=<value>" actions, indexed by <name>.  Each entry is
+ * the first such action in action_list order, chained through prop_next.
+ */
+static Hashmap *property_triggers;
+
+static void index_property_trigger(struct action *act)
+{
+    const char *name = act->name + strlen("property:");
+    const char *equals = strchr(name, '=');
+    struct action *head;
+    char *key;
+
+    if (!equals)
+        return;
+    if (!property_triggers) {
+        property_triggers = hashmapCreate(64, string_hash, string_equals);
+        if (!property_triggers)
+            return;
+    }
+    key = strndup(name, equals - name);
+    if (!key)
+        return;
+
+    head = hashmapGet(property_triggers, key);
+    if (!head) {
+        hashmapPut(property_triggers, key, act);
+        return;
+    }
+    free(key);
+    while (head->prop_next)
+        head = head->prop_next;
+    head->prop_next = act;
+}
+
 void queue_property_triggers(const char *name, const char *value)
 {
-    struct listnode *node;
     struct action *act;
-    list_for_each(node, &action_list) {
-        act = node_to_item(node, struct action, alist);
-        if (!strncmp(act->name, "property:", strlen("property:"))) {
-            const char *test = act->name + strlen("property:");
-            int name_length = strlen(name);
-
-            if (!strncmp(name, test, name_length) &&
-                    test[name_length] == '=' &&
-                    (!strcmp(test + name_length + 1, value) ||
-                     !strcmp(test + name_length + 1, "*"))) {
-                action_add_queue_tail(act);
-            }
+    int name_length = strlen(name);
+
+    if (!property_triggers)
+        return;
+    for (act = hashmapGet(property_triggers, (void *) name); act; act = act->prop_next) {
+        const char *test = act->name + strlen("property:") + name_length + 1;
+
+        if (!strcmp(test, value) || !strcmp(test, "*")) {
+            action_add_queue_tail(act);
         }
     }
 }
@@ -635,7 +795,11 @@ static void *parse_service(struct parse_state *state, int nargs, char **args)
         return 0;
     }
     svc->name = args[1];
-    svc->classname = "default";
+    svc->classname = intern_class_name("default");
+    if (!svc->classname) {
+        parse_error(state, "out of memory\n");
+        return 0;
+    }
     memcpy(svc->args, args + 2, sizeof(char*) * nargs);
     svc->args[nargs] = 0;
     svc->nargs = nargs;
@@ -665,7 +829,11 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
         if (nargs != 2) {
             parse_error(state, "class option requires a classname\n");
         } else {
-            svc->classname = args[1];
+            const char *classname = intern_class_name(args[1]);
+            if (classname)
+                svc->classname = classname;
+            else
+                parse_error(state, "out of memory\n");
         }
         break;
     case K_console:
@@ -675,6 +843,20 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
         svc->flags |= SVC_DISABLED;
         svc->flags |= SVC_RC_DISABLED;
         break;
+    case K_after:
+        if (nargs < 2) {
+            parse_error(state, "after option requires a service name\n");
+        } else {
+            svc->after = malloc(sizeof(char*) * (nargs - 1));
+            if (!svc->after) {
+                parse_error(state, "out of memory\n");
+                break;
+            }
+            for (i = 1; i < nargs; i++)
+                svc->after[i - 1] = args[i];
+            svc->nr_after = nargs - 1;
+        }
+        break;
     case K_ioprio:
         if (nargs != 3) {
             parse_error(state, "ioprio optin usage: ioprio <rt|be|idle> <ioprio 0-7>\n");
@@ -805,6 +987,14 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
             svc->uid = decode_uid(args[1]);
         }
         break;
+    case K_wait_for:
+        if (nargs != 2 && nargs != 3) {
+            parse_error(state, "wait_for option usage: wait_for <path> [ <timeout> ]\n");
+        } else {
+            svc->wait_path = args[1];
+            svc->wait_timeout = (nargs == 3) ? atoi(args[2]) : COMMAND_RETRY_TIMEOUT;
+        }
+        break;
     case K_seclabel:
         if (nargs != 2) {
             parse_error(state, "seclabel option requires a label string\n");
@@ -834,7 +1024,8 @@ static void *parse_action(struct parse_state *state, int nargs, char **args)
     list_init(&act->commands);
     list_init(&act->qlist);
     list_add_tail(&action_list, &act->alist);
-        /* XXX add to hash */
+    if (!strncmp(act->name, "property:", strlen("property:")))
+        index_property_trigger(act);
     return act;
 }
 
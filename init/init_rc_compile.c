@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host tool that turns an .rc file into the pre-tokenized image init
+ * loads instead of re-parsing the text, see rc_cache.h.
+ *
+ *     init_rc_compile <file.rc> [<output>]
+ *
+ * The output defaults to <file.rc>.bin.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "rc_cache.h"
+
+/* parser.c reports errors through klog, which only exists on the device. */
+void klog_write(int level, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+int main(int argc, char **argv)
+{
+    char outname[4096];
+    struct stat sb;
+    char *text, *image;
+    unsigned image_size;
+    FILE *f;
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: init_rc_compile <file.rc> [<output>]\n");
+        return 1;
+    }
+    snprintf(outname, sizeof(outname), "%s", argc == 3 ? argv[2] : argv[1]);
+    if (argc == 2)
+        strncat(outname, RC_CACHE_SUFFIX, sizeof(outname) - strlen(outname) - 1);
+
+    f = fopen(argv[1], "rb");
+    if (!f || fstat(fileno(f), &sb) < 0) {
+        fprintf(stderr, "init_rc_compile: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    /* Terminated the way init's read_file() leaves it. */
+    text = malloc(sb.st_size + 2);
+    if (!text || fread(text, 1, sb.st_size, f) != (size_t) sb.st_size) {
+        fprintf(stderr, "init_rc_compile: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+    text[sb.st_size] = '\n';
+    text[sb.st_size + 1] = 0;
+
+    if (rc_cache_compile(argv[1], text, sb.st_size, &image, &image_size)) {
+        fprintf(stderr, "init_rc_compile: out of memory\n");
+        return 1;
+    }
+
+    f = fopen(outname, "wb");
+    if (!f || fwrite(image, 1, image_size, f) != image_size || fclose(f)) {
+        fprintf(stderr, "init_rc_compile: cannot write %s\n", outname);
+        return 1;
+    }
+    return 0;
+}
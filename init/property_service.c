@@ -24,10 +24,13 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include <cutils/misc.h>
 #include <cutils/sockets.h>
 #include <cutils/multiuser.h>
+#include <cutils/hashmap.h>
+#include <cutils/properties.h>
 
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
@@ -35,6 +38,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/mman.h>
@@ -130,6 +134,43 @@ static int init_workspace(workspace *w, size_t size)
 
 static workspace pa_workspace;
 
+/*
+ * init is the only writer of the property area, so every prop_info it
+ * ever sees stays valid for the life of the process.  Remember them by
+ * name so sets and gets from init skip the walk through the shared area.
+ */
+static Hashmap *prop_index;
+
+static int prop_name_hash(void *key)
+{
+    return hashmapHash(key, strlen(key));
+}
+
+static bool prop_name_equals(void *keyA, void *keyB)
+{
+    return strcmp(keyA, keyB) == 0;
+}
+
+static const prop_info *find_property(const char *name)
+{
+    const prop_info *pi;
+    char *key;
+
+    if (prop_index) {
+        pi = hashmapGet(prop_index, (void *) name);
+        if (pi)
+            return pi;
+    }
+
+    pi = __system_property_find(name);
+    if (pi && prop_index) {
+        key = strdup(name);
+        if (key)
+            hashmapPut(prop_index, key, (void *) pi);
+    }
+    return pi;
+}
+
 static int init_property_area(void)
 {
     if (property_area_inited)
@@ -138,6 +179,8 @@ static int init_property_area(void)
     if(__system_property_area_init())
         return -1;
 
+    prop_index = hashmapCreate(1024, prop_name_hash, prop_name_equals);
+
     if(init_workspace(&pa_workspace, 0))
         return -1;
 
@@ -251,28 +294,272 @@ static int check_perms(const char *name, unsigned int uid, unsigned int gid, cha
 
 int __property_get(const char *name, char *value)
 {
-    return __system_property_get(name, value);
+    const prop_info *pi = find_property(name);
+
+    if (!pi) {
+        value[0] = 0;
+        return 0;
+    }
+    return __system_property_read(pi, 0, value);
 }
 
-static void write_persistent_property(const char *name, const char *value)
+/*
+ * Persistent properties live in a single append-only journal,
+ * PERSISTENT_PROPERTY_STORE.  Each set appends one checksummed record,
+ * and at boot the journal is replayed front to back so the last record
+ * for a name wins.  A torn record at the tail (power loss mid-append)
+ * fails its checksum and is cut off.  Once the journal has grown well
+ * past the live data, or would grow past PERSIST_STORE_MAX, it is
+ * rewritten from the property area into a temp file and renamed over the
+ * old one.  A store that can't be loaded at all is moved aside to
+ * PERSISTENT_PROPERTY_STORE_BAD and rewritten the same way, so that what
+ * is set from then on is not appended to a file nobody will read.
+ */
+#define PERSISTENT_PROPERTY_STORE  PERSISTENT_PROPERTY_DIR "/persistent_properties"
+#define PERSISTENT_PROPERTY_STORE_BAD  PERSISTENT_PROPERTY_STORE ".bad"
+#define PERSIST_MAGIC        0x31535050  /* "PPS1" */
+#define PERSIST_STORE_MAX    (1024 * 1024)
+#define PERSIST_COMPACT_MIN  (32 * 1024)
+
+struct persist_record {
+    uint8_t name_len;
+    uint8_t value_len;
+    uint16_t reserved;
+    uint32_t checksum;
+    /* followed by name_len bytes of name and value_len bytes of value */
+};
+
+#define PERSIST_RECORD_MAX  (sizeof(struct persist_record) + PROP_NAME_MAX + PROP_VALUE_MAX)
+
+static int persist_fd = -1;
+static size_t persist_size;
+static size_t persist_compacted_size;
+static int persist_store_valid;     /* loaded or written by us */
+
+/* Records queued while a batch of sets is in progress, see persist_batch_end(). */
+static int persist_batching;
+static char *persist_pending;
+static size_t persist_pending_len;
+static size_t persist_pending_cap;
+
+static uint32_t persist_checksum(const struct persist_record *r,
+        const char *name, const char *value)
 {
-    char tempPath[PATH_MAX];
-    char path[PATH_MAX];
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    hash = (hash ^ r->name_len) * 16777619u;
+    hash = (hash ^ r->value_len) * 16777619u;
+    for (i = 0; i < r->name_len; i++)
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    for (i = 0; i < r->value_len; i++)
+        hash = (hash ^ (uint8_t) value[i]) * 16777619u;
+    return hash;
+}
+
+static size_t persist_encode(char *buf, const char *name, const char *value)
+{
+    struct persist_record r;
+
+    memset(&r, 0, sizeof(r));
+    r.name_len = strlen(name);
+    r.value_len = strlen(value);
+    r.checksum = persist_checksum(&r, name, value);
+    memcpy(buf, &r, sizeof(r));
+    memcpy(buf + sizeof(r), name, r.name_len);
+    memcpy(buf + sizeof(r) + r.name_len, value, r.value_len);
+    return sizeof(r) + r.name_len + r.value_len;
+}
+
+static int write_fully(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, buf, len));
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Names that have ever been written to the store; only these belong in a
+ * compacted journal, not persist.* defaults from the build. */
+static Hashmap *persist_names;
+
+static void persist_note_name(const char *name)
+{
+    char *key;
+
+    if (!persist_names)
+        persist_names = hashmapCreate(64, prop_name_hash, prop_name_equals);
+    if (!persist_names || hashmapContainsKey(persist_names, (void *) name))
+        return;
+    key = strdup(name);
+    if (key)
+        hashmapPut(persist_names, key, key);
+}
+
+struct persist_compact_state {
     int fd;
+    size_t size;
+    int error;
+};
+
+static bool persist_compact_one(void *key, void *unused, void *cookie)
+{
+    struct persist_compact_state *state = cookie;
+    const prop_info *pi = find_property(key);
+    char value[PROP_VALUE_MAX];
+    char buf[PERSIST_RECORD_MAX];
+    size_t len;
+
+    if (!pi)
+        return true;
+    __system_property_read(pi, 0, value);
+    len = persist_encode(buf, key, value);
+    if (write_fully(state->fd, buf, len) < 0) {
+        state->error = errno;
+        return false;
+    }
+    state->size += len;
+    return true;
+}
+
+/* Rewrite the journal with one record per persisted property. */
+static int persist_compact(void)
+{
+    char tempPath[PATH_MAX];
+    struct persist_compact_state state;
+    uint32_t magic = PERSIST_MAGIC;
 
     snprintf(tempPath, sizeof(tempPath), "%s/.temp.XXXXXX", PERSISTENT_PROPERTY_DIR);
-    fd = mkstemp(tempPath);
-    if (fd < 0) {
-        ERROR("Unable to write persistent property to temp file %s errno: %d\n", tempPath, errno);
+    state.fd = mkstemp(tempPath);
+    if (state.fd < 0) {
+        ERROR("Unable to write persistent property store to temp file %s errno: %d\n",
+              tempPath, errno);
+        return -1;
+    }
+    state.size = sizeof(magic);
+    state.error = 0;
+    if (write_fully(state.fd, (char *) &magic, sizeof(magic)) < 0)
+        state.error = errno;
+    if (!state.error && persist_names)
+        hashmapForEach(persist_names, persist_compact_one, &state);
+    if (!state.error && fsync(state.fd) < 0)
+        state.error = errno;
+    close(state.fd);
+
+    if (state.error || rename(tempPath, PERSISTENT_PROPERTY_STORE)) {
+        ERROR("Unable to replace persistent property store errno: %d\n",
+              state.error ? state.error : errno);
+        unlink(tempPath);
+        return -1;
+    }
+
+    if (persist_fd >= 0)
+        close(persist_fd);
+    persist_fd = open(PERSISTENT_PROPERTY_STORE, O_WRONLY | O_APPEND | O_NOFOLLOW);
+    if (persist_fd >= 0)
+        fcntl(persist_fd, F_SETFD, FD_CLOEXEC);
+    persist_size = persist_compacted_size = state.size;
+    persist_store_valid = 1;
+    if (persist_size > PERSIST_STORE_MAX)
+        ERROR("persistent properties take %d bytes, more than the store can load\n",
+              (int) persist_size);
+    return 0;
+}
+
+static int persist_open(void)
+{
+    struct stat sb;
+    uint32_t magic = PERSIST_MAGIC;
+
+    if (persist_fd >= 0)
+        return 0;
+    /* never append to a store that wasn't loaded, it would not be read back */
+    if (!persist_store_valid)
+        return persist_compact();
+    persist_fd = open(PERSISTENT_PROPERTY_STORE,
+            O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW, 0600);
+    if (persist_fd < 0) {
+        ERROR("Unable to open persistent property store errno: %d\n", errno);
+        return -1;
+    }
+    fcntl(persist_fd, F_SETFD, FD_CLOEXEC);
+    if (fstat(persist_fd, &sb) < 0) {
+        close(persist_fd);
+        persist_fd = -1;
+        return -1;
+    }
+    persist_size = sb.st_size;
+    if (persist_size == 0) {
+        write_fully(persist_fd, (char *) &magic, sizeof(magic));
+        persist_size = sizeof(magic);
+    }
+    return 0;
+}
+
+static void persist_append(const char *buf, size_t len)
+{
+    if (persist_open() < 0)
+        return;
+    /* The records are in the property area already, so a compaction
+     * writes them too. */
+    if (persist_size + len > PERSIST_STORE_MAX) {
+        if (persist_compact() < 0)
+            ERROR("persistent property store is full, dropping %d bytes of records\n",
+                  (int) len);
         return;
     }
-    write(fd, value, strlen(value));
-    close(fd);
+    /* A single write keeps each commit, batched or not, contiguous in the
+     * journal; a partial one is caught by the checksum at the next boot. */
+    if (write_fully(persist_fd, buf, len) < 0) {
+        ERROR("Unable to append to persistent property store errno: %d\n", errno);
+        return;
+    }
+    persist_size += len;
 
-    snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, name);
-    if (rename(tempPath, path)) {
-        unlink(tempPath);
-        ERROR("Unable to rename persistent property file %s to %s\n", tempPath, path);
+    if (persist_size > PERSIST_COMPACT_MIN && persist_size > 4 * persist_compacted_size)
+        persist_compact();
+}
+
+static void write_persistent_property(const char *name, const char *value)
+{
+    char buf[PERSIST_RECORD_MAX];
+    size_t len = persist_encode(buf, name, value);
+
+    persist_note_name(name);
+    if (persist_batching) {
+        if (persist_pending_len + len > persist_pending_cap) {
+            size_t cap = persist_pending_cap ? persist_pending_cap * 2 : 4096;
+            char *pending = realloc(persist_pending, cap);
+            if (!pending) {
+                persist_append(buf, len);
+                return;
+            }
+            persist_pending = pending;
+            persist_pending_cap = cap;
+        }
+        memcpy(persist_pending + persist_pending_len, buf, len);
+        persist_pending_len += len;
+        return;
+    }
+    persist_append(buf, len);
+}
+
+/* Sets between these two calls reach the store in a single append. */
+static void persist_batch_begin(void)
+{
+    persist_batching = 1;
+}
+
+static void persist_batch_end(void)
+{
+    persist_batching = 0;
+    if (persist_pending_len) {
+        persist_append(persist_pending, persist_pending_len);
+        persist_pending_len = 0;
     }
 }
 
@@ -315,7 +602,7 @@ int property_set(const char *name, const char *value)
     if (!is_legal_property_name(name, namelen)) return -1;
     if (valuelen >= PROP_VALUE_MAX) return -1;
 
-    pi = (prop_info*) __system_property_find(name);
+    pi = (prop_info*) find_property(name);
 
     if(pi != 0) {
         /* ro.* properties may NEVER be modified once set */
@@ -355,6 +642,36 @@ int property_set(const char *name, const char *value)
     return 0;
 }
 
+/*
+ * Apply one entry of a PROPERTY_MSG_SETPROP_BATCH request.  The caller's
+ * credentials and security context are fetched once per connection; the
+ * permission checks still run for every entry.
+ */
+static void handle_batch_entry(prop_msg *msg, const struct ucred *cr, char *source_ctx)
+{
+    msg->name[PROP_NAME_MAX-1] = 0;
+    msg->value[PROP_VALUE_MAX-1] = 0;
+
+    if (!is_legal_property_name(msg->name, strlen(msg->name))) {
+        ERROR("sys_prop: illegal property name. Got: \"%s\"\n", msg->name);
+        return;
+    }
+
+    if (memcmp(msg->name, "ctl.", 4) == 0) {
+        if (check_control_perms(msg->value, cr->uid, cr->gid, source_ctx)) {
+            handle_control_message((char*) msg->name + 4, (char*) msg->value);
+        } else {
+            ERROR("sys_prop: Unable to %s service ctl [%s] uid:%d gid:%d pid:%d\n",
+                    msg->name + 4, msg->value, cr->uid, cr->gid, cr->pid);
+        }
+    } else if (check_perms(msg->name, cr->uid, cr->gid, source_ctx)) {
+        property_set((char*) msg->name, (char*) msg->value);
+    } else {
+        ERROR("sys_prop: permission denied uid:%d  name:%s\n",
+                cr->uid, msg->name);
+    }
+}
+
 void handle_property_set_fd()
 {
     prop_msg msg;
@@ -425,6 +742,35 @@ void handle_property_set_fd()
         freecon(source_ctx);
         break;
 
+    case PROPERTY_MSG_SETPROP_BATCH: {
+        /* init serves every client from its main loop, so don't let one
+         * that stalls in the middle of a batch hold it up for long. */
+        struct timeval tv = { 1, 0 };
+        int count = 0;
+
+        getpeercon(s, &source_ctx);
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        persist_batch_begin();
+        do {
+            if (msg.cmd != PROPERTY_MSG_SETPROP_BATCH) {
+                ERROR("sys_prop: unexpected cmd %d in batch\n", msg.cmd);
+                break;
+            }
+            handle_batch_entry(&msg, &cr, source_ctx);
+            if (++count == PROPERTY_BATCH_MAX) {
+                break;
+            }
+            r = TEMP_FAILURE_RETRY(recv(s, &msg, sizeof(msg), MSG_WAITALL));
+        } while (r == sizeof(prop_msg));
+        persist_batch_end();
+
+        // As with a single set, the client waits for us to close the socket
+        // to know that the batch has been applied.
+        close(s);
+        freecon(source_ctx);
+        break;
+    }
+
     default:
         close(s);
         break;
@@ -477,7 +823,12 @@ static void load_properties_from_file(const char *fn)
     }
 }
 
-static void load_persistent_properties()
+/*
+ * Pre-journal layout: one file per property under PERSISTENT_PROPERTY_DIR.
+ * Returns how many were loaded, and sets *failed if any could not be read,
+ * in which case the files have to be kept for another try.
+ */
+static int load_legacy_persistent_properties(int *failed)
 {
     DIR* dir = opendir(PERSISTENT_PROPERTY_DIR);
     int dir_fd;
@@ -485,6 +836,7 @@ static void load_persistent_properties()
     char value[PROP_VALUE_MAX];
     int fd, length;
     struct stat sb;
+    int loaded = 0;
 
     if (dir) {
         dir_fd = dirfd(dir);
@@ -500,10 +852,12 @@ static void load_persistent_properties()
             if (fd < 0) {
                 ERROR("Unable to open persistent property file \"%s\" errno: %d\n",
                       entry->d_name, errno);
+                *failed = 1;
                 continue;
             }
             if (fstat(fd, &sb) < 0) {
                 ERROR("fstat on property file \"%s\" failed errno: %d\n", entry->d_name, errno);
+                *failed = 1;
                 close(fd);
                 continue;
             }
@@ -524,18 +878,153 @@ static void load_persistent_properties()
             if (length >= 0) {
                 value[length] = 0;
                 property_set(entry->d_name, value);
+                persist_note_name(entry->d_name);
+                loaded++;
             } else {
                 ERROR("Unable to read persistent property file %s errno: %d\n",
                       entry->d_name, errno);
+                *failed = 1;
             }
             close(fd);
         }
         closedir(dir);
-    } else {
+    } else if (errno != ENOENT) {
         ERROR("Unable to open persistent property directory %s errno: %d\n", PERSISTENT_PROPERTY_DIR, errno);
+        *failed = 1;
+    }
+
+    return loaded;
+}
+
+static void remove_legacy_persistent_properties(void)
+{
+    DIR* dir = opendir(PERSISTENT_PROPERTY_DIR);
+    struct dirent* entry;
+
+    if (!dir)
+        return;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp("persist.", entry->d_name, strlen("persist.")))
+            continue;
+        unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+    closedir(dir);
+}
+
+/* A store that can't be loaded is kept aside for whoever wants to look. */
+static void reject_persistent_store(void)
+{
+    if (rename(PERSISTENT_PROPERTY_STORE, PERSISTENT_PROPERTY_STORE_BAD) < 0)
+        ERROR("Unable to move the persistent property store aside errno: %d\n", errno);
+}
+
+/* Replay the journal.  Returns -1 if there is no usable store. */
+static int load_persistent_store(void)
+{
+    struct stat sb;
+    char *data;
+    size_t pos, good;
+    ssize_t length;
+    int fd;
+
+    fd = open(PERSISTENT_PROPERTY_STORE, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &sb) < 0) {
+        ERROR("fstat on persistent property store failed errno: %d\n", errno);
+        close(fd);
+        reject_persistent_store();
+        return -1;
     }
 
+    // Same rules as the old per-property files: private to root/root
+    // and not a hard link to any other file.
+    if (((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+            || (sb.st_uid != 0)
+            || (sb.st_gid != 0)
+            || (sb.st_nlink != 1)
+            || (sb.st_size > PERSIST_STORE_MAX)) {
+        ERROR("skipping insecure persistent property store (uid=%lu gid=%lu nlink=%d mode=%o size=%lld)\n",
+              sb.st_uid, sb.st_gid, sb.st_nlink, sb.st_mode, (long long) sb.st_size);
+        close(fd);
+        reject_persistent_store();
+        return -1;
+    }
+
+    data = malloc(sb.st_size + 1);
+    if (!data) {
+        close(fd);
+        reject_persistent_store();
+        return -1;
+    }
+    length = read(fd, data, sb.st_size);
+    close(fd);
+    if (length < (ssize_t) sizeof(uint32_t) || *(uint32_t *) data != PERSIST_MAGIC) {
+        ERROR("persistent property store is unreadable, ignoring it\n");
+        free(data);
+        reject_persistent_store();
+        return -1;
+    }
+
+    good = pos = sizeof(uint32_t);
+    while (pos + sizeof(struct persist_record) <= (size_t) length) {
+        struct persist_record r;
+        char name[PROP_NAME_MAX];
+        char value[PROP_VALUE_MAX];
+
+        memcpy(&r, data + pos, sizeof(r));
+        if (r.name_len >= PROP_NAME_MAX || r.value_len >= PROP_VALUE_MAX ||
+                pos + sizeof(r) + r.name_len + r.value_len > (size_t) length)
+            break;
+        memcpy(name, data + pos + sizeof(r), r.name_len);
+        name[r.name_len] = 0;
+        memcpy(value, data + pos + sizeof(r) + r.name_len, r.value_len);
+        value[r.value_len] = 0;
+        if (r.checksum != persist_checksum(&r, name, value))
+            break;
+
+        property_set(name, value);
+        persist_note_name(name);
+        pos += sizeof(r) + r.name_len + r.value_len;
+        good = pos;
+    }
+    free(data);
+
+    if (good < (size_t) length) {
+        ERROR("discarding %d bytes of damaged persistent property records\n",
+              (int) (length - good));
+        truncate(PERSISTENT_PROPERTY_STORE, good);
+    }
+    persist_size = persist_compacted_size = good;
+    persist_store_valid = 1;
+    return 0;
+}
+
+static void load_persistent_properties()
+{
+    int legacy, legacy_failed = 0;
+    int loaded;
+
+    /* Nothing being loaded needs to be written back. */
+    persistent_properties_loaded = 0;
+    if (persist_fd >= 0) {
+        close(persist_fd);
+        persist_fd = -1;
+    }
+    persist_store_valid = 0;
+
+    /* Legacy files are only removed once all of them made it into the
+     * store; until then they are read first and the store, which is newer,
+     * overrides them. */
+    legacy = load_legacy_persistent_properties(&legacy_failed);
+    loaded = load_persistent_store();
+
     persistent_properties_loaded = 1;
+
+    if (legacy > 0 || loaded < 0 || persist_size > PERSIST_COMPACT_MIN) {
+        if (persist_compact() == 0 && legacy > 0 && !legacy_failed)
+            remove_legacy_persistent_properties();
+    }
 }
 
 void property_init(void)
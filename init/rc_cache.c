@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "init_parser.h"
+#include "rc_cache.h"
+
+uint32_t rc_cache_hash(const char *data, unsigned size)
+{
+    uint32_t hash = 2166136261u;
+    unsigned i;
+
+    for (i = 0; i < size; i++)
+        hash = (hash ^ (uint8_t) data[i]) * 16777619u;
+    return hash;
+}
+
+struct image {
+    char *data;
+    unsigned size;
+    unsigned capacity;
+};
+
+static int append(struct image *image, const void *data, unsigned size)
+{
+    if (image->size + size > image->capacity) {
+        unsigned capacity = image->capacity * 2;
+        char *grown;
+
+        while (capacity < image->size + size)
+            capacity *= 2;
+        grown = realloc(image->data, capacity);
+        if (!grown)
+            return -1;
+        image->data = grown;
+        image->capacity = capacity;
+    }
+    memcpy(image->data + image->size, data, size);
+    image->size += size;
+    return 0;
+}
+
+static int append_line(struct image *image, uint32_t line, int nargs, char **args)
+{
+    uint32_t n = nargs;
+    int i;
+
+    if (append(image, &line, sizeof(line)) || append(image, &n, sizeof(n)))
+        return -1;
+    for (i = 0; i < nargs; i++) {
+        if (append(image, args[i], strlen(args[i]) + 1))
+            return -1;
+    }
+    return 0;
+}
+
+int rc_cache_compile(const char *fn, char *text, unsigned size,
+                     char **out, unsigned *out_size)
+{
+    struct parse_state state;
+    struct rc_cache_header header;
+    struct image image;
+    char *args[INIT_PARSER_MAXARGS];
+    int nargs = 0;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = RC_CACHE_MAGIC;
+    header.source_size = size;
+    header.source_hash = rc_cache_hash(text, size);
+
+    image.capacity = size + sizeof(header) + 64;
+    image.size = 0;
+    image.data = malloc(image.capacity);
+    if (!image.data || append(&image, &header, sizeof(header)))
+        goto oops;
+
+    memset(&state, 0, sizeof(state));
+    state.filename = fn;
+    state.ptr = text;
+
+    /* Same loop as parse_config(), recording lines instead of running them. */
+    for (;;) {
+        switch (next_token(&state)) {
+        case T_EOF:
+            memcpy(image.data, &header, sizeof(header));
+            *out = image.data;
+            *out_size = image.size;
+            return 0;
+        case T_NEWLINE:
+            state.line++;
+            if (nargs) {
+                if (append_line(&image, state.line, nargs, args))
+                    goto oops;
+                header.nlines++;
+                nargs = 0;
+            }
+            break;
+        case T_TEXT:
+            if (nargs < INIT_PARSER_MAXARGS) {
+                args[nargs++] = state.text;
+            }
+            break;
+        }
+    }
+
+oops:
+    free(image.data);
+    return -1;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_RC_CACHE_H
+#define _INIT_RC_CACHE_H
+
+#include <stdint.h>
+
+/*
+ * Pre-tokenized form of an .rc file, installed next to it as
+ * <file>.bin.  It holds exactly the lines the tokenizer would produce:
+ *
+ *     struct rc_cache_header
+ *     header.nlines times:
+ *         uint32_t line       line number, for parse errors
+ *         uint32_t nargs
+ *         nargs NUL-terminated, already unescaped, arguments
+ *
+ * The header records the size and hash of the text it was built from,
+ * and init ignores a cache that doesn't match the installed text.
+ */
+#define RC_CACHE_MAGIC   0x31435249  /* "IRC1" */
+#define RC_CACHE_SUFFIX  ".bin"
+
+struct rc_cache_header {
+    uint32_t magic;
+    uint32_t source_size;
+    uint32_t source_hash;
+    uint32_t nlines;
+};
+
+uint32_t rc_cache_hash(const char *data, unsigned size);
+
+/* Tokenize text (size bytes, followed by "\n\0" as read_file() leaves
+ * it; the text is modified) into a malloc()ed cache image. */
+int rc_cache_compile(const char *fn, char *text, unsigned size,
+                     char **out, unsigned *out_size);
+
+#endif
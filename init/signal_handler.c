@@ -28,6 +28,7 @@
 
 #include "init.h"
 #include "util.h"
+#include "boottrace.h"
 #include "log.h"
 
 static int signal_fd = -1;
@@ -62,6 +63,7 @@ static int wait_for_one_process(int block)
     }
 
     NOTICE("process '%s', pid %d exited\n", svc->name, pid);
+    boottrace_event(BOOTTRACE_SERVICE_EXIT, svc->name, svc->time_started * 1000000LL);
 
     if (!(svc->flags & SVC_ONESHOT) || (svc->flags & SVC_RESTART)) {
         kill(-pid, SIGKILL);
@@ -75,7 +77,7 @@ static int wait_for_one_process(int block)
         unlink(tmp);
     }
 
-    svc->pid = 0;
+    service_set_pid(svc, 0);
     svc->flags &= (~SVC_RUNNING);
 
         /* oneshot processes go into the disabled state on exit,
@@ -107,7 +109,7 @@ static int wait_for_one_process(int block)
     }
 
     svc->flags &= (~SVC_RESTART);
-    svc->flags |= SVC_RESTARTING;
+    service_queue_restart(svc);
 
     /* Execute all onrestart commands for this service. */
     list_for_each(node, &svc->onrestart.commands) {
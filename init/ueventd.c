@@ -29,6 +29,7 @@
 #include "util.h"
 #include "devices.h"
 #include "ueventd_parser.h"
+#include "boottrace.h"
 
 static char hardware[32];
 static unsigned revision = 0;
@@ -43,6 +44,10 @@ static void import_kernel_nv(char *name, int in_qemu)
             {
                 strlcpy(hardware, value, sizeof(hardware));
             }
+            else if (!strcmp(name, "androidboot.klog_buffered"))
+            {
+                klog_set_buffered(!strcmp(value, "1"));
+            }
         }
     }
 }
@@ -52,6 +57,8 @@ int ueventd_main(int argc, char **argv)
     struct pollfd ufd;
     int nr;
     char tmp[32];
+    long long last_dump;
+    int trace_dirty = 0;
 
     /*
      * init sets the umask to 077 for forked processes. We need to
@@ -85,17 +92,26 @@ int ueventd_main(int argc, char **argv)
     ueventd_parse_config_file(tmp);
 
     device_init();
+    boottrace_dump(BOOTTRACE_UEVENTD_FILE);
+    last_dump = boottrace_now();
 
     ufd.events = POLLIN;
     ufd.fd = get_device_fd();
 
     while(1) {
         ufd.revents = 0;
-        nr = poll(&ufd, 1, -1);
-        if (nr <= 0)
-            continue;
-        if (ufd.revents == POLLIN)
+        klog_flush();
+        nr = poll(&ufd, 1, trace_dirty ? 1000 : -1);
+        if (nr > 0 && ufd.revents == POLLIN) {
                handle_device_fd();
+               trace_dirty = 1;
+        }
+            /* refresh the trace file at most once a second */
+        if (trace_dirty && boottrace_now() - last_dump >= 1000000) {
+            boottrace_dump(BOOTTRACE_UEVENTD_FILE);
+            last_dump = boottrace_now();
+            trace_dirty = 0;
+        }
     }
 }
 
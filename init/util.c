@@ -22,14 +22,22 @@
 #include <ctype.h>
 #include <errno.h>
 #include <time.h>
-#include <ftw.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 
+#include <selinux/selinux.h>
 #include <selinux/label.h>
+#include <selinux/android.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/xattr.h>
+
+#include <mincrypt/sha.h>
 
 /* for ANDROID_SOCKET_* */
 #include <cutils/sockets.h>
@@ -39,6 +47,7 @@
 #include "init.h"
 #include "log.h"
 #include "util.h"
+#include "boottrace.h"
 
 /*
  * android_name_to_id - returns the integer uid/gid associated with the given
@@ -367,11 +376,13 @@ int wait_for_file(const char *filename, int timeout)
 {
     struct stat info;
     time_t timeout_time = gettime() + timeout;
+    long long start = boottrace_now();
     int ret = -1;
 
     while (gettime() < timeout_time && ((ret = stat(filename, &info)) < 0))
         usleep(10000);
 
+    boottrace_event(BOOTTRACE_WAIT, filename, start);
     return ret;
 }
 
@@ -514,16 +525,271 @@ int restorecon(const char *pathname)
     return 0;
 }
 
-static int nftw_restorecon(const char* filename, const struct stat* statptr,
-    int fileflags, struct FTW* pftw)
+/* Holds the hash of the file_contexts a tree was last fully relabeled with. */
+#define RESTORECON_LAST_XATTR  "security.restorecon_last"
+
+/* The order libselinux tries them in. */
+static const char *const file_contexts_paths[] = {
+    "/data/security/file_contexts",
+    "/file_contexts",
+};
+
+#define RESTORECON_MAX_THREADS  8
+#define RESTORECON_PROGRESS     10000   /* files between progress messages */
+
+struct restorecon_job {
+    dev_t dev;                  /* the walk stays on this filesystem */
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* dirs were queued, or the walk is done */
+    char **dirs;                /* directories left to read */
+    int count;
+    int capacity;
+    int busy;                   /* threads reading a directory */
+
+    unsigned files;
+    unsigned relabeled;
+    unsigned errors;
+};
+
+static int get_file_contexts_digest(uint8_t *digest)
 {
-    restorecon(filename);
-    return 0;
+    unsigned i, sz;
+    void *data;
+
+    for (i = 0; i < ARRAY_SIZE(file_contexts_paths); i++) {
+        data = read_file(file_contexts_paths[i], &sz);
+        if (data != NULL) {
+            SHA_hash(data, sz, digest);
+            free(data);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Returns 1 if pathname was relabeled, 0 if it was already right. */
+static int restorecon_sb(struct selabel_handle *handle, const char *pathname,
+                         const struct stat *sb)
+{
+    char *secontext = NULL;
+    char *oldcontext = NULL;
+    int ret = 0;
+
+    if (selabel_lookup(handle, &secontext, pathname, sb->st_mode) < 0)
+        return -errno;
+    if (lgetfilecon(pathname, &oldcontext) < 0 || strcmp(oldcontext, secontext)) {
+        ret = lsetfilecon(pathname, secontext) < 0 ? -errno : 1;
+    }
+    freecon(oldcontext);
+    freecon(secontext);
+    return ret;
+}
+
+/*
+ * Takes directories off the queue until there are none left and nobody is
+ * reading one that might add more.  Subdirectories are queued rather than
+ * followed so that every thread has something to do.
+ */
+static void restorecon_dirs(struct restorecon_job *job,
+                            struct selabel_handle *handle)
+{
+    char path[PATH_MAX];
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        char **subdirs = NULL;
+        int nsubdirs = 0, subdirs_capacity = 0;
+        unsigned files = 0, relabeled = 0, errors = 0;
+        struct dirent *de;
+        char *dir;
+        DIR *d;
+        int i;
+
+        while (job->count == 0 && job->busy > 0)
+            pthread_cond_wait(&job->cond, &job->lock);
+        if (job->count == 0)
+            break;
+        dir = job->dirs[--job->count];
+        job->busy++;
+        pthread_mutex_unlock(&job->lock);
+
+        d = opendir(dir);
+        if (d == NULL)
+            errors++;
+        while (d != NULL && (de = readdir(d)) != NULL) {
+            struct stat sb;
+            int rc;
+
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+                continue;
+            if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int) sizeof(path) ||
+                lstat(path, &sb) < 0) {
+                errors++;
+                continue;
+            }
+            if (sb.st_dev != job->dev)
+                continue;
+
+            files++;
+            rc = restorecon_sb(handle, path, &sb);
+            if (rc < 0)
+                errors++;
+            else
+                relabeled += rc;
+
+            if (S_ISDIR(sb.st_mode)) {
+                if (nsubdirs == subdirs_capacity) {
+                    int n = subdirs_capacity ? subdirs_capacity * 2 : 16;
+                    char **p = realloc(subdirs, n * sizeof(*p));
+                    if (p == NULL) {
+                        errors++;
+                        continue;
+                    }
+                    subdirs = p;
+                    subdirs_capacity = n;
+                }
+                if ((subdirs[nsubdirs] = strdup(path)) == NULL)
+                    errors++;
+                else
+                    nsubdirs++;
+            }
+        }
+        if (d != NULL)
+            closedir(d);
+        free(dir);
+
+        pthread_mutex_lock(&job->lock);
+        if (job->count + nsubdirs > job->capacity) {
+            int n = job->capacity ? job->capacity * 2 : 64;
+            char **p;
+            while (n < job->count + nsubdirs)
+                n *= 2;
+            p = realloc(job->dirs, n * sizeof(*p));
+            if (p != NULL) {
+                job->dirs = p;
+                job->capacity = n;
+            }
+        }
+        for (i = 0; i < nsubdirs; i++) {
+            if (job->count < job->capacity) {
+                job->dirs[job->count++] = subdirs[i];
+            } else {
+                free(subdirs[i]);
+                errors++;
+            }
+        }
+        free(subdirs);
+
+        if ((job->files + files) / RESTORECON_PROGRESS != job->files / RESTORECON_PROGRESS)
+            INFO("restorecon_recursive: %u files so far\n", job->files + files);
+        job->files += files;
+        job->relabeled += relabeled;
+        job->errors += errors;
+        job->busy--;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
 }
 
+/* Each helper thread looks labels up in a handle of its own. */
+static void *restorecon_thread(void *arg)
+{
+    struct restorecon_job *job = arg;
+    struct selabel_handle *handle = selinux_android_file_context_handle();
+
+    if (handle != NULL) {
+        restorecon_dirs(job, handle);
+        selabel_close(handle);
+    }
+    return NULL;
+}
+
+/*
+ * Relabels pathname and everything below it on the same filesystem, like
+ * restorecon(), on a pool of threads.  Once a tree has been relabeled
+ * without errors, the hash of file_contexts is stored with it and later
+ * calls return straight away until file_contexts changes.
+ */
 int restorecon_recursive(const char* pathname)
 {
-    int fd_limit = 20;
-    int flags = FTW_DEPTH | FTW_MOUNT | FTW_PHYS;
-    return nftw(pathname, nftw_restorecon, fd_limit, flags);
+    struct restorecon_job job;
+    pthread_t tids[RESTORECON_MAX_THREADS - 1];
+    uint8_t digest[SHA_DIGEST_SIZE];
+    uint8_t stored[SHA_DIGEST_SIZE];
+    int have_digest;
+    long long start;
+    struct stat sb;
+    char detail[64];
+    long threads;
+    int started = 0;
+    int rc, i;
+
+    if (is_selinux_enabled() <= 0 || !sehandle)
+        return 0;
+
+    start = boottrace_now();
+    if (lstat(pathname, &sb) < 0)
+        return -errno;
+
+    have_digest = get_file_contexts_digest(digest) == 0;
+    if (have_digest &&
+        lgetxattr(pathname, RESTORECON_LAST_XATTR, stored, sizeof(stored)) == sizeof(stored) &&
+        !memcmp(digest, stored, sizeof(stored))) {
+        INFO("restorecon_recursive: %s is up to date\n", pathname);
+        boottrace_event2(BOOTTRACE_RESTORECON, pathname, "unchanged", start);
+        return 0;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.dev = sb.st_dev;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    job.files = 1;
+    rc = restorecon_sb(sehandle, pathname, &sb);
+    if (rc < 0)
+        job.errors++;
+    else
+        job.relabeled += rc;
+
+    if (S_ISDIR(sb.st_mode)) {
+        job.dirs = malloc(64 * sizeof(*job.dirs));
+        if (job.dirs != NULL && (job.dirs[0] = strdup(pathname)) != NULL) {
+            job.capacity = 64;
+            job.count = 1;
+        } else {
+            job.errors++;
+        }
+
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads > RESTORECON_MAX_THREADS)
+            threads = RESTORECON_MAX_THREADS;
+        /* This thread is one of them, with the global handle. */
+        for (i = 1; i < threads; i++) {
+            if (pthread_create(&tids[started], NULL, restorecon_thread, &job) != 0)
+                break;
+            started++;
+        }
+        restorecon_dirs(&job, sehandle);
+        for (i = 0; i < started; i++)
+            pthread_join(tids[i], NULL);
+    }
+
+    while (job.count > 0)
+        free(job.dirs[--job.count]);
+    free(job.dirs);
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+
+    /* Not every filesystem takes the xattr, which just means no shortcut. */
+    if (have_digest && job.errors == 0)
+        lsetxattr(pathname, RESTORECON_LAST_XATTR, digest, sizeof(digest), 0);
+
+    INFO("restorecon_recursive: %s: %u files, %u relabeled, %u errors, %lld ms\n",
+         pathname, job.files, job.relabeled, job.errors,
+         (boottrace_now() - start) / 1000);
+    snprintf(detail, sizeof(detail), "%u/%u", job.relabeled, job.files);
+    boottrace_event2(BOOTTRACE_RESTORECON, pathname, detail, start);
+    return job.errors ? -1 : 0;
 }
@@ -118,6 +118,48 @@ static uintptr_t prel_to_absolute(uintptr_t place, uint32_t prel_offset) {
     return place + (((int32_t)(prel_offset << 1)) >> 1);
 }
 
+/* Decodes the second word of an EXIDX entry into the address of its handler,
+ * or 0 if the function cannot be unwound. */
+static uintptr_t decode_exidx_handler(uintptr_t entry_handler_ptr, uint32_t entry_handler) {
+    if (entry_handler & (1L << 31)) {
+        return entry_handler_ptr; // in-place handler data
+    } else if (entry_handler != EXIDX_CANTUNWIND) {
+        return prel_to_absolute(entry_handler_ptr, entry_handler);
+    }
+    return 0;
+}
+
+/* Copies the EXIDX table of a library out of the remote process into its
+ * unwind index.  The index is left empty if the table cannot be read, in
+ * which case lookups go back to reading the table in place. */
+static void load_exidx_index(const memory_t* memory, map_info_data_t* data) {
+    unwind_index_t* index = &data->unwind_index;
+    index->loaded = true;
+    if (!data->exidx_start || !data->exidx_size) {
+        return;
+    }
+
+    unwind_index_entry_t* entries = malloc(data->exidx_size * sizeof(unwind_index_entry_t));
+    if (!entries) {
+        return;
+    }
+    for (size_t i = 0; i < data->exidx_size; i++) {
+        uintptr_t entry = data->exidx_start + i * 8;
+        uint32_t entry_prel_pc;
+        uint32_t entry_handler;
+        if (!try_get_word(memory, entry, &entry_prel_pc)
+                || !try_get_word(memory, entry + 4, &entry_handler)) {
+            ALOGV("Could not read EXIDX entry %d at 0x%08x", i, entry);
+            free(entries);
+            return;
+        }
+        entries[i].pc = prel_to_absolute(entry, entry_prel_pc);
+        entries[i].data = decode_exidx_handler(entry + 4, entry_handler);
+    }
+    index->entries = entries;
+    index->count = data->exidx_size;
+}
+
 static uintptr_t get_exception_handler(const memory_t* memory,
         const map_info_t* map_info_list, uintptr_t pc) {
     if (!pc) {
@@ -128,13 +170,20 @@ static uintptr_t get_exception_handler(const memory_t* memory,
     uintptr_t exidx_start;
     size_t exidx_size;
     const map_info_t* mi;
+    const unwind_index_t* exidx_index = NULL;
     if (memory->tid < 0) {
         mi = NULL;
         exidx_start = find_exidx(pc, &exidx_size);
     } else {
         mi = find_map_info(map_info_list, pc);
         if (mi && mi->data) {
-            const map_info_data_t* data = (const map_info_data_t*)mi->data;
+            map_info_data_t* data = (map_info_data_t*)mi->data;
+            if (!data->unwind_index.loaded) {
+                load_exidx_index(memory, data);
+            }
+            if (data->unwind_index.entries) {
+                exidx_index = &data->unwind_index;
+            }
             exidx_start = data->exidx_start;
             exidx_size = data->exidx_size;
         } else {
@@ -145,7 +194,13 @@ static uintptr_t get_exception_handler(const memory_t* memory,
 
     uintptr_t handler = 0;
     int32_t handler_index = -1;
-    if (exidx_start) {
+    if (exidx_index) {
+        const unwind_index_entry_t* entry = find_unwind_index_entry(exidx_index, pc);
+        if (entry) {
+            handler = entry->data;
+            handler_index = entry - exidx_index->entries;
+        }
+    } else if (exidx_start) {
         uint32_t low = 0;
         uint32_t high = exidx_size;
         while (low < high) {
@@ -181,11 +236,7 @@ static uintptr_t get_exception_handler(const memory_t* memory,
             if (!try_get_word(memory, entry_handler_ptr, &entry_handler)) {
                 break;
             }
-            if (entry_handler & (1L << 31)) {
-                handler = entry_handler_ptr; // in-place handler data
-            } else if (entry_handler != EXIDX_CANTUNWIND) {
-                handler = prel_to_absolute(entry_handler_ptr, entry_handler);
-            }
+            handler = decode_exidx_handler(entry_handler_ptr, entry_handler);
             handler_index = index;
             break;
         }
@@ -595,7 +646,7 @@ ssize_t unwind_backtrace_ptrace_arch(pid_t tid, const ptrace_context_t* context,
     }
 
     memory_t memory;
-    init_memory_ptrace(&memory, tid);
+    init_memory_ptrace_context(&memory, context, tid);
     return unwind_backtrace_common(&memory, context->map_info_list, &state,
             backtrace, ignore_depth, max_depth);
 }
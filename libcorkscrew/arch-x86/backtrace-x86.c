@@ -238,6 +238,76 @@ static bool read_dwarf(const memory_t* memory, uintptr_t ptr, uint32_t* out_valu
     return true;
 }
 
+/* Reads the header of .eh_frame_hdr, leaving the cursor at the start of the
+ * FDE lookup table. */
+static bool read_eh_frame_hdr_info(const memory_t* memory, uintptr_t eh_frame_hdr,
+                                   eh_frame_hdr_info_t* eh_hdr_info, uint32_t* cursor) {
+    memset(eh_hdr_info, 0, sizeof(eh_frame_hdr_info_t));
+
+    /* Getting the first word of eh_frame_hdr:
+        1st byte is version;
+        2nd byte is encoding of pointer to eh_frames;
+        3rd byte is encoding of count of FDEs in lookup table;
+        4th byte is encoding of lookup table entries.
+    */
+    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info->version, cursor)) return false;
+    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info->eh_frame_ptr_enc, cursor)) return false;
+    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info->fde_count_enc, cursor)) return false;
+    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info->fde_table_enc, cursor)) return false;
+
+    /* TODO: 3rd byte can be DW_EH_PE_omit, that means no lookup table available and we should
+       try to parse eh_frame instead. Not sure how often it may occur, skipping now.
+    */
+    if (eh_hdr_info->version != 1) {
+        ALOGV("find_fde: eh_frame_hdr version %d is not supported", eh_hdr_info->version);
+        return false;
+    }
+    /* Getting the data:
+        2nd word is eh_frame pointer (normally not used, because lookup table has all we need);
+        3rd word is count of FDEs in the lookup table;
+        starting from 4 word there is FDE lookup table (pairs of PC and FDE pointer) sorted by PC;
+    */
+    if (!read_dwarf(memory, eh_frame_hdr, &eh_hdr_info->eh_frame_ptr, eh_hdr_info->eh_frame_ptr_enc, cursor)) return false;
+    if (!read_dwarf(memory, eh_frame_hdr, &eh_hdr_info->fde_count, eh_hdr_info->fde_count_enc, cursor)) return false;
+    ALOGV("find_fde: found %d FDEs", eh_hdr_info->fde_count);
+    return true;
+}
+
+/* Copies the FDE lookup table of a library out of the remote process into its
+ * unwind index.  The index is left empty if the table cannot be read, in which
+ * case lookups go back to reading the table in place. */
+static void load_fde_index(const memory_t* memory, map_info_data_t* midata) {
+    unwind_index_t* index = &midata->unwind_index;
+    index->loaded = true;
+
+    eh_frame_hdr_info_t eh_hdr_info;
+    uintptr_t eh_frame_hdr = midata->eh_frame_hdr;
+    uint32_t c = 0;
+    if (!eh_frame_hdr || !read_eh_frame_hdr_info(memory, eh_frame_hdr, &eh_hdr_info, &c)
+            || !eh_hdr_info.fde_count) {
+        return;
+    }
+
+    unwind_index_entry_t* entries = malloc(eh_hdr_info.fde_count * sizeof(unwind_index_entry_t));
+    if (!entries) {
+        return;
+    }
+    for (uint32_t i = 0; i < eh_hdr_info.fde_count; i++) {
+        uint32_t start;
+        uint32_t fde;
+        if (!read_dwarf(memory, eh_frame_hdr, &start, eh_hdr_info.fde_table_enc, &c)
+                || !read_dwarf(memory, eh_frame_hdr, &fde, eh_hdr_info.fde_table_enc, &c)) {
+            ALOGV("find_fde: could not read FDE lookup table entry %d", i);
+            free(entries);
+            return;
+        }
+        entries[i].pc = start;
+        entries[i].data = fde;
+    }
+    index->entries = entries;
+    index->count = eh_hdr_info.fde_count;
+}
+
 /* Having PC find corresponding FDE by reading .eh_frame_hdr section data. */
 static uintptr_t find_fde(const memory_t* memory,
                           const map_info_t* map_info_list, uintptr_t pc) {
@@ -256,37 +326,30 @@ static uintptr_t find_fde(const memory_t* memory,
         return 0;
     }
 
-    eh_frame_hdr_info_t eh_hdr_info;
-    memset(&eh_hdr_info, 0, sizeof(eh_frame_hdr_info_t));
+    /* Only a ptrace context owns the map data, so only there can the index be kept. */
+    if (memory->tid >= 0) {
+        map_info_data_t* data = (map_info_data_t*)mi->data;
+        if (!data->unwind_index.loaded) {
+            load_fde_index(memory, data);
+        }
+        if (data->unwind_index.entries) {
+            /* The table entries give the first pc of each FDE; pc itself belongs
+               to the last one that starts strictly before it. */
+            const unwind_index_entry_t* entry = find_unwind_index_entry(&data->unwind_index, pc - 1);
+            if (!entry) {
+                ALOGV("find_fde: pc %x is out of FDE bounds", pc);
+                return 0;
+            }
+            ALOGV("pc 0x%x, ENTRY %d: start=0x%x, fde=0x%x", pc,
+                  entry - data->unwind_index.entries, entry->pc, entry->data);
+            return entry->data;
+        }
+    }
 
-    /* Getting the first word of eh_frame_hdr:
-        1st byte is version;
-        2nd byte is encoding of pointer to eh_frames;
-        3rd byte is encoding of count of FDEs in lookup table;
-        4th byte is encoding of lookup table entries.
-    */
+    eh_frame_hdr_info_t eh_hdr_info;
     uintptr_t eh_frame_hdr = midata->eh_frame_hdr;
     uint32_t c = 0;
-    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info.version, &c)) return 0;
-    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info.eh_frame_ptr_enc, &c)) return 0;
-    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info.fde_count_enc, &c)) return 0;
-    if (!try_get_byte(memory, eh_frame_hdr, &eh_hdr_info.fde_table_enc, &c)) return 0;
-
-    /* TODO: 3rd byte can be DW_EH_PE_omit, that means no lookup table available and we should
-       try to parse eh_frame instead. Not sure how often it may occur, skipping now.
-    */
-    if (eh_hdr_info.version != 1) {
-        ALOGV("find_fde: eh_frame_hdr version %d is not supported", eh_hdr_info.version);
-        return 0;
-    }
-    /* Getting the data:
-        2nd word is eh_frame pointer (normally not used, because lookup table has all we need);
-        3rd word is count of FDEs in the lookup table;
-        starting from 4 word there is FDE lookup table (pairs of PC and FDE pointer) sorted by PC;
-    */
-    if (!read_dwarf(memory, eh_frame_hdr, &eh_hdr_info.eh_frame_ptr, eh_hdr_info.eh_frame_ptr_enc, &c)) return 0;
-    if (!read_dwarf(memory, eh_frame_hdr, &eh_hdr_info.fde_count, eh_hdr_info.fde_count_enc, &c)) return 0;
-    ALOGV("find_fde: found %d FDEs", eh_hdr_info.fde_count);
+    if (!read_eh_frame_hdr_info(memory, eh_frame_hdr, &eh_hdr_info, &c)) return 0;
 
     int32_t low = 0;
     int32_t high = eh_hdr_info.fde_count;
@@ -856,7 +919,7 @@ ssize_t unwind_backtrace_ptrace_arch(pid_t tid, const ptrace_context_t* context,
     state.reg[DWARF_ESP] = regs.esp;
 
     memory_t memory;
-    init_memory_ptrace(&memory, tid);
+    init_memory_ptrace_context(&memory, context, tid);
     return unwind_backtrace_common(&memory, context->map_info_list,
             &state, backtrace, ignore_depth, max_depth);
 #endif
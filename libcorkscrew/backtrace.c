@@ -25,11 +25,15 @@
 #include <corkscrew/ptrace.h>
 #include <corkscrew/demangle.h>
 
+#include <dirent.h>
+#include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/ptrace.h>
 #include <unwind.h>
 #include <cutils/log.h>
 #include <cutils/atomic.h>
@@ -144,6 +148,108 @@ static void unwind_backtrace_thread_signal_handler(int n __attribute__((unused))
                 gettid(), android_atomic_acquire_load(&g_unwind_signal_state.tid_state));
     }
 }
+
+// Like g_unwind_signal_state, for unwind_backtrace_threads().  Also guarded by
+// g_unwind_signal_mutex, since both use SIGURG.  The tids and their states live
+// here rather than with the caller because a thread can still be entering the
+// handler after its dump was canceled.
+#define MAX_UNWIND_THREADS 256
+
+static volatile struct {
+    int32_t count;
+    pid_t tids[MAX_UNWIND_THREADS];
+    int32_t tid_states[MAX_UNWIND_THREADS];
+    thread_backtrace_t* threads;
+    const map_info_t* map_info_list;
+    size_t ignore_depth;
+    size_t max_depth;
+} g_unwind_threads_state;
+
+static void unwind_backtrace_threads_signal_handler(int n __attribute__((unused)), siginfo_t* siginfo, void* sigcontext) {
+    pid_t tid = gettid();
+    int32_t count = android_atomic_acquire_load(&g_unwind_threads_state.count);
+    for (int32_t i = 0; i < count; i++) {
+        if (g_unwind_threads_state.tids[i] != tid) {
+            continue;
+        }
+        if (!android_atomic_acquire_cas(tid, STATE_DUMPING, &g_unwind_threads_state.tid_states[i])) {
+            thread_backtrace_t* thread = &g_unwind_threads_state.threads[i];
+            thread->frame_count = unwind_backtrace_signal_arch(siginfo, sigcontext,
+                    g_unwind_threads_state.map_info_list, thread->frames,
+                    g_unwind_threads_state.ignore_depth,
+                    g_unwind_threads_state.max_depth);
+            android_atomic_release_store(STATE_DONE, &g_unwind_threads_state.tid_states[i]);
+        }
+        return;
+    }
+    ALOGV("Received spurious SIGURG on thread %d.", tid);
+}
+
+// Unwinds up to MAX_UNWIND_THREADS threads with g_unwind_signal_mutex held and
+// the handler installed.
+static void unwind_backtrace_threads_locked(thread_backtrace_t* threads, size_t count,
+        const map_info_t* milist, size_t ignore_depth, size_t max_depth) {
+    volatile int32_t* tid_states = g_unwind_threads_state.tid_states;
+    pid_t self = gettid();
+
+    for (size_t i = 0; i < count; i++) {
+        g_unwind_threads_state.tids[i] = threads[i].tid;
+        tid_states[i] = threads[i].tid == self ? STATE_CANCEL : threads[i].tid;
+    }
+    g_unwind_threads_state.threads = threads;
+    g_unwind_threads_state.map_info_list = milist;
+    g_unwind_threads_state.ignore_depth = ignore_depth;
+    g_unwind_threads_state.max_depth = max_depth;
+    android_atomic_release_store(count, &g_unwind_threads_state.count);
+
+    // Signal every thread before waiting for any of them, so that they all
+    // unwind their own stacks at the same time.
+    for (size_t i = 0; i < count; i++) {
+        if (tid_states[i] != STATE_CANCEL && tgkill(getpid(), threads[i].tid, SIGURG)) {
+            ALOGV("Failed to send SIGURG to thread %d.", threads[i].tid);
+            threads[i].error = errno;
+            tid_states[i] = STATE_CANCEL;
+        }
+    }
+
+    // Wait for the threads to start dumping their stacks.  The wait is shared,
+    // so that a few wedged threads cannot hold us up once each.
+    int wait_millis = 250;
+    for (;;) {
+        size_t waiting = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (android_atomic_acquire_load(&tid_states[i]) == threads[i].tid) {
+                waiting++;
+            }
+        }
+        if (!waiting) {
+            break;
+        }
+        if (wait_millis--) {
+            usleep(1000);
+        } else {
+            ALOGV("Timed out waiting for %zu threads to start dumping the stack.", waiting);
+            break;
+        }
+    }
+
+    // Cancel the dumps that have not started yet, then wait indefinitely for the
+    // others to finish, for the same reason as in unwind_backtrace_thread().
+    for (size_t i = 0; i < count; i++) {
+        pid_t tid = threads[i].tid;
+        int32_t tid_state = android_atomic_acquire_load(&tid_states[i]);
+        if (tid_state == tid && !android_atomic_acquire_cas(tid, STATE_CANCEL, &tid_states[i])) {
+            ALOGV("Canceled thread %d stack dump.", tid);
+            continue;
+        }
+        while ((tid_state = android_atomic_acquire_load(&tid_states[i])) == STATE_DUMPING) {
+            usleep(1000);
+        }
+        if (tid_state != STATE_DONE) {
+            threads[i].frame_count = -1;
+        }
+    }
+}
 #endif
 
 ssize_t unwind_backtrace_thread(pid_t tid, backtrace_frame_t* backtrace,
@@ -233,6 +339,48 @@ ssize_t unwind_backtrace_thread(pid_t tid, backtrace_frame_t* backtrace,
 #endif
 }
 
+void unwind_backtrace_threads(thread_backtrace_t* threads, size_t count,
+        size_t ignore_depth, size_t max_depth) {
+    for (size_t i = 0; i < count; i++) {
+        threads[i].error = 0;
+        threads[i].detach_failed = false;
+        threads[i].frame_count = -1;
+    }
+
+#if defined(CORKSCREW_HAVE_ARCH) && !defined(__APPLE__)
+    struct sigaction act;
+    struct sigaction oact;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = unwind_backtrace_threads_signal_handler;
+    act.sa_flags = SA_RESTART | SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&act.sa_mask);
+
+    pthread_mutex_lock(&g_unwind_signal_mutex);
+    map_info_t* milist = acquire_my_map_info_list();
+
+    if (!sigaction(SIGURG, &act, &oact)) {
+        for (size_t i = 0; i < count; i += MAX_UNWIND_THREADS) {
+            size_t n = count - i < MAX_UNWIND_THREADS ? count - i : MAX_UNWIND_THREADS;
+            unwind_backtrace_threads_locked(threads + i, n, milist, ignore_depth, max_depth);
+        }
+        android_atomic_release_store(0, &g_unwind_threads_state.count);
+        sigaction(SIGURG, &oact, NULL);
+    }
+
+    release_my_map_info_list(milist);
+    pthread_mutex_unlock(&g_unwind_signal_mutex);
+
+    // The calling thread cannot signal itself, but it can unwind itself.
+    pid_t self = gettid();
+    for (size_t i = 0; i < count; i++) {
+        if (threads[i].tid == self) {
+            threads[i].frame_count = unwind_backtrace(threads[i].frames,
+                    ignore_depth + 1, max_depth);
+        }
+    }
+#endif
+}
+
 ssize_t unwind_backtrace_ptrace(pid_t tid, const ptrace_context_t* context,
         backtrace_frame_t* backtrace, size_t ignore_depth, size_t max_depth) {
 #ifdef CORKSCREW_HAVE_ARCH
@@ -242,6 +390,151 @@ ssize_t unwind_backtrace_ptrace(pid_t tid, const ptrace_context_t* context,
 #endif
 }
 
+#if defined(CORKSCREW_HAVE_ARCH) && !defined(__APPLE__)
+// How long to wait in total for the threads of a process to stop after attaching.
+static const int PROCESS_STOP_TIMEOUT_MS = 1000;
+
+static bool add_process_thread(thread_backtrace_t** threads, size_t* count,
+        size_t* capacity, pid_t tid, size_t max_depth) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 32;
+        thread_backtrace_t* new_threads = realloc(*threads,
+                new_capacity * sizeof(thread_backtrace_t));
+        if (!new_threads) {
+            return false;
+        }
+        *threads = new_threads;
+        *capacity = new_capacity;
+    }
+
+    thread_backtrace_t* thread = &(*threads)[*count];
+    thread->tid = tid;
+    thread->error = 0;
+    thread->detach_failed = false;
+    thread->frame_count = -1;
+    thread->frames = malloc(max_depth * sizeof(backtrace_frame_t));
+    thread->symbols = malloc(max_depth * sizeof(backtrace_symbol_t));
+    if (!thread->frames || !thread->symbols) {
+        free(thread->frames);
+        free(thread->symbols);
+        return false;
+    }
+    *count += 1;
+    return true;
+}
+
+static ssize_t list_process_threads(pid_t pid, pid_t attached_tid, size_t max_depth,
+        thread_backtrace_t** out_threads) {
+    char task_path[64];
+    snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
+    DIR* d = opendir(task_path);
+    if (!d) {
+        ALOGV("Could not open %s: %s", task_path, strerror(errno));
+        return -1;
+    }
+
+    thread_backtrace_t* threads = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    bool ok = !attached_tid
+            || add_process_thread(&threads, &count, &capacity, attached_tid, max_depth);
+    struct dirent* de;
+    while (ok && (de = readdir(d)) != NULL) {
+        char* end;
+        pid_t tid = strtoul(de->d_name, &end, 10);
+        if (!tid || *end || tid == attached_tid) {
+            continue;
+        }
+        ok = add_process_thread(&threads, &count, &capacity, tid, max_depth);
+    }
+    closedir(d);
+
+    if (!ok) {
+        free_process_backtrace(threads, count);
+        return -1;
+    }
+    *out_threads = threads;
+    return count;
+}
+
+static bool wait_for_thread_stop(pid_t tid, int* total_wait_ms) {
+    siginfo_t si;
+    while (ptrace(PTRACE_GETSIGINFO, tid, 0, &si) < 0) {
+        if (errno != ESRCH || *total_wait_ms >= PROCESS_STOP_TIMEOUT_MS) {
+            ALOGV("Thread %d did not stop: %s", tid, strerror(errno));
+            return false;
+        }
+        usleep(1000);
+        *total_wait_ms += 1;
+    }
+    return true;
+}
+#endif
+
+ssize_t unwind_backtrace_process(pid_t pid, pid_t attached_tid,
+        const ptrace_context_t* context, size_t max_depth,
+        thread_backtrace_t** out_threads) {
+#if defined(CORKSCREW_HAVE_ARCH) && !defined(__APPLE__)
+    thread_backtrace_t* threads;
+    ssize_t count = list_process_threads(pid, attached_tid, max_depth, &threads);
+    if (count < 0) {
+        return -1;
+    }
+
+    // Attach to every thread before waiting for any of them so that they all
+    // stop in parallel.
+    for (ssize_t i = 0; i < count; i++) {
+        thread_backtrace_t* thread = &threads[i];
+        if (thread->tid != attached_tid && ptrace(PTRACE_ATTACH, thread->tid, 0, 0) < 0) {
+            thread->error = errno;
+        }
+    }
+
+    // Only the stack walk itself needs the threads stopped.  The wait budget is
+    // shared so that a wedged process cannot hold us up once per thread.
+    int total_wait_ms = 0;
+    for (ssize_t i = 0; i < count; i++) {
+        thread_backtrace_t* thread = &threads[i];
+        if (thread->error) {
+            continue;
+        }
+        if (wait_for_thread_stop(thread->tid, &total_wait_ms)) {
+            thread->frame_count = unwind_backtrace_ptrace(thread->tid, context,
+                    thread->frames, 0, max_depth);
+        }
+        if (thread->tid != attached_tid && ptrace(PTRACE_DETACH, thread->tid, 0, 0) < 0) {
+            ALOGV("Failed to detach from thread %d: %s", thread->tid, strerror(errno));
+            thread->detach_failed = true;
+        }
+    }
+
+    for (ssize_t i = 0; i < count; i++) {
+        thread_backtrace_t* thread = &threads[i];
+        if (thread->frame_count > 0) {
+            get_backtrace_symbols_ptrace(context, thread->frames, thread->frame_count,
+                    thread->symbols);
+        }
+    }
+
+    *out_threads = threads;
+    return count;
+#else
+    return -1;
+#endif
+}
+
+void free_process_backtrace(thread_backtrace_t* threads, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        thread_backtrace_t* thread = &threads[i];
+        if (thread->frame_count > 0) {
+            free_backtrace_symbols(thread->symbols, thread->frame_count);
+        }
+        free(thread->frames);
+        free(thread->symbols);
+    }
+    free(threads);
+}
+
 static void init_backtrace_symbol(backtrace_symbol_t* symbol, uintptr_t pc) {
     symbol->relative_pc = pc;
     symbol->relative_symbol_addr = 0;
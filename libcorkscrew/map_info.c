@@ -29,6 +29,43 @@
 #include <cutils/log.h>
 #include <sys/time.h>
 
+/* The maps of a list in address order, so lookups can bisect. */
+typedef struct map_index {
+    size_t count;
+    const map_info_t* maps[];
+} map_index_t;
+
+static int compare_map_start(const void* a, const void* b) {
+    const map_info_t* ma = *(const map_info_t* const*)a;
+    const map_info_t* mb = *(const map_info_t* const*)b;
+    if (ma->start > mb->start) return 1;
+    if (ma->start < mb->start) return -1;
+    return 0;
+}
+
+/* Attaches an index to the head of milist; lookups stay linear without one. */
+static void index_map_info_list(map_info_t* milist) {
+    size_t count = 0;
+    for (const map_info_t* mi = milist; mi; mi = mi->next) {
+        count++;
+    }
+    if (!count) {
+        return;
+    }
+
+    map_index_t* index = malloc(sizeof(map_index_t) + count * sizeof(const map_info_t*));
+    if (!index) {
+        return;
+    }
+    index->count = count;
+    size_t i = 0;
+    for (const map_info_t* mi = milist; mi; mi = mi->next) {
+        index->maps[i++] = mi;
+    }
+    qsort(index->maps, count, sizeof(const map_info_t*), compare_map_start);
+    milist->index = index;
+}
+
 #if defined(__APPLE__)
 
 // Mac OS vmmap(1) output:
@@ -56,6 +93,7 @@ static map_info_t* parse_vmmap_line(const char* line) {
         mi->is_writable = permissions[1] == 'w';
         mi->is_executable = permissions[2] == 'x';
         mi->data = NULL;
+        mi->index = NULL;
         memcpy(mi->name, name, name_len);
         mi->name[name_len - 1] = '\0';
         ALOGV("Parsed map: start=0x%08x, end=0x%08x, "
@@ -84,6 +122,7 @@ map_info_t* load_map_info_list(pid_t pid) {
         }
     }
     pclose(fp);
+    index_map_info_list(milist);
     return milist;
 }
 
@@ -121,6 +160,7 @@ static map_info_t* parse_maps_line(const char* line)
         mi->is_writable = strlen(permissions) == 4 && permissions[1] == 'w';
         mi->is_executable = strlen(permissions) == 4 && permissions[2] == 'x';
         mi->data = NULL;
+        mi->index = NULL;
         memcpy(mi->name, name, name_len);
         mi->name[name_len] = '\0';
         ALOGV("Parsed map: start=0x%08x, end=0x%08x, "
@@ -149,12 +189,16 @@ map_info_t* load_map_info_list(pid_t tid) {
         }
         fclose(fp);
     }
+    index_map_info_list(milist);
     return milist;
 }
 
 #endif
 
 void free_map_info_list(map_info_t* milist) {
+    if (milist) {
+        free(milist->index);
+    }
     while (milist) {
         map_info_t* next = milist->next;
         free(milist);
@@ -163,6 +207,24 @@ void free_map_info_list(map_info_t* milist) {
 }
 
 const map_info_t* find_map_info(const map_info_t* milist, uintptr_t addr) {
+    if (milist && milist->index) {
+        // Find the last map starting at or below addr
+        const map_index_t* index = milist->index;
+        size_t lo = 0, hi = index->count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (index->maps[mid]->start <= addr) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo && addr < index->maps[lo - 1]->end) {
+            return index->maps[lo - 1];
+        }
+        return NULL;
+    }
+
     const map_info_t* mi = milist;
     while (mi && !(addr >= mi->start && addr < mi->end)) {
         mi = mi->next;
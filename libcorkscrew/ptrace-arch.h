@@ -27,6 +27,23 @@
 extern "C" {
 #endif
 
+/* One entry of the unwind table of a library: the first pc that the entry
+ * covers and the architecture specific unwind data for it (the exception
+ * handler on ARM, the FDE on x86). */
+typedef struct {
+    uintptr_t pc;
+    uintptr_t data;
+} unwind_index_entry_t;
+
+/* A local copy of the unwind table of a library, sorted by pc.  It is read
+ * out of the remote process the first time a frame in that library is
+ * unwound so that later lookups do not touch the remote process at all. */
+typedef struct {
+    bool loaded;
+    size_t count;
+    unwind_index_entry_t* entries;
+} unwind_index_t;
+
 /* Custom extra data we stuff into map_info_t structures as part
  * of our ptrace_context_t. */
 typedef struct {
@@ -36,9 +53,17 @@ typedef struct {
 #elif __i386__
     uintptr_t eh_frame_hdr;
 #endif
+    unwind_index_t unwind_index;
     symbol_table_t* symbol_table;
 } map_info_data_t;
 
+/* Finds the last entry of the index whose pc is less than or equal to pc.
+ * Returns NULL if there is none. */
+const unwind_index_entry_t* find_unwind_index_entry(const unwind_index_t* index, uintptr_t pc);
+
+/* Frees the entries of an unwind index. */
+void free_unwind_index(unwind_index_t* index);
+
 void load_ptrace_map_info_data_arch(pid_t pid, map_info_t* mi, map_info_data_t* data);
 void free_ptrace_map_info_data_arch(map_info_t* mi, map_info_data_t* data);
 
@@ -22,7 +22,11 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <cutils/log.h>
 
 static const uint32_t ELF_MAGIC = 0x464C457f; // "ELF\0177"
@@ -35,16 +39,85 @@ static const uint32_t ELF_MAGIC = 0x464C457f; // "ELF\0177"
 #define PAGE_MASK (~(PAGE_SIZE - 1))
 #endif
 
+#define MEMORY_CACHE_PAGES 4
+
+struct memory_cache {
+    bool bulk_unsupported;
+    unsigned next;
+    struct {
+        bool valid;
+        uintptr_t page;
+        uint8_t data[PAGE_SIZE];
+    } pages[MEMORY_CACHE_PAGES];
+};
+
 void init_memory(memory_t* memory, const map_info_t* map_info_list) {
     memory->tid = -1;
     memory->map_info_list = map_info_list;
+    memory->cache = NULL;
 }
 
 void init_memory_ptrace(memory_t* memory, pid_t tid) {
     memory->tid = tid;
     memory->map_info_list = NULL;
+    memory->cache = NULL;
+}
+
+void init_memory_ptrace_context(memory_t* memory, const ptrace_context_t* context, pid_t tid) {
+    init_memory_ptrace(memory, tid);
+    memory->cache = context->memory_cache;
+    if (memory->cache) {
+        for (int i = 0; i < MEMORY_CACHE_PAGES; i++) {
+            memory->cache->pages[i].valid = false;
+        }
+    }
+}
+
+#if !defined(__APPLE__)
+/* Reads the whole page at page with one syscall, instead of a ptrace() per word. */
+static bool read_remote_page(memory_cache_t* cache, pid_t tid, uintptr_t page, uint8_t* data) {
+#ifdef __NR_process_vm_readv
+    if (!cache->bulk_unsupported) {
+        struct iovec local = { data, PAGE_SIZE };
+        struct iovec remote = { (void*) page, PAGE_SIZE };
+        ssize_t n = syscall(__NR_process_vm_readv, tid, &local, 1, &remote, 1, 0);
+        if (n == PAGE_SIZE) {
+            return true;
+        }
+        if (n < 0 && errno == ENOSYS) {
+            cache->bulk_unsupported = true;
+        }
+    }
+#else
+    (void) cache; (void) tid; (void) page; (void) data;
+#endif
+    return false;
 }
 
+/* Returns the cached copy of the page holding ptr, or NULL if it can't be read in bulk. */
+static const uint8_t* get_cached_page(memory_cache_t* cache, pid_t tid, uintptr_t ptr) {
+    uintptr_t page = ptr & PAGE_MASK;
+    for (int i = 0; i < MEMORY_CACHE_PAGES; i++) {
+        if (cache->pages[i].valid && cache->pages[i].page == page) {
+            return cache->pages[i].data;
+        }
+    }
+    if (cache->bulk_unsupported) {
+        return NULL;
+    }
+
+    unsigned slot = cache->next;
+    cache->pages[slot].valid = false;
+    if (!read_remote_page(cache, tid, page, cache->pages[slot].data)) {
+        return NULL;
+    }
+    cache->pages[slot].valid = true;
+    cache->pages[slot].page = page;
+    cache->next = (slot + 1) % MEMORY_CACHE_PAGES;
+    return cache->pages[slot].data;
+}
+#endif
+
 bool try_get_word(const memory_t* memory, uintptr_t ptr, uint32_t* out_value) {
     ALOGV("try_get_word: reading word at %p", (void*) ptr);
     if (ptr & 3) {
@@ -65,6 +138,15 @@ bool try_get_word(const memory_t* memory, uintptr_t ptr, uint32_t* out_value) {
         ALOGV("no ptrace on Mac OS");
         return false;
 #else
+        if (memory->cache) {
+            const uint8_t* data = get_cached_page(memory->cache, memory->tid, ptr);
+            if (data) {
+                memcpy(out_value, data + (ptr & ~PAGE_MASK), sizeof(*out_value));
+                return true;
+            }
+            // fall back to ptrace(), which also tells us why the read failed
+        }
+
         // ptrace() returns -1 and sets errno when the operation fails.
         // To disambiguate -1 from a valid result, we clear errno beforehand.
         errno = 0;
@@ -107,6 +189,8 @@ ptrace_context_t* load_ptrace_context(pid_t pid) {
     ptrace_context_t* context =
             (ptrace_context_t*)calloc(1, sizeof(ptrace_context_t));
     if (context) {
+        // only an optimization, so carry on without it
+        context->memory_cache = (memory_cache_t*)calloc(1, sizeof(memory_cache_t));
         context->map_info_list = load_map_info_list(pid);
         for (map_info_t* mi = context->map_info_list; mi; mi = mi->next) {
             load_ptrace_map_info_data(pid, mi);
@@ -124,6 +208,7 @@ static void free_ptrace_map_info_data(map_info_t* mi) {
 #ifdef CORKSCREW_HAVE_ARCH
         free_ptrace_map_info_data_arch(mi, data);
 #endif
+        free_unwind_index(&data->unwind_index);
         free(data);
         mi->data = NULL;
     }
@@ -134,9 +219,31 @@ void free_ptrace_context(ptrace_context_t* context) {
         free_ptrace_map_info_data(mi);
     }
     free_map_info_list(context->map_info_list);
+    free(context->memory_cache);
     free(context);
 }
 
+const unwind_index_entry_t* find_unwind_index_entry(const unwind_index_t* index, uintptr_t pc) {
+    size_t low = 0;
+    size_t high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (pc < index->entries[mid].pc) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low ? &index->entries[low - 1] : NULL;
+}
+
+void free_unwind_index(unwind_index_t* index) {
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+    index->loaded = false;
+}
+
 void find_symbol_ptrace(const ptrace_context_t* context,
         uintptr_t addr, const map_info_t** out_map_info, const symbol_t** out_symbol) {
     const map_info_t* mi = find_map_info(context->map_info_list, addr);
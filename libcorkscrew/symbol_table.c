@@ -22,7 +22,9 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <cutils/log.h>
@@ -59,22 +61,51 @@ static int bcompar(const void *key, const void *element) {
     return 0;
 }
 
-symbol_table_t* load_symbol_table(const char *filename) {
-    symbol_table_t* table = NULL;
+/*
+ * Symbol tables are shared by everyone in the process who loads the same
+ * file, and the symbols are only read the first time one is looked up.
+ * A few tables nobody holds any more are kept around for the next user,
+ * since the same libraries turn up in every process we are asked about.
+ */
+#define MAX_UNUSED_TABLES 32
+
+typedef struct cached_table {
+    symbol_table_t table;       // must come first
+    struct cached_table* next;
+    char* filename;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    int refs;
+    bool loaded;
+    char* names;                // the names of all the symbols, back to back
+} cached_table_t;
+
+static pthread_mutex_t g_tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cached_table_t* g_tables;    // most recently used first
+
+static void free_cached_table(cached_table_t* ct) {
+    free(ct->table.symbols);
+    free(ct->names);
+    free(ct->filename);
+    free(ct);
+}
+
+/* Reads the symbols of the table's file.  Called with g_tables_mutex held. */
+static void read_symbols(cached_table_t* ct) {
+    symbol_table_t* table = &ct->table;
+
+    ct->loaded = true;
 #if !defined(__APPLE__)
-    ALOGV("Loading symbol table from '%s'.", filename);
+    ALOGV("Loading symbol table from '%s'.", ct->filename);
 
-    int fd = open(filename, O_RDONLY);
+    int fd = open(ct->filename, O_RDONLY);
     if (fd < 0) {
-        goto out;
+        return;
     }
 
-    struct stat sb;
-    if (fstat(fd, &sb)) {
-        goto out_close;
-    }
-
-    size_t length = sb.st_size;
+    size_t length = ct->size;
     char* base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
     if (base == MAP_FAILED) {
         goto out_close;
@@ -83,7 +114,7 @@ symbol_table_t* load_symbol_table(const char *filename) {
     // Parse the file header
     Elf32_Ehdr *hdr = (Elf32_Ehdr*)base;
     if (!is_elf(hdr)) {
-        goto out_close;
+        goto out_unmap;
     }
     Elf32_Shdr *shdr = (Elf32_Shdr*)(base + hdr->e_shoff);
 
@@ -102,12 +133,6 @@ symbol_table_t* load_symbol_table(const char *filename) {
         goto out_unmap;
     }
 
-    table = malloc(sizeof(symbol_table_t));
-    if(!table) {
-        goto out_unmap;
-    }
-    table->num_symbols = 0;
-
     Elf32_Sym *dynsyms = NULL;
     int dynnumsyms = 0;
     char *dynstr = NULL;
@@ -128,73 +153,72 @@ symbol_table_t* load_symbol_table(const char *filename) {
         str = base + shdr[str_idx].sh_offset;
     }
 
-    int dynsymbol_count = 0;
-    if (dynsym_idx != -1) {
-        // Iterate through the dynamic symbol table, and count how many symbols
-        // are actually defined
-        for (int i = 0; i < dynnumsyms; i++) {
-            if (dynsyms[i].st_shndx != SHN_UNDEF) {
-                dynsymbol_count++;
-            }
+    // Count how many symbols are actually defined, and how long their names are
+    size_t symbol_count = 0;
+    size_t names_length = 0;
+    for (int i = 0; i < dynnumsyms; i++) {
+        if (dynsyms[i].st_shndx != SHN_UNDEF) {
+            symbol_count++;
+            names_length += strlen(dynstr + dynsyms[i].st_name) + 1;
         }
     }
-
-    size_t symbol_count = 0;
-    if (sym_idx != -1) {
-        // Iterate through the symbol table, and count how many symbols
-        // are actually defined
-        for (int i = 0; i < numsyms; i++) {
-            if (syms[i].st_shndx != SHN_UNDEF
-                    && str[syms[i].st_name]
-                    && syms[i].st_value
-                    && syms[i].st_size) {
-                symbol_count++;
-            }
+    for (int i = 0; i < numsyms; i++) {
+        if (syms[i].st_shndx != SHN_UNDEF
+                && str[syms[i].st_name]
+                && syms[i].st_value
+                && syms[i].st_size) {
+            symbol_count++;
+            names_length += strlen(str + syms[i].st_name) + 1;
         }
     }
 
-    // Now, create an entry in our symbol table structure for each symbol...
-    table->num_symbols += symbol_count + dynsymbol_count;
-    table->symbols = malloc(table->num_symbols * sizeof(symbol_t));
-    if (!table->symbols) {
-        free(table);
-        table = NULL;
+    // Now, create an entry in our symbol table structure for each symbol,
+    // with one allocation for the names rather than one each
+    table->symbols = malloc(symbol_count * sizeof(symbol_t));
+    ct->names = malloc(names_length);
+    if (!table->symbols || !ct->names) {
+        free(table->symbols);
+        free(ct->names);
+        table->symbols = NULL;
+        ct->names = NULL;
         goto out_unmap;
     }
 
     size_t symbol_index = 0;
-    if (dynsym_idx != -1) {
-        // ...and populate them
-        for (int i = 0; i < dynnumsyms; i++) {
-            if (dynsyms[i].st_shndx != SHN_UNDEF) {
-                table->symbols[symbol_index].name = strdup(dynstr + dynsyms[i].st_name);
-                table->symbols[symbol_index].start = dynsyms[i].st_value;
-                table->symbols[symbol_index].end = dynsyms[i].st_value + dynsyms[i].st_size;
-                ALOGV("  [%d] '%s' 0x%08x-0x%08x (DYNAMIC)",
-                        symbol_index, table->symbols[symbol_index].name,
-                        table->symbols[symbol_index].start, table->symbols[symbol_index].end);
-                symbol_index += 1;
-            }
+    char* name = ct->names;
+    // ...and populate them
+    for (int i = 0; i < dynnumsyms; i++) {
+        if (dynsyms[i].st_shndx != SHN_UNDEF) {
+            size_t len = strlen(dynstr + dynsyms[i].st_name) + 1;
+            memcpy(name, dynstr + dynsyms[i].st_name, len);
+            table->symbols[symbol_index].name = name;
+            table->symbols[symbol_index].start = dynsyms[i].st_value;
+            table->symbols[symbol_index].end = dynsyms[i].st_value + dynsyms[i].st_size;
+            ALOGV("  [%d] '%s' 0x%08x-0x%08x (DYNAMIC)",
+                    symbol_index, table->symbols[symbol_index].name,
+                    table->symbols[symbol_index].start, table->symbols[symbol_index].end);
+            name += len;
+            symbol_index += 1;
         }
     }
-
-    if (sym_idx != -1) {
-        // ...and populate them
-        for (int i = 0; i < numsyms; i++) {
-            if (syms[i].st_shndx != SHN_UNDEF
-                    && str[syms[i].st_name]
-                    && syms[i].st_value
-                    && syms[i].st_size) {
-                table->symbols[symbol_index].name = strdup(str + syms[i].st_name);
-                table->symbols[symbol_index].start = syms[i].st_value;
-                table->symbols[symbol_index].end = syms[i].st_value + syms[i].st_size;
-                ALOGV("  [%d] '%s' 0x%08x-0x%08x",
-                        symbol_index, table->symbols[symbol_index].name,
-                        table->symbols[symbol_index].start, table->symbols[symbol_index].end);
-                symbol_index += 1;
-            }
+    for (int i = 0; i < numsyms; i++) {
+        if (syms[i].st_shndx != SHN_UNDEF
+                && str[syms[i].st_name]
+                && syms[i].st_value
+                && syms[i].st_size) {
+            size_t len = strlen(str + syms[i].st_name) + 1;
+            memcpy(name, str + syms[i].st_name, len);
+            table->symbols[symbol_index].name = name;
+            table->symbols[symbol_index].start = syms[i].st_value;
+            table->symbols[symbol_index].end = syms[i].st_value + syms[i].st_size;
+            ALOGV("  [%d] '%s' 0x%08x-0x%08x",
+                    symbol_index, table->symbols[symbol_index].name,
+                    table->symbols[symbol_index].start, table->symbols[symbol_index].end);
+            name += len;
+            symbol_index += 1;
         }
     }
+    table->num_symbols = symbol_count;
 
     // Sort the symbol table entries, so they can be bsearched later
     qsort(table->symbols, table->num_symbols, sizeof(symbol_t), qcompar);
@@ -205,23 +229,91 @@ out_unmap:
 out_close:
     close(fd);
 #endif
+}
+
+symbol_table_t* load_symbol_table(const char *filename) {
+    struct stat sb;
+    if (stat(filename, &sb) || !S_ISREG(sb.st_mode)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_tables_mutex);
+
+    // Reuse the table for this file if it hasn't changed since it was read
+    cached_table_t** prev = &g_tables;
+    cached_table_t* ct;
+    for (ct = g_tables; ct; prev = &ct->next, ct = ct->next) {
+        if (ct->dev == sb.st_dev && ct->ino == sb.st_ino && ct->size == sb.st_size
+                && ct->mtime == sb.st_mtime && !strcmp(ct->filename, filename)) {
+            *prev = ct->next;
+            break;
+        }
+    }
+
+    if (!ct) {
+        ct = calloc(1, sizeof(cached_table_t));
+        if (ct) {
+            ct->filename = strdup(filename);
+            if (!ct->filename) {
+                free(ct);
+                ct = NULL;
+            }
+        }
+        if (!ct) {
+            pthread_mutex_unlock(&g_tables_mutex);
+            return NULL;
+        }
+        ct->dev = sb.st_dev;
+        ct->ino = sb.st_ino;
+        ct->size = sb.st_size;
+        ct->mtime = sb.st_mtime;
+    }
+
+    ct->refs++;
+    ct->next = g_tables;
+    g_tables = ct;
 
-out:
-    return table;
+    pthread_mutex_unlock(&g_tables_mutex);
+    return &ct->table;
 }
 
 void free_symbol_table(symbol_table_t* table) {
-    if (table) {
-        for (size_t i = 0; i < table->num_symbols; i++) {
-            free(table->symbols[i].name);
+    if (!table) {
+        return;
+    }
+
+    cached_table_t* ct = (cached_table_t*)table;
+    cached_table_t* victim = NULL;
+
+    pthread_mutex_lock(&g_tables_mutex);
+    ct->refs--;
+
+    // Forget the least recently used table past the unused limit
+    int unused = 0;
+    for (cached_table_t** prev = &g_tables; *prev; prev = &(*prev)->next) {
+        if (!(*prev)->refs && ++unused > MAX_UNUSED_TABLES) {
+            victim = *prev;
+            *prev = victim->next;
+            break;
         }
-        free(table->symbols);
-        free(table);
+    }
+    pthread_mutex_unlock(&g_tables_mutex);
+
+    if (victim) {
+        free_cached_table(victim);
     }
 }
 
 const symbol_t* find_symbol(const symbol_table_t* table, uintptr_t addr) {
     if (!table) return NULL;
+
+    cached_table_t* ct = (cached_table_t*)table;
+    pthread_mutex_lock(&g_tables_mutex);
+    if (!ct->loaded) {
+        read_symbols(ct);
+    }
+    pthread_mutex_unlock(&g_tables_mutex);
+
     return (const symbol_t*)bsearch(&addr, table->symbols, table->num_symbols,
             sizeof(symbol_t), bcompar);
 }
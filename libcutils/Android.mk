@@ -67,8 +67,10 @@ endif
 
 ifneq ($(WINDOWS_HOST_ONLY),1)
     commonSources += \
+        ashmem-pool.c \
         fs.c \
-        multiuser.c
+        multiuser.c \
+        perfstat.c
 endif
 
 
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Region pooling and range batching on top of the ashmem API, shared by the
+ * device and host implementations.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+
+struct ashmem_pool_entry {
+	int fd;
+	size_t size;
+};
+
+struct ashmem_pool {
+	pthread_mutex_t lock;
+	char name[ASHMEM_NAME_LEN];
+	size_t max_free;
+	size_t free_count;
+	struct ashmem_pool_entry entries[];
+};
+
+struct ashmem_pool *ashmem_pool_create(const char *name, size_t max_free)
+{
+	struct ashmem_pool *pool;
+
+	pool = calloc(1, sizeof(*pool) +
+			max_free * sizeof(struct ashmem_pool_entry));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	if (name)
+		strncpy(pool->name, name, sizeof(pool->name) - 1);
+	pool->max_free = max_free;
+	return pool;
+}
+
+void ashmem_pool_destroy(struct ashmem_pool *pool)
+{
+	size_t i;
+
+	for (i = 0; i < pool->free_count; i++)
+		close(pool->entries[i].fd);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int ashmem_pool_get(struct ashmem_pool *pool, size_t size)
+{
+	size_t i;
+	int fd = -1;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = pool->free_count; i-- > 0; ) {
+		if (pool->entries[i].size == size) {
+			fd = pool->entries[i].fd;
+			pool->entries[i] = pool->entries[--pool->free_count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (fd < 0)
+		return ashmem_create_region(pool->name[0] ? pool->name : NULL, size);
+
+	/* idle regions are unpinned, so take the whole region back */
+	if (ashmem_pin_region(fd, 0, 0) < 0) {
+		close(fd);
+		return ashmem_create_region(pool->name[0] ? pool->name : NULL, size);
+	}
+	return fd;
+}
+
+void ashmem_pool_put(struct ashmem_pool *pool, int fd)
+{
+	int size = ashmem_get_size_region(fd);
+
+	/* let the kernel reclaim the pages while nobody uses them */
+	if (size <= 0 || ashmem_unpin_region(fd, 0, 0) < 0) {
+		close(fd);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->free_count < pool->max_free) {
+		pool->entries[pool->free_count].fd = fd;
+		pool->entries[pool->free_count].size = size;
+		pool->free_count++;
+		fd = -1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+/*
+ * Applies op to each run of back-to-back ranges as a single range, and
+ * returns the largest result, so ASHMEM_WAS_PURGED if any pin found a purge.
+ */
+static int ashmem_apply_ranges(int fd, const struct ashmem_range *ranges,
+			       size_t count,
+			       int (*op)(int fd, size_t offset, size_t len))
+{
+	size_t i = 0;
+	int result = 0;
+
+	while (i < count) {
+		size_t offset = ranges[i].offset;
+		size_t len = ranges[i].len;
+		int ret;
+
+		/* a zero length runs to the end of the region, so it ends a run */
+		for (i++; len && i < count && ranges[i].offset == offset + len; i++)
+			len = ranges[i].len ? len + ranges[i].len : 0;
+
+		ret = op(fd, offset, len);
+		if (ret < 0)
+			return ret;
+		if (ret > result)
+			result = ret;
+	}
+	return result;
+}
+
+int ashmem_pin_ranges(int fd, const struct ashmem_range *ranges, size_t count)
+{
+	return ashmem_apply_ranges(fd, ranges, count, ashmem_pin_region);
+}
+
+int ashmem_unpin_ranges(int fd, const struct ashmem_range *ranges, size_t count)
+{
+	return ashmem_apply_ranges(fd, ranges, count, ashmem_unpin_region);
+}
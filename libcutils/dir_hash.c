@@ -16,6 +16,8 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +32,12 @@
 
 #include <cutils/dir_hash.h>
 
+/* Reads this big keep the flash busy; the buffer is on each hashing thread's stack. */
+#define READ_SIZE (64 * 1024)
+
+/* Past this there is nothing left to gain on flash. */
+#define MAX_THREADS 8
+
 /**
  * Copies, if it fits within max_output_string bytes, into output_string
  * a hash of the contents, size, permissions, uid, and gid of the file
@@ -41,7 +49,7 @@ int get_file_hash(HashAlgorithm algorithm, const char *path,
     SHA1_CTX context;
     struct stat sb;
     unsigned char md[SHA1_DIGEST_LENGTH];
-    int used;
+    int used = 0;
     size_t n;
 
     if (algorithm != SHA_1) {
@@ -66,26 +74,29 @@ int get_file_hash(HashAlgorithm algorithm, const char *path,
         SHA1Update(&context, (unsigned char *) buf, len);
         SHA1Final(md, &context);
     } else if (S_ISREG(sb.st_mode)) {
-        char buf[10000];
-        FILE *f = fopen(path, "rb");
-        int len;
+        char buf[READ_SIZE];
+        int fd = open(path, O_RDONLY);
+        ssize_t len;
 
-        if (f == NULL) {
+        if (fd < 0) {
             return -1;
         }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
         SHA1Init(&context);
 
-        while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        while ((len = read(fd, buf, sizeof(buf))) != 0) {
+            if (len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                close(fd);
+                return -1;
+            }
             SHA1Update(&context, (unsigned char *) buf, len);
         }
 
-        if (ferror(f)) {
-            fclose(f);
-            return -1;
-        }
-
-        fclose(f);
+        close(fd);
         SHA1Final(md, &context);
     }
 
@@ -114,30 +125,66 @@ int get_file_hash(HashAlgorithm algorithm, const char *path,
     return used + n;
 }
 
-struct list {
-    char *name;
-    struct list *next;
+struct entry {
+    char *path;
+    char *line;     /* "path hash\n", once hashed */
 };
 
-static int cmp(const void *a, const void *b) {
-    struct list *const *ra = a;
-    struct list *const *rb = b;
+struct manifest {
+    struct entry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+static void free_manifest(struct manifest *m) {
+    size_t i;
 
-    return strcmp((*ra)->name, (*rb)->name);
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].path);
+        free(m->entries[i].line);
+    }
+    free(m->entries);
 }
 
-static int recurse(HashAlgorithm algorithm, const char *directory_path,
-                    struct list **out) {
-    struct list *list = NULL;
-    struct list *f;
+static int add_entry(struct manifest *m, const char *directory_path,
+                     const char *name) {
+    struct entry *e;
+
+    if (m->count == m->capacity) {
+        size_t capacity = m->capacity ? m->capacity * 2 : 64;
+        e = realloc(m->entries, capacity * sizeof(*e));
+        if (e == NULL) {
+            return -1;
+        }
+        m->entries = e;
+        m->capacity = capacity;
+    }
 
+    e = &m->entries[m->count];
+    e->path = malloc(strlen(directory_path) + strlen(name) + 2);
+    if (e->path == NULL) {
+        return -1;
+    }
+    sprintf(e->path, "%s/%s", directory_path, name);
+    e->line = NULL;
+    m->count++;
+    return 0;
+}
+
+/*
+ * Adds everything under directory_path to the manifest, without hashing
+ * anything yet, so that the hashing can be spread over several threads.
+ */
+static int recurse(const char *directory_path, struct manifest *m) {
     struct dirent *de;
+    size_t first, last, i;
     DIR *d = opendir(directory_path);
 
     if (d == NULL) {
         return -1;
     }
 
+    first = m->count;
     while ((de = readdir(d)) != NULL) {
         if (strcmp(de->d_name, ".") == 0) {
             continue;
@@ -145,114 +192,123 @@ static int recurse(HashAlgorithm algorithm, const char *directory_path,
         if (strcmp(de->d_name, "..") == 0) {
             continue;
         }
-
-        char *name = malloc(strlen(de->d_name) + 1);
-        struct list *node = malloc(sizeof(struct list));
-
-        if (name == NULL || node == NULL) {
-            struct list *next;
-            for (f = list; f != NULL; f = next) {
-                next = f->next;
-                free(f->name);
-                free(f);
-            }
-
-            free(name);
-            free(node);
+        if (add_entry(m, directory_path, de->d_name) < 0) {
+            closedir(d);
             return -1;
         }
-
-        strcpy(name, de->d_name);
-
-        node->name = name;
-        node->next = list;
-        list = node;
     }
+    last = m->count;
 
     closedir(d);
 
-    for (f = list; f != NULL; f = f->next) {
+    for (i = first; i < last; i++) {
         struct stat sb;
-        char *name;
-        char outstr[NAME_MAX + 100];
-        char *keep;
-        struct list *res;
-
-        name = malloc(strlen(f->name) + strlen(directory_path) + 2);
-        if (name == NULL) {
-            struct list *next;
-            for (f = list; f != NULL; f = f->next) {
-                next = f->next;
-                free(f->name);
-                free(f);
-            }
-            for (f = *out; f != NULL; f = f->next) {
-                next = f->next;
-                free(f->name);
-                free(f);
+
+        if ((stat(m->entries[i].path, &sb) == 0) && S_ISDIR(sb.st_mode)) {
+            /* The entries may move as the child directory is added. */
+            char *path = strdup(m->entries[i].path);
+            int res = path == NULL ? -1 : recurse(path, m);
+
+            free(path);
+            if (res < 0) {
+                return -1;
             }
-            *out = NULL;
-            return -1;
         }
+    }
 
-        sprintf(name, "%s/%s", directory_path, f->name);
+    return 0;
+}
 
-        int len = get_file_hash(algorithm, name,
-                                outstr, sizeof(outstr));
-        if (len < 0) {
-            // should not happen
-            return -1;
-        }
+struct hash_job {
+    HashAlgorithm algorithm;
+    struct manifest *manifest;
 
-        keep = malloc(len + strlen(name) + 3);
-        res = malloc(sizeof(struct list));
+    pthread_mutex_t lock;
+    size_t next;        /* next entry to hash */
+    int failed;
+};
 
-        if (keep == NULL || res == NULL) {
-            struct list *next;
-            for (f = list; f != NULL; f = f->next) {
-                next = f->next;
-                free(f->name);
-                free(f);
-            }
-            for (f = *out; f != NULL; f = f->next) {
-                next = f->next;
-                free(f->name);
-                free(f);
-            }
-            *out = NULL;
+static void *hash_thread(void *arg) {
+    struct hash_job *job = arg;
+    char outstr[NAME_MAX + 100];
 
-            free(keep);
-            free(res);
-            return -1;
+    while (1) {
+        struct entry *e;
+        size_t i;
+        int len;
+
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        if (job->failed) {
+            i = job->manifest->count;
+        }
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->manifest->count) {
+            break;
         }
 
-        sprintf(keep, "%s %s\n", name, outstr);
+        e = &job->manifest->entries[i];
+        len = get_file_hash(job->algorithm, e->path, outstr, sizeof(outstr));
+        if (len >= 0) {
+            e->line = malloc(strlen(e->path) + len + 3);
+        }
+        if (len < 0 || e->line == NULL) {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        sprintf(e->line, "%s %s\n", e->path, outstr);
+    }
 
-        res->name = keep;
-        res->next = *out;
-        *out = res;
+    return NULL;
+}
 
-        if ((stat(name, &sb) == 0) && S_ISDIR(sb.st_mode)) {
-            if (recurse(algorithm, name, out) < 0) {
-                struct list *next;
-                for (f = list; f != NULL; f = next) {
-                    next = f->next;
-                    free(f->name);
-                    free(f);
-                }
+/*
+ * Hashes every entry of the manifest, on a pool of threads.
+ */
+static int hash_entries(HashAlgorithm algorithm, struct manifest *m) {
+    pthread_t tids[MAX_THREADS - 1];
+    struct hash_job job;
+    long threads;
+    int started = 0;
+    int i;
 
-                return -1;
-            }
-        }
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (threads > (long) m->count) {
+        threads = m->count;
     }
 
-    struct list *next;
-    for (f = list; f != NULL; f = next) {
-        next = f->next;
+    memset(&job, 0, sizeof(job));
+    job.algorithm = algorithm;
+    job.manifest = m;
+    pthread_mutex_init(&job.lock, NULL);
 
-        free(f->name);
-        free(f);
+    /* This thread is one of them. */
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, hash_thread, &job) != 0) {
+            break;
+        }
+        started++;
     }
+    hash_thread(&job);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    return job.failed ? -1 : 0;
+}
+
+static int cmp(const void *a, const void *b) {
+    const struct entry *ea = a;
+    const struct entry *eb = b;
+
+    return strcmp(ea->line, eb->line);
 }
 
 /**
@@ -264,70 +320,40 @@ static int recurse(HashAlgorithm algorithm, const char *directory_path,
 int get_recursive_hash_manifest(HashAlgorithm algorithm,
                                 const char *directory_path,
                                 char **output_string) {
-    struct list *out = NULL;
-    struct list *r;
-    struct list **list;
-    int count = 0;
-    int len = 0;
+    struct manifest m;
+    size_t len = 0;
     int retlen = 0;
-    int i;
+    size_t i;
     char *buf;
-    
-    if (recurse(algorithm, directory_path, &out) < 0) {
-        return -1;
-    }
 
-    for (r = out; r != NULL; r = r->next) {
-        count++;
-        len += strlen(r->name);
-    }
-
-    list = malloc(count * sizeof(struct list *));
-    if (list == NULL) {
-        struct list *next;
-        for (r = out; r != NULL; r = next) {
-            next = r->next;
-            free(r->name);
-            free(r);
-        }
+    memset(&m, 0, sizeof(m));
+    if (recurse(directory_path, &m) < 0 || hash_entries(algorithm, &m) < 0) {
+        free_manifest(&m);
         return -1;
     }
 
-    count = 0;
-    for (r = out; r != NULL; r = r->next) {
-        list[count++] = r;
-    }
+    /* The lines are sorted, so the order the threads finish in doesn't show. */
+    qsort(m.entries, m.count, sizeof(m.entries[0]), cmp);
 
-    qsort(list, count, sizeof(struct list *), cmp);
+    for (i = 0; i < m.count; i++) {
+        len += strlen(m.entries[i].line);
+    }
 
     buf = malloc(len + 1);
     if (buf == NULL) {
-        struct list *next;
-        for (r = out; r != NULL; r = next) {
-            next = r->next;
-            free(r->name);
-            free(r);
-        }
-        free(list);
+        free_manifest(&m);
         return -1;
     }
+    buf[0] = '\0';
 
-    for (i = 0; i < count; i++) {
-        int n = strlen(list[i]->name);
+    for (i = 0; i < m.count; i++) {
+        int n = strlen(m.entries[i].line);
 
-        strcpy(buf + retlen, list[i]->name);
+        strcpy(buf + retlen, m.entries[i].line);
         retlen += n;
     }
 
-    free(list);
-
-    struct list *next;
-    for (r = out; r != NULL; r = next) {
-        next = r->next;
-
-        free(r->name);
-        free(r);
-    }
+    free_manifest(&m);
 
     *output_string = buf;
     return retlen;
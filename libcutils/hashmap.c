@@ -23,23 +23,72 @@
 #include <stdbool.h>
 #include <sys/types.h>
 
+/*
+ * An open addressing table with linear probing.  Entries live in the table
+ * itself, so a lookup touches a cache line or two instead of a linked list
+ * of separately allocated nodes.
+ *
+ * Removed entries are left behind as tombstones, so that removing an entry
+ * does not break the probe sequences going through it, or an iteration in
+ * progress.
+ *
+ * When the table fills up it is not rehashed all at once.  A new table is
+ * allocated, and each insertion moves a few entries of the old one over,
+ * while lookups check both.  The old table is gone by the time the new one
+ * could fill up in turn.
+ */
+
+enum {
+    ENTRY_EMPTY = 0,
+    ENTRY_USED,
+    ENTRY_DELETED,
+};
+
+// How many slots of the old table each insertion moves over.  The new table
+// is twice as big, so it takes at least half of the old table's size in
+// insertions to fill it up again.
+#define MIGRATE_STEP 4
+
 typedef struct Entry Entry;
 struct Entry {
     void* key;
-    int hash;
     void* value;
-    Entry* next;
+    int hash;
+    unsigned char state;
+};
+
+typedef struct Table Table;
+struct Table {
+    Entry* entries;
+    size_t capacity;    // power of 2, or 0 if there is no table
+    size_t used;        // entries that are used or deleted
 };
 
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
+    Table table;        // where new entries go
+    Table old;          // the table being moved over, if any
+    size_t migrated;    // slots of the old table moved over so far
+    size_t size;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
-    mutex_t lock; 
-    size_t size;
+    mutex_t lock;
 };
 
+static bool initTable(Table* table, size_t capacity) {
+    table->entries = calloc(capacity, sizeof(Entry));
+    if (table->entries == NULL) {
+        return false;
+    }
+    table->capacity = capacity;
+    table->used = 0;
+    return true;
+}
+
+static inline bool isFull(const Table* table) {
+    // 0.75 load factor, counting tombstones.
+    return table->used >= table->capacity * 3 / 4;
+}
+
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
     assert(hash != NULL);
@@ -51,18 +100,21 @@ Hashmap* hashmapCreate(size_t initialCapacity,
     }
     
     // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1; 
+    size_t minimumCapacity = initialCapacity * 4 / 3;
+    size_t capacity = 4;
+    while (capacity <= minimumCapacity) {
+        // Capacity must be power of 2.
+        capacity <<= 1;
     }
 
-    map->buckets = calloc(map->bucketCount, sizeof(Entry*));
-    if (map->buckets == NULL) {
+    if (!initTable(&map->table, capacity)) {
         free(map);
         return NULL;
     }
+    map->old.entries = NULL;
+    map->old.capacity = 0;
+    map->old.used = 0;
+    map->migrated = 0;
     
     map->size = 0;
 
@@ -94,41 +146,134 @@ size_t hashmapSize(Hashmap* map) {
     return map->size;
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+static inline size_t calculateIndex(size_t capacity, int hash) {
+    return ((size_t) hash) & (capacity - 1);
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = calloc(newBucketCount, sizeof(Entry*));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
+static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
+        bool (*equals)(void*, void*)) {
+    if (keyA == keyB) {
+        return true;
+    }
+    if (hashA != hashB) {
+        return false;
+    }
+    return equals(keyA, keyB);
+}
+
+/**
+ * Finds the entry for the given key in the table, or returns NULL.
+ */
+static Entry* findEntry(Hashmap* map, Table* table, void* key, int hash) {
+    if (table->entries == NULL) {
+        return NULL;
+    }
+    size_t mask = table->capacity - 1;
+    size_t index = calculateIndex(table->capacity, hash);
+    while (true) {
+        Entry* entry = &table->entries[index];
+        if (entry->state == ENTRY_EMPTY) {
+            return NULL;
         }
-        
-        // Move over existing entries.
-        size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
-            }
+        if (entry->state == ENTRY_USED
+                && equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
+            return entry;
         }
+        index = (index + 1) & mask;
+    }
+}
+
+/**
+ * Finds the entry for the given key in either table, or returns NULL.
+ */
+static inline Entry* lookUp(Hashmap* map, void* key, int hash) {
+    Entry* entry = findEntry(map, &map->table, key, hash);
+    if (entry == NULL) {
+        entry = findEntry(map, &map->old, key, hash);
+    }
+    return entry;
+}
+
+/**
+ * Adds an entry for a key known not to be in the table, which has room.
+ */
+static Entry* addEntry(Table* table, void* key, int hash, void* value) {
+    size_t mask = table->capacity - 1;
+    size_t index = calculateIndex(table->capacity, hash);
+    Entry* entry;
+    while (true) {
+        entry = &table->entries[index];
+        if (entry->state != ENTRY_USED) {
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    if (entry->state == ENTRY_EMPTY) {
+        table->used++;
+    }
+    entry->key = key;
+    entry->hash = hash;
+    entry->value = value;
+    entry->state = ENTRY_USED;
+    return entry;
+}
 
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
+/**
+ * Moves up to count slots of the old table over to the new one.
+ */
+static void migrate(Hashmap* map, size_t count) {
+    Table* old = &map->old;
+    if (old->entries == NULL) {
+        return;
+    }
+    while (count-- > 0 && map->migrated < old->capacity) {
+        Entry* entry = &old->entries[map->migrated++];
+        if (entry->state == ENTRY_USED) {
+            addEntry(&map->table, entry->key, entry->hash, entry->value);
+            // Keep the probe sequences through this slot intact.
+            entry->state = ENTRY_DELETED;
+        }
+    }
+    if (map->migrated == old->capacity) {
+        free(old->entries);
+        old->entries = NULL;
+        old->capacity = 0;
+        old->used = 0;
+        map->migrated = 0;
     }
 }
 
+/**
+ * Makes room for one more entry in the table.  Returns false if memory
+ * allocation fails and there is no room left.
+ */
+static bool makeRoom(Hashmap* map) {
+    migrate(map, MIGRATE_STEP);
+    if (!isFull(&map->table)) {
+        return true;
+    }
+
+    // The previous table, if still around, has to go first.
+    migrate(map, map->old.capacity);
+
+    // Grow, unless the table is mostly tombstones, in which case moving the
+    // entries over to a table of the same size is enough.
+    size_t capacity = map->table.capacity;
+    if (map->size >= capacity / 2) {
+        capacity <<= 1;
+    }
+    Table table;
+    if (!initTable(&table, capacity)) {
+        // Carry on with the current table until it is really full.
+        return map->table.used + 1 < map->table.capacity;
+    }
+    map->old = map->table;
+    map->table = table;
+    map->migrated = 0;
+    migrate(map, MIGRATE_STEP);
+    return true;
+}
+
 void hashmapLock(Hashmap* map) {
     mutex_lock(&map->lock);
 }
@@ -138,16 +283,8 @@ void hashmapUnlock(Hashmap* map) {
 }
 
 void hashmapFree(Hashmap* map) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
-        }
-    }
-    free(map->buckets);
+    free(map->table.entries);
+    free(map->old.entries);
     mutex_destroy(&map->lock);
     free(map);
 }
@@ -163,182 +300,116 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = malloc(sizeof(Entry));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
-        bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
-}
-
 void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            map->size++;
-            expandIfNecessary(map);
-            return NULL;
-        }
 
-        // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
-            return oldValue;
-        }
+    // Replace existing entry.
+    Entry* entry = lookUp(map, key, hash);
+    if (entry != NULL) {
+        void* oldValue = entry->value;
+        entry->value = value;
+        return oldValue;
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!makeRoom(map)) {
+        errno = ENOMEM;
+        return NULL;
     }
+    addEntry(&map->table, key, hash, value);
+    map->size++;
+    return NULL;
 }
 
 void* hashmapGet(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
-        }
-        entry = entry->next;
-    }
-
-    return NULL;
+    Entry* entry = lookUp(map, key, hash);
+    return entry != NULL ? entry->value : NULL;
 }
 
 bool hashmapContainsKey(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return true;
-        }
-        entry = entry->next;
-    }
-
-    return false;
+    return lookUp(map, key, hash) != NULL;
 }
 
 void* hashmapMemoize(Hashmap* map, void* key, 
         void* (*initialValue)(void* key, void* context), void* context) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, NULL);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            void* value = initialValue(key, context);
-            (*p)->value = value;
-            map->size++;
-            expandIfNecessary(map);
-            return value;
-        }
 
-        // Return existing value.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            return current->value;
-        }
+    // Return existing value.
+    Entry* entry = lookUp(map, key, hash);
+    if (entry != NULL) {
+        return entry->value;
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!makeRoom(map)) {
+        errno = ENOMEM;
+        return NULL;
     }
+    entry = addEntry(&map->table, key, hash, NULL);
+    void* value = initialValue(key, context);
+    entry->value = value;
+    map->size++;
+    return value;
 }
 
 void* hashmapRemove(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
-        }
-
-        p = &current->next;
+    Entry* entry = lookUp(map, key, hash);
+    if (entry == NULL) {
+        return NULL;
     }
-
-    return NULL;
+    entry->state = ENTRY_DELETED;
+    map->size--;
+    return entry->value;
 }
 
-void hashmapForEach(Hashmap* map, 
+static bool forEachInTable(Table* table,
         bool (*callback)(void* key, void* value, void* context),
         void* context) {
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
-                return;
-            }
-            entry = next;
+    for (i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (entry->state == ENTRY_USED
+                && !callback(entry->key, entry->value, context)) {
+            return false;
         }
     }
+    return true;
+}
+
+void hashmapForEach(Hashmap* map, 
+        bool (*callback)(void* key, void* value, void* context),
+        void* context) {
+    // Only insertions move entries between the tables, so the callback can
+    // remove entries as it goes.
+    if (forEachInTable(&map->table, callback, context)) {
+        forEachInTable(&map->old, callback, context);
+    }
 }
 
 size_t hashmapCurrentCapacity(Hashmap* map) {
-    size_t bucketCount = map->bucketCount;
-    return bucketCount * 3 / 4;
+    return map->table.capacity * 3 / 4;
 }
 
-size_t hashmapCountCollisions(Hashmap* map) {
+static size_t countCollisionsInTable(Table* table) {
     size_t collisions = 0;
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            if (entry->next != NULL) {
-                collisions++;
-            }
-            entry = entry->next;
+    for (i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (entry->state == ENTRY_USED
+                && calculateIndex(table->capacity, entry->hash) != i) {
+            collisions++;
         }
     }
     return collisions;
 }
 
+size_t hashmapCountCollisions(Hashmap* map) {
+    return countCollisionsInTable(&map->table) + countCollisionsInTable(&map->old);
+}
+
 int hashmapIntHash(void* key) {
     // Return the key value itself.
     return *((int*) key);
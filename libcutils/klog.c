@@ -16,11 +16,14 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <cutils/klog.h>
@@ -28,6 +31,27 @@
 static int klog_fd = -1;
 static int klog_level = KLOG_DEFAULT_LEVEL;
 
+/*
+ * In buffered mode, messages are held here and written out together.
+ * Each write to /dev/kmsg becomes one record with the level of its first
+ * "<N>" prefix, so a batch only ever holds messages of one level.
+ */
+#define KLOG_BUF_SIZE      4096
+#define KLOG_BUF_MSGS      64
+#define KLOG_FLUSH_LEVEL   3    /* messages <= this level go out at once */
+#define KLOG_FLUSH_MS      100  /* nothing is held longer than this */
+
+static pthread_mutex_t klog_lock = PTHREAD_MUTEX_INITIALIZER;
+static int klog_buffered;
+static char klog_buf[KLOG_BUF_SIZE];
+static size_t klog_buf_len;
+static struct {
+    size_t offset;
+    int level;
+} klog_msgs[KLOG_BUF_MSGS];
+static int klog_msg_count;
+static long long klog_oldest_ms;
+
 void klog_set_level(int level) {
     klog_level = level;
 }
@@ -47,12 +71,72 @@ void klog_init(void)
     }
 }
 
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Writes out the buffer, one write per run of messages of the same level. */
+static void klog_flush_locked(void)
+{
+    int i = 0;
+
+    while (i < klog_msg_count) {
+        size_t start = klog_msgs[i].offset;
+        size_t end;
+        int level = klog_msgs[i].level;
+
+        while (++i < klog_msg_count && klog_msgs[i].level == level)
+            ;
+        end = (i < klog_msg_count) ? klog_msgs[i].offset : klog_buf_len;
+        if (klog_fd >= 0)
+            write(klog_fd, klog_buf + start, end - start);
+    }
+    klog_buf_len = 0;
+    klog_msg_count = 0;
+}
+
+void klog_flush(void)
+{
+    pthread_mutex_lock(&klog_lock);
+    klog_flush_locked();
+    pthread_mutex_unlock(&klog_lock);
+}
+
+/* A forked child must not write out what its parent is still holding. */
+static void klog_atfork_child(void)
+{
+    klog_buf_len = 0;
+    klog_msg_count = 0;
+    pthread_mutex_init(&klog_lock, NULL);
+}
+
+void klog_set_buffered(int buffered)
+{
+    static int registered;
+
+    pthread_mutex_lock(&klog_lock);
+    if (buffered && !registered) {
+        atexit(klog_flush);
+        pthread_atfork(NULL, NULL, klog_atfork_child);
+        registered = 1;
+    }
+    if (!buffered)
+        klog_flush_locked();
+    klog_buffered = buffered;
+    pthread_mutex_unlock(&klog_lock);
+}
+
 #define LOG_BUF_MAX 512
 
 void klog_write(int level, const char *fmt, ...)
 {
     char buf[LOG_BUF_MAX];
     va_list ap;
+    size_t len;
+    long long now;
 
     if (level > klog_level) return;
     if (klog_fd < 0) klog_init();
@@ -62,5 +146,35 @@ void klog_write(int level, const char *fmt, ...)
     vsnprintf(buf, LOG_BUF_MAX, fmt, ap);
     buf[LOG_BUF_MAX - 1] = 0;
     va_end(ap);
-    write(klog_fd, buf, strlen(buf));
+    len = strlen(buf);
+
+    if (!klog_buffered) {
+        write(klog_fd, buf, len);
+        return;
+    }
+
+    pthread_mutex_lock(&klog_lock);
+    if (level <= KLOG_FLUSH_LEVEL) {
+        /* What was held first, so that the order is kept. */
+        klog_flush_locked();
+        write(klog_fd, buf, len);
+        pthread_mutex_unlock(&klog_lock);
+        return;
+    }
+
+    if (klog_buf_len + len > KLOG_BUF_SIZE || klog_msg_count == KLOG_BUF_MSGS)
+        klog_flush_locked();
+
+    now = now_ms();
+    if (klog_msg_count == 0)
+        klog_oldest_ms = now;
+    klog_msgs[klog_msg_count].offset = klog_buf_len;
+    klog_msgs[klog_msg_count].level = level;
+    klog_msg_count++;
+    memcpy(klog_buf + klog_buf_len, buf, len);
+    klog_buf_len += len;
+
+    if (now - klog_oldest_ms >= KLOG_FLUSH_MS)
+        klog_flush_locked();
+    pthread_mutex_unlock(&klog_lock);
 }
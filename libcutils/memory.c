@@ -16,24 +16,268 @@
 
 #include <cutils/memory.h>
 
-#if !HAVE_MEMSET16
-void android_memset16(uint16_t* dst, uint16_t value, size_t size)
+#include "memory_impl.h"
+
+static void android_memset16_c(uint16_t* dst, uint16_t value, size_t size)
 {
     size >>= 1;
     while (size--) {
         *dst++ = value;
     }
 }
-#endif
 
-#if !HAVE_MEMSET32
-void android_memset32(uint32_t* dst, uint32_t value, size_t size)
+static void android_memset32_c(uint32_t* dst, uint32_t value, size_t size)
 {
     size >>= 2;
     while (size--) {
         *dst++ = value;
     }
 }
+
+/*
+ * Fills bigger than this bypass the caches with non-temporal stores:
+ * they would only evict everything else, and what is filled that big is
+ * usually a frame buffer that the display, not the cpu, reads next.
+ */
+#define NON_TEMPORAL_THRESHOLD  (2 * 1024 * 1024)
+
+#if (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+static int has_sse2(void)
+{
+#if defined(__x86_64__)
+    return 1;
+#else
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (edx & (1 << 26)) != 0;
+#endif
+}
+
+static int has_avx2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int xcr0_lo, xcr0_hi;
+
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & (1 << 27))) return 0;           // OSXSAVE
+    /* xgetbv, spelled out for the assemblers which don't know it */
+    __asm__ (".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 6) != 6) return 0;           // the OS saves ymm
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 5)) != 0;               // AVX2
+}
+
+/* Fills size bytes at dst with v, the value repeated, and returns size;
+ * or returns 0 if that is less than one vector, for the caller to do.
+ * dst is aligned to the value's size, and size is a multiple of it, so
+ * that the unaligned stores at both ends can overlap the aligned ones.
+ */
+SSE2_TARGET static size_t fill_sse2(void* dst, __m128i v, size_t size)
+{
+    char* d = (char*) dst;
+    char* end = d + size;
+    __m128i* p;
+
+    if (size < 16) return 0;
+
+    _mm_storeu_si128((__m128i*) d, v);
+    p = (__m128i*) (((uintptr_t) d + 16) & ~(uintptr_t) 15);
+    if (size >= NON_TEMPORAL_THRESHOLD) {
+        for (; (char*) (p + 4) <= end; p += 4) {
+            _mm_stream_si128(p, v);
+            _mm_stream_si128(p + 1, v);
+            _mm_stream_si128(p + 2, v);
+            _mm_stream_si128(p + 3, v);
+        }
+        _mm_sfence();
+    } else {
+        for (; (char*) (p + 4) <= end; p += 4) {
+            _mm_store_si128(p, v);
+            _mm_store_si128(p + 1, v);
+            _mm_store_si128(p + 2, v);
+            _mm_store_si128(p + 3, v);
+        }
+    }
+    for (; (char*) (p + 1) <= end; p++) {
+        _mm_store_si128(p, v);
+    }
+    _mm_storeu_si128((__m128i*) (end - 16), v);
+    return size;
+}
+
+SSE2_TARGET static void android_memset16_sse2(uint16_t* dst, uint16_t value,
+                                               size_t size)
+{
+    size &= ~1;
+    if (((uintptr_t) dst & 1) || !fill_sse2(dst, _mm_set1_epi16(value), size))
+        android_memset16_c(dst, value, size);
+}
+
+SSE2_TARGET static void android_memset32_sse2(uint32_t* dst, uint32_t value,
+                                               size_t size)
+{
+    size &= ~3;
+    if (((uintptr_t) dst & 3) || !fill_sse2(dst, _mm_set1_epi32(value), size))
+        android_memset32_c(dst, value, size);
+}
+
+/* Same as fill_sse2() with 32-byte ymm stores */
+AVX2_TARGET static size_t fill_avx2(void* dst, __m256i v, size_t size)
+{
+    char* d = (char*) dst;
+    char* end = d + size;
+    __m256i* p;
+
+    if (size < 32) return fill_sse2(dst, _mm256_castsi256_si128(v), size);
+
+    _mm256_storeu_si256((__m256i*) d, v);
+    p = (__m256i*) (((uintptr_t) d + 32) & ~(uintptr_t) 31);
+    if (size >= NON_TEMPORAL_THRESHOLD) {
+        for (; (char*) (p + 4) <= end; p += 4) {
+            _mm256_stream_si256(p, v);
+            _mm256_stream_si256(p + 1, v);
+            _mm256_stream_si256(p + 2, v);
+            _mm256_stream_si256(p + 3, v);
+        }
+        _mm_sfence();
+    } else {
+        for (; (char*) (p + 4) <= end; p += 4) {
+            _mm256_store_si256(p, v);
+            _mm256_store_si256(p + 1, v);
+            _mm256_store_si256(p + 2, v);
+            _mm256_store_si256(p + 3, v);
+        }
+    }
+    for (; (char*) (p + 1) <= end; p++) {
+        _mm256_store_si256(p, v);
+    }
+    _mm256_storeu_si256((__m256i*) (end - 32), v);
+    return size;
+}
+
+AVX2_TARGET static void android_memset16_avx2(uint16_t* dst, uint16_t value,
+                                               size_t size)
+{
+    size &= ~1;
+    if (((uintptr_t) dst & 1) || !fill_avx2(dst, _mm256_set1_epi16(value), size))
+        android_memset16_c(dst, value, size);
+}
+
+AVX2_TARGET static void android_memset32_avx2(uint32_t* dst, uint32_t value,
+                                               size_t size)
+{
+    size &= ~3;
+    if (((uintptr_t) dst & 3) || !fill_avx2(dst, _mm256_set1_epi32(value), size))
+        android_memset32_c(dst, value, size);
+}
+
+static const android_memset_impl memset_impls[] = {
+    { "avx2", android_memset16_avx2, android_memset32_avx2, has_avx2 },
+    { "sse2", android_memset16_sse2, android_memset32_sse2, has_sse2 },
+    { "c", android_memset16_c, android_memset32_c, NULL },
+};
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+/* Advanced SIMD is always there on arm64, so there is nothing to check. */
+static void android_memset16_neon(uint16_t* dst, uint16_t value, size_t size)
+{
+    size_t n = size >> 1;
+    uint16x8_t v = vdupq_n_u16(value);
+
+    for (; n >= 32; n -= 32, dst += 32) {
+        vst1q_u16(dst, v);
+        vst1q_u16(dst + 8, v);
+        vst1q_u16(dst + 16, v);
+        vst1q_u16(dst + 24, v);
+    }
+    while (n--) {
+        *dst++ = value;
+    }
+}
+
+static void android_memset32_neon(uint32_t* dst, uint32_t value, size_t size)
+{
+    size_t n = size >> 2;
+    uint32x4_t v = vdupq_n_u32(value);
+
+    for (; n >= 16; n -= 16, dst += 16) {
+        vst1q_u32(dst, v);
+        vst1q_u32(dst + 4, v);
+        vst1q_u32(dst + 8, v);
+        vst1q_u32(dst + 12, v);
+    }
+    while (n--) {
+        *dst++ = value;
+    }
+}
+
+static const android_memset_impl memset_impls[] = {
+    { "neon", android_memset16_neon, android_memset32_neon, NULL },
+    { "c", android_memset16_c, android_memset32_c, NULL },
+};
+
+#else
+
+static const android_memset_impl memset_impls[] = {
+    { "c", android_memset16_c, android_memset32_c, NULL },
+};
+
+#endif
+
+#define NUM_MEMSET_IMPLS (sizeof(memset_impls) / sizeof(memset_impls[0]))
+
+const android_memset_impl* android_memset_get_impl(size_t index)
+{
+    size_t i;
+
+    for (i = 0; i < NUM_MEMSET_IMPLS; i++) {
+        if (memset_impls[i].supported && !memset_impls[i].supported())
+            continue;
+        if (index-- == 0)
+            return &memset_impls[i];
+    }
+    return NULL;
+}
+
+#if !HAVE_MEMSET16 || !HAVE_MEMSET32
+// The fastest implementation this cpu has, picked on first use.  Racing
+// threads all store the same value.
+static const android_memset_impl* memset_impl;
+
+static const android_memset_impl* get_memset_impl(void)
+{
+    if (!memset_impl) {
+        memset_impl = android_memset_get_impl(0);
+    }
+    return memset_impl;
+}
+#endif
+
+#if !HAVE_MEMSET16
+void android_memset16(uint16_t* dst, uint16_t value, size_t size)
+{
+    get_memset_impl()->memset16(dst, value, size);
+}
+#endif
+
+#if !HAVE_MEMSET32
+void android_memset32(uint32_t* dst, uint32_t value, size_t size)
+{
+    get_memset_impl()->memset32(dst, value, size);
+}
 #endif
 
 #if !HAVE_STRLCPY
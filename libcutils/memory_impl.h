@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CUTILS_MEMORY_IMPL_H
+#define ANDROID_CUTILS_MEMORY_IMPL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The android_memset16/32 implementations in memory.c, for the benchmark
+ * in tests/memset to compare; not part of the libcutils API.
+ */
+
+typedef struct {
+    const char* name;
+    void (*memset16)(uint16_t* dst, uint16_t value, size_t size);
+    void (*memset32)(uint32_t* dst, uint32_t value, size_t size);
+    int (*supported)(void);     /* NULL if it runs on any cpu */
+} android_memset_impl;
+
+/* Returns the index'th implementation this cpu can run, the one
+ * android_memset16/32 use first, or NULL past the last one.
+ */
+const android_memset_impl* android_memset_get_impl(size_t index);
+
+#endif // ANDROID_CUTILS_MEMORY_IMPL_H
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/perfstat.h>
+
+static struct perfstat_area *area;
+static pthread_mutex_t area_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int valid_name(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len > 0 && len < PERFSTAT_NAME_MAX && !strchr(name, '/');
+}
+
+int perfstat_init(const char *name)
+{
+    char path[sizeof(PERFSTAT_DIR) + PERFSTAT_NAME_MAX + 1];
+    struct perfstat_area *a;
+    int fd, ret = 0;
+
+    if (!valid_name(name)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&area_lock);
+    if (area)
+        goto out;
+
+    /* init.rc makes it on the device; hosts and tests may not have it */
+    if (mkdir(PERFSTAT_DIR, 0775) < 0 && errno != EEXIST) {
+        ret = -1;
+        goto out;
+    }
+
+    snprintf(path, sizeof(path), PERFSTAT_DIR "/%s", name);
+    /* a new file, so that readers of the old one see it go unchanged */
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ret = -1;
+        goto out;
+    }
+    if (ftruncate(fd, PERFSTAT_AREA_SIZE) < 0) {
+        ret = -1;
+        goto fail;
+    }
+    a = mmap(NULL, PERFSTAT_AREA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0);
+    if (a == MAP_FAILED) {
+        ret = -1;
+        goto fail;
+    }
+    close(fd);
+
+    /* the file starts out zeroed */
+    a->version = PERFSTAT_VERSION;
+    a->slots = PERFSTAT_AREA_SIZE / PERFSTAT_SLOT_SIZE;
+    a->pid = getpid();
+    strcpy(a->name, name);
+    a->used = 1;
+    /* readers check the magic last */
+    android_atomic_release_store(PERFSTAT_MAGIC, (volatile int32_t *) &a->magic);
+    area = a;
+    goto out;
+
+fail:
+    {
+        int saved_errno = errno;
+        close(fd);
+        unlink(path);
+        errno = saved_errno;
+    }
+out:
+    pthread_mutex_unlock(&area_lock);
+    return ret;
+}
+
+static struct perfstat *get_stat(const char *name, uint32_t type,
+                                 uint32_t slots)
+{
+    struct perfstat *stat = NULL;
+    int32_t i;
+
+    if (!valid_name(name))
+        return NULL;
+
+    pthread_mutex_lock(&area_lock);
+    if (!area)
+        goto out;
+
+    for (i = 1; i < area->used; i += stat->slots) {
+        stat = (struct perfstat *) ((char *) area + i * PERFSTAT_SLOT_SIZE);
+        if (!strcmp(stat->name, name))
+            goto found;
+    }
+    if ((uint32_t) area->used + slots > area->slots) {
+        stat = NULL;
+        goto out;
+    }
+
+    /* fill it in, then let readers see it */
+    stat = (struct perfstat *) ((char *) area + area->used * PERFSTAT_SLOT_SIZE);
+    strcpy(stat->name, name);
+    stat->type = type;
+    stat->slots = slots;
+    android_atomic_release_store(area->used + slots, &area->used);
+
+found:
+    if (stat->type != type)
+        stat = NULL;
+out:
+    pthread_mutex_unlock(&area_lock);
+    return stat;
+}
+
+struct perfstat *perfstat_counter(const char *name)
+{
+    return get_stat(name, PERFSTAT_COUNTER, 1);
+}
+
+struct perfstat *perfstat_histogram(const char *name)
+{
+    return get_stat(name, PERFSTAT_HISTOGRAM, PERFSTAT_HISTOGRAM_SLOTS);
+}
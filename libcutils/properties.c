@@ -30,12 +30,62 @@
 
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <stdint.h>
+#include <cutils/hashmap.h>
 
 int property_set(const char *key, const char *value)
 {
     return __system_property_set(key, value);
 }
 
+int property_set_batch(const char * const *keys, const char * const *values,
+        size_t count)
+{
+    prop_msg msg;
+    struct pollfd pollfd;
+    size_t i;
+    int fd;
+    int res = 0;
+
+    if (count > PROPERTY_BATCH_MAX) return -1;
+    for (i = 0; i < count; i++) {
+        if (strlen(keys[i]) >= PROP_NAME_MAX) return -1;
+        if (strlen(values[i]) >= PROP_VALUE_MAX) return -1;
+    }
+    if (count == 0) return 0;
+
+    fd = socket_local_client(PROP_SERVICE_NAME, ANDROID_SOCKET_NAMESPACE_RESERVED,
+            SOCK_STREAM);
+    if (fd < 0) return -1;
+
+    for (i = 0; i < count && res == 0; i++) {
+        memset(&msg, 0, sizeof(msg));
+        msg.cmd = PROPERTY_MSG_SETPROP_BATCH;
+        strlcpy(msg.name, keys[i], sizeof(msg.name));
+        strlcpy(msg.value, values[i], sizeof(msg.value));
+        if (TEMP_FAILURE_RETRY(send(fd, &msg, sizeof(msg), MSG_NOSIGNAL))
+                != sizeof(msg)) {
+            res = -1;
+        }
+    }
+
+    /* Like __system_property_set(), wait for the service to close the
+     * socket, which it does only after the whole batch is applied. */
+    if (res == 0) {
+        shutdown(fd, SHUT_WR);
+        pollfd.fd = fd;
+        pollfd.events = 0;
+        if (TEMP_FAILURE_RETRY(poll(&pollfd, 1, 250 + count * 10)) != 1 ||
+                !(pollfd.revents & POLLHUP)) {
+            ALOGW("property service did not acknowledge batch of %zu\n", count);
+        }
+    }
+    close(fd);
+    return res;
+}
+
 int property_get(const char *key, char *value, const char *default_value)
 {
     int len;
@@ -76,6 +126,196 @@ int property_list(
     return __system_property_foreach(property_list_callback, &data);
 }
 
+int property_wait(const char *key, unsigned *serial, char *value)
+{
+    const prop_info *pi;
+    unsigned area_serial = 0;
+
+    for (;;) {
+        pi = __system_property_find(key);
+        if (pi && __system_property_serial(pi) != *serial) {
+            break;
+        }
+        area_serial = __system_property_wait_any(area_serial);
+    }
+    /* Read the serial first: if the value changes underneath us the
+     * next call simply returns again. */
+    *serial = __system_property_serial(pi);
+    return __system_property_read(pi, 0, value);
+}
+
+struct property_watcher {
+    char prefix[PROP_NAME_MAX];
+    size_t prefix_len;
+    unsigned area_serial;
+    Hashmap *serials;
+    int changes;
+    void (*propfn)(const char *key, const char *value, void *cookie);
+    void *cookie;
+};
+
+static int str_hash(void *key)
+{
+    return hashmapHash(key, strlen(key));
+}
+
+static bool str_equals(void *keyA, void *keyB)
+{
+    return strcmp(keyA, keyB) == 0;
+}
+
+/* Compare every matching property with the serial we last saw for it. */
+static void property_watcher_scan(const prop_info *pi, void *cookie)
+{
+    property_watcher *watcher = cookie;
+    char name[PROP_NAME_MAX];
+    char value[PROP_VALUE_MAX];
+    unsigned serial = __system_property_serial(pi);
+    void *last;
+
+    __system_property_read(pi, name, value);
+    if (strncmp(name, watcher->prefix, watcher->prefix_len)) {
+        return;
+    }
+    last = hashmapGet(watcher->serials, name);
+    if (last && (unsigned) (uintptr_t) last - 1 == serial) {
+        return;
+    }
+    if (!last) {
+        char *key = strdup(name);
+        if (!key) {
+            return;
+        }
+        hashmapPut(watcher->serials, key, (void *) (uintptr_t) (serial + 1));
+    } else {
+        hashmapPut(watcher->serials, name, (void *) (uintptr_t) (serial + 1));
+    }
+    if (watcher->propfn) {
+        watcher->propfn(name, value, watcher->cookie);
+        watcher->changes++;
+    }
+}
+
+property_watcher *property_watcher_create(const char *prefix)
+{
+    property_watcher *watcher;
+
+    if (strlen(prefix) >= PROP_NAME_MAX) {
+        return NULL;
+    }
+    watcher = calloc(1, sizeof(*watcher));
+    if (!watcher) {
+        return NULL;
+    }
+    strcpy(watcher->prefix, prefix);
+    watcher->prefix_len = strlen(prefix);
+    watcher->serials = hashmapCreate(64, str_hash, str_equals);
+    if (!watcher->serials) {
+        free(watcher);
+        return NULL;
+    }
+
+    /* Record where everything stands now; only later changes are reported.
+     * area_serial stays 0, so the first wait returns at once and rescans,
+     * which catches anything set while this scan was running. */
+    __system_property_foreach(property_watcher_scan, watcher);
+    return watcher;
+}
+
+int property_watcher_wait(property_watcher *watcher,
+        void (*propfn)(const char *key, const char *value, void *cookie), void *cookie)
+{
+    watcher->propfn = propfn;
+    watcher->cookie = cookie;
+    watcher->changes = 0;
+    while (watcher->changes == 0) {
+        watcher->area_serial = __system_property_wait_any(watcher->area_serial);
+        __system_property_foreach(property_watcher_scan, watcher);
+    }
+    watcher->propfn = NULL;
+    return watcher->changes;
+}
+
+static bool free_key(void *key, void *value, void *context)
+{
+    free(key);
+    return true;
+}
+
+void property_watcher_destroy(property_watcher *watcher)
+{
+    if (!watcher) {
+        return;
+    }
+    hashmapForEach(watcher->serials, free_key, NULL);
+    hashmapFree(watcher->serials);
+    free(watcher);
+}
+
+struct property_handle {
+    char key[PROPERTY_KEY_MAX];
+    char default_value[PROPERTY_VALUE_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    int valid;
+    const prop_info *pi;
+    unsigned serial;
+};
+
+property_handle_t *property_handle_create(const char *key, const char *default_value)
+{
+    property_handle_t *handle;
+
+    if (strlen(key) >= PROPERTY_KEY_MAX) return NULL;
+    if (default_value && strlen(default_value) >= PROPERTY_VALUE_MAX) return NULL;
+    handle = calloc(1, sizeof(*handle));
+    if (!handle) return NULL;
+    strcpy(handle->key, key);
+    if (default_value) strcpy(handle->default_value, default_value);
+    return handle;
+}
+
+void property_handle_destroy(property_handle_t *handle)
+{
+    free(handle);
+}
+
+const char *property_handle_get(property_handle_t *handle, int *changed)
+{
+    char value[PROPERTY_VALUE_MAX];
+    unsigned serial;
+
+    if (changed) *changed = 0;
+    if (!handle->pi) {
+        handle->pi = __system_property_find(handle->key);
+    }
+    if (!handle->pi) {
+        if (!handle->valid) {
+            strcpy(handle->value, handle->default_value);
+            handle->valid = 1;
+            if (changed) *changed = 1;
+        }
+        return handle->value;
+    }
+
+    serial = __system_property_serial(handle->pi);
+    if (handle->valid && serial == handle->serial) {
+        return handle->value;
+    }
+
+    /* As in property_wait(), the serial is read first: a change racing
+     * with the read below just makes the next call read again. */
+    handle->serial = serial;
+    if (__system_property_read(handle->pi, 0, value) <= 0) {
+        strcpy(value, handle->default_value);
+    }
+    if (!handle->valid || strcmp(value, handle->value)) {
+        strcpy(handle->value, value);
+        handle->valid = 1;
+        if (changed) *changed = 1;
+    }
+    return handle->value;
+}
+
 #elif defined(HAVE_SYSTEM_PROPERTY_SERVER)
 
 /*
@@ -337,3 +577,81 @@ int property_list(void (*propfn)(const char *key, const char *value, void *cooki
 }
 
 #endif
+
+#ifndef HAVE_LIBC_SYSTEM_PROPERTIES
+
+/* Without a shared property area there is nothing to sleep on. */
+int property_wait(const char *key, unsigned *serial, char *value)
+{
+    return -1;
+}
+
+property_watcher *property_watcher_create(const char *prefix)
+{
+    return NULL;
+}
+
+int property_watcher_wait(property_watcher *watcher,
+        void (*propfn)(const char *key, const char *value, void *cookie), void *cookie)
+{
+    return -1;
+}
+
+void property_watcher_destroy(property_watcher *watcher)
+{
+}
+
+struct property_handle {
+    char key[PROPERTY_KEY_MAX];
+    char default_value[PROPERTY_VALUE_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    int valid;
+};
+
+property_handle_t *property_handle_create(const char *key, const char *default_value)
+{
+    property_handle_t *handle;
+
+    if (strlen(key) >= PROPERTY_KEY_MAX) return NULL;
+    if (default_value && strlen(default_value) >= PROPERTY_VALUE_MAX) return NULL;
+    handle = calloc(1, sizeof(*handle));
+    if (!handle) return NULL;
+    strcpy(handle->key, key);
+    if (default_value) strcpy(handle->default_value, default_value);
+    return handle;
+}
+
+void property_handle_destroy(property_handle_t *handle)
+{
+    free(handle);
+}
+
+/* No serials to go by: fetch every time and compare. */
+const char *property_handle_get(property_handle_t *handle, int *changed)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    if (changed) *changed = 0;
+    property_get(handle->key, value,
+            handle->default_value[0] ? handle->default_value : NULL);
+    if (!handle->valid || strcmp(value, handle->value)) {
+        strcpy(handle->value, value);
+        handle->valid = 1;
+        if (changed) *changed = 1;
+    }
+    return handle->value;
+}
+
+int property_set_batch(const char * const *keys, const char * const *values,
+        size_t count)
+{
+    size_t i;
+
+    if (count > PROPERTY_BATCH_MAX) return -1;
+    for (i = 0; i < count; i++) {
+        if (property_set(keys[i], values[i]) < 0) return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -20,6 +20,7 @@
 #define LOG_TAG "qtaguid"
 
 #include <cutils/qtaguid.h>
+#include <cutils/atomic.h>
 #include <cutils/log.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -27,9 +28,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 static const char* CTRL_PROCPATH = "/proc/net/xt_qtaguid/ctrl";
-static const int CTRL_MAX_INPUT_LEN = 128;
+#define CTRL_MAX_INPUT_LEN 128
+/* Commands per writev() in the batched calls. */
+#define CTRL_MAX_BATCH 32
 static const char *GLOBAL_PACIFIER_PARAM = "/sys/module/xt_qtaguid/parameters/passive";
 static const char *TAG_PACIFIER_PARAM = "/sys/module/xt_qtaguid/parameters/tag_tracking_passive";
 
@@ -52,32 +56,111 @@ void qtaguid_resTrack(void) {
     }
 }
 
+/*
+ * The ctrl file is opened on first use and then kept open, like resTrackFd,
+ * rather than opened and closed for every command.  If it is missing, the
+ * module isn't there, and -ENOENT is kept so that we stop looking.
+ */
+static volatile int32_t ctrlFd = -1;
+static pthread_mutex_t ctrlFdLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Returns:
+ *   the ctrl fd on success.
+ *   -errno on failure.
+ */
+static int get_ctrl_fd(void) {
+    int fd = android_atomic_acquire_load(&ctrlFd);
+    if (fd != -1) {
+        return fd;
+    }
+
+    pthread_mutex_lock(&ctrlFdLock);
+    fd = ctrlFd;
+    if (fd == -1) {
+        fd = TEMP_FAILURE_RETRY(open(CTRL_PROCPATH, O_WRONLY));
+        if (fd >= 0) {
+            TEMP_FAILURE_RETRY(fcntl(fd, F_SETFD, FD_CLOEXEC));
+            android_atomic_release_store(fd, &ctrlFd);
+        } else {
+            fd = -errno;
+            if (fd == -ENOENT) {
+                android_atomic_release_store(fd, &ctrlFd);
+            }
+        }
+    }
+    pthread_mutex_unlock(&ctrlFdLock);
+    return fd;
+}
+
 /*
  * Returns:
  *   0 on success.
  *   -errno on failure.
  */
 static int write_ctrl(const char *cmd) {
-    int fd, res, savedErrno;
+    int fd, res;
 
     ALOGV("write_ctrl(%s)", cmd);
 
-    fd = TEMP_FAILURE_RETRY(open(CTRL_PROCPATH, O_WRONLY));
+    fd = get_ctrl_fd();
     if (fd < 0) {
-        return -errno;
+        return fd;
     }
 
     res = TEMP_FAILURE_RETRY(write(fd, cmd, strlen(cmd)));
     if (res < 0) {
-        savedErrno = errno;
-    } else {
-        savedErrno = 0;
+        res = -errno;
+        ALOGI("Failed write_ctrl(%s) res=%d errno=%d", cmd, res, -res);
+        return res;
+    }
+    return 0;
+}
+
+/*
+ * Writes count commands, each of which the module takes as a separate
+ * write, with one writev().
+ *
+ * Returns:
+ *   the number of commands that were written before the first failure.
+ *   -errno if the first one failed.
+ */
+static int write_ctrl_batch(char cmds[][CTRL_MAX_INPUT_LEN], int count) {
+    struct iovec iov[CTRL_MAX_BATCH];
+    int fd, i, res;
+
+    fd = get_ctrl_fd();
+    if (fd < 0) {
+        return fd;
     }
+
+    for (i = 0; i < count; i++) {
+        ALOGV("write_ctrl(%s)", cmds[i]);
+        iov[i].iov_base = cmds[i];
+        iov[i].iov_len = strlen(cmds[i]);
+    }
+
+    res = TEMP_FAILURE_RETRY(writev(fd, iov, count));
     if (res < 0) {
-        ALOGI("Failed write_ctrl(%s) res=%d errno=%d", cmd, res, savedErrno);
+        res = -errno;
+        ALOGI("Failed write_ctrl(%s) res=%d errno=%d", cmds[0], res, -res);
+        return res;
     }
-    close(fd);
-    return -savedErrno;
+
+    /*
+     * On a failure, the kernel returns what was written before it.  Finish
+     * one at a time, which also finds out why that one failed.
+     */
+    for (i = 0; i < count && res >= (int)iov[i].iov_len; i++) {
+        res -= iov[i].iov_len;
+    }
+    for (; i < count; i++) {
+        res = write_ctrl(cmds[i]);
+        if (res < 0) {
+            return i ? i : res;
+        }
+    }
+    return count;
 }
 
 static int write_param(const char *param_path, const char *value) {
@@ -131,6 +214,61 @@ int qtaguid_untagSocket(int sockfd) {
     return res;
 }
 
+int qtaguid_tagSockets(const int *sockfds, int count, int tag, uid_t uid) {
+    char lineBufs[CTRL_MAX_BATCH][CTRL_MAX_INPUT_LEN];
+    int done = 0;
+    uint64_t kTag = ((uint64_t)tag << 32);
+
+    pthread_once(&resTrackInitDone, qtaguid_resTrack);
+
+    ALOGV("Tagging %d sockets with tag %llx{%u,0} for uid %d", count, kTag, tag, uid);
+
+    while (done < count) {
+        int i, n, res;
+
+        n = count - done < CTRL_MAX_BATCH ? count - done : CTRL_MAX_BATCH;
+        for (i = 0; i < n; i++) {
+            snprintf(lineBufs[i], sizeof(lineBufs[i]), "t %d %llu %d",
+                     sockfds[done + i], kTag, uid);
+        }
+        res = write_ctrl_batch(lineBufs, n);
+        if (res < n) {
+            int failed = done + (res > 0 ? res : 0);
+            ALOGI("Tagging socket %d with tag %llx(%d) for uid %d failed",
+                 sockfds[failed], kTag, tag, uid);
+            return failed ? failed : res;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+int qtaguid_untagSockets(const int *sockfds, int count) {
+    char lineBufs[CTRL_MAX_BATCH][CTRL_MAX_INPUT_LEN];
+    int done = 0;
+
+    ALOGV("Untagging %d sockets", count);
+
+    while (done < count) {
+        int i, n, res;
+
+        n = count - done < CTRL_MAX_BATCH ? count - done : CTRL_MAX_BATCH;
+        for (i = 0; i < n; i++) {
+            snprintf(lineBufs[i], sizeof(lineBufs[i]), "u %d", sockfds[done + i]);
+        }
+        res = write_ctrl_batch(lineBufs, n);
+        if (res < n) {
+            int failed = done + (res > 0 ? res : 0);
+            ALOGI("Untagging socket %d failed", sockfds[failed]);
+            return failed ? failed : res;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
 int qtaguid_setCounterSet(int counterSetNum, uid_t uid) {
     char lineBuf[CTRL_MAX_INPUT_LEN];
     int res;
@@ -30,6 +30,9 @@
 
 #define HEADER_SIZE 4
 
+/* Buffers start at least this big so that one read picks up many records */
+#define MIN_BUFFER_SIZE 8192
+
 struct RecordStream {
     int fd;
     size_t maxRecordLen;
@@ -45,18 +48,30 @@ struct RecordStream {
 extern RecordStream *record_stream_new(int fd, size_t maxRecordLen)
 {
     RecordStream *ret;
-
-    assert (maxRecordLen <= 0xffff);
+    size_t size;
 
     ret = (RecordStream *)calloc(1, sizeof(RecordStream));
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    /* Records larger than 64K grow the buffer when they turn up */
+    size = (maxRecordLen < 0xffff ? maxRecordLen : 0xffff) + HEADER_SIZE;
+    if (size < MIN_BUFFER_SIZE) {
+        size = MIN_BUFFER_SIZE;
+    }
 
     ret->fd = fd;
     ret->maxRecordLen = maxRecordLen;
-    ret->buffer = (unsigned char *)malloc (maxRecordLen + HEADER_SIZE);
-    
+    ret->buffer = (unsigned char *)malloc (size);
+    if (ret->buffer == NULL) {
+        free(ret);
+        return NULL;
+    }
+
     ret->unconsumed = ret->buffer;
     ret->read_end = ret->buffer;
-    ret->buffer_end = ret->buffer + maxRecordLen + HEADER_SIZE;
+    ret->buffer_end = ret->buffer + size;
 
     return ret;
 }
@@ -69,41 +84,32 @@ extern void record_stream_free(RecordStream *rs)
 }
 
 
-/* returns NULL; if there isn't a full record in the buffer */
-static unsigned char * getEndOfRecord (unsigned char *p_begin,
-                                            unsigned char *p_end)
+/* Bytes needed to hold the record starting at p_begin, header included,
+ * as far as can be told from what has been read */
+static size_t getRecordSize (unsigned char *p_begin, unsigned char *p_end)
 {
-    size_t len;
-    unsigned char * p_ret;
-
     if (p_end < p_begin + HEADER_SIZE) {
-        return NULL;
+        return HEADER_SIZE;
     }
 
     //First four bytes are length
-    len = ntohl(*((uint32_t *)p_begin));
-
-    p_ret = p_begin + HEADER_SIZE + len;
-
-    if (p_end < p_ret) {
-        return NULL;
-    }
-
-    return p_ret;
+    return HEADER_SIZE + ntohl(*((uint32_t *)p_begin));
 }
 
 static void *getNextRecord (RecordStream *p_rs, size_t *p_outRecordLen)
 {
-    unsigned char *record_start, *record_end;
+    unsigned char *record_start;
+    size_t size;
 
-    record_end = getEndOfRecord (p_rs->unconsumed, p_rs->read_end);
+    size = getRecordSize (p_rs->unconsumed, p_rs->read_end);
 
-    if (record_end != NULL) {
+    if (p_rs->read_end - p_rs->unconsumed >= (ptrdiff_t)size
+            && size - HEADER_SIZE <= p_rs->maxRecordLen) {
         /* one full line in the buffer */
         record_start = p_rs->unconsumed + HEADER_SIZE;
-        p_rs->unconsumed = record_end;
+        p_rs->unconsumed += size;
 
-        *p_outRecordLen = record_end - record_start;
+        *p_outRecordLen = size - HEADER_SIZE;
 
         return record_start;
     }
@@ -111,15 +117,85 @@ static void *getNextRecord (RecordStream *p_rs, size_t *p_outRecordLen)
     return NULL;
 }
 
+/*
+ * Makes room to read the rest of the partial record at unconsumed.  The
+ * leftover is only moved when it would not fit where it is, so most refills
+ * move nothing, and the buffer grows for records bigger than it is.
+ * Returns 0, or -1 with errno set if the record can never fit.
+ */
+static int makeRoom (RecordStream *p_rs)
+{
+    size_t size = getRecordSize (p_rs->unconsumed, p_rs->read_end);
+    size_t toMove = p_rs->read_end - p_rs->unconsumed;
+    size_t capacity = p_rs->buffer_end - p_rs->buffer;
+
+    if (size - HEADER_SIZE > p_rs->maxRecordLen) {
+        // this should never happen
+        //ALOGE("max record length exceeded\n");
+        assert (0);
+        errno = EFBIG;
+        return -1;
+    }
+
+    if (toMove == 0) {
+        /* everything has been consumed; start over for free */
+        p_rs->unconsumed = p_rs->read_end = p_rs->buffer;
+        return 0;
+    }
+
+    if ((size_t)(p_rs->buffer_end - p_rs->unconsumed) >= size
+            && p_rs->read_end < p_rs->buffer_end) {
+        return 0;
+    }
+
+    if (p_rs->unconsumed != p_rs->buffer) {
+        memmove(p_rs->buffer, p_rs->unconsumed, toMove);
+        p_rs->read_end = p_rs->buffer + toMove;
+        p_rs->unconsumed = p_rs->buffer;
+    }
+
+    if (size > capacity) {
+        unsigned char *buffer = (unsigned char *)realloc(p_rs->buffer, size);
+        if (buffer == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        p_rs->buffer = buffer;
+        p_rs->unconsumed = buffer;
+        p_rs->read_end = buffer + toMove;
+        p_rs->buffer_end = buffer + size;
+    }
+    return 0;
+}
+
+/* Reads as much as fits into the buffer; returns what read() returned */
+static ssize_t fill (RecordStream *p_rs)
+{
+    ssize_t countRead;
+
+    if (makeRoom (p_rs) < 0) {
+        return -1;
+    }
+
+    countRead = read (p_rs->fd, p_rs->read_end, p_rs->buffer_end - p_rs->read_end);
+    if (countRead > 0) {
+        p_rs->read_end += countRead;
+    }
+    return countRead;
+}
+
 /**
  * Reads the next record from stream fd
- * Records are prefixed by a 16-bit big endian length value
+ * Records are prefixed by a 32-bit big endian length value
  * Records may not be larger than maxRecordLen
  *
  * Doesn't guard against EINTR
  *
  * p_outRecord and p_outRecordLen may not be NULL
  *
+ * The record points into the stream's buffer and is only valid until the
+ * next call on the stream.
+ *
  * Return 0 on success, -1 on fail
  * Returns 0 with *p_outRecord set to NULL on end of stream
  * Returns -1 / errno = EAGAIN if it needs to read again
@@ -139,31 +215,7 @@ int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord,
         return 0;
     }
 
-    // if the buffer is full and we don't have a full record
-    if (p_rs->unconsumed == p_rs->buffer 
-        && p_rs->read_end == p_rs->buffer_end
-    ) {
-        // this should never happen
-        //ALOGE("max record length exceeded\n");
-        assert (0);
-        errno = EFBIG;
-        return -1;
-    }
-
-    if (p_rs->unconsumed != p_rs->buffer) {
-        // move remainder to the beginning of the buffer
-        size_t toMove;
-
-        toMove = p_rs->read_end - p_rs->unconsumed;
-        if (toMove) {
-            memmove(p_rs->buffer, p_rs->unconsumed, toMove);
-        }
-
-        p_rs->read_end = p_rs->buffer + toMove;
-        p_rs->unconsumed = p_rs->buffer;
-    }
-
-    countRead = read (p_rs->fd, p_rs->read_end, p_rs->buffer_end - p_rs->read_end);
+    countRead = fill (p_rs);
 
     if (countRead <= 0) {
         /* note: end-of-stream drops through here too */
@@ -171,8 +223,6 @@ int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord,
         return countRead;
     }
 
-    p_rs->read_end += countRead;
-
     ret = getNextRecord (p_rs, p_outRecordLen);
 
     if (ret == NULL) {
@@ -184,3 +234,48 @@ int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord,
     *p_outRecord = ret;        
     return 0;
 }
+
+/**
+ * Like record_stream_get_next(), but hands back up to maxRecords records
+ * at once, reading from fd at most once and only if none are buffered.
+ * All of them point into the stream's buffer and stay valid until the
+ * next call on the stream.
+ *
+ * Returns the number of records (> 0) on success, 0 on end of stream,
+ * -1 on fail, with errno = EAGAIN if it needs to read again
+ */
+int record_stream_get_batch (RecordStream *p_rs, void **p_outRecords,
+                                    size_t *p_outRecordLens, size_t maxRecords)
+{
+    size_t count = 0;
+    ssize_t countRead;
+
+    while (count < maxRecords) {
+        p_outRecords[count] = getNextRecord (p_rs, &p_outRecordLens[count]);
+        if (p_outRecords[count] == NULL) {
+            break;
+        }
+        count++;
+    }
+    if (count > 0 || maxRecords == 0) {
+        return count;
+    }
+
+    countRead = fill (p_rs);
+    if (countRead <= 0) {
+        return countRead;
+    }
+
+    while (count < maxRecords) {
+        p_outRecords[count] = getNextRecord (p_rs, &p_outRecordLens[count]);
+        if (p_outRecords[count] == NULL) {
+            break;
+        }
+        count++;
+    }
+    if (count == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return count;
+}
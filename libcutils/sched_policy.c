@@ -40,6 +40,7 @@ static inline SchedPolicy _policy(SchedPolicy p)
 
 #include <sched.h>
 #include <pthread.h>
+#include <dirent.h>
 
 #ifndef SCHED_NORMAL
   #define SCHED_NORMAL 0
@@ -64,6 +65,53 @@ static int fg_cgroup_fd = -1;
 static int system_cgroup_fd = -1;
 #endif
 
+// File descriptors open to /dev/cpuctl/../cgroup.procs, or -1 if the kernel
+// cannot move a whole thread group with one write.
+static int bg_procs_fd = -1;
+static int fg_procs_fd = -1;
+
+/*
+ * /proc/<tid>/cgroup is regenerated on every read from offset 0, so rather
+ * than opening it for each get_sched_policy() a few descriptors are kept
+ * open, indexed by tid.  Once the thread is gone the read fails and the
+ * slot is dropped, so a reused tid is never answered from a stale file.
+ */
+#define CGROUP_FD_CACHE_SIZE 16
+
+static struct {
+    int tid;
+    int fd;
+} cgroup_fd_cache[CGROUP_FD_CACHE_SIZE];
+static pthread_mutex_t cgroup_fd_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Write tid to fd, one of the cgroup task files */
+static int write_tid(int fd, int tid, SchedPolicy policy)
+{
+    // specialized itoa -- works for tid > 0
+    char text[22];
+    char *end = text + sizeof(text) - 1;
+    char *ptr = end;
+    *ptr = '\0';
+    while (tid > 0) {
+        *--ptr = '0' + (tid % 10);
+        tid = tid / 10;
+    }
+
+    if (write(fd, ptr, end - ptr) < 0) {
+        /*
+         * If the thread is in the process of exiting,
+         * don't flag an error
+         */
+        if (errno == ESRCH)
+                return 0;
+        SLOGW("add_tid_to_cgroup failed to write '%s' (%s); policy=%d\n",
+              ptr, strerror(errno), policy);
+        return -1;
+    }
+
+    return 0;
+}
+
 /* Add tid to the scheduling group defined by the policy */
 static int add_tid_to_cgroup(int tid, SchedPolicy policy)
 {
@@ -93,33 +141,18 @@ static int add_tid_to_cgroup(int tid, SchedPolicy policy)
         return -1;
     }
 
-    // specialized itoa -- works for tid > 0
-    char text[22];
-    char *end = text + sizeof(text) - 1;
-    char *ptr = end;
-    *ptr = '\0';
-    while (tid > 0) {
-        *--ptr = '0' + (tid % 10);
-        tid = tid / 10;
-    }
-
-    if (write(fd, ptr, end - ptr) < 0) {
-        /*
-         * If the thread is in the process of exiting,
-         * don't flag an error
-         */
-        if (errno == ESRCH)
-                return 0;
-        SLOGW("add_tid_to_cgroup failed to write '%s' (%s); policy=%d\n",
-              ptr, strerror(errno), policy);
-        return -1;
-    }
-
-    return 0;
+    return write_tid(fd, tid, policy);
 }
 
 static void __initialize(void) {
     char* filename;
+    int i;
+
+    for (i = 0; i < CGROUP_FD_CACHE_SIZE; i++) {
+        cgroup_fd_cache[i].tid = 0;
+        cgroup_fd_cache[i].fd = -1;
+    }
+
     if (!access("/dev/cpuctl/tasks", F_OK)) {
         __sys_supports_schedgroups = 1;
 
@@ -142,11 +175,63 @@ static void __initialize(void) {
         if (bg_cgroup_fd < 0) {
             SLOGE("open of %s failed: %s\n", filename, strerror(errno));
         }
+
+        /* Older kernels have no cgroup.procs; moves then go tid by tid */
+        fg_procs_fd = open("/dev/cpuctl/apps/cgroup.procs", O_WRONLY | O_CLOEXEC);
+        bg_procs_fd = open("/dev/cpuctl/apps/bg_non_interactive/cgroup.procs",
+                           O_WRONLY | O_CLOEXEC);
     } else {
         __sys_supports_schedgroups = 0;
     }
 }
 
+/*
+ * Read /proc/<tid>/cgroup into buf, through cgroup_fd_cache.  Returns the
+ * number of bytes read, which are followed by a '\0', or -1.
+ */
+static ssize_t read_tid_cgroup(int tid, char* buf, size_t bufLen)
+{
+    int slot = tid % CGROUP_FD_CACHE_SIZE;
+    char pathBuf[32];
+    ssize_t n;
+    int fd;
+
+    pthread_mutex_lock(&cgroup_fd_cache_lock);
+    if (cgroup_fd_cache[slot].tid == tid && cgroup_fd_cache[slot].fd >= 0) {
+        n = TEMP_FAILURE_RETRY(pread(cgroup_fd_cache[slot].fd, buf, bufLen - 1, 0));
+        if (n > 0) {
+            pthread_mutex_unlock(&cgroup_fd_cache_lock);
+            buf[n] = '\0';
+            return n;
+        }
+    }
+
+    /* Not cached, or the thread it was opened for is gone */
+    if (cgroup_fd_cache[slot].fd >= 0) {
+        close(cgroup_fd_cache[slot].fd);
+        cgroup_fd_cache[slot].fd = -1;
+    }
+
+    snprintf(pathBuf, sizeof(pathBuf), "/proc/%d/cgroup", tid);
+    fd = open(pathBuf, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        pthread_mutex_unlock(&cgroup_fd_cache_lock);
+        return -1;
+    }
+    n = TEMP_FAILURE_RETRY(read(fd, buf, bufLen - 1));
+    if (n <= 0) {
+        close(fd);
+        pthread_mutex_unlock(&cgroup_fd_cache_lock);
+        return -1;
+    }
+    cgroup_fd_cache[slot].tid = tid;
+    cgroup_fd_cache[slot].fd = fd;
+    pthread_mutex_unlock(&cgroup_fd_cache_lock);
+
+    buf[n] = '\0';
+    return n;
+}
+
 /*
  * Try to get the scheduler group.
  *
@@ -161,57 +246,55 @@ static void __initialize(void) {
 static int getSchedulerGroup(int tid, char* buf, size_t bufLen)
 {
 #ifdef HAVE_ANDROID_OS
-    char pathBuf[32];
-    char lineBuf[256];
-    FILE *fp;
+    char data[512];
+    char *line;
+    char *next;
 
-    snprintf(pathBuf, sizeof(pathBuf), "/proc/%d/cgroup", tid);
-    if (!(fp = fopen(pathBuf, "r"))) {
+    if (read_tid_cgroup(tid, data, sizeof(data)) < 0) {
         return -1;
     }
 
-    while(fgets(lineBuf, sizeof(lineBuf) -1, fp)) {
-        char *next = lineBuf;
+    for (line = data; *line; line = next) {
         char *subsys;
         char *grp;
         size_t len;
 
-        /* Junk the first field */
-        if (!strsep(&next, ":")) {
-            goto out_bad_data;
+        next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
+        } else {
+            next = line + strlen(line);
         }
 
-        if (!(subsys = strsep(&next, ":"))) {
+        /* Junk the first field */
+        if (!(subsys = strchr(line, ':'))) {
             goto out_bad_data;
         }
+        subsys++;
 
-        if (strcmp(subsys, "cpu")) {
+        if (strncmp(subsys, "cpu:", 4)) {
             /* Not the subsys we're looking for */
             continue;
         }
 
-        if (!(grp = strsep(&next, ":"))) {
-            goto out_bad_data;
+        grp = subsys + 4;
+        if (*grp == '/') {
+            grp++; /* Drop the leading '/' */
         }
-        grp++; /* Drop the leading '/' */
         len = strlen(grp);
-        grp[len-1] = '\0'; /* Drop the trailing '\n' */
 
         if (bufLen <= len) {
             len = bufLen - 1;
         }
-        strncpy(buf, grp, len);
+        memcpy(buf, grp, len);
         buf[len] = '\0';
-        fclose(fp);
         return 0;
     }
 
     SLOGE("Failed to find cpu subsys");
-    fclose(fp);
     return -1;
  out_bad_data:
-    SLOGE("Bad cgroup data {%s}", lineBuf);
-    fclose(fp);
+    SLOGE("Bad cgroup data {%s}", line);
     return -1;
 #else
     errno = ENOSYS;
@@ -327,6 +410,103 @@ int set_sched_policy(int tid, SchedPolicy policy)
     return 0;
 }
 
+static void set_tid_scheduler(int tid, SchedPolicy policy)
+{
+    struct sched_param param;
+
+    param.sched_priority = 0;
+    sched_setscheduler(tid,
+                       (policy == SP_BACKGROUND) ?
+                        SCHED_BATCH : SCHED_NORMAL,
+                       &param);
+}
+
+int set_sched_policy_tids(const int *tids, size_t count, SchedPolicy policy)
+{
+    size_t i;
+    int rc = 0;
+
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
+
+    for (i = 0; i < count; i++) {
+        if (__sys_supports_schedgroups) {
+            if (add_tid_to_cgroup(tids[i], policy)) {
+                if (errno != ESRCH && errno != ENOENT)
+                    rc = -errno;
+            }
+        } else {
+            set_tid_scheduler(tids[i], policy);
+        }
+    }
+    return rc;
+}
+
+/* Move each thread listed in /proc/<pid>/task, for kernels without cgroup.procs */
+static int set_task_sched_policy(int pid, SchedPolicy policy)
+{
+    char path[32];
+    DIR *d;
+    struct dirent *de;
+    int tids[64];
+    size_t count = 0;
+    int rc = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    if (!(d = opendir(path)))
+        return -errno;
+
+    while ((de = readdir(d)) != NULL) {
+        int tid = atoi(de->d_name);
+        if (tid <= 0)
+            continue;
+        tids[count++] = tid;
+        if (count == sizeof(tids) / sizeof(tids[0])) {
+            if ((rc = set_sched_policy_tids(tids, count, policy)) < 0)
+                break;
+            count = 0;
+        }
+    }
+    closedir(d);
+
+    if (rc == 0 && count)
+        rc = set_sched_policy_tids(tids, count, policy);
+    return rc;
+}
+
+int set_process_sched_policy(int pid, SchedPolicy policy)
+{
+    int fd;
+
+    if (pid == 0) {
+        pid = getpid();
+    }
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
+
+    if (!__sys_supports_schedgroups)
+        return set_task_sched_policy(pid, policy);
+
+    switch (policy) {
+    case SP_BACKGROUND:
+        fd = bg_procs_fd;
+        break;
+    case SP_FOREGROUND:
+    case SP_AUDIO_APP:
+    case SP_AUDIO_SYS:
+        fd = fg_procs_fd;
+        break;
+    default:
+        fd = -1;
+        break;
+    }
+
+    /* One write moves every thread in the group */
+    if (fd >= 0 && write_tid(fd, pid, policy) == 0)
+        return 0;
+    return set_task_sched_policy(pid, policy);
+}
+
 #else
 
 /* Stubs for non-Android targets. */
@@ -342,6 +522,16 @@ int get_sched_policy(int tid, SchedPolicy *policy)
     return 0;
 }
 
+int set_sched_policy_tids(const int *tids, size_t count, SchedPolicy policy)
+{
+    return 0;
+}
+
+int set_process_sched_policy(int pid, SchedPolicy policy)
+{
+    return 0;
+}
+
 #endif
 
 const char *get_sched_policy_name(SchedPolicy policy)
@@ -125,43 +125,86 @@ void str_parms_destroy(struct str_parms *str_parms)
     free(str_parms);
 }
 
+/*
+ * Finds the next key/value pair in the string, the same way strtok_r() on
+ * ';' and strchr() on '=' would, skipping pairs with an empty key.  Returns
+ * the position to carry on from, or NULL if there are no more pairs.
+ */
+static const char *next_pair(const char *str, struct str_parms_view *pair)
+{
+    while (*str) {
+        const char *end = str + strcspn(str, ";");
+        const char *eq = memchr(str, '=', end - str);
+
+        if (eq != str && end != str) {
+            pair->key = str;
+            if (eq) {
+                pair->key_len = eq - str;
+                pair->value = eq + 1;
+                pair->value_len = end - (eq + 1);
+            } else {
+                pair->key_len = end - str;
+                pair->value = end;
+                pair->value_len = 0;
+            }
+            return *end ? end + 1 : end;
+        }
+        str = *end ? end + 1 : end;
+    }
+    return NULL;
+}
+
+int str_parms_parse(const char *str, struct str_parms_view *pairs, int max_pairs)
+{
+    struct str_parms_view pair;
+    int count = 0;
+
+    while ((str = next_pair(str, &pair)) != NULL) {
+        if (count < max_pairs)
+            pairs[count] = pair;
+        count++;
+    }
+    return count;
+}
+
+const struct str_parms_view *str_parms_find(const struct str_parms_view *pairs,
+                                            int count, const char *key)
+{
+    size_t key_len = strlen(key);
+    int i;
+
+    /* later pairs override earlier ones, as in str_parms_create_str() */
+    for (i = count - 1; i >= 0; i--) {
+        if (pairs[i].key_len == key_len && !memcmp(pairs[i].key, key, key_len))
+            return &pairs[i];
+    }
+    return NULL;
+}
+
 struct str_parms *str_parms_create_str(const char *_string)
 {
     struct str_parms *str_parms;
-    char *str;
-    char *kvpair;
-    char *tmpstr;
+    struct str_parms_view pair;
+    const char *str = _string;
     int items = 0;
 
     str_parms = str_parms_create();
     if (!str_parms)
         goto err_create_str_parms;
 
-    str = strdup(_string);
-    if (!str)
-        goto err_strdup;
-
     ALOGV("%s: source string == '%s'\n", __func__, _string);
 
-    kvpair = strtok_r(str, ";", &tmpstr);
-    while (kvpair && *kvpair) {
-        char *eq = strchr(kvpair, '='); /* would love strchrnul */
-        char *value;
+    while ((str = next_pair(str, &pair)) != NULL) {
         char *key;
+        char *value;
         void *old_val;
 
-        if (eq == kvpair)
-            goto next_pair;
-
-        if (eq) {
-            key = strndup(kvpair, eq - kvpair);
-            if (*(++eq))
-                value = strdup(eq);
-            else
-                value = strdup("");
-        } else {
-            key = strdup(kvpair);
-            value = strdup("");
+        key = strndup(pair.key, pair.key_len);
+        value = strndup(pair.value, pair.value_len);
+        if (!key || !value) {
+            free(key);
+            free(value);
+            goto err_strdup;
         }
 
         /* if we replaced a value, free it */
@@ -172,15 +215,11 @@ struct str_parms *str_parms_create_str(const char *_string)
         }
 
         items++;
-next_pair:
-        kvpair = strtok_r(NULL, ";", &tmpstr);
     }
 
     if (!items)
         ALOGV("%s: no items found in string\n", __func__);
 
-    free(str);
-
     return str_parms;
 
 err_strdup:
@@ -278,44 +317,62 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
         return -ENOENT;
 
     out = strtof(value, &end);
-    if (*value != '\0' && *end == '\0')
+    if (*value != '\0' && *end == '\0') {
+        *val = out;
         return 0;
+    }
 
     return -EINVAL;
 }
 
-static bool combine_strings(void *key, void *value, void *context)
+struct combine_ctxt {
+    char *str;
+    size_t len;
+};
+
+static bool measure_strings(void *key, void *value, void *context)
 {
-    char **old_str = context;
-    char *new_str;
-    int ret;
+    struct combine_ctxt *ctxt = context;
 
-    ret = asprintf(&new_str, "%s%s%s=%s",
-                   *old_str ? *old_str : "",
-                   *old_str ? ";" : "",
-                   (char *)key,
-                   (char *)value);
-    if (*old_str)
-        free(*old_str);
-
-    if (ret >= 0) {
-        *old_str = new_str;
-        return true;
-    }
+    ctxt->len += strlen(key) + 1 + strlen(value) + 1;
+    return true;
+}
 
-    *old_str = NULL;
-    return false;
+static bool combine_strings(void *key, void *value, void *context)
+{
+    struct combine_ctxt *ctxt = context;
+    char *p = ctxt->str + ctxt->len;
+    size_t key_len = strlen(key);
+    size_t value_len = strlen(value);
+
+    if (ctxt->len)
+        *p++ = ';';
+    memcpy(p, key, key_len);
+    p += key_len;
+    *p++ = '=';
+    memcpy(p, value, value_len);
+    p += value_len;
+    *p = '\0';
+    ctxt->len = p - ctxt->str;
+    return true;
 }
 
 char *str_parms_to_str(struct str_parms *str_parms)
 {
-    char *str = NULL;
+    struct combine_ctxt ctxt = { NULL, 0 };
+    size_t len;
 
-    if (hashmapSize(str_parms->map) > 0)
-        hashmapForEach(str_parms->map, combine_strings, &str);
-    else
-        str = strdup("");
-    return str;
+    /* measure first, so as to build the string in a single allocation */
+    hashmapForEach(str_parms->map, measure_strings, &ctxt);
+    len = ctxt.len;
+
+    ctxt.str = malloc(len + 1);
+    if (!ctxt.str)
+        return NULL;
+    ctxt.str[0] = '\0';
+    ctxt.len = 0;
+    hashmapForEach(str_parms->map, combine_strings, &ctxt);
+    return ctxt.str;
 }
 
 static bool dump_entry(void *key, void *value, void *context)
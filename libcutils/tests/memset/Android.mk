@@ -0,0 +1,20 @@
+# Copyright 2014 The Android Open Source Project
+
+# arm and mips have their own assembly android_memset16/32 instead of
+# the implementations in memory.c.
+ifeq ($(filter arm mips,$(TARGET_ARCH)),)
+
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= memset_bench.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../..
+
+LOCAL_MODULE:= memset_bench
+
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput of each android_memset16/32 implementation this cpu can run,
+ * of what android_memset16/32 picked, and of memset() for reference, from
+ * fills which stay in the L1 cache to ones which go well past the last
+ * level one (and so take the non-temporal path).
+ *
+ *     memset_bench [<seconds per measurement>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/memory.h>
+
+#include "memory_impl.h"
+
+#define MAX_SIZE (32 * 1024 * 1024)
+
+static const size_t sizes[] = {
+    64, 512, 4096, 64 * 1024, 512 * 1024, 4 * 1024 * 1024, MAX_SIZE,
+};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void libc_memset16(uint16_t* dst, uint16_t value, size_t size)
+{
+    memset(dst, value & 0xff, size);
+}
+
+static void libc_memset32(uint32_t* dst, uint32_t value, size_t size)
+{
+    memset(dst, value & 0xff, size);
+}
+
+static const android_memset_impl exported = {
+    "android_memset", android_memset16, android_memset32, NULL,
+};
+
+static const android_memset_impl libc = {
+    "memset", libc_memset16, libc_memset32, NULL,
+};
+
+/* Returns MB/s, filling 'size' bytes at dst again and again for 'seconds' */
+static double measure(void (*fill)(void*, uint32_t, size_t), void* dst,
+                      size_t size, double seconds)
+{
+    double start, elapsed;
+    long long bytes = 0;
+    int batch = (int) (MAX_SIZE / size / 8) + 1;
+    int i;
+
+    fill(dst, 0, size);     // fault the pages in, warm the caches
+    start = now();
+    do {
+        for (i = 0; i < batch; i++)
+            fill(dst, i, size);
+        bytes += (long long) batch * size;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    return bytes / elapsed / (1024 * 1024);
+}
+
+static const android_memset_impl* current;
+
+static void fill16(void* dst, uint32_t value, size_t size)
+{
+    current->memset16((uint16_t*) dst, (uint16_t) value, size);
+}
+
+static void fill32(void* dst, uint32_t value, size_t size)
+{
+    current->memset32((uint32_t*) dst, value, size);
+}
+
+static void run(const android_memset_impl* impl, void* arena, double seconds)
+{
+    size_t i;
+
+    current = impl;
+    printf("%-16s", impl->name);
+    for (i = 0; i < NUM_SIZES; i++)
+        printf(" %9.0f", measure(fill16, arena, sizes[i], seconds));
+    printf("\n%-16s", "");
+    for (i = 0; i < NUM_SIZES; i++)
+        printf(" %9.0f", measure(fill32, arena, sizes[i], seconds));
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.2;
+    const android_memset_impl* impl;
+    void* arena;
+    size_t i;
+
+    /* page aligned, like the frame buffers these fill */
+    if (posix_memalign(&arena, 4096, MAX_SIZE)) {
+        fprintf(stderr, "memset_bench: out of memory\n");
+        return 1;
+    }
+
+    printf("MB/s, memset16 then memset32, for fills of\n%-16s", "");
+    for (i = 0; i < NUM_SIZES; i++) {
+        if (sizes[i] >= 1024 * 1024)
+            printf(" %8zuM", sizes[i] / (1024 * 1024));
+        else if (sizes[i] >= 1024)
+            printf(" %8zuK", sizes[i] / 1024);
+        else
+            printf(" %9zu", sizes[i]);
+    }
+    printf("\n");
+
+    for (i = 0; (impl = android_memset_get_impl(i)) != NULL; i++)
+        run(impl, arena, seconds);
+    run(&exported, arena, seconds);
+    run(&libc, arena, seconds);
+
+    free(arena);
+    return 0;
+}
@@ -19,9 +19,11 @@
 #include <limits.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <cutils/atomic.h>
 #include <cutils/compiler.h>
 #include <cutils/properties.h>
@@ -38,6 +40,10 @@ static volatile int32_t atrace_is_enabled    = 1;
 static pthread_once_t   atrace_once_control  = PTHREAD_ONCE_INIT;
 static pthread_mutex_t  atrace_tags_mutex    = PTHREAD_MUTEX_INITIALIZER;
 
+// Every event carries the pid, and getpid() is a system call of its own, so
+// keep it here, and update it in children.
+static pid_t            atrace_pid           = 0;
+
 // Set whether this process is debuggable, which determines whether
 // application-level tracing is allowed when the ro.debuggable system property
 // is not set to '1'.
@@ -165,8 +171,16 @@ void atrace_update_tags()
     }
 }
 
+static void atrace_update_pid()
+{
+    atrace_pid = getpid();
+}
+
 static void atrace_init_once()
 {
+    atrace_update_pid();
+    pthread_atfork(NULL, NULL, atrace_update_pid);
+
     atrace_marker_fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY);
     if (atrace_marker_fd == -1) {
         ALOGE("Error opening trace file: %s (%d)", strerror(errno), errno);
@@ -184,3 +198,54 @@ void atrace_setup()
 {
     pthread_once(&atrace_once_control, atrace_init_once);
 }
+
+void atrace_begin_body(const char* name)
+{
+    char buf[ATRACE_MESSAGE_LENGTH];
+    int len;
+
+    len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "B|%d|%s", atrace_pid, name);
+    if (len >= ATRACE_MESSAGE_LENGTH) {
+        len = ATRACE_MESSAGE_LENGTH - 1;
+    }
+    write(atrace_marker_fd, buf, len);
+}
+
+void atrace_end_body()
+{
+    char c = 'E';
+    write(atrace_marker_fd, &c, 1);
+}
+
+static void atrace_write_with_value(char type, const char* name, int64_t value)
+{
+    char buf[ATRACE_MESSAGE_LENGTH];
+    int len;
+
+    len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "%c|%d|%s|%lld", type, atrace_pid,
+            name, (long long) value);
+    if (len >= ATRACE_MESSAGE_LENGTH) {
+        len = ATRACE_MESSAGE_LENGTH - 1;
+    }
+    write(atrace_marker_fd, buf, len);
+}
+
+void atrace_async_begin_body(const char* name, int32_t cookie)
+{
+    atrace_write_with_value('S', name, cookie);
+}
+
+void atrace_async_end_body(const char* name, int32_t cookie)
+{
+    atrace_write_with_value('F', name, cookie);
+}
+
+void atrace_int_body(const char* name, int32_t value)
+{
+    atrace_write_with_value('C', name, value);
+}
+
+void atrace_int64_body(const char* name, int64_t value)
+{
+    atrace_write_with_value('C', name, value);
+}
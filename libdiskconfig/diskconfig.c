@@ -216,6 +216,9 @@ load_diskconfig(const char *fn, char *path_override)
     }
     dinfo->num_lba = strtoul(tmp, NULL, 0);
 
+    /* bypass the page cache when writing the partition table */
+    dinfo->direct_io = config_bool(devroot, "direct_io", 0);
+
     if (!(partnode = config_find(devroot, "partitions"))) {
         ALOGE("Device must specify partition list");
         goto fail;
@@ -280,7 +283,14 @@ validate(struct disk_info *dinfo)
     if (!dinfo)
         return -1;
 
-    if ((fd = open(dinfo->device, O_RDWR)) < 0) {
+    fd = open(dinfo->device, O_RDWR | (dinfo->direct_io ? O_DIRECT : 0));
+    if (fd < 0 && dinfo->direct_io && errno == EINVAL) {
+        /* some filesystems holding image files don't do O_DIRECT */
+        ALOGW("Cannot open '%s' with O_DIRECT, using buffered writes.",
+              dinfo->device);
+        fd = open(dinfo->device, O_RDWR);
+    }
+    if (fd < 0) {
         ALOGE("Cannot open device '%s' (errno=%d)", dinfo->device, errno);
         return -1;
     }
@@ -442,7 +452,7 @@ apply_disk_config(struct disk_info *dinfo, int test)
         goto fail;
     }
 
-    if ((rv = wlist_commit(fd, wr_lst, test)) >= 0)
+    if ((rv = wlist_commit_aligned(fd, wr_lst, dinfo->sect_size, test)) >= 0)
         rv = test ? 0 : sync_ptable(fd);
 
     close(fd);
@@ -17,9 +17,11 @@
 
 #define LOG_TAG "write_lst"
 #include <sys/types.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <cutils/log.h>
@@ -66,27 +68,177 @@ wlist_free(struct write_list *lst)
     }
 }
 
-int
-wlist_commit(int fd, struct write_list *lst, int test)
+/* The entries are written a run of whole sectors at a time: those that
+ * share or touch a sector go out in a single write, patched into what
+ * the rest of those sectors already hold. Once they are all written and
+ * flushed, the runs are read back and compared. The buffers are page
+ * aligned, so the descriptor may have been opened with O_DIRECT.
+ */
+struct wlist_run {
+    loff_t offset;
+    uint32_t len;
+    uint8_t *data;
+};
+
+static int
+cmp_offset(const void *a, const void *b)
+{
+    const struct write_list *wa = *(const struct write_list **)a;
+    const struct write_list *wb = *(const struct write_list **)b;
+
+    if (wa->offset != wb->offset)
+        return wa->offset < wb->offset ? -1 : 1;
+    return 0;
+}
+
+static uint8_t *
+alloc_run_buf(uint32_t len)
 {
-    for(; lst; lst = lst->next) {
-        if (lseek64(fd, lst->offset, SEEK_SET) != (loff_t)lst->offset) {
-            ALOGE("Cannot seek to the specified position (%lld).", lst->offset);
-            goto fail;
+    void *buf;
+
+    if (posix_memalign(&buf, getpagesize(), len)) {
+        ALOGE("Unable to allocate memory.");
+        return NULL;
+    }
+    return buf;
+}
+
+static int
+read_run(int fd, loff_t offset, uint8_t *buf, uint32_t len)
+{
+    uint32_t done = 0;
+    ssize_t rv;
+
+    while (done < len) {
+        rv = pread64(fd, buf + done, len - done, offset + done);
+        if (rv < 0 && errno == EINTR)
+            continue;
+        if (rv < 0) {
+            ALOGE("Failed reading %u bytes at position %lld (errno=%d).",
+                  len, offset, errno);
+            return -1;
+        }
+        if (!rv) {
+            /* past the end of an image file */
+            memset(buf + done, 0, len - done);
+            break;
         }
+        done += rv;
+    }
+    return 0;
+}
 
-        if (!test) {
-            if (write(fd, lst->data, lst->len) != (int)lst->len) {
-                ALOGE("Failed writing %u bytes at position %lld.", lst->len,
-                     lst->offset);
-                goto fail;
-            }
-        } else
+int
+wlist_commit_aligned(int fd, struct write_list *lst, int sect_size, int test)
+{
+    struct write_list **items = NULL;
+    struct write_list *item;
+    struct wlist_run *runs = NULL;
+    uint8_t *check = NULL;
+    loff_t mask = sect_size - 1;
+    uint32_t max_len = 0;
+    int cnt = 0;
+    int nruns = 0;
+    int rv = -1;
+    int i;
+
+    if (test) {
+        for (; lst; lst = lst->next)
             ALOGI("Would write %d bytes @ offset %lld.", lst->len, lst->offset);
+        return 0;
     }
 
-    return 0;
+    for (item = lst; item; item = item->next)
+        cnt++;
+    if (!cnt)
+        return 0;
 
-fail:
-    return -1;
+    if (!(items = malloc(cnt * sizeof(*items))) ||
+        !(runs = calloc(cnt, sizeof(*runs)))) {
+        ALOGE("Unable to allocate memory.");
+        goto done;
+    }
+    for (i = 0, item = lst; item; item = item->next)
+        items[i++] = item;
+    qsort(items, cnt, sizeof(*items), cmp_offset);
+
+    /* gather the entries into runs of whole sectors */
+    for (i = 0; i < cnt; i++) {
+        loff_t start = items[i]->offset & ~mask;
+        loff_t end = (items[i]->offset + items[i]->len + mask) & ~mask;
+        struct wlist_run *run = nruns ? &runs[nruns - 1] : NULL;
+
+        if (run && start <= run->offset + run->len) {
+            if (end > run->offset + run->len)
+                run->len = end - run->offset;
+        } else {
+            run = &runs[nruns++];
+            run->offset = start;
+            run->len = end - start;
+        }
+    }
+
+    for (i = 0; i < nruns; i++) {
+        if (!(runs[i].data = alloc_run_buf(runs[i].len)) ||
+            read_run(fd, runs[i].offset, runs[i].data, runs[i].len))
+            goto done;
+        if (runs[i].len > max_len)
+            max_len = runs[i].len;
+    }
+
+    /* in list order, as the entries used to be written */
+    for (item = lst; item; item = item->next) {
+        for (i = 0; i < nruns; i++) {
+            if (item->offset >= runs[i].offset &&
+                item->offset < runs[i].offset + runs[i].len)
+                break;
+        }
+        memcpy(runs[i].data + (item->offset - runs[i].offset), item->data,
+               item->len);
+    }
+
+    for (i = 0; i < nruns; i++) {
+        if (pwrite64(fd, runs[i].data, runs[i].len, runs[i].offset) !=
+            (ssize_t)runs[i].len) {
+            ALOGE("Failed writing %u bytes at position %lld (errno=%d).",
+                  runs[i].len, runs[i].offset, errno);
+            goto done;
+        }
+    }
+
+    if (fdatasync(fd)) {
+        ALOGE("Cannot flush the partition table (errno=%d).", errno);
+        goto done;
+    }
+
+    if (!(check = alloc_run_buf(max_len)))
+        goto done;
+    for (i = 0; i < nruns; i++) {
+        if (read_run(fd, runs[i].offset, check, runs[i].len))
+            goto done;
+        if (memcmp(check, runs[i].data, runs[i].len)) {
+            ALOGE("Verification failed for %u bytes at position %lld.",
+                  runs[i].len, runs[i].offset);
+            goto done;
+        }
+    }
+
+    rv = 0;
+
+done:
+    free(check);
+    if (runs) {
+        for (i = 0; i < nruns; i++)
+            free(runs[i].data);
+        free(runs);
+    }
+    free(items);
+    return rv;
+}
+
+int
+wlist_commit(int fd, struct write_list *lst, int test)
+{
+    /* every sector size is a multiple of this */
+    return wlist_commit_aligned(fd, lst, PC_MBR_SIZE, test);
 }
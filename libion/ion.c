@@ -22,10 +22,14 @@
 #include <cutils/log.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <linux/ion.h>
 #include <ion/ion.h>
@@ -154,3 +158,184 @@ int ion_sync_fd(int fd, int handle_fd)
     };
     return ion_ioctl(fd, ION_IOC_SYNC, &data);
 }
+
+/*
+ * Buffer pool
+ *
+ * Buffers handed back with ion_pool_release() are kept, still mapped if
+ * they ever were, and given out again to the next ion_pool_alloc() with the
+ * same size, alignment, heap mask and flags.
+ */
+
+struct ion_pool_buffer {
+        struct ion_pool_buffer *next;
+        int handle_fd;
+        size_t len;
+        size_t align;
+        unsigned int heap_mask;
+        unsigned int flags;
+        unsigned char *ptr;
+        int in_use;
+};
+
+struct ion_pool {
+        int fd;
+        size_t max_free;
+        size_t free_count;
+        pthread_mutex_t lock;
+        struct ion_pool_buffer *buffers;
+};
+
+static void ion_pool_buffer_destroy(struct ion_pool_buffer *buf)
+{
+        if (buf->ptr)
+                munmap(buf->ptr, buf->len);
+        close(buf->handle_fd);
+        free(buf);
+}
+
+/* Must be called with pool->lock held */
+static struct ion_pool_buffer *ion_pool_find(struct ion_pool *pool,
+                                             int handle_fd,
+                                             struct ion_pool_buffer ***prevp)
+{
+        struct ion_pool_buffer **prev = &pool->buffers;
+        struct ion_pool_buffer *buf;
+
+        for (buf = pool->buffers; buf; prev = &buf->next, buf = buf->next) {
+                if (buf->handle_fd == handle_fd) {
+                        if (prevp)
+                                *prevp = prev;
+                        return buf;
+                }
+        }
+        return NULL;
+}
+
+struct ion_pool *ion_pool_create(int fd, size_t max_free)
+{
+        struct ion_pool *pool = calloc(1, sizeof(*pool));
+
+        if (!pool)
+                return NULL;
+        pool->fd = fd;
+        pool->max_free = max_free;
+        pthread_mutex_init(&pool->lock, NULL);
+        return pool;
+}
+
+void ion_pool_destroy(struct ion_pool *pool)
+{
+        struct ion_pool_buffer *buf, *next;
+
+        for (buf = pool->buffers; buf; buf = next) {
+                next = buf->next;
+                if (buf->in_use)
+                        ALOGW("ion pool destroyed with buffer %d in use\n",
+                              buf->handle_fd);
+                ion_pool_buffer_destroy(buf);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+}
+
+int ion_pool_alloc(struct ion_pool *pool, size_t len, size_t align,
+                   unsigned int heap_mask, unsigned int flags, int *handle_fd)
+{
+        struct ion_pool_buffer *buf;
+        int ret;
+
+        pthread_mutex_lock(&pool->lock);
+        for (buf = pool->buffers; buf; buf = buf->next) {
+                if (!buf->in_use && buf->len == len && buf->align == align &&
+                    buf->heap_mask == heap_mask && buf->flags == flags) {
+                        buf->in_use = 1;
+                        pool->free_count--;
+                        *handle_fd = buf->handle_fd;
+                        pthread_mutex_unlock(&pool->lock);
+                        return 0;
+                }
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        buf = calloc(1, sizeof(*buf));
+        if (!buf)
+                return -ENOMEM;
+        ret = ion_alloc_fd(pool->fd, len, align, heap_mask, flags,
+                           &buf->handle_fd);
+        if (ret < 0) {
+                free(buf);
+                return ret;
+        }
+        buf->len = len;
+        buf->align = align;
+        buf->heap_mask = heap_mask;
+        buf->flags = flags;
+        buf->in_use = 1;
+
+        pthread_mutex_lock(&pool->lock);
+        buf->next = pool->buffers;
+        pool->buffers = buf;
+        pthread_mutex_unlock(&pool->lock);
+
+        *handle_fd = buf->handle_fd;
+        return 0;
+}
+
+int ion_pool_map(struct ion_pool *pool, int handle_fd, unsigned char **ptr)
+{
+        struct ion_pool_buffer *buf;
+        int ret = 0;
+
+        pthread_mutex_lock(&pool->lock);
+        buf = ion_pool_find(pool, handle_fd, NULL);
+        if (!buf) {
+                ret = -EINVAL;
+        } else if (!buf->ptr) {
+                unsigned char *mapped = mmap(NULL, buf->len,
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_SHARED, handle_fd, 0);
+                if (mapped == MAP_FAILED) {
+                        ALOGE("mmap failed: %s\n", strerror(errno));
+                        ret = -errno;
+                } else {
+                        buf->ptr = mapped;
+                }
+        }
+        if (ret == 0)
+                *ptr = buf->ptr;
+        pthread_mutex_unlock(&pool->lock);
+        return ret;
+}
+
+int ion_pool_release(struct ion_pool *pool, int handle_fd)
+{
+        struct ion_pool_buffer *buf, **prev, **oldest = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+        buf = ion_pool_find(pool, handle_fd, &prev);
+        if (!buf || !buf->in_use) {
+                pthread_mutex_unlock(&pool->lock);
+                return -EINVAL;
+        }
+        buf->in_use = 0;
+        pool->free_count++;
+
+        /* over the limit, drop the oldest free buffer */
+        if (pool->free_count > pool->max_free) {
+                for (prev = &pool->buffers; *prev; prev = &(*prev)->next) {
+                        if (!(*prev)->in_use)
+                                oldest = prev;
+                }
+                buf = *oldest;
+                *oldest = buf->next;
+                pool->free_count--;
+        } else {
+                buf = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (buf)
+                ion_pool_buffer_destroy(buf);
+        return 0;
+}
@@ -79,3 +79,11 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := liblog
 LOCAL_WHOLE_STATIC_LIBRARIES := liblog
 include $(BUILD_SHARED_LIBRARY)
+
+# Host tool that precompiles event-log-tags for android_openEventTagMap()
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := eventtagmap_compile
+LOCAL_SRC_FILES := eventtagmap_compile.c
+LOCAL_STATIC_LIBRARIES := liblog
+include $(BUILD_HOST_EXECUTABLE)
@@ -22,6 +22,9 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 #define OUT_TAG "EventTagMap"
 
@@ -33,6 +36,31 @@ typedef struct EventTag {
     const char*     tagStr;
 } EventTag;
 
+/*
+ * Precompiled index, written next to the text file with the
+ * EVENT_TAG_MAP_INDEX_SUFFIX.  It is used straight from the mapping:
+ *
+ *   EventTagIndexHeader
+ *   EventTagIndexSlot[hashSize]     open addressing on tagIndex
+ *   NUL-terminated tag strings
+ *
+ * A slot whose strOffset is 0 is empty; strings start after the slots,
+ * so no real offset is 0.  All fields are in host byte order.
+ */
+#define EVENT_TAG_INDEX_MAGIC   0x314d5445      /* "ETM1" */
+
+typedef struct EventTagIndexHeader {
+    uint32_t        magic;
+    uint32_t        sourceSize;     /* size of the text file it came from */
+    uint32_t        numTags;
+    uint32_t        hashSize;       /* power of two */
+} EventTagIndexHeader;
+
+typedef struct EventTagIndexSlot {
+    uint32_t        tagIndex;
+    uint32_t        strOffset;      /* from the start of the file */
+} EventTagIndexSlot;
+
 /*
  * Map.
  */
@@ -44,8 +72,17 @@ struct EventTagMap {
     /* array of event tags, sorted numerically by tag index */
     EventTag*       tagArray;
     int             numTags;
+
+    /* set instead of tagArray when mapAddr is a precompiled index */
+    const EventTagIndexSlot* hashTable;
+    uint32_t        hashMask;
 };
 
+static inline uint32_t hashTagIndex(uint32_t tagIndex)
+{
+    return tagIndex * 2654435761u;
+}
+
 /* fwd */
 static int processFile(EventTagMap* map);
 static int countMapLines(const EventTagMap* map);
@@ -61,12 +98,76 @@ static void dumpTags(const EventTagMap* map);
  * We create a private mapping because we want to terminate the log tag
  * strings with '\0'.
  */
+/*
+ * Map fileName's precompiled index, if there is one that is at least as
+ * new as fileName and was built from a file of the same size.  Returns
+ * NULL if the caller should parse the text instead.
+ */
+static EventTagMap* openEventTagIndex(const char* fileName)
+{
+    char indexName[PATH_MAX];
+    struct stat srcStat, indexStat;
+    const EventTagIndexHeader* hdr;
+    EventTagMap* map;
+    void* addr;
+    uint64_t tableEnd;
+    int fd;
+
+    if (snprintf(indexName, sizeof(indexName), "%s%s", fileName,
+                 EVENT_TAG_MAP_INDEX_SUFFIX) >= (int) sizeof(indexName))
+        return NULL;
+    if (stat(fileName, &srcStat) < 0)
+        return NULL;
+
+    fd = open(indexName, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &indexStat) < 0 ||
+            indexStat.st_mtime < srcStat.st_mtime ||
+            indexStat.st_size < (off_t) sizeof(EventTagIndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    addr = mmap(NULL, indexStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    hdr = (const EventTagIndexHeader*) addr;
+    tableEnd = sizeof(*hdr) + (uint64_t) hdr->hashSize * sizeof(EventTagIndexSlot);
+    if (hdr->magic != EVENT_TAG_INDEX_MAGIC ||
+            hdr->sourceSize != (uint32_t) srcStat.st_size ||
+            hdr->hashSize == 0 || (hdr->hashSize & (hdr->hashSize - 1)) ||
+            tableEnd > (uint64_t) indexStat.st_size ||
+            ((const char*) addr)[indexStat.st_size - 1] != '\0') {
+        munmap(addr, indexStat.st_size);
+        return NULL;
+    }
+
+    map = calloc(1, sizeof(EventTagMap));
+    if (map == NULL) {
+        munmap(addr, indexStat.st_size);
+        return NULL;
+    }
+    map->mapAddr = addr;
+    map->mapLen = indexStat.st_size;
+    map->numTags = hdr->numTags;
+    map->hashTable = (const EventTagIndexSlot*) (hdr + 1);
+    map->hashMask = hdr->hashSize - 1;
+    return map;
+}
+
 EventTagMap* android_openEventTagMap(const char* fileName)
 {
     EventTagMap* newTagMap;
     off_t end;
     int fd = -1;
 
+    newTagMap = openEventTagIndex(fileName);
+    if (newTagMap != NULL)
+        return newTagMap;
+
     newTagMap = calloc(1, sizeof(EventTagMap));
     if (newTagMap == NULL)
         return NULL;
@@ -115,6 +216,7 @@ void android_closeEventTagMap(EventTagMap* map)
         return;
 
     munmap(map->mapAddr, map->mapLen);
+    free(map->tagArray);
     free(map);
 }
 
@@ -127,6 +229,24 @@ const char* android_lookupEventTag(const EventTagMap* map, int tag)
 {
     int hi, lo, mid;
 
+    if (map->hashTable != NULL) {
+        uint32_t i = hashTagIndex(tag) & map->hashMask;
+        uint32_t probes;
+
+        for (probes = 0; probes <= map->hashMask; probes++) {
+            const EventTagIndexSlot* slot = &map->hashTable[i];
+            if (slot->strOffset == 0)
+                break;
+            if (slot->tagIndex == (uint32_t) tag) {
+                if (slot->strOffset >= map->mapLen)
+                    return NULL;
+                return (const char*) map->mapAddr + slot->strOffset;
+            }
+            i = (i + 1) & map->hashMask;
+        }
+        return NULL;
+    }
+
     lo = 0;
     hi = map->numTags-1;
 
@@ -152,6 +272,68 @@ const char* android_lookupEventTag(const EventTagMap* map, int tag)
 
 
 
+/*
+ * Write the precompiled index for a map opened from its text file.
+ */
+int android_writeEventTagMapIndex(const EventTagMap* map, const char* indexName)
+{
+    EventTagIndexHeader hdr;
+    EventTagIndexSlot* slots;
+    uint32_t hashSize = 16, strOffset;
+    FILE* fp;
+    int i, result = -1;
+
+    if (map->tagArray == NULL && map->numTags != 0)
+        return -1;      /* already an index */
+
+    while (hashSize < (uint32_t) map->numTags * 2)
+        hashSize *= 2;
+
+    slots = calloc(hashSize, sizeof(EventTagIndexSlot));
+    if (slots == NULL)
+        return -1;
+
+    strOffset = sizeof(hdr) + hashSize * sizeof(EventTagIndexSlot);
+    for (i = 0; i < map->numTags; i++) {
+        const EventTag* tag = &map->tagArray[i];
+        uint32_t h = hashTagIndex(tag->tagIndex) & (hashSize - 1);
+
+        while (slots[h].strOffset != 0)
+            h = (h + 1) & (hashSize - 1);
+        slots[h].tagIndex = tag->tagIndex;
+        slots[h].strOffset = strOffset;
+        strOffset += strlen(tag->tagStr) + 1;
+    }
+
+    hdr.magic = EVENT_TAG_INDEX_MAGIC;
+    hdr.sourceSize = map->mapLen;
+    hdr.numTags = map->numTags;
+    hdr.hashSize = hashSize;
+
+    fp = fopen(indexName, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: unable to create '%s': %s\n",
+            OUT_TAG, indexName, strerror(errno));
+        goto bail;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(slots, sizeof(EventTagIndexSlot), hashSize, fp);
+    for (i = 0; i < map->numTags; i++)
+        fwrite(map->tagArray[i].tagStr, 1, strlen(map->tagArray[i].tagStr) + 1, fp);
+    /* an empty map still needs its trailing NUL */
+    if (map->numTags == 0)
+        fputc('\0', fp);
+    if (ferror(fp) | fclose(fp)) {
+        unlink(indexName);
+        goto bail;
+    }
+    result = 0;
+
+bail:
+    free(slots);
+    return result;
+}
+
 /*
  * Determine whether "c" is a whitespace char.
  */
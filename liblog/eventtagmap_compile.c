@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Builds the precompiled index for an event-log-tags file, so readers can
+ * look tags up straight from the mapping instead of parsing the text.
+ *
+ *   eventtagmap_compile <event-log-tags> [<index>]
+ *
+ * The index defaults to the input name plus EVENT_TAG_MAP_INDEX_SUFFIX,
+ * which is where android_openEventTagMap() looks for it.  The index must
+ * be installed alongside the text file it was built from.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <log/event_tag_map.h>
+
+int main(int argc, char** argv)
+{
+    char indexName[4096];
+    EventTagMap* map;
+    int result;
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s <event-log-tags> [<index>]\n", argv[0]);
+        return 2;
+    }
+
+    if (argc == 3) {
+        snprintf(indexName, sizeof(indexName), "%s", argv[2]);
+    } else {
+        snprintf(indexName, sizeof(indexName), "%s%s", argv[1],
+                 EVENT_TAG_MAP_INDEX_SUFFIX);
+    }
+    /* don't let a stale index stand in for the file we are compiling */
+    remove(indexName);
+
+    map = android_openEventTagMap(argv[1]);
+    if (map == NULL)
+        return 1;
+
+    result = android_writeEventTagMapIndex(map, indexName);
+    android_closeEventTagMap(map);
+    return result == 0 ? 0 : 1;
+}
@@ -20,6 +20,7 @@
  * simulator, messages are printed to stderr.
  */
 #include <log/logd.h>
+#include <log/fake_log_device.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -67,27 +68,35 @@ typedef struct LogState {
 
     /* nonzero if this is a binary log */
     int     isBinary;
+} LogState;
 
+/*
+ * Settings from the environment.  They are the same for every log, are
+ * read once and never change afterwards, so writers use them unlocked.
+ */
+static struct {
     /* global minimum priority */
     int     globalMinPriority;
 
     /* output format */
     LogFormat outputFormat;
 
+    /* nonzero to buffer lines per thread */
+    int     buffered;
+
     /* tags and priorities */
     struct {
         char    tag[kMaxTagLen];
         int     minPriority;
     } tagSet[kTagSetSize];
-} LogState;
+} logConfig;
 
 
 #ifdef HAVE_PTHREADS
 /*
  * Locking.  Since we're emulating a device, we need to be prepared
- * to have multiple callers at the same time.  This lock is used
- * to both protect the fd list and to prevent LogStates from being
- * freed out from under a user.
+ * to have multiple callers at the same time.  This lock protects the
+ * fd list while logs are opened and closed; writers don't take it.
  */
 static pthread_mutex_t fakeLogDeviceLock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -121,16 +130,28 @@ static LogState *createLogState()
 {
     size_t i;
 
-    for (i = 0; i < sizeof(openLogTable); i++) {
+    for (i = 0; i < MAX_OPEN_LOGS; i++) {
         if (openLogTable[i] == NULL) {
-            openLogTable[i] = calloc(1, sizeof(LogState));
-            openLogTable[i]->fakeFd = FAKE_FD_BASE + i;
-            return openLogTable[i];
+            LogState *ls = calloc(1, sizeof(LogState));
+            if (ls == NULL)
+                return NULL;
+            ls->fakeFd = FAKE_FD_BASE + i;
+            return ls;
         }
     }
     return NULL;
 }
 
+/*
+ * Make a fully set up LogState visible to writers, which look it up
+ * without the lock.
+ */
+static void publishLogState(LogState *ls)
+{
+    __sync_synchronize();
+    openLogTable[ls->fakeFd - FAKE_FD_BASE] = ls;
+}
+
 /*
  * Translate an fd to a LogState.
  */
@@ -143,20 +164,16 @@ static LogState *fdToLogState(int fd)
 }
 
 /*
- * Unregister the fake fd and free the memory it pointed to.
+ * Unregister the fake fd.  A writer that raced with the close may still
+ * be using the LogState, so it is never freed; liblog only closes its
+ * logs when opening one of them failed, so there are at most a few.
  */
 static void deleteFakeFd(int fd)
 {
-    LogState *ls;
-
     lock();
 
-    ls = fdToLogState(fd);
-    if (ls != NULL) {
+    if (fdToLogState(fd) != NULL)
         openLogTable[fd - FAKE_FD_BASE] = NULL;
-        free(ls->debugName);
-        free(ls);
-    }
 
     unlock();
 }
@@ -172,21 +189,12 @@ static void deleteFakeFd(int fd)
  * This can be used to reveal or conceal logs with specific tags.
  *
  * We also want to check ANDROID_PRINTF_LOG to determine how the output
- * will look.
+ * will look, and ANDROID_LOG_BUFFERED to see whether it is buffered.
  */
-static void configureInitialState(const char* pathName, LogState* logState)
+static void readConfig()
 {
-    static const int kDevLogLen = sizeof("/dev/log/") - 1;
-
-    logState->debugName = strdup(pathName);
-
-    /* identify binary logs */
-    if (strcmp(pathName + kDevLogLen, "events") == 0) {
-        logState->isBinary = 1;
-    }
-
     /* global min priority defaults to "info" level */
-    logState->globalMinPriority = ANDROID_LOG_INFO;
+    logConfig.globalMinPriority = ANDROID_LOG_INFO;
 
     /*
      * This is based on the the long-dead utils/Log.cpp code.
@@ -228,7 +236,7 @@ static void configureInitialState(const char* pathName, LogState* logState)
                     if (*tags >= ('0' + ANDROID_LOG_SILENT))
                         minPrio = ANDROID_LOG_VERBOSE;
                     else
-                        minPrio = *tags - '\0';
+                        minPrio = *tags - '0';
                 } else {
                     switch (*tags) {
                     case 'v':   minPrio = ANDROID_LOG_VERBOSE;  break;
@@ -251,15 +259,15 @@ static void configureInitialState(const char* pathName, LogState* logState)
             }
 
             if (tagName[0] == 0) {
-                logState->globalMinPriority = minPrio;
-                TRACE("+++ global min prio %d\n", logState->globalMinPriority);
-            } else {
-                logState->tagSet[entry].minPriority = minPrio;
-                strcpy(logState->tagSet[entry].tag, tagName);
+                logConfig.globalMinPriority = minPrio;
+                TRACE("+++ global min prio %d\n", logConfig.globalMinPriority);
+            } else if (entry < kTagSetSize) {
+                logConfig.tagSet[entry].minPriority = minPrio;
+                strcpy(logConfig.tagSet[entry].tag, tagName);
                 TRACE("+++ entry %d: %s:%d\n",
                     entry,
-                    logState->tagSet[entry].tag,
-                    logState->tagSet[entry].minPriority);
+                    logConfig.tagSet[entry].tag,
+                    logConfig.tagSet[entry].minPriority);
                 entry++;
             }
         }
@@ -292,7 +300,65 @@ static void configureInitialState(const char* pathName, LogState* logState)
             format = (LogFormat) atoi(fstr);        // really?!
     }
 
-    logState->outputFormat = format;
+    logConfig.outputFormat = format;
+
+    const char* bstr = getenv("ANDROID_LOG_BUFFERED");
+    logConfig.buffered = bstr != NULL && strcmp(bstr, "1") == 0;
+}
+
+#ifdef HAVE_PTHREADS
+static pthread_once_t configOnce = PTHREAD_ONCE_INIT;
+
+static void configure()
+{
+    pthread_once(&configOnce, readConfig);
+}
+#else
+static void configure()
+{
+    static int configured;
+
+    if (!configured) {
+        readConfig();
+        configured = 1;
+    }
+}
+#endif
+
+/*
+ * Set up a new log for pathName.
+ */
+static void configureInitialState(const char* pathName, LogState* logState)
+{
+    static const int kDevLogLen = sizeof("/dev/log/") - 1;
+
+    logState->debugName = strdup(pathName);
+
+    /* identify binary logs */
+    if (strcmp(pathName + kDevLogLen, "events") == 0) {
+        logState->isBinary = 1;
+    }
+
+    configure();
+}
+
+/*
+ * Return the minimum priority that tag is logged at.
+ */
+static int tagMinPriority(const char* tag)
+{
+    int i;
+
+    for (i = 0; i < kTagSetSize; i++) {
+        if (logConfig.tagSet[i].minPriority == ANDROID_LOG_UNKNOWN)
+            break;      /* reached end of configured values */
+
+        if (strcmp(logConfig.tagSet[i].tag, tag) == 0) {
+            //TRACE("MATCH tag '%s'\n", tag);
+            return logConfig.tagSet[i].minPriority;
+        }
+    }
+    return logConfig.globalMinPriority;
 }
 
 /*
@@ -338,6 +404,309 @@ static ssize_t fake_writev(int fd, const struct iovec *iov, int iovcnt) {
 #endif
 
 
+/*
+ * Write the whole of vec to stderr with a single writev() call.
+ * We need to use this rather than a collection of printf()s on a FILE*
+ * because of multi-threading and multi-process issues.
+ *
+ * If the file was not opened with O_APPEND, this will produce interleaved
+ * output when called on the same file from multiple processes.
+ *
+ * If the file descriptor is actually a network socket, the writev()
+ * call may return with a partial write.  Putting the writev() call in
+ * a loop can result in interleaved data.
+ */
+static void writeFully(const struct iovec* vec, int count, size_t totalLen)
+{
+    for(;;) {
+        int cc = writev(fileno(stderr), vec, count);
+
+        if (cc == (int) totalLen) break;
+
+        if (cc < 0) {
+            if(errno == EINTR) continue;
+
+                /* can't really log the failure; for now, throw out a stderr */
+            fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+            break;
+        } else {
+                /* shouldn't happen when writing to file or tty */
+            fprintf(stderr, "+++ LOG: write partial (%d of %d)\n", cc,
+                (int) totalLen);
+            break;
+        }
+    }
+}
+
+static void copyVecs(char* dst, const struct iovec* vec, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        memcpy(dst, vec[i].iov_base, vec[i].iov_len);
+        dst += vec[i].iov_len;
+    }
+}
+
+
+/*
+ * In-memory capture, for tests.  Writers check captureActive without the
+ * lock, so only records that start after fakeLogCaptureStart() returns
+ * are sure to be captured.
+ */
+static volatile int captureActive;
+static char* captureData;
+static size_t captureLen;
+static size_t captureSize;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER;
+#define lockCapture() pthread_mutex_lock(&captureLock)
+#define unlockCapture() pthread_mutex_unlock(&captureLock)
+#else
+#define lockCapture() ((void)0)
+#define unlockCapture() ((void)0)
+#endif
+
+/*
+ * Returns nonzero if the record was captured.
+ */
+static int captureLog(const struct iovec* vec, int count, size_t totalLen)
+{
+    int captured = 0;
+
+    lockCapture();
+    if (captureActive) {
+        /* always leave room for the terminating NUL */
+        if (captureLen + totalLen >= captureSize) {
+            size_t size = captureSize ? captureSize : 4096;
+            char* data;
+
+            while (captureLen + totalLen >= size)
+                size *= 2;
+            data = realloc(captureData, size);
+            if (data == NULL)
+                goto done;
+            captureData = data;
+            captureSize = size;
+        }
+        copyVecs(captureData + captureLen, vec, count);
+        captureLen += totalLen;
+        captured = 1;
+    }
+done:
+    unlockCapture();
+    return captured;
+}
+
+void fakeLogCaptureStart(void)
+{
+    fakeLogFlush();
+
+    lockCapture();
+    captureLen = 0;
+    captureActive = 1;
+    unlockCapture();
+}
+
+char *fakeLogCaptureStop(void)
+{
+    char* text;
+
+    lockCapture();
+    captureActive = 0;
+    text = captureData;
+    if (text == NULL)
+        text = malloc(1);
+    if (text != NULL)
+        text[captureLen] = '\0';
+    captureData = NULL;
+    captureLen = captureSize = 0;
+    unlockCapture();
+
+    return text;
+}
+
+
+#ifdef HAVE_PTHREADS
+/*
+ * Per-thread buffering.  Each thread appends its lines to a ThreadBuf of
+ * its own.  The buffer's lock is only ever contended by fakeLogFlush(),
+ * which writes out the buffers of all threads, so there is no lock that
+ * threads logging at the same time have to share.
+ */
+#define kThreadBufSize  (16 * 1024)
+
+typedef struct ThreadBuf {
+    struct ThreadBuf* next;     /* in threadBufList */
+    pthread_mutex_t lock;
+    pid_t   pid;                /* process the contents belong to */
+    size_t  len;
+    char    data[kThreadBufSize];
+} ThreadBuf;
+
+static pthread_key_t threadBufKey;
+static pthread_once_t threadBufOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t threadBufListLock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadBuf* threadBufList;
+
+/*
+ * The caller holds b->lock.  Lines buffered before a fork() belong to
+ * the parent, which writes them out itself.
+ */
+static void flushThreadBuf(ThreadBuf* b)
+{
+    if (b->len > 0 && b->pid == getpid()) {
+        struct iovec vec;
+
+        vec.iov_base = b->data;
+        vec.iov_len = b->len;
+        writeFully(&vec, 1, b->len);
+    }
+    b->len = 0;
+}
+
+static void destroyThreadBuf(void* arg)
+{
+    ThreadBuf* b = arg;
+    ThreadBuf** pb;
+
+    pthread_mutex_lock(&b->lock);
+    flushThreadBuf(b);
+    pthread_mutex_unlock(&b->lock);
+
+    pthread_mutex_lock(&threadBufListLock);
+    for (pb = &threadBufList; *pb != NULL; pb = &(*pb)->next) {
+        if (*pb == b) {
+            *pb = b->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&threadBufListLock);
+
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
+
+static void lockThreadBufList(void)
+{
+    pthread_mutex_lock(&threadBufListLock);
+}
+
+static void unlockThreadBufList(void)
+{
+    pthread_mutex_unlock(&threadBufListLock);
+}
+
+static void createThreadBufKey(void)
+{
+    pthread_key_create(&threadBufKey, destroyThreadBuf);
+    pthread_atfork(lockThreadBufList, unlockThreadBufList,
+        unlockThreadBufList);
+    atexit(fakeLogFlush);
+}
+
+static ThreadBuf* getThreadBuf(void)
+{
+    ThreadBuf* b;
+
+    pthread_once(&threadBufOnce, createThreadBufKey);
+    b = pthread_getspecific(threadBufKey);
+    if (b == NULL) {
+        b = malloc(sizeof(ThreadBuf));
+        if (b == NULL)
+            return NULL;
+        pthread_mutex_init(&b->lock, NULL);
+        b->pid = getpid();
+        b->len = 0;
+        pthread_setspecific(threadBufKey, b);
+
+        pthread_mutex_lock(&threadBufListLock);
+        b->next = threadBufList;
+        threadBufList = b;
+        pthread_mutex_unlock(&threadBufListLock);
+    }
+    return b;
+}
+
+/*
+ * Returns nonzero if the record was buffered (or written).
+ */
+static int bufferLog(int logPrio, pid_t pid, const struct iovec* vec,
+        int count, size_t totalLen)
+{
+    ThreadBuf* b = getThreadBuf();
+
+    if (b == NULL)
+        return 0;
+
+    /* whatever the other threads have goes out before an assert */
+    if (logPrio >= ANDROID_LOG_FATAL)
+        fakeLogFlush();
+
+    pthread_mutex_lock(&b->lock);
+    if (b->pid != pid) {
+        /* we are a child that inherited the buffer */
+        b->pid = pid;
+        b->len = 0;
+    }
+    if (b->len + totalLen > sizeof(b->data))
+        flushThreadBuf(b);
+    if (totalLen > sizeof(b->data)) {
+        writeFully(vec, count, totalLen);
+    } else {
+        copyVecs(b->data + b->len, vec, count);
+        b->len += totalLen;
+        if (logPrio >= ANDROID_LOG_ERROR)
+            flushThreadBuf(b);
+    }
+    pthread_mutex_unlock(&b->lock);
+    return 1;
+}
+
+void fakeLogFlush(void)
+{
+    ThreadBuf* b;
+    pid_t pid = getpid();
+
+    pthread_mutex_lock(&threadBufListLock);
+    for (b = threadBufList; b != NULL; b = b->next) {
+        /* the threads those belong to didn't survive the fork() */
+        if (b->pid != pid)
+            continue;
+        pthread_mutex_lock(&b->lock);
+        flushThreadBuf(b);
+        pthread_mutex_unlock(&b->lock);
+    }
+    pthread_mutex_unlock(&threadBufListLock);
+}
+#else   // !HAVE_PTHREADS
+static int bufferLog(int logPrio, pid_t pid, const struct iovec* vec,
+        int count, size_t totalLen)
+{
+    return 0;
+}
+
+void fakeLogFlush(void)
+{
+}
+#endif  // !HAVE_PTHREADS
+
+/*
+ * Send a formatted record wherever it goes: into the capture, into the
+ * thread's buffer, or straight to stderr.
+ */
+static void emitLog(int logPrio, pid_t pid, const struct iovec* vec,
+        int count, size_t totalLen)
+{
+    if (captureActive && captureLog(vec, count, totalLen))
+        return;
+    if (logConfig.buffered && bufferLog(logPrio, pid, vec, count, totalLen))
+        return;
+    writeFully(vec, count, totalLen);
+}
+
+
 /*
  * Write a filtered log message to stderr.
  *
@@ -359,11 +728,11 @@ static void showLog(LogState *state,
     TRACE("LOG %d: %s %s", logPrio, tag, msg);
 
     priChar = getPriorityString(logPrio)[0];
-    when = time(NULL);
     pid = tid = getpid();       // find gettid()?
 
     /*
-     * Get the current date/time in pretty form
+     * Get the current date/time in pretty form, for the formats that
+     * show it.
      *
      * It's often useful when examining a log with "less" to jump to
      * a specific point in the file by searching for the date/time stamp.
@@ -371,20 +740,25 @@ static void showLog(LogState *state,
      * in the time stamp.  Don't use forward slashes, parenthesis,
      * brackets, asterisks, or other special chars here.
      */
+    if (logConfig.outputFormat == FORMAT_TIME ||
+            logConfig.outputFormat == FORMAT_THREADTIME ||
+            logConfig.outputFormat == FORMAT_LONG) {
+        when = time(NULL);
 #if defined(HAVE_LOCALTIME_R)
-    ptm = localtime_r(&when, &tmBuf);
+        ptm = localtime_r(&when, &tmBuf);
 #else
-    ptm = localtime(&when);
+        ptm = localtime(&when);
 #endif
-    //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
-    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
+        //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
+        strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
+    }
 
     /*
      * Construct a buffer containing the log header and log message.
      */
     size_t prefixLen, suffixLen;
 
-    switch (state->outputFormat) {
+    switch (logConfig.outputFormat) {
     case FORMAT_TAG:
         prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
             "%c/%-8s: ", priChar, tag);
@@ -494,37 +868,7 @@ static void showLog(LogState *state,
         numLines -= 1;
     }
     
-    /*
-     * Write the entire message to the log file with a single writev() call.
-     * We need to use this rather than a collection of printf()s on a FILE*
-     * because of multi-threading and multi-process issues.
-     *
-     * If the file was not opened with O_APPEND, this will produce interleaved
-     * output when called on the same file from multiple processes.
-     *
-     * If the file descriptor is actually a network socket, the writev()
-     * call may return with a partial write.  Putting the writev() call in
-     * a loop can result in interleaved data.  This can be alleviated
-     * somewhat by wrapping the writev call in the Mutex.
-     */
-
-    for(;;) {
-        int cc = writev(fileno(stderr), vec, v-vec);
-
-        if (cc == totalLen) break;
-        
-        if (cc < 0) {
-            if(errno == EINTR) continue;
-            
-                /* can't really log the failure; for now, throw out a stderr */
-            fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
-            break;
-        } else {
-                /* shouldn't happen when writing to file or tty */
-            fprintf(stderr, "+++ LOG: write partial (%d of %d)\n", cc, totalLen);
-            break;
-        }
-    }
+    emitLog(logPrio, pid, vec, v-vec, totalLen);
 
     /* if we allocated storage for the iovecs, free it */
     if (vec != stackVec)
@@ -543,16 +887,13 @@ static ssize_t logWritev(int fd, const struct iovec* vector, int count)
 {
     LogState* state;
 
-    /* Make sure that no-one frees the LogState while we're using it.
-     * Also guarantees that only one thread is in showLog() at a given
-     * time (if it matters).
+    /* LogStates are never freed and the settings never change once the
+     * log is open, so there is nothing to lock here.
      */
-    lock();
-
     state = fdToLogState(fd);
     if (state == NULL) {
         errno = EBADF;
-        goto error;
+        return -1;
     }
 
     if (state->isBinary) {
@@ -563,7 +904,7 @@ static ssize_t logWritev(int fd, const struct iovec* vector, int count)
     if (count != 3) {
         TRACE("%s: writevLog with count=%d not expected\n",
             state->debugName, count);
-        goto error;
+        return -1;
     }
 
     /* pull out the three fields */
@@ -572,31 +913,14 @@ static ssize_t logWritev(int fd, const struct iovec* vector, int count)
     const char* msg = (const char*) vector[2].iov_base;
 
     /* see if this log tag is configured */
-    int i;
-    int minPrio = state->globalMinPriority;
-    for (i = 0; i < kTagSetSize; i++) {
-        if (state->tagSet[i].minPriority == ANDROID_LOG_UNKNOWN)
-            break;      /* reached end of configured values */
-
-        if (strcmp(state->tagSet[i].tag, tag) == 0) {
-            //TRACE("MATCH tag '%s'\n", tag);
-            minPrio = state->tagSet[i].minPriority;
-            break;
-        }
-    }
-
-    if (logPrio >= minPrio) {
+    if (logPrio >= tagMinPriority(tag)) {
         showLog(state, logPrio, tag, msg);
     } else {
         //TRACE("+++ NOLOG(%d): %s %s", logPrio, tag, msg);
     }
 
 bail:
-    unlock();
     return vector[0].iov_len + vector[1].iov_len + vector[2].iov_len;
-error:
-    unlock();
-    return -1;
 }
 
 /*
@@ -621,6 +945,7 @@ static int logOpen(const char* pathName, int flags)
     logState = createLogState();
     if (logState != NULL) {
         configureInitialState(pathName, logState);
+        publishLogState(logState);
         fd = logState->fakeFd;
     } else  {
         errno = ENFILE;
@@ -664,11 +989,25 @@ static void setRedirects()
     }
 }
 
-int fakeLogOpen(const char *pathName, int flags)
+#ifdef HAVE_PTHREADS
+static pthread_once_t redirectOnce = PTHREAD_ONCE_INIT;
+
+static void initRedirects()
+{
+    pthread_once(&redirectOnce, setRedirects);
+}
+#else
+static void initRedirects()
 {
     if (redirectOpen == NULL) {
         setRedirects();
     }
+}
+#endif
+
+int fakeLogOpen(const char *pathName, int flags)
+{
+    initRedirects();
     return redirectOpen(pathName, flags);
 }
 
@@ -683,3 +1022,14 @@ ssize_t fakeLogWritev(int fd, const struct iovec* vector, int count)
     /* Assume that open() was called first. */
     return redirectWritev(fd, vector, count);
 }
+
+int fakeLogTagLevel(const char *tag)
+{
+    initRedirects();
+    if (redirectWritev != logWritev) {
+        /* the device does its own filtering */
+        return ANDROID_LOG_DEFAULT;
+    }
+    configure();
+    return tagMinPriority(tag);
+}
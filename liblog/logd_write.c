@@ -31,6 +31,13 @@
 #include <log/logd.h>
 #include <log/log.h>
 
+#if FAKE_LOG_DEVICE
+#include <log/fake_log_device.h>
+#else
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+#endif
+
 #define LOG_BUF_SIZE	1024
 
 #if FAKE_LOG_DEVICE
@@ -77,6 +84,14 @@ static int __write_to_log_null(log_id_t log_fd, struct iovec *vec, size_t nr)
     return -1;
 }
 
+/*
+ * Each record is written with its own writev().  The logger driver turns a
+ * single write into a single entry and stamps it with the writer's pid,
+ * tid and the current time, so records cannot be batched or handed to a
+ * flusher thread without losing exactly the fields readers rely on.
+ * Callers that log heavily should check __android_log_is_loggable-style
+ * levels before formatting instead.
+ */
 static int __write_to_log_kernel(log_id_t log_id, struct iovec *vec, size_t nr)
 {
     ssize_t ret;
@@ -132,6 +147,176 @@ static int __write_to_log_init(log_id_t log_id, struct iovec *vec, size_t nr)
     return write_to_log(log_id, vec, nr);
 }
 
+#if !FAKE_LOG_DEVICE
+/*
+ * Per-tag levels come from the "log.tag.<tag>" properties.  Each tag seen
+ * gets a slot remembering its prop_info and the serial it was parsed at, so
+ * a check costs a hash probe and a serial read until the property changes.
+ * Tags without a property are remembered too, until the property area's
+ * serial says something was added.
+ *
+ * Slots are read without the lock: seq is odd while a slot is being
+ * rewritten, and a reader that sees it change retries.  Writers hold the
+ * lock, and evict a slot when all of a tag's probes are taken.
+ */
+#define TAG_CACHE_SIZE  128
+#define TAG_CACHE_PROBE 4
+#define TAG_PROP_PREFIX "log.tag."
+
+struct tag_level {
+    volatile unsigned seq;
+    char name[PROP_NAME_MAX];       /* TAG_PROP_PREFIX + tag, "" if free */
+    const prop_info *pi;            /* NULL if there is no such property */
+    unsigned serial;                /* pi's serial, else the area's */
+    int level;
+};
+
+static struct tag_level tag_cache[TAG_CACHE_SIZE];
+static unsigned tag_cache_evict;
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t tag_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int parse_level(const char *value)
+{
+    switch (value[0]) {
+    case 'V': return ANDROID_LOG_VERBOSE;
+    case 'D': return ANDROID_LOG_DEBUG;
+    case 'I': return ANDROID_LOG_INFO;
+    case 'W': return ANDROID_LOG_WARN;
+    case 'E': return ANDROID_LOG_ERROR;
+    case 'F': /* fall through */
+    case 'A': return ANDROID_LOG_FATAL;
+    case 'S': return ANDROID_LOG_SILENT;
+    }
+    return ANDROID_LOG_DEFAULT;
+}
+
+/*
+ * Returns 1 and the level if t holds an up to date level for name, 0 if
+ * it holds name but is out of date or changing, and -1 otherwise.
+ */
+static int read_slot(const struct tag_level *t, const char *name, int *level)
+{
+    const prop_info *pi;
+    unsigned seq, serial;
+    int match, lvl;
+
+    seq = t->seq;
+    __sync_synchronize();
+    if (seq & 1)
+        return 0;
+    match = !strncmp(t->name, name, sizeof(t->name));
+    pi = t->pi;
+    serial = t->serial;
+    lvl = t->level;
+    __sync_synchronize();
+    if (t->seq != seq)
+        return 0;
+
+    if (!match)
+        return -1;
+    if (serial != (pi ? __system_property_serial(pi)
+                      : __system_property_area_serial()))
+        return 0;
+    *level = lvl;
+    return 1;
+}
+
+/* Looks name up and rewrites t with the result.  Called with the lock held. */
+static int fill_slot(struct tag_level *t, const char *name)
+{
+    char value[PROP_VALUE_MAX];
+    const prop_info *pi;
+    unsigned serial;
+    int level = ANDROID_LOG_DEFAULT;
+
+    /* read serials first, so that a change while we look is seen next time */
+    serial = __system_property_area_serial();
+    pi = __system_property_find(name);
+    if (pi) {
+        serial = __system_property_serial(pi);
+        __system_property_read(pi, NULL, value);
+        level = parse_level(value);
+    }
+
+    t->seq++;
+    __sync_synchronize();
+    strcpy(t->name, name);
+    t->pi = pi;
+    t->serial = serial;
+    t->level = level;
+    __sync_synchronize();
+    t->seq++;
+    return level;
+}
+
+static int tag_level(const char *tag)
+{
+    char name[PROP_NAME_MAX];
+    unsigned int hash = 2166136261u;
+    struct tag_level *t, *free_slot;
+    int i, rc, level;
+    const char *p;
+
+    if (strlen(tag) + sizeof(TAG_PROP_PREFIX) > sizeof(name))
+        return ANDROID_LOG_DEFAULT;     /* too long to have a property */
+    strcpy(name, TAG_PROP_PREFIX);
+    strcat(name, tag);
+
+    for (p = tag; *p; p++)
+        hash = (hash ^ (unsigned char) *p) * 16777619u;
+
+    for (i = 0; i < TAG_CACHE_PROBE; i++) {
+        rc = read_slot(&tag_cache[(hash + i) % TAG_CACHE_SIZE], name, &level);
+        if (rc > 0)
+            return level;
+        if (rc == 0)
+            break;
+    }
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&tag_cache_lock);
+#endif
+    /* the tag's own slot if it has one, else a free one, else a victim */
+    t = free_slot = NULL;
+    for (i = 0; i < TAG_CACHE_PROBE; i++) {
+        struct tag_level *s = &tag_cache[(hash + i) % TAG_CACHE_SIZE];
+
+        if (!strcmp(s->name, name)) {
+            t = s;
+            break;
+        }
+        if (!s->name[0] && !free_slot)
+            free_slot = s;
+    }
+    if (!t)
+        t = free_slot;
+    if (!t)
+        t = &tag_cache[(hash + tag_cache_evict++ % TAG_CACHE_PROBE) % TAG_CACHE_SIZE];
+    level = fill_slot(t, name);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&tag_cache_lock);
+#endif
+    return level;
+}
+#else
+/* On the host the levels come from ANDROID_LOG_TAGS instead. */
+static int tag_level(const char *tag)
+{
+    return fakeLogTagLevel(tag);
+}
+#endif
+
+int __android_log_is_loggable(int prio, const char *tag, int default_prio)
+{
+    int level = tag_level(tag ? tag : "");
+
+    if (level == ANDROID_LOG_DEFAULT)
+        level = default_prio;
+    return prio >= level;
+}
+
 int __android_log_write(int prio, const char *tag, const char *msg)
 {
     struct iovec vec[3];
@@ -273,6 +458,20 @@ int __android_log_bwrite(int32_t tag, const void *payload, size_t len)
     return write_to_log(LOG_ID_EVENTS, vec, 2);
 }
 
+int __android_log_bwritev(int32_t tag, const struct iovec *payload, size_t count)
+{
+    struct iovec vec[LOG_BWRITEV_MAX + 1];
+
+    if (count > LOG_BWRITEV_MAX)
+        return -EINVAL;
+
+    vec[0].iov_base = &tag;
+    vec[0].iov_len = sizeof(tag);
+    memcpy(vec + 1, payload, count * sizeof(*payload));
+
+    return write_to_log(LOG_ID_EVENTS, vec, count + 1);
+}
+
 /*
  * Like __android_log_bwrite, but takes the type as well.  Doesn't work
  * for the general case where we're generating lists of stuff, but very
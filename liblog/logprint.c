@@ -25,6 +25,10 @@
 #include <string.h>
 #include <assert.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #include <log/logd.h>
 #include <log/logprint.h>
@@ -39,6 +43,17 @@ struct AndroidLogFormat_t {
     android_LogPriority global_pri;
     FilterInfo *filters;
     AndroidLogPrintFormat format;
+
+    /* the "%m-%d %H:%M:%S" form of timeCacheSec, since consecutive
+     * entries mostly share their second.  A format may be shared by
+     * threads that print lines, so the cache is guarded. */
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t timeCacheLock;
+#endif
+    int timeCacheValid;
+    time_t timeCacheSec;
+    char timeCacheBuf[32];
+    size_t timeCacheLen;
 };
 
 static FilterInfo * filterinfo_new(const char * tag, android_LogPriority pri)
@@ -174,6 +189,9 @@ AndroidLogFormat *android_log_format_new()
 
     p_ret->global_pri = ANDROID_LOG_VERBOSE;
     p_ret->format = FORMAT_BRIEF;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&p_ret->timeCacheLock, NULL);
+#endif
 
     return p_ret;
 }
@@ -191,6 +209,9 @@ void android_log_format_free(AndroidLogFormat *p_format)
         free(p_info_old);
     }
 
+#ifdef HAVE_PTHREADS
+    pthread_mutex_destroy(&p_format->timeCacheLock);
+#endif
     free(p_format);
 }
 
@@ -689,201 +710,277 @@ int android_log_processBinaryLogBuffer(struct logger_entry *buf,
     return 0;
 }
 
-/**
- * Formats a log message into a buffer
+/*
+ * Prefix and suffix templates for each AndroidLogPrintFormat.  Besides
+ * literal characters they contain:
  *
- * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
- * If return value != defaultBuffer, caller must call free()
- * Returns NULL on malloc error
+ *   %t  "%m-%d %H:%M:%S.mmm" time      %c  priority character
+ *   %p  pid, as "%5d"                  %i  tid, as "%5d"
+ *   %g  tag, as "%-8s"                 %s  tag, as "%s"
  */
+typedef struct {
+    const char *prefix;
+    const char *suffix;
+    int prefixSuffixIsHeaderFooter;
+} LogLineTemplate;
+
+static const LogLineTemplate kLineTemplates[] = {
+    [FORMAT_OFF]        = { "%c/%g(%p): ",          "\n",       0 },
+    [FORMAT_BRIEF]      = { "%c/%g(%p): ",          "\n",       0 },
+    [FORMAT_PROCESS]    = { "%c(%p) ",              "  (%s)\n", 0 },
+    [FORMAT_TAG]        = { "%c/%g: ",              "\n",       0 },
+    [FORMAT_THREAD]     = { "%c(%p:%i) ",           "\n",       0 },
+    [FORMAT_RAW]        = { "",                     "\n",       0 },
+    [FORMAT_TIME]       = { "%t %c/%g(%p): ",       "\n",       0 },
+    [FORMAT_THREADTIME] = { "%t %p %i %c %g: ",     "\n",       0 },
+    [FORMAT_LONG]       = { "[ %t %p:%i %c/%g ]\n", "\n\n",     1 },
+};
 
-char *android_log_formatLogLine (
-    AndroidLogFormat *p_format,
-    char *defaultBuffer,
-    size_t defaultBufferSize,
-    const AndroidLogEntry *entry,
-    size_t *p_outLength)
+/* Appends at most end - p bytes, and returns the new end of the text. */
+static char *appendChars(char *p, char *end, const char *s, size_t len)
 {
-#if defined(HAVE_LOCALTIME_R)
-    struct tm tmBuf;
-#endif
-    struct tm* ptm;
-    char timeBuf[32];
-    char headerBuf[128];
-    char prefixBuf[128], suffixBuf[128];
-    char priChar;
-    int prefixSuffixIsHeaderFooter = 0;
-    char * ret = NULL;
+    if (len > (size_t)(end - p))
+        len = end - p;
+    memcpy(p, s, len);
+    return p + len;
+}
 
-    priChar = filterPriToChar(entry->priority);
+static char *appendPadded(char *p, char *end, const char *s, size_t width)
+{
+    size_t len = strlen(s);
 
-    /*
-     * Get the current date/time in pretty form
-     *
-     * It's often useful when examining a log with "less" to jump to
-     * a specific point in the file by searching for the date/time stamp.
-     * For this reason it's very annoying to have regexp meta characters
-     * in the time stamp.  Don't use forward slashes, parenthesis,
-     * brackets, asterisks, or other special chars here.
-     */
+    p = appendChars(p, end, s, len);
+    while (len++ < width && p < end)
+        *p++ = ' ';
+    return p;
+}
+
+static char *appendNumber(char *p, char *end, long value, size_t width, char pad)
+{
+    char digits[24];
+    size_t n = 0;
+    unsigned long v = value < 0 ? -(unsigned long) value : (unsigned long) value;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0)
+        digits[n++] = '-';
+    while (n < width && n < sizeof(digits))
+        digits[n++] = pad;
+    while (n > 0 && p < end)
+        *p++ = digits[--n];
+    return p;
+}
+
+/* Appends sec in "%m-%d %H:%M:%S" form. */
+static char *appendTime(AndroidLogFormat *p_format, char *p, char *end, time_t sec)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&p_format->timeCacheLock);
+#endif
+    if (!p_format->timeCacheValid || p_format->timeCacheSec != sec) {
 #if defined(HAVE_LOCALTIME_R)
-    ptm = localtime_r(&(entry->tv_sec), &tmBuf);
+        struct tm tmBuf;
+        struct tm* ptm = localtime_r(&sec, &tmBuf);
 #else
-    ptm = localtime(&(entry->tv_sec));
+        struct tm* ptm = localtime(&sec);
+#endif
+        /*
+         * It's often useful when examining a log with "less" to jump to
+         * a specific point in the file by searching for the date/time stamp.
+         * For this reason it's very annoying to have regexp meta characters
+         * in the time stamp.  Don't use forward slashes, parenthesis,
+         * brackets, asterisks, or other special chars here.
+         */
+        //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
+        p_format->timeCacheLen = strftime(p_format->timeCacheBuf,
+                sizeof(p_format->timeCacheBuf), "%m-%d %H:%M:%S", ptm);
+        p_format->timeCacheSec = sec;
+        p_format->timeCacheValid = 1;
+    }
+    p = appendChars(p, end, p_format->timeCacheBuf, p_format->timeCacheLen);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&p_format->timeCacheLock);
 #endif
-    //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
-    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
+    return p;
+}
 
-    /*
-     * Construct a buffer containing the log header and log message.
-     */
-    size_t prefixLen, suffixLen;
+/* Expands a template into buf, truncating at size, and returns its length. */
+static size_t expandTemplate(AndroidLogFormat *p_format, const char *tmpl,
+        char *buf, size_t size, const AndroidLogEntry *entry)
+{
+    char *p = buf;
+    char *end = buf + size;
 
-    switch (p_format->format) {
-        case FORMAT_TAG:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
-                "%c/%-8s: ", priChar, entry->tag);
-            strcpy(suffixBuf, "\n"); suffixLen = 1;
-            break;
-        case FORMAT_PROCESS:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
-                "%c(%5d) ", priChar, entry->pid);
-            suffixLen = snprintf(suffixBuf, sizeof(suffixBuf),
-                "  (%s)\n", entry->tag);
-            break;
-        case FORMAT_THREAD:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
-                "%c(%5d:%5d) ", priChar, entry->pid, entry->tid);
-            strcpy(suffixBuf, "\n");
-            suffixLen = 1;
-            break;
-        case FORMAT_RAW:
-            prefixBuf[0] = 0;
-            prefixLen = 0;
-            strcpy(suffixBuf, "\n");
-            suffixLen = 1;
-            break;
-        case FORMAT_TIME:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
-                "%s.%03ld %c/%-8s(%5d): ", timeBuf, entry->tv_nsec / 1000000,
-                priChar, entry->tag, entry->pid);
-            strcpy(suffixBuf, "\n");
-            suffixLen = 1;
-            break;
-        case FORMAT_THREADTIME:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
-                "%s.%03ld %5d %5d %c %-8s: ", timeBuf, entry->tv_nsec / 1000000,
-                entry->pid, entry->tid, priChar, entry->tag);
-            strcpy(suffixBuf, "\n");
-            suffixLen = 1;
-            break;
-        case FORMAT_LONG:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
-                "[ %s.%03ld %5d:%5d %c/%-8s ]\n",
-                timeBuf, entry->tv_nsec / 1000000, entry->pid,
-                entry->tid, priChar, entry->tag);
-            strcpy(suffixBuf, "\n\n");
-            suffixLen = 2;
-            prefixSuffixIsHeaderFooter = 1;
-            break;
-        case FORMAT_BRIEF:
-        default:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
-                "%c/%-8s(%5d): ", priChar, entry->tag, entry->pid);
-            strcpy(suffixBuf, "\n");
-            suffixLen = 1;
-            break;
+    for (; *tmpl && p < end; tmpl++) {
+        if (*tmpl != '%') {
+            *p++ = *tmpl;
+            continue;
+        }
+        switch (*++tmpl) {
+            case 't':
+                p = appendTime(p_format, p, end, entry->tv_sec);
+                p = appendChars(p, end, ".", 1);
+                p = appendNumber(p, end, entry->tv_nsec / 1000000, 3, '0');
+                break;
+            case 'c':
+                *p++ = filterPriToChar(entry->priority);
+                break;
+            case 'p':
+                p = appendNumber(p, end, entry->pid, 5, ' ');
+                break;
+            case 'i':
+                p = appendNumber(p, end, entry->tid, 5, ' ');
+                break;
+            case 'g':
+                p = appendPadded(p, end, entry->tag, 8);
+                break;
+            case 's':
+                p = appendPadded(p, end, entry->tag, 0);
+                break;
+            default:
+                tmpl--;
+                *p++ = '%';
+                break;
+        }
     }
-    /* snprintf has a weird return value.   It returns what would have been
-     * written given a large enough buffer.  In the case that the prefix is
-     * longer then our buffer(128), it messes up the calculations below
-     * possibly causing heap corruption.  To avoid this we double check and
-     * set the length at the maximum (size minus null byte)
-     */
-    if(prefixLen >= sizeof(prefixBuf))
-        prefixLen = sizeof(prefixBuf) - 1;
-    if(suffixLen >= sizeof(suffixBuf))
-        suffixLen = sizeof(suffixBuf) - 1;
-
-    /* the following code is tragically unreadable */
+    return p - buf;
+}
 
-    size_t numLines;
-    size_t i;
-    char *p;
-    size_t bufferSize;
+/**
+ * Formats a log message into buf, which is left alone unless the whole
+ * line and its terminating NUL fit in size bytes.
+ *
+ * Returns the length of the formatted line, not counting the NUL.
+ */
+size_t android_log_formatLogLineInto(
+    AndroidLogFormat *p_format,
+    char *buf,
+    size_t size,
+    const AndroidLogEntry *entry)
+{
+    const LogLineTemplate *tmpl;
+    char prefixBuf[128], suffixBuf[128];
+    size_t prefixLen, suffixLen;
+    size_t numLines, total;
     const char *pm;
+    const char *msgEnd = entry->message + entry->messageLen;
+    char *p;
 
-    if (prefixSuffixIsHeaderFooter) {
-        // we're just wrapping message with a header/footer
-        numLines = 1;
-    } else {
-        pm = entry->message;
-        numLines = 0;
+    if ((unsigned) p_format->format < sizeof(kLineTemplates) / sizeof(kLineTemplates[0]))
+        tmpl = &kLineTemplates[p_format->format];
+    else
+        tmpl = &kLineTemplates[FORMAT_BRIEF];
+
+    /* as before, a prefix or suffix is cut at 127 chars */
+    prefixLen = expandTemplate(p_format, tmpl->prefix, prefixBuf,
+            sizeof(prefixBuf) - 1, entry);
+    suffixLen = expandTemplate(p_format, tmpl->suffix, suffixBuf,
+            sizeof(suffixBuf) - 1, entry);
+
+    if (tmpl->prefixSuffixIsHeaderFooter) {
+        total = prefixLen + entry->messageLen + suffixLen;
+        if (total + 1 > size)
+            return total;
+        p = buf;
+        memcpy(p, prefixBuf, prefixLen);
+        p += prefixLen;
+        memcpy(p, entry->message, entry->messageLen);
+        p += entry->messageLen;
+        memcpy(p, suffixBuf, suffixLen);
+        p += suffixLen;
+        *p = '\0';
+        return total;
+    }
 
-        // The line-end finding here must match the line-end finding
-        // in for ( ... numLines...) loop below
-        while (pm < (entry->message + entry->messageLen)) {
-            if (*pm++ == '\n') numLines++;
-        }
-        // plus one line for anything not newline-terminated at the end
-        if (pm > entry->message && *(pm-1) != '\n') numLines++;
+    /* each line of the message gets its own prefix and suffix, and the
+     * newlines are replaced by the suffix */
+    numLines = 0;
+    total = 0;
+    for (pm = entry->message; pm < msgEnd; ) {
+        const char *lineStart = pm;
+        while (pm < msgEnd && *pm != '\n')
+            pm++;
+        total += pm - lineStart;
+        numLines++;
+        if (pm < msgEnd)
+            pm++;
     }
+    total += numLines * (prefixLen + suffixLen);
+    if (total + 1 > size)
+        return total;
+
+    p = buf;
+    for (pm = entry->message; pm < msgEnd; ) {
+        const char *lineStart = pm;
+        while (pm < msgEnd && *pm != '\n')
+            pm++;
+        memcpy(p, prefixBuf, prefixLen);
+        p += prefixLen;
+        memcpy(p, lineStart, pm - lineStart);
+        p += pm - lineStart;
+        memcpy(p, suffixBuf, suffixLen);
+        p += suffixLen;
+        if (pm < msgEnd)
+            pm++;
+    }
+    *p = '\0';
+    return total;
+}
 
-    // this is an upper bound--newlines in message may be counted
-    // extraneously
-    bufferSize = (numLines * (prefixLen + suffixLen)) + entry->messageLen + 1;
+/**
+ * Formats a log message into a buffer
+ *
+ * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
+ * If return value != defaultBuffer, caller must call free()
+ * Returns NULL on malloc error
+ */
 
-    if (defaultBufferSize >= bufferSize) {
-        ret = defaultBuffer;
-    } else {
-        ret = (char *)malloc(bufferSize);
+char *android_log_formatLogLine (
+    AndroidLogFormat *p_format,
+    char *defaultBuffer,
+    size_t defaultBufferSize,
+    const AndroidLogEntry *entry,
+    size_t *p_outLength)
+{
+    char *ret = defaultBuffer;
+    size_t len;
 
+    len = android_log_formatLogLineInto(p_format, defaultBuffer,
+            defaultBufferSize, entry);
+    if (len + 1 > defaultBufferSize) {
+        ret = (char *)malloc(len + 1);
         if (ret == NULL) {
             return ret;
         }
-    }
-
-    ret[0] = '\0';       /* to start strcat off */
-
-    p = ret;
-    pm = entry->message;
-
-    if (prefixSuffixIsHeaderFooter) {
-        strcat(p, prefixBuf);
-        p += prefixLen;
-        strncat(p, entry->message, entry->messageLen);
-        p += entry->messageLen;
-        strcat(p, suffixBuf);
-        p += suffixLen;
-    } else {
-        while(pm < (entry->message + entry->messageLen)) {
-            const char *lineStart;
-            size_t lineLen;
-            lineStart = pm;
-
-            // Find the next end-of-line in message
-            while (pm < (entry->message + entry->messageLen)
-                    && *pm != '\n') pm++;
-            lineLen = pm - lineStart;
-
-            strcat(p, prefixBuf);
-            p += prefixLen;
-            strncat(p, lineStart, lineLen);
-            p += lineLen;
-            strcat(p, suffixBuf);
-            p += suffixLen;
-
-            if (*pm == '\n') pm++;
-        }
+        android_log_formatLogLineInto(p_format, ret, len + 1, entry);
     }
 
     if (p_outLength != NULL) {
-        *p_outLength = p - ret;
+        *p_outLength = len;
     }
 
     return ret;
 }
 
+static int writeFully(int fd, const char *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = write(fd, buf + done, len - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
 /**
  * Either print or do not print log line, based on filter
  *
@@ -930,6 +1027,92 @@ done:
     return ret;
 }
 
+void android_log_initWriteBuffer(AndroidLogWriteBuffer *out, int fd)
+{
+    out->fd = fd;
+    out->write = NULL;
+    out->cookie = NULL;
+    out->len = 0;
+}
+
+void android_log_initWriteBufferFunc(AndroidLogWriteBuffer *out,
+        AndroidLogWriteFunc write, void *cookie)
+{
+    out->fd = -1;
+    out->write = write;
+    out->cookie = cookie;
+    out->len = 0;
+}
+
+static int writeOut(AndroidLogWriteBuffer *out, const char *data, size_t len)
+{
+    if (out->write != NULL)
+        return out->write(out->cookie, data, len);
+    return writeFully(out->fd, data, len);
+}
+
+int android_log_flushWriteBuffer(AndroidLogWriteBuffer *out)
+{
+    int ret = 0;
+
+    if (out->len > 0) {
+        ret = writeOut(out, out->data, out->len);
+        if (ret < 0)
+            fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+        out->len = 0;
+    }
+    return ret;
+}
+
+int android_log_writeToBuffer(AndroidLogWriteBuffer *out,
+        const void *data, size_t len)
+{
+    if (len > sizeof(out->data) - out->len) {
+        if (android_log_flushWriteBuffer(out) < 0)
+            return -1;
+        if (len > sizeof(out->data))
+            return writeOut(out, data, len) < 0 ? -1 : (int) len;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return len;
+}
+
+int android_log_bufferLogLine(
+    AndroidLogFormat *p_format,
+    AndroidLogWriteBuffer *out,
+    const AndroidLogEntry *entry)
+{
+    size_t len;
+    char *line;
+    int ret;
+
+    /* the common case: the line goes straight into the buffer */
+    len = android_log_formatLogLineInto(p_format, out->data + out->len,
+            sizeof(out->data) - out->len, entry);
+    if (len + 1 <= sizeof(out->data) - out->len) {
+        out->len += len;
+        return len;
+    }
+
+    if (android_log_flushWriteBuffer(out) < 0)
+        return -1;
+    if (len + 1 <= sizeof(out->data)) {
+        android_log_formatLogLineInto(p_format, out->data, sizeof(out->data), entry);
+        out->len = len;
+        return len;
+    }
+
+    /* longer than the whole buffer */
+    line = malloc(len + 1);
+    if (line == NULL)
+        return -1;
+    android_log_formatLogLineInto(p_format, line, len + 1, entry);
+    ret = writeOut(out, line, len) < 0 ? -1 : (int) len;
+    free(line);
+    return ret;
+}
+
 
 
 void logprint_run_tests()
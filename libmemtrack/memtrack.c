@@ -79,7 +79,7 @@ void memtrack_proc_destroy(struct memtrack_proc *p)
 static int memtrack_proc_get_type(struct memtrack_proc_type *t,
             pid_t pid, enum memtrack_type type)
 {
-    size_t num_records = t->num_records;
+    size_t num_records = t->allocated_records;
     int ret;
 
 retry:
@@ -198,3 +198,53 @@ ssize_t memtrack_proc_other_pss(struct memtrack_proc *p)
     return memtrack_proc_sum(p, types, ARRAY_SIZE(types),
                 MEMTRACK_FLAG_SMAPS_UNACCOUNTED);
 }
+
+/* Adds the total and unaccounted sizes of one type's records */
+static void memtrack_proc_type_sum(struct memtrack_proc_type *t,
+            ssize_t *total, ssize_t *pss)
+{
+    size_t j;
+
+    for (j = 0; j < t->num_records; j++) {
+        *total += t->records[j].size_in_bytes;
+        if (t->records[j].flags & MEMTRACK_FLAG_SMAPS_UNACCOUNTED) {
+            *pss += t->records[j].size_in_bytes;
+        }
+    }
+}
+
+int memtrack_proc_get_totals(struct memtrack_proc *p, const pid_t *pids,
+            size_t num_pids, struct memtrack_proc_totals *totals)
+{
+    size_t i;
+    int found = 0;
+
+    if (!module || !p) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < num_pids; i++) {
+        struct memtrack_proc_totals *out = &totals[i];
+
+        memset(out, 0, sizeof(*out));
+        out->pid = pids[i];
+        out->error = memtrack_proc_get(p, pids[i]);
+        if (out->error) {
+            continue;
+        }
+
+        memtrack_proc_type_sum(&p->types[MEMTRACK_TYPE_GRAPHICS],
+                &out->graphics_total, &out->graphics_pss);
+        memtrack_proc_type_sum(&p->types[MEMTRACK_TYPE_GL],
+                &out->gl_total, &out->gl_pss);
+        memtrack_proc_type_sum(&p->types[MEMTRACK_TYPE_MULTIMEDIA],
+                &out->other_total, &out->other_pss);
+        memtrack_proc_type_sum(&p->types[MEMTRACK_TYPE_CAMERA],
+                &out->other_total, &out->other_pss);
+        memtrack_proc_type_sum(&p->types[MEMTRACK_TYPE_OTHER],
+                &out->other_total, &out->other_pss);
+        found++;
+    }
+
+    return found;
+}
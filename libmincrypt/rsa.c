@@ -92,6 +92,74 @@ static void montMul(const RSAPublicKey* key,
     }
 }
 
+// montgomery c[] = a[] * a[] / R % mod
+// Squaring needs only half of the products a multiplication does: the
+// full square is computed first, cross products once and doubled, and then
+// reduced, for about three quarters of the work of montMul().
+static void montSqr(const RSAPublicKey* key,
+                    uint32_t* c,
+                    const uint32_t* a) {
+    uint32_t t[2 * RSANUMWORDS];
+    uint64_t A;
+    uint32_t carry;
+    int n = key->len;
+    int i, j;
+
+    // t[] = sum of a[i] * a[j] for i < j
+    for (i = 0; i < n; ++i) {
+        t[i] = 0;
+    }
+    for (i = 0; i < n; ++i) {
+        A = 0;
+        for (j = i + 1; j < n; ++j) {
+            A += (uint64_t)a[i] * a[j] + t[i + j];
+            t[i + j] = (uint32_t)A;
+            A >>= 32;
+        }
+        t[i + n] = (uint32_t)A;
+    }
+
+    // t[] = 2 * t[], which can't overflow as it stays below a[]^2
+    for (i = 2 * n - 1; i > 0; --i) {
+        t[i] = (t[i] << 1) | (t[i - 1] >> 31);
+    }
+    t[0] <<= 1;
+
+    // t[] += a[i]^2 for each i
+    A = 0;
+    for (i = 0; i < n; ++i) {
+        A += (uint64_t)a[i] * a[i] + t[2 * i];
+        t[2 * i] = (uint32_t)A;
+        A >>= 32;
+        A += t[2 * i + 1];
+        t[2 * i + 1] = (uint32_t)A;
+        A >>= 32;
+    }
+
+    // montgomery reduction: add multiples of mod that clear the low words
+    carry = 0;
+    for (i = 0; i < n; ++i) {
+        uint32_t d0 = t[i] * key->n0inv;
+        A = 0;
+        for (j = 0; j < n; ++j) {
+            A += (uint64_t)d0 * key->n[j] + t[i + j];
+            t[i + j] = (uint32_t)A;
+            A >>= 32;
+        }
+        A += (uint64_t)t[i + n] + carry;
+        t[i + n] = (uint32_t)A;
+        carry = (uint32_t)(A >>= 32);
+    }
+
+    for (i = 0; i < n; ++i) {
+        c[i] = t[i + n];
+    }
+
+    if (carry) {
+        subM(key, c);
+    }
+}
+
 // In-place public exponentiation.
 // Input and output big-endian byte array in inout.
 static void modpow(const RSAPublicKey* key,
@@ -116,14 +184,14 @@ static void modpow(const RSAPublicKey* key,
         aaa = aaR;  // Re-use location.
         montMul(key, aR, a, key->rr);  // aR = a * RR / R mod M
         for (i = 0; i < 16; i += 2) {
-            montMul(key, aaR, aR, aR);  // aaR = aR * aR / R mod M
-            montMul(key, aR, aaR, aaR);  // aR = aaR * aaR / R mod M
+            montSqr(key, aaR, aR);  // aaR = aR * aR / R mod M
+            montSqr(key, aR, aaR);  // aR = aaR * aaR / R mod M
         }
         montMul(key, aaa, aR, a);  // aaa = aR * a / R mod M
     } else if (key->exponent == 3) {
         aaa = aR;  // Re-use location.
         montMul(key, aR, a, key->rr);  /* aR = a * RR / R mod M   */
-        montMul(key, aaR, aR, aR);     /* aaR = aR * aR / R mod M */
+        montSqr(key, aaR, aR);         /* aaR = aR * aR / R mod M */
         montMul(key, aaa, aaR, a);     /* aaa = aaR * a / R mod M */
     }
 
@@ -306,3 +374,44 @@ int RSA_verify(const RSAPublicKey *key,
 
     return 1;  // All checked out OK.
 }
+
+// Encrypt len bytes of msg to key with RSA PKCS1.5 (block type 2), for
+// the holder of the private key to decrypt.  pad must hold
+// RSANUMBYTES - 3 - len random bytes; zeros in it are replaced, since the
+// padding may not contain any.  Both e=3 and e=65537 are supported.
+//
+// Returns 1 and fills out[RSANUMBYTES] on success, 0 on failure.
+int RSA_encrypt(const RSAPublicKey *key,
+                const uint8_t *msg,
+                const int len,
+                const uint8_t *pad,
+                uint8_t *out) {
+    int padlen = RSANUMBYTES - 3 - len;
+    int i;
+
+    if (key->len != RSANUMWORDS) {
+        return 0;  // Wrong key passed in.
+    }
+
+    if (len < 0 || padlen < 8) {
+        return 0;  // PKCS1.5 wants at least 8 bytes of padding.
+    }
+
+    if (key->exponent != 3 && key->exponent != 65537) {
+        return 0;  // Unsupported exponent.
+    }
+
+    out[0] = 0x00;
+    out[1] = 0x02;
+    for (i = 0; i < padlen; ++i) {
+        out[2 + i] = pad[i] ? pad[i] : 0x01;
+    }
+    out[2 + padlen] = 0x00;
+    for (i = 0; i < len; ++i) {
+        out[3 + padlen + i] = msg[i];
+    }
+
+    modpow(key, out);  // In-place exponentiation.
+
+    return 1;
+}
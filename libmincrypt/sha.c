@@ -25,9 +25,10 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-// Optimized for minimal code size.
+// Optimized for minimal code size; sha_accel.c has the fast versions.
 
 #include "mincrypt/sha.h"
+#include "sha_blocks.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -35,54 +36,55 @@
 
 #define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static void SHA1_Transform(SHA_CTX* ctx) {
+void SHA1_Blocks(uint32_t* state, const uint8_t* p, int blocks) {
     uint32_t W[80];
     uint32_t A, B, C, D, E;
-    uint8_t* p = ctx->buf;
     int t;
 
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
-    }
+    while (blocks--) {
+        for(t = 0; t < 16; ++t) {
+            uint32_t tmp =  *p++ << 24;
+            tmp |= *p++ << 16;
+            tmp |= *p++ << 8;
+            tmp |= *p++;
+            W[t] = tmp;
+        }
 
-    for(; t < 80; t++) {
-        W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
-    }
+        for(; t < 80; t++) {
+            W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
+        }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-
-    for(t = 0; t < 80; t++) {
-        uint32_t tmp = rol(5,A) + E + W[t];
-
-        if (t < 20)
-            tmp += (D^(B&(C^D))) + 0x5A827999;
-        else if ( t < 40)
-            tmp += (B^C^D) + 0x6ED9EBA1;
-        else if ( t < 60)
-            tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
-        else
-            tmp += (B^C^D) + 0xCA62C1D6;
-
-        E = D;
-        D = C;
-        C = rol(30,B);
-        B = A;
-        A = tmp;
-    }
+        A = state[0];
+        B = state[1];
+        C = state[2];
+        D = state[3];
+        E = state[4];
+
+        for(t = 0; t < 80; t++) {
+            uint32_t tmp = rol(5,A) + E + W[t];
+
+            if (t < 20)
+                tmp += (D^(B&(C^D))) + 0x5A827999;
+            else if ( t < 40)
+                tmp += (B^C^D) + 0x6ED9EBA1;
+            else if ( t < 60)
+                tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
+            else
+                tmp += (B^C^D) + 0xCA62C1D6;
+
+            E = D;
+            D = C;
+            C = rol(30,B);
+            B = A;
+            A = tmp;
+        }
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+    }
 }
 
 static const HASH_VTAB SHA_VTAB = {
@@ -104,19 +106,45 @@ void SHA_init(SHA_CTX* ctx) {
 }
 
 
+// The fastest block function this cpu has, picked on first use.  Racing
+// threads all store the same value.
+static SHA_BlocksFn sha1_blocks;
+
+static SHA_BlocksFn SHA1_GetBlocks(void) {
+    if (!sha1_blocks) {
+        SHA_BlocksFn f = SHA1_AccelBlocks();
+        sha1_blocks = f ? f : SHA1_Blocks;
+    }
+    return sha1_blocks;
+}
+
 void SHA_update(SHA_CTX* ctx, const void* data, int len) {
     int i = (int) (ctx->count & 63);
     const uint8_t* p = (const uint8_t*)data;
+    SHA_BlocksFn blocks = SHA1_GetBlocks();
 
+    if (len <= 0) return;
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA1_Transform(ctx);
-            i = 0;
-        }
+    // top up a partial block first
+    if (i) {
+        int n = 64 - i;
+        if (n > len) n = len;
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < 64) return;
+        blocks(ctx->state, ctx->buf, 1);
     }
+
+    // hash whole blocks straight from the input
+    if (len >= 64) {
+        blocks(ctx->state, p, len / 64);
+        p += len & ~63;
+        len &= 63;
+    }
+
+    memcpy(ctx->buf, p, len);
 }
 
 
@@ -25,9 +25,10 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-// Optimized for minimal code size.
+// Optimized for minimal code size; sha_accel.c has the fast versions.
 
 #include "mincrypt/sha256.h"
+#include "sha_blocks.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -54,61 +55,62 @@ static const uint32_t K[64] = {
     0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
-static void SHA256_Transform(SHA256_CTX* ctx) {
+void SHA256_Blocks(uint32_t* state, const uint8_t* p, int blocks) {
     uint32_t W[64];
     uint32_t A, B, C, D, E, F, G, H;
-    uint8_t* p = ctx->buf;
     int t;
 
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
-    }
+    while (blocks--) {
+        for(t = 0; t < 16; ++t) {
+            uint32_t tmp =  *p++ << 24;
+            tmp |= *p++ << 16;
+            tmp |= *p++ << 8;
+            tmp |= *p++;
+            W[t] = tmp;
+        }
 
-    for(; t < 64; t++) {
-        uint32_t s0 = ror(W[t-15], 7) ^ ror(W[t-15], 18) ^ shr(W[t-15], 3);
-        uint32_t s1 = ror(W[t-2], 17) ^ ror(W[t-2], 19) ^ shr(W[t-2], 10);
-        W[t] = W[t-16] + s0 + W[t-7] + s1;
-    }
+        for(; t < 64; t++) {
+            uint32_t s0 = ror(W[t-15], 7) ^ ror(W[t-15], 18) ^ shr(W[t-15], 3);
+            uint32_t s1 = ror(W[t-2], 17) ^ ror(W[t-2], 19) ^ shr(W[t-2], 10);
+            W[t] = W[t-16] + s0 + W[t-7] + s1;
+        }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-    F = ctx->state[5];
-    G = ctx->state[6];
-    H = ctx->state[7];
-
-    for(t = 0; t < 64; t++) {
-        uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
-        uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
-        uint32_t t2 = s0 + maj;
-        uint32_t s1 = ror(E, 6) ^ ror(E, 11) ^ ror(E, 25);
-        uint32_t ch = (E & F) ^ ((~E) & G);
-        uint32_t t1 = H + s1 + ch + K[t] + W[t];
-
-        H = G;
-        G = F;
-        F = E;
-        E = D + t1;
-        D = C;
-        C = B;
-        B = A;
-        A = t1 + t2;
-    }
+        A = state[0];
+        B = state[1];
+        C = state[2];
+        D = state[3];
+        E = state[4];
+        F = state[5];
+        G = state[6];
+        H = state[7];
+
+        for(t = 0; t < 64; t++) {
+            uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
+            uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
+            uint32_t t2 = s0 + maj;
+            uint32_t s1 = ror(E, 6) ^ ror(E, 11) ^ ror(E, 25);
+            uint32_t ch = (E & F) ^ ((~E) & G);
+            uint32_t t1 = H + s1 + ch + K[t] + W[t];
+
+            H = G;
+            G = F;
+            F = E;
+            E = D + t1;
+            D = C;
+            C = B;
+            B = A;
+            A = t1 + t2;
+        }
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
-    ctx->state[5] += F;
-    ctx->state[6] += G;
-    ctx->state[7] += H;
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+        state[5] += F;
+        state[6] += G;
+        state[7] += H;
+    }
 }
 
 static const HASH_VTAB SHA256_VTAB = {
@@ -133,19 +135,45 @@ void SHA256_init(SHA256_CTX* ctx) {
 }
 
 
+// The fastest block function this cpu has, picked on first use.  Racing
+// threads all store the same value.
+static SHA_BlocksFn sha256_blocks;
+
+static SHA_BlocksFn SHA256_GetBlocks(void) {
+    if (!sha256_blocks) {
+        SHA_BlocksFn f = SHA256_AccelBlocks();
+        sha256_blocks = f ? f : SHA256_Blocks;
+    }
+    return sha256_blocks;
+}
+
 void SHA256_update(SHA256_CTX* ctx, const void* data, int len) {
     int i = (int) (ctx->count & 63);
     const uint8_t* p = (const uint8_t*)data;
+    SHA_BlocksFn blocks = SHA256_GetBlocks();
 
+    if (len <= 0) return;
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA256_Transform(ctx);
-            i = 0;
-        }
+    // top up a partial block first
+    if (i) {
+        int n = 64 - i;
+        if (n > len) n = len;
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < 64) return;
+        blocks(ctx->state, ctx->buf, 1);
     }
+
+    // hash whole blocks straight from the input
+    if (len >= 64) {
+        blocks(ctx->state, p, len / 64);
+        p += len & ~63;
+        len &= 63;
+    }
+
+    memcpy(ctx->buf, p, len);
 }
 
 
@@ -0,0 +1,300 @@
+/* sha_accel.c
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// SHA-1 and SHA-256 block functions built on the instructions x86 (SHA-NI)
+// and ARMv8 (crypto extension) cpus have for them.  Which one is used is
+// decided at run time, so the library still runs anywhere; these are only
+// compiled in when the compiler can generate the instructions.
+
+#include "sha_blocks.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SHA_ACCEL_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+// Needs -march=armv8-a+crypto; nothing else uses the instructions.
+#define SHA_ACCEL_ARM64 1
+#endif
+
+#if defined(SHA_ACCEL_X86)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_NI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+
+static int has_sha_ni(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (!(ebx & (1 << 29))) return 0;          // SHA
+    __cpuid(1, eax, ebx, ecx, edx);
+    return (ecx & (1 << 9)) && (ecx & (1 << 19));  // SSSE3, SSE4.1
+}
+
+SHA_NI_TARGET
+static void SHA1_BlocksNI(uint32_t* state, const uint8_t* data, int blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E, PREV;
+    __m128i M[20];
+    int g;
+
+    ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1B);
+    E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (blocks--) {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        // Four rounds per group of four message words, the first group
+        // adds E, the later ones E from the state four rounds back.
+        PREV = ABCD;
+        for (g = 0; g < 20; g++) {
+            if (g < 4) {
+                M[g] = _mm_shuffle_epi8(
+                        _mm_loadu_si128((const __m128i*) (data + 16 * g)), MASK);
+            } else {
+                M[g] = _mm_sha1msg2_epu32(
+                        _mm_xor_si128(_mm_sha1msg1_epu32(M[g - 4], M[g - 3]), M[g - 2]),
+                        M[g - 1]);
+            }
+            E = g ? _mm_sha1nexte_epu32(PREV, M[g]) : _mm_add_epi32(E0, M[g]);
+            PREV = ABCD;
+            if (g < 5)
+                ABCD = _mm_sha1rnds4_epu32(ABCD, E, 0);
+            else if (g < 10)
+                ABCD = _mm_sha1rnds4_epu32(ABCD, E, 1);
+            else if (g < 15)
+                ABCD = _mm_sha1rnds4_epu32(ABCD, E, 2);
+            else
+                ABCD = _mm_sha1rnds4_epu32(ABCD, E, 3);
+        }
+
+        E0 = _mm_sha1nexte_epu32(PREV, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+        data += 64;
+    }
+
+    _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(ABCD, 0x1B));
+    state[4] = _mm_extract_epi32(E0, 3);
+}
+
+static const uint32_t K256[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+SHA_NI_TARGET
+static void SHA256_BlocksNI(uint32_t* state, const uint8_t* data, int blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, ABEF_SAVE, CDGH_SAVE, MSG, TMP;
+    __m128i W[16];
+    int g;
+
+    // the instructions want the state as ABEF and CDGH
+    TMP = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[0]), 0xB1);
+    STATE1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[4]), 0x1B);
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+    while (blocks--) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        for (g = 0; g < 16; g++) {
+            if (g < 4) {
+                W[g] = _mm_shuffle_epi8(
+                        _mm_loadu_si128((const __m128i*) (data + 16 * g)), MASK);
+            } else {
+                TMP = _mm_add_epi32(_mm_sha256msg1_epu32(W[g - 4], W[g - 3]),
+                                    _mm_alignr_epi8(W[g - 1], W[g - 2], 4));
+                W[g] = _mm_sha256msg2_epu32(TMP, W[g - 1]);
+            }
+            MSG = _mm_add_epi32(W[g], _mm_load_si128((const __m128i*) &K256[4 * g]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, _mm_shuffle_epi32(MSG, 0x0E));
+        }
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        data += 64;
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+    _mm_storeu_si128((__m128i*) &state[0], _mm_blend_epi16(TMP, STATE1, 0xF0));
+    _mm_storeu_si128((__m128i*) &state[4], _mm_alignr_epi8(STATE1, TMP, 8));
+}
+
+SHA_BlocksFn SHA1_AccelBlocks(void) {
+    return has_sha_ni() ? SHA1_BlocksNI : NULL;
+}
+
+SHA_BlocksFn SHA256_AccelBlocks(void) {
+    return has_sha_ni() ? SHA256_BlocksNI : NULL;
+}
+
+#elif defined(SHA_ACCEL_ARM64)
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+
+static void SHA1_BlocksCE(uint32_t* state, const uint8_t* data, int blocks) {
+    static const uint32_t K[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t ABCD, ABCD_SAVE, TMP;
+    uint32x4_t M[20];
+    uint32_t E0, E0_SAVE, E1;
+    int g;
+
+    ABCD = vld1q_u32(state);
+    E0 = state[4];
+
+    while (blocks--) {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        for (g = 0; g < 20; g++) {
+            if (g < 4) {
+                M[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * g)));
+            } else {
+                M[g] = vsha1su1q_u32(vsha1su0q_u32(M[g - 4], M[g - 3], M[g - 2]), M[g - 1]);
+            }
+            TMP = vaddq_u32(M[g], vdupq_n_u32(K[g / 5]));
+            E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+            if (g < 5)
+                ABCD = vsha1cq_u32(ABCD, E0, TMP);
+            else if (g < 10 || g >= 15)
+                ABCD = vsha1pq_u32(ABCD, E0, TMP);
+            else
+                ABCD = vsha1mq_u32(ABCD, E0, TMP);
+            E0 = E1;
+        }
+
+        ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+        E0 += E0_SAVE;
+        data += 64;
+    }
+
+    vst1q_u32(state, ABCD);
+    state[4] = E0;
+}
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+static void SHA256_BlocksCE(uint32_t* state, const uint8_t* data, int blocks) {
+    uint32x4_t STATE0, STATE1, ABEF_SAVE, CDGH_SAVE, MSG, TMP;
+    uint32x4_t W[16];
+    int g;
+
+    STATE0 = vld1q_u32(&state[0]);
+    STATE1 = vld1q_u32(&state[4]);
+
+    while (blocks--) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        for (g = 0; g < 16; g++) {
+            if (g < 4) {
+                W[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * g)));
+            } else {
+                W[g] = vsha256su1q_u32(vsha256su0q_u32(W[g - 4], W[g - 3]),
+                                       W[g - 2], W[g - 1]);
+            }
+            MSG = vaddq_u32(W[g], vld1q_u32(&K256[4 * g]));
+            TMP = STATE0;
+            STATE0 = vsha256hq_u32(STATE0, STATE1, MSG);
+            STATE1 = vsha256h2q_u32(STATE1, TMP, MSG);
+        }
+
+        STATE0 = vaddq_u32(STATE0, ABEF_SAVE);
+        STATE1 = vaddq_u32(STATE1, CDGH_SAVE);
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], STATE0);
+    vst1q_u32(&state[4], STATE1);
+}
+
+SHA_BlocksFn SHA1_AccelBlocks(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) ? SHA1_BlocksCE : NULL;
+}
+
+SHA_BlocksFn SHA256_AccelBlocks(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) ? SHA256_BlocksCE : NULL;
+}
+
+#else
+
+SHA_BlocksFn SHA1_AccelBlocks(void) {
+    return NULL;
+}
+
+SHA_BlocksFn SHA256_AccelBlocks(void) {
+    return NULL;
+}
+
+#endif
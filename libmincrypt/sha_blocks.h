@@ -0,0 +1,46 @@
+/* sha_blocks.h
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SYSTEM_CORE_LIBMINCRYPT_SHA_BLOCKS_H_
+#define SYSTEM_CORE_LIBMINCRYPT_SHA_BLOCKS_H_
+
+#include <stdint.h>
+
+// Runs the compression function over a number of consecutive 64 byte
+// blocks, updating the 5 (SHA-1) or 8 (SHA-256) word state in place.
+typedef void (*SHA_BlocksFn)(uint32_t* state, const uint8_t* data, int blocks);
+
+// The portable versions, in sha.c and sha256.c.
+void SHA1_Blocks(uint32_t* state, const uint8_t* data, int blocks);
+void SHA256_Blocks(uint32_t* state, const uint8_t* data, int blocks);
+
+// Versions using the SHA instructions of the cpu we run on, or NULL when
+// it has none: SHA-NI on x86, the crypto extension on ARMv8.
+SHA_BlocksFn SHA1_AccelBlocks(void);
+SHA_BlocksFn SHA256_AccelBlocks(void);
+
+#endif  // SYSTEM_CORE_LIBMINCRYPT_SHA_BLOCKS_H_
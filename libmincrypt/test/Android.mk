@@ -8,3 +8,13 @@ LOCAL_SRC_FILES := rsa_test.c
 LOCAL_STATIC_LIBRARIES := libmincrypt
 include $(BUILD_HOST_EXECUTABLE)
 
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := sha_test
+LOCAL_SRC_FILES := sha_test.c
+LOCAL_STATIC_LIBRARIES := libmincrypt
+ifeq ($(HOST_OS),linux)
+LOCAL_LDLIBS := -lrt
+endif
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,185 @@
+/* sha_test.c
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Checks SHA-1 and SHA-256 against the FIPS 180-2 examples and the cpu
+// accelerated block functions, when there are any, against the portable
+// ones, then reports how fast each of them hashes.
+//
+//   sha_test [megabytes to hash in the benchmark, default 64]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
+#include "../sha_blocks.h"
+
+static const char* hex(const uint8_t* digest, int len) {
+    static char buf[2 * SHA256_DIGEST_SIZE + 1];
+    int i;
+    for (i = 0; i < len; i++) {
+        sprintf(buf + 2 * i, "%02x", digest[i]);
+    }
+    return buf;
+}
+
+static const char* const msgs[] = {
+    "abc",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    NULL,   // a million 'a's
+};
+
+static const char* const sha1_digests[] = {
+    "a9993e364706816aba3e25717850c26c9cd0d89d",
+    "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+    "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+};
+
+static const char* const sha256_digests[] = {
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+};
+
+static int test_known_answers(void) {
+    static char million[1000000];
+    int success = 1;
+    int i;
+
+    memset(million, 'a', sizeof(million));
+    for (i = 0; i < 3; i++) {
+        const char* msg = msgs[i] ? msgs[i] : million;
+        int len = msgs[i] ? (int) strlen(msgs[i]) : (int) sizeof(million);
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        const char* got;
+
+        got = hex(SHA_hash(msg, len, digest), SHA_DIGEST_SIZE);
+        if (strcmp(got, sha1_digests[i])) {
+            printf("sha1 message %d: got %s\n", i + 1, got);
+            success = 0;
+        }
+        got = hex(SHA256_hash(msg, len, digest), SHA256_DIGEST_SIZE);
+        if (strcmp(got, sha256_digests[i])) {
+            printf("sha256 message %d: got %s\n", i + 1, got);
+            success = 0;
+        }
+    }
+
+    // the same, fed to the update functions in odd sized pieces
+    for (i = 1; i < 200; i += 7) {
+        SHA_CTX ctx;
+        SHA256_CTX ctx256;
+        int off, n;
+
+        SHA_init(&ctx);
+        SHA256_init(&ctx256);
+        for (off = 0; off < (int) sizeof(million); off += n) {
+            n = (int) sizeof(million) - off < i ? (int) sizeof(million) - off : i;
+            SHA_update(&ctx, million + off, n);
+            SHA256_update(&ctx256, million + off, n);
+        }
+        if (strcmp(hex(SHA_final(&ctx), SHA_DIGEST_SIZE), sha1_digests[2]) ||
+            strcmp(hex(SHA256_final(&ctx256), SHA256_DIGEST_SIZE), sha256_digests[2])) {
+            printf("million a's in pieces of %d: wrong digest\n", i);
+            success = 0;
+        }
+    }
+
+    return success;
+}
+
+static int compare_blocks(const char* name, SHA_BlocksFn portable,
+                          SHA_BlocksFn accel, int words) {
+    uint8_t data[64 * 16];
+    uint32_t s1[8], s2[8];
+    int i, n;
+
+    for (i = 0; i < (int) sizeof(data); i++) {
+        data[i] = (uint8_t) rand();
+    }
+    for (n = 1; n <= 16; n++) {
+        for (i = 0; i < 8; i++) {
+            s1[i] = s2[i] = (uint32_t) rand();
+        }
+        portable(s1, data, n);
+        accel(s2, data, n);
+        if (memcmp(s1, s2, words * sizeof(uint32_t))) {
+            printf("%s: cpu accelerated version differs for %d blocks\n", name, n);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char* name, SHA_BlocksFn fn, const uint8_t* data,
+                  int len, int megabytes) {
+    uint32_t state[8] = { 0 };
+    double start = now();
+    double elapsed;
+    int i;
+
+    for (i = 0; i < megabytes * (1024 * 1024 / len); i++) {
+        fn(state, data, len / 64);
+    }
+    elapsed = now() - start;
+    printf("%-16s %8.1f MB/s\n", name, elapsed > 0 ? megabytes / elapsed : 0);
+}
+
+int main(int argc, char** argv) {
+    int megabytes = argc > 1 ? atoi(argv[1]) : 64;
+    SHA_BlocksFn sha1_accel = SHA1_AccelBlocks();
+    SHA_BlocksFn sha256_accel = SHA256_AccelBlocks();
+    int success = test_known_answers();
+    static uint8_t data[64 * 1024];
+
+    if (sha1_accel)
+        success = compare_blocks("sha1", SHA1_Blocks, sha1_accel, 5) && success;
+    if (sha256_accel)
+        success = compare_blocks("sha256", SHA256_Blocks, sha256_accel, 8) && success;
+
+    if (megabytes > 0) {
+        memset(data, 0x5a, sizeof(data));
+        bench("sha1", SHA1_Blocks, data, sizeof(data), megabytes);
+        if (sha1_accel)
+            bench("sha1 (cpu)", sha1_accel, data, sizeof(data), megabytes);
+        bench("sha256", SHA256_Blocks, data, sizeof(data), megabytes);
+        if (sha256_accel)
+            bench("sha256 (cpu)", sha256_accel, data, sizeof(data), megabytes);
+    }
+
+    printf("\n%s\n\n", success ? "PASS" : "FAIL");
+
+    return !success;
+}
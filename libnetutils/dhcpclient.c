@@ -29,6 +29,7 @@
 #include <sys/select.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <net/if.h>
 
 #include <cutils/properties.h>
 #define LOG_TAG "DHCP"
@@ -380,17 +381,71 @@ static int is_valid_reply(dhcp_msg *msg, dhcp_msg *reply, int sz)
 
 #define STATE_SELECTING  1
 #define STATE_REQUESTING 2
+#define STATE_REBOOTING  3
 
-#define TIMEOUT_INITIAL   4000
+/*
+ * RFC 2131 only asks for randomized exponential backoff; starting at one
+ * second instead of four gets a lease from a server which missed the
+ * first discover (or a link that wasn't quite up) three seconds sooner,
+ * and the six tries up to TIMEOUT_MAX still take about a minute.
+ */
+#define TIMEOUT_INITIAL   1000
 #define TIMEOUT_MAX      32000
 
+/* Tries of INIT-REBOOT before falling back to DISCOVER */
+#define REBOOT_TRIES         2
+
+/*
+ * The lease last acknowledged on an interface, so that asking again for
+ * the same interface can go straight to INIT-REBOOT (RFC 2131 3.2): a
+ * single request and ack, rather than discover, offer, request and ack.
+ */
+static struct {
+    char ifname[IFNAMSIZ];
+    unsigned char hwaddr[6];
+    dhcp_info info;
+    msecs_t expires;
+} cached_lease;
+
+static int get_cached_lease(const char *ifname, const unsigned char *hwaddr,
+                            dhcp_info *info)
+{
+    if (cached_lease.expires <= get_msecs() ||
+            strcmp(cached_lease.ifname, ifname) ||
+            memcmp(cached_lease.hwaddr, hwaddr, sizeof(cached_lease.hwaddr))) {
+        return 0;
+    }
+    *info = cached_lease.info;
+    return 1;
+}
+
+static void set_cached_lease(const char *ifname, const unsigned char *hwaddr,
+                             const dhcp_info *info)
+{
+    if (info->lease == 0 || strlen(ifname) >= sizeof(cached_lease.ifname)) {
+        return;
+    }
+    strcpy(cached_lease.ifname, ifname);
+    memcpy(cached_lease.hwaddr, hwaddr, sizeof(cached_lease.hwaddr));
+    cached_lease.info = *info;
+    cached_lease.expires = get_msecs() + (msecs_t) info->lease * 1000;
+}
+
+/* timeout +/- 25%, so that clients which came up together drift apart */
+static unsigned int jitter(unsigned int timeout, unsigned int *seed)
+{
+    return timeout - timeout / 4 + rand_r(seed) % (timeout / 2 + 1);
+}
+
 int dhcp_init_ifc(const char *ifname)
 {
     dhcp_msg discover_msg;
     dhcp_msg request_msg;
+    dhcp_msg reboot_msg;
     dhcp_msg reply;
     dhcp_msg *msg;
     dhcp_info info;
+    dhcp_info reply_info;
     int s, r, size;
     int valid_reply;
     uint32_t xid;
@@ -398,6 +453,10 @@ int dhcp_init_ifc(const char *ifname)
     struct pollfd pfd;
     unsigned int state;
     unsigned int timeout;
+    unsigned int wait;
+    unsigned int seed;
+    int reboot_tries;
+    int rebooted;
     int if_index;
 
     xid = (uint32_t) get_msecs();
@@ -410,26 +469,53 @@ int dhcp_init_ifc(const char *ifname)
     }
 
     s = open_raw_socket(ifname, hwaddr, if_index);
+    if (s < 0) {
+        return -1;
+    }
+
+    memcpy(&seed, hwaddr + 2, sizeof(seed));
+    seed ^= xid;
 
     timeout = TIMEOUT_INITIAL;
-    state = STATE_SELECTING;
     info.type = 0;
+    reboot_tries = 0;
+    rebooted = get_cached_lease(ifname, hwaddr, &info);
+    if (rebooted) {
+        printerr("asking to keep %s on %s\n", ipaddr(info.ipaddr), ifname);
+        state = STATE_REBOOTING;
+        info.type = 0;
+    } else {
+        state = STATE_SELECTING;
+    }
     goto transmit;
 
     for (;;) {
         pfd.fd = s;
         pfd.events = POLLIN;
         pfd.revents = 0;
-        r = poll(&pfd, 1, timeout);
+        r = poll(&pfd, 1, wait);
 
         if (r == 0) {
 #if VERBOSE
             printerr("TIMEOUT\n");
 #endif
-            if (timeout >= TIMEOUT_MAX) {
+            if (state == STATE_REBOOTING) {
+                if (++reboot_tries >= REBOOT_TRIES) {
+                    /*
+                     * An ack for reboot_msg is still taken if it turns up
+                     * while we are discovering.
+                     */
+                    printerr("no answer to INIT-REBOOT, discovering\n");
+                    state = STATE_SELECTING;
+                    timeout = TIMEOUT_INITIAL;
+                    xid++;
+                    goto transmit;
+                }
+            } else if (timeout >= TIMEOUT_MAX) {
                 printerr("timed out\n");
                 if ( info.type == DHCPOFFER ) {
                     printerr("no acknowledgement from DHCP server\nconfiguring %s with offered parameters\n", ifname);
+                    close(s);
                     return dhcp_configure(ifname, &info);
                 }
                 errno = ETIME;
@@ -450,6 +536,11 @@ int dhcp_init_ifc(const char *ifname)
                 msg = &request_msg;
                 size = init_dhcp_request_msg(msg, hwaddr, xid, info.ipaddr, info.serveraddr);
                 break;
+            case STATE_REBOOTING:
+                msg = &reboot_msg;
+                size = init_dhcp_request_msg(msg, hwaddr, xid,
+                                             cached_lease.info.ipaddr, 0);
+                break;
             default:
                 r = 0;
             }
@@ -459,6 +550,7 @@ int dhcp_init_ifc(const char *ifname)
                     printerr("error sending dhcp msg: %s\n", strerror(errno));
                 }
             }
+            wait = jitter(timeout, &seed);
             continue;
         }
 
@@ -466,61 +558,100 @@ int dhcp_init_ifc(const char *ifname)
             if ((errno == EAGAIN) || (errno == EINTR)) {
                 continue;
             }
+            close(s);
             return fatal("poll failed");
         }
 
-        errno = 0;
-        r = receive_packet(s, &reply);
-        if (r < 0) {
-            if (errno != 0) {
-                ALOGD("receive_packet failed (%d): %s", r, strerror(errno));
-                if (errno == ENETDOWN || errno == ENXIO) {
-                    return -1;
+        /*
+         * The socket is non-blocking: handle everything that is queued
+         * before polling again, so that an offer behind some other
+         * server's packet doesn't wait for another round trip.
+         */
+        for (;;) {
+            errno = 0;
+            r = receive_packet(s, &reply);
+            if (r < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
                 }
+                if (errno != 0) {
+                    ALOGD("receive_packet failed (%d): %s", r, strerror(errno));
+                    if (errno == ENETDOWN || errno == ENXIO) {
+                        close(s);
+                        return -1;
+                    }
+                    if (errno != EINTR) {
+                        break;
+                    }
+                }
+                continue;
             }
-            continue;
-        }
 
 #if VERBOSE > 1
-        dump_dhcp_msg(&reply, r);
+            dump_dhcp_msg(&reply, r);
 #endif
-        decode_dhcp_msg(&reply, r, &info);
-
-        if (state == STATE_SELECTING) {
-            valid_reply = is_valid_reply(&discover_msg, &reply, r);
-        } else {
-            valid_reply = is_valid_reply(&request_msg, &reply, r);
-        }
-        if (!valid_reply) {
-            printerr("invalid reply\n");
-            continue;
-        }
-
-        if (verbose) dump_dhcp_info(&info);
+            decode_dhcp_msg(&reply, r, &reply_info);
 
-        switch(state) {
-        case STATE_SELECTING:
-            if (info.type == DHCPOFFER) {
-                state = STATE_REQUESTING;
-                timeout = TIMEOUT_INITIAL;
-                xid++;
-                goto transmit;
-            }
-            break;
-        case STATE_REQUESTING:
-            if (info.type == DHCPACK) {
-                printerr("configuring %s\n", ifname);
+            if (rebooted && state != STATE_REBOOTING &&
+                    reply_info.type == DHCPACK &&
+                    reply.xid == reboot_msg.xid &&
+                    is_valid_reply(&reboot_msg, &reply, r)) {
+                printerr("late INIT-REBOOT ack, configuring %s\n", ifname);
                 close(s);
-                return dhcp_configure(ifname, &info);
-            } else if (info.type == DHCPNAK) {
-                printerr("configuration request denied\n");
-                close(s);
-                return -1;
+                set_cached_lease(ifname, hwaddr, &reply_info);
+                return dhcp_configure(ifname, &reply_info);
+            }
+
+            if (state == STATE_SELECTING) {
+                valid_reply = is_valid_reply(&discover_msg, &reply, r);
+            } else if (state == STATE_REBOOTING) {
+                valid_reply = is_valid_reply(&reboot_msg, &reply, r);
             } else {
-                printerr("ignoring %s message in state %d\n",
-                         dhcp_type_to_name(info.type), state);
+                valid_reply = is_valid_reply(&request_msg, &reply, r);
+            }
+            if (!valid_reply) {
+                printerr("invalid reply\n");
+                continue;
+            }
+            info = reply_info;
+
+            if (verbose) dump_dhcp_info(&info);
+
+            switch(state) {
+            case STATE_SELECTING:
+                if (info.type == DHCPOFFER) {
+                    state = STATE_REQUESTING;
+                    timeout = TIMEOUT_INITIAL;
+                    xid++;
+                    goto transmit;
+                }
+                break;
+            case STATE_REQUESTING:
+            case STATE_REBOOTING:
+                if (info.type == DHCPACK) {
+                    printerr("configuring %s\n", ifname);
+                    close(s);
+                    set_cached_lease(ifname, hwaddr, &info);
+                    return dhcp_configure(ifname, &info);
+                } else if (info.type == DHCPNAK && state == STATE_REBOOTING) {
+                    printerr("lease on %s refused, discovering\n", ifname);
+                    cached_lease.expires = 0;
+                    rebooted = 0;
+                    info.type = 0;
+                    state = STATE_SELECTING;
+                    timeout = TIMEOUT_INITIAL;
+                    xid++;
+                    goto transmit;
+                } else if (info.type == DHCPNAK) {
+                    printerr("configuration request denied\n");
+                    close(s);
+                    return -1;
+                } else {
+                    printerr("ignoring %s message in state %d\n",
+                             dhcp_type_to_name(info.type), state);
+                }
+                break;
             }
-            break;
         }
     }
     close(s);
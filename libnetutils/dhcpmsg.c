@@ -89,10 +89,13 @@ int init_dhcp_request_msg(dhcp_msg *msg, void *hwaddr, uint32_t xid,
     memcpy(x, &ipaddr, 4);
     x +=  4;
 
-    *x++ = OPT_SERVER_ID;
-    *x++ = 4;
-    memcpy(x, &serveraddr, 4);
-    x += 4;
+    /* INIT-REBOOT requests (RFC 2131 4.3.2) have no server id */
+    if (serveraddr) {
+        *x++ = OPT_SERVER_ID;
+        *x++ = 4;
+        memcpy(x, &serveraddr, 4);
+        x += 4;
+    }
 
     *x++ = OPT_END;
 
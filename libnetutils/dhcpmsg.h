@@ -100,6 +100,7 @@ struct dhcp_msg
 
 int init_dhcp_discover_msg(dhcp_msg *msg, void *hwaddr, uint32_t xid);
 
+/* A serveraddr of 0 asks any server to confirm ipaddr (INIT-REBOOT). */
 int init_dhcp_request_msg(dhcp_msg *msg, void *hwaddr, uint32_t xid,
                           uint32_t ipaddr, uint32_t serveraddr);
 
@@ -236,102 +236,384 @@ int ifc_set_addr(const char *name, in_addr_t addr)
 }
 
 /*
- * Adds or deletes an IP address on an interface.
- *
- * Action is one of:
- * - RTM_NEWADDR (to add a new address)
- * - RTM_DELADDR (to delete an existing address)
+ * Batches of rtnetlink requests for one interface.
  *
- * Returns zero on success and negative errno on failure.
+ * The messages are queued in a buffer and sent with a single send() by
+ * ifc_batch_commit(), which then collects one ack per message. The kernel
+ * still applies them one after the other, and goes on past one which
+ * fails: it saves the round trips (and the ioctl socket dance), it isn't
+ * a transaction.
  */
-int ifc_act_on_address(int action, const char *name, const char *address,
-                       int prefixlen) {
-    int ifindex, s, len, ret;
-    struct sockaddr_storage ss;
-    void *addr;
-    size_t addrlen;
-    struct {
-        struct nlmsghdr n;
-        struct ifaddrmsg r;
-        // Allow for IPv6 address, headers, and padding.
-        char attrbuf[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
-                     NLMSG_ALIGN(sizeof(struct rtattr)) +
-                     NLMSG_ALIGN(INET6_ADDRLEN)];
-    } req;
+
+#define IFC_BATCH_SIZE 4096
+
+struct ifc_batch {
+    int ifindex;
+    int error;      /* first error while queueing, or 0 */
+    int count;      /* queued messages, which are acked one by one */
+    size_t len;
+    char buf[IFC_BATCH_SIZE];
+};
+
+static int batch_fail(ifc_batch *b, int error)
+{
+    if (b->error == 0) {
+        b->error = error;
+    }
+    return error;
+}
+
+static struct nlmsghdr *batch_msg(ifc_batch *b, int type, int flags, size_t size)
+{
+    struct nlmsghdr *n;
+
+    if (b->error) {
+        return NULL;
+    }
+    if (b->len + NLMSG_SPACE(size) > sizeof(b->buf)) {
+        batch_fail(b, -ENOSPC);
+        return NULL;
+    }
+
+    // The buffer starts zeroed and is never reused, so neither is padding.
+    n = (struct nlmsghdr *) (b->buf + b->len);
+    n->nlmsg_len = NLMSG_LENGTH(size);
+    n->nlmsg_type = type;
+    n->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    n->nlmsg_seq = ++b->count;
+    return n;
+}
+
+static void batch_attr(ifc_batch *b, struct nlmsghdr *n, int type,
+                       const void *data, size_t len)
+{
     struct rtattr *rta;
-    struct nlmsghdr *nh;
-    struct nlmsgerr *err;
-    char buf[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
-             NLMSG_ALIGN(sizeof(struct nlmsgerr)) +
-             NLMSG_ALIGN(sizeof(struct nlmsghdr))];
+    size_t offset = NLMSG_ALIGN(n->nlmsg_len);
 
-    // Get interface ID.
-    ifindex = if_nametoindex(name);
-    if (ifindex == 0) {
-        return -errno;
+    if (b->error) {
+        return;
     }
+    if (b->len + offset + RTA_SPACE(len) > sizeof(b->buf)) {
+        batch_fail(b, -ENOSPC);
+        return;
+    }
+
+    rta = (struct rtattr *) (((char *) n) + offset);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    n->nlmsg_len = offset + RTA_LENGTH(len);
+}
+
+static int batch_end(ifc_batch *b, struct nlmsghdr *n)
+{
+    if (b->error) {
+        return b->error;
+    }
+    b->len += NLMSG_ALIGN(n->nlmsg_len);
+    return 0;
+}
+
+// Returns the family of address, with its INET_ADDRLEN or INET6_ADDRLEN bytes in addr.
+static int parse_address(const char *address, int *family, void *addr)
+{
+    struct sockaddr_storage ss;
+    int ret;
 
-    // Convert string representation to sockaddr_storage.
     ret = string_to_ip(address, &ss);
     if (ret) {
         return ret;
     }
 
-    // Determine address type and length.
+    *family = ss.ss_family;
     if (ss.ss_family == AF_INET) {
-        struct sockaddr_in *sin = (struct sockaddr_in *) &ss;
-        addr = &sin->sin_addr;
-        addrlen = INET_ADDRLEN;
+        memcpy(addr, &((struct sockaddr_in *) &ss)->sin_addr, INET_ADDRLEN);
     } else if (ss.ss_family == AF_INET6) {
-        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &ss;
-        addr = &sin6->sin6_addr;
-        addrlen = INET6_ADDRLEN;
+        memcpy(addr, &((struct sockaddr_in6 *) &ss)->sin6_addr, INET6_ADDRLEN);
     } else {
         return -EAFNOSUPPORT;
     }
+    return 0;
+}
+
+static int batch_flags(ifc_batch *b, unsigned set, unsigned clr)
+{
+    struct nlmsghdr *n;
+    struct ifinfomsg *ifi;
+
+    n = batch_msg(b, RTM_NEWLINK, 0, sizeof(*ifi));
+    if (n == NULL) {
+        return b->error;
+    }
+    ifi = NLMSG_DATA(n);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = b->ifindex;
+    ifi->ifi_flags = set;
+    ifi->ifi_change = set | clr;
+    return batch_end(b, n);
+}
+
+static int batch_address(ifc_batch *b, int action, int flags, int family,
+                         const void *addr, int prefixlen)
+{
+    size_t addrlen = (family == AF_INET) ? INET_ADDRLEN : INET6_ADDRLEN;
+    struct nlmsghdr *n;
+    struct ifaddrmsg *ifa;
+
+    if (prefixlen < 0 || prefixlen > (int) addrlen * 8) {
+        return batch_fail(b, -EINVAL);
+    }
+
+    n = batch_msg(b, action, flags, sizeof(*ifa));
+    if (n == NULL) {
+        return b->error;
+    }
+    ifa = NLMSG_DATA(n);
+    ifa->ifa_family = family;
+    ifa->ifa_prefixlen = prefixlen;
+    ifa->ifa_index = b->ifindex;
+    batch_attr(b, n, IFA_LOCAL, addr, addrlen);
+
+    // SIOCSIFNETMASK used to set this; netlink leaves it to us.
+    if (family == AF_INET && action == RTM_NEWADDR && prefixlen > 0 && prefixlen < 31) {
+        in_addr_t broadcast;
+        memcpy(&broadcast, addr, INET_ADDRLEN);
+        broadcast |= ~prefixLengthToIpv4Netmask(prefixlen);
+        batch_attr(b, n, IFA_BROADCAST, &broadcast, INET_ADDRLEN);
+    }
+    return batch_end(b, n);
+}
+
+// A NULL gw is a route to the link itself. Like SIOCADDRT, goes in the main table.
+static int batch_route(ifc_batch *b, int action, int family, const void *dst,
+                       int prefix_length, const void *gw)
+{
+    size_t addrlen = (family == AF_INET) ? INET_ADDRLEN : INET6_ADDRLEN;
+    struct nlmsghdr *n;
+    struct rtmsg *rtm;
+
+    if (prefix_length < 0 || prefix_length > (int) addrlen * 8) {
+        return batch_fail(b, -EINVAL);
+    }
+
+    n = batch_msg(b, action, action == RTM_NEWROUTE ? NLM_F_CREATE : 0, sizeof(*rtm));
+    if (n == NULL) {
+        return b->error;
+    }
+    rtm = NLMSG_DATA(n);
+    rtm->rtm_family = family;
+    rtm->rtm_dst_len = prefix_length;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    if (action == RTM_NEWROUTE) {
+        rtm->rtm_protocol = RTPROT_BOOT;
+        rtm->rtm_scope = gw ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+        rtm->rtm_type = RTN_UNICAST;
+    } else {
+        rtm->rtm_scope = RT_SCOPE_NOWHERE;
+    }
+    if (prefix_length > 0) {
+        batch_attr(b, n, RTA_DST, dst, addrlen);
+    }
+    if (gw) {
+        batch_attr(b, n, RTA_GATEWAY, gw, addrlen);
+    }
+    batch_attr(b, n, RTA_OIF, &b->ifindex, sizeof(b->ifindex));
+    return batch_end(b, n);
+}
+
+static int batch_string_route(ifc_batch *b, int action, const char *dst,
+                              int prefix_length, const char *gw)
+{
+    unsigned char dst_addr[INET6_ADDRLEN], gw_addr[INET6_ADDRLEN];
+    int family, gw_family, ret;
+
+    ret = parse_address(dst, &family, dst_addr);
+    if (ret) {
+        return batch_fail(b, ret);
+    }
+    if (gw == NULL || strlen(gw) == 0) {
+        return batch_route(b, action, family, dst_addr, prefix_length, NULL);
+    }
+
+    ret = parse_address(gw, &gw_family, gw_addr);
+    if (ret) {
+        return batch_fail(b, ret);
+    }
+    if (gw_family != family) {
+        return batch_fail(b, -EINVAL);
+    }
+    if (!memcmp(gw_addr, &in6addr_any, family == AF_INET ? INET_ADDRLEN : INET6_ADDRLEN)) {
+        return batch_route(b, action, family, dst_addr, prefix_length, NULL);
+    }
+    return batch_route(b, action, family, dst_addr, prefix_length, gw_addr);
+}
+
+ifc_batch *ifc_batch_begin(const char *name)
+{
+    ifc_batch *b;
+    int ifindex;
+
+    ifindex = if_nametoindex(name);
+    if (ifindex == 0) {
+        return NULL;
+    }
+    b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->ifindex = ifindex;
+    return b;
+}
+
+int ifc_batch_up(ifc_batch *b)
+{
+    return batch_flags(b, IFF_UP, 0);
+}
+
+int ifc_batch_down(ifc_batch *b)
+{
+    return batch_flags(b, 0, IFF_UP);
+}
 
-    // Fill in netlink structures.
-    memset(&req, 0, sizeof(req));
+int ifc_batch_add_address(ifc_batch *b, const char *address, int prefixlen)
+{
+    unsigned char addr[INET6_ADDRLEN];
+    int family, ret;
+
+    ret = parse_address(address, &family, addr);
+    if (ret) {
+        return batch_fail(b, ret);
+    }
+    // Unlike ifc_add_address(), having the address already is fine.
+    return batch_address(b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+                         family, addr, prefixlen);
+}
+
+int ifc_batch_del_address(ifc_batch *b, const char *address, int prefixlen)
+{
+    unsigned char addr[INET6_ADDRLEN];
+    int family, ret;
+
+    ret = parse_address(address, &family, addr);
+    if (ret) {
+        return batch_fail(b, ret);
+    }
+    return batch_address(b, RTM_DELADDR, 0, family, addr, prefixlen);
+}
 
-    // Netlink message header.
-    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.r));
-    req.n.nlmsg_type = action;
-    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-    req.n.nlmsg_pid = getpid();
+int ifc_batch_add_route(ifc_batch *b, const char *dst, int prefix_length,
+                        const char *gw)
+{
+    return batch_string_route(b, RTM_NEWROUTE, dst, prefix_length, gw);
+}
 
-    // Interface address message header.
-    req.r.ifa_family = ss.ss_family;
-    req.r.ifa_prefixlen = prefixlen;
-    req.r.ifa_index = ifindex;
+int ifc_batch_remove_route(ifc_batch *b, const char *dst, int prefix_length,
+                           const char *gw)
+{
+    return batch_string_route(b, RTM_DELROUTE, dst, prefix_length, gw);
+}
 
-    // Routing attribute. Contains the actual IP address.
-    rta = (struct rtattr *) (((char *) &req) + NLMSG_ALIGN(req.n.nlmsg_len));
-    rta->rta_type = IFA_LOCAL;
-    rta->rta_len = RTA_LENGTH(addrlen);
-    req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) + RTA_LENGTH(addrlen);
-    memcpy(RTA_DATA(rta), addr, addrlen);
+static int batch_send(ifc_batch *b)
+{
+    int s, len, acked, ret;
+    struct nlmsghdr *nh;
+    struct nlmsgerr *err;
+    // Error acks carry the request they answer.
+    char buf[NLMSG_SPACE(sizeof(struct nlmsgerr)) + IFC_BATCH_SIZE];
 
     s = socket(PF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
-    if (send(s, &req, req.n.nlmsg_len, 0) < 0) {
-        close(s);
+    if (s < 0) {
         return -errno;
     }
+    if (send(s, b->buf, b->len, 0) < 0) {
+        ret = -errno;
+        close(s);
+        return ret;
+    }
 
-    len = recv(s, buf, sizeof(buf), 0);
+    ret = 0;
+    for (acked = 0; acked < b->count; ) {
+        len = recv(s, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (ret == 0) {
+                ret = -errno;
+            }
+            break;
+        }
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (unsigned) len);
+                nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+            if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                acked = b->count;
+                ret = ret ? ret : -EINVAL;
+                break;
+            }
+            err = NLMSG_DATA(nh);
+            acked++;
+            // SIOCADDRT callers never saw EEXIST either.
+            if (err->error == -EEXIST && err->msg.nlmsg_type == RTM_NEWROUTE) {
+                continue;
+            }
+            if (err->error && ret == 0) {
+                if (DBG) printerr("batch message %d on %d failed: %s", err->msg.nlmsg_seq,
+                                  b->ifindex, strerror(-err->error));
+                ret = err->error;
+            }
+        }
+    }
     close(s);
-    if (len < 0) {
+    return ret;
+}
+
+int ifc_batch_commit(ifc_batch *b)
+{
+    int ret = b->error;
+
+    if (ret == 0 && b->count > 0) {
+        ret = batch_send(b);
+    }
+    free(b);
+    return ret;
+}
+
+void ifc_batch_abort(ifc_batch *b)
+{
+    free(b);
+}
+
+/*
+ * Adds or deletes an IP address on an interface.
+ *
+ * Action is one of:
+ * - RTM_NEWADDR (to add a new address)
+ * - RTM_DELADDR (to delete an existing address)
+ *
+ * Returns zero on success and negative errno on failure.
+ */
+int ifc_act_on_address(int action, const char *name, const char *address,
+                       int prefixlen) {
+    unsigned char addr[INET6_ADDRLEN];
+    ifc_batch *b;
+    int family, ret;
+
+    b = ifc_batch_begin(name);
+    if (b == NULL) {
         return -errno;
     }
 
-    // Parse the acknowledgement to find the return code.
-    nh = (struct nlmsghdr *) buf;
-    if (!NLMSG_OK(nh, (unsigned) len) || nh->nlmsg_type != NLMSG_ERROR) {
-        return -EINVAL;
+    ret = parse_address(address, &family, addr);
+    if (ret) {
+        ifc_batch_abort(b);
+        return ret;
     }
-    err = NLMSG_DATA(nh);
 
-    // Return code is negative errno.
-    return err->error;
+    batch_address(b, action, 0, family, addr, prefixlen);
+    return ifc_batch_commit(b);
 }
 
 int ifc_add_address(const char *name, const char *address, int prefixlen) {
@@ -783,32 +1065,28 @@ ifc_configure(const char *ifname,
         in_addr_t dns2) {
 
     char dns_prop_name[PROPERTY_KEY_MAX];
+    in_addr_t any = 0;
+    ifc_batch *b;
+    int ret;
 
-    ifc_init();
-
-    if (ifc_up(ifname)) {
-        printerr("failed to turn on interface %s: %s\n", ifname, strerror(errno));
-        ifc_close();
+    // One round trip for what used to be four ioctls.
+    b = ifc_batch_begin(ifname);
+    if (b == NULL) {
+        printerr("failed to find interface %s: %s\n", ifname, strerror(errno));
         return -1;
     }
-    if (ifc_set_addr(ifname, address)) {
-        printerr("failed to set ipaddr %s: %s\n", ipaddr_to_string(address), strerror(errno));
-        ifc_close();
-        return -1;
-    }
-    if (ifc_set_prefixLength(ifname, prefixLength)) {
-        printerr("failed to set prefixLength %d: %s\n", prefixLength, strerror(errno));
-        ifc_close();
-        return -1;
-    }
-    if (ifc_create_default_route(ifname, gateway)) {
-        printerr("failed to set default route %s: %s\n", ipaddr_to_string(gateway), strerror(errno));
-        ifc_close();
+    ifc_batch_up(b);
+    batch_address(b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, AF_INET, &address,
+                  prefixLength);
+    batch_route(b, RTM_NEWROUTE, AF_INET, &any, 0, gateway ? &gateway : NULL);
+    ret = ifc_batch_commit(b);
+    if (ret) {
+        printerr("failed to configure %s with %s/%d: %s\n", ifname,
+                 ipaddr_to_string(address), prefixLength, strerror(-ret));
+        errno = -ret;
         return -1;
     }
 
-    ifc_close();
-
     snprintf(dns_prop_name, sizeof(dns_prop_name), "net.%s.dns1", ifname);
     property_set(dns_prop_name, dns1 ? ipaddr_to_string(dns1) : "");
     snprintf(dns_prop_name, sizeof(dns_prop_name), "net.%s.dns2", ifname);
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/uio.h>
@@ -23,7 +24,9 @@
 #include <netinet/udp.h>
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
+#include <linux/filter.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef ANDROID
 #define LOG_TAG "DHCP"
@@ -39,6 +42,29 @@
 
 int fatal();
 
+/*
+ * The socket sees every IP packet on the interface. Have the kernel drop
+ * the ones which aren't unfragmented UDP datagrams to the DHCP client
+ * port, so that a busy network doesn't wake us up for each of them.
+ * receive_packet() still checks everything.
+ */
+static struct sock_filter dhcp_filter_insns[] = {
+    BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, offsetof(struct iphdr, protocol)),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   IPPROTO_UDP, 0, 5),
+    BPF_STMT(BPF_LD  + BPF_H   + BPF_ABS, offsetof(struct iphdr, frag_off)),
+    BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K,  0x1fff, 3, 0),
+    BPF_STMT(BPF_LDX + BPF_B   + BPF_MSH, 0),
+    BPF_STMT(BPF_LD  + BPF_H   + BPF_IND, offsetof(struct udphdr, dest)),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   PORT_BOOTP_CLIENT, 1, 0),
+    BPF_STMT(BPF_RET + BPF_K, 0),
+    BPF_STMT(BPF_RET + BPF_K, 0xffff),
+};
+
+static const struct sock_fprog dhcp_filter = {
+    sizeof(dhcp_filter_insns) / sizeof(dhcp_filter_insns[0]),
+    dhcp_filter_insns
+};
+
 int open_raw_socket(const char *ifname __attribute__((unused)), uint8_t *hwaddr, int if_index)
 {
     int s, flag;
@@ -48,6 +74,11 @@ int open_raw_socket(const char *ifname __attribute__((unused)), uint8_t *hwaddr,
         return fatal("socket(PF_PACKET)");
     }
 
+    if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &dhcp_filter, sizeof(dhcp_filter)) < 0) {
+        ALOGW("Cannot attach DHCP socket filter: %s", strerror(errno));
+    }
+
     memset(&bindaddr, 0, sizeof(bindaddr));
     bindaddr.sll_family = AF_PACKET;
     bindaddr.sll_protocol = htons(ETH_P_IP);
@@ -59,6 +90,12 @@ int open_raw_socket(const char *ifname __attribute__((unused)), uint8_t *hwaddr,
         return fatal("Cannot bind raw socket to interface");
     }
 
+    /* so that the caller can read every queued packet after one poll() */
+    flag = fcntl(s, F_GETFL);
+    if (flag < 0 || fcntl(s, F_SETFL, flag | O_NONBLOCK) < 0) {
+        return fatal("Cannot make raw socket non-blocking");
+    }
+
     return s;
 }
 
@@ -22,6 +22,12 @@
 #include <linux/netlink.h>
 #include "netlink-types.h"
 
+/* Freed messages kept for reuse by nlmsg_alloc(). Like the rest of the
+ * library this is not thread safe. */
+#define NL_MSG_POOL_MAX 8
+static struct nl_msg *nl_msg_pool[NL_MSG_POOL_MAX];
+static int nl_msg_pool_cnt;
+
 /* Allocate a new netlink message with the default maximum payload size. */
 struct nl_msg *nlmsg_alloc(void)
 {
@@ -31,7 +37,10 @@ struct nl_msg *nlmsg_alloc(void)
 	struct nlmsghdr *nlh;
 
 	/* Netlink message */
-	nm = (struct nl_msg *) malloc(page_sz);
+	if (nl_msg_pool_cnt > 0)
+		nm = nl_msg_pool[--nl_msg_pool_cnt];
+	else
+		nm = (struct nl_msg *) malloc(page_sz);
 	if (!nm)
 		goto fail;
 
@@ -76,7 +85,12 @@ void nlmsg_free(struct nl_msg *nm)
 {
 	if (nm) {
 		nm->nm_refcnt--;
-		if (nm->nm_refcnt <= 0)
+		if (nm->nm_refcnt > 0)
+			return;
+		if (nm->nm_size == getpagesize() &&
+		    nl_msg_pool_cnt < NL_MSG_POOL_MAX)
+			nl_msg_pool[nl_msg_pool_cnt++] = nm;
+		else
 			free(nm);
 	}
 
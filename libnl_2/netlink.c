@@ -21,10 +21,16 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netlink/batch.h>
 #include "netlink-types.h"
 
 #define NL_BUFFER_SZ (32768U)
 
+/* Receive buffer size. The kernel sizes dump replies after the reader's
+ * buffer, so a larger one gets more parts of a multi-part reply per recv. */
+#define NL_RECV_BUF_SZ (16384)
+
 /* Checks message for completeness and sends it out */
 int nl_send_auto_complete(struct nl_sock *sk, struct nl_msg *msg)
 {
@@ -58,8 +64,7 @@ int nl_recv(struct nl_sock *sk, struct sockaddr_nl *nla, \
 	unsigned char **buf, struct ucred **creds)
 {
 	int rc = -1;
-	int sk_flags;
-	int RECV_BUF_SIZE = getpagesize();
+	int RECV_BUF_SIZE = NL_RECV_BUF_SZ;
 	int errsv;
 	struct iovec recvmsg_iov;
 	struct msghdr msg;
@@ -83,12 +88,9 @@ int nl_recv(struct nl_sock *sk, struct sockaddr_nl *nla, \
 	msg.msg_controllen = 0;
 	msg.msg_flags = 0;
 
-	/* Make non blocking and then restore previous setting */
-	sk_flags = fcntl(sk->s_fd, F_GETFL, 0);
-	fcntl(sk->s_fd, F_SETFL, O_NONBLOCK);
-	rc = recvmsg(sk->s_fd, &msg, 0);
+	/* Non blocking for this call only, without touching the socket flags */
+	rc = recvmsg(sk->s_fd, &msg, MSG_DONTWAIT);
 	errsv = errno;
-	fcntl(sk->s_fd, F_SETFL, sk_flags);
 
 	if (rc < 0) {
 		rc = -errsv;
@@ -114,7 +116,8 @@ int nl_recvmsgs(struct nl_sock *sk, struct nl_cb *cb)
 		int i, rem, flags;
 		struct nlmsghdr *nlh;
 		struct nlmsgerr *nlme;
-		struct nl_msg *msg;
+		struct nl_msg msg_buf;
+		struct nl_msg *msg = &msg_buf;
 
 		done = 0;
 		rc = nl_recv(sk, &nla, &buf, &creds);
@@ -128,7 +131,6 @@ int nl_recvmsgs(struct nl_sock *sk, struct nl_cb *cb)
 
 			/* Check for callbacks */
 
-			msg = (struct nl_msg *) malloc(sizeof(struct nl_msg));
 			memset(msg, 0, sizeof(*msg));
 			msg->nm_nlh = nlh;
 
@@ -184,7 +186,6 @@ int nl_recvmsgs(struct nl_sock *sk, struct nl_cb *cb)
 				}
 			}
 
-			free(msg);
 			if (done)
 				break;
 		}
@@ -200,6 +201,42 @@ fail:
 	return rc;
 }
 
+/* Completes count messages as nl_send_auto_complete() would and sends
+ * them all with one sendmsg(); the kernel handles each in turn and the
+ * replies are read back with nl_recvmsgs() as usual. */
+int nl_send_batch(struct nl_sock *sk, struct nl_msg **msgs, int count)
+{
+	struct iovec iov[NL_BATCH_MAX];
+	struct timeval tv;
+	int seq;
+	int i;
+
+	if (count <= 0 || count > NL_BATCH_MAX)
+		return -EINVAL;
+
+	if (gettimeofday(&tv, NULL))
+		seq = 1;
+	else
+		seq = (int) tv.tv_sec;
+
+	for (i = 0; i < count; i++) {
+		struct nlmsghdr *nlh = msgs[i]->nm_nlh;
+
+		if (!nlh) {
+			fprintf(stderr, "Netlink message header is NULL!\n");
+			return -EINVAL;
+		}
+		nlh->nlmsg_seq = seq + i;
+		nlh->nlmsg_pid = sk->s_local.nl_pid;
+		nlh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+
+		iov[i].iov_base = nlh;
+		iov[i].iov_len = nlh->nlmsg_len;
+	}
+
+	return nl_send_iovec(sk, msgs[0], iov, count);
+}
+
 /* Send raw data over netlink socket */
 int nl_send(struct nl_sock *sk, struct nl_msg *msg)
 {
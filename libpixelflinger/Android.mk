@@ -26,7 +26,8 @@ PIXELFLINGER_SRC_FILES:= \
 	format.cpp \
 	clear.cpp \
 	raster.cpp \
-	buffer.cpp
+	buffer.cpp \
+	tiler.cpp
 
 ifeq ($(TARGET_ARCH),arm)
 ifeq ($(TARGET_ARCH_VERSION),armv7-a)
@@ -38,11 +39,27 @@ PIXELFLINGER_SRC_FILES += col32cb16blend.S
 endif
 endif
 
+ifeq ($(TARGET_ARCH),arm)
+# empty unless the compiler targets NEON
+PIXELFLINGER_SRC_FILES += t32cb16blend_neon.cpp
+endif
+
+ifeq ($(TARGET_ARCH),x86)
+# empty unless the compiler targets SSE2
+PIXELFLINGER_SRC_FILES += arch-x86/blend_sse2.cpp
+endif
+
 ifeq ($(TARGET_ARCH),arm)
 # special optimization flags for pixelflinger
 PIXELFLINGER_CFLAGS += -fstrict-aliasing -fomit-frame-pointer
 endif
 
+ifeq ($(TARGET_ARCH),arm64)
+PIXELFLINGER_SRC_FILES += codeflinger/Arm64Assembler.cpp
+PIXELFLINGER_SRC_FILES += codeflinger/Arm64Disassembler.cpp
+PIXELFLINGER_CFLAGS += -fstrict-aliasing -fomit-frame-pointer
+endif
+
 ifeq ($(TARGET_ARCH),mips)
 PIXELFLINGER_SRC_FILES += codeflinger/MIPSAssembler.cpp
 PIXELFLINGER_SRC_FILES += codeflinger/mips_disassem.c
@@ -0,0 +1,114 @@
+/* libs/pixelflinger/arch-x86/blend_sse2.cpp
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+/*
+ * SSE2 versions of the SRC_OVER blends of 8888 pixels into a 565 scanline,
+ * eight pixels at a time. For every destination pixel d and source pixel s
+ * with alpha a they compute, like the C versions in scanline.cpp,
+ *
+ *     f = 0x100 - (a + (a >> 7))
+ *     d = s + ((f * d) >> 8)
+ *
+ * per channel, with s truncated to 565. A transparent source (s == 0) gives
+ * f == 0x100 and leaves d as it was, and an opaque one gives f == 0, so
+ * neither needs a special case.
+ */
+
+// Blends eight pixels whose red, green, blue and alpha are given in
+// separate 16-bit lanes, 8 bits per channel.
+static inline __m128i blend8(__m128i sR, __m128i sG, __m128i sB, __m128i sA,
+        __m128i d)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i f = _mm_sub_epi16(_mm_set1_epi16(0x100),
+            _mm_add_epi16(sA, _mm_srli_epi16(sA, 7)));
+
+    __m128i dR = _mm_srli_epi16(d, 11);
+    __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), mask6);
+    __m128i dB = _mm_and_si128(d, mask5);
+    dR = _mm_add_epi16(_mm_srli_epi16(sR, 3), _mm_srli_epi16(_mm_mullo_epi16(f, dR), 8));
+    dG = _mm_add_epi16(_mm_srli_epi16(sG, 2), _mm_srli_epi16(_mm_mullo_epi16(f, dG), 8));
+    dB = _mm_add_epi16(_mm_srli_epi16(sB, 3), _mm_srli_epi16(_mm_mullo_epi16(f, dB), 8));
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(dR, 11), _mm_slli_epi16(dG, 5)), dB);
+}
+
+// Packs one channel of eight 8888 pixels into 16-bit lanes.
+static inline __m128i channel8(__m128i lo, __m128i hi, int shift)
+{
+    const __m128i mask8 = _mm_set1_epi32(0xff);
+    lo = _mm_and_si128(_mm_srl_epi32(lo, _mm_cvtsi32_si128(shift)), mask8);
+    hi = _mm_and_si128(_mm_srl_epi32(hi, _mm_cvtsi32_si128(shift)), mask8);
+    return _mm_packs_epi32(lo, hi);
+}
+
+static inline uint16_t blend1(uint32_t s, uint16_t d)
+{
+    int sA = (s>>24);
+    int f = 0x100 - (sA + (sA>>7));
+    int sR = (s >> (   3))&0x1F;
+    int sG = (s >> ( 8+2))&0x3F;
+    int sB = (s >> (16+3))&0x1F;
+    int dR = (d>>11)&0x1f;
+    int dG = (d>>5)&0x3f;
+    int dB = (d)&0x1f;
+    sR += (f*dR)>>8;
+    sG += (f*dG)>>8;
+    sB += (f*dB)>>8;
+    return uint16_t((sR<<11)|(sG<<5)|sB);
+}
+
+extern "C" void scanline_t32cb16blend_sse2(uint16_t* dst, uint32_t* src, size_t ct)
+{
+    for ( ; ct >= 8 ; ct -= 8, dst += 8, src += 8) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+        d = blend8(channel8(lo, hi, 0), channel8(lo, hi, 8),
+                channel8(lo, hi, 16), channel8(lo, hi, 24), d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), d);
+    }
+    while (ct--) {
+        *dst = blend1(*src++, *dst);
+        dst++;
+    }
+}
+
+extern "C" void scanline_col32cb16blend_sse2(uint16_t* dst, uint32_t col, size_t ct)
+{
+    const __m128i sR = _mm_set1_epi16((col      ) & 0xff);
+    const __m128i sG = _mm_set1_epi16((col >>  8) & 0xff);
+    const __m128i sB = _mm_set1_epi16((col >> 16) & 0xff);
+    const __m128i sA = _mm_set1_epi16((col >> 24));
+    for ( ; ct >= 8 ; ct -= 8, dst += 8) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), blend8(sR, sG, sB, sA, d));
+    }
+    while (ct--) {
+        *dst = blend1(col, *dst);
+        dst++;
+    }
+}
+
+#endif // defined(__SSE2__)
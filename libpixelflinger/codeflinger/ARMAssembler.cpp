@@ -99,8 +99,8 @@ void ARMAssembler::disassemble(const char* name)
         if (comment >= 0) {
             printf("; %s\n", mComments.valueAt(comment));
         }
-        printf("%08x:    %08x    ", int(i), int(i[0]));
-        ::disassemble((u_int)i);
+        printf("%08lx:    %08x    ", (unsigned long)i, int(i[0]));
+        ::disassemble(u_int(uintptr_t(i)));
         i++;
     }
 }
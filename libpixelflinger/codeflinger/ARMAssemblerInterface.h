@@ -63,7 +63,7 @@ public:
     };
 
     enum {
-        CODEGEN_ARCH_ARM = 1, CODEGEN_ARCH_MIPS
+        CODEGEN_ARCH_ARM = 1, CODEGEN_ARCH_MIPS, CODEGEN_ARCH_ARM64
     };
 
     // -----------------------------------------------------------------------
@@ -217,6 +217,18 @@ public:
     // bit manipulation...
     virtual void UBFX(int cc, int Rd, int Rn, int lsb, int width) = 0;
 
+    // pointer arithmetic and pointer transfer...
+    // (the same as ADD/SUB/LDR/STR, except where pointers are wider than
+    // the 32-bit registers the code is written for)
+    virtual void ADDR_LDR(int cc, int Rd,
+                int Rn, uint32_t offset = __immed12_pre(0));
+    virtual void ADDR_STR(int cc, int Rd,
+                int Rn, uint32_t offset = __immed12_pre(0));
+    virtual void ADDR_ADD(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+    virtual void ADDR_SUB(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+
     // -----------------------------------------------------------------------
     // convenience...
     // -----------------------------------------------------------------------
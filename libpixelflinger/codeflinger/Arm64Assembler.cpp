@@ -0,0 +1,1220 @@
+/* libs/pixelflinger/codeflinger/Arm64Assembler.cpp
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+/* ARM to A64 (AArch64) assembly translator
+**
+** Like the ArmToMipsAssembler, this leaves GGLAssembler generating Arm
+** instructions, and translates each of them into one or more A64 instructions.
+**
+** - Arm registers r0-r14 are A64 registers w0-w14. They are all caller-saved
+** in the AAPCS64, so there is no register to save in the prolog, and the
+** context pointer arrives in x0 as it does in r0. w16 and w17 (ip0/ip1) are
+** the translator's scratch registers; x18 is never touched.
+**
+** - Arm instructions work on 32-bit values and the w registers do too, but
+** pointers are 64-bit. GGLAssembler uses ADDR_LDR/ADDR_STR/ADDR_ADD/ADDR_SUB
+** for pointers, which use the x registers and sign-extend the 32-bit offsets.
+** Every load and store uses its base register as an x register.
+**
+** - The condition codes are the same as Arm's. Conditional data processing
+** computes into w17 and selects it with csel; anything else conditional is
+** skipped with a branch on the inverse condition.
+**
+** - Flags are only set by the S variants of the instructions which have one
+** (adds, subs, ands, bics); other Arm S instructions are followed by a tst of
+** their result, which sets N and Z but not the shifter carry out.
+**
+** - Registers are pushed on the stack in 16-byte slots, so sp stays aligned
+** and pointers survive the spill.
+*/
+
+
+#define LOG_TAG "ArmToArm64Assembler"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include <private/pixelflinger/ggl_context.h>
+
+#include "Arm64Assembler.h"
+#include "Arm64Disassembler.h"
+#include "CodeCache.h"
+
+
+#define NOT_IMPLEMENTED()  LOG_ALWAYS_FATAL("Arm instruction %s not yet implemented\n", __func__)
+
+
+// ----------------------------------------------------------------------------
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// unsigned offset encodings of the loads and stores, in ldst_t order
+static const uint32_t sLoadStoreOps[] = {
+    0x39000000,     // strb
+    0x39400000,     // ldrb
+    0x39C00000,     // ldrsb (w)
+    0x79000000,     // strh
+    0x79400000,     // ldrh
+    0x79C00000,     // ldrsh (w)
+    0xB9000000,     // str (w)
+    0xB9400000,     // ldr (w)
+    0xF9000000,     // str (x)
+    0xF9400000,     // ldr (x)
+};
+
+#if 0
+#pragma mark -
+#pragma mark ArmToArm64Assembler...
+#endif
+
+ArmToArm64Assembler::ArmToArm64Assembler(const sp<Assembly>& assembly)
+    :   ARMAssemblerInterface(),
+        mAssembly(assembly)
+{
+    mBase = mPC = (uint32_t *)assembly->base();
+    mDuration = ggl_system_time();
+}
+
+ArmToArm64Assembler::~ArmToArm64Assembler()
+{
+}
+
+uint32_t* ArmToArm64Assembler::pc() const
+{
+    return mPC;
+}
+
+uint32_t* ArmToArm64Assembler::base() const
+{
+    return mBase;
+}
+
+void ArmToArm64Assembler::reset()
+{
+    mBase = mPC = (uint32_t *)mAssembly->base();
+    mBranchTargets.clear();
+    mLabels.clear();
+    mLabelsInverseMapping.clear();
+    mComments.clear();
+}
+
+int ArmToArm64Assembler::getCodegenArch()
+{
+    return CODEGEN_ARCH_ARM64;
+}
+
+// ----------------------------------------------------------------------------
+
+void ArmToArm64Assembler::disassemble(const char* name)
+{
+    char instr[64];
+
+    if (name) {
+        printf("%s:\n", name);
+    }
+    size_t count = pc()-base();
+    uint32_t* i = base();
+    while (count--) {
+        ssize_t label = mLabelsInverseMapping.indexOfKey(i);
+        if (label >= 0) {
+            printf("%s:\n", mLabelsInverseMapping.valueAt(label));
+        }
+        ssize_t comment = mComments.indexOfKey(i);
+        if (comment >= 0) {
+            printf("; %s\n", mComments.valueAt(comment));
+        }
+        ::arm64_disassemble(i[0], instr);
+        printf("%p:    %08x    %s\n", i, i[0], instr);
+        i++;
+    }
+}
+
+void ArmToArm64Assembler::comment(const char* string)
+{
+    mComments.add(mPC, string);
+}
+
+void ArmToArm64Assembler::label(const char* theLabel)
+{
+    mLabels.add(theLabel, mPC);
+    mLabelsInverseMapping.add(mPC, theLabel);
+}
+
+void ArmToArm64Assembler::B(int cc, const char* label)
+{
+    mBranchTargets.add(branch_target_t(label, mPC));
+    if (cc == AL) {
+        emit(0x14000000);                   // b
+    } else {
+        emit(0x54000000 | cc);              // b.cc
+    }
+}
+
+void ArmToArm64Assembler::BL(int cc, const char* label)
+{
+    uint32_t* skip = beginConditional(cc);
+    mBranchTargets.add(branch_target_t(label, mPC));
+    emit(0x94000000);                       // bl
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::B(int cc, uint32_t* to_pc)
+{
+    const int32_t offset = int32_t(to_pc - mPC);
+    if (cc == AL) {
+        emit(0x14000000 | (offset & 0x3FFFFFF));
+    } else {
+        emit(0x54000000 | ((offset & 0x7FFFF) << 5) | cc);
+    }
+}
+
+void ArmToArm64Assembler::BL(int cc, uint32_t* to_pc)
+{
+    uint32_t* skip = beginConditional(cc);
+    emit(0x94000000 | (int32_t(to_pc - mPC) & 0x3FFFFFF));
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::BX(int cc, int Rn)
+{
+    uint32_t* skip = beginConditional(cc);
+    if (Rn == LR) {
+        emit(0xD65F03C0);                   // ret
+    } else {
+        emit(0xD61F0000 | (Rn << 5));       // br xn
+    }
+    endConditional(skip);
+}
+
+uint32_t* ArmToArm64Assembler::pcForLabel(const char* label)
+{
+    return mLabels.valueFor(label);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Prolog/Epilog & Generate...
+#endif
+
+void ArmToArm64Assembler::prolog()
+{
+    // nothing to save, see the top of this file
+}
+
+void ArmToArm64Assembler::epilog(uint32_t touched)
+{
+    emit(0xD65F03C0);                       // ret
+}
+
+int ArmToArm64Assembler::generate(const char* name)
+{
+    // fixup all the branches
+    size_t count = mBranchTargets.size();
+    while (count--) {
+        const branch_target_t& bt = mBranchTargets[count];
+        uint32_t* target_pc = mLabels.valueFor(bt.label);
+        LOG_ALWAYS_FATAL_IF(!target_pc,
+                "error resolving branch targets, target_pc is null");
+        int32_t offset = int32_t(target_pc - bt.pc);
+        if ((*bt.pc & 0x7C000000) == 0x14000000) {
+            *bt.pc |= offset & 0x3FFFFFF;   // b, bl
+        } else {
+            *bt.pc |= (offset & 0x7FFFF) << 5;  // b.cc
+        }
+    }
+
+    mAssembly->resize( int(pc()-base())*4 );
+
+    // the instruction cache is flushed by CodeCache
+    const int64_t duration = ggl_system_time() - mDuration;
+    const char * const format = "generated %s (%d ins) at [%p:%p] in %lld ns\n";
+    ALOGI(format, name, int(pc()-base()), base(), pc(), (long long)duration);
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.pf.disasm", value, "0");
+    if (atoi(value) != 0) {
+        printf(format, name, int(pc()-base()), base(), pc(), (long long)duration);
+        disassemble(name);
+    }
+
+    return NO_ERROR;
+}
+
+void ArmToArm64Assembler::emit(uint32_t insn)
+{
+    *mPC++ = insn;
+}
+
+// Skips what follows unless cc holds; the branch is patched by
+// endConditional() once the translated instructions are all emitted.
+uint32_t* ArmToArm64Assembler::beginConditional(int cc)
+{
+    if (cc == AL) {
+        return 0;
+    }
+    uint32_t* skip = mPC;
+    emit(0x54000000 | (cc ^ 1));            // b.!cc
+    return skip;
+}
+
+void ArmToArm64Assembler::endConditional(uint32_t* skip)
+{
+    if (skip) {
+        *skip |= (int32_t(mPC - skip) & 0x7FFFF) << 5;
+    }
+}
+
+#if 0
+#pragma mark -
+#pragma mark Shifters and addressing modes...
+#endif
+
+// any 32-bit immediate can be built, in at most two instructions
+bool ArmToArm64Assembler::isValidImmediate(uint32_t immed)
+{
+    return true;
+}
+
+int ArmToArm64Assembler::buildImmediate(
+        uint32_t immediate, uint32_t& rot, uint32_t& imm)
+{
+    rot = 0;
+    imm = immediate;
+    return 0;
+}
+
+uint32_t ArmToArm64Assembler::imm(uint32_t immediate)
+{
+    mOperand.value = immediate;
+    return OPERAND_IMM;
+}
+
+uint32_t ArmToArm64Assembler::reg_imm(int Rm, int type, uint32_t shift)
+{
+    LOG_ALWAYS_FATAL_IF(shift > 32, "shift too big (%u)", shift);
+    mOperand.reg = Rm;
+    mOperand.type = type;
+    mOperand.value = shift;
+    return OPERAND_REG_IMM;
+}
+
+uint32_t ArmToArm64Assembler::reg_rrx(int Rm)
+{
+    mOperand.reg = Rm;
+    return OPERAND_RRX;
+}
+
+uint32_t ArmToArm64Assembler::reg_reg(int Rm, int type, int Rs)
+{
+    mOperand.reg = Rm;
+    mOperand.type = type;
+    mOperand.Rs = Rs;
+    return OPERAND_REG_REG;
+}
+
+// addressing modes...
+// LDR(B)/STR(B)/PLD (immediate and Rm can be negative, which indicate U=0)
+uint32_t ArmToArm64Assembler::immed12_pre(int32_t immed12, int W)
+{
+    mAddrMode.offset = immed12;
+    mAddrMode.writeback = W;
+    return AMODE_IMM_PRE;
+}
+
+uint32_t ArmToArm64Assembler::immed12_post(int32_t immed12)
+{
+    mAddrMode.offset = immed12;
+    mAddrMode.writeback = true;
+    return AMODE_IMM_POST;
+}
+
+uint32_t ArmToArm64Assembler::reg_scale_pre(int Rm, int type,
+        uint32_t shift, int W)
+{
+    mAddrMode.reg = abs(Rm);
+    mAddrMode.negative = (Rm < 0);
+    mAddrMode.type = type;
+    mAddrMode.shift = shift;
+    mAddrMode.writeback = W;
+    return AMODE_REG_PRE;
+}
+
+uint32_t ArmToArm64Assembler::reg_scale_post(int Rm, int type, uint32_t shift)
+{
+    mAddrMode.reg = abs(Rm);
+    mAddrMode.negative = (Rm < 0);
+    mAddrMode.type = type;
+    mAddrMode.shift = shift;
+    mAddrMode.writeback = true;
+    return AMODE_REG_POST;
+}
+
+// LDRH/LDRSB/LDRSH/STRH (immediate and Rm can be negative, which indicate U=0)
+uint32_t ArmToArm64Assembler::immed8_pre(int32_t immed8, int W)
+{
+    return immed12_pre(immed8, W);
+}
+
+uint32_t ArmToArm64Assembler::immed8_post(int32_t immed8)
+{
+    return immed12_post(immed8);
+}
+
+uint32_t ArmToArm64Assembler::reg_pre(int Rm, int W)
+{
+    return reg_scale_pre(Rm, LSL, 0, W);
+}
+
+uint32_t ArmToArm64Assembler::reg_post(int Rm)
+{
+    return reg_scale_post(Rm, LSL, 0);
+}
+
+// Returns true if Op2 is a register, shifted by an amount A64 can encode
+// (rotations only if the instruction takes them), in Rm, type and amount.
+bool ArmToArm64Assembler::isShiftedReg(uint32_t Op2,
+        int& Rm, int& type, int& amount, bool rotate)
+{
+    if (Op2 < 16) {
+        Rm = Op2;
+        type = LSL;
+        amount = 0;
+        return true;
+    }
+    if (Op2 != OPERAND_REG_IMM || mOperand.value >= 32) {
+        return false;
+    }
+    Rm = mOperand.reg;
+    type = mOperand.type;
+    amount = mOperand.value;
+    if (amount == 0) {
+        type = LSL;
+    }
+    return rotate || type != ROR;
+}
+
+// Returns the register holding the value of the shifter operand Op2,
+// computing it into tmp if needed.
+int ArmToArm64Assembler::operandToReg(uint32_t Op2, int tmp)
+{
+    if (Op2 < 16) {
+        return Op2;
+    }
+
+    const int Rm = mOperand.reg;
+    const uint32_t amount = mOperand.value;
+    switch (Op2) {
+    case OPERAND_IMM:
+        if (mOperand.value == 0) {
+            return ZR;
+        }
+        loadImmediate(tmp, mOperand.value);
+        return tmp;
+    case OPERAND_REG_IMM:
+        if (amount == 0) {
+            return Rm;
+        }
+        switch (mOperand.type) {
+        case LSL:
+            if (amount == 32)
+                return ZR;
+            emit(A64_BITFIELD(0, 2, tmp, Rm, (32 - amount) & 31, 31 - amount));
+            break;
+        case LSR:
+            if (amount == 32)
+                return ZR;
+            emit(A64_BITFIELD(0, 2, tmp, Rm, amount, 31));
+            break;
+        case ASR:
+            emit(A64_BITFIELD(0, 0, tmp, Rm, amount < 32 ? amount : 31, 31));
+            break;
+        case ROR:
+            if (amount == 32)
+                return Rm;
+            emit(A64_EXTR(tmp, Rm, Rm, amount));
+            break;
+        }
+        return tmp;
+    case OPERAND_REG_REG:
+        emit(A64_SHIFTV(mOperand.type, tmp, Rm, mOperand.Rs));
+        return tmp;
+    }
+
+    LOG_ALWAYS_FATAL("shifter operand %08x not supported", Op2);
+    return ZR;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Data Processing...
+#endif
+
+void ArmToArm64Assembler::dataProcessing(int opcode, int cc,
+        int s, int Rd, int Rn, uint32_t Op2)
+{
+    const bool compare = (opcode >= opTST && opcode <= opCMN);
+    const bool select = (cc != AL) && !s && !compare;
+    uint32_t* skip = select ? 0 : beginConditional(cc);
+    const int dest = select ? int(TMP1) : Rd;
+    int src;
+
+    switch (opcode) {
+    case opAND: case opEOR: case opORR: case opBIC:
+    case opTST: case opTEQ:
+        dataProcessingLogical(opcode, s, dest, Rn, Op2);
+        break;
+    case opADD:
+        dataProcessingAddSub(0, s, dest, Rn, Op2);
+        break;
+    case opSUB:
+        dataProcessingAddSub(1, s, dest, Rn, Op2);
+        break;
+    case opCMP:
+        dataProcessingAddSub(1, 1, ZR, Rn, Op2);
+        break;
+    case opCMN:
+        dataProcessingAddSub(0, 1, ZR, Rn, Op2);
+        break;
+    case opRSB:
+        src = operandToReg(Op2, TMP0);
+        emit(A64_ADDSUB_SHIFT(0, 1, s, dest, src, Rn, LSL, 0));
+        break;
+    case opADC:
+        src = operandToReg(Op2, TMP0);
+        emit(A64_ADDSUB_CARRY(0, s, dest, Rn, src));
+        break;
+    case opSBC:
+        src = operandToReg(Op2, TMP0);
+        emit(A64_ADDSUB_CARRY(1, s, dest, Rn, src));
+        break;
+    case opRSC:
+        src = operandToReg(Op2, TMP0);
+        emit(A64_ADDSUB_CARRY(1, s, dest, src, Rn));
+        break;
+    case opMOV: case opMVN:
+        dataProcessingMove(opcode == opMVN, dest, Op2);
+        if (s) {
+            emit(A64_LOGIC_SHIFT(3, 0, ZR, dest, dest, LSL, 0));    // tst
+        }
+        break;
+    }
+
+    if (select) {
+        emit(A64_CSEL(Rd, TMP1, Rd, cc));
+    }
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::dataProcessingLogical(int opcode, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    int opc = 0, N = 0;
+    bool test = false;
+    switch (opcode) {
+    case opAND: opc = s ? 3 : 0;                    break;
+    case opBIC: opc = s ? 3 : 0;    N = 1;          break;
+    case opORR: opc = 1;            test = s;       break;
+    case opEOR: opc = 2;            test = s;       break;
+    case opTST: opc = 3;            Rd = ZR;        break;
+    case opTEQ: opc = 2;            Rd = TMP1;      test = true;    break;
+    }
+
+    if (Op2 == OPERAND_IMM) {
+        uint32_t immr, imms;
+        uint32_t v = N ? ~mOperand.value : mOperand.value;
+        if (encodeLogicalImmediate(v, immr, imms)) {
+            emit(A64_LOGIC_IMM(opc, Rd, Rn, immr, imms));
+        } else {
+            loadImmediate(TMP0, v);
+            emit(A64_LOGIC_SHIFT(opc, 0, Rd, Rn, TMP0, LSL, 0));
+        }
+    } else {
+        int Rm, type, amount;
+        if (!isShiftedReg(Op2, Rm, type, amount, true)) {
+            Rm = operandToReg(Op2, TMP0);
+            type = LSL;
+            amount = 0;
+        }
+        emit(A64_LOGIC_SHIFT(opc, N, Rd, Rn, Rm, type, amount));
+    }
+
+    if (test) {
+        emit(A64_LOGIC_SHIFT(3, 0, ZR, Rd, Rd, LSL, 0));    // tst
+    }
+}
+
+void ArmToArm64Assembler::dataProcessingAddSub(int sub, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    if (Op2 == OPERAND_IMM) {
+        const uint32_t v = mOperand.value;
+        if (isAddSubImmediate(v)) {
+            emit(A64_ADDSUB_IMM(0, sub, s, Rd, Rn, v));
+        } else if (isAddSubImmediate(-v)) {
+            emit(A64_ADDSUB_IMM(0, !sub, s, Rd, Rn, -v));
+        } else {
+            loadImmediate(TMP0, v);
+            emit(A64_ADDSUB_SHIFT(0, sub, s, Rd, Rn, TMP0, LSL, 0));
+        }
+    } else {
+        int Rm, type, amount;
+        if (!isShiftedReg(Op2, Rm, type, amount, false)) {
+            Rm = operandToReg(Op2, TMP0);
+            type = LSL;
+            amount = 0;
+        }
+        emit(A64_ADDSUB_SHIFT(0, sub, s, Rd, Rn, Rm, type, amount));
+    }
+}
+
+void ArmToArm64Assembler::dataProcessingMove(int invert, int Rd, uint32_t Op2)
+{
+    if (Op2 == OPERAND_IMM) {
+        loadImmediate(Rd, invert ? ~mOperand.value : mOperand.value);
+        return;
+    }
+    int Rm, type, amount;
+    if (!isShiftedReg(Op2, Rm, type, amount, true)) {
+        Rm = operandToReg(Op2, TMP0);
+        type = LSL;
+        amount = 0;
+    }
+    emit(A64_LOGIC_SHIFT(1, invert, Rd, ZR, Rm, type, amount));   // orr/orn
+}
+
+void ArmToArm64Assembler::loadImmediate(int Rd, uint32_t imm)
+{
+    uint32_t immr, imms;
+    if ((imm & 0xFFFF0000) == 0) {
+        emit(A64_MOVE_WIDE(2, Rd, imm, 0));                 // movz
+    } else if ((imm & 0xFFFF) == 0) {
+        emit(A64_MOVE_WIDE(2, Rd, imm >> 16, 1));
+    } else if ((~imm & 0xFFFF0000) == 0) {
+        emit(A64_MOVE_WIDE(0, Rd, ~imm & 0xFFFF, 0));       // movn
+    } else if ((~imm & 0xFFFF) == 0) {
+        emit(A64_MOVE_WIDE(0, Rd, ~imm >> 16, 1));
+    } else if (encodeLogicalImmediate(imm, immr, imms)) {
+        emit(A64_LOGIC_IMM(1, Rd, ZR, immr, imms));         // orr
+    } else {
+        emit(A64_MOVE_WIDE(2, Rd, imm & 0xFFFF, 0));
+        emit(A64_MOVE_WIDE(3, Rd, imm >> 16, 1));           // movk
+    }
+}
+
+// xd = xn + imm, where xd and xn can be sp
+void ArmToArm64Assembler::addImmediateX(int Rd, int Rn, int32_t imm)
+{
+    if (imm == 0 && Rd == Rn) {
+        return;
+    }
+    if (imm >= 0 && isAddSubImmediate(imm)) {
+        emit(A64_ADDSUB_IMM(1, 0, 0, Rd, Rn, imm));
+    } else if (imm < 0 && isAddSubImmediate(-uint32_t(imm))) {
+        emit(A64_ADDSUB_IMM(1, 1, 0, Rd, Rn, -uint32_t(imm)));
+    } else {
+        loadImmediate(TMP0, imm);
+        emit(A64_ADDSUB_EXT(1, 0, 0, Rd, Rn, TMP0, 6, 0));   // sxtw
+    }
+}
+
+void ArmToArm64Assembler::addressArithmetic(int sub, int cc,
+        int Rd, int Rn, uint32_t Op2)
+{
+    uint32_t* skip = beginConditional(cc);
+    if (Op2 == OPERAND_IMM) {
+        const int32_t v = int32_t(mOperand.value);
+        addImmediateX(Rd, Rn, sub ? -v : v);
+    } else {
+        int Rm, type, amount;
+        if (!isShiftedReg(Op2, Rm, type, amount, false) ||
+                type != LSL || amount > 4) {
+            Rm = operandToReg(Op2, TMP0);
+            amount = 0;
+        }
+        emit(A64_ADDSUB_EXT(1, sub, 0, Rd, Rn, Rm, 6, amount));  // sxtw
+    }
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::ADDR_ADD(int cc, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    LOG_ALWAYS_FATAL_IF(s, "ADDR_ADD doesn't set the flags");
+    addressArithmetic(0, cc, Rd, Rn, Op2);
+}
+
+void ArmToArm64Assembler::ADDR_SUB(int cc, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    LOG_ALWAYS_FATAL_IF(s, "ADDR_SUB doesn't set the flags");
+    addressArithmetic(1, cc, Rd, Rn, Op2);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Multiply...
+#endif
+
+// multiply...
+void ArmToArm64Assembler::MLA(int cc, int s,
+        int Rd, int Rm, int Rs, int Rn) {
+    uint32_t* skip = beginConditional(cc);
+    emit(A64_MADD(Rd, Rm, Rs, Rn));
+    if (s) {
+        emit(A64_LOGIC_SHIFT(3, 0, ZR, Rd, Rd, LSL, 0));    // tst
+    }
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::MUL(int cc, int s,
+        int Rd, int Rm, int Rs) {
+    MLA(cc, s, Rd, Rm, Rs, ZR);
+}
+
+// RdHi:RdLo = Rm * Rs (+ RdHi:RdLo), through x16
+void ArmToArm64Assembler::multiplyLong(int sign, int accumulate, int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs)
+{
+    uint32_t* skip = beginConditional(cc);
+    int Ra = ZR;
+    if (accumulate) {
+        emit(A64_BITFIELD(1, 2, TMP1, RdHi, 32, 31));           // lsl x17, xhi, #32
+        emit(A64_ADDSUB_EXT(1, 0, 0, TMP1, TMP1, RdLo, 2, 0));  // add x17, x17, wlo, uxtw
+        Ra = TMP1;
+    }
+    emit(A64_MADDL(sign, TMP0, Rm, Rs, Ra));
+    emit(A64_LOGIC_SHIFT(1, 0, RdLo, ZR, TMP0, LSL, 0));        // mov wlo, w16
+    emit(A64_BITFIELD(1, 2, RdHi, TMP0, 32, 63));               // lsr xhi, x16, #32
+    if (s) {
+        emit((1U<<31) | A64_LOGIC_SHIFT(3, 0, ZR, TMP0, TMP0, LSL, 0));  // tst x16
+    }
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::UMULL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    multiplyLong(0, 0, cc, s, RdLo, RdHi, Rm, Rs);
+}
+
+void ArmToArm64Assembler::UMUAL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    multiplyLong(0, 1, cc, s, RdLo, RdHi, Rm, Rs);
+}
+
+void ArmToArm64Assembler::SMULL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    multiplyLong(1, 0, cc, s, RdLo, RdHi, Rm, Rs);
+}
+
+void ArmToArm64Assembler::SMUAL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    multiplyLong(1, 1, cc, s, RdLo, RdHi, Rm, Rs);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Data Transfer...
+#endif
+
+// data transfer...
+void ArmToArm64Assembler::dataTransfer(ldst_t op, int cc,
+        int Rt, int Rn, uint32_t offset)
+{
+    // work-around for ARM default address mode of immed12_pre(0)
+    if (offset == 0 || offset > AMODE_UNSUPPORTED) {
+        offset = immed12_pre(0);
+    }
+
+    uint32_t* skip = beginConditional(cc);
+
+    if (Rn == SP) {
+        // GGLAssembler only pushes and pops through sp (see Spill), and
+        // every register takes a 16-byte slot
+        const int32_t o = mAddrMode.offset;
+        if (offset == AMODE_IMM_PRE && mAddrMode.writeback && o < 0 &&
+                op == opSTRW) {
+            emit(A64_LDST_SIMM(opSTRX, Rt, A64_SP, -16, 3));    // str xt, [sp, #-16]!
+        } else if (offset == AMODE_IMM_POST && o > 0 && op == opLDRW) {
+            emit(A64_LDST_SIMM(opLDRX, Rt, A64_SP, 16, 1));     // ldr xt, [sp], #16
+        } else {
+            LOG_ALWAYS_FATAL("only push and pop through sp are supported");
+        }
+        endConditional(skip);
+        return;
+    }
+
+    const int size = sLoadStoreOps[op] >> 30;
+    const int32_t o = mAddrMode.offset;
+    switch (offset) {
+    case AMODE_IMM_PRE:
+        if (mAddrMode.writeback) {
+            if (o >= -256 && o < 256) {
+                emit(A64_LDST_SIMM(op, Rt, Rn, o, 3));
+            } else {
+                addImmediateX(Rn, Rn, o);
+                emit(A64_LDST_IMM(op, Rt, Rn, 0));
+            }
+        } else if (o >= 0 && !(o & ((1<<size)-1)) && (o >> size) < 4096) {
+            emit(A64_LDST_IMM(op, Rt, Rn, o >> size));
+        } else if (o >= -256 && o < 256) {
+            emit(A64_LDST_SIMM(op, Rt, Rn, o, 0));             // ldur/stur
+        } else {
+            loadImmediate(TMP0, o);
+            emit(A64_LDST_REG(op, Rt, Rn, TMP0, 0));
+        }
+        break;
+    case AMODE_IMM_POST:
+        if (o >= -256 && o < 256) {
+            emit(A64_LDST_SIMM(op, Rt, Rn, o, 1));
+        } else {
+            emit(A64_LDST_IMM(op, Rt, Rn, 0));
+            addImmediateX(Rn, Rn, o);
+        }
+        break;
+    case AMODE_REG_PRE:
+    case AMODE_REG_POST: {
+        const int Rm = mAddrMode.reg;
+        const int type = mAddrMode.type;
+        const uint32_t shift = mAddrMode.shift;
+        const int sub = mAddrMode.negative;
+        if (offset == AMODE_REG_PRE && !mAddrMode.writeback && !sub &&
+                (type == LSL || shift == 0) &&
+                (shift == 0 || int(shift) == size)) {
+            emit(A64_LDST_REG(op, Rt, Rn, Rm, shift != 0));
+            break;
+        }
+        if (offset == AMODE_REG_POST) {
+            emit(A64_LDST_IMM(op, Rt, Rn, 0));
+        }
+        const int base = mAddrMode.writeback ? Rn : int(TMP0);
+        if ((type == LSL || shift == 0) && shift <= 4) {
+            emit(A64_ADDSUB_EXT(1, sub, 0, base, Rn, Rm, 6, shift));
+        } else {
+            const int index = operandToReg(reg_imm(Rm, type, shift), TMP0);
+            emit(A64_ADDSUB_EXT(1, sub, 0, base, Rn, index, 6, 0));
+        }
+        if (offset == AMODE_REG_PRE) {
+            emit(A64_LDST_IMM(op, Rt, base, 0));
+        }
+        break;
+    }
+    default:
+        LOG_ALWAYS_FATAL("address mode %08x not supported", offset);
+    }
+
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::LDR(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opLDRW, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::LDRB(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opLDRB, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::STR(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opSTRW, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::STRB(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opSTRB, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::LDRH(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opLDRH, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::LDRSB(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opLDRSB, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::LDRSH(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opLDRSH, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::STRH(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opSTRH, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::ADDR_LDR(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opLDRX, cc, Rd, Rn, offset);
+}
+void ArmToArm64Assembler::ADDR_STR(int cc, int Rd, int Rn, uint32_t offset) {
+    dataTransfer(opSTRX, cc, Rd, Rn, offset);
+}
+
+// block data transfer, only as push and pop through sp...
+void ArmToArm64Assembler::LDM(int cc, int dir,
+        int Rn, int W, uint32_t reg_list)
+{
+    LOG_ALWAYS_FATAL_IF(Rn != SP || !W || (dir != IA && dir != FD),
+                        "LDM only supported as a pop from sp");
+    int regs[16], count = 0;
+    for (int r = 0; r < 16; r++) {
+        if (reg_list & (1 << r))
+            regs[count++] = r;
+    }
+    uint32_t* skip = beginConditional(cc);
+    for (int i = 0; i < count; i += 2) {
+        if (i + 1 < count) {
+            emit(A64_LDSTP_X(1, 2, regs[i], regs[i+1], A64_SP, i*8));
+        } else {
+            emit(A64_LDST_IMM(opLDRX, regs[i], A64_SP, i));
+        }
+    }
+    addImmediateX(A64_SP, A64_SP, ((count + 1) / 2) * 16);
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::STM(int cc, int dir,
+        int Rn, int W, uint32_t reg_list)
+{
+    LOG_ALWAYS_FATAL_IF(Rn != SP || !W || (dir != DB && dir != FD),
+                        "STM only supported as a push to sp");
+    int regs[16], count = 0;
+    for (int r = 0; r < 16; r++) {
+        if (reg_list & (1 << r))
+            regs[count++] = r;
+    }
+    uint32_t* skip = beginConditional(cc);
+    addImmediateX(A64_SP, A64_SP, -((count + 1) / 2) * 16);
+    for (int i = 0; i < count; i += 2) {
+        if (i + 1 < count) {
+            emit(A64_LDSTP_X(0, 2, regs[i], regs[i+1], A64_SP, i*8));
+        } else {
+            emit(A64_LDST_IMM(opSTRX, regs[i], A64_SP, i));
+        }
+    }
+    endConditional(skip);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Special...
+#endif
+
+// special...
+void ArmToArm64Assembler::SWP(int cc, int Rn, int Rd, int Rm) {
+    NOT_IMPLEMENTED();
+}
+void ArmToArm64Assembler::SWPB(int cc, int Rn, int Rd, int Rm) {
+    NOT_IMPLEMENTED();
+}
+void ArmToArm64Assembler::SWI(int cc, uint32_t comment) {
+    NOT_IMPLEMENTED();
+}
+
+#if 0
+#pragma mark -
+#pragma mark DSP instructions...
+#endif
+
+// DSP instructions...
+void ArmToArm64Assembler::PLD(int Rn, uint32_t offset) {
+    LOG_ALWAYS_FATAL_IF(offset != AMODE_IMM_PRE || mAddrMode.writeback,
+                        "PLD only P=1, W=0");
+    const int32_t o = mAddrMode.offset;
+    if (o >= 0 && !(o & 7) && o < 8*4096) {
+        emit(0xF9800000 | ((o >> 3) << 10) | (Rn << 5));          // prfm pldl1keep
+    } else if (o >= -256 && o < 256) {
+        emit(0xF8800000 | ((o & 0x1FF) << 12) | (Rn << 5));      // prfum pldl1keep
+    }
+    // it's only a hint, other offsets are just dropped
+}
+
+void ArmToArm64Assembler::CLZ(int cc, int Rd, int Rm)
+{
+    uint32_t* skip = beginConditional(cc);
+    emit(0x5AC01000 | (Rm << 5) | Rd);
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::QADD(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToArm64Assembler::QDADD(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToArm64Assembler::QSUB(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToArm64Assembler::QDSUB(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+// Rd = sign-extended bottom or top half of Rm
+void ArmToArm64Assembler::halfword(int Rd, int Rm, int top)
+{
+    if (top) {
+        emit(A64_BITFIELD(0, 0, Rd, Rm, 16, 31));   // asr #16
+    } else {
+        emit(A64_BITFIELD(0, 0, Rd, Rm, 0, 15));    // sxth
+    }
+}
+
+// 16 x 16 multiplication
+void ArmToArm64Assembler::SMUL(int cc, int xy,
+                int Rd, int Rm, int Rs)
+{
+    SMLA(cc, xy, Rd, Rm, Rs, ZR);
+}
+
+// 32 x 16 multiplication
+void ArmToArm64Assembler::SMULW(int cc, int y,
+                int Rd, int Rm, int Rs)
+{
+    uint32_t* skip = beginConditional(cc);
+    halfword(TMP1, Rs, y & yT);
+    emit(A64_MADDL(1, TMP0, Rm, TMP1, ZR));             // smull x16, wm, w17
+    emit(A64_BITFIELD(1, 2, Rd, TMP0, 16, 47));         // ubfx xd, x16, #16, #32
+    endConditional(skip);
+}
+
+// 16 x 16 multiplication and accumulate
+void ArmToArm64Assembler::SMLA(int cc, int xy,
+                int Rd, int Rm, int Rs, int Rn)
+{
+    uint32_t* skip = beginConditional(cc);
+    halfword(TMP0, Rm, xy & xyTB);
+    halfword(TMP1, Rs, xy & xyBT);
+    emit(A64_MADD(Rd, TMP0, TMP1, Rn));
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::SMLAL(int cc, int xy,
+                int RdHi, int RdLo, int Rs, int Rm)
+{
+    uint32_t* skip = beginConditional(cc);
+    halfword(TMP0, Rm, xy & xyTB);
+    halfword(TMP1, Rs, xy & xyBT);
+    emit(A64_MADDL(1, TMP0, TMP0, TMP1, ZR));               // smull x16, w16, w17
+    emit(A64_BITFIELD(1, 2, TMP1, RdHi, 32, 31));           // lsl x17, xhi, #32
+    emit(A64_ADDSUB_EXT(1, 0, 0, TMP1, TMP1, RdLo, 2, 0));  // add x17, x17, wlo, uxtw
+    emit(A64_ADDSUB_SHIFT(1, 0, 0, TMP0, TMP0, TMP1, LSL, 0));
+    emit(A64_LOGIC_SHIFT(1, 0, RdLo, ZR, TMP0, LSL, 0));    // mov wlo, w16
+    emit(A64_BITFIELD(1, 2, RdHi, TMP0, 32, 63));           // lsr xhi, x16, #32
+    endConditional(skip);
+}
+
+void ArmToArm64Assembler::SMLAW(int cc, int y,
+                int Rd, int Rm, int Rs, int Rn)
+{
+    uint32_t* skip = beginConditional(cc);
+    halfword(TMP1, Rs, y & yT);
+    emit(A64_MADDL(1, TMP0, Rm, TMP1, ZR));             // smull x16, wm, w17
+    emit(A64_BITFIELD(1, 2, TMP0, TMP0, 16, 47));       // ubfx x16, x16, #16, #32
+    emit(A64_ADDSUB_SHIFT(0, 0, 0, Rd, TMP0, Rn, LSL, 0));
+    endConditional(skip);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Byte/half word extract and extend (ARMv6+ only)...
+#endif
+
+void ArmToArm64Assembler::UXTB16(int cc, int Rd, int Rm, int rotate)
+{
+    uint32_t immr, imms;
+    encodeLogicalImmediate(0x00FF00FF, immr, imms);
+
+    uint32_t* skip = beginConditional(cc);
+    int src = Rm;
+    if (rotate) {
+        emit(A64_EXTR(TMP0, Rm, Rm, rotate));           // ror
+        src = TMP0;
+    }
+    emit(A64_LOGIC_IMM(0, Rd, src, immr, imms));        // and #0x00ff00ff
+    endConditional(skip);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Bit manipulation (ARMv7+ only)...
+#endif
+
+// Bit manipulation (ARMv7+ only)...
+void ArmToArm64Assembler::UBFX(int cc, int Rd, int Rn, int lsb, int width)
+{
+    uint32_t* skip = beginConditional(cc);
+    emit(A64_BITFIELD(0, 2, Rd, Rn, lsb, lsb + width - 1));
+    endConditional(skip);
+}
+
+#if 0
+#pragma mark -
+#pragma mark A64 encodings...
+#endif
+
+// Finds the A64 bitmask immediate encoding of imm, a rotated run of ones
+// repeated in 2, 4, 8, 16 or 32-bit elements, for 32-bit instructions.
+bool ArmToArm64Assembler::encodeLogicalImmediate(uint32_t imm,
+        uint32_t& immr, uint32_t& imms)
+{
+    if (imm == 0 || imm == 0xFFFFFFFF) {
+        return false;
+    }
+
+    uint32_t size = 32;
+    while (size > 2) {
+        const uint32_t half = size / 2;
+        const uint32_t mask = (1U << half) - 1;
+        if ((imm & mask) != ((imm >> half) & mask))
+            break;
+        size = half;
+    }
+
+    const uint32_t mask = (size == 32) ? 0xFFFFFFFF : ((1U << size) - 1);
+    const uint32_t element = imm & mask;
+    const int ones = __builtin_popcount(element);
+    const uint32_t run = (1U << ones) - 1;
+    for (uint32_t r = 0; r < size; r++) {
+        uint32_t rotated = r ? ((run >> r) | (run << (size - r))) & mask : run;
+        if (rotated == element) {
+            immr = r;
+            imms = ((~(size - 1) << 1) | (ones - 1)) & 0x3F;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ArmToArm64Assembler::isAddSubImmediate(uint32_t imm)
+{
+    return imm < 0x1000 || (!(imm & 0xFFF) && imm < 0x1000000);
+}
+
+uint32_t ArmToArm64Assembler::A64_ADDSUB_IMM(int sf, int sub, int s,
+        int Rd, int Rn, uint32_t imm)
+{
+    uint32_t shift = 0;
+    if (imm >= 0x1000) {
+        imm >>= 12;
+        shift = 1;
+    }
+    return (sf << 31) | (sub << 30) | (s << 29) | 0x11000000 |
+            (shift << 22) | (imm << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_ADDSUB_SHIFT(int sf, int sub, int s,
+        int Rd, int Rn, int Rm, int type, int amount)
+{
+    return (sf << 31) | (sub << 30) | (s << 29) | 0x0B000000 |
+            (type << 22) | (Rm << 16) | (amount << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_ADDSUB_EXT(int sf, int sub, int s,
+        int Rd, int Rn, int Rm, int option, int amount)
+{
+    return (sf << 31) | (sub << 30) | (s << 29) | 0x0B200000 |
+            (Rm << 16) | (option << 13) | (amount << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_LOGIC_SHIFT(int opc, int N,
+        int Rd, int Rn, int Rm, int type, int amount)
+{
+    return (opc << 29) | 0x0A000000 | (type << 22) | (N << 21) |
+            (Rm << 16) | (amount << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_LOGIC_IMM(int opc,
+        int Rd, int Rn, uint32_t immr, uint32_t imms)
+{
+    return (opc << 29) | 0x12000000 | (immr << 16) | (imms << 10) |
+            (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_ADDSUB_CARRY(int sub, int s,
+        int Rd, int Rn, int Rm)
+{
+    return (sub << 30) | (s << 29) | 0x1A000000 | (Rm << 16) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_MOVE_WIDE(int opc, int Rd,
+        uint32_t imm16, int hw)
+{
+    return (opc << 29) | 0x12800000 | (hw << 21) | (imm16 << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_BITFIELD(int sf, int opc,
+        int Rd, int Rn, int immr, int imms)
+{
+    return (sf << 31) | (opc << 29) | 0x13000000 | (sf << 22) |
+            (immr << 16) | (imms << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_EXTR(int Rd, int Rn, int Rm, int lsb)
+{
+    return 0x13800000 | (Rm << 16) | (lsb << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_SHIFTV(int type, int Rd, int Rn, int Rm)
+{
+    return 0x1AC02000 | (Rm << 16) | (type << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_MADD(int Rd, int Rn, int Rm, int Ra)
+{
+    return 0x1B000000 | (Rm << 16) | (Ra << 10) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_MADDL(int sign, int Rd, int Rn, int Rm, int Ra)
+{
+    return 0x9B200000 | ((sign ? 0 : 1) << 23) | (Rm << 16) | (Ra << 10) |
+            (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_CSEL(int Rd, int Rn, int Rm, int cc)
+{
+    return 0x1A800000 | (Rm << 16) | (cc << 12) | (Rn << 5) | Rd;
+}
+
+uint32_t ArmToArm64Assembler::A64_LDST_IMM(ldst_t op, int Rt, int Rn,
+        uint32_t imm12)
+{
+    return sLoadStoreOps[op] | (imm12 << 10) | (Rn << 5) | Rt;
+}
+
+// mode is 0 for an unscaled offset, 1 for post-index and 3 for pre-index
+uint32_t ArmToArm64Assembler::A64_LDST_SIMM(ldst_t op, int Rt, int Rn,
+        int32_t simm9, int mode)
+{
+    return (sLoadStoreOps[op] & ~(1 << 24)) | ((simm9 & 0x1FF) << 12) |
+            (mode << 10) | (Rn << 5) | Rt;
+}
+
+// [xn, wm, sxtw {#size}]
+uint32_t ArmToArm64Assembler::A64_LDST_REG(ldst_t op, int Rt, int Rn,
+        int Rm, int scaled)
+{
+    return (sLoadStoreOps[op] & ~(1 << 24)) | (1 << 21) | (Rm << 16) |
+            (6 << 13) | (scaled << 12) | (2 << 10) | (Rn << 5) | Rt;
+}
+
+// mode is 1 for post-index, 2 for a signed offset and 3 for pre-index
+uint32_t ArmToArm64Assembler::A64_LDSTP_X(int load, int mode,
+        int Rt, int Rt2, int Rn, int32_t offset)
+{
+    return 0xA8000000 | (mode << 23) | (load << 22) |
+            (((offset / 8) & 0x7F) << 15) | (Rt2 << 10) | (Rn << 5) | Rt;
+}
+
+}; // namespace android
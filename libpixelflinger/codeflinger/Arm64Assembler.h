@@ -0,0 +1,287 @@
+/* libs/pixelflinger/codeflinger/Arm64Assembler.h
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_ARM64ASSEMBLER_H
+#define ANDROID_ARM64ASSEMBLER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tinyutils/Vector.h"
+#include "tinyutils/KeyedVector.h"
+#include "tinyutils/smartpointer.h"
+
+#include "ARMAssemblerInterface.h"
+#include "CodeCache.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// this class mimics ARMAssembler interface
+//  intent is to translate each ARM instruction to 1 or more A64 instr
+//  ARM registers r0-r14 are used as w0-w14, and hold 64-bit pointers
+//  as x0-x14 whenever they are used through the ADDR_xxx instructions
+class ArmToArm64Assembler : public ARMAssemblerInterface
+{
+public:
+                ArmToArm64Assembler(const sp<Assembly>& assembly);
+    virtual     ~ArmToArm64Assembler();
+
+    uint32_t*   base() const;
+    uint32_t*   pc() const;
+
+    void        disassemble(const char* name);
+
+    // ------------------------------------------------------------------------
+    // ARMAssemblerInterface...
+    // ------------------------------------------------------------------------
+
+    virtual void    reset();
+
+    virtual int     generate(const char* name);
+    virtual int     getCodegenArch();
+
+    virtual void    prolog();
+    virtual void    epilog(uint32_t touched);
+    virtual void    comment(const char* string);
+
+
+    // -----------------------------------------------------------------------
+    // shifters and addressing modes
+    // -----------------------------------------------------------------------
+
+    // shifters...
+    virtual bool        isValidImmediate(uint32_t immed);
+    virtual int         buildImmediate(uint32_t i, uint32_t& rot, uint32_t& imm);
+
+    virtual uint32_t    imm(uint32_t immediate);
+    virtual uint32_t    reg_imm(int Rm, int type, uint32_t shift);
+    virtual uint32_t    reg_rrx(int Rm);
+    virtual uint32_t    reg_reg(int Rm, int type, int Rs);
+
+    // addressing modes...
+    // LDR(B)/STR(B)/PLD
+    // (immediate and Rm can be negative, which indicates U=0)
+    virtual uint32_t    immed12_pre(int32_t immed12, int W=0);
+    virtual uint32_t    immed12_post(int32_t immed12);
+    virtual uint32_t    reg_scale_pre(int Rm, int type=0, uint32_t shift=0, int W=0);
+    virtual uint32_t    reg_scale_post(int Rm, int type=0, uint32_t shift=0);
+
+    // LDRH/LDRSB/LDRSH/STRH
+    // (immediate and Rm can be negative, which indicates U=0)
+    virtual uint32_t    immed8_pre(int32_t immed8, int W=0);
+    virtual uint32_t    immed8_post(int32_t immed8);
+    virtual uint32_t    reg_pre(int Rm, int W=0);
+    virtual uint32_t    reg_post(int Rm);
+
+
+    virtual void    dataProcessing(int opcode, int cc, int s,
+                                int Rd, int Rn,
+                                uint32_t Op2);
+    virtual void MLA(int cc, int s,
+                int Rd, int Rm, int Rs, int Rn);
+    virtual void MUL(int cc, int s,
+                int Rd, int Rm, int Rs);
+    virtual void UMULL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void UMUAL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void SMULL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void SMUAL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+
+    virtual void B(int cc, uint32_t* pc);
+    virtual void BL(int cc, uint32_t* pc);
+    virtual void BX(int cc, int Rn);
+    virtual void label(const char* theLabel);
+    virtual void B(int cc, const char* label);
+    virtual void BL(int cc, const char* label);
+
+    virtual uint32_t* pcForLabel(const char* label);
+
+    virtual void LDR (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRB(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void STR (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void STRB(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRH (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRSB(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRSH(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void STRH (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+
+    virtual void LDM(int cc, int dir,
+                int Rn, int W, uint32_t reg_list);
+    virtual void STM(int cc, int dir,
+                int Rn, int W, uint32_t reg_list);
+
+    virtual void SWP(int cc, int Rn, int Rd, int Rm);
+    virtual void SWPB(int cc, int Rn, int Rd, int Rm);
+    virtual void SWI(int cc, uint32_t comment);
+
+    virtual void PLD(int Rn, uint32_t offset);
+    virtual void CLZ(int cc, int Rd, int Rm);
+    virtual void QADD(int cc, int Rd, int Rm, int Rn);
+    virtual void QDADD(int cc, int Rd, int Rm, int Rn);
+    virtual void QSUB(int cc, int Rd, int Rm, int Rn);
+    virtual void QDSUB(int cc, int Rd, int Rm, int Rn);
+    virtual void SMUL(int cc, int xy,
+                int Rd, int Rm, int Rs);
+    virtual void SMULW(int cc, int y,
+                int Rd, int Rm, int Rs);
+    virtual void SMLA(int cc, int xy,
+                int Rd, int Rm, int Rs, int Rn);
+    virtual void SMLAL(int cc, int xy,
+                int RdHi, int RdLo, int Rs, int Rm);
+    virtual void SMLAW(int cc, int y,
+                int Rd, int Rm, int Rs, int Rn);
+
+    // byte/half word extract...
+    virtual void UXTB16(int cc, int Rd, int Rm, int rotate);
+
+    // bit manipulation...
+    virtual void UBFX(int cc, int Rd, int Rn, int lsb, int width);
+
+    // pointer arithmetic and pointer transfer, on the x registers...
+    virtual void ADDR_LDR(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void ADDR_STR(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void ADDR_ADD(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+    virtual void ADDR_SUB(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+
+private:
+    ArmToArm64Assembler(const ArmToArm64Assembler& rhs);
+    ArmToArm64Assembler& operator = (const ArmToArm64Assembler& rhs);
+
+    // A64 registers with a fixed use
+    enum {
+        TMP0 = 16,      // ip0, holds the value of a shifter operand
+        TMP1 = 17,      // ip1, holds the result of a conditional op
+        ZR = 31,        // wzr / xzr ...
+        A64_SP = 31     // ... or sp, depending on the instruction
+    };
+
+    // loads and stores, in the order of their encodings in Arm64Assembler.cpp
+    enum ldst_t {
+        opSTRB, opLDRB, opLDRSB, opSTRH, opLDRH, opLDRSH,
+        opSTRW, opLDRW, opSTRX, opLDRX
+    };
+
+    enum operand_types {
+        // start above the range of legal arm reg #'s (0-15)
+        OPERAND_IMM = 0x20, OPERAND_REG_IMM, OPERAND_REG_REG, OPERAND_RRX,
+        AMODE_IMM_PRE, AMODE_IMM_POST,      // for load/store
+        AMODE_REG_PRE, AMODE_REG_POST,
+        AMODE_UNSUPPORTED
+    };
+
+    struct operand_t {      // shifter operand of the current ARM instruction
+        int         reg;
+        int         type;
+        uint32_t    value;  // immediate or shift amount
+        int         Rs;
+    } mOperand;
+
+    struct addr_mode_t {    // address mode of the current ARM instruction
+        int         reg;
+        int         type;
+        uint32_t    shift;
+        int32_t     offset;
+        bool        negative;   // the index register is subtracted
+        bool        writeback;  // writeback the adr reg after modification
+    } mAddrMode;
+
+    void        emit(uint32_t insn);
+
+    // conditional execution, for what csel can't do
+    uint32_t*   beginConditional(int cc);
+    void        endConditional(uint32_t* skip);
+
+    // shifter operands
+    int         operandToReg(uint32_t Op2, int tmp);
+    bool        isShiftedReg(uint32_t Op2, int& Rm, int& type, int& amount, bool rotate);
+
+    void        dataProcessingLogical(int opcode, int s, int Rd, int Rn, uint32_t Op2);
+    void        dataProcessingAddSub(int sub, int s, int Rd, int Rn, uint32_t Op2);
+    void        dataProcessingMove(int invert, int Rd, uint32_t Op2);
+    void        loadImmediate(int Rd, uint32_t imm);
+    void        addImmediateX(int Rd, int Rn, int32_t imm);
+    void        addressArithmetic(int sub, int cc, int Rd, int Rn, uint32_t Op2);
+
+    void        dataTransfer(ldst_t op, int cc, int Rt, int Rn, uint32_t offset);
+
+    void        halfword(int Rd, int Rm, int top);
+    void        multiplyLong(int sign, int accumulate, int cc, int s,
+                        int RdLo, int RdHi, int Rm, int Rs);
+
+    // A64 encodings
+    static bool encodeLogicalImmediate(uint32_t imm, uint32_t& immr, uint32_t& imms);
+    static bool isAddSubImmediate(uint32_t imm);
+    uint32_t    A64_ADDSUB_IMM(int sf, int sub, int s, int Rd, int Rn, uint32_t imm);
+    uint32_t    A64_ADDSUB_SHIFT(int sf, int sub, int s, int Rd, int Rn,
+                        int Rm, int type, int amount);
+    uint32_t    A64_ADDSUB_EXT(int sf, int sub, int s, int Rd, int Rn,
+                        int Rm, int option, int amount);
+    uint32_t    A64_LOGIC_SHIFT(int opc, int N, int Rd, int Rn,
+                        int Rm, int type, int amount);
+    uint32_t    A64_LOGIC_IMM(int opc, int Rd, int Rn, uint32_t immr, uint32_t imms);
+    uint32_t    A64_ADDSUB_CARRY(int sub, int s, int Rd, int Rn, int Rm);
+    uint32_t    A64_MOVE_WIDE(int opc, int Rd, uint32_t imm16, int hw);
+    uint32_t    A64_BITFIELD(int sf, int opc, int Rd, int Rn, int immr, int imms);
+    uint32_t    A64_EXTR(int Rd, int Rn, int Rm, int lsb);
+    uint32_t    A64_SHIFTV(int type, int Rd, int Rn, int Rm);
+    uint32_t    A64_MADD(int Rd, int Rn, int Rm, int Ra);
+    uint32_t    A64_MADDL(int sign, int Rd, int Rn, int Rm, int Ra);
+    uint32_t    A64_CSEL(int Rd, int Rn, int Rm, int cc);
+    uint32_t    A64_LDST_IMM(ldst_t op, int Rt, int Rn, uint32_t imm12);
+    uint32_t    A64_LDST_SIMM(ldst_t op, int Rt, int Rn, int32_t simm9, int mode);
+    uint32_t    A64_LDST_REG(ldst_t op, int Rt, int Rn, int Rm, int scaled);
+    uint32_t    A64_LDSTP_X(int load, int mode, int Rt, int Rt2, int Rn, int32_t offset);
+
+    sp<Assembly>    mAssembly;
+    uint32_t*       mBase;
+    uint32_t*       mPC;
+    int64_t         mDuration;
+
+    struct branch_target_t {
+        inline branch_target_t() : label(0), pc(0) { }
+        inline branch_target_t(const char* l, uint32_t* p)
+            : label(l), pc(p) { }
+        const char* label;
+        uint32_t*   pc;
+    };
+
+    Vector<branch_target_t>                 mBranchTargets;
+    KeyedVector< const char*, uint32_t* >   mLabels;
+    KeyedVector< uint32_t*, const char* >   mLabelsInverseMapping;
+    KeyedVector< uint32_t*, const char* >   mComments;
+};
+
+}; // namespace android
+
+#endif //ANDROID_ARM64ASSEMBLER_H
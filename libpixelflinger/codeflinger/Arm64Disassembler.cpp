@@ -0,0 +1,261 @@
+/* libs/pixelflinger/codeflinger/Arm64Disassembler.cpp
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Arm64Disassembler.h"
+
+/*
+ * Only decodes the instructions ArmToArm64Assembler generates, for the
+ * debug.pf.disasm output; the operands are printed in the order of the
+ * A64 assembly syntax, without aliases except mov, tst/cmp and ret.
+ */
+
+static const char* const sConditions[16] = {
+    "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+    "hi", "ls", "ge", "lt", "gt", "le", "al", "nv"
+};
+
+static const char* const sShifts[4] = { "lsl", "lsr", "asr", "ror" };
+
+static const char* const sExtends[8] = {
+    "uxtb", "uxth", "uxtw", "uxtx", "sxtb", "sxth", "sxtw", "sxtx"
+};
+
+// register r of width sf, where 31 is either the zero register or sp
+static const char* reg(char* buf, int sf, int r, bool sp)
+{
+    if (r == 31) {
+        strcpy(buf, sp ? (sf ? "sp" : "wsp") : (sf ? "xzr" : "wzr"));
+    } else {
+        sprintf(buf, "%c%d", sf ? 'x' : 'w', r);
+    }
+    return buf;
+}
+
+static inline int field(uint32_t code, int lsb, int width)
+{
+    return (code >> lsb) & ((1U << width) - 1);
+}
+
+// sign-extended field
+static inline int sfield(uint32_t code, int lsb, int width)
+{
+    return int32_t(code << (32 - lsb - width)) >> (32 - width);
+}
+
+// the 32-bit value of a logical immediate
+static uint32_t decodeLogicalImmediate(int immr, int imms)
+{
+    int size = 32;
+    while (size > 2 && (imms & size))
+        size >>= 1;
+    const int ones = (imms & (size - 1)) + 1;
+    const uint32_t mask = (size == 32) ? 0xFFFFFFFF : ((1U << size) - 1);
+    uint32_t elt = (ones == 32) ? 0xFFFFFFFF : ((1U << ones) - 1);
+    if (immr)
+        elt = ((elt >> immr) | (elt << (size - immr))) & mask;
+    uint32_t imm = 0;
+    for (int i = 0; i < 32; i += size)
+        imm |= elt << i;
+    return imm;
+}
+
+int arm64_disassemble(uint32_t code, char* instr)
+{
+    char d[8], n[8], m[8], a[8];
+    const int sf = code >> 31;
+    const int Rd = field(code, 0, 5);
+    const int Rn = field(code, 5, 5);
+    const int Rm = field(code, 16, 5);
+
+    if ((code & 0x1F000000) == 0x11000000) {
+        // add/sub (immediate)
+        const int sub = field(code, 30, 1), s = field(code, 29, 1);
+        const int imm = field(code, 10, 12) << (field(code, 22, 1) * 12);
+        if (s && Rd == 31) {
+            sprintf(instr, "%s %s, #0x%x", sub ? "cmp" : "cmn",
+                    reg(n, sf, Rn, true), imm);
+        } else {
+            sprintf(instr, "%s%s %s, %s, #0x%x", sub ? "sub" : "add",
+                    s ? "s" : "", reg(d, sf, Rd, !s), reg(n, sf, Rn, true), imm);
+        }
+    } else if ((code & 0x1F200000) == 0x0B000000) {
+        // add/sub (shifted register)
+        const int sub = field(code, 30, 1), s = field(code, 29, 1);
+        sprintf(instr, "%s%s %s, %s, %s, %s #%d", sub ? "sub" : "add",
+                s ? "s" : "", reg(d, sf, Rd, false), reg(n, sf, Rn, false),
+                reg(m, sf, Rm, false), sShifts[field(code, 22, 2)],
+                field(code, 10, 6));
+    } else if ((code & 0x1F200000) == 0x0B200000) {
+        // add/sub (extended register)
+        const int sub = field(code, 30, 1), s = field(code, 29, 1);
+        const int option = field(code, 13, 3);
+        sprintf(instr, "%s%s %s, %s, %s, %s #%d", sub ? "sub" : "add",
+                s ? "s" : "", reg(d, sf, Rd, !s), reg(n, sf, Rn, true),
+                reg(m, (option & 3) == 3, Rm, false), sExtends[option],
+                field(code, 10, 3));
+    } else if ((code & 0x1F000000) == 0x0A000000) {
+        // logical (shifted register)
+        static const char* const ops[8] = {
+            "and", "bic", "orr", "orn", "eor", "eon", "ands", "bics"
+        };
+        const int op = (field(code, 29, 2) << 1) | field(code, 21, 1);
+        const int type = field(code, 22, 2), amount = field(code, 10, 6);
+        if (op == 2 && Rn == 31 && amount == 0) {
+            sprintf(instr, "mov %s, %s", reg(d, sf, Rd, false),
+                    reg(m, sf, Rm, false));
+        } else if (op == 6 && Rd == 31) {
+            sprintf(instr, "tst %s, %s, %s #%d", reg(n, sf, Rn, false),
+                    reg(m, sf, Rm, false), sShifts[type], amount);
+        } else {
+            sprintf(instr, "%s %s, %s, %s, %s #%d", ops[op],
+                    reg(d, sf, Rd, false), reg(n, sf, Rn, false),
+                    reg(m, sf, Rm, false), sShifts[type], amount);
+        }
+    } else if ((code & 0x1F800000) == 0x12000000) {
+        // logical (immediate)
+        static const char* const ops[4] = { "and", "orr", "eor", "ands" };
+        const int opc = field(code, 29, 2);
+        const uint32_t imm = decodeLogicalImmediate(field(code, 16, 6),
+                field(code, 10, 6));
+        sprintf(instr, "%s %s, %s, #0x%x", ops[opc],
+                reg(d, sf, Rd, opc != 3), reg(n, sf, Rn, false), imm);
+    } else if ((code & 0x1F800000) == 0x12800000) {
+        // move wide
+        static const char* const ops[4] = { "movn", "?", "movz", "movk" };
+        sprintf(instr, "%s %s, #0x%x, lsl #%d", ops[field(code, 29, 2)],
+                reg(d, sf, Rd, false), field(code, 5, 16),
+                field(code, 21, 2) * 16);
+    } else if ((code & 0x1F800000) == 0x13000000) {
+        // bitfield
+        static const char* const ops[4] = { "sbfm", "bfm", "ubfm", "?" };
+        sprintf(instr, "%s %s, %s, #%d, #%d", ops[field(code, 29, 2)],
+                reg(d, sf, Rd, false), reg(n, sf, Rn, false),
+                field(code, 16, 6), field(code, 10, 6));
+    } else if ((code & 0x1FA00000) == 0x13800000) {
+        sprintf(instr, "extr %s, %s, %s, #%d", reg(d, sf, Rd, false),
+                reg(n, sf, Rn, false), reg(m, sf, Rm, false),
+                field(code, 10, 6));
+    } else if ((code & 0x1FE00000) == 0x1A000000) {
+        // add/sub with carry
+        const int sub = field(code, 30, 1), s = field(code, 29, 1);
+        sprintf(instr, "%s%s %s, %s, %s", sub ? "sbc" : "adc", s ? "s" : "",
+                reg(d, sf, Rd, false), reg(n, sf, Rn, false),
+                reg(m, sf, Rm, false));
+    } else if ((code & 0x7FE0F000) == 0x1AC02000) {
+        static const char* const ops[4] = { "lslv", "lsrv", "asrv", "rorv" };
+        sprintf(instr, "%s %s, %s, %s", ops[field(code, 10, 2)],
+                reg(d, sf, Rd, false), reg(n, sf, Rn, false),
+                reg(m, sf, Rm, false));
+    } else if ((code & 0x7FFFFC00) == 0x5AC01000) {
+        sprintf(instr, "clz %s, %s", reg(d, sf, Rd, false),
+                reg(n, sf, Rn, false));
+    } else if ((code & 0x7FE00C00) == 0x1A800000) {
+        sprintf(instr, "csel %s, %s, %s, %s", reg(d, sf, Rd, false),
+                reg(n, sf, Rn, false), reg(m, sf, Rm, false),
+                sConditions[field(code, 12, 4)]);
+    } else if ((code & 0xFFE08000) == 0x1B000000) {
+        sprintf(instr, "madd %s, %s, %s, %s", reg(d, 0, Rd, false),
+                reg(n, 0, Rn, false), reg(m, 0, Rm, false),
+                reg(a, 0, field(code, 10, 5), false));
+    } else if ((code & 0xFF608000) == 0x9B200000) {
+        sprintf(instr, "%smaddl %s, %s, %s, %s", field(code, 23, 1) ? "u" : "s",
+                reg(d, 1, Rd, false), reg(n, 0, Rn, false),
+                reg(m, 0, Rm, false), reg(a, 1, field(code, 10, 5), false));
+    } else if ((code & 0x7C000000) == 0x14000000) {
+        sprintf(instr, "%s .%+d", (code & 0x80000000) ? "bl" : "b",
+                sfield(code, 0, 26) * 4);
+    } else if ((code & 0xFF000010) == 0x54000000) {
+        sprintf(instr, "b.%s .%+d", sConditions[field(code, 0, 4)],
+                sfield(code, 5, 19) * 4);
+    } else if ((code & 0xFFFFFC1F) == 0xD65F0000) {
+        sprintf(instr, "ret %s", reg(n, 1, Rn, false));
+    } else if ((code & 0xFFFFFC1F) == 0xD61F0000) {
+        sprintf(instr, "br %s", reg(n, 1, Rn, false));
+    } else if (code == 0xD503201F) {
+        strcpy(instr, "nop");
+    } else if ((code & 0xFFC00000) == 0xF9800000) {
+        sprintf(instr, "prfm #%d, [%s, #%d]", Rd, reg(n, 1, Rn, true),
+                field(code, 10, 12) * 8);
+    } else if ((code & 0xFFE00C00) == 0xF8800000) {
+        sprintf(instr, "prfum #%d, [%s, #%d]", Rd, reg(n, 1, Rn, true),
+                sfield(code, 12, 9));
+    } else if ((code & 0x3B000000) == 0x39000000 ||
+               (code & 0x3B200000) == 0x38000000 ||
+               (code & 0x3B200C00) == 0x38200800) {
+        // loads and stores of a single register
+        static const char* const suffixes[4] = { "b", "h", "", "" };
+        const int size = field(code, 30, 2);
+        const int opc = field(code, 22, 2);
+        const char* op = (opc == 0) ? "str" : (opc == 1) ? "ldr" : "ldrs";
+        const int wide = (size == 3) || (opc == 2);
+        char t[8];
+        reg(t, wide, Rd, false);
+        if (code & (1 << 24)) {
+            sprintf(instr, "%s%s %s, [%s, #%d]", op, suffixes[size], t,
+                    reg(n, 1, Rn, true), field(code, 10, 12) << size);
+        } else if (code & (1 << 21)) {
+            const int option = field(code, 13, 3);
+            sprintf(instr, "%s%s %s, [%s, %s, %s #%d]", op, suffixes[size], t,
+                    reg(n, 1, Rn, true), reg(m, (option & 3) == 3, Rm, false),
+                    sExtends[option], field(code, 12, 1) * size);
+        } else {
+            const int imm = sfield(code, 12, 9);
+            switch (field(code, 10, 2)) {
+            case 0:
+                sprintf(instr, "%s%s %s, [%s, #%d]",
+                        (opc == 0) ? "stur" : (opc == 1) ? "ldur" : "ldurs",
+                        suffixes[size], t,
+                        reg(n, 1, Rn, true), imm);
+                break;
+            case 1:
+                sprintf(instr, "%s%s %s, [%s], #%d", op, suffixes[size], t,
+                        reg(n, 1, Rn, true), imm);
+                break;
+            case 3:
+                sprintf(instr, "%s%s %s, [%s, #%d]!", op, suffixes[size], t,
+                        reg(n, 1, Rn, true), imm);
+                break;
+            default:
+                sprintf(instr, ".word 0x%08x", code);
+                return 1;
+            }
+        }
+    } else if ((code & 0xFC000000) == 0xA8000000) {
+        // load/store pair of x registers
+        const int mode = field(code, 23, 2);
+        const int offset = sfield(code, 15, 7) * 8;
+        char t2[8];
+        reg(t2, 1, field(code, 10, 5), false);
+        const char* op = field(code, 22, 1) ? "ldp" : "stp";
+        reg(d, 1, Rd, false);
+        reg(n, 1, Rn, true);
+        if (mode == 1) {
+            sprintf(instr, "%s %s, %s, [%s], #%d", op, d, t2, n, offset);
+        } else {
+            sprintf(instr, "%s %s, %s, [%s, #%d]%s", op, d, t2, n, offset,
+                    mode == 3 ? "!" : "");
+        }
+    } else {
+        sprintf(instr, ".word 0x%08x", code);
+        return 1;
+    }
+    return 0;
+}
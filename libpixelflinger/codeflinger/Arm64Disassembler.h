@@ -0,0 +1,28 @@
+/* libs/pixelflinger/codeflinger/Arm64Disassembler.h
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_ARM64DISASSEMBLER_H
+#define ANDROID_ARM64DISASSEMBLER_H
+
+#include <stdint.h>
+
+// Writes to instr (at least 64 bytes) the disassembly of one of the
+// A64 instructions generated by ArmToArm64Assembler, or a .word.
+// Returns 0 if the instruction was decoded, 1 otherwise.
+int arm64_disassemble(uint32_t code, char* instr);
+
+#endif //ANDROID_ARM64DISASSEMBLER_H
@@ -151,7 +151,8 @@ ssize_t Assembly::resize(size_t newSize)
 // ----------------------------------------------------------------------------
 
 CodeCache::CodeCache(size_t size)
-    : mCacheSize(size), mCacheInUse(0)
+    : mWhen(0), mCacheSize(size), mCacheInUse(0),
+      mHits(0), mMisses(0), mEvictions(0)
 {
     pthread_mutex_init(&mLock, 0);
 }
@@ -170,6 +171,9 @@ sp<Assembly> CodeCache::lookup(const AssemblyKeyBase& keyBase) const
         const cache_entry_t& e = mCacheData.valueAt(index);
         e.when = mWhen++;
         r = e.entry;
+        mHits++;
+    } else {
+        mMisses++;
     }
     pthread_mutex_unlock(&mLock);
     return r;
@@ -181,8 +185,10 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
     pthread_mutex_lock(&mLock);
 
     const ssize_t assemblySize = assembly->size();
-    while (mCacheInUse + assemblySize > mCacheSize) {
-        // evict the LRU
+    // an assembly larger than the whole cache still gets cached, alone
+    while (mCacheInUse + assemblySize > mCacheSize && mCacheData.size()) {
+        // evict the LRU; the cache only ever holds a few dozen entries,
+        // so a linear scan of the timestamps is cheaper than keeping a list
         size_t lru = 0;
         size_t count = mCacheData.size();
         for (size_t i=0 ; i<count ; i++) {
@@ -194,6 +200,7 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
         const cache_entry_t& e = mCacheData.valueAt(lru);
         mCacheInUse -= e.entry->size();
         mCacheData.removeItemsAt(lru);
+        mEvictions++;
     }
 
     ssize_t err = mCacheData.add(key_t(keyBase), cache_entry_t(assembly, mWhen));
@@ -207,6 +214,10 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
         err = cacheflush(base, curr, 0);
         ALOGE_IF(err, "cacheflush error %s\n",
                  strerror(errno));
+#elif defined(__aarch64__)
+        // there is no cacheflush system call, user space can do it
+        char* const base = reinterpret_cast<char*>(assembly->base());
+        __builtin___clear_cache(base, base + assembly->size());
 #endif
     }
 
@@ -214,6 +225,18 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
     return err;
 }
 
+void CodeCache::getStatistics(statistics_t* stats) const
+{
+    pthread_mutex_lock(&mLock);
+    stats->hits = mHits;
+    stats->misses = mMisses;
+    stats->evictions = mEvictions;
+    stats->entries = mCacheData.size();
+    stats->inUse = mCacheInUse;
+    stats->capacity = mCacheSize;
+    pthread_mutex_unlock(&mLock);
+}
+
 // ----------------------------------------------------------------------------
 
 }; // namespace android
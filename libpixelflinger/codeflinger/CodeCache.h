@@ -88,6 +88,17 @@ public:
             int                 cache(  const AssemblyKeyBase& key,
                                         const sp<Assembly>& assembly);
 
+    struct statistics_t {
+        size_t      hits;           // lookups that found an assembly
+        size_t      misses;         // lookups that found nothing
+        size_t      evictions;      // assemblies dropped to make room
+        size_t      entries;        // assemblies currently cached
+        size_t      inUse;          // bytes currently cached
+        size_t      capacity;       // bytes the cache may hold
+    };
+
+            void                getStatistics(statistics_t* stats) const;
+
 private:
     // nothing to see here...
     struct cache_entry_t {
@@ -112,6 +123,9 @@ private:
     mutable int64_t                     mWhen;
     size_t                              mCacheSize;
     size_t                              mCacheInUse;
+    mutable size_t                      mHits;
+    mutable size_t                      mMisses;
+    size_t                              mEvictions;
     KeyedVector<key_t, cache_entry_t>   mCacheData;
 
     friend int compare_type(
@@ -49,7 +49,7 @@ void GGLAssembler::store(const pointer_t& addr, const pixel_t& s, uint32_t flags
             MOV(AL, 0, s.reg, reg_imm(s.reg, ROR, 16));
         }
         if (inc)
-            ADD(AL, 0, addr.reg, addr.reg, imm(3));
+            ADDR_ADD(AL, 0, addr.reg, addr.reg, imm(3));
         break;
     case 16:
         if (inc)    STRH(AL, s.reg, addr.reg, immed8_post(2));
@@ -93,7 +93,7 @@ void GGLAssembler::load(const pointer_t& addr, const pixel_t& s, uint32_t flags)
             ORR(AL, 0, s.reg, s1, reg_imm(s0, LSL, 16));
         }
         if (inc)
-            ADD(AL, 0, addr.reg, addr.reg, imm(3));
+            ADDR_ADD(AL, 0, addr.reg, addr.reg, imm(3));
         break;        
     case 16:
         if (inc)    LDRH(AL, s.reg, addr.reg, immed8_post(2));
@@ -35,6 +35,9 @@
 #if defined(__mips__)
 #include "codeflinger/MIPSAssembler.h"
 #endif
+#if defined(__aarch64__)
+#include "codeflinger/Arm64Assembler.h"
+#endif
 //#include "codeflinger/ARMAssemblerOptimizer.h"
 
 // ----------------------------------------------------------------------------
@@ -52,7 +55,7 @@
 #   define ANDROID_CODEGEN      ANDROID_CODEGEN_GENERATED
 #endif
 
-#if defined(__arm__) || defined(__mips__)
+#if defined(__arm__) || defined(__mips__) || defined(__aarch64__)
 #   define ANDROID_ARM_CODEGEN  1
 #else
 #   define ANDROID_ARM_CODEGEN  0
@@ -66,7 +69,7 @@
  */
 #define DEBUG_NEEDS  0
 
-#ifdef __mips__
+#if defined(__mips__) || defined(__aarch64__)
 #define ASSEMBLY_SCRATCH_SIZE   4096
 #else
 #define ASSEMBLY_SCRATCH_SIZE   2048
@@ -122,8 +125,12 @@ extern "C" void scanline_t32cb16blend_arm(uint16_t*, uint32_t*, size_t);
 extern "C" void scanline_t32cb16_arm(uint16_t *dst, uint32_t *src, size_t ct);
 extern "C" void scanline_col32cb16blend_neon(uint16_t *dst, uint32_t *col, size_t ct);
 extern "C" void scanline_col32cb16blend_arm(uint16_t *dst, uint32_t col, size_t ct);
+extern "C" void scanline_t32cb16blend_neon(uint16_t *dst, uint32_t *src, size_t ct);
 #elif defined(__mips__)
 extern "C" void scanline_t32cb16blend_mips(uint16_t*, uint32_t*, size_t);
+#elif defined(__i386__) && defined(__SSE2__)
+extern "C" void scanline_t32cb16blend_sse2(uint16_t *dst, uint32_t *src, size_t ct);
+extern "C" void scanline_col32cb16blend_sse2(uint16_t *dst, uint32_t col, size_t ct);
 #endif
 
 // ----------------------------------------------------------------------------
@@ -274,7 +281,7 @@ static  const needs_filter_t fill16noblend = {
 
 #if ANDROID_ARM_CODEGEN
 
-#if defined(__mips__)
+#if defined(__mips__) || defined(__aarch64__)
 static CodeCache gCodeCache(32 * 1024);
 #else
 static CodeCache gCodeCache(12 * 1024);
@@ -394,6 +401,9 @@ static void pick_scanline(context_t* c)
 #endif
 #if defined(__mips__)
         GGLAssembler assembler( new ArmToMipsAssembler(a) );
+#endif
+#if defined(__aarch64__)
+        GGLAssembler assembler( new ArmToArm64Assembler(a) );
 #endif
         // generate the scanline code for the given needs
         int err = assembler.scanline(c->state.needs, c);
@@ -401,6 +411,14 @@ static void pick_scanline(context_t* c)
             // finally, cache this assembly
             err = gCodeCache.cache(a->key(), a);
         }
+#if DEBUG_NEEDS
+        CodeCache::statistics_t stats;
+        gCodeCache.getStatistics(&stats);
+        ALOGI("CodeCache: %zu hits, %zu misses, %zu evictions, "
+             "%zu entries using %zu of %zu bytes",
+             stats.hits, stats.misses, stats.evictions,
+             stats.entries, stats.inUse, stats.capacity);
+#endif
         if (ggl_unlikely(err)) {
             ALOGE("error generating or caching assembly. Reverting to NOP.");
             c->scanline = scanline_noop;
@@ -1717,7 +1735,7 @@ void init_y(context_t* c, int32_t ys)
             gen.width   = t.surface.width;
             gen.height  = t.surface.height;
             gen.stride  = t.surface.stride;
-            gen.data    = int32_t(t.surface.data);
+            gen.data    = uintptr_t(t.surface.data);
             gen.dsdx = ti.dsdx;
             gen.dtdx = ti.dtdx;
         }
@@ -2085,6 +2103,8 @@ void scanline_col32cb16blend(context_t* c)
 #else  // defined(__ARM_HAVE_NEON) && BYTE_ORDER == LITTLE_ENDIAN
     scanline_col32cb16blend_arm(dst, GGL_RGBA_TO_HOST(c->packed8888), ct);
 #endif // defined(__ARM_HAVE_NEON) && BYTE_ORDER == LITTLE_ENDIAN
+#elif ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && defined(__i386__) && defined(__SSE2__))
+    scanline_col32cb16blend_sse2(dst, GGL_RGBA_TO_HOST(c->packed8888), ct);
 #else
     uint32_t s = GGL_RGBA_TO_HOST(c->packed8888);
     int sA = (s>>24);
@@ -2125,7 +2145,7 @@ void scanline_t32cb16(context_t* c)
     int sR, sG, sB;
     uint32_t s, d;
 
-    if (ct==1 || uint32_t(dst)&2) {
+    if (ct==1 || uintptr_t(dst)&2) {
 last_one:
         s = GGL_RGBA_TO_HOST( *src++ );
         *dst++ = convertAbgr8888ToRgb565(s);
@@ -2157,7 +2177,8 @@ last_one:
 
 void scanline_t32cb16blend(context_t* c)
 {
-#if ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && (defined(__arm__) || defined(__mips)))
+#if ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && (defined(__arm__) || defined(__mips) || \
+        (defined(__i386__) && defined(__SSE2__))))
     int32_t x = c->iterators.xl;
     size_t ct = c->iterators.xr - x;
     int32_t y = c->iterators.y;
@@ -2169,8 +2190,12 @@ void scanline_t32cb16blend(context_t* c)
     const int32_t v = (c->state.texture[0].shade.it0>>16) + y;
     uint32_t *src = reinterpret_cast<uint32_t*>(tex->data)+(u+(tex->stride*v));
 
-#ifdef __arm__
+#if defined(__arm__) && defined(__ARM_HAVE_NEON) && BYTE_ORDER == LITTLE_ENDIAN
+    scanline_t32cb16blend_neon(dst, src, ct);
+#elif defined(__arm__)
     scanline_t32cb16blend_arm(dst, src, ct);
+#elif defined(__i386__)
+    scanline_t32cb16blend_sse2(dst, src, ct);
 #else
     scanline_t32cb16blend_mips(dst, src, ct);
 #endif
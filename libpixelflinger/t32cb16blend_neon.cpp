@@ -0,0 +1,81 @@
+/* libs/pixelflinger/t32cb16blend_neon.cpp
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+/*
+ * NEON version of scanline_t32cb16blend: SRC_OVER blends a scanline of
+ * 8888 pixels into a 565 scanline, eight pixels at a time, computing for
+ * every destination pixel d and source pixel s with alpha a
+ *
+ *     f = 0x100 - (a + (a >> 7))
+ *     d = s + ((f * d) >> 8)
+ *
+ * per channel, with s truncated to 565. A transparent source (s == 0) gives
+ * f == 0x100 and leaves d as it was, and an opaque one gives f == 0, so
+ * neither needs a special case. The remaining 0 - 7 pixels are done in C.
+ */
+
+extern "C" void scanline_t32cb16blend_neon(uint16_t* dst, uint32_t* src, size_t ct)
+{
+    const uint16x8_t mask5 = vdupq_n_u16(0x1f);
+    const uint16x8_t mask6 = vdupq_n_u16(0x3f);
+    const uint16x8_t k256 = vdupq_n_u16(0x100);
+
+    for ( ; ct >= 8 ; ct -= 8, dst += 8, src += 8) {
+        // split the source into red, green, blue and alpha
+        uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src));
+        uint16x8_t d = vld1q_u16(dst);
+        __builtin_prefetch(src + 16);
+
+        uint16x8_t sA = vmovl_u8(s.val[3]);
+        uint16x8_t f = vsubq_u16(k256, vaddq_u16(sA, vshrq_n_u16(sA, 7)));
+
+        uint16x8_t dR = vshrq_n_u16(d, 11);
+        uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), mask6);
+        uint16x8_t dB = vandq_u16(d, mask5);
+        dR = vaddq_u16(vmovl_u8(vshr_n_u8(s.val[0], 3)), vshrq_n_u16(vmulq_u16(f, dR), 8));
+        dG = vaddq_u16(vmovl_u8(vshr_n_u8(s.val[1], 2)), vshrq_n_u16(vmulq_u16(f, dG), 8));
+        dB = vaddq_u16(vmovl_u8(vshr_n_u8(s.val[2], 3)), vshrq_n_u16(vmulq_u16(f, dB), 8));
+        d = vorrq_u16(vorrq_u16(vshlq_n_u16(dR, 11), vshlq_n_u16(dG, 5)), dB);
+        vst1q_u16(dst, d);
+    }
+
+    while (ct--) {
+        uint32_t s = *src++;
+        uint16_t d = *dst;
+        int sA = (s>>24);
+        int f = 0x100 - (sA + (sA>>7));
+        int sR = (s >> (   3))&0x1F;
+        int sG = (s >> ( 8+2))&0x3F;
+        int sB = (s >> (16+3))&0x1F;
+        int dR = (d>>11)&0x1f;
+        int dG = (d>>5)&0x3f;
+        int dB = (d)&0x1f;
+        sR += (f*dR)>>8;
+        sG += (f*dG)>>8;
+        sB += (f*dB)>>8;
+        *dst++ = uint16_t((sR<<11)|(sG<<5)|sB);
+    }
+}
+
+#endif // defined(__ARM_NEON__)
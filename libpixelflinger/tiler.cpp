@@ -0,0 +1,235 @@
+/* libs/pixelflinger/tiler.cpp
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "pixelflinger"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "tiler.h"
+
+/*
+ * The tiler splits large rectangles into bands of GGL_TILE_HEIGHT scanlines,
+ * which the calling thread and up to GGL_TILER_MAX_THREADS-1 worker threads
+ * take in turn. Every band is rasterized with the context's own init_y and
+ * rect functions, so generated scanlines are used as they are; the workers
+ * just run them on their private copy of the context, since the scanline
+ * functions keep their iterators there.
+ *
+ * It's off by default, "setprop debug.pf.threads N" turns it on for the
+ * contexts created afterwards.
+ */
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+#define GGL_TILE_HEIGHT         16
+#define GGL_TILER_MAX_THREADS   8
+// smaller rectangles aren't worth waking the threads up
+#define GGL_TILER_MIN_PIXELS    (64*1024)
+
+struct tiler_thread_t {
+    tiler_t*            tiler;
+    pthread_t           thread;
+    void*               base;
+    context_t*          c;
+};
+
+struct tiler_t {
+    pthread_mutex_t     lock;
+    pthread_cond_t      work;
+    pthread_cond_t      done;
+    int                 threads;    // worker threads wanted
+    int                 count;      // worker threads running
+    bool                started;
+    bool                quit;
+    tiler_thread_t      thread[GGL_TILER_MAX_THREADS-1];
+
+    // the current job, set under the lock
+    uint32_t            job;
+    int                 pending;    // workers not done with the job
+    GGLint              l, t, r, b;
+    volatile int32_t    next;       // next band
+};
+
+// ----------------------------------------------------------------------------
+
+static void copy_context(context_t* dst, const context_t* c)
+{
+    memcpy(dst, c, sizeof(context_t));
+    dst->activeTMU = &(dst->state.texture[c->activeTMUIndex]);
+    dst->base = 0;
+    dst->tiler = 0;
+}
+
+static void rasterize_bands(tiler_t* tiler, context_t* c,
+        GGLint l, GGLint t, GGLint r, GGLint b)
+{
+    const int32_t bands = (b - t + GGL_TILE_HEIGHT - 1) / GGL_TILE_HEIGHT;
+    int32_t band;
+    while ((band = android_atomic_inc(&tiler->next)) < bands) {
+        const GGLint top = t + band * GGL_TILE_HEIGHT;
+        const GGLint bottom = (top + GGL_TILE_HEIGHT < b) ?
+                top + GGL_TILE_HEIGHT : b;
+        c->iterators.xl = l;
+        c->iterators.xr = r;
+        c->init_y(c, top);
+        c->rect(c, bottom - top);
+    }
+}
+
+static void* tiler_thread(void* arg)
+{
+    tiler_thread_t* const self = (tiler_thread_t*)arg;
+    tiler_t* const tiler = self->tiler;
+    uint32_t job = 0;
+
+    pthread_mutex_lock(&tiler->lock);
+    while (true) {
+        while (!tiler->quit && tiler->job == job) {
+            pthread_cond_wait(&tiler->work, &tiler->lock);
+        }
+        if (tiler->quit) {
+            break;
+        }
+        job = tiler->job;
+        const GGLint l = tiler->l, t = tiler->t, r = tiler->r, b = tiler->b;
+        pthread_mutex_unlock(&tiler->lock);
+
+        rasterize_bands(tiler, self->c, l, t, r, b);
+
+        pthread_mutex_lock(&tiler->lock);
+        if (--tiler->pending == 0) {
+            pthread_cond_signal(&tiler->done);
+        }
+    }
+    pthread_mutex_unlock(&tiler->lock);
+    return 0;
+}
+
+// the threads are only created for the first rectangle which needs them
+static void start_threads(tiler_t* tiler)
+{
+    tiler->started = true;
+    for (int i = 0; i < tiler->threads; i++) {
+        tiler_thread_t& t = tiler->thread[i];
+        t.tiler = tiler;
+        t.base = malloc(sizeof(context_t) + 32);
+        if (!t.base)
+            break;
+        t.c = (context_t *)((ptrdiff_t(t.base)+31) & ~0x1FL);
+        if (pthread_create(&t.thread, 0, tiler_thread, &t)) {
+            free(t.base);
+            break;
+        }
+        tiler->count++;
+    }
+    ALOGE_IF(tiler->count < tiler->threads,
+            "tiler: only %d of %d threads started",
+            tiler->count, tiler->threads);
+}
+
+// ----------------------------------------------------------------------------
+
+void ggl_init_tiler(context_t* c)
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.pf.threads", value, "0");
+    int threads = atoi(value);
+    if (threads > GGL_TILER_MAX_THREADS)
+        threads = GGL_TILER_MAX_THREADS;
+    if (threads <= 1)
+        return;
+
+    tiler_t* tiler = (tiler_t*)calloc(1, sizeof(tiler_t));
+    if (!tiler)
+        return;
+    pthread_mutex_init(&tiler->lock, 0);
+    pthread_cond_init(&tiler->work, 0);
+    pthread_cond_init(&tiler->done, 0);
+    tiler->threads = threads - 1;   // the caller does its share
+    c->tiler = tiler;
+}
+
+void ggl_uninit_tiler(context_t* c)
+{
+    tiler_t* const tiler = c->tiler;
+    if (!tiler)
+        return;
+
+    pthread_mutex_lock(&tiler->lock);
+    tiler->quit = true;
+    pthread_cond_broadcast(&tiler->work);
+    pthread_mutex_unlock(&tiler->lock);
+    for (int i = 0; i < tiler->count; i++) {
+        pthread_join(tiler->thread[i].thread, 0);
+        free(tiler->thread[i].base);
+    }
+
+    pthread_cond_destroy(&tiler->done);
+    pthread_cond_destroy(&tiler->work);
+    pthread_mutex_destroy(&tiler->lock);
+    free(tiler);
+    c->tiler = 0;
+}
+
+bool ggl_tiled_rect(context_t* c, GGLint l, GGLint t, GGLint r, GGLint b)
+{
+    tiler_t* const tiler = c->tiler;
+    if (!tiler)
+        return false;
+    if ((b - t) < 2*GGL_TILE_HEIGHT || (r - l)*(b - t) < GGL_TILER_MIN_PIXELS)
+        return false;
+    if (!tiler->started)
+        start_threads(tiler);
+    if (!tiler->count)
+        return false;
+
+    // the workers are all waiting, their copies can be updated without lock
+    for (int i = 0; i < tiler->count; i++) {
+        copy_context(tiler->thread[i].c, c);
+    }
+
+    pthread_mutex_lock(&tiler->lock);
+    tiler->l = l;
+    tiler->t = t;
+    tiler->r = r;
+    tiler->b = b;
+    tiler->next = 0;
+    tiler->pending = tiler->count;
+    tiler->job++;
+    pthread_cond_broadcast(&tiler->work);
+    pthread_mutex_unlock(&tiler->lock);
+
+    rasterize_bands(tiler, c, l, t, r, b);
+
+    pthread_mutex_lock(&tiler->lock);
+    while (tiler->pending) {
+        pthread_cond_wait(&tiler->done, &tiler->lock);
+    }
+    pthread_mutex_unlock(&tiler->lock);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
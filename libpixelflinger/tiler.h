@@ -0,0 +1,36 @@
+/* libs/pixelflinger/tiler.h
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_GGL_TILER_H
+#define ANDROID_GGL_TILER_H
+
+#include <private/pixelflinger/ggl_context.h>
+
+namespace android {
+
+void ggl_init_tiler(context_t* c);
+void ggl_uninit_tiler(context_t* c);
+
+// Rasterizes the (already clipped) rectangle [l,r[ x [t,b[ in bands of
+// scanlines spread over the tiler's threads. Returns false, without
+// drawing anything, if the rectangle is too small to be worth it or
+// there are no threads; the caller then rasterizes it itself.
+bool ggl_tiled_rect(context_t* c, GGLint l, GGLint t, GGLint r, GGLint b);
+
+}; // namespace android
+
+#endif // ANDROID_GGL_TILER_H
@@ -21,6 +21,7 @@
 
 #include "trap.h"
 #include "picker.h"
+#include "tiler.h"
 
 #include <cutils/log.h>
 #include <cutils/memory.h>
@@ -433,6 +434,8 @@ void recti(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
     int xc = r - l;
     int yc = b - t;
     if (xc>0 && yc>0) {
+        if (ggl_tiled_rect(c, l, t, r, b))
+            return;
         c->iterators.xl = l;
         c->iterators.xr = r;
         c->init_y(c, t);
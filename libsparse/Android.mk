@@ -8,6 +8,7 @@ libsparse_src_files := \
         sparse.c \
         sparse_crc32.c \
         sparse_err.c \
+        sparse_fill.c \
         sparse_read.c
 
 
@@ -48,6 +49,7 @@ LOCAL_MODULE_STEM := simg2img
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS := -lpthread
 include $(BUILD_HOST_EXECUTABLE)
 
 
@@ -69,6 +71,7 @@ LOCAL_MODULE_STEM := img2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS := -lpthread
 include $(BUILD_HOST_EXECUTABLE)
 
 
@@ -87,6 +90,7 @@ LOCAL_MODULE := simg2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS := -lpthread
 include $(BUILD_HOST_EXECUTABLE)
 
 
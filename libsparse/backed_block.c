@@ -279,7 +279,10 @@ static int queue_bb(struct backed_block_list *bbl, struct backed_block *new_bb)
 	}
 
 	merge_bb(bbl, new_bb, new_bb->next);
-	merge_bb(bbl, bb, new_bb);
+	if (!merge_bb(bbl, bb, new_bb)) {
+		/* new_bb was freed, keep the hint pointing at live memory */
+		bbl->last_used = bb;
+	}
 
 	return 0;
 }
@@ -370,7 +373,7 @@ int backed_block_split(struct backed_block_list *bbl, struct backed_block *bb,
 	}
 
 	new_bb = malloc(sizeof(struct backed_block));
-	if (bb == NULL) {
+	if (new_bb == NULL) {
 		return -ENOMEM;
 	}
 
@@ -241,6 +241,39 @@ struct sparse_file *sparse_file_import(int fd, bool verbose, bool crc);
  */
 struct sparse_file *sparse_file_import_auto(int fd, bool crc);
 
+/**
+ * sparse_file_import_stream - read a sparse file one chunk at a time
+ *
+ * @fd - file descriptor to read from
+ * @verbose - print verbose errors while reading the sparse file
+ * @crc - verify the crc of a file in the Android sparse file format
+ * @header - function called once with the block size and expanded length
+ * @data - function called for the contents of data chunks
+ * @fill - function called for each fill chunk
+ * @priv - value that will be passed as the first argument to the callbacks
+ *
+ * Reads a file in the Android sparse file format from start to end without
+ * building a sparse file cookie, so memory use does not depend on the size
+ * of the image and fd does not need to be seekable.  Data chunks are passed
+ * to 'data' in pieces of at most 1MB, each a whole number of blocks starting
+ * at 'block'.  Fill chunks are passed to 'fill' with their length in bytes.
+ * Don't care chunks are skipped, the next callback will simply start at a
+ * later block.  Any of the callbacks may be NULL.  A negative return value
+ * from a callback stops reading and is returned.
+ *
+ * If crc is true, the data passed to the callbacks is not known to be good
+ * until the function has returned 0.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_import_stream(int fd, bool verbose, bool crc,
+		int (*header)(void *priv, unsigned int block_size, int64_t len),
+		int (*data)(void *priv, unsigned int block, const void *data,
+				unsigned int len),
+		int (*fill)(void *priv, unsigned int block, uint32_t fill_val,
+				int64_t len),
+		void *priv);
+
 /** sparse_file_resparse - rechunk an existing sparse file into smaller files
  *
  * @in_s - sparse file cookie of the existing sparse file
@@ -31,6 +31,7 @@
 #include "output_file.h"
 #include "sparse_format.h"
 #include "sparse_crc32.h"
+#include "sparse_fill.h"
 
 #ifndef USE_MINGW
 #include <sys/mman.h>
@@ -396,9 +397,11 @@ static int write_sparse_fill_chunk(struct output_file *out, unsigned int len,
 		return -1;
 
 	if (out->use_crc) {
-		count = out->block_size / sizeof(uint32_t);
-		while (count--)
-			out->crc32 = sparse_crc32(out->crc32, &fill_val, sizeof(uint32_t));
+		/* the chunk stands for every one of its blocks */
+		sparse_fill_expand(out->fill_buf, fill_val, out->block_size);
+		for (count = rnd_up_len / out->block_size; count; count--)
+			out->crc32 = sparse_crc32(out->crc32, out->fill_buf,
+					out->block_size);
 	}
 
 	out->cur_out_ptr += rnd_up_len;
@@ -503,13 +506,10 @@ static int write_normal_fill_chunk(struct output_file *out, unsigned int len,
 		uint32_t fill_val)
 {
 	int ret;
-	unsigned int i;
 	unsigned int write_len;
 
 	/* Initialize fill_buf with the fill_val */
-	for (i = 0; i < out->block_size / sizeof(uint32_t); i++) {
-		out->fill_buf[i] = fill_val;
-	}
+	sparse_fill_expand(out->fill_buf, fill_val, out->block_size);
 
 	while (len) {
 		write_len = min(len, out->block_size);
@@ -14,8 +14,12 @@
  * limitations under the License.
  */
 
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+
 #include <sparse/sparse.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -30,6 +34,97 @@
 #define O_BINARY 0
 #endif
 
+#if defined(__APPLE__) && defined(__MACH__)
+#define lseek64 lseek
+#define ftruncate64 ftruncate
+#define off64_t off_t
+#endif
+
+#ifdef USE_MINGW
+#define ftruncate64 ftruncate
+#endif
+
+/* Each input is streamed onto the output, chunk by chunk, so images much
+ * larger than memory only take one pass.  Don't care chunks leave what an
+ * earlier input wrote in place. */
+struct expand {
+	int fd;
+	unsigned int block_size;
+	int64_t len;
+	uint32_t *fill_buf;
+	unsigned int fill_buf_len;
+};
+
+#define FILL_BUF_SIZE (256 * 1024)
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *ptr = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, ptr, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		ptr += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static int seek_block(struct expand *e, unsigned int block)
+{
+	if (lseek64(e->fd, (off64_t)block * e->block_size, SEEK_SET) < 0) {
+		return -errno;
+	}
+	return 0;
+}
+
+static int expand_header(void *priv, unsigned int block_size, int64_t len)
+{
+	struct expand *e = priv;
+
+	e->block_size = block_size;
+	e->len = len;
+	/* fill chunks are written a whole number of blocks at a time */
+	e->fill_buf_len = block_size > FILL_BUF_SIZE ? block_size :
+			FILL_BUF_SIZE - FILL_BUF_SIZE % block_size;
+	free(e->fill_buf);
+	e->fill_buf = malloc(e->fill_buf_len);
+	return e->fill_buf ? 0 : -ENOMEM;
+}
+
+static int expand_data(void *priv, unsigned int block, const void *data,
+		unsigned int len)
+{
+	struct expand *e = priv;
+	int ret = seek_block(e, block);
+
+	return ret < 0 ? ret : write_all(e->fd, data, len);
+}
+
+static int expand_fill(void *priv, unsigned int block, uint32_t fill_val,
+		int64_t len)
+{
+	struct expand *e = priv;
+	unsigned int i;
+	unsigned int chunk;
+	int ret = seek_block(e, block);
+
+	for (i = 0; i < e->fill_buf_len / sizeof(uint32_t); i++) {
+		e->fill_buf[i] = fill_val;
+	}
+	while (ret == 0 && len > 0) {
+		chunk = len < e->fill_buf_len ? len : e->fill_buf_len;
+		ret = write_all(e->fd, e->fill_buf, chunk);
+		len -= chunk;
+	}
+	return ret;
+}
+
 void usage()
 {
   fprintf(stderr, "Usage: simg2img <sparse_image_files> <raw_image_file>\n");
@@ -38,18 +133,18 @@ void usage()
 int main(int argc, char *argv[])
 {
 	int in;
-	int out;
 	int i;
 	int ret;
-	struct sparse_file *s;
+	struct expand e;
 
 	if (argc < 3) {
 		usage();
 		exit(-1);
 	}
 
-	out = open(argv[argc - 1], O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0664);
-	if (out < 0) {
+	memset(&e, 0, sizeof(e));
+	e.fd = open(argv[argc - 1], O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0664);
+	if (e.fd < 0) {
 		fprintf(stderr, "Cannot open output file %s\n", argv[argc - 1]);
 		exit(-1);
 	}
@@ -65,25 +160,26 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		s = sparse_file_import(in, true, false);
-		if (!s) {
+		ret = sparse_file_import_stream(in, true, false, expand_header,
+				expand_data, expand_fill, &e);
+		if (ret == -EINVAL) {
 			fprintf(stderr, "Failed to read sparse file\n");
 			exit(-1);
+		} else if (ret < 0) {
+			fprintf(stderr, "Cannot write output file\n");
+			exit(-1);
 		}
 
-		lseek(out, SEEK_SET, 0);
-
-		ret = sparse_file_write(s, out, false, false, false);
-		if (ret < 0) {
+		/* trailing don't care chunks still count towards the length */
+		if (ftruncate64(e.fd, e.len) < 0) {
 			fprintf(stderr, "Cannot write output file\n");
 			exit(-1);
 		}
-		sparse_file_destroy(s);
 		close(in);
 	}
 
-	close(out);
+	free(e.fill_buf);
+	close(e.fd);
 
 	exit(0);
 }
-
@@ -196,13 +196,48 @@ static int out_counter_write(void *priv, const void *data, int len)
 	return 0;
 }
 
+/* What bb takes up in a sparse image, chunk header included. */
+static int64_t sparse_chunk_len(struct sparse_file *s, struct backed_block *bb)
+{
+	if (backed_block_type(bb) == BACKED_BLOCK_FILL) {
+		return sizeof(chunk_header_t) + sizeof(uint32_t);
+	}
+	return sizeof(chunk_header_t) +
+			(int64_t)ALIGN(backed_block_len(bb), s->block_size);
+}
+
 int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc)
 {
 	int ret;
-	int chunks = sparse_count_chunks(s);
+	int chunks;
 	int64_t count = 0;
 	struct output_file *out;
 
+	if (sparse) {
+		/* The same walk as write_all_blocks(), from the chunk sizes alone. */
+		struct backed_block *bb;
+		unsigned int last_block = 0;
+
+		count = sizeof(sparse_header_t);
+		for (bb = backed_block_iter_new(s->backed_block_list); bb;
+				bb = backed_block_iter_next(bb)) {
+			if (backed_block_block(bb) > last_block) {
+				count += sizeof(chunk_header_t);
+			}
+			count += sparse_chunk_len(s, bb);
+			last_block = backed_block_block(bb) +
+					DIV_ROUND_UP(backed_block_len(bb), s->block_size);
+		}
+		if ((int64_t)last_block * s->block_size < s->len) {
+			count += sizeof(chunk_header_t);
+		}
+		if (crc) {
+			count += sizeof(chunk_header_t) + sizeof(uint32_t);
+		}
+		return count;
+	}
+
+	chunks = sparse_count_chunks(s);
 	out = output_file_open_callback(out_counter_write, &count,
 			s->block_size, s->len, false, sparse, chunks, crc);
 	if (!out) {
@@ -220,14 +255,19 @@ int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc)
 	return count;
 }
 
+/*
+ * Moves chunks from the front of from to to while they fit in len, going
+ * by the chunk sizes alone.  The chunk that does not fit is split when
+ * enough room is left; the pieces still point into the same data, files
+ * or fds, so nothing is read or copied.
+ */
 static struct backed_block *move_chunks_up_to_len(struct sparse_file *from,
 		struct sparse_file *to, unsigned int len)
 {
-	int64_t count = 0;
-	struct output_file *out_counter;
 	struct backed_block *last_bb = NULL;
 	struct backed_block *bb;
 	struct backed_block *start;
+	unsigned int last_block = 0;
 	int64_t file_len = 0;
 
 	/*
@@ -239,16 +279,14 @@ static struct backed_block *move_chunks_up_to_len(struct sparse_file *from,
 	len -= overhead;
 
 	start = backed_block_iter_new(from->backed_block_list);
-	out_counter = output_file_open_callback(out_counter_write, &count,
-			to->block_size, to->len, false, true, 0, false);
-	if (!out_counter) {
-		return NULL;
-	}
 
 	for (bb = start; bb; bb = backed_block_iter_next(bb)) {
-		count = 0;
-		/* will call out_counter_write to update count */
-		sparse_file_write_block(out_counter, bb);
+		int64_t count = sparse_chunk_len(from, bb);
+
+		/* a gap after the first chunk costs a skip chunk */
+		if (last_bb && backed_block_block(bb) > last_block) {
+			count += sizeof(chunk_header_t);
+		}
 		if (file_len + count > len) {
 			/*
 			 * If the remaining available size is more than 1/8th of the
@@ -263,14 +301,14 @@ static struct backed_block *move_chunks_up_to_len(struct sparse_file *from,
 		}
 		file_len += count;
 		last_bb = bb;
+		last_block = backed_block_block(bb) +
+				DIV_ROUND_UP(backed_block_len(bb), from->block_size);
 	}
 
 out:
 	backed_block_list_move(from->backed_block_list,
 		to->backed_block_list, start, last_bb);
 
-	output_file_close(out_counter);
-
 	return bb;
 }
 
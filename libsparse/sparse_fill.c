@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "sparse_fill.h"
+
+/*
+ * Checking for fill blocks is the inner loop of every raw to sparse
+ * conversion.  The vector versions compare 64 bytes per iteration
+ * against the broadcast first word and only branch once per iteration;
+ * whatever is left over goes through the word loop.  Loads are
+ * unaligned, callers pass plain malloc()ed buffers.
+ */
+bool sparse_fill_check(const uint32_t *buf, unsigned int len)
+{
+	unsigned int words = len / sizeof(uint32_t);
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	__m128i fill = _mm_set1_epi32(buf[0]);
+
+	for (; i + 16 <= words; i += 16) {
+		const __m128i *p = (const __m128i *)(buf + i);
+		__m128i diff = _mm_or_si128(
+				_mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p), fill),
+					_mm_xor_si128(_mm_loadu_si128(p + 1), fill)),
+				_mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p + 2), fill),
+					_mm_xor_si128(_mm_loadu_si128(p + 3), fill)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff)
+			return false;
+	}
+#elif defined(__ARM_NEON__)
+	uint32x4_t fill = vdupq_n_u32(buf[0]);
+
+	for (; i + 16 <= words; i += 16) {
+		uint32x4_t diff = vorrq_u32(
+				vorrq_u32(veorq_u32(vld1q_u32(buf + i), fill),
+					veorq_u32(vld1q_u32(buf + i + 4), fill)),
+				vorrq_u32(veorq_u32(vld1q_u32(buf + i + 8), fill),
+					veorq_u32(vld1q_u32(buf + i + 12), fill)));
+		uint32x2_t half = vorr_u32(vget_low_u32(diff), vget_high_u32(diff));
+		if (vget_lane_u32(vpmax_u32(half, half), 0))
+			return false;
+	}
+#endif
+
+	for (; i < words; i++) {
+		if (buf[i] != buf[0])
+			return false;
+	}
+	return true;
+}
+
+void sparse_fill_expand(uint32_t *buf, uint32_t fill_val, unsigned int len)
+{
+	unsigned int words = len / sizeof(uint32_t);
+	unsigned int i = 0;
+
+	/* bytewise patterns, zero above all, are what memset is for */
+	if ((fill_val & 0xff) * 0x01010101U == fill_val) {
+		memset(buf, fill_val & 0xff, len);
+		return;
+	}
+
+#if defined(__SSE2__)
+	__m128i fill = _mm_set1_epi32(fill_val);
+
+	for (; i + 4 <= words; i += 4)
+		_mm_storeu_si128((__m128i *)(buf + i), fill);
+#elif defined(__ARM_NEON__)
+	uint32x4_t fill = vdupq_n_u32(fill_val);
+
+	for (; i + 4 <= words; i += 4)
+		vst1q_u32(buf + i, fill);
+#endif
+
+	for (; i < words; i++)
+		buf[i] = fill_val;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBSPARSE_SPARSE_FILL_H_
+#define _LIBSPARSE_SPARSE_FILL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Returns true if the len bytes at buf are the first 32-bit word of buf
+ * repeated.  len must be a multiple of 4. */
+bool sparse_fill_check(const uint32_t *buf, unsigned int len);
+
+/* Fills len bytes at buf with fill_val.  len must be a multiple of 4. */
+void sparse_fill_expand(uint32_t *buf, uint32_t fill_val, unsigned int len);
+
+#endif
@@ -19,6 +19,9 @@
 #define _LARGEFILE64_SOURCE 1
 
 #include <fcntl.h>
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -30,12 +33,15 @@
 #include <sparse/sparse.h>
 
 #include "sparse_crc32.h"
+#include "sparse_defs.h"
 #include "sparse_file.h"
+#include "sparse_fill.h"
 #include "sparse_format.h"
 
 #if defined(__APPLE__) && defined(__MACH__)
 #define lseek64 lseek
 #define off64_t off_t
+#define pread64 pread
 #endif
 
 #define SPARSE_HEADER_MAJOR_VER 1
@@ -356,7 +362,223 @@ static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 	return 0;
 }
 
-static int sparse_file_read_normal(struct sparse_file *s, int fd)
+/* Discards len bytes of fd without seeking, fd may be a pipe */
+static int skip_all(int fd, char *buf, int64_t len)
+{
+	int ret;
+	unsigned int chunk;
+
+	while (len > 0) {
+		chunk = min(len, COPY_BUF_SIZE);
+		ret = read_all(fd, buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		len -= chunk;
+	}
+	return 0;
+}
+
+/* Hands fill or don't care data to the crc, COPY_BUF_SIZE at a time */
+static void stream_crc_fill(char *buf, uint32_t fill_val, int64_t len,
+		uint32_t *crc32)
+{
+	unsigned int chunk;
+
+	sparse_fill_expand((uint32_t *)buf, fill_val, min(len, COPY_BUF_SIZE));
+	while (len > 0) {
+		chunk = min(len, COPY_BUF_SIZE);
+		*crc32 = sparse_crc32(*crc32, buf, chunk);
+		len -= chunk;
+	}
+}
+
+int sparse_file_import_stream(int fd, bool verbose, bool crc,
+		int (*header)(void *priv, unsigned int block_size, int64_t len),
+		int (*data)(void *priv, unsigned int block, const void *data,
+				unsigned int len),
+		int (*fill)(void *priv, unsigned int block, uint32_t fill_val,
+				int64_t len),
+		void *priv)
+{
+	int ret;
+	unsigned int i;
+	sparse_header_t sparse_header;
+	chunk_header_t chunk_header;
+	uint32_t crc32 = 0;
+	uint32_t file_crc32;
+	unsigned int cur_block = 0;
+	unsigned int chunk_data_size;
+	int64_t offset = 0;
+	int64_t len;
+	unsigned int chunk;
+	unsigned int raw_chunk_max;
+	uint32_t fill_val;
+	char *buf;
+
+	buf = malloc(COPY_BUF_SIZE);
+	if (!buf) {
+		verbose_error(verbose, -ENOMEM, NULL);
+		return -ENOMEM;
+	}
+
+	ret = read_all(fd, &sparse_header, sizeof(sparse_header));
+	if (ret < 0) {
+		verbose_error(verbose, ret, "header");
+		goto out;
+	}
+	offset += sizeof(sparse_header);
+
+	ret = -EINVAL;
+	if (sparse_header.magic != SPARSE_HEADER_MAGIC) {
+		verbose_error(verbose, ret, "header magic");
+		goto out;
+	}
+
+	if (sparse_header.major_version != SPARSE_HEADER_MAJOR_VER) {
+		verbose_error(verbose, ret, "header major version");
+		goto out;
+	}
+
+	if (sparse_header.file_hdr_sz < SPARSE_HEADER_LEN ||
+			sparse_header.chunk_hdr_sz < CHUNK_HEADER_LEN ||
+			sparse_header.blk_sz == 0 ||
+			sparse_header.blk_sz % sizeof(uint32_t) != 0 ||
+			sparse_header.blk_sz > COPY_BUF_SIZE) {
+		verbose_error(verbose, ret, "header");
+		goto out;
+	}
+	/* data is handed out in whole blocks */
+	raw_chunk_max = ALIGN_DOWN(COPY_BUF_SIZE, sparse_header.blk_sz);
+
+	ret = skip_all(fd, buf, sparse_header.file_hdr_sz - SPARSE_HEADER_LEN);
+	if (ret < 0) {
+		verbose_error(verbose, ret, "header");
+		goto out;
+	}
+	offset = sparse_header.file_hdr_sz;
+
+	if (header) {
+		ret = header(priv, sparse_header.blk_sz,
+				(int64_t)sparse_header.total_blks * sparse_header.blk_sz);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	for (i = 0; i < sparse_header.total_chunks; i++) {
+		ret = read_all(fd, &chunk_header, sizeof(chunk_header));
+		if (ret == 0) {
+			ret = skip_all(fd, buf,
+					sparse_header.chunk_hdr_sz - CHUNK_HEADER_LEN);
+		}
+		if (ret < 0) {
+			verbose_error(verbose, ret, "chunk header at %lld", offset);
+			goto out;
+		}
+		offset += sparse_header.chunk_hdr_sz;
+
+		ret = -EINVAL;
+		if (chunk_header.total_sz < sparse_header.chunk_hdr_sz) {
+			verbose_error(verbose, ret, "chunk size at %lld", offset);
+			goto out;
+		}
+		chunk_data_size = chunk_header.total_sz - sparse_header.chunk_hdr_sz;
+		len = (int64_t)chunk_header.chunk_sz * sparse_header.blk_sz;
+
+		switch (chunk_header.chunk_type) {
+		case CHUNK_TYPE_RAW:
+			if (chunk_data_size != len) {
+				verbose_error(verbose, ret, "data block at %lld", offset);
+				goto out;
+			}
+			while (len > 0) {
+				chunk = min(len, raw_chunk_max);
+				ret = read_all(fd, buf, chunk);
+				if (ret < 0) {
+					verbose_error(verbose, ret, "data block at %lld", offset);
+					goto out;
+				}
+				if (crc) {
+					crc32 = sparse_crc32(crc32, buf, chunk);
+				}
+				if (data) {
+					ret = data(priv, cur_block, buf, chunk);
+					if (ret < 0) {
+						goto out;
+					}
+				}
+				cur_block += chunk / sparse_header.blk_sz;
+				offset += chunk;
+				len -= chunk;
+			}
+			continue;
+		case CHUNK_TYPE_FILL:
+			if (chunk_data_size != sizeof(fill_val)) {
+				verbose_error(verbose, ret, "fill block at %lld", offset);
+				goto out;
+			}
+			ret = read_all(fd, &fill_val, sizeof(fill_val));
+			if (ret < 0) {
+				verbose_error(verbose, ret, "fill block at %lld", offset);
+				goto out;
+			}
+			offset += sizeof(fill_val);
+			if (crc) {
+				stream_crc_fill(buf, fill_val, len, &crc32);
+			}
+			if (fill) {
+				ret = fill(priv, cur_block, fill_val, len);
+				if (ret < 0) {
+					goto out;
+				}
+			}
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+			if (chunk_data_size != 0) {
+				verbose_error(verbose, ret, "skip block at %lld", offset);
+				goto out;
+			}
+			if (crc) {
+				stream_crc_fill(buf, 0, len, &crc32);
+			}
+			break;
+		case CHUNK_TYPE_CRC32:
+			if (chunk_data_size != sizeof(file_crc32)) {
+				verbose_error(verbose, ret, "crc block at %lld", offset);
+				goto out;
+			}
+			ret = read_all(fd, &file_crc32, sizeof(file_crc32));
+			if (ret == 0 && crc && file_crc32 != crc32) {
+				ret = -EINVAL;
+			}
+			if (ret < 0) {
+				verbose_error(verbose, ret, "crc block at %lld", offset);
+				goto out;
+			}
+			offset += sizeof(file_crc32);
+			continue;
+		default:
+			verbose_error(verbose, ret, "unknown block %04X at %lld",
+					chunk_header.chunk_type, offset);
+			goto out;
+		}
+
+		cur_block += chunk_header.chunk_sz;
+	}
+
+	ret = 0;
+	if (sparse_header.total_blks != cur_block) {
+		verbose_error(verbose, -EINVAL, "block count");
+		ret = -EINVAL;
+	}
+
+out:
+	free(buf);
+	return ret;
+}
+
+static int sparse_file_read_normal_serial(struct sparse_file *s, int fd)
 {
 	int ret;
 	uint32_t *buf = malloc(s->block_size);
@@ -364,8 +586,6 @@ static int sparse_file_read_normal(struct sparse_file *s, int fd)
 	int64_t remain = s->len;
 	int64_t offset = 0;
 	unsigned int to_read;
-	char *ptr;
-	unsigned int i;
 	bool sparse_block;
 
 	if (!buf) {
@@ -377,17 +597,12 @@ static int sparse_file_read_normal(struct sparse_file *s, int fd)
 		ret = read_all(fd, buf, to_read);
 		if (ret < 0) {
 			error("failed to read sparse file");
+			free(buf);
 			return ret;
 		}
 
 		if (to_read == s->block_size) {
-			sparse_block = true;
-			for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-				if (buf[0] != buf[i]) {
-					sparse_block = false;
-					break;
-				}
-			}
+			sparse_block = sparse_fill_check(buf, s->block_size);
 		} else {
 			sparse_block = false;
 		}
@@ -404,9 +619,216 @@ static int sparse_file_read_normal(struct sparse_file *s, int fd)
 		block++;
 	}
 
+	free(buf);
+	return 0;
+}
+
+#ifndef USE_MINGW
+
+/*
+ * Raw images are classified by several threads, each one reading
+ * READ_SLICE_SIZE bytes at a time with pread and recording for every
+ * block whether it is a fill block and with what value.  The results
+ * are then turned into runs and added to the backed block list in order,
+ * so the list comes out the same as with the serial reader.
+ */
+#define READ_THREADS_MAX 8
+#define READ_SLICE_SIZE (4U*1024U*1024U)
+/* longest run handed to the backed block list at once */
+#define READ_RUN_MAX (256U*1024U*1024U)
+
+struct read_normal_ctx {
+	int fd;
+	unsigned int block_size;
+	int64_t len;
+	unsigned int slices;
+	uint32_t *fill_val;
+	uint8_t *is_fill;
+
+	pthread_mutex_t lock;
+	unsigned int next_slice;
+	int err;
+};
+
+static int pread_all(int fd, void *buf, size_t len, int64_t offset)
+{
+	size_t total = 0;
+	ssize_t ret;
+	char *ptr = buf;
+
+	while (total < len) {
+		ret = pread64(fd, ptr, len - total, offset + total);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (ret == 0)
+			return -EINVAL;
+
+		ptr += ret;
+		total += ret;
+	}
+
 	return 0;
 }
 
+static void *read_normal_thread(void *arg)
+{
+	struct read_normal_ctx *ctx = arg;
+	unsigned int blocks_per_slice = READ_SLICE_SIZE / ctx->block_size;
+	uint32_t *buf = malloc(blocks_per_slice * ctx->block_size);
+	unsigned int slice;
+	unsigned int i;
+	int ret = 0;
+
+	if (!buf) {
+		ret = -ENOMEM;
+	}
+
+	while (ret == 0) {
+		pthread_mutex_lock(&ctx->lock);
+		slice = ctx->next_slice++;
+		if (ctx->err) {
+			slice = ctx->slices;
+		}
+		pthread_mutex_unlock(&ctx->lock);
+		if (slice >= ctx->slices) {
+			break;
+		}
+
+		unsigned int first = slice * blocks_per_slice;
+		int64_t offset = (int64_t)first * ctx->block_size;
+		size_t size = min(ctx->len - offset,
+				(int64_t)blocks_per_slice * ctx->block_size);
+
+		ret = pread_all(ctx->fd, buf, size, offset);
+		if (ret < 0) {
+			break;
+		}
+
+		for (i = 0; i * ctx->block_size < size; i++) {
+			uint32_t *block = buf + i * (ctx->block_size / sizeof(uint32_t));
+
+			/* a partial block at the end is always kept as data */
+			if ((i + 1) * ctx->block_size <= size &&
+					sparse_fill_check(block, ctx->block_size)) {
+				ctx->is_fill[first + i] = 1;
+				ctx->fill_val[first + i] = block[0];
+			} else {
+				ctx->is_fill[first + i] = 0;
+			}
+		}
+	}
+
+	if (ret < 0) {
+		pthread_mutex_lock(&ctx->lock);
+		if (!ctx->err) {
+			ctx->err = ret;
+		}
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	free(buf);
+	return NULL;
+}
+
+static int sparse_file_read_normal_threaded(struct sparse_file *s, int fd,
+		int threads)
+{
+	struct read_normal_ctx ctx;
+	pthread_t thread[READ_THREADS_MAX];
+	unsigned int blocks = DIV_ROUND_UP(s->len, s->block_size);
+	unsigned int max_run = READ_RUN_MAX / s->block_size;
+	unsigned int block, run;
+	int started = 0;
+	int ret = 0;
+	int i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fd = fd;
+	ctx.block_size = s->block_size;
+	ctx.len = s->len;
+	ctx.slices = DIV_ROUND_UP(blocks, READ_SLICE_SIZE / s->block_size);
+	ctx.fill_val = malloc(blocks * sizeof(uint32_t));
+	ctx.is_fill = malloc(blocks);
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	if (!ctx.fill_val || !ctx.is_fill) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&thread[i], NULL, read_normal_thread, &ctx)) {
+			break;
+		}
+		started++;
+	}
+	if (started == 0) {
+		/* the caller falls back to reading serially */
+		ret = -EAGAIN;
+		goto out;
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	if (ctx.err) {
+		error("failed to read sparse file");
+		ret = ctx.err;
+		goto out;
+	}
+
+	for (block = 0; block < blocks && ret == 0; block += run) {
+		int64_t offset = (int64_t)block * s->block_size;
+		if (ctx.is_fill[block]) {
+			for (run = 1; block + run < blocks && run < max_run &&
+					ctx.is_fill[block + run] &&
+					ctx.fill_val[block + run] == ctx.fill_val[block]; run++)
+				;
+			ret = sparse_file_add_fill(s, ctx.fill_val[block],
+					run * s->block_size, block);
+		} else {
+			for (run = 1; block + run < blocks && run < max_run &&
+					!ctx.is_fill[block + run]; run++)
+				;
+			ret = sparse_file_add_fd(s, fd, offset,
+					min(s->len - offset, (int64_t)run * s->block_size), block);
+		}
+	}
+
+out:
+	pthread_mutex_destroy(&ctx.lock);
+	free(ctx.fill_val);
+	free(ctx.is_fill);
+	return ret;
+}
+
+#endif
+
+static int sparse_file_read_normal(struct sparse_file *s, int fd)
+{
+#ifndef USE_MINGW
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = cpus < 1 ? 1 : min(cpus, (long)READ_THREADS_MAX);
+	int ret;
+
+	/* threads need pread; and small images or blocks that don't divide
+	   a slice aren't worth the trouble */
+	if (threads > 1 && s->len > READ_SLICE_SIZE &&
+			READ_SLICE_SIZE % s->block_size == 0 &&
+			lseek64(fd, 0, SEEK_CUR) == 0) {
+		ret = sparse_file_read_normal_threaded(s, fd, threads);
+		if (ret != -EAGAIN) {
+			return ret;
+		}
+	}
+#endif
+
+	return sparse_file_read_normal_serial(s, fd);
+}
+
 int sparse_file_read(struct sparse_file *s, int fd, bool sparse, bool crc)
 {
 	if (crc && !sparse) {
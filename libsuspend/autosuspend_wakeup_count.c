@@ -22,6 +22,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define LOG_TAG "libsuspend"
@@ -32,32 +33,77 @@
 #define SYS_POWER_STATE "/sys/power/state"
 #define SYS_POWER_WAKEUP_COUNT "/sys/power/wakeup_count"
 
+#define BASE_SLEEP_TIME_MS 100
+#define MAX_SLEEP_TIME_MS 3200
+
 static int state_fd;
 static int wakeup_count_fd;
 static pthread_t suspend_thread;
 static sem_t suspend_lockout;
 static const char *sleep_state = "mem";
 
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct autosuspend_stats stats;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    /* does not count the time spent suspended */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * How long to wait before the next attempt depends on why the last one
+ * ended. After a suspend, or a wakeup_count which changed under us, the
+ * base delay is enough: reading wakeup_count blocks for as long as
+ * wakeup events are in progress anyway. An attempt that a wakeup source
+ * or a driver aborted froze and thawed every process for nothing, so
+ * each one in a row doubles the delay, up to MAX_SLEEP_TIME_MS. Errors
+ * that are unlikely to go away soon go straight to the maximum.
+ */
+static unsigned int next_sleep_time(unsigned int sleep_ms, int aborted)
+{
+    if (!aborted) {
+        return BASE_SLEEP_TIME_MS;
+    }
+    sleep_ms *= 2;
+    return sleep_ms > MAX_SLEEP_TIME_MS ? MAX_SLEEP_TIME_MS : sleep_ms;
+}
+
+static void set_backoff(unsigned int sleep_ms)
+{
+    pthread_mutex_lock(&stats_lock);
+    stats.backoff_ms = sleep_ms;
+    pthread_mutex_unlock(&stats_lock);
+}
+
 static void *suspend_thread_func(void *arg __attribute__((unused)))
 {
     char buf[80];
     char wakeup_count[20];
     int wakeup_count_len;
+    unsigned int sleep_ms = BASE_SLEEP_TIME_MS;
+    uint64_t start, elapsed;
     int ret;
 
     while (1) {
-        usleep(100000);
+        usleep(sleep_ms * 1000);
         ALOGV("%s: read wakeup_count\n", __func__);
-        lseek(wakeup_count_fd, 0, SEEK_SET);
-        wakeup_count_len = read(wakeup_count_fd, wakeup_count, sizeof(wakeup_count));
+        wakeup_count_len = pread(wakeup_count_fd, wakeup_count, sizeof(wakeup_count), 0);
         if (wakeup_count_len < 0) {
             strerror_r(errno, buf, sizeof(buf));
             ALOGE("Error reading from %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
             wakeup_count_len = 0;
+            sleep_ms = MAX_SLEEP_TIME_MS;
+            set_backoff(sleep_ms);
             continue;
         }
         if (!wakeup_count_len) {
             ALOGE("Empty wakeup count\n");
+            sleep_ms = MAX_SLEEP_TIME_MS;
+            set_backoff(sleep_ms);
             continue;
         }
 
@@ -70,17 +116,42 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
         }
 
         ALOGV("%s: write %*s to wakeup_count\n", __func__, wakeup_count_len, wakeup_count);
-        ret = write(wakeup_count_fd, wakeup_count, wakeup_count_len);
+        ret = pwrite(wakeup_count_fd, wakeup_count, wakeup_count_len, 0);
         if (ret < 0) {
-            strerror_r(errno, buf, sizeof(buf));
+            int err = errno;
+
+            strerror_r(err, buf, sizeof(buf));
             ALOGE("Error writing to %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
+            /* EINVAL is a wakeup event which came in since the read */
+            sleep_ms = err == EINVAL ? BASE_SLEEP_TIME_MS : MAX_SLEEP_TIME_MS;
+            pthread_mutex_lock(&stats_lock);
+            if (err == EINVAL) {
+                stats.count_changed++;
+            }
+            stats.backoff_ms = sleep_ms;
+            pthread_mutex_unlock(&stats_lock);
         } else {
             ALOGV("%s: write %s to %s\n", __func__, sleep_state, SYS_POWER_STATE);
-            ret = write(state_fd, sleep_state, strlen(sleep_state));
+            start = now_us();
+            ret = pwrite(state_fd, sleep_state, strlen(sleep_state), 0);
+            elapsed = now_us() - start;
             if (ret < 0) {
                 strerror_r(errno, buf, sizeof(buf));
                 ALOGE("Error writing to %s: %s\n", SYS_POWER_STATE, buf);
             }
+            sleep_ms = next_sleep_time(sleep_ms, ret < 0);
+
+            pthread_mutex_lock(&stats_lock);
+            stats.attempts++;
+            if (ret < 0) {
+                stats.aborts++;
+            } else {
+                stats.suspends++;
+            }
+            stats.attempt_time_us += elapsed;
+            stats.last_attempt_us = elapsed;
+            stats.backoff_ms = sleep_ms;
+            pthread_mutex_unlock(&stats_lock);
         }
 
         ALOGV("%s: release sem\n", __func__);
@@ -131,9 +202,19 @@ static int autosuspend_wakeup_count_disable(void)
     return ret;
 }
 
+static int autosuspend_wakeup_count_get_stats(struct autosuspend_stats *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    return 0;
+}
+
 struct autosuspend_ops autosuspend_wakeup_count_ops = {
         .enable = autosuspend_wakeup_count_enable,
         .disable = autosuspend_wakeup_count_disable,
+        .get_stats = autosuspend_wakeup_count_get_stats,
 };
 
 struct autosuspend_ops *autosuspend_wakeup_count_init(void)
@@ -155,6 +236,8 @@ struct autosuspend_ops *autosuspend_wakeup_count_init(void)
         goto err_open_wakeup_count;
     }
 
+    stats.backoff_ms = BASE_SLEEP_TIME_MS;
+
     ret = sem_init(&suspend_lockout, 0, 0);
     if (ret < 0) {
         strerror_r(errno, buf, sizeof(buf));
@@ -17,6 +17,7 @@
 #ifndef _LIBSUSPEND_AUTOSUSPEND_H_
 #define _LIBSUSPEND_AUTOSUSPEND_H_
 
+#include <stdint.h>
 #include <sys/cdefs.h>
 
 __BEGIN_DECLS
@@ -43,6 +44,27 @@ int autosuspend_enable(void);
  */
 int autosuspend_disable(void);
 
+struct autosuspend_stats {
+    uint64_t attempts;          /* writes to /sys/power/state */
+    uint64_t suspends;          /* attempts after which the system resumed */
+    uint64_t aborts;            /* attempts a wakeup source or driver failed */
+    uint64_t count_changed;     /* wakeup_count changed before an attempt */
+    uint64_t attempt_time_us;   /* total time spent in the attempts */
+    uint64_t last_attempt_us;   /* time spent in the last attempt */
+    uint32_t backoff_ms;        /* delay before the next attempt */
+};
+
+/*
+ * autosuspend_get_stats
+ *
+ * Fill in the counters of the suspend attempts made since the process
+ * started. The times do not include the time spent suspended.
+ *
+ * Returns 0 on success, -1 if autosuspend is left to the kernel and
+ * there is nothing to count.
+ */
+int autosuspend_get_stats(struct autosuspend_stats *stats);
+
 __END_DECLS
 
 #endif
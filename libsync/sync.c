@@ -16,17 +16,40 @@
  *  limitations under the License.
  */
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <linux/sync.h>
 #include <linux/sw_sync.h>
 
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+/* poll() will not take more fences than this in one call */
+#define SYNC_WAIT_MAX   64
+
+struct sync_waiter_entry;
+
+struct sync_waiter {
+    int epfd;
+    struct sync_waiter_entry *entries;
+};
+
+struct sync_waiter_entry {
+    struct sync_waiter_entry *next;
+    int fd;
+    void (*callback)(int status, void *data);
+    void *data;
+};
+
 int sync_wait(int fd, int timeout)
 {
     __s32 to = timeout;
@@ -49,6 +72,124 @@ int sync_merge(const char *name, int fd1, int fd2)
     return data.fence;
 }
 
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int sync_wait_any(const int *fds, int count, int timeout)
+{
+    struct pollfd pfds[SYNC_WAIT_MAX];
+    int i, ret;
+
+    if (count <= 0 || count > SYNC_WAIT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    do {
+        ret = poll(pfds, count, timeout);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        return -1;
+    if (ret == 0) {
+        errno = ETIME;
+        return -1;
+    }
+
+    /* an errored fence is signaled too; sync_fence_status() tells them apart */
+    for (i = 0; i < count; i++) {
+        if (pfds[i].revents & (POLLIN | POLLERR | POLLNVAL))
+            return i;
+    }
+    errno = EIO;
+    return -1;
+}
+
+int sync_wait_all(const int *fds, int count, int timeout)
+{
+    struct pollfd pfds[SYNC_WAIT_MAX];
+    int64_t deadline = timeout < 0 ? 0 : now_ms() + timeout;
+    int i, pending = 0, ret;
+
+    if (count < 0 || count > SYNC_WAIT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        pfds[pending].fd = fds[i];
+        pfds[pending].events = POLLIN;
+        pfds[pending].revents = 0;
+        pending++;
+    }
+
+    while (pending > 0) {
+        int wait = -1;
+
+        if (timeout >= 0) {
+            int64_t left = deadline - now_ms();
+            wait = left > 0 ? (int) left : 0;
+        }
+
+        ret = poll(pfds, pending, wait);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0) {
+            errno = ETIME;
+            return -1;
+        }
+
+        /* keep only the fences still to signal */
+        for (i = 0; i < pending; ) {
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                errno = EINVAL;
+                return -1;
+            }
+            if (pfds[i].revents & POLLIN)
+                pfds[i] = pfds[--pending];
+            else
+                i++;
+        }
+    }
+    return 0;
+}
+
+int sync_fence_status(int fd)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0 || (pfd.revents & (POLLERR | POLLNVAL)))
+        return -1;
+    return (pfd.revents & POLLIN) ? 1 : 0;
+}
+
+int sync_fence_info_buf(int fd, struct sync_fence_info_data *info, size_t len)
+{
+    info->len = len;
+    return ioctl(fd, SYNC_IOC_FENCE_INFO, info);
+}
+
 struct sync_fence_info_data *sync_fence_info(int fd)
 {
     struct sync_fence_info_data *info;
@@ -87,6 +228,99 @@ void sync_fence_info_free(struct sync_fence_info_data *info)
     free(info);
 }
 
+struct sync_waiter *sync_waiter_create(void)
+{
+    struct sync_waiter *waiter = malloc(sizeof(*waiter));
+
+    if (waiter == NULL)
+        return NULL;
+    waiter->entries = NULL;
+    waiter->epfd = epoll_create(SYNC_WAIT_MAX);
+    if (waiter->epfd < 0) {
+        free(waiter);
+        return NULL;
+    }
+    return waiter;
+}
+
+void sync_waiter_destroy(struct sync_waiter *waiter)
+{
+    struct sync_waiter_entry *entry, *next;
+
+    /* fences still pending are dropped without calling back */
+    for (entry = waiter->entries; entry != NULL; entry = next) {
+        next = entry->next;
+        close(entry->fd);
+        free(entry);
+    }
+    close(waiter->epfd);
+    free(waiter);
+}
+
+int sync_waiter_get_fd(struct sync_waiter *waiter)
+{
+    return waiter->epfd;
+}
+
+int sync_waiter_add(struct sync_waiter *waiter, int fd,
+                    void (*callback)(int status, void *data), void *data)
+{
+    struct sync_waiter_entry *entry;
+    struct epoll_event ev;
+
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL)
+        return -1;
+    /* a private fd, so the caller may close theirs as soon as we return */
+    entry->fd = dup(fd);
+    if (entry->fd < 0) {
+        free(entry);
+        return -1;
+    }
+    entry->callback = callback;
+    entry->data = data;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = entry;
+    if (epoll_ctl(waiter->epfd, EPOLL_CTL_ADD, entry->fd, &ev) < 0) {
+        close(entry->fd);
+        free(entry);
+        return -1;
+    }
+    entry->next = waiter->entries;
+    waiter->entries = entry;
+    return 0;
+}
+
+int sync_waiter_dispatch(struct sync_waiter *waiter, int timeout)
+{
+    struct epoll_event events[SYNC_WAIT_MAX];
+    int i, count;
+
+    do {
+        count = epoll_wait(waiter->epfd, events, SYNC_WAIT_MAX, timeout);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        struct sync_waiter_entry *entry = events[i].data.ptr;
+        struct sync_waiter_entry **prev = &waiter->entries;
+        int status = (events[i].events & EPOLLERR) ? -1 : 1;
+
+        while (*prev != entry)
+            prev = &(*prev)->next;
+        *prev = entry->next;
+
+        epoll_ctl(waiter->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+        close(entry->fd);
+        entry->callback(status, entry->data);
+        free(entry);
+    }
+    return count;
+}
+
 
 int sw_sync_timeline_create(void)
 {
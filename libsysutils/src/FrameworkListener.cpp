@@ -16,6 +16,8 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #define LOG_TAG "FrameworkListener"
 
@@ -27,6 +29,40 @@
 
 static const int CMD_BUF_SIZE = 1024;
 
+/* Longest command that may be assembled across several reads */
+static const size_t CMD_MAX_SIZE = 64 * 1024;
+
+/* Command bytes left over from a read that ended mid-command */
+struct PartialCommand {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool overflow;
+};
+
+static int hashString(void *key) {
+    return hashmapHash(key, strlen((const char *) key));
+}
+
+static bool equalStrings(void *keyA, void *keyB) {
+    return !strcmp((const char *) keyA, (const char *) keyB);
+}
+
+static int hashPointer(void *key) {
+    return (int) ((uintptr_t) key >> 3);
+}
+
+static bool equalPointers(void *keyA, void *keyB) {
+    return keyA == keyB;
+}
+
+static bool freePartial(void *key, void *value, void *context) {
+    PartialCommand *pc = (PartialCommand *) value;
+    free(pc->buf);
+    free(pc);
+    return true;
+}
+
 FrameworkListener::FrameworkListener(const char *socketName, bool withSeq) :
                             SocketListener(socketName, true, withSeq) {
     init(socketName, withSeq);
@@ -37,13 +73,49 @@ FrameworkListener::FrameworkListener(const char *socketName) :
     init(socketName, false);
 }
 
+FrameworkListener::~FrameworkListener() {
+    hashmapForEach(mPartials, freePartial, NULL);
+    hashmapFree(mPartials);
+    hashmapFree(mCommandMap);
+}
+
 void FrameworkListener::init(const char *socketName, bool withSeq) {
     mCommands = new FrameworkCommandCollection();
+    mCommandMap = hashmapCreate(16, hashString, equalStrings);
+    mPartials = hashmapCreate(8, hashPointer, equalPointers);
     errorRate = 0;
     mCommandCount = 0;
     mWithSeq = withSeq;
 }
 
+/*
+ * Appends len bytes to an unfinished command.  Once a command grows past
+ * CMD_MAX_SIZE the rest of it is dropped and it is answered with an error
+ * when its terminator arrives.
+ */
+static void appendPartial(PartialCommand *pc, const char *data, size_t len) {
+    if (pc->overflow)
+        return;
+    if (pc->len + len > CMD_MAX_SIZE) {
+        pc->overflow = true;
+        return;
+    }
+    if (pc->len + len + 1 > pc->cap) {
+        size_t cap = pc->cap ? pc->cap : CMD_BUF_SIZE;
+        while (cap < pc->len + len + 1)
+            cap *= 2;
+        char *buf = (char *) realloc(pc->buf, cap);
+        if (!buf) {
+            pc->overflow = true;
+            return;
+        }
+        pc->buf = buf;
+        pc->cap = cap;
+    }
+    memcpy(pc->buf + pc->len, data, len);
+    pc->len += len;
+}
+
 bool FrameworkListener::onDataAvailable(SocketClient *c) {
     char buffer[CMD_BUF_SIZE];
     int len;
@@ -51,50 +123,99 @@ bool FrameworkListener::onDataAvailable(SocketClient *c) {
     len = TEMP_FAILURE_RETRY(read(c->getSocket(), buffer, sizeof(buffer)));
     if (len < 0) {
         SLOGE("read() failed (%s)", strerror(errno));
+        dropPartial(c);
         return false;
-    } else if (!len)
+    } else if (!len) {
+        dropPartial(c);
         return false;
-   if(buffer[len-1] != '\0')
-        SLOGW("String is not zero-terminated");
+    }
 
     int offset = 0;
     int i;
 
     for (i = 0; i < len; i++) {
-        if (buffer[i] == '\0') {
+        if (buffer[i] != '\0')
+            continue;
+
+        /* A command started in an earlier read is finished off first */
+        hashmapLock(mPartials);
+        PartialCommand *pc = (PartialCommand *) hashmapRemove(mPartials, c);
+        hashmapUnlock(mPartials);
+        if (!pc) {
             /* IMPORTANT: dispatchCommand() expects a zero-terminated string */
             dispatchCommand(c, buffer + offset);
-            offset = i + 1;
+        } else {
+            appendPartial(pc, buffer + offset, i - offset);
+            if (pc->overflow) {
+                LOG_EVENT_INT(78001, c->getUid());
+                c->sendMsg(500, "Command too long", false);
+            } else {
+                pc->buf[pc->len] = '\0';
+                dispatchCommand(c, pc->buf);
+            }
+            freePartial(c, pc, NULL);
         }
+        offset = i + 1;
     }
 
+    if (offset < len)
+        savePartial(c, buffer + offset, len - offset);
+
     return true;
 }
 
+void FrameworkListener::savePartial(SocketClient *c, const char *data, size_t len) {
+    hashmapLock(mPartials);
+    PartialCommand *pc = (PartialCommand *) hashmapGet(mPartials, c);
+    if (!pc) {
+        pc = (PartialCommand *) calloc(1, sizeof(*pc));
+        errno = 0;
+        if (!pc || (!hashmapPut(mPartials, c, pc) && errno == ENOMEM)) {
+            hashmapUnlock(mPartials);
+            free(pc);
+            SLOGE("Unable to save partial command (%s)", strerror(ENOMEM));
+            return;
+        }
+    }
+    hashmapUnlock(mPartials);
+    appendPartial(pc, data, len);
+}
+
+void FrameworkListener::dropPartial(SocketClient *c) {
+    hashmapLock(mPartials);
+    PartialCommand *pc = (PartialCommand *) hashmapRemove(mPartials, c);
+    hashmapUnlock(mPartials);
+    if (pc)
+        freePartial(c, pc, NULL);
+}
+
 void FrameworkListener::registerCmd(FrameworkCommand *cmd) {
     mCommands->push_back(cmd);
+    /* As with the old linear scan, the first command registered wins */
+    if (!hashmapContainsKey(mCommandMap, (void *) cmd->getCommand()))
+        hashmapPut(mCommandMap, (void *) cmd->getCommand(), cmd);
 }
 
+/*
+ * Splits data into argv in place: escapes and quotes only ever shrink the
+ * text, so the unquoted arguments are written back over the command itself
+ * and argv points straight into it.
+ */
 void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
-    FrameworkCommandCollection::iterator i;
     int argc = 0;
     char *argv[FrameworkListener::CMD_ARGS_MAX];
-    char tmp[CMD_BUF_SIZE];
     char *p = data;
-    char *q = tmp;
-    char *qlimit = tmp + sizeof(tmp) - 1;
+    char *q = data;
+    char *arg = data;
     bool esc = false;
     bool quote = false;
-    int k;
     bool haveCmdNum = !mWithSeq;
+    FrameworkCommand *c;
 
     memset(argv, 0, sizeof(argv));
-    memset(tmp, 0, sizeof(tmp));
     while(*p) {
         if (*p == '\\') {
             if (esc) {
-                if (q >= qlimit)
-                    goto overflow;
                 *q++ = '\\';
                 esc = false;
             } else
@@ -103,16 +224,12 @@ void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
             continue;
         } else if (esc) {
             if (*p == '"') {
-                if (q >= qlimit)
-                    goto overflow;
                 *q++ = '"';
             } else if (*p == '\\') {
-                if (q >= qlimit)
-                    goto overflow;
                 *q++ = '\\';
             } else {
                 cli->sendMsg(500, "Unsupported escape sequence", false);
-                goto out;
+                return;
             }
             p++;
             esc = false;
@@ -128,27 +245,24 @@ void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
             continue;
         }
 
-        if (q >= qlimit)
-            goto overflow;
         *q = *p++;
         if (!quote && *q == ' ') {
             *q = '\0';
             if (!haveCmdNum) {
                 char *endptr;
-                int cmdNum = (int)strtol(tmp, &endptr, 0);
+                int cmdNum = (int)strtol(arg, &endptr, 0);
                 if (endptr == NULL || *endptr != '\0') {
                     cli->sendMsg(500, "Invalid sequence number", false);
-                    goto out;
+                    return;
                 }
                 cli->setCmdNum(cmdNum);
                 haveCmdNum = true;
             } else {
                 if (argc >= CMD_ARGS_MAX)
                     goto overflow;
-                argv[argc++] = strdup(tmp);
+                argv[argc++] = arg;
             }
-            memset(tmp, 0, sizeof(tmp));
-            q = tmp;
+            arg = ++q;
             continue;
         }
         q++;
@@ -157,43 +271,35 @@ void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
     *q = '\0';
     if (argc >= CMD_ARGS_MAX)
         goto overflow;
-    argv[argc++] = strdup(tmp);
+    argv[argc++] = arg;
 #if 0
-    for (k = 0; k < argc; k++) {
+    for (int k = 0; k < argc; k++) {
         SLOGD("arg[%d] = '%s'", k, argv[k]);
     }
 #endif
 
     if (quote) {
         cli->sendMsg(500, "Unclosed quotes error", false);
-        goto out;
+        return;
     }
 
     if (errorRate && (++mCommandCount % errorRate == 0)) {
         /* ignore this command - let the timeout handler handle it */
         SLOGE("Faking a timeout");
-        goto out;
+        return;
     }
 
-    for (i = mCommands->begin(); i != mCommands->end(); ++i) {
-        FrameworkCommand *c = *i;
-
-        if (!strcmp(argv[0], c->getCommand())) {
-            if (c->runCommand(cli, argc, argv)) {
-                SLOGW("Handler '%s' error (%s)", c->getCommand(), strerror(errno));
-            }
-            goto out;
+    c = (FrameworkCommand *) hashmapGet(mCommandMap, argv[0]);
+    if (c) {
+        if (c->runCommand(cli, argc, argv)) {
+            SLOGW("Handler '%s' error (%s)", c->getCommand(), strerror(errno));
         }
+        return;
     }
     cli->sendMsg(500, "Command not recognized", false);
-out:
-    int j;
-    for (j = 0; j < argc; j++)
-        free(argv[j]);
     return;
 
 overflow:
     LOG_EVENT_INT(78001, cli->getUid());
     cli->sendMsg(500, "Command too long", false);
-    goto out;
 }
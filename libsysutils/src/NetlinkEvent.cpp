@@ -50,10 +50,13 @@ NetlinkEvent::NetlinkEvent() {
     memset(mParams, 0, sizeof(mParams));
     mPath = NULL;
     mSubsystem = NULL;
+    mBorrowed = false;
 }
 
 NetlinkEvent::~NetlinkEvent() {
     int i;
+    if (mBorrowed)
+        return;
     if (mPath)
         free(mPath);
     if (mSubsystem)
@@ -275,7 +278,8 @@ has_prefix(const char* str, const char* end, const char* prefix, size_t prefixle
 
 /*
  * Parse an ASCII-formatted message from a NETLINK_KOBJECT_UEVENT
- * netlink socket.
+ * netlink socket.  Nothing is copied: the path, subsystem and params all
+ * point into the buffer, which must outlive the event.
  */
 bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
     const char *s = buffer;
@@ -286,6 +290,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
 
     if (size == 0)
         return false;
+    mBorrowed = true;
 
     /* Ensure the buffer is zero-terminated, the code below depends on this */
     buffer[size-1] = '\0';
@@ -300,7 +305,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = (char *) p + 1;
             first = 0;
         } else {
             const char* a;
@@ -314,9 +319,9 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
             } else if ((a = HAS_CONST_PREFIX(s, end, "SEQNUM=")) != NULL) {
                 mSeq = atoi(a);
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != NULL) {
-                mSubsystem = strdup(a);
+                mSubsystem = (char *) a;
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                mParams[param_idx++] = (char *) s;
             }
         }
         s += strlen(s) + 1;
@@ -19,6 +19,9 @@
 #include <sys/socket.h>
 #include <linux/netlink.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #define LOG_TAG "NetlinkListener"
 #include <cutils/log.h>
@@ -41,12 +44,125 @@ NetlinkListener::NetlinkListener(int socket, int format) :
                             SocketListener(socket, false), mFormat(format) {
 }
 
+#ifdef __NR_recvmmsg
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0x10000
+#endif
+
+/* The kernel's struct mmsghdr; not every libc we build against has it. */
+struct nl_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+/* Set once the kernel has said it has no recvmmsg() */
+static bool sBatchUnsupported;
+
+/*
+ * Checks what uevent_kernel_multicast_uid_recv() checks, for one message of
+ * a batch: it must carry root credentials and come from the kernel.
+ */
+static bool fromKernel(struct msghdr *hdr, uid_t *uid) {
+    struct sockaddr_nl *addr = (struct sockaddr_nl *) hdr->msg_name;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+
+    *uid = -1;
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS)
+        return false;
+    *uid = ((struct ucred *) CMSG_DATA(cmsg))->uid;
+    if (*uid != 0)
+        return false;
+    return addr->nl_groups != 0 && addr->nl_pid == 0;
+}
+
+/*
+ * mBuffer is split into NL_BATCH_SIZE slots so that a burst of events is
+ * picked up with one recvmmsg() instead of a wakeup per message.  The
+ * kernel multicasts nothing larger than NLMSG_GOODSIZE (at most 8K, and
+ * uevents are capped at 2K), so a slot holds any message it sends; anything
+ * that still comes back with MSG_TRUNC is dropped rather than misparsed.
+ *
+ * Returns the number of messages handled, or -1 with errno set.
+ */
+int NetlinkListener::receiveBatch(int socket)
+{
+    static const size_t slotSize = sizeof(mBuffer) / NL_BATCH_SIZE;
+    struct nl_mmsghdr msgs[NL_BATCH_SIZE];
+    struct iovec iov[NL_BATCH_SIZE];
+    struct sockaddr_nl addrs[NL_BATCH_SIZE];
+    char control[NL_BATCH_SIZE][CMSG_SPACE(sizeof(struct ucred))];
+    int count;
+    int i;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < NL_BATCH_SIZE; i++) {
+        iov[i].iov_base = mBuffer + i * slotSize;
+        iov[i].iov_len = slotSize;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    /* Wait for the first message only; take whatever else is already queued */
+    count = TEMP_FAILURE_RETRY(syscall(__NR_recvmmsg, socket, msgs, NL_BATCH_SIZE,
+                                       MSG_WAITFORONE, NULL));
+    if (count < 0)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        char *buffer = (char *) iov[i].iov_base;
+        uid_t uid;
+
+        if (!fromKernel(&msgs[i].msg_hdr, &uid)) {
+            if (uid > 0)
+                LOG_EVENT_INT(65537, uid);
+            SLOGE("recvmsg failed (%s)", strerror(EIO));
+            /* clear residual potentially malicious data */
+            memset(buffer, 0, slotSize);
+            continue;
+        }
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            SLOGE("Dropping netlink message longer than %zu bytes", slotSize);
+            continue;
+        }
+
+        dispatch(buffer, msgs[i].msg_len);
+    }
+    return count;
+}
+#endif
+
+void NetlinkListener::dispatch(char *buffer, ssize_t length) {
+    NetlinkEvent evt;
+    if (!evt.decode(buffer, length, mFormat)) {
+        SLOGE("Error decoding NetlinkEvent");
+    } else {
+        onEvent(&evt);
+    }
+}
+
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
 {
     int socket = cli->getSocket();
     ssize_t count;
     uid_t uid = -1;
 
+#ifdef __NR_recvmmsg
+    if (!sBatchUnsupported) {
+        if (receiveBatch(socket) >= 0)
+            return true;
+        if (errno != ENOSYS) {
+            SLOGE("recvmmsg failed (%s)", strerror(errno));
+            return false;
+        }
+        sBatchUnsupported = true;
+    }
+#endif
+
+    /* One message per wakeup, into the whole buffer */
     count = TEMP_FAILURE_RETRY(uevent_kernel_multicast_uid_recv(
                                        socket, mBuffer, sizeof(mBuffer), &uid));
     if (count < 0) {
@@ -56,13 +172,6 @@ bool NetlinkListener::onDataAvailable(SocketClient *cli)
         return false;
     }
 
-    NetlinkEvent *evt = new NetlinkEvent();
-    if (!evt->decode(mBuffer, count, mFormat)) {
-        SLOGE("Error decoding NetlinkEvent");
-    } else {
-        onEvent(evt);
-    }
-
-    delete evt;
+    dispatch(mBuffer, count);
     return true;
 }
@@ -1,7 +1,11 @@
 #include <alloca.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <pthread.h>
 #include <string.h>
 #include <arpa/inet.h>
@@ -10,6 +14,7 @@
 #include <cutils/log.h>
 
 #include <sysutils/SocketClient.h>
+#include <sysutils/SocketListener.h>
 
 SocketClient::SocketClient(int socket, bool owned) {
     init(socket, owned, false);
@@ -30,6 +35,16 @@ void SocketClient::init(int socket, bool owned, bool useCmdNum) {
     mGid = -1;
     mRefCount = 1;
     mCmdNum = 0;
+    mReply = NULL;
+    mReplyLen = 0;
+    mReplyCap = 0;
+    mAsync = false;
+    mMaxQueued = 0;
+    mQueue = NULL;
+    mQueueLen = 0;
+    mQueueCap = 0;
+    mListener = NULL;
+    mArmed = false;
 
     struct ucred creds;
     socklen_t szCreds = sizeof(creds);
@@ -48,6 +63,8 @@ SocketClient::~SocketClient()
     if (mSocketOwned) {
         close(mSocket);
     }
+    free(mReply);
+    free(mQueue);
 }
 
 int SocketClient::sendMsg(int code, const char *msg, bool addErrno) {
@@ -90,11 +107,14 @@ int SocketClient::sendBinaryMsg(int code, const void *data, int len) {
     uint32_t tmp = htonl(len);
     memcpy(buf + 4, &tmp, sizeof(uint32_t));
 
+    struct iovec iov[2];
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(buf);
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = len > 0 ? len : 0;
+
     pthread_mutex_lock(&mWriteMutex);
-    int result = sendDataLocked(buf, sizeof(buf));
-    if (result == 0 && len > 0) {
-        result = sendDataLocked(data, len);
-    }
+    int result = sendvLocked(iov, 2);
     pthread_mutex_unlock(&mWriteMutex);
 
     return result;
@@ -107,6 +127,60 @@ int SocketClient::sendCode(int code) {
     return sendData(buf, sizeof(buf));
 }
 
+int SocketClient::addReply(int code, const char *msg, bool addErrno) {
+    if (addErrno) {
+        if (mUseCmdNum) {
+            return appendReply("%d %d %s (%s)", code, getCmdNum(), msg, strerror(errno));
+        }
+        return appendReply("%d %s (%s)", code, msg, strerror(errno));
+    }
+    if (mUseCmdNum) {
+        return appendReply("%d %d %s", code, getCmdNum(), msg);
+    }
+    return appendReply("%d %s", code, msg);
+}
+
+/* Formats one message, including its null, onto the end of mReply */
+int SocketClient::appendReply(const char *fmt, ...) {
+    va_list ap;
+
+    while (1) {
+        size_t room = mReplyCap - mReplyLen;
+        int len = 0;
+
+        if (room) {
+            va_start(ap, fmt);
+            len = vsnprintf(mReply + mReplyLen, room, fmt, ap);
+            va_end(ap);
+            if (len < 0)
+                return -1;
+            if ((size_t) len < room) {
+                mReplyLen += len + 1;
+                return 0;
+            }
+        }
+
+        size_t cap = mReplyCap ? mReplyCap : 256;
+        while (cap < mReplyLen + len + 1)
+            cap *= 2;
+        if (cap == mReplyCap)
+            cap *= 2;
+        char *reply = (char *) realloc(mReply, cap);
+        if (!reply) {
+            SLOGW("Unable to grow reply (%s)", strerror(errno));
+            return -1;
+        }
+        mReply = reply;
+        mReplyCap = cap;
+    }
+}
+
+int SocketClient::sendReply() {
+    int rc = sendData(mReply, mReplyLen);
+    mReplyLen = 0;
+    return rc;
+}
+
 char *SocketClient::quoteArg(const char *arg) {
     int len = strlen(arg);
     char *result = (char *)malloc(len * 2 + 3);
@@ -156,30 +230,70 @@ int SocketClient::sendData(const void *data, int len) {
 }
 
 int SocketClient::sendDataLocked(const void *data, int len) {
-    int rc = 0;
-    const char *p = (const char*) data;
-    int brtw = len;
+    struct iovec iov;
+
+    iov.iov_base = (void *) data;
+    iov.iov_len = len > 0 ? len : 0;
+    return sendvLocked(&iov, 1);
+}
+
+/* Sends every byte described by iov, which is used up in the process */
+int SocketClient::sendvLocked(struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    int flags = MSG_NOSIGNAL;
+    int i;
 
     if (mSocket < 0) {
         errno = EHOSTUNREACH;
         return -1;
     }
 
-    if (len == 0) {
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    if (total == 0) {
         return 0;
     }
 
-    while (brtw > 0) {
-        rc = send(mSocket, p, brtw, MSG_NOSIGNAL);
+    if (mAsync) {
+        /* Anything already queued has to go out first */
+        if (mQueueLen && flushQueuedLocked() < 0)
+            return -1;
+        if (mQueueLen) {
+            if (mQueueLen + total > mMaxQueued) {
+                errno = EAGAIN;
+                return -1;
+            }
+            return queueLocked(iov, iovcnt);
+        }
+        flags |= MSG_DONTWAIT;
+    }
+
+    while (iovcnt > 0) {
+        struct msghdr mh;
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+        ssize_t rc = sendmsg(mSocket, &mh, flags);
         if (rc > 0) {
-            p += rc;
-            brtw -= rc;
+            while (iovcnt > 0 && (size_t) rc >= iov->iov_len) {
+                rc -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = (char *) iov->iov_base + rc;
+                iov->iov_len -= rc;
+            }
             continue;
         }
 
         if (rc < 0 && errno == EINTR)
             continue;
 
+        if (rc < 0 && mAsync && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return queueLocked(iov, iovcnt);
+
         if (rc == 0) {
             SLOGW("0 length write :(");
             errno = EIO;
@@ -191,6 +305,88 @@ int SocketClient::sendDataLocked(const void *data, int len) {
     return 0;
 }
 
+/*
+ * The listener only watches for the socket draining while something is
+ * queued, so when the queue starts filling it is told to look again.
+ */
+int SocketClient::queueLocked(const struct iovec *iov, int iovcnt) {
+    bool wasEmpty = mQueueLen == 0;
+    size_t total = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    if (mQueueLen + total > mQueueCap) {
+        size_t cap = mQueueCap ? mQueueCap : 1024;
+        while (cap < mQueueLen + total)
+            cap *= 2;
+        char *queue = (char *) realloc(mQueue, cap);
+        if (!queue) {
+            SLOGW("Unable to queue %zu bytes (%s)", total, strerror(errno));
+            return -1;
+        }
+        mQueue = queue;
+        mQueueCap = cap;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(mQueue + mQueueLen, iov[i].iov_base, iov[i].iov_len);
+        mQueueLen += iov[i].iov_len;
+    }
+    if (wasEmpty && mQueueLen && mListener)
+        mListener->wakeup();
+    return 0;
+}
+
+/* Sends as much of the queue as the socket will take without blocking */
+int SocketClient::flushQueuedLocked() {
+    size_t sent = 0;
+
+    while (sent < mQueueLen) {
+        ssize_t rc = send(mSocket, mQueue + sent, mQueueLen - sent,
+                          MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc > 0) {
+            sent += rc;
+            continue;
+        }
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        if (rc == 0)
+            errno = EIO;
+        SLOGW("write error (%s)", strerror(errno));
+        /* The stream is broken, so what is left can never be delivered */
+        mQueueLen = 0;
+        return -1;
+    }
+    memmove(mQueue, mQueue + sent, mQueueLen - sent);
+    mQueueLen -= sent;
+    return 0;
+}
+
+void SocketClient::setQueued(size_t maxQueued) {
+    pthread_mutex_lock(&mWriteMutex);
+    mAsync = maxQueued > 0;
+    mMaxQueued = maxQueued;
+    pthread_mutex_unlock(&mWriteMutex);
+}
+
+bool SocketClient::hasQueued() {
+    pthread_mutex_lock(&mWriteMutex);
+    bool queued = mQueueLen > 0;
+    pthread_mutex_unlock(&mWriteMutex);
+    return queued;
+}
+
+int SocketClient::flushQueued() {
+    pthread_mutex_lock(&mWriteMutex);
+    int rc = mQueueLen ? flushQueuedLocked() : 0;
+    pthread_mutex_unlock(&mWriteMutex);
+    return rc;
+}
+
 void SocketClient::incRef() {
     pthread_mutex_lock(&mRefCountMutex);
     mRefCount++;
@@ -16,8 +16,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -31,6 +33,12 @@
 
 #define LOG_NDEBUG 0
 
+#define MAX_EPOLL_EVENTS 16
+
+/* What is written down the control pipe */
+#define CTRL_PIPE_SHUTDOWN 0
+#define CTRL_PIPE_WAKEUP 1
+
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
 }
@@ -48,8 +56,19 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mSocketName = socketName;
     mSock = socketFd;
     mUseCmdNum = useCmdNum;
+    mCtrlPipe[0] = -1;
+    mCtrlPipe[1] = -1;
+    mEpollFd = -1;
     pthread_mutex_init(&mClientsLock, NULL);
     mClients = new SocketClientCollection();
+
+    mWorkerCount = 0;
+    mWorkers = NULL;
+    mWorkersExiting = false;
+    mWakePending = 0;
+    mPending = new SocketClientCollection();
+    pthread_mutex_init(&mPendingLock, NULL);
+    pthread_cond_init(&mPendingCond, NULL);
 }
 
 SocketListener::~SocketListener() {
@@ -60,12 +79,21 @@ SocketListener::~SocketListener() {
         close(mCtrlPipe[0]);
         close(mCtrlPipe[1]);
     }
+    if (mEpollFd != -1)
+        close(mEpollFd);
     SocketClientCollection::iterator it;
     for (it = mClients->begin(); it != mClients->end();) {
         (*it)->decRef();
         it = mClients->erase(it);
     }
     delete mClients;
+    delete mPending;
+    pthread_mutex_destroy(&mPendingLock);
+    pthread_cond_destroy(&mPendingCond);
+}
+
+void SocketListener::setWorkerCount(int count) {
+    mWorkerCount = count > 0 ? count : 0;
 }
 
 int SocketListener::startListener() {
@@ -87,15 +115,61 @@ int SocketListener::startListener() {
         SLOGE("Unable to listen on socket (%s)", strerror(errno));
         return -1;
     } else if (!mListen)
-        mClients->push_back(new SocketClient(mSock, false, mUseCmdNum));
+        addClient(new SocketClient(mSock, false, mUseCmdNum));
 
     if (pipe(mCtrlPipe)) {
         SLOGE("pipe failed (%s)", strerror(errno));
         return -1;
     }
 
+    if ((mEpollFd = epoll_create(MAX_EPOLL_EVENTS)) < 0) {
+        SLOGE("epoll_create failed (%s)", strerror(errno));
+        return -1;
+    }
+
+    /*
+     * The control pipe and the listening socket are told apart from the
+     * clients by pointing at our own members; everything else carries the
+     * SocketClient itself.
+     */
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = mCtrlPipe;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCtrlPipe[0], &ev) < 0) {
+        SLOGE("epoll_ctl failed for control pipe (%s)", strerror(errno));
+        return -1;
+    }
+    if (mListen) {
+        ev.data.ptr = &mSock;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mSock, &ev) < 0) {
+            SLOGE("epoll_ctl failed for socket (%s)", strerror(errno));
+            return -1;
+        }
+    }
+
+    SocketClientCollection::iterator it;
+    for (it = mClients->begin(); it != mClients->end(); ++it) {
+        if (watchClient(*it, EPOLL_CTL_ADD) < 0)
+            return -1;
+    }
+
+    if (mWorkerCount) {
+        mWorkersExiting = false;
+        mWorkers = new pthread_t[mWorkerCount];
+        for (int i = 0; i < mWorkerCount; i++) {
+            if (pthread_create(&mWorkers[i], NULL, SocketListener::workerStart, this)) {
+                SLOGE("pthread_create (%s)", strerror(errno));
+                mWorkerCount = i;
+                stopWorkers();
+                return -1;
+            }
+        }
+    }
+
     if (pthread_create(&mThread, NULL, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
+        stopWorkers();
         return -1;
     }
 
@@ -103,7 +177,7 @@ int SocketListener::startListener() {
 }
 
 int SocketListener::stopListener() {
-    char c = 0;
+    char c = CTRL_PIPE_SHUTDOWN;
     int  rc;
 
     rc = TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &c, 1));
@@ -117,10 +191,14 @@ int SocketListener::stopListener() {
         SLOGE("Error joining to listener thread (%s)", strerror(errno));
         return -1;
     }
+    stopWorkers();
+
     close(mCtrlPipe[0]);
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
     mCtrlPipe[1] = -1;
+    close(mEpollFd);
+    mEpollFd = -1;
 
     if (mSocketName && mSock > -1) {
         close(mSock);
@@ -143,104 +221,222 @@ void *SocketListener::threadStart(void *obj) {
     return NULL;
 }
 
-void SocketListener::runListener() {
+void *SocketListener::workerStart(void *obj) {
+    SocketListener *me = reinterpret_cast<SocketListener *>(obj);
 
-    SocketClientCollection *pendingList = new SocketClientCollection();
+    me->runWorker();
+    pthread_exit(NULL);
+    return NULL;
+}
 
-    while(1) {
-        SocketClientCollection::iterator it;
-        fd_set read_fds;
-        int rc = 0;
-        int max = -1;
+void SocketListener::addClient(SocketClient *c) {
+    c->mListener = this;
+    pthread_mutex_lock(&mClientsLock);
+    mClients->push_back(c);
+    pthread_mutex_unlock(&mClientsLock);
+}
 
-        FD_ZERO(&read_fds);
+/*
+ * Clients are registered one-shot: once a client has been reported it is
+ * not reported again until handleClient() re-arms it, so a client is never
+ * in the hands of more than one thread.  mArmed tracks which side of that
+ * the client is on.
+ */
+int SocketListener::watchClient(SocketClient *c, int op) {
+    struct epoll_event ev;
+    int rc = 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    if (c->hasQueued())
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = c;
+    pthread_mutex_lock(&mClientsLock);
+    if (epoll_ctl(mEpollFd, op, c->getSocket(), &ev) < 0) {
+        SLOGE("epoll_ctl failed for %d (%s)", c->getSocket(), strerror(errno));
+        rc = -1;
+    } else {
+        c->mArmed = true;
+    }
+    pthread_mutex_unlock(&mClientsLock);
+    return rc;
+}
 
-        if (mListen) {
-            max = mSock;
-            FD_SET(mSock, &read_fds);
-        }
+/* Called by clients whose queue was empty and no longer is */
+void SocketListener::wakeup() {
+    char c = CTRL_PIPE_WAKEUP;
 
-        FD_SET(mCtrlPipe[0], &read_fds);
-        if (mCtrlPipe[0] > max)
-            max = mCtrlPipe[0];
+    /* One wakeup in the pipe at a time, so it can never fill up */
+    if (mCtrlPipe[1] < 0 || android_atomic_cmpxchg(0, 1, &mWakePending))
+        return;
+    if (TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &c, 1)) != 1) {
+        SLOGE("Error writing to control pipe (%s)", strerror(errno));
+        android_atomic_release_store(0, &mWakePending);
+    }
+}
 
+/*
+ * Adds EPOLLOUT for waiting clients that have something queued.  Clients
+ * out being handled are left alone; handleClient() re-arms them with
+ * EPOLLOUT if need be.
+ */
+void SocketListener::watchQueued() {
+    SocketClientCollection::iterator it;
+    struct epoll_event ev;
+
+    pthread_mutex_lock(&mClientsLock);
+    for (it = mClients->begin(); it != mClients->end(); ++it) {
+        SocketClient *c = *it;
+
+        if (!c->mArmed || !c->hasQueued())
+            continue;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLONESHOT;
+        ev.data.ptr = c;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, c->getSocket(), &ev) < 0)
+            SLOGE("epoll_ctl failed for %d (%s)", c->getSocket(), strerror(errno));
+    }
+    pthread_mutex_unlock(&mClientsLock);
+}
+
+void SocketListener::handleClient(SocketClient *c) {
+    /* Process it, if false is returned and our sockets are
+     * connection-based, remove and destroy it */
+    if (!onDataAvailable(c) && mListen) {
+        /* Remove the client from our array */
+        SLOGV("going to zap %d for %s", c->getSocket(), mSocketName);
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, c->getSocket(), NULL);
         pthread_mutex_lock(&mClientsLock);
+        SocketClientCollection::iterator it;
         for (it = mClients->begin(); it != mClients->end(); ++it) {
-            int fd = (*it)->getSocket();
-            FD_SET(fd, &read_fds);
-            if (fd > max)
-                max = fd;
+            if (*it == c) {
+                mClients->erase(it);
+                break;
+            }
         }
         pthread_mutex_unlock(&mClientsLock);
-        SLOGV("mListen=%d, max=%d, mSocketName=%s", mListen, max, mSocketName);
-        if ((rc = select(max + 1, &read_fds, NULL, NULL, NULL)) < 0) {
+        /* Remove our reference to the client */
+        c->decRef();
+        return;
+    }
+    watchClient(c, EPOLL_CTL_MOD);
+}
+
+void SocketListener::runListener() {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    while(1) {
+        bool woken = false;
+        int nr = epoll_wait(mEpollFd, events, MAX_EPOLL_EVENTS, -1);
+        if (nr < 0) {
             if (errno == EINTR)
                 continue;
-            SLOGE("select failed (%s) mListen=%d, max=%d", strerror(errno), mListen, max);
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
             sleep(1);
             continue;
-        } else if (!rc)
-            continue;
-
-        if (FD_ISSET(mCtrlPipe[0], &read_fds))
-            break;
-        if (mListen && FD_ISSET(mSock, &read_fds)) {
-            struct sockaddr addr;
-            socklen_t alen;
-            int c;
-
-            do {
-                alen = sizeof(addr);
-                c = accept(mSock, &addr, &alen);
-                SLOGV("%s got %d from accept", mSocketName, c);
-            } while (c < 0 && errno == EINTR);
-            if (c < 0) {
-                SLOGE("accept failed (%s)", strerror(errno));
-                sleep(1);
-                continue;
-            }
-            pthread_mutex_lock(&mClientsLock);
-            mClients->push_back(new SocketClient(c, true, mUseCmdNum));
-            pthread_mutex_unlock(&mClientsLock);
         }
 
-        /* Add all active clients to the pending list first */
-        pendingList->clear();
+        /* Whatever was reported is no longer armed, whatever we do with it */
         pthread_mutex_lock(&mClientsLock);
-        for (it = mClients->begin(); it != mClients->end(); ++it) {
-            int fd = (*it)->getSocket();
-            if (FD_ISSET(fd, &read_fds)) {
-                pendingList->push_back(*it);
-            }
+        for (int i = 0; i < nr; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr != mCtrlPipe && ptr != &mSock)
+                reinterpret_cast<SocketClient *>(ptr)->mArmed = false;
         }
         pthread_mutex_unlock(&mClientsLock);
 
-        /* Process the pending list, since it is owned by the thread,
-         * there is no need to lock it */
-        while (!pendingList->empty()) {
-            /* Pop the first item from the list */
-            it = pendingList->begin();
-            SocketClient* c = *it;
-            pendingList->erase(it);
-            /* Process it, if false is returned and our sockets are
-             * connection-based, remove and destroy it */
-            if (!onDataAvailable(c) && mListen) {
-                /* Remove the client from our array */
-                SLOGV("going to zap %d for %s", c->getSocket(), mSocketName);
-                pthread_mutex_lock(&mClientsLock);
-                for (it = mClients->begin(); it != mClients->end(); ++it) {
-                    if (*it == c) {
-                        mClients->erase(it);
-                        break;
-                    }
+        for (int i = 0; i < nr; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == mCtrlPipe) {
+                char c;
+
+                android_atomic_release_store(0, &mWakePending);
+                if (TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1)) == 1 &&
+                        c == CTRL_PIPE_SHUTDOWN)
+                    return;
+                woken = true;
+                continue;
+            }
+
+            if (ptr == &mSock) {
+                struct sockaddr addr;
+                socklen_t alen;
+                int c;
+
+                do {
+                    alen = sizeof(addr);
+                    c = accept(mSock, &addr, &alen);
+                    SLOGV("%s got %d from accept", mSocketName, c);
+                } while (c < 0 && errno == EINTR);
+                if (c < 0) {
+                    SLOGE("accept failed (%s)", strerror(errno));
+                    sleep(1);
+                    continue;
                 }
-                pthread_mutex_unlock(&mClientsLock);
-                /* Remove our reference to the client */
-                c->decRef();
+                SocketClient *client = new SocketClient(c, true, mUseCmdNum);
+                addClient(client);
+                watchClient(client, EPOLL_CTL_ADD);
+                continue;
             }
+
+            SocketClient *c = reinterpret_cast<SocketClient *>(ptr);
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                /* Only writable: push out replies the client has queued */
+                c->flushQueued();
+                watchClient(c, EPOLL_CTL_MOD);
+                continue;
+            }
+            if (!mWorkerCount) {
+                handleClient(c);
+                continue;
+            }
+            pthread_mutex_lock(&mPendingLock);
+            mPending->push_back(c);
+            pthread_cond_signal(&mPendingCond);
+            pthread_mutex_unlock(&mPendingLock);
         }
+        /* After the loop, so that clients reported above count as handled */
+        if (woken)
+            watchQueued();
     }
-    delete pendingList;
+}
+
+void SocketListener::runWorker() {
+    while(1) {
+        pthread_mutex_lock(&mPendingLock);
+        while (mPending->empty() && !mWorkersExiting)
+            pthread_cond_wait(&mPendingCond, &mPendingLock);
+        if (mWorkersExiting) {
+            pthread_mutex_unlock(&mPendingLock);
+            break;
+        }
+        SocketClientCollection::iterator it = mPending->begin();
+        SocketClient *c = *it;
+        mPending->erase(it);
+        pthread_mutex_unlock(&mPendingLock);
+
+        handleClient(c);
+    }
+}
+
+void SocketListener::stopWorkers() {
+    if (!mWorkers)
+        return;
+
+    pthread_mutex_lock(&mPendingLock);
+    mWorkersExiting = true;
+    pthread_cond_broadcast(&mPendingCond);
+    pthread_mutex_unlock(&mPendingLock);
+
+    for (int i = 0; i < mWorkerCount; i++)
+        pthread_join(mWorkers[i], NULL);
+    delete[] mWorkers;
+    mWorkers = NULL;
+
+    /* Clients still waiting remain in mClients, which owns them */
+    mPending->clear();
 }
 
 void SocketListener::sendBroadcast(int code, const char *msg, bool addErrno) {
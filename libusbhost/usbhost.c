@@ -34,11 +34,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <stddef.h>
+#include <limits.h>
 
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -61,6 +63,19 @@
 #define MAX_USBFS_BUFFER_SIZE   16384
 
 #define MAX_USBFS_WD_COUNT      10
+// device numbers on a bus run from 1 to 127
+#define MAX_USBFS_DEV_COUNT     128
+
+// Capabilities of newer kernels; not all our headers know them yet
+#ifndef USBDEVFS_GET_CAPABILITIES
+#define USBDEVFS_GET_CAPABILITIES       _IOR('U', 26, __u32)
+#endif
+#ifndef USBDEVFS_CAP_BULK_SCATTER_GATHER
+#define USBDEVFS_CAP_BULK_SCATTER_GATHER    0x08
+#endif
+#ifndef USBDEVFS_CAP_MMAP
+#define USBDEVFS_CAP_MMAP                   0x20
+#endif
 
 struct usb_host_context {
     int                         fd;
@@ -70,6 +85,8 @@ struct usb_host_context {
     int                         wds[MAX_USBFS_WD_COUNT];
     int                         wdd;
     int                         wddbus;
+    /* devices reported to cb_added, so rescans do not report them twice */
+    unsigned char               present[MAX_USBFS_WD_COUNT][MAX_USBFS_DEV_COUNT / 8];
 };
 
 struct usb_device {
@@ -78,6 +95,24 @@ struct usb_device {
     int desc_length;
     int fd;
     int writeable;
+    int caps_valid;
+    unsigned int caps;
+    /* string descriptors read so far, in the first supported language */
+    __u16 languages[128];
+    int language_count;
+    int languages_valid;
+    char *strings[256];
+};
+
+struct usb_stream {
+    struct usb_device *dev;
+    int num_requests;
+    int buffer_size;
+    int mmapped;
+    struct usb_request **requests;
+    /* requests not queued with the kernel, for the caller to fill */
+    struct usb_request **idle;
+    int idle_count;
 };
 
 static inline int badname(const char *name)
@@ -88,9 +123,45 @@ static inline int badname(const char *name)
     return 0;
 }
 
-static int find_existing_devices_bus(char *busname,
-                                     usb_device_added_cb added_cb,
-                                     void *client_data)
+/* Returns the presence bit of device dev_name in *bit, or NULL if untracked */
+static unsigned char *device_present(struct usb_host_context *context,
+                                     const char *dev_name, unsigned char *bit)
+{
+    int bus = 0, dev = 0;
+
+    if (sscanf(dev_name, USB_FS_ID_SCANNER, &bus, &dev) != 2)
+        return NULL;
+    if (bus <= 0 || bus >= MAX_USBFS_WD_COUNT || dev <= 0 || dev >= MAX_USBFS_DEV_COUNT)
+        return NULL;
+    *bit = 1 << (dev % 8);
+    return &context->present[bus][dev / 8];
+}
+
+static int device_added(struct usb_host_context *context, const char *dev_name)
+{
+    unsigned char bit;
+    unsigned char *present = device_present(context, dev_name, &bit);
+
+    if (present) {
+        if (*present & bit)
+            return 0;
+        *present |= bit;
+    }
+    return context->cb_added(dev_name, context->data);
+}
+
+static int device_removed(struct usb_host_context *context, const char *dev_name)
+{
+    unsigned char bit;
+    unsigned char *present = device_present(context, dev_name, &bit);
+
+    if (present)
+        *present &= ~bit;
+    return context->cb_removed(dev_name, context->data);
+}
+
+static int find_existing_devices_bus(struct usb_host_context *context,
+                                     char *busname)
 {
     char devname[32];
     DIR *devdir;
@@ -104,7 +175,7 @@ static int find_existing_devices_bus(char *busname,
         if(badname(de->d_name)) continue;
 
         snprintf(devname, sizeof(devname), "%s/%s", busname, de->d_name);
-        done = added_cb(devname, client_data);
+        done = device_added(context, devname);
     } // end of devdir while
     closedir(devdir);
 
@@ -112,8 +183,7 @@ static int find_existing_devices_bus(char *busname,
 }
 
 /* returns true if one of the callbacks indicates we are done */
-static int find_existing_devices(usb_device_added_cb added_cb,
-                                  void *client_data)
+static int find_existing_devices(struct usb_host_context *context)
 {
     char busname[32];
     DIR *busdir;
@@ -127,8 +197,7 @@ static int find_existing_devices(usb_device_added_cb added_cb,
         if(badname(de->d_name)) continue;
 
         snprintf(busname, sizeof(busname), USB_FS_DIR "/%s", de->d_name);
-        done = find_existing_devices_bus(busname, added_cb,
-                                         client_data);
+        done = find_existing_devices_bus(context, busname);
     } //end of busdir while
     closedir(busdir);
 
@@ -213,7 +282,7 @@ int usb_host_load(struct usb_host_context *context,
     watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
 
     /* check for existing devices first, after we have inotify set up */
-    done = find_existing_devices(added_cb, client_data);
+    done = find_existing_devices(context);
     if (discovery_done_cb)
         done |= discovery_done_cb(client_data);
 
@@ -223,7 +292,8 @@ int usb_host_load(struct usb_host_context *context,
 int usb_host_read_event(struct usb_host_context *context)
 {
     struct inotify_event* event;
-    char event_buf[512];
+    // room for a hub's worth of events, so a burst is handled in one call
+    char event_buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
     char path[100];
     int i, ret, done = 0;
     int offset = 0;
@@ -242,14 +312,15 @@ int usb_host_read_event(struct usb_host_context *context)
                         done = 1;
                     } else {
                         watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
-                        done = find_existing_devices(context->cb_added, context->data);
+                        done = find_existing_devices(context);
                     }
                 }
             } else if (wd == context->wddbus) {
                 if ((event->mask & IN_CREATE) && !strcmp(event->name, "usb")) {
                     watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
-                    done = find_existing_devices(context->cb_added, context->data);
+                    done = find_existing_devices(context);
                 } else if ((event->mask & IN_DELETE) && !strcmp(event->name, "usb")) {
+                    memset(context->present, 0, sizeof(context->present));
                     for (i = 0; i < MAX_USBFS_WD_COUNT; i++) {
                         if (context->wds[i] >= 0) {
                             inotify_rm_watch(context->fd, context->wds[i]);
@@ -268,9 +339,9 @@ int usb_host_read_event(struct usb_host_context *context)
                                 IN_CREATE | IN_DELETE);
                         if (ret >= 0)
                             context->wds[i] = ret;
-                        done = find_existing_devices_bus(path, context->cb_added,
-                                context->data);
+                        done = find_existing_devices_bus(context, path);
                     } else if (event->mask & IN_DELETE) {
+                        memset(context->present[i], 0, sizeof(context->present[i]));
                         inotify_rm_watch(context->fd, context->wds[i]);
                         context->wds[i] = -1;
                     }
@@ -281,10 +352,10 @@ int usb_host_read_event(struct usb_host_context *context)
                         snprintf(path, sizeof(path), USB_FS_DIR "/%03d/%s", i, event->name);
                         if (event->mask == IN_CREATE) {
                             D("new device %s\n", path);
-                            done = context->cb_added(path, context->data);
+                            done = device_added(context, path);
                         } else if (event->mask == IN_DELETE) {
                             D("gone device %s\n", path);
-                            done = context->cb_removed(path, context->data);
+                            done = device_removed(context, path);
                         }
                     }
                 }
@@ -346,6 +417,10 @@ retry:
 
 void usb_device_close(struct usb_device *device)
 {
+    int i;
+
+    for (i = 0; i < 256; i++)
+        free(device->strings[i]);
     close(device->fd);
     free(device);
 }
@@ -445,30 +520,34 @@ const struct usb_device_descriptor* usb_device_get_device_descriptor(struct usb_
     return (struct usb_device_descriptor*)device->desc;
 }
 
-char* usb_device_get_string(struct usb_device *device, int id)
+static char* usb_device_read_string(struct usb_device *device, int id)
 {
     char string[256];
     __u16 buffer[128];
-    __u16 languages[128];
     int i, result;
-    int languageCount = 0;
 
     string[0] = 0;
-    memset(languages, 0, sizeof(languages));
 
-    // read list of supported languages
-    result = usb_device_control_transfer(device,
-            USB_DIR_IN|USB_TYPE_STANDARD|USB_RECIP_DEVICE, USB_REQ_GET_DESCRIPTOR,
-            (USB_DT_STRING << 8) | 0, 0, languages, sizeof(languages), 0);
-    if (result > 0)
-        languageCount = (result - 2) / 2;
+    // read list of supported languages, once per device
+    if (!device->languages_valid) {
+        memset(device->languages, 0, sizeof(device->languages));
+        result = usb_device_control_transfer(device,
+                USB_DIR_IN|USB_TYPE_STANDARD|USB_RECIP_DEVICE, USB_REQ_GET_DESCRIPTOR,
+                (USB_DT_STRING << 8) | 0, 0, device->languages,
+                sizeof(device->languages), 0);
+        if (result > 0)
+            device->language_count = (result - 2) / 2;
+        else if (result < 0)
+            return NULL; // may be transient, so try again next time
+        device->languages_valid = 1;
+    }
 
-    for (i = 1; i <= languageCount; i++) {
+    for (i = 1; i <= device->language_count; i++) {
         memset(buffer, 0, sizeof(buffer));
 
         result = usb_device_control_transfer(device,
                 USB_DIR_IN|USB_TYPE_STANDARD|USB_RECIP_DEVICE, USB_REQ_GET_DESCRIPTOR,
-                (USB_DT_STRING << 8) | id, languages[i], buffer, sizeof(buffer), 0);
+                (USB_DT_STRING << 8) | id, device->languages[i], buffer, sizeof(buffer), 0);
         if (result > 0) {
             int i;
             // skip first word, and copy the rest to the string, changing shorts to bytes.
@@ -483,6 +562,20 @@ char* usb_device_get_string(struct usb_device *device, int id)
     return NULL;
 }
 
+char* usb_device_get_string(struct usb_device *device, int id)
+{
+    if (id <= 0 || id > 255)
+        return NULL;
+
+    // descriptors do not change while the device is open
+    if (!device->strings[id]) {
+        device->strings[id] = usb_device_read_string(device, id);
+        if (!device->strings[id])
+            return NULL;
+    }
+    return strdup(device->strings[id]);
+}
+
 char* usb_device_get_manufacturer_name(struct usb_device *device)
 {
     struct usb_device_descriptor *desc = (struct usb_device_descriptor *)device->desc;
@@ -582,6 +675,30 @@ int usb_device_control_transfer(struct usb_device *device,
     return ioctl(device->fd, USBDEVFS_CONTROL, &ctrl);
 }
 
+/* USBDEVFS_CAP_* flags of the kernel driving this device, 0 if unknown */
+static unsigned int usb_device_get_caps(struct usb_device *device)
+{
+    __u32 caps;
+
+    if (!device->caps_valid) {
+        if (ioctl(device->fd, USBDEVFS_GET_CAPABILITIES, &caps) == 0)
+            device->caps = caps;
+        else
+            device->caps = 0;
+        device->caps_valid = 1;
+    }
+    return device->caps;
+}
+
+/* Largest buffer one URB may carry on this device */
+static int usb_device_max_urb_size(struct usb_device *device)
+{
+    // with scatter-gather the kernel splits big bulk URBs itself
+    if (usb_device_get_caps(device) & USBDEVFS_CAP_BULK_SCATTER_GATHER)
+        return INT_MAX;
+    return MAX_USBFS_BUFFER_SIZE;
+}
+
 int usb_device_bulk_transfer(struct usb_device *device,
                             int endpoint,
                             void* buffer,
@@ -646,11 +763,13 @@ int usb_request_queue(struct usb_request *req)
     struct usbdevfs_urb *urb = (struct usbdevfs_urb*)req->private_data;
     int res;
 
+    int max = usb_device_max_urb_size(req->dev);
+
     urb->status = -1;
     urb->buffer = req->buffer;
     // need to limit request size to avoid EINVAL
-    if (req->buffer_length > MAX_USBFS_BUFFER_SIZE)
-        urb->buffer_length = MAX_USBFS_BUFFER_SIZE;
+    if (req->buffer_length > max)
+        urb->buffer_length = max;
     else
         urb->buffer_length = req->buffer_length;
 
@@ -692,3 +811,166 @@ int usb_request_cancel(struct usb_request *req)
     return ioctl(req->dev->fd, USBDEVFS_DISCARDURB, &urb);
 }
 
+
+/* Picks up one finished URB; with nowait, returns NULL at once if none is */
+static struct usb_request *usb_request_reap(struct usb_device *dev, int nowait)
+{
+    struct usbdevfs_urb *urb = NULL;
+    struct usb_request *req;
+    int res;
+
+    do {
+        res = ioctl(dev->fd, nowait ? USBDEVFS_REAPURBNDELAY : USBDEVFS_REAPURB, &urb);
+    } while ((res < 0) && (errno == EINTR));
+    if (res < 0)
+        return NULL;
+
+    req = (struct usb_request*)urb->usercontext;
+    req->actual_length = urb->actual_length;
+    return req;
+}
+
+struct usb_stream *usb_stream_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc,
+        int num_requests, int buffer_size)
+{
+    struct usb_stream *stream;
+    int max = usb_device_max_urb_size(dev);
+    int i, j;
+
+    if (num_requests <= 0 || buffer_size <= 0)
+        return NULL;
+    if (buffer_size > max)
+        buffer_size = max;
+
+    stream = calloc(1, sizeof(struct usb_stream));
+    if (!stream)
+        return NULL;
+    stream->dev = dev;
+    stream->buffer_size = buffer_size;
+    stream->mmapped = (usb_device_get_caps(dev) & USBDEVFS_CAP_MMAP) != 0;
+    stream->requests = calloc(num_requests, sizeof(struct usb_request *));
+    stream->idle = calloc(num_requests, sizeof(struct usb_request *));
+    if (!stream->requests || !stream->idle)
+        goto failed;
+
+    for (i = 0; i < num_requests; i++) {
+        struct usb_request *req = usb_request_new(dev, ep_desc);
+        void *buffer = NULL;
+
+        if (!req)
+            goto failed;
+        stream->requests[i] = req;
+        stream->num_requests++;
+
+        // usbfs memory mapped into our address space spares the kernel
+        // copying every transfer; fall back to the heap if it is refused
+        if (stream->mmapped) {
+            buffer = mmap(NULL, buffer_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, dev->fd, 0);
+            if (buffer == MAP_FAILED) {
+                D("usb_stream_new mmap failed errno %d\n", errno);
+                buffer = NULL;
+                stream->mmapped = 0;
+                // release what was mapped so far and use the heap throughout
+                for (j = 0; j < i; j++) {
+                    munmap(stream->requests[j]->buffer, buffer_size);
+                    stream->requests[j]->buffer = malloc(buffer_size);
+                    if (!stream->requests[j]->buffer)
+                        goto failed;
+                }
+            }
+        }
+        if (!buffer)
+            buffer = malloc(buffer_size);
+        if (!buffer)
+            goto failed;
+        req->buffer = buffer;
+        req->buffer_length = buffer_size;
+        stream->idle[stream->idle_count++] = req;
+    }
+    return stream;
+
+failed:
+    usb_stream_free(stream);
+    return NULL;
+}
+
+void usb_stream_free(struct usb_stream *stream)
+{
+    int i;
+
+    if (!stream)
+        return;
+    for (i = 0; i < stream->num_requests; i++) {
+        struct usb_request *req = stream->requests[i];
+        if (req->buffer) {
+            if (stream->mmapped)
+                munmap(req->buffer, stream->buffer_size);
+            else
+                free(req->buffer);
+        }
+        usb_request_free(req);
+    }
+    free(stream->requests);
+    free(stream->idle);
+    free(stream);
+}
+
+int usb_stream_start(struct usb_stream *stream)
+{
+    while (stream->idle_count > 0) {
+        struct usb_request *req = stream->idle[stream->idle_count - 1];
+        req->buffer_length = stream->buffer_size;
+        if (usb_request_queue(req) < 0)
+            return -1;
+        stream->idle_count--;
+    }
+    return 0;
+}
+
+struct usb_request *usb_stream_get_idle(struct usb_stream *stream)
+{
+    if (stream->idle_count == 0)
+        return NULL;
+    return stream->idle[--stream->idle_count];
+}
+
+int usb_stream_queue(struct usb_stream *stream, struct usb_request *req)
+{
+    if (usb_request_queue(req) < 0) {
+        stream->idle[stream->idle_count++] = req;
+        return -1;
+    }
+    return 0;
+}
+
+void usb_stream_release(struct usb_stream *stream, struct usb_request *req)
+{
+    req->buffer_length = stream->buffer_size;
+    stream->idle[stream->idle_count++] = req;
+}
+
+int usb_stream_reap(struct usb_stream *stream, struct usb_request **reqs,
+        int max, int nowait)
+{
+    int count = 0;
+
+    while (count < max) {
+        struct usb_request *req = usb_request_reap(stream->dev, nowait || count > 0);
+        if (!req)
+            break;
+        reqs[count++] = req;
+    }
+    if (count == 0 && !(nowait && errno == EAGAIN))
+        return -1;
+    return count;
+}
+
+void usb_stream_cancel(struct usb_stream *stream)
+{
+    int i;
+
+    for (i = 0; i < stream->num_requests; i++)
+        usb_request_cancel(stream->requests[i]);
+}
@@ -21,6 +21,7 @@ commonSources:= \
 	BasicHashtable.cpp \
 	BlobCache.cpp \
 	CallStack.cpp \
+	CallStackStore.cpp \
 	FileMap.cpp \
 	JenkinsHash.cpp \
 	LinearAllocator.cpp \
@@ -30,6 +31,7 @@ commonSources:= \
 	ProcessCallStack.cpp \
 	PropertyMap.cpp \
 	RefBase.cpp \
+	RWLock.cpp \
 	SharedBuffer.cpp \
 	Static.cpp \
 	StopWatch.cpp \
@@ -64,7 +66,7 @@ endif
 include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= $(commonSources)
 ifeq ($(HOST_OS), linux)
-LOCAL_SRC_FILES += Looper.cpp
+LOCAL_SRC_FILES += Looper.cpp LooperPool.cpp ThreadPool.cpp
 endif
 LOCAL_MODULE:= libutils
 LOCAL_STATIC_LIBRARIES := liblog
@@ -78,7 +80,7 @@ include $(BUILD_HOST_STATIC_LIBRARY)
 include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= $(commonSources)
 ifeq ($(HOST_OS), linux)
-LOCAL_SRC_FILES += Looper.cpp
+LOCAL_SRC_FILES += Looper.cpp LooperPool.cpp ThreadPool.cpp
 endif
 LOCAL_MODULE:= lib64utils
 LOCAL_STATIC_LIBRARIES := liblog
@@ -96,16 +98,14 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= \
 	$(commonSources) \
 	Looper.cpp \
+	LooperPool.cpp \
+	ThreadPool.cpp \
 	Trace.cpp
 
 ifeq ($(TARGET_OS),linux)
 LOCAL_LDLIBS += -lrt -ldl
 endif
 
-ifeq ($(TARGET_ARCH),mips)
-LOCAL_CFLAGS += -DALIGN_DOUBLE
-endif
-
 LOCAL_C_INCLUDES += \
 		bionic/libc/private \
 		external/zlib
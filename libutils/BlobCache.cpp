@@ -22,6 +22,8 @@
 
 #include <utils/BlobCache.h>
 #include <utils/Errors.h>
+#include <utils/FileMap.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 
 namespace android {
@@ -39,20 +41,22 @@ BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize
         mMaxKeySize(maxKeySize),
         mMaxValueSize(maxValueSize),
         mMaxTotalSize(maxTotalSize),
-        mTotalSize(0) {
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-#ifdef _WIN32
-    srand(now);
-#else
-    mRandState[0] = (now >> 0) & 0xFFFF;
-    mRandState[1] = (now >> 16) & 0xFFFF;
-    mRandState[2] = (now >> 32) & 0xFFFF;
-#endif
-    ALOGV("initializing random seed using %lld", now);
+        mTotalSize(0),
+        mHitCount(0),
+        mMissCount(0),
+        mEvictionCount(0),
+        mEntryRemoved(this),
+        mCache(LruCache<BlobKey, sp<Blob> >::kUnlimitedCapacity) {
+    mCache.setOnEntryRemovedListener(&mEntryRemoved);
 }
 
 void BlobCache::set(const void* key, size_t keySize, const void* value,
         size_t valueSize) {
+    insert(key, keySize, value, valueSize, NULL);
+}
+
+void BlobCache::insert(const void* key, size_t keySize, const void* value,
+        size_t valueSize, FileMap* map) {
     if (mMaxKeySize < keySize) {
         ALOGV("set: not caching because the key is too large: %d (limit: %d)",
                 keySize, mMaxKeySize);
@@ -77,55 +81,43 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
         return;
     }
 
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
+    BlobKey dummyKey(new Blob(key, keySize, false));
 
     while (true) {
-        ssize_t index = mCacheEntries.indexOf(dummyEntry);
-        if (index < 0) {
-            // Create a new cache entry.
-            sp<Blob> keyBlob(new Blob(key, keySize, true));
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
-            size_t newTotalSize = mTotalSize + keySize + valueSize;
-            if (mMaxTotalSize < newTotalSize) {
-                if (isCleanable()) {
-                    // Clean the cache and try again.
-                    clean();
-                    continue;
-                } else {
-                    ALOGV("set: not caching new key/value pair because the "
-                            "total cache size limit would be exceeded: %d "
-                            "(limit: %d)",
-                            keySize + valueSize, mMaxTotalSize);
-                    break;
-                }
+        const sp<Blob>& oldValueBlob(mCache.get(dummyKey));
+        size_t oldSize = oldValueBlob != NULL ? keySize + oldValueBlob->getSize() : 0;
+        size_t newTotalSize = mTotalSize - oldSize + keySize + valueSize;
+        if (mMaxTotalSize < newTotalSize) {
+            if (isCleanable()) {
+                // Clean the cache and try again.
+                clean();
+                continue;
+            } else {
+                ALOGV("set: not caching new key/value pair because the "
+                        "total cache size limit would be exceeded: %d "
+                        "(limit: %d)",
+                        keySize + valueSize, mMaxTotalSize);
+                break;
             }
-            mCacheEntries.add(CacheEntry(keyBlob, valueBlob));
-            mTotalSize = newTotalSize;
-            ALOGV("set: created new cache entry with %d byte key and %d byte value",
-                    keySize, valueSize);
+        }
+
+        if (oldSize != 0) {
+            // Replace the existing cache entry; mEntryRemoved accounts for it.
+            mCache.remove(dummyKey);
+        }
+        sp<Blob> keyBlob;
+        sp<Blob> valueBlob;
+        if (map != NULL) {
+            keyBlob = new Blob(key, keySize, map);
+            valueBlob = new Blob(value, valueSize, map);
         } else {
-            // Update the existing cache entry.
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
-            sp<Blob> oldValueBlob(mCacheEntries[index].getValue());
-            size_t newTotalSize = mTotalSize + valueSize - oldValueBlob->getSize();
-            if (mMaxTotalSize < newTotalSize) {
-                if (isCleanable()) {
-                    // Clean the cache and try again.
-                    clean();
-                    continue;
-                } else {
-                    ALOGV("set: not caching new value because the total cache "
-                            "size limit would be exceeded: %d (limit: %d)",
-                            keySize + valueSize, mMaxTotalSize);
-                    break;
-                }
-            }
-            mCacheEntries.editItemAt(index).setValue(valueBlob);
-            mTotalSize = newTotalSize;
-            ALOGV("set: updated existing cache entry with %d byte key and %d byte "
-                    "value", keySize, valueSize);
+            keyBlob = new Blob(key, keySize, true);
+            valueBlob = new Blob(value, valueSize, true);
         }
+        mCache.put(BlobKey(keyBlob), valueBlob);
+        mTotalSize += keySize + valueSize;
+        ALOGV("set: %s cache entry with %d byte key and %d byte value",
+                oldSize != 0 ? "updated existing" : "created new", keySize, valueSize);
         break;
     }
 }
@@ -137,17 +129,17 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
                 keySize, mMaxKeySize);
         return 0;
     }
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
-    ssize_t index = mCacheEntries.indexOf(dummyEntry);
-    if (index < 0) {
+    BlobKey dummyKey(new Blob(key, keySize, false));
+    sp<Blob> valueBlob(mCache.get(dummyKey));
+    if (valueBlob == NULL) {
         ALOGV("get: no cache entry found for key of size %d", keySize);
+        mMissCount++;
         return 0;
     }
+    mHitCount++;
 
     // The key was found. Return the value if the caller's buffer is large
     // enough.
-    sp<Blob> valueBlob(mCacheEntries[index].getValue());
     size_t valueBlobSize = valueBlob->getSize();
     if (valueBlobSize <= valueSize) {
         ALOGV("get: copying %d bytes to caller's buffer", valueBlobSize);
@@ -165,10 +157,10 @@ static inline size_t align4(size_t size) {
 
 size_t BlobCache::getFlattenedSize() const {
     size_t size = sizeof(Header);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
+    LruCache<BlobKey, sp<Blob> >::Iterator it(mCache);
+    while (it.next()) {
+        const sp<Blob>& keyBlob = it.key().getBlob();
+        const sp<Blob>& valueBlob = it.value();
         size = align4(size);
         size += sizeof(EntryHeader) + keyBlob->getSize() +
                 valueBlob->getSize();
@@ -186,15 +178,15 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
     header->mMagicNumber = blobCacheMagic;
     header->mBlobCacheVersion = blobCacheVersion;
     header->mDeviceVersion = blobCacheDeviceVersion;
-    header->mNumEntries = mCacheEntries.size();
+    header->mNumEntries = mCache.size();
 
     // Write cache entries
     uint8_t* byteBuffer = reinterpret_cast<uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header));
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
+    LruCache<BlobKey, sp<Blob> >::Iterator it(mCache);
+    while (it.next()) {
+        const sp<Blob>& keyBlob = it.key().getBlob();
+        const sp<Blob>& valueBlob = it.value();
         size_t keySize = keyBlob->getSize();
         size_t valueSize = valueBlob->getSize();
 
@@ -219,8 +211,16 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
 }
 
 status_t BlobCache::unflatten(void const* buffer, size_t size) {
+    return unflattenEntries(buffer, size, NULL);
+}
+
+status_t BlobCache::unflatten(FileMap* map) {
+    return unflattenEntries(map->getDataPtr(), map->getDataLength(), map);
+}
+
+status_t BlobCache::unflattenEntries(void const* buffer, size_t size, FileMap* map) {
     // All errors should result in the BlobCache being in an empty state.
-    mCacheEntries.clear();
+    mCache.clear();
 
     // Read the cache header
     if (size < sizeof(Header)) {
@@ -244,7 +244,7 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     size_t numEntries = header->mNumEntries;
     for (size_t i = 0; i < numEntries; i++) {
         if (byteOffset + sizeof(EntryHeader) > size) {
-            mCacheEntries.clear();
+            mCache.clear();
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
@@ -256,13 +256,13 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
         size_t entrySize = sizeof(EntryHeader) + keySize + valueSize;
 
         if (byteOffset + entrySize > size) {
-            mCacheEntries.clear();
+            mCache.clear();
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
 
         const uint8_t* data = eheader->mData;
-        set(data, keySize, data + keySize, valueSize);
+        insert(data, keySize, data + keySize, valueSize, map);
 
         byteOffset += align4(entrySize);
     }
@@ -270,22 +270,11 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     return OK;
 }
 
-long int BlobCache::blob_random() {
-#ifdef _WIN32
-    return rand();
-#else
-    return nrand48(mRandState);
-#endif
-}
-
 void BlobCache::clean() {
-    // Remove a random cache entry until the total cache size gets below half
-    // the maximum total cache size.
-    while (mTotalSize > mMaxTotalSize / 2) {
-        size_t i = size_t(blob_random() % (mCacheEntries.size()));
-        const CacheEntry& entry(mCacheEntries[i]);
-        mTotalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
-        mCacheEntries.removeAt(i);
+    // Remove the least recently used cache entry until the total cache size
+    // gets below half the maximum total cache size.
+    while (mTotalSize > mMaxTotalSize / 2 && mCache.removeOldest()) {
+        mEvictionCount++;
     }
 }
 
@@ -296,23 +285,26 @@ bool BlobCache::isCleanable() const {
 BlobCache::Blob::Blob(const void* data, size_t size, bool copyData):
         mData(copyData ? malloc(size) : data),
         mSize(size),
-        mOwnsData(copyData) {
+        mOwnsData(copyData),
+        mMap(NULL) {
     if (data != NULL && copyData) {
         memcpy(const_cast<void*>(mData), data, size);
     }
 }
 
+BlobCache::Blob::Blob(const void* data, size_t size, FileMap* map):
+        mData(data),
+        mSize(size),
+        mOwnsData(false),
+        mMap(map->acquire()) {
+}
+
 BlobCache::Blob::~Blob() {
     if (mOwnsData) {
         free(const_cast<void*>(mData));
     }
-}
-
-bool BlobCache::Blob::operator<(const Blob& rhs) const {
-    if (mSize == rhs.mSize) {
-        return memcmp(mData, rhs.mData, mSize) < 0;
-    } else {
-        return mSize < rhs.mSize;
+    if (mMap != NULL) {
+        mMap->release();
     }
 }
 
@@ -324,39 +316,24 @@ size_t BlobCache::Blob::getSize() const {
     return mSize;
 }
 
-BlobCache::CacheEntry::CacheEntry() {
-}
-
-BlobCache::CacheEntry::CacheEntry(const sp<Blob>& key, const sp<Blob>& value):
-        mKey(key),
-        mValue(value) {
-}
-
-BlobCache::CacheEntry::CacheEntry(const CacheEntry& ce):
-        mKey(ce.mKey),
-        mValue(ce.mValue) {
-}
-
-bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
-    return *mKey < *rhs.mKey;
-}
-
-const BlobCache::CacheEntry& BlobCache::CacheEntry::operator=(const CacheEntry& rhs) {
-    mKey = rhs.mKey;
-    mValue = rhs.mValue;
-    return *this;
+BlobCache::BlobKey::BlobKey():
+        mHash(0) {
 }
 
-sp<BlobCache::Blob> BlobCache::CacheEntry::getKey() const {
-    return mKey;
+BlobCache::BlobKey::BlobKey(const sp<Blob>& blob):
+        mBlob(blob) {
+    const uint8_t* data = static_cast<const uint8_t*>(blob->getData());
+    mHash = JenkinsHashWhiten(JenkinsHashMixBytes(0, data, blob->getSize()));
 }
 
-sp<BlobCache::Blob> BlobCache::CacheEntry::getValue() const {
-    return mValue;
+bool BlobCache::BlobKey::operator==(const BlobKey& rhs) const {
+    return mHash == rhs.mHash
+            && mBlob->getSize() == rhs.mBlob->getSize()
+            && memcmp(mBlob->getData(), rhs.mBlob->getData(), mBlob->getSize()) == 0;
 }
 
-void BlobCache::CacheEntry::setValue(const sp<Blob>& value) {
-    mValue = value;
+void BlobCache::EntryRemoved::operator()(BlobKey& key, sp<Blob>& value) {
+    mCache->mTotalSize -= key.getBlob()->getSize() + value->getSize();
 }
 
 } // namespace android
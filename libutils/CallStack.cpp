@@ -19,9 +19,12 @@
 #include <utils/CallStack.h>
 #include <utils/Printer.h>
 #include <utils/Errors.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 #include <corkscrew/backtrace.h>
 
+#include <stdlib.h>
+
 namespace android {
 
 CallStack::CallStack() :
@@ -87,6 +90,15 @@ const void* CallStack::operator [] (int index) const {
     return reinterpret_cast<const void*>(mStack[index].absolute_pc);
 }
 
+hash_t CallStack::hash() const {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < mCount; i++) {
+        uintptr_t pc = mStack[i].absolute_pc;
+        hash = JenkinsHashMixBytes(hash, reinterpret_cast<const uint8_t*>(&pc), sizeof(pc));
+    }
+    return JenkinsHashWhiten(hash);
+}
+
 void CallStack::clear() {
     mCount = 0;
 }
@@ -109,6 +121,35 @@ void CallStack::update(int32_t ignoreDepth, int32_t maxDepth, pid_t tid) {
     mCount = count > 0 ? count : 0;
 }
 
+void CallStack::updateThreads(CallStack* const* stacks, const pid_t* tids, size_t count,
+        int32_t maxDepth) {
+    if (maxDepth > MAX_DEPTH) {
+        maxDepth = MAX_DEPTH;
+    }
+
+    thread_backtrace_t* threads = static_cast<thread_backtrace_t*>(
+            calloc(count, sizeof(thread_backtrace_t)));
+    if (threads == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            stacks[i]->update(0, maxDepth, tids[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        threads[i].tid = tids[i];
+        threads[i].frames = stacks[i]->mStack;
+    }
+
+    // Ignore as many frames as update() does.
+    unwind_backtrace_threads(threads, count, 1, maxDepth);
+
+    for (size_t i = 0; i < count; i++) {
+        ssize_t frames = threads[i].frame_count;
+        stacks[i]->mCount = frames > 0 ? frames : 0;
+    }
+    free(threads);
+}
+
 void CallStack::log(const char* logtag, android_LogPriority priority, const char* prefix) const {
     LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
     print(printer);
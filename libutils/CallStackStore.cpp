@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CallStackStore"
+
+#include <utils/CallStackStore.h>
+#include <utils/Printer.h>
+#include <utils/Log.h>
+#include <utils/Vector.h>
+#include <cutils/atomic.h>
+
+namespace android {
+
+// Compare the PC addresses only: the same call path can run at different
+// stack depths.
+static bool hasSamePcs(const CallStack& lhs, const CallStack& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); i++) {
+        if (lhs[i] != rhs[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CallStackStore::CallStackStore(uint32_t samplingInterval) :
+        mSamplingInterval(samplingInterval ? samplingInterval : 1), mCalls(0),
+        mTotalCount(0) {
+}
+
+CallStackStore::~CallStackStore() {
+}
+
+bool CallStackStore::record(int32_t ignoreDepth, int32_t maxDepth) {
+    if (mSamplingInterval > 1
+            && uint32_t(android_atomic_inc(&mCalls)) % mSamplingInterval != 0) {
+        return false;
+    }
+
+    CallStack stack;
+    stack.update(ignoreDepth + 1, maxDepth);
+    add(stack);
+    return true;
+}
+
+void CallStackStore::add(const CallStack& stack) {
+    hash_t hash = stack.hash();
+
+    AutoMutex _l(mLock);
+    mTotalCount += 1;
+    for (ssize_t index = mEntries.find(-1, hash, hash); index >= 0;
+            index = mEntries.find(index, hash, hash)) {
+        Entry& entry = mEntries.editEntryAt(index);
+        if (hasSamePcs(entry.stack, stack)) {
+            entry.count += 1;
+            return;
+        }
+    }
+
+    Entry entry;
+    entry.hash = hash;
+    entry.stack = stack;
+    entry.count = 1;
+    mEntries.add(hash, entry);
+}
+
+void CallStackStore::clear() {
+    AutoMutex _l(mLock);
+    mEntries.clear();
+    mTotalCount = 0;
+}
+
+void CallStackStore::log(const char* logtag, android_LogPriority priority,
+        const char* prefix) const {
+    LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
+    print(printer);
+}
+
+void CallStackStore::dump(int fd, int indent, const char* prefix) const {
+    FdPrinter printer(fd, indent, prefix);
+    print(printer);
+}
+
+void CallStackStore::print(Printer& printer) const {
+    // Symbolize a copy, so as not to hold up the threads recording call stacks.
+    Vector<Entry> entries;
+    size_t totalCount;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        entries.setCapacity(mEntries.size());
+        for (ssize_t index = mEntries.next(-1); index >= 0; index = mEntries.next(index)) {
+            entries.push(mEntries.entryAt(index));
+        }
+        totalCount = mTotalCount;
+    } // release lock
+
+    printer.printFormatLine("%zu call stacks, %zu distinct:", totalCount, entries.size());
+    PrefixPrinter csPrinter(printer, "    ");
+    for (size_t i = 0; i < entries.size(); i++) {
+        printer.printLine("");
+        printer.printFormatLine("  %zu times:", entries[i].count);
+        entries[i].stack.print(csPrinter);
+    }
+}
+
+size_t CallStackStore::size() const {
+    AutoMutex _l(mLock);
+    return mEntries.size();
+}
+
+size_t CallStackStore::getTotalCount() const {
+    AutoMutex _l(mLock);
+    return mTotalCount;
+}
+
+}; // namespace android
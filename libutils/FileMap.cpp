@@ -22,9 +22,12 @@
 
 #include <utils/FileMap.h>
 #include <utils/Log.h>
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_POSIX_FILEMAP
 #include <sys/mman.h>
@@ -39,13 +42,17 @@ using namespace android;
 
 /*static*/ long FileMap::mPageSize = -1;
 
+// The mappings returned by createShared(), and their reference counts.
+static Mutex gSharedMapsLock;
+static Vector<FileMap*> gSharedMaps;
+
 
 /*
  * Constructor.  Create an empty object.
  */
 FileMap::FileMap(void)
     : mRefCount(1), mFileName(NULL), mBasePtr(NULL), mBaseLength(0),
-      mDataPtr(NULL), mDataLength(0)
+      mDataPtr(NULL), mDataLength(0), mShared(false), mDevice(0), mInode(0)
 {
 }
 
@@ -90,6 +97,15 @@ FileMap::~FileMap(void)
  */
 bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
         bool readOnly)
+{
+    return create(origFileName, fd, offset, length, readOnly, 0);
+}
+
+/*
+ * Create a new mapping on an open file, with a combination of CreateFlags.
+ */
+bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
+        bool readOnly, int createFlags)
 {
 #ifdef HAVE_WIN32_FILEMAP
     int     adjust;
@@ -162,6 +178,10 @@ try_again:
     adjLength = length + adjust;
 
     flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (createFlags & POPULATE)
+        flags |= MAP_POPULATE;
+#endif
     prot = PROT_READ;
     if (!readOnly)
         prot |= PROT_WRITE;
@@ -196,6 +216,104 @@ try_again:
     return true;
 }
 
+/*
+ * Create or share a read-only mapping of a range of a file.
+ */
+/*static*/ FileMap* FileMap::createShared(const char* origFileName, int fd,
+        off64_t offset, size_t length, int createFlags)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ALOGE("fstat(%d) failed: %s\n", fd, strerror(errno));
+        return NULL;
+    }
+
+    {
+        Mutex::Autolock _l(gSharedMapsLock);
+        FileMap* map = findShared(st.st_dev, st.st_ino, offset, length);
+        if (map != NULL) {
+            map->mRefCount++;
+            return map;
+        }
+    }
+
+    // Map outside of the lock, since POPULATE reads the whole range in.
+    FileMap* newMap = new FileMap();
+    if (!newMap->create(origFileName, fd, offset, length, true, createFlags)) {
+        newMap->release();
+        return NULL;
+    }
+
+    Mutex::Autolock _l(gSharedMapsLock);
+    FileMap* map = findShared(st.st_dev, st.st_ino, offset, length);
+    if (map != NULL) {
+        // Someone else got there first.
+        map->mRefCount++;
+        newMap->release();
+        return map;
+    }
+    newMap->mShared = true;
+    newMap->mDevice = st.st_dev;
+    newMap->mInode = st.st_ino;
+    gSharedMaps.push(newMap);
+    return newMap;
+}
+
+/*
+ * Look a shared mapping up.  gSharedMapsLock must be held.
+ */
+/*static*/ FileMap* FileMap::findShared(dev_t device, ino_t inode, off64_t offset,
+        size_t length)
+{
+    for (size_t i = 0; i < gSharedMaps.size(); i++) {
+        FileMap* map = gSharedMaps[i];
+        if (map->mDevice == device && map->mInode == inode
+                && map->mDataOffset == offset && map->mDataLength == length) {
+            return map;
+        }
+    }
+    return NULL;
+}
+
+FileMap* FileMap::acquireShared(void)
+{
+    Mutex::Autolock _l(gSharedMapsLock);
+    mRefCount++;
+    return this;
+}
+
+void FileMap::releaseShared(void)
+{
+    {
+        Mutex::Autolock _l(gSharedMapsLock);
+        if (--mRefCount > 0)
+            return;
+        for (size_t i = 0; i < gSharedMaps.size(); i++) {
+            if (gSharedMaps[i] == this) {
+                gSharedMaps.removeAt(i);
+                break;
+            }
+        }
+    }
+    delete this;
+}
+
+#if HAVE_MADVISE
+static int getSysAdvice(FileMap::MapAdvice advice)
+{
+    switch (advice) {
+        case FileMap::NORMAL:       return MADV_NORMAL;
+        case FileMap::RANDOM:       return MADV_RANDOM;
+        case FileMap::SEQUENTIAL:   return MADV_SEQUENTIAL;
+        case FileMap::WILLNEED:     return MADV_WILLNEED;
+        case FileMap::DONTNEED:     return MADV_DONTNEED;
+        default:
+                                    assert(false);
+                                    return -1;
+    }
+}
+#endif // HAVE_MADVISE
+
 /*
  * Provide guidance to the system.
  */
@@ -204,16 +322,9 @@ int FileMap::advise(MapAdvice advice)
 #if HAVE_MADVISE
     int cc, sysAdvice;
 
-    switch (advice) {
-        case NORMAL:        sysAdvice = MADV_NORMAL;        break;
-        case RANDOM:        sysAdvice = MADV_RANDOM;        break;
-        case SEQUENTIAL:    sysAdvice = MADV_SEQUENTIAL;    break;
-        case WILLNEED:      sysAdvice = MADV_WILLNEED;      break;
-        case DONTNEED:      sysAdvice = MADV_DONTNEED;      break;
-        default:
-                            assert(false);
-                            return -1;
-    }
+    sysAdvice = getSysAdvice(advice);
+    if (sysAdvice < 0)
+        return -1;
 
     cc = madvise(mBasePtr, mBaseLength, sysAdvice);
     if (cc != 0)
@@ -223,3 +334,32 @@ int FileMap::advise(MapAdvice advice)
 	return -1;
 #endif // HAVE_MADVISE
 }
+
+/*
+ * Provide guidance to the system about part of the data.
+ */
+int FileMap::advise(MapAdvice advice, size_t offset, size_t length)
+{
+#if HAVE_MADVISE
+    int cc, sysAdvice;
+    size_t start, end;
+
+    sysAdvice = getSysAdvice(advice);
+    if (sysAdvice < 0 || offset > mDataLength)
+        return -1;
+    if (length > mDataLength - offset)
+        length = mDataLength - offset;
+
+    // madvise() wants a page-aligned start; mBasePtr is one.
+    start = ((char*) mDataPtr - (char*) mBasePtr) + offset;
+    end = start + length;
+    start -= start % mPageSize;
+
+    cc = madvise((char*) mBasePtr + start, end - start, sysAdvice);
+    if (cc != 0)
+        ALOGW("madvise(%d) failed: %s\n", sysAdvice, strerror(errno));
+    return cc;
+#else
+	return -1;
+#endif // HAVE_MADVISE
+}
@@ -26,10 +26,15 @@
 #define LOG_TAG "LinearAllocator"
 #define LOG_NDEBUG 1
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <utils/LinearAllocator.h>
 #include <utils/Log.h>
 
+#if defined(HAVE_PTHREADS)
+#include <pthread.h>
+#endif
+
 
 // The ideal size of a page allocation (these need to be multiples of 8)
 #define INITIAL_PAGE_SIZE ((size_t)4096) // 4kb
@@ -42,11 +47,19 @@
 // Must be smaller than INITIAL_PAGE_SIZE
 #define MAX_WASTE_SIZE ((size_t)1024)
 
-#if ALIGN_DOUBLE
-#define ALIGN_SZ (sizeof(double))
-#else
-#define ALIGN_SZ (sizeof(int))
-#endif
+// Allocations are aligned for the most demanding of these types, which
+// is at least a pointer and a double on every ABI we build for.
+union MaxAlign {
+    long long ll;
+    double d;
+    void* p;
+    void (*fn)();
+};
+struct MaxAlignProbe {
+    char c;
+    MaxAlign m;
+};
+#define ALIGN_SZ (offsetof(MaxAlignProbe, m))
 
 #define ALIGN(x) ((x + ALIGN_SZ - 1 ) & ~(ALIGN_SZ - 1))
 #define ALIGN_PTR(p) ((void*)(ALIGN((size_t)p)))
@@ -88,23 +101,26 @@ public:
     Page* next() { return mNextPage; }
     void setNext(Page* next) { mNextPage = next; }
 
-    Page()
+    // The size of the allocation holding the page, header included.
+    size_t size() const { return mSize; }
+
+    Page(size_t size)
         : mNextPage(0)
+        , mSize(size)
     {}
 
     void* operator new(size_t size, void* buf) { return buf; }
 
-    void* start() {
-        return (void*) (((size_t)this) + sizeof(Page));
-    }
-
-    void* end(int pageSize) {
-        return (void*) (((size_t)start()) + pageSize);
-    }
-
 private:
     Page(const Page& other) {}
     Page* mNextPage;
+    size_t mSize;
+};
+
+struct LinearAllocator::Destructor {
+    void (*destructor)(void*);
+    void* object;
+    Destructor* next;
 };
 
 LinearAllocator::LinearAllocator()
@@ -113,28 +129,65 @@ LinearAllocator::LinearAllocator()
     , mNext(0)
     , mCurrentPage(0)
     , mPages(0)
+    , mDedicatedPages(0)
+    , mDestructors(0)
     , mTotalAllocated(0)
     , mWastedSpace(0)
     , mPageCount(0)
     , mDedicatedPageCount(0) {}
 
 LinearAllocator::~LinearAllocator(void) {
-    Page* p = mPages;
-    while (p) {
-        Page* next = p->next();
-        p->~Page();
-        free(p);
-        RM_ALLOCATION(mPageSize);
-        p = next;
+    runDestructors(0);
+    Page* lists[] = { mDedicatedPages, mPages };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        Page* p = lists[i];
+        while (p) {
+            Page* next = p->next();
+            freePage(p);
+            p = next;
+        }
+    }
+}
+
+#if defined(HAVE_PTHREADS)
+
+static pthread_once_t gThreadAllocatorOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gThreadAllocatorKey;
+
+static void destroyThreadAllocator(void* allocator) {
+    delete static_cast<LinearAllocator*>(allocator);
+}
+
+static void initThreadAllocatorKey() {
+    pthread_key_create(&gThreadAllocatorKey, destroyThreadAllocator);
+}
+
+LinearAllocator& LinearAllocator::forThread() {
+    pthread_once(&gThreadAllocatorOnce, initThreadAllocatorKey);
+    LinearAllocator* allocator =
+            static_cast<LinearAllocator*>(pthread_getspecific(gThreadAllocatorKey));
+    if (!allocator) {
+        allocator = new LinearAllocator();
+        pthread_setspecific(gThreadAllocatorKey, allocator);
     }
+    return *allocator;
+}
+
+#else
+
+LinearAllocator& LinearAllocator::forThread() {
+    static LinearAllocator allocator;
+    return allocator;
 }
 
+#endif
+
 void* LinearAllocator::start(Page* p) {
-    return ALIGN_PTR(((size_t*)p) + sizeof(Page));
+    return ALIGN_PTR(((char*)p) + sizeof(Page));
 }
 
 void* LinearAllocator::end(Page* p) {
-    return ((char*)p) + mPageSize;
+    return ((char*)p) + p->size();
 }
 
 bool LinearAllocator::fitsInCurrentPage(size_t size) {
@@ -144,19 +197,27 @@ bool LinearAllocator::fitsInCurrentPage(size_t size) {
 void LinearAllocator::ensureNext(size_t size) {
     if (fitsInCurrentPage(size)) return;
 
+    // Reuse the pages kept by rewind() before making new ones
+    Page* next = mCurrentPage ? mCurrentPage->next() : mPages;
+    if (next && ((char*)start(next) + size) <= end(next)) {
+        mCurrentPage = next;
+        mNext = start(mCurrentPage);
+        return;
+    }
+
     if (mCurrentPage && mPageSize < MAX_PAGE_SIZE) {
         mPageSize = min(MAX_PAGE_SIZE, mPageSize * 2);
         mPageSize = ALIGN(mPageSize);
     }
     mWastedSpace += mPageSize;
     Page* p = newPage(mPageSize);
+    p->setNext(next);
     if (mCurrentPage) {
         mCurrentPage->setNext(p);
+    } else {
+        mPages = p;
     }
     mCurrentPage = p;
-    if (!mPages) {
-        mPages = mCurrentPage;
-    }
     mNext = start(mCurrentPage);
 }
 
@@ -167,10 +228,8 @@ void* LinearAllocator::alloc(size_t size) {
         // Allocation is too large, create a dedicated page for the allocation
         Page* page = newPage(size);
         mDedicatedPageCount++;
-        page->setNext(mPages);
-        mPages = page;
-        if (!mCurrentPage)
-            mCurrentPage = mPages;
+        page->setNext(mDedicatedPages);
+        mDedicatedPages = page;
         return start(page);
     }
     ensureNext(size);
@@ -182,22 +241,87 @@ void* LinearAllocator::alloc(size_t size) {
 
 void LinearAllocator::rewindIfLastAlloc(void* ptr, size_t allocSize) {
     // Don't bother rewinding across pages
+    if (!mCurrentPage) return;
     allocSize = ALIGN(allocSize);
     if (ptr >= start(mCurrentPage) && ptr < end(mCurrentPage)
             && ptr == ((char*)mNext - allocSize)) {
-        mTotalAllocated -= allocSize;
         mWastedSpace += allocSize;
         mNext = ptr;
     }
 }
 
+void LinearAllocator::registerDestructor(void (*destructor)(void*), void* object) {
+    Destructor* d = (Destructor*) alloc(sizeof(Destructor));
+    d->destructor = destructor;
+    d->object = object;
+    d->next = mDestructors;
+    mDestructors = d;
+}
+
+void LinearAllocator::runDestructors(Destructor* last) {
+    while (mDestructors != last) {
+        Destructor* d = mDestructors;
+        mDestructors = d->next;
+        d->destructor(d->object);
+    }
+}
+
+LinearAllocator::Mark LinearAllocator::mark() const {
+    Mark m;
+    m.mPage = mCurrentPage;
+    m.mNext = mNext;
+    m.mDedicatedPages = mDedicatedPages;
+    m.mDestructors = mDestructors;
+    m.mUsedSize = usedSize();
+    return m;
+}
+
+void LinearAllocator::rewind(const Mark& mark) {
+    runDestructors(mark.mDestructors);
+
+    while (mDedicatedPages != mark.mDedicatedPages) {
+        Page* next = mDedicatedPages->next();
+        freePage(mDedicatedPages);
+        mDedicatedPageCount--;
+        mDedicatedPages = next;
+    }
+
+    // The pages filled since the mark are kept, to be reused by ensureNext()
+    mCurrentPage = mark.mPage;
+    mNext = mark.mNext;
+    mWastedSpace = mTotalAllocated - mark.mUsedSize;
+}
+
+void LinearAllocator::reset() {
+    rewind(Mark());
+    if (mPages) {
+        Page* p = mPages->next();
+        mPages->setNext(0);
+        while (p) {
+            Page* next = p->next();
+            freePage(p);
+            p = next;
+        }
+    }
+    mWastedSpace = mTotalAllocated;
+}
+
 LinearAllocator::Page* LinearAllocator::newPage(size_t pageSize) {
     pageSize = ALIGN(pageSize + sizeof(LinearAllocator::Page));
     ADD_ALLOCATION(pageSize);
     mTotalAllocated += pageSize;
     mPageCount++;
     void* buf = malloc(pageSize);
-    return new (buf) Page();
+    return new (buf) Page(pageSize);
+}
+
+void LinearAllocator::freePage(Page* p) {
+    size_t pageSize = p->size();
+    RM_ALLOCATION(pageSize);
+    mTotalAllocated -= pageSize;
+    mPageCount--;
+    p->~Page();
+    free(p);
 }
 
 static const char* toSize(size_t value, float& result) {
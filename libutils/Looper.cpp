@@ -55,20 +55,190 @@ int SimpleLooperCallback::handleEvent(int fd, int events, void* data) {
 }
 
 
+// --- MessageQueue ---
+
+MessageQueue::MessageQueue() : mNextSeq(0) {
+}
+
+nsecs_t MessageQueue::nextUptime() const {
+    if (mHeap.isEmpty()) {
+        return LLONG_MAX;
+    }
+    return mEntries.itemAt(mHeap.itemAt(0)).uptime;
+}
+
+bool MessageQueue::enqueue(nsecs_t uptime, const sp<MessageHandler>& handler,
+        const Message& message) {
+    size_t slot;
+    if (mFreeSlots.isEmpty()) {
+        slot = mEntries.add();
+    } else {
+        slot = mFreeSlots.top();
+        mFreeSlots.pop();
+    }
+
+    Entry& entry = mEntries.editItemAt(slot);
+    entry.uptime = uptime;
+    entry.seq = mNextSeq++;
+    entry.handler = handler;
+    entry.message = message;
+
+    // Link it in front of the other messages of the handler, the order does
+    // not matter there.
+    entry.prev = -1;
+    ssize_t index = mFirstByHandler.indexOfKey(handler.get());
+    if (index >= 0) {
+        size_t first = mFirstByHandler.valueAt(index);
+        entry.next = first;
+        mEntries.editItemAt(first).prev = slot;
+        mFirstByHandler.replaceValueAt(index, slot);
+    } else {
+        entry.next = -1;
+        mFirstByHandler.add(handler.get(), slot);
+    }
+
+    size_t heapIndex = mHeap.add(slot);
+    mEntries.editItemAt(slot).heapIndex = heapIndex;
+    siftUp(heapIndex);
+    return mHeap.itemAt(0) == slot;
+}
+
+void MessageQueue::dequeue(sp<MessageHandler>* outHandler, Message* outMessage) {
+    size_t slot = mHeap.itemAt(0);
+    const Entry& entry = mEntries.itemAt(slot);
+    *outHandler = entry.handler;
+    *outMessage = entry.message;
+    removeSlot(slot);
+}
+
+size_t MessageQueue::remove(const sp<MessageHandler>& handler) {
+    ssize_t index = mFirstByHandler.indexOfKey(handler.get());
+    if (index < 0) {
+        return 0;
+    }
+
+    size_t count = 0;
+    ssize_t slot = mFirstByHandler.valueAt(index);
+    while (slot >= 0) {
+        ssize_t next = mEntries.itemAt(slot).next;
+        removeSlot(slot);
+        slot = next;
+        count += 1;
+    }
+    return count;
+}
+
+size_t MessageQueue::remove(const sp<MessageHandler>& handler, int what) {
+    ssize_t index = mFirstByHandler.indexOfKey(handler.get());
+    if (index < 0) {
+        return 0;
+    }
+
+    size_t count = 0;
+    ssize_t slot = mFirstByHandler.valueAt(index);
+    while (slot >= 0) {
+        const Entry& entry = mEntries.itemAt(slot);
+        ssize_t next = entry.next;
+        if (entry.message.what == what) {
+            removeSlot(slot);
+            count += 1;
+        }
+        slot = next;
+    }
+    return count;
+}
+
+void MessageQueue::clear() {
+    mEntries.clear();
+    mFreeSlots.clear();
+    mHeap.clear();
+    mFirstByHandler.clear();
+}
+
+void MessageQueue::setHeapItem(size_t heapIndex, size_t slot) {
+    mHeap.editItemAt(heapIndex) = slot;
+    mEntries.editItemAt(slot).heapIndex = heapIndex;
+}
+
+void MessageQueue::siftUp(size_t heapIndex) {
+    size_t slot = mHeap.itemAt(heapIndex);
+    while (heapIndex > 0) {
+        size_t parent = (heapIndex - 1) / 2;
+        size_t parentSlot = mHeap.itemAt(parent);
+        if (!isBefore(slot, parentSlot)) {
+            break;
+        }
+        setHeapItem(heapIndex, parentSlot);
+        heapIndex = parent;
+    }
+    setHeapItem(heapIndex, slot);
+}
+
+void MessageQueue::siftDown(size_t heapIndex) {
+    size_t size = mHeap.size();
+    size_t slot = mHeap.itemAt(heapIndex);
+    for (;;) {
+        size_t child = heapIndex * 2 + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && isBefore(mHeap.itemAt(child + 1), mHeap.itemAt(child))) {
+            child += 1;
+        }
+        size_t childSlot = mHeap.itemAt(child);
+        if (!isBefore(childSlot, slot)) {
+            break;
+        }
+        setHeapItem(heapIndex, childSlot);
+        heapIndex = child;
+    }
+    setHeapItem(heapIndex, slot);
+}
+
+void MessageQueue::removeSlot(size_t slot) {
+    Entry& entry = mEntries.editItemAt(slot);
+
+    // Unlink it from the messages of its handler.
+    if (entry.prev >= 0) {
+        mEntries.editItemAt(entry.prev).next = entry.next;
+    } else if (entry.next >= 0) {
+        mFirstByHandler.replaceValueFor(entry.handler.get(), entry.next);
+    } else {
+        mFirstByHandler.removeItem(entry.handler.get());
+    }
+    if (entry.next >= 0) {
+        mEntries.editItemAt(entry.next).prev = entry.prev;
+    }
+
+    // Move the last item of the heap into its place.
+    size_t heapIndex = entry.heapIndex;
+    size_t last = mHeap.top();
+    mHeap.pop();
+    if (last != slot) {
+        setHeapItem(heapIndex, last);
+        if (heapIndex > 0 && isBefore(last, mHeap.itemAt((heapIndex - 1) / 2))) {
+            siftUp(heapIndex);
+        } else {
+            siftDown(heapIndex);
+        }
+    }
+
+    mEntries.editItemAt(slot).handler.clear();
+    mFreeSlots.push(slot);
+}
+
+
 // --- Looper ---
 
 // Hint for number of file descriptors to be associated with the epoll instance.
 static const int EPOLL_SIZE_HINT = 8;
 
-// Maximum number of file descriptors for which to retrieve poll events each iteration.
-static const int EPOLL_MAX_EVENTS = 16;
-
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks) :
         mAllowNonCallbacks(allowNonCallbacks), mSendingMessage(false),
-        mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
+        mResponseCount(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
     int wakeFds[2];
     int result = pipe(wakeFds);
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not create wake pipe.  errno=%d", errno);
@@ -159,8 +329,8 @@ bool Looper::getAllowNonCallbacks() const {
 int Looper::pollOnce(int timeoutMillis, int* outFd, int* outEvents, void** outData) {
     int result = 0;
     for (;;) {
-        while (mResponseIndex < mResponses.size()) {
-            const Response& response = mResponses.itemAt(mResponseIndex++);
+        while (mResponseIndex < mResponseCount) {
+            const Response& response = mResponses[mResponseIndex++];
             int ident = response.request.ident;
             if (ident >= 0) {
                 int fd = response.request.fd;
@@ -213,7 +383,7 @@ int Looper::pollInner(int timeoutMillis) {
 
     // Poll.
     int result = ALOOPER_POLL_WAKE;
-    mResponses.clear();
+    mResponseCount = 0;
     mResponseIndex = 0;
 
     // We are about to idle.
@@ -262,14 +432,14 @@ int Looper::pollInner(int timeoutMillis) {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake read pipe.", epollEvents);
             }
         } else {
-            ssize_t requestIndex = mRequests.indexOfKey(fd);
-            if (requestIndex >= 0) {
+            const Request* request = getRequestLocked(fd);
+            if (request) {
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= ALOOPER_EVENT_INPUT;
                 if (epollEvents & EPOLLOUT) events |= ALOOPER_EVENT_OUTPUT;
                 if (epollEvents & EPOLLERR) events |= ALOOPER_EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= ALOOPER_EVENT_HANGUP;
-                pushResponse(events, mRequests.valueAt(requestIndex));
+                pushResponse(events, *request);
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on fd %d that is "
                         "no longer registered.", epollEvents, fd);
@@ -280,18 +450,18 @@ Done: ;
 
     // Invoke pending message callbacks.
     mNextMessageUptime = LLONG_MAX;
-    while (mMessageEnvelopes.size() != 0) {
+    while (!mMessages.isEmpty()) {
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(0);
-        if (messageEnvelope.uptime <= now) {
-            // Remove the envelope from the list.
+        nsecs_t uptime = mMessages.nextUptime();
+        if (uptime <= now) {
+            // Remove the message from the queue.
             // We keep a strong reference to the handler until the call to handleMessage
             // finishes.  Then we drop it so that the handler can be deleted *before*
             // we reacquire our lock.
             { // obtain handler
-                sp<MessageHandler> handler = messageEnvelope.handler;
-                Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                sp<MessageHandler> handler;
+                Message message;
+                mMessages.dequeue(&handler, &message);
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -307,7 +477,7 @@ Done: ;
             result = ALOOPER_POLL_CALLBACK;
         } else {
             // The last message left at the head of the queue determines the next wakeup time.
-            mNextMessageUptime = messageEnvelope.uptime;
+            mNextMessageUptime = uptime;
             break;
         }
     }
@@ -316,8 +486,8 @@ Done: ;
     mLock.unlock();
 
     // Invoke all response callbacks.
-    for (size_t i = 0; i < mResponses.size(); i++) {
-        Response& response = mResponses.editItemAt(i);
+    for (size_t i = 0; i < mResponseCount; i++) {
+        Response& response = mResponses[i];
         if (response.request.ident == ALOOPER_POLL_CALLBACK) {
             int fd = response.request.fd;
             int events = response.events;
@@ -331,7 +501,7 @@ Done: ;
                 removeFd(fd);
             }
             // Clear the callback reference in the response structure promptly because we
-            // will not clear the response vector itself until the next poll.
+            // will not reuse the response until the next poll.
             response.request.callback.clear();
             result = ALOOPER_POLL_CALLBACK;
         }
@@ -395,10 +565,17 @@ void Looper::awoken() {
 }
 
 void Looper::pushResponse(int events, const Request& request) {
-    Response response;
+    Response& response = mResponses[mResponseCount++];
     response.events = events;
     response.request = request;
-    mResponses.push(response);
+}
+
+const Looper::Request* Looper::getRequestLocked(int fd) const {
+    if (fd < 0 || size_t(fd) >= mRequests.size()) {
+        return NULL;
+    }
+    const Request& request = mRequests.itemAt(fd);
+    return request.fd >= 0 ? &request : NULL;
 }
 
 int Looper::addFd(int fd, int ident, int events, ALooper_callbackFunc callback, void* data) {
@@ -443,22 +620,24 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
         eventItem.events = epollEvents;
         eventItem.data.fd = fd;
 
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
+        if (!getRequestLocked(fd)) {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
             if (epollResult < 0) {
                 ALOGE("Error adding epoll events for fd %d, errno=%d", fd, errno);
                 return -1;
             }
-            mRequests.add(fd, request);
+            if (size_t(fd) >= mRequests.size()) {
+                // Grow to twice what is needed, fds come from the lowest free number.
+                mRequests.insertAt(Request(), mRequests.size(), fd * 2 + 1 - mRequests.size());
+            }
         } else {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, & eventItem);
             if (epollResult < 0) {
                 ALOGE("Error modifying epoll events for fd %d, errno=%d", fd, errno);
                 return -1;
             }
-            mRequests.replaceValueAt(requestIndex, request);
         }
+        mRequests.editItemAt(fd) = request;
     } // release lock
     return 1;
 }
@@ -470,8 +649,7 @@ int Looper::removeFd(int fd) {
 
     { // acquire lock
         AutoMutex _l(mLock);
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
+        if (!getRequestLocked(fd)) {
             return 0;
         }
 
@@ -481,7 +659,7 @@ int Looper::removeFd(int fd) {
             return -1;
         }
 
-        mRequests.removeItemsAt(requestIndex);
+        mRequests.editItemAt(fd) = Request();
     } // release lock
     return 1;
 }
@@ -504,17 +682,11 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool first;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        first = mMessages.enqueue(uptime, handler, message);
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -526,7 +698,7 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (first) {
         wake();
     }
 }
@@ -539,12 +711,7 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        mMessages.remove(handler);
     } // release lock
 }
 
@@ -556,13 +723,7 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        mMessages.remove(handler, what);
     } // release lock
 }
 
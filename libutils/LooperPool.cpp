@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LooperPool"
+
+//#define LOG_NDEBUG 0
+
+#include <utils/LooperPool.h>
+#include <utils/Log.h>
+#include <utils/Timers.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+
+namespace android {
+
+// Which pool thread, if any, the calling thread is.
+static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gTLSKey = 0;
+
+static void initTLSKey() {
+    int result = pthread_key_create(&gTLSKey, NULL);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not allocate TLS key.");
+}
+
+// --- LooperPool::Worker ---
+
+LooperPool::Worker::Worker(LooperPool* pool, size_t index) :
+        Thread(false), mPool(pool), mIndex(index) {
+}
+
+status_t LooperPool::Worker::readyToRun() {
+    pthread_setspecific(gTLSKey, this);
+    return NO_ERROR;
+}
+
+bool LooperPool::Worker::threadLoop() {
+    mPool->runOnce(mIndex);
+    return true;
+}
+
+// --- LooperPool ---
+
+LooperPool::LooperPool(size_t threadCount) :
+        mNextSeq(0), mIdleCount(0), mNextQueue(0), mExiting(false) {
+    pthread_once(&gTLSOnce, initTLSKey);
+
+    int wakeFds[2];
+    int result = pipe(wakeFds);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not create wake pipe.  errno=%d", errno);
+
+    mWakeReadPipeFd = wakeFds[0];
+    mWakeWritePipeFd = wakeFds[1];
+
+    result = fcntl(mWakeReadPipeFd, F_SETFL, O_NONBLOCK);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not make wake read pipe non-blocking.  errno=%d",
+            errno);
+
+    result = fcntl(mWakeWritePipeFd, F_SETFL, O_NONBLOCK);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not make wake write pipe non-blocking.  errno=%d",
+            errno);
+
+    mEpollFd = epoll_create(8);
+    LOG_ALWAYS_FATAL_IF(mEpollFd < 0, "Could not create epoll instance.  errno=%d", errno);
+
+    // The wake pipe is one shot too, so that a wake() gets one thread going.
+    struct epoll_event eventItem;
+    memset(&eventItem, 0, sizeof(epoll_event));
+    eventItem.events = EPOLLIN | EPOLLONESHOT;
+    eventItem.data.fd = mWakeReadPipeFd;
+    result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeReadPipeFd, &eventItem);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake read pipe to epoll instance.  errno=%d",
+            errno);
+
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        mWorkers.push(new Worker(this, i));
+    }
+}
+
+LooperPool::~LooperPool() {
+    stop();
+    close(mWakeReadPipeFd);
+    close(mWakeWritePipeFd);
+    close(mEpollFd);
+}
+
+status_t LooperPool::start(const char* name) {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        status_t result = mWorkers[i]->run(name);
+        if (result != NO_ERROR) {
+            return result;
+        }
+    }
+    return NO_ERROR;
+}
+
+void LooperPool::stop() {
+    { // acquire lock
+        AutoMutex _l(mLock);
+        mExiting = true;
+    } // release lock
+
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->requestExit();
+    }
+    wake();
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->join();
+    }
+
+    AutoMutex _l(mLock);
+    mTimedMessages.clear();
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        AutoMutex _wl(mWorkers[i]->mLock);
+        mWorkers[i]->mQueue.clear();
+    }
+}
+
+void LooperPool::runOnce(size_t index) {
+    MessageEnvelope messageEnvelope;
+    if (takeMessage(index, &messageEnvelope)) {
+        // Get another thread onto whatever is left.
+        if (hasQueuedMessages()) {
+            wake();
+        }
+        messageEnvelope.handler->handleMessage(messageEnvelope.message);
+        return;
+    }
+
+    int timeoutMillis;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        if (mExiting) {
+            return;
+        }
+        timeoutMillis = pollTimeoutLocked(systemTime(SYSTEM_TIME_MONOTONIC));
+        mIdleCount += 1;
+    } // release lock
+
+    // Anything queued from now on sees us idle and wakes someone, so a last
+    // look at the queues leaves no message behind.
+    struct epoll_event eventItem;
+    int eventCount = 0;
+    if (!hasQueuedMessages()) {
+        eventCount = epoll_wait(mEpollFd, &eventItem, 1, timeoutMillis);
+        if (eventCount < 0 && errno != EINTR) {
+            ALOGW("Poll failed with an unexpected error, errno=%d", errno);
+        }
+    }
+
+    size_t moved;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        mIdleCount -= 1;
+        moved = moveDueMessagesLocked(systemTime(SYSTEM_TIME_MONOTONIC), index);
+    } // release lock
+    if (moved > 1) {
+        wake();
+    }
+
+    if (eventCount == 1) {
+        if (eventItem.data.fd == mWakeReadPipeFd) {
+            awoken();
+        } else {
+            handleEvent(eventItem.data.fd, eventItem.events);
+        }
+    }
+}
+
+bool LooperPool::takeMessage(size_t index, MessageEnvelope* outMessage) {
+    { // acquire lock
+        Worker* worker = mWorkers[index].get();
+        AutoMutex _l(worker->mLock);
+        if (!worker->mQueue.empty()) {
+            List<MessageEnvelope>::iterator it = worker->mQueue.begin();
+            *outMessage = *it;
+            worker->mQueue.erase(it);
+            return true;
+        }
+    } // release lock
+
+    // Steal from the back of the other queues, away from their owners.
+    size_t count = mWorkers.size();
+    for (size_t i = 1; i < count; i++) {
+        Worker* worker = mWorkers[(index + i) % count].get();
+        AutoMutex _l(worker->mLock);
+        if (!worker->mQueue.empty()) {
+            List<MessageEnvelope>::iterator it = worker->mQueue.end();
+            --it;
+            *outMessage = *it;
+            worker->mQueue.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LooperPool::hasQueuedMessages() {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        AutoMutex _l(mWorkers[i]->mLock);
+        if (!mWorkers[i]->mQueue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LooperPool::queueMessage(ssize_t index, const MessageEnvelope& messageEnvelope) {
+    if (index < 0) {
+        Worker* self = static_cast<Worker*>(pthread_getspecific(gTLSKey));
+        if (self != NULL && self->mPool == this) {
+            index = self->mIndex;
+        } else {
+            AutoMutex _l(mLock);
+            index = mNextQueue++ % mWorkers.size();
+        }
+    }
+
+    Worker* worker = mWorkers[index].get();
+    AutoMutex _l(worker->mLock);
+    worker->mQueue.push_back(messageEnvelope);
+}
+
+int LooperPool::pollTimeoutLocked(nsecs_t now) {
+    if (mTimedMessages.isEmpty()) {
+        return -1;
+    }
+    return toMillisecondTimeoutDelay(now, mTimedMessages.nextUptime());
+}
+
+size_t LooperPool::moveDueMessagesLocked(nsecs_t now, size_t index) {
+    size_t count = 0;
+    while (!mTimedMessages.isEmpty() && mTimedMessages.nextUptime() <= now) {
+        MessageEnvelope messageEnvelope;
+        messageEnvelope.uptime = mTimedMessages.nextUptime();
+        mTimedMessages.dequeue(&messageEnvelope.handler, &messageEnvelope.message);
+        queueMessage(index, messageEnvelope);
+        count += 1;
+    }
+    return count;
+}
+
+void LooperPool::handleEvent(int fd, uint32_t epollEvents) {
+    Request request;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        ssize_t requestIndex = mRequests.indexOfKey(fd);
+        if (requestIndex < 0) {
+            return;
+        }
+        request = mRequests.valueAt(requestIndex);
+    } // release lock
+
+    int events = 0;
+    if (epollEvents & EPOLLIN) events |= ALOOPER_EVENT_INPUT;
+    if (epollEvents & EPOLLOUT) events |= ALOOPER_EVENT_OUTPUT;
+    if (epollEvents & EPOLLERR) events |= ALOOPER_EVENT_ERROR;
+    if (epollEvents & EPOLLHUP) events |= ALOOPER_EVENT_HANGUP;
+
+    int callbackResult = request.callback->handleEvent(fd, events, request.data);
+
+    AutoMutex _l(mLock);
+    ssize_t requestIndex = mRequests.indexOfKey(fd);
+    if (requestIndex < 0 || mRequests.valueAt(requestIndex).seq != request.seq) {
+        return; // removed or replaced meanwhile
+    }
+    if (callbackResult == 0) {
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
+        mRequests.removeItemsAt(requestIndex);
+        return;
+    }
+
+    struct epoll_event eventItem;
+    memset(&eventItem, 0, sizeof(epoll_event));
+    eventItem.events = request.events | EPOLLONESHOT;
+    eventItem.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &eventItem) < 0) {
+        ALOGE("Error re-arming epoll events for fd %d, errno=%d", fd, errno);
+    }
+}
+
+void LooperPool::wake() {
+    { // acquire lock
+        AutoMutex _l(mLock);
+        if (mIdleCount == 0) {
+            return;
+        }
+    } // release lock
+
+    ssize_t nWrite;
+    do {
+        nWrite = write(mWakeWritePipeFd, "W", 1);
+    } while (nWrite == -1 && errno == EINTR);
+
+    if (nWrite != 1 && errno != EAGAIN) {
+        ALOGW("Could not write wake signal, errno=%d", errno);
+    }
+}
+
+void LooperPool::awoken() {
+    char buffer[16];
+    ssize_t nRead;
+    do {
+        nRead = read(mWakeReadPipeFd, buffer, sizeof(buffer));
+    } while ((nRead == -1 && errno == EINTR) || nRead == sizeof(buffer));
+
+    rearmWakePipe();
+
+    bool exiting;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        exiting = mExiting;
+    } // release lock
+    if (exiting) {
+        // pass it on to the next thread
+        wake();
+    }
+}
+
+void LooperPool::rearmWakePipe() {
+    struct epoll_event eventItem;
+    memset(&eventItem, 0, sizeof(epoll_event));
+    eventItem.events = EPOLLIN | EPOLLONESHOT;
+    eventItem.data.fd = mWakeReadPipeFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, mWakeReadPipeFd, &eventItem) < 0) {
+        ALOGE("Error re-arming the wake pipe, errno=%d", errno);
+    }
+}
+
+int LooperPool::addFd(int fd, int events, ALooper_callbackFunc callback, void* data) {
+    return addFd(fd, events, callback ? new SimpleLooperCallback(callback) : NULL, data);
+}
+
+int LooperPool::addFd(int fd, int events, const sp<LooperCallback>& callback, void* data) {
+    if (callback == NULL) {
+        ALOGE("Invalid attempt to add a fd without a callback to a looper pool.");
+        return -1;
+    }
+
+    int epollEvents = 0;
+    if (events & ALOOPER_EVENT_INPUT) epollEvents |= EPOLLIN;
+    if (events & ALOOPER_EVENT_OUTPUT) epollEvents |= EPOLLOUT;
+
+    AutoMutex _l(mLock);
+
+    Request request;
+    request.events = epollEvents;
+    request.callback = callback;
+    request.data = data;
+    request.seq = mNextSeq++;
+
+    struct epoll_event eventItem;
+    memset(&eventItem, 0, sizeof(epoll_event));
+    eventItem.events = epollEvents | EPOLLONESHOT;
+    eventItem.data.fd = fd;
+
+    ssize_t requestIndex = mRequests.indexOfKey(fd);
+    if (requestIndex < 0) {
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &eventItem) < 0) {
+            ALOGE("Error adding epoll events for fd %d, errno=%d", fd, errno);
+            return -1;
+        }
+        mRequests.add(fd, request);
+    } else {
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &eventItem) < 0) {
+            ALOGE("Error modifying epoll events for fd %d, errno=%d", fd, errno);
+            return -1;
+        }
+        mRequests.replaceValueAt(requestIndex, request);
+    }
+    return 1;
+}
+
+int LooperPool::removeFd(int fd) {
+    AutoMutex _l(mLock);
+    ssize_t requestIndex = mRequests.indexOfKey(fd);
+    if (requestIndex < 0) {
+        return 0;
+    }
+
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+        ALOGE("Error removing epoll events for fd %d, errno=%d", fd, errno);
+        return -1;
+    }
+
+    mRequests.removeItemsAt(requestIndex);
+    return 1;
+}
+
+void LooperPool::sendMessage(const sp<MessageHandler>& handler, const Message& message) {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sendMessageAtTime(now, handler, message);
+}
+
+void LooperPool::sendMessageDelayed(nsecs_t uptimeDelay, const sp<MessageHandler>& handler,
+        const Message& message) {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sendMessageAtTime(now + uptimeDelay, handler, message);
+}
+
+void LooperPool::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
+        const Message& message) {
+    if (uptime <= systemTime(SYSTEM_TIME_MONOTONIC)) {
+        queueMessage(-1, MessageEnvelope(uptime, handler, message));
+        wake();
+        return;
+    }
+
+    bool first;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        first = mTimedMessages.enqueue(uptime, handler, message);
+    } // release lock
+
+    // Only a new head changes how long the threads should wait.
+    if (first) {
+        wake();
+    }
+}
+
+void LooperPool::removeMessages(const sp<MessageHandler>& handler) {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        Worker* worker = mWorkers[i].get();
+        AutoMutex _l(worker->mLock);
+        for (List<MessageEnvelope>::iterator it = worker->mQueue.begin();
+                it != worker->mQueue.end(); ) {
+            if (it->handler == handler) {
+                it = worker->mQueue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    AutoMutex _l(mLock);
+    mTimedMessages.remove(handler);
+}
+
+void LooperPool::removeMessages(const sp<MessageHandler>& handler, int what) {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        Worker* worker = mWorkers[i].get();
+        AutoMutex _l(worker->mLock);
+        for (List<MessageEnvelope>::iterator it = worker->mQueue.begin();
+                it != worker->mQueue.end(); ) {
+            if (it->handler == handler && it->message.what == what) {
+                it = worker->mQueue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    AutoMutex _l(mLock);
+    mTimedMessages.remove(handler, what);
+}
+
+} // namespace android
@@ -46,17 +46,30 @@ void Printer::printFormatLine(const char* format, ...) {
     va_list arglist;
     va_start(arglist, format);
 
-    char* formattedString;
-
-#ifndef USE_MINGW
-    if (vasprintf(&formattedString, format, arglist) < 0) { // returns -1 on error
+    // Most lines fit here, and then are only formatted once.
+    char stackString[256];
+    va_list tmp;
+    va_copy(tmp, arglist);
+    int n = vsnprintf(stackString, sizeof(stackString), format, tmp);
+    va_end(tmp);
+    if (n < 0) {
         ALOGE("%s: Failed to format string", __FUNCTION__);
+        va_end(arglist);
+        return;
+    }
+    if (size_t(n) < sizeof(stackString)) {
+        va_end(arglist);
+        printLine(stackString);
         return;
     }
-#else
-    return;
-#endif
 
+    char* formattedString = (char*) malloc(n + 1);
+    if (formattedString == NULL) {
+        ALOGE("%s: Failed to format string", __FUNCTION__);
+        va_end(arglist);
+        return;
+    }
+    vsnprintf(formattedString, n + 1, format, arglist);
     va_end(arglist);
 
     printLine(formattedString);
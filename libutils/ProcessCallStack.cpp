@@ -25,6 +25,9 @@
 #include <utils/Errors.h>
 #include <utils/ProcessCallStack.h>
 #include <utils/Printer.h>
+#include <utils/AndroidThreads.h>
+#include <utils/SortedVector.h>
+#include <utils/Vector.h>
 
 #include <limits.h>
 
@@ -135,8 +138,6 @@ void ProcessCallStack::update(int32_t maxDepth) {
         return;
     }
 
-    pid_t selfPid = getpid();
-
     clear();
 
     // Get current time.
@@ -174,26 +175,35 @@ void ProcessCallStack::update(int32_t maxDepth) {
 
         ThreadInfo& threadInfo = mThreadMap.editValueAt(static_cast<size_t>(idx));
 
-        /*
-         * Ignore CallStack::update and ProcessCallStack::update for current thread
-         * - Every other thread doesn't need this since we call update off-thread
-         */
-        int ignoreDepth = (selfPid == tid) ? IGNORE_DEPTH_CURRENT_THREAD : 0;
-
-        // Update thread's call stacks
-        CallStack& cs = threadInfo.callStack;
-        cs.update(ignoreDepth, maxDepth, tid);
-
         // Read/save thread name
         threadInfo.threadName = getThreadName(tid);
-
-        ALOGV("%s: Got call stack for tid %d (size %zu)",
-              __FUNCTION__, tid, cs.size());
     }
     if (code != 0) { // returns positive error value on error
         ALOGE("%s: Failed to readdir from %s (errno = %d, '%s')",
               __FUNCTION__, PATH_SELF_TASK, -code, strerror(code));
     }
+
+    /*
+     * Update the other threads' call stacks all at once, so that a process with
+     * hundreds of threads doesn't take hundreds of times as long as one thread.
+     * - Ignore CallStack::update and ProcessCallStack::update for current thread
+     */
+    pid_t selfTid = androidGetTid();
+    Vector<CallStack*> stacks;
+    Vector<pid_t> tids;
+    stacks.setCapacity(mThreadMap.size());
+    tids.setCapacity(mThreadMap.size());
+    for (size_t i = 0; i < mThreadMap.size(); ++i) {
+        pid_t tid = mThreadMap.keyAt(i);
+        CallStack& cs = mThreadMap.editValueAt(i).callStack;
+        if (tid == selfTid) {
+            cs.update(IGNORE_DEPTH_CURRENT_THREAD, maxDepth, tid);
+        } else {
+            stacks.push(&cs);
+            tids.push(tid);
+        }
+    }
+    CallStack::updateThreads(stacks.array(), tids.array(), stacks.size(), maxDepth);
 #endif
 
     closedir(dp);
@@ -218,6 +228,30 @@ void ProcessCallStack::printInternal(Printer& printer, Printer& csPrinter) const
     dumpProcessHeader(printer, getpid(),
                       getTimeString(mTimeUpdated).string());
 
+    /*
+     * Most threads of a process are parked in the same few functions, so look up
+     * the symbols of each distinct pc once, for all the threads together, rather
+     * than once per frame through CallStack::print.
+     */
+    SortedVector<uintptr_t> pcs;
+    for (size_t i = 0; i < mThreadMap.size(); ++i) {
+        const CallStack& cs = mThreadMap.valueAt(i).callStack;
+        for (size_t j = 0; j < cs.size(); ++j) {
+            pcs.add(reinterpret_cast<uintptr_t>(cs[j]));
+        }
+    }
+    Vector<backtrace_frame_t> frames;
+    frames.insertAt(0, pcs.size());
+    for (size_t i = 0; i < pcs.size(); ++i) {
+        backtrace_frame_t& frame = frames.editItemAt(i);
+        frame.absolute_pc = pcs[i];
+        frame.stack_top = 0;
+        frame.stack_size = 0;
+    }
+    Vector<backtrace_symbol_t> symbols;
+    symbols.insertAt(0, pcs.size());
+    get_backtrace_symbols(frames.array(), frames.size(), symbols.editArray());
+
     for (size_t i = 0; i < mThreadMap.size(); ++i) {
         pid_t tid = mThreadMap.keyAt(i);
         const ThreadInfo& threadInfo = mThreadMap.valueAt(i);
@@ -227,9 +261,16 @@ void ProcessCallStack::printInternal(Printer& printer, Printer& csPrinter) const
         printer.printLine("");
         printer.printFormatLine("\"%s\" sysTid=%d", threadName.string(), tid);
 
-        cs.print(csPrinter);
+        for (size_t j = 0; j < cs.size(); ++j) {
+            ssize_t k = pcs.indexOf(reinterpret_cast<uintptr_t>(cs[j]));
+            char line[MAX_BACKTRACE_LINE_LENGTH];
+            format_backtrace_line(j, &frames[k], &symbols[k],
+                    line, MAX_BACKTRACE_LINE_LENGTH);
+            csPrinter.printLine(line);
+        }
     }
 
+    free_backtrace_symbols(symbols.editArray(), symbols.size());
     dumpProcessFooter(printer, getpid());
 }
 
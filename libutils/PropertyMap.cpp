@@ -110,9 +110,7 @@ bool PropertyMap::tryGetProperty(const String8& key, float& outValue) const {
 }
 
 void PropertyMap::addAll(const PropertyMap* map) {
-    for (size_t i = 0; i < map->mProperties.size(); i++) {
-        mProperties.add(map->mProperties.keyAt(i), map->mProperties.valueAt(i));
-    }
+    mProperties.merge(map->mProperties);
 }
 
 status_t PropertyMap::load(const String8& filename, PropertyMap** outMap) {
@@ -170,7 +168,8 @@ status_t PropertyMap::Parser::parse() {
         mTokenizer->skipDelimiters(WHITESPACE);
 
         if (!mTokenizer->isEol() && mTokenizer->peekChar() != '#') {
-            String8 keyToken = mTokenizer->nextToken(WHITESPACE_OR_PROPERTY_DELIMITER);
+            Tokenizer::View keyToken = mTokenizer->nextTokenView(
+                    WHITESPACE_OR_PROPERTY_DELIMITER);
             if (keyToken.isEmpty()) {
                 ALOGE("%s: Expected non-empty property key.", mTokenizer->getLocation().string());
                 return BAD_VALUE;
@@ -186,8 +185,8 @@ status_t PropertyMap::Parser::parse() {
 
             mTokenizer->skipDelimiters(WHITESPACE);
 
-            String8 valueToken = mTokenizer->nextToken(WHITESPACE);
-            if (valueToken.find("\\", 0) >= 0 || valueToken.find("\"", 0) >= 0) {
+            Tokenizer::View valueToken = mTokenizer->nextTokenView(WHITESPACE);
+            if (valueToken.contains('\\') || valueToken.contains('"')) {
                 ALOGE("%s: Found reserved character '\\' or '\"' in property value.",
                         mTokenizer->getLocation().string());
                 return BAD_VALUE;
@@ -201,13 +200,14 @@ status_t PropertyMap::Parser::parse() {
                 return BAD_VALUE;
             }
 
-            if (mMap->hasProperty(keyToken)) {
+            String8 key(keyToken.toString8());
+            if (mMap->hasProperty(key)) {
                 ALOGE("%s: Duplicate property value for key '%s'.",
-                        mTokenizer->getLocation().string(), keyToken.string());
+                        mTokenizer->getLocation().string(), key.string());
                 return BAD_VALUE;
             }
 
-            mMap->addProperty(keyToken, valueToken);
+            mMap->addProperty(key, valueToken.toString8());
         }
 
         mTokenizer->nextLine();
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RWLock"
+
+#include <utils/RWLock.h>
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <string.h>
+
+namespace android {
+
+#if defined(HAVE_PTHREADS)
+
+// RWLock is implemented as inlines in RWLock.h.
+
+// ---------------------------------------------------------------------------
+
+/*
+ * A reader registers itself on its counter, then checks for a writer; a
+ * writer registers itself on mWriter, then checks the counters.  All of
+ * these are sequentially consistent, so at least one of them sees the other
+ * and backs off or waits.  Whoever leaves while the other one waits wakes
+ * it up, under mWaitLock so that the wakeup cannot be missed.
+ */
+
+BigReaderLock::BigReaderLock()
+    : mWriter(0) {
+    memset(mSlots, 0, sizeof(mSlots));
+}
+
+BigReaderLock::~BigReaderLock() {
+}
+
+status_t BigReaderLock::readLockSlow(Slot& slot) {
+    do {
+        // Get out of the way of the writer, and wait for it to be done.
+        android_atomic_dec_explicit(&slot.readers, ANDROID_MEMORY_ORDER_SEQ_CST);
+        Mutex::Autolock _l(mWaitLock);
+        mWaitCondition.broadcast();
+        while (writerPending()) {
+            mWaitCondition.wait(mWaitLock);
+        }
+        android_atomic_inc_explicit(&slot.readers, ANDROID_MEMORY_ORDER_SEQ_CST);
+    } while (writerPending());
+    return NO_ERROR;
+}
+
+status_t BigReaderLock::tryReadLock() {
+    Slot& slot = slotForThread();
+    android_atomic_inc_explicit(&slot.readers, ANDROID_MEMORY_ORDER_SEQ_CST);
+    if (!writerPending()) {
+        return NO_ERROR;
+    }
+    android_atomic_dec_explicit(&slot.readers, ANDROID_MEMORY_ORDER_SEQ_CST);
+    wakeWaiters();
+    return -EBUSY;
+}
+
+void BigReaderLock::readUnlockSlow() {
+    wakeWaiters();
+}
+
+bool BigReaderLock::hasReaders() const {
+    for (size_t i = 0; i < SLOT_COUNT; i++) {
+        if (android_atomic_load_explicit(&mSlots[i].readers, ANDROID_MEMORY_ORDER_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BigReaderLock::wakeWaiters() {
+    Mutex::Autolock _l(mWaitLock);
+    mWaitCondition.broadcast();
+}
+
+status_t BigReaderLock::writeLock() {
+    status_t err = mWriterLock.lock();
+    if (err != NO_ERROR) {
+        return err;
+    }
+    mWriterThread = pthread_self();
+    android_atomic_store_explicit(1, &mWriter, ANDROID_MEMORY_ORDER_SEQ_CST);
+
+    if (hasReaders()) {
+        Mutex::Autolock _l(mWaitLock);
+        while (hasReaders()) {
+            mWaitCondition.wait(mWaitLock);
+        }
+    }
+    return NO_ERROR;
+}
+
+status_t BigReaderLock::tryWriteLock() {
+    if (mWriterLock.tryLock() != NO_ERROR) {
+        return -EBUSY;
+    }
+    mWriterThread = pthread_self();
+    android_atomic_store_explicit(1, &mWriter, ANDROID_MEMORY_ORDER_SEQ_CST);
+
+    if (hasReaders()) {
+        writeUnlock();
+        return -EBUSY;
+    }
+    return NO_ERROR;
+}
+
+void BigReaderLock::writeUnlock() {
+    android_atomic_store_explicit(0, &mWriter, ANDROID_MEMORY_ORDER_SEQ_CST);
+    wakeWaiters();
+    mWriterLock.unlock();
+}
+
+#endif // HAVE_PTHREADS
+
+}; // namespace android
@@ -65,6 +65,8 @@ public:
     RefBase* const      mBase;
     volatile int32_t    mFlags;
 
+    int32_t incStrongCount();
+
 #if !DEBUG_REFS
 
     weakref_impl(RefBase* base)
@@ -315,13 +317,38 @@ private:
 
 // ---------------------------------------------------------------------------
 
+// The strong references share a single weak reference, rather than each
+// holding one, so that copying an sp<> only touches the strong count.  It is
+// taken by whoever moves the strong count from INITIAL_STRONG_VALUE or 0, and
+// released by whoever moves it back to 0.  To be safe against another thread
+// dropping the last weak reference concurrently, the weak reference is taken
+// before the strong count goes up whenever this could be the first strong
+// reference; once the count has left INITIAL_STRONG_VALUE it never comes back
+// to it, so this is only a guess when the count is 0.
+int32_t RefBase::weakref_impl::incStrongCount()
+{
+    const int32_t old = mStrong;
+    const bool tookWeak = (old == INITIAL_STRONG_VALUE || old == 0);
+    if (tookWeak) {
+        incWeak(this);
+    }
+
+    const int32_t c = android_atomic_inc(&mStrong);
+    const bool first = (c == INITIAL_STRONG_VALUE || c == 0);
+    if (tookWeak && !first) {
+        // someone else got there first, and holds the weak reference
+        decWeak(this);
+    } else if (first && !tookWeak) {
+        incWeak(this);
+    }
+    return c;
+}
+
 void RefBase::incStrong(const void* id) const
 {
     weakref_impl* const refs = mRefs;
-    refs->incWeak(id);
-    
     refs->addStrongRef(id);
-    const int32_t c = android_atomic_inc(&refs->mStrong);
+    const int32_t c = refs->incStrongCount();
     ALOG_ASSERT(c > 0, "incStrong() called on %p after last strong ref", refs);
 #if PRINT_REFS
     ALOGD("incStrong of %p from %p: cnt=%d\n", this, id, c);
@@ -344,21 +371,23 @@ void RefBase::decStrong(const void* id) const
 #endif
     ALOG_ASSERT(c >= 1, "decStrong() called on %p too many times", refs);
     if (c == 1) {
+        // The decrement only orders what came before it.  Make sure what
+        // the other threads did before their decStrong() is seen by the
+        // destructor.
+        android_atomic_acquire_load(&refs->mStrong);
         refs->mBase->onLastStrongRef(id);
         if ((refs->mFlags&OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_STRONG) {
             delete this;
         }
+        refs->decWeak(refs);
     }
-    refs->decWeak(id);
 }
 
 void RefBase::forceIncStrong(const void* id) const
 {
     weakref_impl* const refs = mRefs;
-    refs->incWeak(id);
-    
     refs->addStrongRef(id);
-    const int32_t c = android_atomic_inc(&refs->mStrong);
+    const int32_t c = refs->incStrongCount();
     ALOG_ASSERT(c >= 0, "forceIncStrong called on %p after ref count underflow",
                refs);
 #if PRINT_REFS
@@ -509,21 +538,19 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
     ALOGD("attemptIncStrong of %p from %p: cnt=%d\n", this, id, curCount);
 #endif
 
-    // now we need to fix-up the count if it was INITIAL_STRONG_VALUE
-    // this must be done safely, i.e.: handle the case where several threads
-    // were here in attemptIncStrong().
-    curCount = impl->mStrong;
-    while (curCount >= INITIAL_STRONG_VALUE) {
-        ALOG_ASSERT(curCount > INITIAL_STRONG_VALUE,
-                "attemptIncStrong in %p underflowed to INITIAL_STRONG_VALUE",
-                this);
-        if (android_atomic_cmpxchg(curCount, curCount-INITIAL_STRONG_VALUE,
-                &impl->mStrong) == 0) {
-            break;
+    // curCount is now what the strong count was just before our increment.
+    // If we took the first strong reference, the weak reference we took
+    // above becomes the one shared by the strong references (see
+    // incStrongCount()), otherwise it is not needed any more.  Whoever moved
+    // the count from INITIAL_STRONG_VALUE fixes it up, and has held a weak
+    // reference since before doing so: dropping ours cannot destroy anything.
+    if (curCount == INITIAL_STRONG_VALUE || curCount == 0) {
+        impl->renameWeakRefId(id, impl);
+        if (curCount == INITIAL_STRONG_VALUE) {
+            android_atomic_add(-INITIAL_STRONG_VALUE, &impl->mStrong);
         }
-        // the strong-count changed on us, we need to re-assert the situation,
-        // for e.g.: it's possible the fix-up happened in another thread.
-        curCount = impl->mStrong;
+    } else {
+        decWeak(id);
     }
 
     return true;
@@ -17,6 +17,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(HAVE_PTHREADS)
+#include <pthread.h>
+#endif
+
 #include <utils/SharedBuffer.h>
 #include <utils/Atomic.h>
 
@@ -24,9 +28,205 @@
 
 namespace android {
 
+/*
+ * Small buffers come in a few size classes, and each thread keeps a short
+ * list of the ones it freed for each class.  Most buffers are the storage
+ * of small Vectors and strings that are freed soon after they are made,
+ * often on the same thread, so this skips malloc's locking most of the
+ * time.  The class of a buffer is recorded in it, so it goes back to the
+ * right list whichever thread frees it.
+ */
+
+static const size_t kSizeClasses[SharedBuffer::kSizeClassCount] = {
+    16, 32, 48, 64, 96, 128, 192, 256
+};
+
+// Most buffers kept per class and thread.
+static const uint32_t kMaxCachedPerClass = 32;
+
+static const uint32_t kNoSizeClass = 0xffffffff;
+
+static inline uint32_t sizeClassFor(size_t size) {
+    for (uint32_t i = 0; i < SharedBuffer::kSizeClassCount; i++) {
+        if (size <= kSizeClasses[i]) {
+            return i;
+        }
+    }
+    return kNoSizeClass;
+}
+
+struct SharedBufferCache {
+    // Freed buffers, linked through their first word of data.
+    void* freeList[SharedBuffer::kSizeClassCount];
+    uint32_t freeCount[SharedBuffer::kSizeClassCount];
+
+    // Allocations by class, then the ones too large for a class.
+    uint64_t allocCount[SharedBuffer::kSizeClassCount + 1];
+
+    SharedBufferCache* prev;
+    SharedBufferCache* next;
+};
+
+#if defined(HAVE_PTHREADS)
+
+static pthread_once_t gCacheOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gCacheKey;
+
+// The caches of the live threads, and what the others allocated.
+static pthread_mutex_t gCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static SharedBufferCache* gCaches = NULL;
+static uint64_t gRetiredAllocCount[SharedBuffer::kSizeClassCount + 1];
+
+// Set once a thread's cache is gone, so it does not get a new one.
+static SharedBufferCache* const kCacheGone = reinterpret_cast<SharedBufferCache*>(1);
+
+static void destroyCache(void* data) {
+    SharedBufferCache* cache = static_cast<SharedBufferCache*>(data);
+    if (cache == kCacheGone) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < SharedBuffer::kSizeClassCount; i++) {
+        void* block = cache->freeList[i];
+        while (block) {
+            void* next = *static_cast<void**>(static_cast<SharedBuffer*>(block)->data());
+            free(block);
+            block = next;
+        }
+    }
+
+    pthread_mutex_lock(&gCacheLock);
+    for (uint32_t i = 0; i <= SharedBuffer::kSizeClassCount; i++) {
+        gRetiredAllocCount[i] += cache->allocCount[i];
+    }
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        gCaches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&gCacheLock);
+
+    free(cache);
+    pthread_setspecific(gCacheKey, kCacheGone);
+}
+
+static void initCacheKey() {
+    pthread_key_create(&gCacheKey, destroyCache);
+}
+
+static SharedBufferCache* getCache() {
+    pthread_once(&gCacheOnce, initCacheKey);
+    SharedBufferCache* cache = static_cast<SharedBufferCache*>(pthread_getspecific(gCacheKey));
+    if (cache == kCacheGone) {
+        return NULL;
+    }
+    if (!cache) {
+        cache = static_cast<SharedBufferCache*>(calloc(1, sizeof(SharedBufferCache)));
+        if (!cache) {
+            return NULL;
+        }
+        pthread_mutex_lock(&gCacheLock);
+        cache->next = gCaches;
+        if (gCaches) {
+            gCaches->prev = cache;
+        }
+        gCaches = cache;
+        pthread_mutex_unlock(&gCacheLock);
+        pthread_setspecific(gCacheKey, cache);
+    }
+    return cache;
+}
+
+#else
+
+// No threads to keep a cache for, only count.
+static uint64_t gAllocCount[SharedBuffer::kSizeClassCount + 1];
+
+static inline SharedBufferCache* getCache() {
+    return NULL;
+}
+
+#endif
+
+SharedBuffer* SharedBuffer::allocBlock(size_t size)
+{
+    uint32_t sizeClass = sizeClassFor(size);
+    SharedBufferCache* cache = getCache();
+    SharedBuffer* sb;
+
+    if (sizeClass == kNoSizeClass) {
+        sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
+    } else if (cache && cache->freeList[sizeClass]) {
+        sb = static_cast<SharedBuffer *>(cache->freeList[sizeClass]);
+        cache->freeList[sizeClass] = *static_cast<void**>(sb->data());
+        cache->freeCount[sizeClass]--;
+    } else {
+        sb = static_cast<SharedBuffer *>(
+                malloc(sizeof(SharedBuffer) + kSizeClasses[sizeClass]));
+    }
+
+    uint32_t countIndex = sizeClass == kNoSizeClass ? SharedBuffer::kSizeClassCount : sizeClass;
+    if (cache) {
+        cache->allocCount[countIndex]++;
+    }
+#if !defined(HAVE_PTHREADS)
+    gAllocCount[countIndex]++;
+#endif
+
+    if (sb) {
+        sb->mSizeClass = sizeClass;
+    }
+    return sb;
+}
+
+void SharedBuffer::freeBlock(SharedBuffer* sb)
+{
+    uint32_t sizeClass = sb->mSizeClass;
+    if (sizeClass != kNoSizeClass) {
+        SharedBufferCache* cache = getCache();
+        if (cache && cache->freeCount[sizeClass] < kMaxCachedPerClass) {
+            *static_cast<void**>(sb->data()) = cache->freeList[sizeClass];
+            cache->freeList[sizeClass] = sb;
+            cache->freeCount[sizeClass]++;
+            return;
+        }
+    }
+    free(sb);
+}
+
+size_t SharedBuffer::sizeClassLimit(size_t sizeClass)
+{
+    return sizeClass < kSizeClassCount ? kSizeClasses[sizeClass] : 0;
+}
+
+void SharedBuffer::getAllocationCounts(uint64_t counts[kSizeClassCount + 1])
+{
+#if defined(HAVE_PTHREADS)
+    pthread_mutex_lock(&gCacheLock);
+    for (size_t i = 0; i <= kSizeClassCount; i++) {
+        counts[i] = gRetiredAllocCount[i];
+    }
+    // The counts of running threads are read without synchronization,
+    // they may be a little behind.
+    for (SharedBufferCache* cache = gCaches; cache; cache = cache->next) {
+        for (size_t i = 0; i <= kSizeClassCount; i++) {
+            counts[i] += cache->allocCount[i];
+        }
+    }
+    pthread_mutex_unlock(&gCacheLock);
+#else
+    for (size_t i = 0; i <= kSizeClassCount; i++) {
+        counts[i] = gAllocCount[i];
+    }
+#endif
+}
+
 SharedBuffer* SharedBuffer::alloc(size_t size)
 {
-    SharedBuffer* sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
+    SharedBuffer* sb = allocBlock(size);
     if (sb) {
         sb->mRefs = 1;
         sb->mSize = size;
@@ -38,7 +238,7 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
 ssize_t SharedBuffer::dealloc(const SharedBuffer* released)
 {
     if (released->mRefs != 0) return -1; // XXX: invalid operation
-    free(const_cast<SharedBuffer*>(released));
+    freeBlock(const_cast<SharedBuffer*>(released));
     return 0;
 }
 
@@ -60,8 +260,18 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
     if (onlyOwner()) {
         SharedBuffer* buf = const_cast<SharedBuffer*>(this);
         if (buf->mSize == newSize) return buf;
-        buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
-        if (buf != NULL) {
+
+        uint32_t newSizeClass = sizeClassFor(newSize);
+        if (newSizeClass == kNoSizeClass) {
+            // a large buffer, realloc() can do better than a copy
+            buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
+            if (buf != NULL) {
+                buf->mSize = newSize;
+                buf->mSizeClass = kNoSizeClass;
+                return buf;
+            }
+        } else if (newSizeClass == buf->mSizeClass) {
+            // it still fits the block
             buf->mSize = newSize;
             return buf;
         }
@@ -103,7 +313,7 @@ int32_t SharedBuffer::release(uint32_t flags) const
     if (onlyOwner() || ((prev = android_atomic_dec(&mRefs)) == 1)) {
         mRefs = 0;
         if ((flags & eKeepStorage) == 0) {
-            free(const_cast<SharedBuffer*>(this));
+            freeBlock(const_cast<SharedBuffer*>(this));
         }
     }
     return prev;
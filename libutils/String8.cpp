@@ -16,6 +16,8 @@
 
 #include <utils/String8.h>
 
+#include <utils/HashMap.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 #include <utils/Unicode.h>
 #include <utils/SharedBuffer.h>
@@ -40,6 +42,25 @@ namespace android {
 static SharedBuffer* gEmptyStringBuf = NULL;
 static char* gEmptyString = NULL;
 
+// The pool of interned strings, keyed by the characters of the values.
+struct InternKey {
+    const char* str;
+    size_t len;
+
+    inline bool operator==(const InternKey& other) const {
+        return len == other.len && !memcmp(str, other.str, len);
+    }
+};
+
+ANDROID_BASIC_TYPES_TRAITS(InternKey)
+
+template<> inline hash_t hash_type(const InternKey& key) {
+    return JenkinsHashWhiten(JenkinsHashMixBytes(0, (const uint8_t*)key.str, key.len));
+}
+
+static Mutex* gInternLock = NULL;
+static HashMap<InternKey, String8>* gInternPool = NULL;
+
 extern int gDarwinCantLoadAllObjects;
 int gDarwinIsReallyAnnoying;
 
@@ -64,10 +85,18 @@ void initialize_string8()
     *str = 0;
     gEmptyStringBuf = buf;
     gEmptyString = str;
+
+    gInternLock = new Mutex();
+    gInternPool = new HashMap<InternKey, String8>();
 }
 
 void terminate_string8()
 {
+    delete gInternPool;
+    delete gInternLock;
+    gInternPool = NULL;
+    gInternLock = NULL;
+
     SharedBuffer::bufferFromData(gEmptyString)->release();
     gEmptyStringBuf = NULL;
     gEmptyString = NULL;
@@ -225,6 +254,47 @@ String8 String8::formatV(const char* fmt, va_list args)
     return result;
 }
 
+String8 String8::intern(const char* str)
+{
+    return intern(str, strlen(str));
+}
+
+String8 String8::intern(const char* str, size_t numChars)
+{
+    InternKey key;
+    key.str = str;
+    key.len = numChars;
+
+    AutoMutex _l(*gInternLock);
+    const String8* interned = gInternPool->find(key);
+    if (interned) {
+        return *interned;
+    }
+
+    String8 value(str, numChars);
+    key.str = value.string();   // the pool keeps value, and its buffer, forever
+    gInternPool->add(key, value);
+    return value;
+}
+
+String8 String8::intern(const String8& str)
+{
+    InternKey key;
+    key.str = str.string();
+    key.len = str.length();
+
+    AutoMutex _l(*gInternLock);
+    const String8* interned = gInternPool->find(key);
+    if (interned) {
+        return *interned;
+    }
+
+    // Share the buffer of str, it cannot change under the pool: editing a
+    // shared String8 makes a copy first.
+    gInternPool->add(key, str);
+    return str;
+}
+
 void String8::clear() {
     SharedBuffer::bufferFromData(mString)->release();
     mString = getEmptyString();
@@ -323,18 +393,29 @@ status_t String8::appendFormat(const char* fmt, ...)
 
 status_t String8::appendFormatV(const char* fmt, va_list args)
 {
-    int result = NO_ERROR;
-    int n = vsnprintf(NULL, 0, fmt, args);
-    if (n != 0) {
-        size_t oldLength = length();
-        char* buf = lockBuffer(oldLength + n);
-        if (buf) {
-            vsnprintf(buf + oldLength, n + 1, fmt, args);
-        } else {
-            result = NO_MEMORY;
-        }
+    // Most results fit here, and then are only formatted once.
+    char stackBuf[256];
+    va_list tmp;
+    va_copy(tmp, args);
+    int n = vsnprintf(stackBuf, sizeof(stackBuf), fmt, tmp);
+    va_end(tmp);
+    if (n < 0) {
+        return UNKNOWN_ERROR;
     }
-    return result;
+    if (n == 0) {
+        return NO_ERROR;
+    }
+    if (size_t(n) < sizeof(stackBuf)) {
+        return real_append(stackBuf, n);
+    }
+
+    size_t oldLength = length();
+    char* buf = lockBuffer(oldLength + n);
+    if (!buf) {
+        return NO_MEMORY;
+    }
+    vsnprintf(buf + oldLength, n + 1, fmt, args);
+    return NO_ERROR;
 }
 
 status_t String8::real_append(const char* other, size_t otherLen)
@@ -637,4 +718,109 @@ String8& String8::convertToResPath()
     return *this;
 }
 
+// ---------------------------------------------------------------------------
+
+String8Builder::String8Builder()
+    : mLength(0), mCapacity(0)
+{
+}
+
+String8Builder::String8Builder(size_t capacity)
+    : mLength(0), mCapacity(0)
+{
+    reserve(capacity);
+}
+
+char* String8Builder::reserve(size_t numChars)
+{
+    size_t size = mLength + numChars;
+    if (size > mCapacity || mCapacity == 0) {
+        size_t capacity = mCapacity ? mCapacity * 2 : 64;
+        if (capacity < size) {
+            capacity = size;
+        }
+        char* buf = mString.lockBuffer(capacity);
+        if (!buf) {
+            return NULL;
+        }
+        buf[mLength] = '\0';
+        mCapacity = capacity;
+    }
+    return const_cast<char*>(mString.string());
+}
+
+status_t String8Builder::append(const String8& other)
+{
+    return append(other.string(), other.length());
+}
+
+status_t String8Builder::append(const char* other)
+{
+    return append(other, strlen(other));
+}
+
+status_t String8Builder::append(const char* other, size_t numChars)
+{
+    char* buf = reserve(numChars);
+    if (!buf) {
+        return NO_MEMORY;
+    }
+    memcpy(buf + mLength, other, numChars);
+    mLength += numChars;
+    buf[mLength] = '\0';
+    return NO_ERROR;
+}
+
+status_t String8Builder::appendFormat(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+
+    status_t result = appendFormatV(fmt, args);
+
+    va_end(args);
+    return result;
+}
+
+status_t String8Builder::appendFormatV(const char* fmt, va_list args)
+{
+    char* buf = reserve(0);
+    if (!buf) {
+        return NO_MEMORY;
+    }
+
+    size_t room = mCapacity - mLength;
+    va_list tmp;
+    va_copy(tmp, args);
+    int n = vsnprintf(buf + mLength, room + 1, fmt, tmp);
+    va_end(tmp);
+    if (n < 0) {
+        buf[mLength] = '\0';
+        return UNKNOWN_ERROR;
+    }
+
+    if (size_t(n) > room) {
+        char* bigger = reserve(n);
+        if (!bigger) {
+            buf[mLength] = '\0';
+            return NO_MEMORY;
+        }
+        vsnprintf(bigger + mLength, n + 1, fmt, args);
+    }
+    mLength += n;
+    return NO_ERROR;
+}
+
+String8 String8Builder::toString()
+{
+    if (mCapacity) {
+        mString.unlockBuffer(mLength);
+    }
+    String8 result(mString);
+    mString.clear();
+    mLength = 0;
+    mCapacity = 0;
+    return result;
+}
+
 }; // namespace android
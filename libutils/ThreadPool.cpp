@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ThreadPool"
+
+//#define LOG_NDEBUG 0
+
+#include <utils/ThreadPool.h>
+#include <utils/AndroidThreads.h>
+#include <utils/Log.h>
+
+#include <pthread.h>
+
+namespace android {
+
+// How long a pool thread waiting for a TaskGroup sleeps before it looks for
+// more tasks to run.  Tasks queued meanwhile only wake idle threads.
+static const nsecs_t kHelpInterval = ms2ns(1);
+
+// Which pool thread, if any, the calling thread is.
+static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gTLSKey = 0;
+
+static void initTLSKey() {
+    int result = pthread_key_create(&gTLSKey, NULL);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not allocate TLS key.");
+}
+
+// --- TaskGroup ---
+
+TaskGroup::TaskGroup() :
+        mPending(0) {
+}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::wait() {
+    pthread_once(&gTLSOnce, initTLSKey);
+    for (;;) {
+        if (ThreadPool::runTaskOnCurrentThread()) {
+            AutoMutex _l(mLock);
+            if (mPending == 0) {
+                return;
+            }
+            continue;
+        }
+
+        AutoMutex _l(mLock);
+        if (mPending == 0) {
+            return;
+        }
+        if (pthread_getspecific(gTLSKey) != NULL) {
+            mCondition.waitRelative(mLock, kHelpInterval);
+        } else {
+            mCondition.wait(mLock);
+        }
+    }
+}
+
+size_t TaskGroup::getPendingCount() const {
+    AutoMutex _l(mLock);
+    return mPending;
+}
+
+void TaskGroup::add() {
+    AutoMutex _l(mLock);
+    mPending += 1;
+}
+
+void TaskGroup::done() {
+    AutoMutex _l(mLock);
+    mPending -= 1;
+    if (mPending == 0) {
+        mCondition.broadcast();
+    }
+}
+
+// --- ThreadPool::Worker ---
+
+ThreadPool::Worker::Worker(ThreadPool* pool, size_t index) :
+        Thread(false), mPool(pool), mIndex(index), mPriority(ANDROID_PRIORITY_NORMAL) {
+}
+
+status_t ThreadPool::Worker::readyToRun() {
+    pthread_setspecific(gTLSKey, this);
+    return NO_ERROR;
+}
+
+bool ThreadPool::Worker::threadLoop() {
+    return mPool->runOnce(this);
+}
+
+// --- ThreadPool ---
+
+ThreadPool::ThreadPool(size_t threadCount) :
+        mIdleCount(0), mNextQueue(0), mExiting(false) {
+    pthread_once(&gTLSOnce, initTLSKey);
+
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        mWorkers.push(new Worker(this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+status_t ThreadPool::start(const char* name) {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        status_t result = mWorkers[i]->run(name);
+        if (result != NO_ERROR) {
+            return result;
+        }
+    }
+    return NO_ERROR;
+}
+
+void ThreadPool::stop() {
+    { // acquire lock
+        AutoMutex _l(mLock);
+        mExiting = true;
+        mCondition.broadcast();
+    } // release lock
+
+    // The threads exit once they find nothing left to run.
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->join();
+    }
+}
+
+status_t ThreadPool::post(const sp<Task>& task, int priority, TaskGroup* group) {
+    size_t index;
+    Worker* self = static_cast<Worker*>(pthread_getspecific(gTLSKey));
+    { // acquire lock
+        AutoMutex _l(mLock);
+        if (mExiting && (self == NULL || self->mPool != this)) {
+            return INVALID_OPERATION;
+        }
+        if (self != NULL && self->mPool == this) {
+            index = self->mIndex;
+        } else {
+            index = mNextQueue++ % mWorkers.size();
+        }
+    } // release lock
+
+    if (group != NULL) {
+        group->add();
+    }
+
+    Entry entry;
+    entry.task = task;
+    entry.priority = priority;
+    entry.group = group;
+    { // acquire lock
+        Worker* worker = mWorkers[index].get();
+        AutoMutex _wl(worker->mLock);
+        worker->mQueue.push_back(entry);
+    } // release lock
+
+    AutoMutex _l(mLock);
+    if (mIdleCount != 0) {
+        mCondition.signal();
+    }
+    return NO_ERROR;
+}
+
+bool ThreadPool::runOnce(Worker* worker) {
+    Entry entry;
+    if (takeTask(worker->mIndex, &entry)) {
+        runTask(worker, entry);
+        return true;
+    }
+
+    AutoMutex _l(mLock);
+    if (mExiting) {
+        // Nothing left, and a task still running can only queue onto its
+        // own thread, which runs it before exiting.
+        return false;
+    }
+
+    // Anything queued from now on sees us idle and signals, so a last look
+    // at the queues leaves no task behind.
+    mIdleCount += 1;
+    if (!hasQueuedTasks()) {
+        mCondition.wait(mLock);
+    }
+    mIdleCount -= 1;
+    return true;
+}
+
+bool ThreadPool::takeTask(size_t index, Entry* outEntry) {
+    { // acquire lock
+        Worker* worker = mWorkers[index].get();
+        AutoMutex _l(worker->mLock);
+        if (!worker->mQueue.empty()) {
+            List<Entry>::iterator it = worker->mQueue.end();
+            --it;
+            *outEntry = *it;
+            worker->mQueue.erase(it);
+            return true;
+        }
+    } // release lock
+
+    // Steal from the front of the other queues, away from their owners.
+    size_t count = mWorkers.size();
+    for (size_t i = 1; i < count; i++) {
+        Worker* worker = mWorkers[(index + i) % count].get();
+        AutoMutex _l(worker->mLock);
+        if (!worker->mQueue.empty()) {
+            List<Entry>::iterator it = worker->mQueue.begin();
+            *outEntry = *it;
+            worker->mQueue.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::hasQueuedTasks() {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        AutoMutex _l(mWorkers[i]->mLock);
+        if (!mWorkers[i]->mQueue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runTask(Worker* worker, const Entry& entry) {
+#if defined(HAVE_ANDROID_OS)
+    if (entry.priority != worker->mPriority) {
+        androidSetThreadPriority(androidGetTid(), entry.priority);
+        worker->mPriority = entry.priority;
+    }
+#endif
+
+    ALOGV("Running task %p on thread %zu, priority %d", entry.task.get(),
+            worker->mIndex, entry.priority);
+    entry.task->run();
+
+    if (entry.group != NULL) {
+        entry.group->done();
+    }
+}
+
+bool ThreadPool::runTaskOnCurrentThread() {
+    Worker* self = static_cast<Worker*>(pthread_getspecific(gTLSKey));
+    if (self == NULL) {
+        return false;
+    }
+
+    ThreadPool* pool = self->mPool;
+    Entry entry;
+    if (!pool->takeTask(self->mIndex, &entry)) {
+        return false;
+    }
+
+#if defined(HAVE_ANDROID_OS)
+    int priority = self->mPriority;
+    pool->runTask(self, entry);
+    // Go back to the priority of the task that is waiting.
+    if (self->mPriority != priority) {
+        androidSetThreadPriority(androidGetTid(), priority);
+        self->mPriority = priority;
+    }
+#else
+    pool->runTask(self, entry);
+#endif
+    return true;
+}
+
+} // namespace android
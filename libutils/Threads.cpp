@@ -19,11 +19,14 @@
 
 #include <utils/threads.h>
 #include <utils/Log.h>
+#include <utils/Timers.h>
 
+#include <cutils/atomic.h>
 #include <cutils/sched_policy.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <memory.h>
 #include <errno.h>
 #include <assert.h>
@@ -356,7 +359,169 @@ namespace android {
  */
 
 #if defined(HAVE_PTHREADS)
-// implemented as inlines in threads.h
+// implemented as inlines in threads.h, except for what follows: the path
+// taken when lock() finds the mutex held, and contention profiling.
+
+// How many more times lock() tries before blocking, on SMP.  Most critical
+// sections are over by then, and blocking would cost two context switches.
+static const int kMutexSpinCount = 100;
+
+struct ContentionSite {
+    const void* mutex;
+    const void* caller;
+    uint32_t count;
+    nsecs_t totalWait;
+    nsecs_t maxWait;
+};
+
+static const size_t kMaxContentionSites = 64;
+
+static volatile int32_t gContentionSamplePeriod = 0;
+static volatile int32_t gContentionCount = 0;
+
+static pthread_mutex_t gContentionLock = PTHREAD_MUTEX_INITIALIZER;
+static ContentionSite gContentionSites[kMaxContentionSites];   // guarded by gContentionLock
+static uint32_t gContentionDropped = 0;                        // guarded by gContentionLock
+
+static bool isMultiprocessor()
+{
+    static int sProcessorCount = 0;
+    if (sProcessorCount == 0) {
+        long count = sysconf(_SC_NPROCESSORS_CONF);
+        sProcessorCount = count > 0 ? int(count) : 1;
+    }
+    return sProcessorCount > 1;
+}
+
+static inline void cpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__ ("pause" : : : "memory");
+#else
+    __asm__ __volatile__ ("" : : : "memory");
+#endif
+}
+
+static void recordContention(const void* mutex, const void* caller, nsecs_t wait)
+{
+    size_t hash = (uintptr_t(caller) >> 2) ^ (uintptr_t(mutex) >> 4) * 31;
+    pthread_mutex_lock(&gContentionLock);
+    for (size_t i = 0; i < kMaxContentionSites; i++) {
+        ContentionSite& site = gContentionSites[(hash + i) % kMaxContentionSites];
+        if (site.count == 0) {
+            site.mutex = mutex;
+            site.caller = caller;
+        } else if (site.mutex != mutex || site.caller != caller) {
+            continue;
+        }
+        site.count++;
+        site.totalWait += wait;
+        if (wait > site.maxWait) {
+            site.maxWait = wait;
+        }
+        pthread_mutex_unlock(&gContentionLock);
+        return;
+    }
+    gContentionDropped++;
+    pthread_mutex_unlock(&gContentionLock);
+}
+
+status_t Mutex::lockContended()
+{
+    // Not inlined, so this is in the function that called lock().
+    const void* caller = __builtin_return_address(0);
+
+    const int32_t period = gContentionSamplePeriod;
+    const bool sampled = period > 0
+            && uint32_t(android_atomic_inc(&gContentionCount)) % uint32_t(period) == 0;
+    const nsecs_t start = sampled ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
+
+    status_t err = NO_ERROR;
+    bool locked = false;
+    if (isMultiprocessor()) {
+        for (int i = 0; i < kMutexSpinCount && !locked; i++) {
+            cpuRelax();
+            locked = pthread_mutex_trylock(&mMutex) == 0;
+        }
+    }
+    if (!locked) {
+        err = -pthread_mutex_lock(&mMutex);
+    }
+
+    if (sampled) {
+        recordContention(this, caller, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    }
+    return err;
+}
+
+void Mutex::setContentionSampling(uint32_t samplePeriod)
+{
+    android_atomic_release_store(int32_t(samplePeriod), &gContentionSamplePeriod);
+}
+
+// Writes all of buf to fd.  Returns false if fd won't take it.
+static bool writeFully(int fd, const char* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int compareTotalWait(const void* lhs, const void* rhs)
+{
+    nsecs_t l = static_cast<const ContentionSite*>(lhs)->totalWait;
+    nsecs_t r = static_cast<const ContentionSite*>(rhs)->totalWait;
+    return l > r ? -1 : (l < r ? 1 : 0);
+}
+
+void Mutex::dumpContention(int fd, bool reset)
+{
+    ContentionSite sites[kMaxContentionSites];
+    uint32_t dropped;
+
+    pthread_mutex_lock(&gContentionLock);
+    memcpy(sites, gContentionSites, sizeof(sites));
+    dropped = gContentionDropped;
+    if (reset) {
+        memset(gContentionSites, 0, sizeof(gContentionSites));
+        gContentionDropped = 0;
+    }
+    pthread_mutex_unlock(&gContentionLock);
+
+    qsort(sites, kMaxContentionSites, sizeof(sites[0]), compareTotalWait);
+
+    char line[160];
+    int n = snprintf(line, sizeof(line), "Mutex contention (1 in %d sampled):\n",
+            int(gContentionSamplePeriod));
+    if (!writeFully(fd, line, n)) {
+        return;
+    }
+    for (size_t i = 0; i < kMaxContentionSites && sites[i].count; i++) {
+        const ContentionSite& site = sites[i];
+        n = snprintf(line, sizeof(line),
+                "  mutex %p from %p: %u waits, %lld us total, %lld us max\n",
+                site.mutex, site.caller, site.count,
+                (long long) nanoseconds_to_microseconds(site.totalWait),
+                (long long) nanoseconds_to_microseconds(site.maxWait));
+        if (!writeFully(fd, line, n)) {
+            return;
+        }
+    }
+    if (dropped) {
+        n = snprintf(line, sizeof(line), "  %u waits at other sites not recorded\n", dropped);
+        writeFully(fd, line, n);
+    }
+}
+
 #elif defined(HAVE_WIN32_THREADS)
 
 Mutex::Mutex()
@@ -32,6 +32,25 @@
 #include <windows.h>
 #endif
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#if defined(HAVE_POSIX_CLOCKS)
+// Older C libraries don't name the coarse clocks; they are older than
+// CLOCK_BOOTTIME in the kernel.
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE 5
+#endif
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE 6
+#endif
+#endif
+
 nsecs_t systemTime(int clock)
 {
 #if defined(HAVE_POSIX_CLOCKS)
@@ -40,7 +59,9 @@ nsecs_t systemTime(int clock)
             CLOCK_MONOTONIC,
             CLOCK_PROCESS_CPUTIME_ID,
             CLOCK_THREAD_CPUTIME_ID,
-            CLOCK_BOOTTIME
+            CLOCK_BOOTTIME,
+            CLOCK_REALTIME_COARSE,
+            CLOCK_MONOTONIC_COARSE
     };
     struct timespec t;
     t.tv_sec = t.tv_nsec = 0;
@@ -70,3 +91,134 @@ int toMillisecondTimeoutDelay(nsecs_t referenceTime, nsecs_t timeoutTime)
     }
     return timeoutDelayMillis;
 }
+
+// ------------------------------------------------------------------
+// systemCycles()
+
+static uint64_t monotonicCycles()
+{
+    return systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+#if defined(__aarch64__)
+static uint64_t counterCycles()
+{
+    uint64_t t;
+    // the isb keeps the read from being done ahead of earlier instructions
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (t) : : "memory");
+    return t;
+}
+
+static uint64_t counterFrequency()
+{
+    uint64_t f;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (f));
+    return f;
+}
+#elif defined(__i386__) || defined(__x86_64__)
+static uint64_t counterCycles()
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return (uint64_t(hi) << 32) | lo;
+}
+
+// Counts the TSC against the monotonic clock for a couple of milliseconds,
+// which is good to some tens of ppm.  Returns 0 if the TSC can't be used:
+// without an invariant TSC its rate follows the CPU frequency.
+static uint64_t counterFrequency()
+{
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(0x80000007, &a, &b, &c, &d) || !(d & (1 << 8))) {
+        return 0;
+    }
+
+    const nsecs_t t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+    const uint64_t c0 = counterCycles();
+    nsecs_t t1;
+    uint64_t c1;
+    do {
+        t1 = systemTime(SYSTEM_TIME_MONOTONIC);
+        c1 = counterCycles();
+    } while (t1 - t0 < ms2ns(2));
+    return (c1 - c0) * 1000000000ULL / uint64_t(t1 - t0);
+}
+#else
+// 32-bit ARM kernels don't always let user space read CNTVCT, and reading
+// it when they don't is fatal, so those use the clock too.
+static uint64_t counterCycles()
+{
+    return monotonicCycles();
+}
+
+static uint64_t counterFrequency()
+{
+    return 0;
+}
+#endif
+
+static uint64_t firstCycles();
+
+// Starts out as firstCycles(), which sets it up; a reader racing with
+// that sees either function, and both give a valid count.
+static uint64_t (*gReadCycles)() = firstCycles;
+static uint64_t gCyclesFrequency;
+
+static void initCycles()
+{
+    uint64_t frequency = counterFrequency();
+    if (frequency != 0) {
+        gCyclesFrequency = frequency;
+        gReadCycles = counterCycles;
+    } else {
+        gCyclesFrequency = 1000000000ULL;
+        gReadCycles = monotonicCycles;
+    }
+}
+
+#ifdef HAVE_PTHREADS
+static pthread_once_t gCyclesOnce = PTHREAD_ONCE_INIT;
+
+static void initCyclesOnce()
+{
+    pthread_once(&gCyclesOnce, initCycles);
+}
+#else
+static void initCyclesOnce()
+{
+    if (gCyclesFrequency == 0) {
+        initCycles();
+    }
+}
+#endif
+
+static uint64_t firstCycles()
+{
+    initCyclesOnce();
+    return gReadCycles();
+}
+
+uint64_t systemCycles()
+{
+    return gReadCycles();
+}
+
+uint64_t systemCyclesFrequency()
+{
+    initCyclesOnce();
+    return gCyclesFrequency;
+}
+
+nsecs_t cyclesToNanoseconds(uint64_t cycles)
+{
+    const uint64_t f = systemCyclesFrequency();
+    // split up so that neither product can overflow
+    return nsecs_t((cycles / f) * 1000000000ULL + (cycles % f) * 1000000000ULL / f);
+}
+
+uint64_t nanosecondsToCycles(nsecs_t ns)
+{
+    const uint64_t f = systemCyclesFrequency();
+    const uint64_t n = ns > 0 ? uint64_t(ns) : 0;
+    return (n / 1000000000ULL) * f + (n % 1000000000ULL) * f / 1000000000ULL;
+}
@@ -116,6 +116,10 @@ String8 Tokenizer::getLocation() const {
 }
 
 String8 Tokenizer::peekRemainderOfLine() const {
+    return peekRemainderOfLineView().toString8();
+}
+
+Tokenizer::View Tokenizer::peekRemainderOfLineView() const {
     const char* end = getEnd();
     const char* eol = mCurrent;
     while (eol != end) {
@@ -125,10 +129,15 @@ String8 Tokenizer::peekRemainderOfLine() const {
         }
         eol += 1;
     }
-    return String8(mCurrent, eol - mCurrent);
+    View view = { mCurrent, size_t(eol - mCurrent) };
+    return view;
 }
 
 String8 Tokenizer::nextToken(const char* delimiters) {
+    return nextTokenView(delimiters).toString8();
+}
+
+Tokenizer::View Tokenizer::nextTokenView(const char* delimiters) {
 #if DEBUG_TOKENIZER
     ALOGD("nextToken");
 #endif
@@ -141,7 +150,8 @@ String8 Tokenizer::nextToken(const char* delimiters) {
         }
         mCurrent += 1;
     }
-    return String8(tokenStart, mCurrent - tokenStart);
+    View view = { tokenStart, size_t(mCurrent - tokenStart) };
+    return view;
 }
 
 void Tokenizer::nextLine() {
@@ -17,6 +17,8 @@
 #include <utils/Unicode.h>
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #ifdef HAVE_WINSOCK
 # undef  nhtol
@@ -68,6 +70,58 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// --------------------------------------------------------------------------
+// ASCII runs
+// --------------------------------------------------------------------------
+
+// Most strings are mostly ASCII, so the conversions below look for runs of
+// it a word at a time and copy them with a plain loop, which the compiler
+// can vectorize, before going back to decoding one character at a time.
+
+// The high bit of every byte, and of every UTF-16 code unit above 0x7F, in a
+// word.
+static const uintptr_t kAsciiMask8 = ~(uintptr_t) 0 / 0xFF * 0x80;
+static const uintptr_t kAsciiMask16 = ~(uintptr_t) 0 / 0xFFFF * 0xFF80;
+
+/**
+ * Return the number of ASCII characters at the start of the UTF-8 string.
+ */
+static inline size_t utf8_ascii_run(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+    for (; i + sizeof(uintptr_t) <= len; i += sizeof(uintptr_t)) {
+        uintptr_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & kAsciiMask8) {
+            break;
+        }
+    }
+    while (i < len && src[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Return the number of ASCII characters at the start of the UTF-16 string.
+ */
+static inline size_t utf16_ascii_run(const char16_t* src, size_t len)
+{
+    const size_t kUnitsPerWord = sizeof(uintptr_t) / sizeof(char16_t);
+    size_t i = 0;
+    for (; i + kUnitsPerWord <= len; i += kUnitsPerWord) {
+        uintptr_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & kAsciiMask16) {
+            break;
+        }
+    }
+    while (i < len && src[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -340,6 +394,15 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst)
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        if (*cur_utf16 < 0x80) {
+            const size_t n = utf16_ascii_run(cur_utf16, end_utf16 - cur_utf16);
+            for (size_t i = 0; i < n; i++) {
+                cur[i] = (char) cur_utf16[i];
+            }
+            cur += n;
+            cur_utf16 += n;
+            continue;
+        }
         char32_t utf32;
         // surrogate pairs
         if ((*cur_utf16 & 0xFC00) == 0xD800) {
@@ -412,6 +475,12 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        if (*src < 0x80) {
+            const size_t n = utf16_ascii_run(src, end - src);
+            ret += n;
+            src += n;
+            continue;
+        }
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*++src & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
@@ -524,6 +593,12 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            const size_t n = utf8_ascii_run(u8cur, u8end - u8cur);
+            u16measuredLen += n;
+            u8cur += n;
+            continue;
+        }
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
@@ -549,6 +624,15 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     char16_t* u16cur = u16str;
 
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            const size_t n = utf8_ascii_run(u8cur, u8end - u8cur);
+            for (size_t i = 0; i < n; i++) {
+                u16cur[i] = u8cur[i];
+            }
+            u16cur += n;
+            u8cur += n;
+            continue;
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -580,6 +664,19 @@ char16_t* utf8_to_utf16_n(const uint8_t* src, size_t srcLen, char16_t* dst, size
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        if (*u8cur < 0x80) {
+            size_t n = utf8_ascii_run(u8cur, u8end - u8cur);
+            const size_t room = dst + dstLen - u16cur;
+            if (n > room) {
+                n = room;
+            }
+            for (size_t i = 0; i < n; i++) {
+                u16cur[i] = u8cur[i];
+            }
+            u16cur += n;
+            u8cur += n;
+            continue;
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -281,6 +281,37 @@ ssize_t VectorImpl::removeItemsAt(size_t index, size_t count)
    return index;
 }
 
+ssize_t VectorImpl::removeItemsAtIndices(const size_t* indices, size_t count)
+{
+    for (size_t i=0 ; i<count ; i++) {
+        if (indices[i] >= size() || (i > 0 && indices[i] <= indices[i-1]))
+            return BAD_VALUE;
+    }
+    if (count == 0)
+        return NO_ERROR;
+
+    char* array = reinterpret_cast<char*>(editArrayImpl());
+    if (!array)
+        return NO_MEMORY;
+
+    // each run of survivors moves down over the items removed so far
+    size_t to = indices[0];
+    for (size_t i=0 ; i<count ; i++) {
+        const size_t from = indices[i] + 1;
+        const size_t end = (i+1 < count) ? indices[i+1] : mCount;
+        _do_destroy(array + indices[i]*mItemSize, 1);
+        if (end > from) {
+            _do_move_backward(array + to*mItemSize, array + from*mItemSize, end - from);
+        }
+        to += end - from;
+    }
+    mCount = to;
+
+    // give back memory the same way removeItemsAt() would
+    _shrink(mCount, 0);
+    return NO_ERROR;
+}
+
 void VectorImpl::finish_vector()
 {
     release_storage();
@@ -334,8 +365,9 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
     SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
     if (sb) {
         void* array = sb->data();
-        _do_copy(array, mStorage, size());
-        release_storage();
+        const bool move = _can_move_storage();
+        _do_relocate(array, mStorage, size(), move);
+        _release_relocated_storage(move);
         mStorage = const_cast<void*>(array);
     } else {
         return NO_MEMORY;
@@ -353,6 +385,33 @@ ssize_t VectorImpl::resize(size_t size) {
     return result < 0 ? result : size;
 }
 
+bool VectorImpl::_can_move_storage() const
+{
+    return mStorage && SharedBuffer::bufferFromData(mStorage)->onlyOwner();
+}
+
+void VectorImpl::_do_relocate(void* dest, const void* from, size_t num, bool move) const
+{
+    if (move) {
+        // the buffers don't overlap, either direction will do
+        _do_move_forward(dest, from, num);
+    } else {
+        _do_copy(dest, from, num);
+    }
+}
+
+void VectorImpl::_release_relocated_storage(bool moved)
+{
+    if (moved) {
+        // the items are gone already, only free the buffer
+        const SharedBuffer* sb = SharedBuffer::bufferFromData(mStorage);
+        sb->release(SharedBuffer::eKeepStorage);
+        SharedBuffer::dealloc(sb);
+    } else {
+        release_storage();
+    }
+}
+
 void VectorImpl::release_storage()
 {
     if (mStorage) {
@@ -389,15 +448,16 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
+                const bool move = _can_move_storage();
                 if (where != 0) {
-                    _do_copy(array, mStorage, where);
+                    _do_relocate(array, mStorage, where, move);
                 }
                 if (where != mCount) {
                     const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
                     void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
-                    _do_copy(dest, from, mCount-where);
+                    _do_relocate(dest, from, mCount-where, move);
                 }
-                release_storage();
+                _release_relocated_storage(move);
                 mStorage = const_cast<void*>(array);
             }
         }
@@ -441,15 +501,21 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
+                const bool move = _can_move_storage();
                 if (where != 0) {
-                    _do_copy(array, mStorage, where);
+                    _do_relocate(array, mStorage, where, move);
                 }
                 if (where != new_size) {
                     const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
                     void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
-                    _do_copy(dest, from, new_size - where);
+                    _do_relocate(dest, from, new_size - where, move);
                 }
-                release_storage();
+                if (move) {
+                    // the removed items were not moved
+                    void* removed = reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize;
+                    _do_destroy(removed, amount);
+                }
+                _release_relocated_storage(move);
                 mStorage = const_cast<void*>(array);
             }
         }
@@ -588,37 +654,142 @@ ssize_t SortedVectorImpl::add(const void* item)
 
 ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
 {
-    // naive merge...
-    if (!vector.isEmpty()) {
-        const void* buffer = vector.arrayImpl();
-        const size_t is = itemSize();
-        size_t s = vector.size();
-        for (size_t i=0 ; i<s ; i++) {
-            ssize_t err = add( reinterpret_cast<const char*>(buffer) + i*is );
-            if (err<0) {
-                return err;
-            }
-        }
+    if (&vector == this) {
+        return NO_ERROR;
     }
-    return NO_ERROR;
+    return _merge(vector.arrayImpl(), vector.size(), false);
 }
 
 ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
 {
-    // we've merging a sorted vector... nice!
-    ssize_t err = NO_ERROR;
-    if (!vector.isEmpty()) {
-        // first take care of the case where the vectors are sorted together
-        if (do_compare(vector.itemLocation(vector.size()-1), arrayImpl()) <= 0) {
-            err = VectorImpl::insertVectorAt(static_cast<const VectorImpl&>(vector), 0);
-        } else if (do_compare(vector.arrayImpl(), itemLocation(size()-1)) >= 0) {
-            err = VectorImpl::appendVector(static_cast<const VectorImpl&>(vector));
+    if (&vector == this) {
+        return NO_ERROR;
+    }
+    return _merge(vector.arrayImpl(), vector.size(), true);
+}
+
+/*
+ * Stable merge sort of n pointers to items, temp has room for n/2.
+ */
+void SortedVectorImpl::_sortItems(const void** items, const void** temp, size_t n) const
+{
+    if (n < 2)
+        return;
+
+    const size_t half = n / 2;
+    _sortItems(items, temp, half);
+    _sortItems(items + half, temp, n - half);
+    if (do_compare(items[half-1], items[half]) <= 0)
+        return; // already in order
+
+    memcpy(temp, items, half * sizeof(*items));
+    size_t a = 0, b = half, d = 0;
+    while (a < half && b < n) {
+        if (do_compare(items[b], temp[a]) < 0) {
+            items[d++] = items[b++];
         } else {
-            // this could be made a little better
-            err = merge(static_cast<const VectorImpl&>(vector));
+            items[d++] = temp[a++];
         }
     }
-    return err;
+    while (a < half) {
+        items[d++] = temp[a++];
+    }
+}
+
+/*
+ * Adds the length items in array at once.  They are put in order (unless
+ * sorted says they already are, without duplicates) and merged in from the
+ * back, so each item here moves at most once.  As with add() called for
+ * each of them in turn, an item replaces the one it is equal to, and of
+ * equal items in array the last one wins.
+ */
+ssize_t SortedVectorImpl::_merge(const void* array, size_t length, bool sorted)
+{
+    if (length == 0)
+        return NO_ERROR;
+
+    const size_t is = itemSize();
+    const void** items = reinterpret_cast<const void**>(
+            malloc((length + length/2) * sizeof(*items)));
+    if (!items)
+        return NO_MEMORY;
+
+    size_t n = length;
+    for (size_t i=0 ; i<n ; i++) {
+        items[i] = reinterpret_cast<const char*>(array) + i*is;
+    }
+    if (!sorted) {
+        _sortItems(items, items + length, n);
+        size_t m = 0;
+        for (size_t i=0 ; i<n ; i++) {
+            if (m > 0 && do_compare(items[m-1], items[i]) == 0) {
+                items[m-1] = items[i];
+            } else {
+                items[m++] = items[i];
+            }
+        }
+        n = m;
+    }
+
+    // count the items that replace one that is already here
+    const size_t old = size();
+    const char* cur = reinterpret_cast<const char*>(arrayImpl());
+    size_t replaced = 0;
+    for (size_t i=0, j=0 ; i<old && j<n ; ) {
+        const int c = do_compare(cur + i*is, items[j]);
+        if (c < 0) {
+            i++;
+        } else if (c > 0) {
+            j++;
+        } else {
+            replaced++;
+            i++, j++;
+        }
+    }
+
+    const size_t grow = n - replaced;
+    if (grow != 0) {
+        ssize_t err = VectorImpl::insertAt(old, grow);
+        if (err < 0) {
+            free(items);
+            return err;
+        }
+    }
+    char* base = reinterpret_cast<char*>(editArrayImpl());
+    if (!base) {
+        free(items);
+        return NO_MEMORY;
+    }
+
+    // Slots from old on hold the items insertAt() constructed, slots up to
+    // i hold the items still to be merged, the ones between are empty.
+    ssize_t i = old - 1;
+    ssize_t j = n - 1;
+    ssize_t k = old + grow - 1;
+    while (j >= 0) {
+        void* slot = base + k*is;
+        const int c = (i >= 0) ? do_compare(base + i*is, items[j]) : -1;
+        if (c > 0) {
+            if (k != i) {
+                if (k >= ssize_t(old)) do_destroy(slot, 1);
+                do_move_forward(slot, base + i*is, 1);
+            }
+            i--;
+        } else {
+            if (c == 0) {
+                do_destroy(base + i*is, 1);
+                i--;
+            }
+            if (k >= ssize_t(old)) do_destroy(slot, 1);
+            do_copy(slot, items[j], 1);
+            j--;
+        }
+        k--;
+    }
+    ALOG_ASSERT(k == i, "[%p] merge: k=%d, i=%d", this, int(k), int(i));
+
+    free(items);
+    return NO_ERROR;
 }
 
 ssize_t SortedVectorImpl::remove(const void* item)
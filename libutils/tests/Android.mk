@@ -7,9 +7,19 @@ test_src_files := \
     BasicHashtable_test.cpp \
     BlobCache_test.cpp \
     BitSet_test.cpp \
+    ConcurrentLruCache_test.cpp \
+    HashMap_test.cpp \
+    LinearAllocator_test.cpp \
     Looper_test.cpp \
+    LooperPool_test.cpp \
     LruCache_test.cpp \
+    RefBase_test.cpp \
+    RWLock_test.cpp \
+    SharedBuffer_test.cpp \
+    SortedVector_test.cpp \
     String8_test.cpp \
+    ThreadPool_test.cpp \
+    Timers_test.cpp \
     Unicode_test.cpp \
     Vector_test.cpp
 
@@ -32,3 +42,11 @@ $(foreach file,$(test_src_files), \
     $(eval LOCAL_MODULE := $(notdir $(file:%.cpp=%))) \
     $(eval include $(BUILD_NATIVE_TEST)) \
 )
+
+# Build the benchmarks, which aren't tests and aren't run with them.
+include $(CLEAR_VARS)
+LOCAL_MODULE := libutils_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := Benchmark.cpp
+LOCAL_SHARED_LIBRARIES := $(shared_libraries)
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks for the libutils containers and primitives, to judge
+ * changes to them by. Each benchmark is run with a growing number of
+ * iterations until it takes long enough to time, and is reported as the
+ * time per iteration:
+ *
+ *     libutils_benchmark [-t <seconds>] [<name substring>...]
+ *
+ * With names, only the benchmarks whose name contains one of them run.
+ */
+
+#define LOG_TAG "libutils_benchmark"
+
+#include <utils/BasicHashtable.h>
+#include <utils/BlobCache.h>
+#include <utils/KeyedVector.h>
+#include <utils/Looper.h>
+#include <utils/RefBase.h>
+#include <utils/SharedBuffer.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace android {
+
+// Results go here so that the compiler can't drop the work.
+static volatile uintptr_t gSink;
+
+static const int kContainerSize = 1000;
+static const int kContentionThreads = 4;
+
+static int compareInt(const int* lhs, const int* rhs) {
+    return *lhs - *rhs;
+}
+
+// A fixed pseudo-random sequence, the same from one run to the next.
+static void fillShuffled(int* values, int count) {
+    uint32_t seed = 1;
+    for (int i = 0; i < count; i++) {
+        values[i] = i;
+    }
+    for (int i = count - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        int j = (seed >> 16) % (i + 1);
+        int tmp = values[i];
+        values[i] = values[j];
+        values[j] = tmp;
+    }
+}
+
+static void BM_VectorPush(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        Vector<int> v;
+        for (int j = 0; j < kContainerSize; j++) {
+            v.push(j);
+        }
+        gSink += v.size();
+    }
+}
+
+static void BM_VectorInsertFront(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        Vector<int> v;
+        for (int j = 0; j < kContainerSize; j++) {
+            v.insertAt(j, 0);
+        }
+        gSink += v.size();
+    }
+}
+
+static void BM_VectorSort(int iterations) {
+    int values[kContainerSize];
+    fillShuffled(values, kContainerSize);
+    Vector<int> shuffled;
+    shuffled.appendArray(values, kContainerSize);
+
+    for (int i = 0; i < iterations; i++) {
+        Vector<int> v(shuffled);
+        v.sort(compareInt);
+        gSink += v[0];
+    }
+}
+
+static void BM_KeyedVectorLookup(int iterations) {
+    KeyedVector<int, int> kv;
+    int keys[kContainerSize];
+    fillShuffled(keys, kContainerSize);
+    for (int j = 0; j < kContainerSize; j++) {
+        kv.add(keys[j], j);
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        gSink += kv.valueFor(keys[i % kContainerSize]);
+    }
+}
+
+typedef key_value_pair_t<int, int> IntEntry;
+
+static void BM_BasicHashtableLookup(int iterations) {
+    BasicHashtable<int, IntEntry> table;
+    int keys[kContainerSize];
+    fillShuffled(keys, kContainerSize);
+    for (int j = 0; j < kContainerSize; j++) {
+        table.add(hash_type(keys[j]), IntEntry(keys[j], j));
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        int key = keys[i % kContainerSize];
+        gSink += table.find(-1, hash_type(key), key);
+    }
+}
+
+static const char kShortString[] = "android.hardware.camera";
+static const char kLongString[] =
+        "/data/data/com.example.android.app/cache/images/"
+        "0123456789abcdef0123456789abcdef0123456789abcdef.png";
+
+static void BM_String8Construct(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        String8 s(kLongString);
+        gSink += s.length();
+    }
+}
+
+static void BM_String8Append(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        String8 s(kShortString);
+        s.append("/");
+        s.append(kShortString);
+        s.appendFormat(":%d", i);
+        gSink += s.length();
+    }
+}
+
+static void BM_String16Construct(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        String16 s(kLongString);
+        gSink += s.size();
+    }
+}
+
+static void BM_String16To8(int iterations) {
+    String16 s16(kLongString);
+    for (int i = 0; i < iterations; i++) {
+        String8 s(s16);
+        gSink += s.length();
+    }
+}
+
+static void BM_SharedBufferAlloc(int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        SharedBuffer* sb = SharedBuffer::alloc(64 + (i & 0xff));
+        gSink += reinterpret_cast<uintptr_t>(sb->data());
+        sb->release();
+    }
+}
+
+static void BM_SharedBufferEditResize(int iterations) {
+    SharedBuffer* sb = SharedBuffer::alloc(16);
+    sb->acquire();  // a second owner, so that edit() has to copy
+    for (int i = 0; i < iterations; i++) {
+        SharedBuffer* copy = sb->edit();
+        copy = copy->editResize(32 + (i & 0xff));
+        gSink += copy->size();
+        copy->release();
+        sb->acquire();
+    }
+    sb->release();
+    sb->release();
+}
+
+class Counted : public RefBase {
+};
+
+static void BM_SpCopy(int iterations) {
+    sp<Counted> obj = new Counted();
+    for (int i = 0; i < iterations; i++) {
+        sp<Counted> copy(obj);
+        gSink += reinterpret_cast<uintptr_t>(copy.get());
+    }
+}
+
+struct ContentionArgs {
+    sp<Counted> obj;
+    int iterations;
+};
+
+static void* spCopyThread(void* arg) {
+    ContentionArgs* args = static_cast<ContentionArgs*>(arg);
+    for (int i = 0; i < args->iterations; i++) {
+        sp<Counted> copy(args->obj);
+        gSink += reinterpret_cast<uintptr_t>(copy.get());
+    }
+    return NULL;
+}
+
+// The iterations are shared out between the threads, which all copy the
+// same sp<>, so the time per iteration shows what contention costs.
+static void BM_SpCopyContended(int iterations) {
+    pthread_t threads[kContentionThreads];
+    ContentionArgs args;
+    args.obj = new Counted();
+    args.iterations = iterations / kContentionThreads;
+
+    for (int t = 0; t < kContentionThreads; t++) {
+        pthread_create(&threads[t], NULL, spCopyThread, &args);
+    }
+    for (int t = 0; t < kContentionThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+static void BM_WpPromote(int iterations) {
+    sp<Counted> obj = new Counted();
+    wp<Counted> weak(obj);
+    for (int i = 0; i < iterations; i++) {
+        sp<Counted> strong = weak.promote();
+        gSink += reinterpret_cast<uintptr_t>(strong.get());
+    }
+}
+
+class CountingHandler : public MessageHandler {
+public:
+    int count;
+
+    CountingHandler() : count(0) { }
+
+    virtual void handleMessage(const Message& message) {
+        count += message.what;
+    }
+};
+
+static void BM_LooperSendAndDispatch(int iterations) {
+    sp<Looper> looper = new Looper(true);
+    sp<CountingHandler> handler = new CountingHandler();
+
+    for (int i = 0; i < iterations; i++) {
+        looper->sendMessage(handler, Message(1));
+        looper->pollOnce(0);
+    }
+    gSink += handler->count;
+}
+
+// A burst of messages, posted from another thread and dispatched by one
+// wakeup where they arrive together.
+struct LooperArgs {
+    sp<Looper> looper;
+    sp<CountingHandler> handler;
+    int iterations;
+};
+
+static void* looperSendThread(void* arg) {
+    LooperArgs* args = static_cast<LooperArgs*>(arg);
+    for (int i = 0; i < args->iterations; i++) {
+        args->looper->sendMessage(args->handler, Message(1));
+    }
+    return NULL;
+}
+
+static void BM_LooperCrossThread(int iterations) {
+    LooperArgs args;
+    args.looper = new Looper(true);
+    args.handler = new CountingHandler();
+    args.iterations = iterations;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, looperSendThread, &args);
+    while (args.handler->count < iterations) {
+        args.looper->pollOnce(100);
+    }
+    pthread_join(thread, NULL);
+    gSink += args.handler->count;
+}
+
+static const size_t kBlobKeySize = 16;
+static const size_t kBlobValueSize = 256;
+static const int kBlobEntries = 256;
+
+static void makeBlobKey(char* key, int i) {
+    memset(key, 0, kBlobKeySize);
+    snprintf(key, kBlobKeySize, "key-%d", i);
+}
+
+static void BM_BlobCacheSet(int iterations) {
+    sp<BlobCache> cache = new BlobCache(kBlobKeySize, kBlobValueSize,
+            kBlobEntries * (kBlobKeySize + kBlobValueSize) / 2);
+    char key[kBlobKeySize];
+    char value[kBlobValueSize];
+    memset(value, 0x5a, sizeof(value));
+
+    // Twice as many keys as fit, so that sets keep evicting.
+    for (int i = 0; i < iterations; i++) {
+        makeBlobKey(key, i % kBlobEntries);
+        cache->set(key, sizeof(key), value, sizeof(value));
+    }
+}
+
+static void BM_BlobCacheGet(int iterations) {
+    sp<BlobCache> cache = new BlobCache(kBlobKeySize, kBlobValueSize,
+            2 * kBlobEntries * (kBlobKeySize + kBlobValueSize));
+    char key[kBlobKeySize];
+    char value[kBlobValueSize];
+    memset(value, 0x5a, sizeof(value));
+    for (int i = 0; i < kBlobEntries; i++) {
+        makeBlobKey(key, i);
+        cache->set(key, sizeof(key), value, sizeof(value));
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        makeBlobKey(key, i % kBlobEntries);
+        gSink += cache->get(key, sizeof(key), value, sizeof(value));
+    }
+}
+
+struct Benchmark {
+    const char* name;
+    void (*function)(int iterations);
+    const char* unit;       // what one iteration does
+};
+
+#define BENCHMARK(name, unit) { #name, name, unit }
+
+static const Benchmark gBenchmarks[] = {
+    BENCHMARK(BM_VectorPush, "1000 pushes"),
+    BENCHMARK(BM_VectorInsertFront, "1000 inserts at 0"),
+    BENCHMARK(BM_VectorSort, "sort of 1000"),
+    BENCHMARK(BM_KeyedVectorLookup, "lookup in 1000"),
+    BENCHMARK(BM_BasicHashtableLookup, "lookup in 1000"),
+    BENCHMARK(BM_String8Construct, "construct"),
+    BENCHMARK(BM_String8Append, "3 appends"),
+    BENCHMARK(BM_String16Construct, "construct from UTF-8"),
+    BENCHMARK(BM_String16To8, "UTF-16 to UTF-8"),
+    BENCHMARK(BM_SharedBufferAlloc, "alloc and release"),
+    BENCHMARK(BM_SharedBufferEditResize, "copy on write"),
+    BENCHMARK(BM_SpCopy, "sp copy"),
+    BENCHMARK(BM_SpCopyContended, "sp copy, 4 threads"),
+    BENCHMARK(BM_WpPromote, "promote"),
+    BENCHMARK(BM_LooperSendAndDispatch, "send and poll"),
+    BENCHMARK(BM_LooperCrossThread, "message from a thread"),
+    BENCHMARK(BM_BlobCacheSet, "set, evicting"),
+    BENCHMARK(BM_BlobCacheGet, "get"),
+};
+
+static bool matches(const char* name, int argc, char** argv) {
+    if (argc == 0) {
+        return true;
+    }
+    for (int i = 0; i < argc; i++) {
+        if (strstr(name, argv[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run(const Benchmark& b, nsecs_t target) {
+    int iterations = 1;
+    nsecs_t elapsed;
+
+    // Grow the run until it is long enough that timer and setup noise
+    // don't matter, then do one at the size that should take 'target'.
+    for (;;) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        b.function(iterations);
+        elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        if (elapsed >= target / 10 || iterations >= (1 << 30) / 10) {
+            break;
+        }
+        iterations *= elapsed < target / 100 ? 10 : 2;
+    }
+    if (elapsed > 0 && elapsed < target) {
+        double scaled = (double) iterations * target / elapsed;
+        iterations = scaled > (1 << 30) ? (1 << 30) : (int) scaled;
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        b.function(iterations);
+        elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+
+    printf("%-28s %12d %12.1f ns  %s\n", b.name, iterations,
+            (double) elapsed / iterations, b.unit);
+    fflush(stdout);
+}
+
+} // namespace android
+
+using namespace android;
+
+int main(int argc, char** argv) {
+    double seconds = 1.0;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:")) != -1) {
+        switch (c) {
+        case 't':
+            seconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t <seconds>] [<name substring>...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%-28s %12s %15s\n", "benchmark", "iterations", "per iteration");
+    for (size_t i = 0; i < sizeof(gBenchmarks) / sizeof(gBenchmarks[0]); i++) {
+        if (matches(gBenchmarks[i].name, argc - optind, argv + optind)) {
+            run(gBenchmarks[i], (nsecs_t) (seconds * 1000000000LL));
+        }
+    }
+    return 0;
+}
@@ -84,4 +84,84 @@ TEST_F(BitSetTest, BitWiseAnd_NonDisjoint) {
     EXPECT_EQ(b2.count(), 3u);
     EXPECT_TRUE(b2.hasBit(3) && b2.hasBit(6) && b2.hasBit(9));
 }
+TEST_F(BitSetTest, BitSet64_HighBits) {
+    BitSet64 b;
+    b.markBit(0);
+    b.markBit(40);
+    b.markBit(63);
+
+    EXPECT_EQ(b.count(), 3u);
+    EXPECT_EQ(b.firstMarkedBit(), 0u);
+    EXPECT_EQ(b.lastMarkedBit(), 63u);
+    EXPECT_EQ(b.getIndexOfBit(40), 1u);
+    EXPECT_EQ(b.getIndexOfBit(63), 2u);
+    EXPECT_EQ(b.firstUnmarkedBit(), 1u);
+
+    EXPECT_EQ(b.clearLastMarkedBit(), 63u);
+    EXPECT_EQ(b.clearFirstMarkedBit(), 0u);
+    EXPECT_EQ(b.clearFirstMarkedBit(), 40u);
+    EXPECT_TRUE(b.isEmpty());
+}
+
+TEST_F(BitSetTest, BitSetN_Iterate) {
+    BitSetN<200> b;
+    const uint32_t bits[] = { 0, 63, 64, 127, 150, 199 };
+    for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); i++) {
+        b.markBit(bits[i]);
+    }
+
+    size_t i = 0;
+    for (uint32_t n = b.firstMarkedBit(); n < 200; n = b.nextMarkedBit(n + 1)) {
+        ASSERT_LT(i, sizeof(bits) / sizeof(bits[0]));
+        EXPECT_EQ(n, bits[i]);
+        EXPECT_EQ(b.getIndexOfBit(n), i);
+        i++;
+    }
+    EXPECT_EQ(i, sizeof(bits) / sizeof(bits[0]));
+    EXPECT_EQ(b.count(), i);
+    EXPECT_EQ(b.lastMarkedBit(), 199u);
+    EXPECT_EQ(b.firstUnmarkedBit(), 1u);
+    EXPECT_EQ(b.nextUnmarkedBit(63), 65u);
+
+    b.clear();
+    EXPECT_TRUE(b.isEmpty());
+    EXPECT_EQ(b.firstMarkedBit(), 200u);
+    EXPECT_EQ(b.lastMarkedBit(), 200u);
+    EXPECT_EQ(b.clearFirstMarkedBit(), 200u);
+}
+
+TEST_F(BitSetTest, BitSetN_Full) {
+    BitSetN<70> b;
+    for (uint32_t n = 0; n < 70; n++) {
+        EXPECT_EQ(b.markFirstUnmarkedBit(), n);
+    }
+    EXPECT_TRUE(b.isFull());
+    EXPECT_EQ(b.firstUnmarkedBit(), 70u);
+    EXPECT_EQ(b.markFirstUnmarkedBit(), 70u);
+    EXPECT_EQ(b.count(), 70u);
+}
+
+TEST_F(BitSetTest, BitSetN_BitWise) {
+    BitSetN<130> a, c;
+    a.markBit(2);
+    a.markBit(100);
+    c.markBit(100);
+    c.markBit(129);
+
+    BitSetN<130> tmp = a & c;
+    EXPECT_EQ(tmp.count(), 1u);
+    EXPECT_TRUE(tmp.hasBit(100));
+    EXPECT_TRUE((c & a) == (a & c));
+
+    tmp = a | c;
+    EXPECT_EQ(tmp.count(), 3u);
+    EXPECT_TRUE(tmp.hasBit(2) && tmp.hasBit(100) && tmp.hasBit(129));
+    EXPECT_TRUE((c | a) == (a | c));
+    EXPECT_TRUE(tmp != a);
+
+    a |= c;
+    EXPECT_TRUE(a == tmp);
+    a &= c;
+    EXPECT_TRUE(a == c);
+}
 } // namespace android
@@ -21,6 +21,7 @@
 
 #include <utils/BlobCache.h>
 #include <utils/Errors.h>
+#include <utils/FileMap.h>
 
 namespace android {
 
@@ -258,6 +259,49 @@ TEST_F(BlobCacheTest, ExceedingTotalLimitHalvesCacheSize) {
     ASSERT_EQ(maxEntries/2 + 1, numCached);
 }
 
+TEST_F(BlobCacheTest, ExceedingTotalLimitEvictsLeastRecentlyUsed) {
+    // Fill up the entire cache with 1 char key/value pairs.
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // Use the oldest entry, so that it is the most recently used one.
+    {
+        uint8_t k = 0;
+        ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    }
+    // Insert one more entry, causing a cache overflow.
+    {
+        uint8_t k = maxEntries;
+        mBC->set(&k, 1, "x", 1);
+    }
+    uint8_t k = 0;
+    ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    k = 1;
+    ASSERT_EQ(size_t(0), mBC->get(&k, 1, NULL, 0));
+    k = maxEntries;
+    ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+}
+
+TEST_F(BlobCacheTest, CountsHitsMissesAndEvictions) {
+    char buf[4] = { 0 };
+    mBC->set("abcd", 4, "efgh", 4);
+    mBC->get("abcd", 4, buf, 4);
+    mBC->get("abcd", 4, buf, 4);
+    mBC->get("ijkl", 4, buf, 4);
+    ASSERT_EQ(size_t(2), mBC->getHitCount());
+    ASSERT_EQ(size_t(1), mBC->getMissCount());
+    ASSERT_EQ(size_t(0), mBC->getEvictionCount());
+
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    ASSERT_LT(size_t(0), mBC->getEvictionCount());
+}
+
 class BlobCacheFlattenTest : public BlobCacheTest {
 protected:
     virtual void SetUp() {
@@ -418,4 +462,36 @@ TEST_F(BlobCacheFlattenTest, UnflattenCatchesBufferTooSmall) {
     ASSERT_EQ(size_t(0), mBC2->get("abcd", 4, buf, 4));
 }
 
+TEST_F(BlobCacheFlattenTest, UnflattenFromMappedFile) {
+    char buf[2] = { 0 };
+    mBC->set("ab", 2, "cd", 2);
+    mBC->set("ef", 2, "gh", 2);
+
+    size_t size = mBC->getFlattenedSize();
+    uint8_t* flat = new uint8_t[size];
+    ASSERT_EQ(OK, mBC->flatten(flat, size));
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(size, fwrite(flat, 1, size, file));
+    fflush(file);
+    delete[] flat;
+
+    FileMap* map = new FileMap();
+    ASSERT_TRUE(map->create(NULL, fileno(file), 0, size, true));
+    fclose(file);
+    ASSERT_EQ(OK, mBC2->unflatten(map));
+    // The cache entries keep the mapping alive.
+    map->release();
+
+    ASSERT_EQ(size_t(2), mBC2->get("ab", 2, buf, 2));
+    ASSERT_EQ(0, memcmp(buf, "cd", 2));
+
+    // Replacing a mapped entry leaves the mapping intact.
+    mBC2->set("ab", 2, "ij", 2);
+    ASSERT_EQ(size_t(2), mBC2->get("ab", 2, buf, 2));
+    ASSERT_EQ(0, memcmp(buf, "ij", 2));
+    ASSERT_EQ(size_t(2), mBC2->get("ef", 2, buf, 2));
+    ASSERT_EQ(0, memcmp(buf, "gh", 2));
+}
+
 } // namespace android
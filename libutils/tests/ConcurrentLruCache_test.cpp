@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <utils/ConcurrentLruCache.h>
+#include <utils/Thread.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+typedef int SimpleKey;
+typedef const char* StringValue;
+typedef ConcurrentLruCache<SimpleKey, StringValue> SimpleCache;
+
+class EntryRemovedCallback : public OnEntryRemoved<SimpleKey, StringValue> {
+public:
+    EntryRemovedCallback() : callbackCount(0), lastKey(-1), lastValue(NULL) { }
+    void operator()(SimpleKey& k, StringValue& v) {
+        callbackCount += 1;
+        lastKey = k;
+        lastValue = v;
+    }
+    ssize_t callbackCount;
+    SimpleKey lastKey;
+    StringValue lastValue;
+};
+
+class StringLengthCost : public EntryCost<SimpleKey, StringValue> {
+public:
+    size_t operator()(const SimpleKey&, const StringValue& v) {
+        return strlen(v);
+    }
+};
+
+class ConcurrentLruCacheTest : public testing::Test {
+};
+
+TEST_F(ConcurrentLruCacheTest, Simple) {
+    SimpleCache cache(100);
+
+    EXPECT_TRUE(cache.put(1, "one"));
+    EXPECT_TRUE(cache.put(2, "two"));
+    EXPECT_FALSE(cache.put(2, "deux"));
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_STREQ("two", cache.get(2));
+    EXPECT_EQ(NULL, cache.get(3));
+    EXPECT_EQ(2u, cache.size());
+    EXPECT_EQ(2u, cache.getCost());
+
+    EXPECT_TRUE(cache.remove(1));
+    EXPECT_FALSE(cache.remove(1));
+    EXPECT_EQ(NULL, cache.get(1));
+    EXPECT_EQ(1u, cache.size());
+}
+
+TEST_F(ConcurrentLruCacheTest, EvictsLeastRecentlyUsed) {
+    SimpleCache cache(2, 1);
+    EntryRemovedCallback callback;
+    cache.setOnEntryRemovedListener(&callback);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    EXPECT_STREQ("one", cache.get(1));
+    cache.put(3, "three");
+    EXPECT_EQ(1, callback.callbackCount);
+    EXPECT_EQ(2, callback.lastKey);
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_EQ(NULL, cache.get(2));
+    EXPECT_STREQ("three", cache.get(3));
+}
+
+TEST_F(ConcurrentLruCacheTest, Cost) {
+    SimpleCache cache(10, 1);
+    StringLengthCost cost;
+    cache.setEntryCost(&cost);
+
+    EXPECT_FALSE(cache.put(0, "eleven long"));
+    EXPECT_TRUE(cache.put(1, "one"));
+    EXPECT_TRUE(cache.put(2, "two"));
+    EXPECT_TRUE(cache.put(3, "three"));
+    EXPECT_EQ(NULL, cache.get(1));
+    EXPECT_EQ(8u, cache.getCost());
+
+    cache.clear();
+    EXPECT_EQ(0u, cache.size());
+    EXPECT_EQ(0u, cache.getCost());
+}
+
+class CacheThread : public Thread {
+public:
+    CacheThread(SimpleCache* cache, int base) : Thread(false), mCache(cache), mBase(base),
+            mMismatches(0) { }
+
+    int mismatches() const { return mMismatches; }
+
+private:
+    virtual bool threadLoop() {
+        static const char* const kValues[] = { "a", "b", "c", "d" };
+        for (int i = 0; i < 10000; i++) {
+            int key = mBase + i % 256;
+            const char* value = kValues[key % 4];
+            const char* cached = mCache->get(key);
+            if (cached == NULL) {
+                mCache->put(key, value);
+            } else if (cached != value) {
+                mMismatches++;
+            }
+        }
+        return false;
+    }
+
+    SimpleCache* mCache;
+    int mBase;
+    int mMismatches;
+};
+
+TEST_F(ConcurrentLruCacheTest, MultipleThreads) {
+    SimpleCache cache(512);
+    sp<CacheThread> threads[4];
+    for (int i = 0; i < 4; i++) {
+        threads[i] = new CacheThread(&cache, i * 128);
+        threads[i]->run("CacheThread");
+    }
+    for (int i = 0; i < 4; i++) {
+        threads[i]->join();
+        EXPECT_EQ(0, threads[i]->mismatches());
+    }
+    EXPECT_GE(512u, cache.size());
+    EXPECT_EQ(cache.size(), cache.getCost());
+}
+
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "HashMap_test"
+
+#include <utils/HashMap.h>
+#include <utils/KeyedVector.h>
+#include <cutils/log.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+namespace android {
+
+struct ComplexKey {
+    int k;
+
+    explicit ComplexKey(int k) : k(k) {
+        instanceCount += 1;
+    }
+
+    ComplexKey(const ComplexKey& other) : k(other.k) {
+        instanceCount += 1;
+    }
+
+    ~ComplexKey() {
+        instanceCount -= 1;
+    }
+
+    bool operator ==(const ComplexKey& other) const {
+        return k == other.k;
+    }
+
+    static ssize_t instanceCount;
+};
+
+ssize_t ComplexKey::instanceCount = 0;
+
+template<> inline hash_t hash_type(const ComplexKey& value) {
+    // a poor hash, so that there are long runs
+    return hash_type(value.k / 8);
+}
+
+struct ComplexValue {
+    int v;
+
+    explicit ComplexValue(int v) : v(v) {
+        instanceCount += 1;
+    }
+
+    ComplexValue(const ComplexValue& other) : v(other.v) {
+        instanceCount += 1;
+    }
+
+    ~ComplexValue() {
+        instanceCount -= 1;
+    }
+
+    static ssize_t instanceCount;
+};
+
+ssize_t ComplexValue::instanceCount = 0;
+
+typedef HashMap<int, int> SimpleHashMap;
+typedef HashMap<ComplexKey, ComplexValue> ComplexHashMap;
+
+class HashMapTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        ComplexKey::instanceCount = 0;
+        ComplexValue::instanceCount = 0;
+    }
+
+    virtual void TearDown() {
+        ASSERT_NO_FATAL_FAILURE(assertInstanceCount(0, 0));
+    }
+
+    void assertInstanceCount(ssize_t keys, ssize_t values) {
+        if (keys != ComplexKey::instanceCount || values != ComplexValue::instanceCount) {
+            FAIL() << "Expected " << keys << " keys and " << values << " values "
+                    "but there were actually " << ComplexKey::instanceCount << " keys and "
+                    << ComplexValue::instanceCount << " values";
+        }
+    }
+};
+
+TEST_F(HashMapTest, DefaultConstructor_IsEmpty) {
+    SimpleHashMap m;
+
+    EXPECT_EQ(0U, m.size());
+    EXPECT_TRUE(m.isEmpty());
+    EXPECT_EQ(-1, m.indexOfKey(0));
+    EXPECT_EQ(-1, m.next(-1));
+    EXPECT_EQ(NAME_NOT_FOUND, m.removeItem(0));
+}
+
+TEST_F(HashMapTest, Add_WhenKeyIsNew_AddsIt) {
+    SimpleHashMap m;
+
+    ssize_t index = m.add(1, 10);
+
+    ASSERT_GE(index, 0);
+    EXPECT_EQ(1U, m.size());
+    EXPECT_EQ(1, m.keyAt(index));
+    EXPECT_EQ(10, m.valueAt(index));
+    EXPECT_EQ(index, m.indexOfKey(1));
+    EXPECT_EQ(10, m.valueFor(1));
+    EXPECT_EQ(NULL, m.find(2));
+}
+
+TEST_F(HashMapTest, Add_WhenKeyIsPresent_ReplacesValue) {
+    SimpleHashMap m;
+
+    m.add(1, 10);
+    m.add(1, 11);
+
+    EXPECT_EQ(1U, m.size());
+    ASSERT_TRUE(m.find(1) != NULL);
+    EXPECT_EQ(11, *m.find(1));
+}
+
+TEST_F(HashMapTest, EditValueFor_ChangesValue) {
+    SimpleHashMap m;
+
+    m.add(1, 10);
+    m.editValueFor(1) = 12;
+
+    EXPECT_EQ(12, m.valueFor(1));
+}
+
+TEST_F(HashMapTest, Next_VisitsEachEntryOnce) {
+    SimpleHashMap m;
+    for (int i = 0; i < 100; i++) {
+        m.add(i, i * 2);
+    }
+
+    int seen[100] = { 0 };
+    size_t count = 0;
+    for (ssize_t index = m.next(-1); index >= 0; index = m.next(index)) {
+        int key = m.keyAt(index);
+        ASSERT_GE(key, 0);
+        ASSERT_LT(key, 100);
+        EXPECT_EQ(key * 2, m.valueAt(index));
+        seen[key] += 1;
+        count += 1;
+    }
+
+    EXPECT_EQ(100U, count);
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(1, seen[i]) << "key " << i;
+    }
+}
+
+TEST_F(HashMapTest, SetCapacity_AvoidsRehashing) {
+    SimpleHashMap m;
+
+    m.setCapacity(1000);
+    size_t capacity = m.capacity();
+    for (int i = 0; i < 1000; i++) {
+        m.add(i, i);
+    }
+
+    EXPECT_EQ(capacity, m.capacity());
+    EXPECT_EQ(1000U, m.size());
+}
+
+TEST_F(HashMapTest, Complex_AddRemoveAndClear_KeepsInstanceCounts) {
+    {
+        ComplexHashMap m;
+        for (int i = 0; i < 200; i++) {
+            m.add(ComplexKey(i), ComplexValue(i));
+        }
+        ASSERT_NO_FATAL_FAILURE(assertInstanceCount(200, 200));
+
+        for (int i = 0; i < 200; i += 2) {
+            EXPECT_EQ(OK, m.removeItem(ComplexKey(i)));
+        }
+        ASSERT_NO_FATAL_FAILURE(assertInstanceCount(100, 100));
+        EXPECT_EQ(100U, m.size());
+
+        for (int i = 0; i < 200; i++) {
+            const ComplexValue* value = m.find(ComplexKey(i));
+            if (i % 2) {
+                ASSERT_TRUE(value != NULL) << "key " << i;
+                EXPECT_EQ(i, value->v);
+            } else {
+                EXPECT_TRUE(value == NULL) << "key " << i;
+            }
+        }
+
+        ComplexHashMap copy(m);
+        ASSERT_NO_FATAL_FAILURE(assertInstanceCount(200, 200));
+        m.clear();
+        ASSERT_NO_FATAL_FAILURE(assertInstanceCount(100, 100));
+        EXPECT_EQ(0U, m.size());
+        EXPECT_EQ(100U, copy.size());
+        EXPECT_EQ(OK, copy.removeItem(ComplexKey(1)));
+        EXPECT_EQ(NAME_NOT_FOUND, copy.removeItem(ComplexKey(1)));
+    }
+}
+
+TEST_F(HashMapTest, RandomOperations_MatchKeyedVector) {
+    SimpleHashMap m;
+    KeyedVector<int, int> reference;
+
+    srand(1);
+    for (int i = 0; i < 20000; i++) {
+        int key = rand() % 2000;
+        if (rand() % 3) {
+            m.add(key, i);
+            reference.replaceValueFor(key, i);
+        } else {
+            status_t removed = m.removeItem(key);
+            ssize_t expected = reference.removeItem(key);
+            ASSERT_EQ(expected >= 0, removed == OK) << "iteration " << i;
+        }
+    }
+
+    ASSERT_EQ(reference.size(), m.size());
+    for (size_t i = 0; i < reference.size(); i++) {
+        const int* value = m.find(reference.keyAt(i));
+        ASSERT_TRUE(value != NULL) << "key " << reference.keyAt(i);
+        EXPECT_EQ(reference.valueAt(i), *value);
+    }
+    for (int key = 0; key < 2000; key++) {
+        EXPECT_EQ(reference.indexOfKey(key) >= 0, m.indexOfKey(key) >= 0) << "key " << key;
+    }
+}
+
+} // namespace android
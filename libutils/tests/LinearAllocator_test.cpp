@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LinearAllocator_test"
+
+#include <utils/LinearAllocator.h>
+#include <cutils/log.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace android {
+
+static int gDestroyed;
+
+struct Tracked {
+    Tracked() : value(42) {}
+    ~Tracked() { gDestroyed++; }
+    int value;
+};
+
+class LinearAllocatorTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        gDestroyed = 0;
+    }
+};
+
+TEST_F(LinearAllocatorTest, Rewind_ReusesTheMemoryAllocatedAfterTheMark) {
+    LinearAllocator la;
+    memset(la.alloc(100), 1, 100);
+    size_t used = la.usedSize();
+
+    LinearAllocator::Mark mark = la.mark();
+    void* first = la.alloc(64);
+    for (int i = 0; i < 1000; i++) {
+        memset(la.alloc(64), 2, 64);
+    }
+    la.rewind(mark);
+
+    EXPECT_EQ(used, la.usedSize());
+    EXPECT_EQ(first, la.alloc(64))
+            << "the allocation after the mark should get the same memory again";
+}
+
+TEST_F(LinearAllocatorTest, Alloc_WhenLarge_GetsADedicatedPageFreedOnRewind) {
+    LinearAllocator la;
+    LinearAllocator::Mark mark = la.mark();
+
+    void* large = la.alloc(64 * 1024);
+    memset(large, 3, 64 * 1024);
+    EXPECT_GE(la.usedSize(), size_t(64 * 1024));
+
+    la.rewind(mark);
+    EXPECT_EQ(0U, la.usedSize());
+}
+
+TEST_F(LinearAllocatorTest, Create_RunsDestructorsWhenRewoundPastThem) {
+    LinearAllocator la;
+    Tracked* kept = la.create<Tracked>();
+    EXPECT_EQ(42, kept->value);
+
+    {
+        LinearAllocator::AutoRewind _r(la);
+        la.create<Tracked>();
+        la.create<Tracked>();
+    }
+    EXPECT_EQ(2, gDestroyed)
+            << "only the objects created in the scope should be destroyed";
+
+    la.reset();
+    EXPECT_EQ(3, gDestroyed);
+    EXPECT_EQ(0U, la.usedSize());
+}
+
+TEST_F(LinearAllocatorTest, Alloc_AlignsForPointersAndDoubles) {
+    LinearAllocator la;
+    size_t align = sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double);
+
+    for (size_t size = 1; size < 64; size++) {
+        uintptr_t p = reinterpret_cast<uintptr_t>(la.alloc(size));
+        EXPECT_EQ(0U, p % align) << "allocation of " << size << " bytes";
+    }
+}
+
+static void* threadAllocator(void*) {
+    return &LinearAllocator::forThread();
+}
+
+TEST_F(LinearAllocatorTest, ForThread_ReturnsOneAllocatorPerThread) {
+    LinearAllocator* mine = &LinearAllocator::forThread();
+    EXPECT_EQ(mine, &LinearAllocator::forThread());
+
+    pthread_t thread;
+    void* theirs;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, threadAllocator, NULL));
+    ASSERT_EQ(0, pthread_join(thread, &theirs));
+    EXPECT_NE(static_cast<void*>(mine), theirs);
+}
+
+} // namespace android
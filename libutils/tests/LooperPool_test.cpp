@@ -0,0 +1,320 @@
+//
+// Copyright 2013 The Android Open Source Project
+//
+
+#include <utils/LooperPool.h>
+#include <utils/SortedVector.h>
+#include <utils/Timers.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "TestHelpers.h"
+
+// how long to wait for something that should happen
+#define WAIT_TIMEOUT_MS 2000
+
+namespace android {
+
+// Counts the messages it handles and records the threads they ran on.
+class CountingMessageHandler : public MessageHandler {
+public:
+    CountingMessageHandler() : mCount(0), mBlockedCount(0), mReleased(false) { }
+
+    virtual void handleMessage(const Message& message) {
+        Mutex::Autolock _l(mLock);
+        mCount += 1;
+        mWhats.push(message.what);
+        mThreads.add(pthread_self());
+        mWhen.push(systemTime(SYSTEM_TIME_MONOTONIC));
+        mCondition.broadcast();
+
+        if (message.what < 0) {
+            // blocks until release(), so another thread has to take over
+            mBlockedCount += 1;
+            mCondition.broadcast();
+            while (!mReleased) {
+                mCondition.wait(mLock);
+            }
+        }
+    }
+
+    bool waitForCount(size_t count) {
+        Mutex::Autolock _l(mLock);
+        while (mCount < count) {
+            if (mCondition.waitRelative(mLock, milliseconds_to_nanoseconds(WAIT_TIMEOUT_MS))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool waitForBlocked(size_t count) {
+        Mutex::Autolock _l(mLock);
+        while (mBlockedCount < count) {
+            if (mCondition.waitRelative(mLock, milliseconds_to_nanoseconds(WAIT_TIMEOUT_MS))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void release() {
+        Mutex::Autolock _l(mLock);
+        mReleased = true;
+        mCondition.broadcast();
+    }
+
+    Mutex mLock;
+    Condition mCondition;
+    size_t mCount;
+    size_t mBlockedCount;
+    bool mReleased;
+    Vector<int> mWhats;
+    SortedVector<pthread_t> mThreads;
+    Vector<nsecs_t> mWhen;
+};
+
+// Posts a batch of messages from a pool thread, to its own queue, then waits
+// for the others to run them.
+class PostingMessageHandler : public MessageHandler {
+public:
+    PostingMessageHandler(LooperPool* pool, const sp<CountingMessageHandler>& target,
+            int count) : mPool(pool), mTarget(target), mPostCount(count), mDone(false) { }
+
+    virtual void handleMessage(const Message&) {
+        for (int i = 0; i < mPostCount; i++) {
+            mPool->sendMessage(mTarget, Message(i));
+        }
+        bool done = mTarget->waitForCount(mPostCount);
+
+        Mutex::Autolock _l(mLock);
+        mDone = done;
+        mThread = pthread_self();
+        mCondition.broadcast();
+    }
+
+    LooperPool* mPool;
+    sp<CountingMessageHandler> mTarget;
+    int mPostCount;
+
+    Mutex mLock;
+    Condition mCondition;
+    bool mDone;
+    pthread_t mThread;
+};
+
+class CountingCallback : public LooperCallback {
+public:
+    CountingCallback(int result) : mResult(result), mCount(0) { }
+
+    virtual int handleEvent(int fd, int events, void*) {
+        char buf[1];
+        ::read(fd, buf, 1);
+
+        Mutex::Autolock _l(mLock);
+        mCount += 1;
+        mEvents = events;
+        mCondition.broadcast();
+        return mResult;
+    }
+
+    bool waitForCount(int count) {
+        Mutex::Autolock _l(mLock);
+        while (mCount < count) {
+            if (mCondition.waitRelative(mLock, milliseconds_to_nanoseconds(WAIT_TIMEOUT_MS))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int getCount() {
+        Mutex::Autolock _l(mLock);
+        return mCount;
+    }
+
+    int mResult;
+    Mutex mLock;
+    Condition mCondition;
+    int mCount;
+    int mEvents;
+};
+
+class LooperPoolTest : public testing::Test {
+protected:
+    sp<LooperPool> mPool;
+
+    virtual void SetUp() {
+        mPool = new LooperPool(4);
+        ASSERT_EQ(OK, mPool->start());
+    }
+
+    virtual void TearDown() {
+        mPool->stop();
+        mPool.clear();
+    }
+};
+
+
+TEST_F(LooperPoolTest, SendMessage_DeliversAllMessages) {
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+
+    for (int i = 0; i < 100; i++) {
+        mPool->sendMessage(handler, Message(i));
+    }
+
+    EXPECT_TRUE(handler->waitForCount(100))
+            << "all the messages should be handled";
+
+    Mutex::Autolock _l(handler->mLock);
+    SortedVector<int> whats;
+    for (size_t i = 0; i < handler->mWhats.size(); i++) {
+        whats.add(handler->mWhats[i]);
+    }
+    EXPECT_EQ(100U, whats.size())
+            << "each message should be handled exactly once";
+}
+
+TEST_F(LooperPoolTest, SendMessage_WhenHandlersBlock_RunsThemConcurrently) {
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+
+    mPool->sendMessage(handler, Message(-1));
+    mPool->sendMessage(handler, Message(-2));
+
+    EXPECT_TRUE(handler->waitForBlocked(2))
+            << "two threads should be running handlers at the same time";
+    handler->release();
+    EXPECT_TRUE(handler->waitForCount(2));
+
+    Mutex::Autolock _l(handler->mLock);
+    EXPECT_EQ(2U, handler->mThreads.size());
+}
+
+TEST_F(LooperPoolTest, SendMessage_FromBusyPoolThread_IsTakenByAnotherThread) {
+    sp<CountingMessageHandler> target = new CountingMessageHandler();
+    sp<PostingMessageHandler> poster = new PostingMessageHandler(mPool.get(), target, 10);
+
+    mPool->sendMessage(poster, Message(0));
+
+    {
+        Mutex::Autolock _l(poster->mLock);
+        while (!poster->mDone) {
+            if (poster->mCondition.waitRelative(poster->mLock,
+                    milliseconds_to_nanoseconds(WAIT_TIMEOUT_MS))) {
+                break;
+            }
+        }
+        ASSERT_TRUE(poster->mDone)
+                << "messages queued by a busy thread should be taken by the others";
+    }
+
+    Mutex::Autolock _l(target->mLock);
+    EXPECT_EQ(10U, target->mCount);
+    EXPECT_LT(target->mThreads.indexOf(poster->mThread), 0)
+            << "none of the messages should have run on the thread that is busy";
+}
+
+TEST_F(LooperPoolTest, SendMessageDelayed_DeliversNoEarlierThanTheDelay) {
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    mPool->sendMessageDelayed(ms2ns(100), handler, Message(1));
+    mPool->sendMessage(handler, Message(0));
+
+    EXPECT_TRUE(handler->waitForCount(2));
+
+    Mutex::Autolock _l(handler->mLock);
+    for (size_t i = 0; i < handler->mWhats.size(); i++) {
+        if (handler->mWhats[i] == 1) {
+            EXPECT_GE(handler->mWhen[i] - start, ms2ns(100))
+                    << "the delayed message should not be handled early";
+        }
+    }
+}
+
+TEST_F(LooperPoolTest, RemoveMessages_WhenRemovingAllForHandler_RemovesThem) {
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+    sp<CountingMessageHandler> other = new CountingMessageHandler();
+
+    mPool->sendMessageDelayed(ms2ns(100), handler, Message(0));
+    mPool->sendMessageDelayed(ms2ns(100), handler, Message(1));
+    mPool->sendMessageDelayed(ms2ns(100), other, Message(2));
+    mPool->removeMessages(handler);
+
+    EXPECT_TRUE(other->waitForCount(1));
+    usleep(50 * 1000);
+
+    Mutex::Autolock _l(handler->mLock);
+    EXPECT_EQ(0U, handler->mCount)
+            << "the removed messages should not be handled";
+}
+
+TEST_F(LooperPoolTest, RemoveMessages_WhenRemovingSomeForHandler_RemovesThoseOnly) {
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+
+    mPool->sendMessageDelayed(ms2ns(100), handler, Message(0));
+    mPool->sendMessageDelayed(ms2ns(100), handler, Message(1));
+    mPool->sendMessageDelayed(ms2ns(100), handler, Message(1));
+    mPool->removeMessages(handler, 1);
+
+    EXPECT_TRUE(handler->waitForCount(1));
+    usleep(50 * 1000);
+
+    Mutex::Autolock _l(handler->mLock);
+    ASSERT_EQ(1U, handler->mCount);
+    EXPECT_EQ(0, handler->mWhats[0]);
+}
+
+TEST_F(LooperPoolTest, AddFd_WhenSignalled_InvokesCallbackEachTime) {
+    Pipe pipe;
+    sp<CountingCallback> callback = new CountingCallback(1);
+
+    EXPECT_EQ(1, mPool->addFd(pipe.receiveFd, ALOOPER_EVENT_INPUT, callback, NULL));
+
+    pipe.writeSignal();
+    EXPECT_TRUE(callback->waitForCount(1));
+    pipe.writeSignal();
+    EXPECT_TRUE(callback->waitForCount(2))
+            << "the fd should be re-armed after the callback returns";
+    EXPECT_EQ(ALOOPER_EVENT_INPUT, callback->mEvents);
+}
+
+TEST_F(LooperPoolTest, AddFd_WhenCallbackReturnsZero_UnregistersIt) {
+    Pipe pipe;
+    sp<CountingCallback> callback = new CountingCallback(0);
+
+    mPool->addFd(pipe.receiveFd, ALOOPER_EVENT_INPUT, callback, NULL);
+
+    pipe.writeSignal();
+    EXPECT_TRUE(callback->waitForCount(1));
+    pipe.writeSignal();
+    usleep(50 * 1000);
+
+    EXPECT_EQ(1, callback->getCount());
+    EXPECT_EQ(0, mPool->removeFd(pipe.receiveFd))
+            << "the fd should no longer be registered";
+}
+
+TEST_F(LooperPoolTest, RemoveFd_WhenRegistered_StopsCallbacks) {
+    Pipe pipe;
+    sp<CountingCallback> callback = new CountingCallback(1);
+
+    mPool->addFd(pipe.receiveFd, ALOOPER_EVENT_INPUT, callback, NULL);
+    EXPECT_EQ(1, mPool->removeFd(pipe.receiveFd));
+
+    pipe.writeSignal();
+    usleep(50 * 1000);
+
+    EXPECT_EQ(0, callback->getCount());
+}
+
+TEST_F(LooperPoolTest, Stop_WhenIdle_ReturnsPromptly) {
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    mPool->stop();
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    EXPECT_LT(elapsed, ms2ns(WAIT_TIMEOUT_MS))
+            << "all the threads should be woken to exit";
+}
+
+} // namespace android
@@ -437,6 +437,41 @@ TEST_F(LooperTest, PollOnce_WhenCallbackAddedTwice_OnlySecondCallbackShouldBeInv
             << "replacement handler callback should be invoked";
 }
 
+TEST_F(LooperTest, PollOnce_WhenManyFdsAreRegistered_OnlySignalledCallbacksShouldBeInvoked) {
+    const int count = 64;
+    Pipe pipes[count];
+    StubCallbackHandler* handlers[count];
+    for (int i = 0; i < count; i++) {
+        handlers[i] = new StubCallbackHandler(true);
+        handlers[i]->setCallback(mLooper, pipes[i].receiveFd, ALOOPER_EVENT_INPUT);
+    }
+    for (int i = 0; i < count; i += 2) {
+        mLooper->removeFd(pipes[i].receiveFd);
+    }
+    pipes[count - 1].writeSignal();
+    pipes[count - 2].writeSignal(); // was removed
+    pipes[1].writeSignal();
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(ALOOPER_POLL_CALLBACK, result)
+            << "pollOnce result should be ALOOPER_POLL_CALLBACK because FDs were signalled";
+    for (int i = 0; i < count; i++) {
+        int expected = (i == 1 || i == count - 1) ? 1 : 0;
+        EXPECT_EQ(expected, handlers[i]->callbackCount)
+                << "only the callbacks of signalled FDs that are registered should be invoked";
+        if (expected) {
+            EXPECT_EQ(pipes[i].receiveFd, handlers[i]->fd)
+                    << "callback should have received the FD";
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        mLooper->removeFd(pipes[i].receiveFd);
+        delete handlers[i];
+    }
+}
+
 TEST_F(LooperTest, SendMessage_WhenOneMessageIsEnqueue_ShouldInvokeHandlerDuringNextPoll) {
     sp<StubMessageHandler> handler = new StubMessageHandler();
     mLooper->sendMessage(handler, Message(MSG_TEST1));
@@ -690,4 +725,60 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeMessagesForHandler_ShouldRemove
             << "no more messages to handle";
 }
 
+
+TEST_F(LooperTest, SendMessageAtTime_WhenManyMessagesAreEnqueued_ShouldInvokeHandlerInUptimeOrder) {
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // Scrambled uptimes in the past, two messages for each.
+    const int count = 1000;
+    for (int i = 0; i < count; i++) {
+        mLooper->sendMessageAtTime(now - ms2ns(1000) + (i * 7919) % (count / 2), handler,
+                Message(i));
+    }
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(ALOOPER_POLL_CALLBACK, result)
+            << "pollOnce result should be ALOOPER_POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(count), handler->messages.size())
+            << "handled messages";
+    for (int i = 1; i < count; i++) {
+        int prev = handler->messages[i - 1].what;
+        int what = handler->messages[i].what;
+        int prevOffset = (prev * 7919) % (count / 2);
+        int offset = (what * 7919) % (count / 2);
+        ASSERT_TRUE(prevOffset < offset || (prevOffset == offset && prev < what))
+                << "messages should be handled by uptime, then in the order they were sent";
+    }
+}
+
+TEST_F(LooperTest, RemoveMessage_WhenManyHandlersHaveMessages_ShouldRemoveOnlyThose) {
+    sp<StubMessageHandler> handler1 = new StubMessageHandler();
+    sp<StubMessageHandler> handler2 = new StubMessageHandler();
+    sp<StubMessageHandler> handler3 = new StubMessageHandler();
+    for (int i = 0; i < 100; i++) {
+        mLooper->sendMessage(handler1, Message(i % 4));
+        mLooper->sendMessage(handler2, Message(i % 4));
+        mLooper->sendMessage(handler3, Message(i % 4));
+    }
+    mLooper->removeMessages(handler2);
+    mLooper->removeMessages(handler3, MSG_TEST1);
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(ALOOPER_POLL_CALLBACK, result)
+            << "pollOnce result should be ALOOPER_POLL_CALLBACK because messages were sent";
+    EXPECT_EQ(size_t(100), handler1->messages.size())
+            << "messages of other handlers should not be removed";
+    EXPECT_EQ(size_t(0), handler2->messages.size())
+            << "all the messages of the handler should be removed";
+    ASSERT_EQ(size_t(75), handler3->messages.size())
+            << "only the messages with that what should be removed";
+    for (size_t i = 0; i < handler3->messages.size(); i++) {
+        EXPECT_NE(MSG_TEST1, handler3->messages[i].what)
+                << "only the messages with that what should be removed";
+    }
+}
+
 } // namespace android
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RWLock_test"
+
+#include <utils/RWLock.h>
+#include <cutils/log.h>
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <pthread.h>
+
+namespace android {
+
+struct TryArgs {
+    BigReaderLock* lock;
+    bool write;
+    status_t result;
+};
+
+static void* tryLockOnOtherThread(void* data) {
+    TryArgs* args = static_cast<TryArgs*>(data);
+    args->result = args->write ? args->lock->tryWriteLock() : args->lock->tryReadLock();
+    if (args->result == NO_ERROR) {
+        args->lock->unlock();
+    }
+    return NULL;
+}
+
+static status_t tryLockElsewhere(BigReaderLock& lock, bool write) {
+    TryArgs args = { &lock, write, NO_ERROR };
+    pthread_t thread;
+    pthread_create(&thread, NULL, tryLockOnOtherThread, &args);
+    pthread_join(thread, NULL);
+    return args.result;
+}
+
+TEST(BigReaderLockTest, ReadLock_AllowsOtherReadersOnly) {
+    BigReaderLock lock;
+    ASSERT_EQ(NO_ERROR, lock.readLock());
+
+    EXPECT_EQ(NO_ERROR, tryLockElsewhere(lock, false));
+    EXPECT_EQ(-EBUSY, tryLockElsewhere(lock, true));
+
+    lock.unlock();
+    EXPECT_EQ(NO_ERROR, tryLockElsewhere(lock, true));
+}
+
+TEST(BigReaderLockTest, WriteLock_ExcludesEveryoneElse) {
+    BigReaderLock lock;
+    ASSERT_EQ(NO_ERROR, lock.writeLock());
+
+    EXPECT_EQ(-EBUSY, tryLockElsewhere(lock, false));
+    EXPECT_EQ(-EBUSY, tryLockElsewhere(lock, true));
+
+    lock.unlock();
+    EXPECT_EQ(NO_ERROR, tryLockElsewhere(lock, false));
+    EXPECT_EQ(NO_ERROR, tryLockElsewhere(lock, true));
+}
+
+struct Shared {
+    BigReaderLock lock;
+    volatile int a;
+    volatile int b;
+    volatile bool torn;
+};
+
+static void* readAndWrite(void* data) {
+    Shared* shared = static_cast<Shared*>(data);
+    for (int i = 0; i < 20000; i++) {
+        if (i % 100 == 0) {
+            BigReaderLock::AutoWLock _l(shared->lock);
+            shared->a++;
+            shared->b++;
+        } else {
+            BigReaderLock::AutoRLock _l(shared->lock);
+            if (shared->a != shared->b) {
+                shared->torn = true;
+            }
+        }
+    }
+    return NULL;
+}
+
+TEST(BigReaderLockTest, ReadersAndWriters_FromManyThreads_NeverSeeAWriteInProgress) {
+    Shared shared;
+    shared.a = 0;
+    shared.b = 0;
+    shared.torn = false;
+
+    pthread_t threads[4];
+    for (size_t i = 0; i < 4; i++) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, readAndWrite, &shared));
+    }
+    for (size_t i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    EXPECT_FALSE(shared.torn);
+    EXPECT_EQ(4 * 200, shared.a);
+    EXPECT_EQ(4 * 200, shared.b);
+}
+
+} // namespace android
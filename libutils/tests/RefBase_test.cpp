@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RefBase_test"
+
+#include <utils/RefBase.h>
+#include <cutils/log.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+
+namespace android {
+
+class Foo : public RefBase {
+public:
+    Foo(bool* deleted) : mDeleted(deleted), mFirstRefCount(0) {
+        *mDeleted = false;
+    }
+
+    virtual ~Foo() {
+        *mDeleted = true;
+    }
+
+    virtual void onFirstRef() {
+        mFirstRefCount++;
+    }
+
+    bool* mDeleted;
+    int mFirstRefCount;
+};
+
+TEST(RefBaseTest, StrongReferences_ShareOneWeakReference) {
+    bool deleted;
+    sp<Foo> foo = new Foo(&deleted);
+    EXPECT_EQ(1, foo->getStrongCount());
+    EXPECT_EQ(1, foo->getWeakRefs()->getWeakCount());
+
+    {
+        sp<Foo> copy1 = foo;
+        sp<Foo> copy2 = foo;
+        EXPECT_EQ(3, foo->getStrongCount());
+        EXPECT_EQ(1, foo->getWeakRefs()->getWeakCount())
+                << "copying an sp<> should not touch the weak count";
+    }
+
+    wp<Foo> weak = foo;
+    EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    EXPECT_EQ(1, foo->mFirstRefCount);
+
+    foo.clear();
+    EXPECT_TRUE(deleted);
+    EXPECT_TRUE(weak.promote() == NULL)
+            << "the object should not be revived once destroyed";
+}
+
+TEST(RefBaseTest, Promote_WhenThereNeverWasAStrongReference_TakesTheFirstOne) {
+    bool deleted;
+    Foo* raw = new Foo(&deleted);
+    wp<Foo> weak = raw;
+
+    sp<Foo> foo = weak.promote();
+    ASSERT_TRUE(foo != NULL);
+    EXPECT_EQ(1, foo->getStrongCount());
+    EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+
+    sp<Foo> again = weak.promote();
+    EXPECT_EQ(2, foo->getStrongCount());
+    EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+
+    again.clear();
+    foo.clear();
+    EXPECT_TRUE(deleted);
+}
+
+TEST(RefBaseTest, WeakReference_WhenNeverPromoted_DeletesTheObject) {
+    bool deleted;
+    {
+        wp<Foo> weak = new Foo(&deleted);
+        EXPECT_FALSE(deleted);
+    }
+    EXPECT_TRUE(deleted);
+}
+
+struct CopyArgs {
+    sp<Foo>* foo;
+    wp<Foo>* weak;
+};
+
+static void* copyAndPromote(void* data) {
+    CopyArgs* args = static_cast<CopyArgs*>(data);
+    for (int i = 0; i < 10000; i++) {
+        sp<Foo> copy = *args->foo;
+        sp<Foo> promoted = args->weak->promote();
+        if (promoted == NULL) {
+            return data;
+        }
+    }
+    return NULL;
+}
+
+TEST(RefBaseTest, CopiesAndPromotions_FromManyThreads_KeepTheCountsRight) {
+    bool deleted;
+    sp<Foo> foo = new Foo(&deleted);
+    wp<Foo> weak = foo;
+    CopyArgs args = { &foo, &weak };
+
+    pthread_t threads[4];
+    for (size_t i = 0; i < 4; i++) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, copyAndPromote, &args));
+    }
+    for (size_t i = 0; i < 4; i++) {
+        void* result;
+        pthread_join(threads[i], &result);
+        EXPECT_TRUE(result == NULL) << "promoting should not fail while foo is held";
+    }
+
+    EXPECT_EQ(1, foo->getStrongCount());
+    EXPECT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    foo.clear();
+    EXPECT_TRUE(deleted);
+}
+
+} // namespace android
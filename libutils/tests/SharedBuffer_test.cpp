@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SharedBuffer_test"
+
+#include <utils/SharedBuffer.h>
+#include <cutils/log.h>
+#include <gtest/gtest.h>
+#include <string.h>
+
+namespace android {
+
+static void fill(SharedBuffer* sb) {
+    uint8_t* data = static_cast<uint8_t*>(sb->data());
+    for (size_t i = 0; i < sb->size(); i++) {
+        data[i] = uint8_t(i * 7);
+    }
+}
+
+static bool check(const SharedBuffer* sb, size_t size) {
+    const uint8_t* data = static_cast<const uint8_t*>(sb->data());
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != uint8_t(i * 7)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST(SharedBufferTest, Alloc_AfterRelease_ReusesBufferOfTheSameClass) {
+    SharedBuffer* sb = SharedBuffer::alloc(20);
+    ASSERT_TRUE(sb != NULL);
+    EXPECT_EQ(20U, sb->size());
+    EXPECT_TRUE(sb->onlyOwner());
+    sb->release();
+
+    SharedBuffer* again = SharedBuffer::alloc(24);
+    EXPECT_EQ(sb, again)
+            << "a buffer of the same size class should come from the thread's cache";
+    EXPECT_EQ(24U, again->size());
+    again->release();
+}
+
+TEST(SharedBufferTest, EditResize_KeepsContentsAcrossSizeClasses) {
+    SharedBuffer* sb = SharedBuffer::alloc(10);
+    fill(sb);
+
+    size_t sizes[] = { 12, 40, 100, 300, 5000, 200, 30, 8 };
+    size_t kept = sb->size();
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        sb = sb->editResize(sizes[i]);
+        ASSERT_TRUE(sb != NULL);
+        EXPECT_EQ(sizes[i], sb->size());
+        if (sizes[i] < kept) {
+            kept = sizes[i];
+        }
+        EXPECT_TRUE(check(sb, kept)) << "resizing to " << sizes[i];
+        fill(sb);
+        kept = sb->size();
+    }
+    sb->release();
+}
+
+TEST(SharedBufferTest, EditResize_WhenShared_LeavesOriginalAlone) {
+    SharedBuffer* sb = SharedBuffer::alloc(16);
+    fill(sb);
+    sb->acquire();
+
+    SharedBuffer* copy = sb->editResize(64);
+    ASSERT_TRUE(copy != sb);
+    EXPECT_TRUE(check(copy, 16));
+    EXPECT_TRUE(sb->onlyOwner());
+    EXPECT_EQ(16U, sb->size());
+    EXPECT_TRUE(check(sb, 16));
+
+    copy->release();
+    sb->release();
+}
+
+TEST(SharedBufferTest, GetAllocationCounts_CountsBySizeClass) {
+    uint64_t before[SharedBuffer::kSizeClassCount + 1];
+    uint64_t after[SharedBuffer::kSizeClassCount + 1];
+    SharedBuffer::getAllocationCounts(before);
+
+    SharedBuffer::alloc(1)->release();
+    SharedBuffer::alloc(SharedBuffer::sizeClassLimit(0))->release();
+    SharedBuffer::alloc(SharedBuffer::sizeClassLimit(0) + 1)->release();
+    SharedBuffer::alloc(
+            SharedBuffer::sizeClassLimit(SharedBuffer::kSizeClassCount - 1) + 1)->release();
+
+    SharedBuffer::getAllocationCounts(after);
+    EXPECT_EQ(2U, after[0] - before[0]);
+    EXPECT_EQ(1U, after[1] - before[1]);
+    EXPECT_EQ(1U, after[SharedBuffer::kSizeClassCount] - before[SharedBuffer::kSizeClassCount]);
+}
+
+} // namespace android
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SortedVector_test"
+
+#include <utils/KeyedVector.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+#include <cutils/log.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+namespace android {
+
+class SortedVectorTest : public testing::Test {
+};
+
+// Adds the same items one at a time and with merge(), and checks that
+// both give the same vector.
+static void expectMergeMatchesAdd(const Vector<int>& existing, const Vector<int>& items) {
+    SortedVector<int> added;
+    SortedVector<int> merged;
+    for (size_t i = 0; i < existing.size(); i++) {
+        added.add(existing[i]);
+        merged.add(existing[i]);
+    }
+    for (size_t i = 0; i < items.size(); i++) {
+        added.add(items[i]);
+    }
+    EXPECT_EQ(NO_ERROR, merged.merge(items));
+
+    ASSERT_EQ(added.size(), merged.size());
+    for (size_t i = 0; i < added.size(); i++) {
+        EXPECT_EQ(added[i], merged[i]) << "at " << i;
+    }
+}
+
+TEST_F(SortedVectorTest, MergeUnsortedMatchesAdd) {
+    srand(1);
+    for (int round = 0; round < 50; round++) {
+        Vector<int> existing, items;
+        int n = rand() % 40, m = rand() % 40;
+        for (int i = 0; i < n; i++) existing.add(rand() % 50);
+        for (int i = 0; i < m; i++) items.add(rand() % 50);
+        expectMergeMatchesAdd(existing, items);
+    }
+}
+
+TEST_F(SortedVectorTest, MergeIntoEmpty) {
+    Vector<int> items;
+    items.add(3);
+    items.add(1);
+    items.add(2);
+    items.add(1);
+
+    SortedVector<int> v;
+    EXPECT_EQ(NO_ERROR, v.merge(items));
+    ASSERT_EQ(3U, v.size());
+    EXPECT_EQ(1, v[0]);
+    EXPECT_EQ(2, v[1]);
+    EXPECT_EQ(3, v[2]);
+}
+
+TEST_F(SortedVectorTest, MergeSorted) {
+    SortedVector<int> a, b;
+    for (int i = 0; i < 10; i += 2) a.add(i);
+    for (int i = 5; i < 15; i++) b.add(i);
+
+    EXPECT_EQ(NO_ERROR, a.merge(b));
+    const int expected[] = { 0, 2, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14 };
+    ASSERT_EQ(13U, a.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        EXPECT_EQ(expected[i], a[i]);
+    }
+
+    // merging with itself changes nothing
+    EXPECT_EQ(NO_ERROR, a.merge(a));
+    EXPECT_EQ(13U, a.size());
+}
+
+TEST_F(SortedVectorTest, MergeSharedStorage) {
+    SortedVector<int> a;
+    a.add(1);
+    a.add(3);
+    SortedVector<int> b(a);
+    b.add(2);
+
+    EXPECT_EQ(NO_ERROR, a.merge(b));
+    ASSERT_EQ(3U, a.size());
+    EXPECT_EQ(1, a[0]);
+    EXPECT_EQ(2, a[1]);
+    EXPECT_EQ(3, a[2]);
+}
+
+TEST_F(SortedVectorTest, KeyedVectorMergeReplacesValues) {
+    KeyedVector<String8, String8> map;
+    map.add(String8("b"), String8("old b"));
+    map.add(String8("d"), String8("d"));
+
+    Vector< key_value_pair_t<String8, String8> > items;
+    items.add(key_value_pair_t<String8, String8>(String8("c"), String8("c")));
+    items.add(key_value_pair_t<String8, String8>(String8("b"), String8("new b")));
+    items.add(key_value_pair_t<String8, String8>(String8("a"), String8("first a")));
+    items.add(key_value_pair_t<String8, String8>(String8("a"), String8("last a")));
+
+    EXPECT_EQ(NO_ERROR, map.merge(items));
+    ASSERT_EQ(4U, map.size());
+    EXPECT_STREQ("last a", map.valueFor(String8("a")).string());
+    EXPECT_STREQ("new b", map.valueFor(String8("b")).string());
+    EXPECT_STREQ("c", map.valueFor(String8("c")).string());
+    EXPECT_STREQ("d", map.valueFor(String8("d")).string());
+
+    KeyedVector<String8, String8> other;
+    other.add(String8("e"), String8("e"));
+    other.add(String8("a"), String8("other a"));
+    EXPECT_EQ(NO_ERROR, map.merge(other));
+    ASSERT_EQ(5U, map.size());
+    EXPECT_STREQ("other a", map.valueFor(String8("a")).string());
+    EXPECT_STREQ("e", map.keyAt(4).string());
+}
+
+TEST_F(SortedVectorTest, RemoveItemsAtIndices) {
+    KeyedVector<int, String8> map;
+    for (int i = 0; i < 10; i++) {
+        map.add(i, String8::format("%d", i));
+    }
+
+    Vector<size_t> indices;
+    indices.add(0);
+    indices.add(3);
+    indices.add(4);
+    indices.add(9);
+    EXPECT_EQ(NO_ERROR, map.removeItemsAt(indices));
+
+    const int expected[] = { 1, 2, 5, 6, 7, 8 };
+    ASSERT_EQ(6U, map.size());
+    for (size_t i = 0; i < map.size(); i++) {
+        EXPECT_EQ(expected[i], map.keyAt(i));
+        EXPECT_STREQ(String8::format("%d", expected[i]).string(), map.valueAt(i).string());
+    }
+
+    // out of order or out of range indices are refused
+    Vector<size_t> bad;
+    bad.add(2);
+    bad.add(1);
+    EXPECT_EQ(BAD_VALUE, map.removeItemsAt(bad));
+    bad.clear();
+    bad.add(6);
+    EXPECT_EQ(BAD_VALUE, map.removeItemsAt(bad));
+    EXPECT_EQ(6U, map.size());
+}
+
+} // namespace android
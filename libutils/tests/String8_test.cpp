@@ -72,4 +72,68 @@ TEST_F(String8Test, OperatorPlusEquals) {
     EXPECT_STREQ(src3, " Verify me.");
 }
 
+
+TEST_F(String8Test, Intern_SameValue_SharesStorage) {
+    String8 a = String8::intern("ro.product.model");
+    String8 b = String8::intern(String8("ro.product.model"));
+    String8 c = String8::intern("ro.product.model.x", 16);
+
+    EXPECT_STREQ("ro.product.model", a.string());
+    EXPECT_EQ(a.string(), b.string());
+    EXPECT_EQ(a.string(), c.string());
+
+    String8 other = String8::intern("ro.product.name");
+    EXPECT_STREQ("ro.product.name", other.string());
+    EXPECT_NE(a.string(), other.string());
+}
+
+TEST_F(String8Test, Intern_WhenEdited_DoesNotChangeThePool) {
+    String8 a = String8::intern("interned");
+    a.toUpper();
+
+    EXPECT_STREQ("INTERNED", a.string());
+    EXPECT_STREQ("interned", String8::intern("interned").string());
+}
+
+
+TEST_F(String8Test, AppendFormat_LongerThanStackBuffer) {
+    String8 s("x");
+    String8 pad(String8::format("%1000s", ""));
+    EXPECT_EQ(NO_ERROR, s.appendFormat("%d%s%d", 1, pad.string(), 2));
+
+    EXPECT_EQ(1003u, s.length());
+    EXPECT_EQ('1', s.string()[1]);
+    EXPECT_EQ('2', s.string()[1002]);
+}
+
+TEST_F(String8Test, Builder_ManyAppends) {
+    String8Builder builder;
+    String8 expected;
+    for (int i = 0; i < 1000; i++) {
+        builder.appendFormat("line %d\n", i);
+        builder.append("-");
+        expected.appendFormat("line %d\n", i);
+        expected.append("-");
+    }
+    EXPECT_EQ(expected.length(), builder.length());
+    EXPECT_STREQ(expected.string(), builder.string());
+
+    String8 result = builder.toString();
+    EXPECT_STREQ(expected.string(), result.string());
+    EXPECT_EQ(expected.length(), result.length());
+    EXPECT_EQ(0u, builder.length());
+    EXPECT_STREQ("", builder.string());
+}
+
+TEST_F(String8Test, Builder_FormatLargerThanSpareRoom) {
+    String8Builder builder(4);
+    String8 pad(String8::format("%500s", ""));
+    builder.append("ab");
+    builder.appendFormat("%s|", pad.string());
+
+    String8 result = builder.toString();
+    EXPECT_EQ(503u, result.length());
+    EXPECT_EQ('|', result.string()[502]);
+}
+
 }
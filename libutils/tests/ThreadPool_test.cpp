@@ -0,0 +1,138 @@
+//
+// Copyright 2013 The Android Open Source Project
+//
+
+#include <utils/ThreadPool.h>
+#include <utils/SortedVector.h>
+#include <cutils/atomic.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+namespace android {
+
+// Counts the times it ran and records the threads it ran on.
+class CountingTask : public Task {
+public:
+    CountingTask() : mCount(0) { }
+
+    virtual void run() {
+        Mutex::Autolock _l(mLock);
+        mCount += 1;
+        mThreads.add(pthread_self());
+    }
+
+    int getCount() {
+        Mutex::Autolock _l(mLock);
+        return mCount;
+    }
+
+    Mutex mLock;
+    int mCount;
+    SortedVector<pthread_t> mThreads;
+};
+
+// Sleeps a little, so that the others have to take over.
+class SlowTask : public CountingTask {
+public:
+    virtual void run() {
+        usleep(10 * 1000);
+        CountingTask::run();
+    }
+};
+
+// Splits a range in two until it is small, then counts it, waiting for the
+// halves it posts from within the pool.
+class SplittingTask : public Task {
+public:
+    SplittingTask(ThreadPool* pool, volatile int32_t* total, int begin, int end) :
+            mPool(pool), mTotal(total), mBegin(begin), mEnd(end) { }
+
+    virtual void run() {
+        if (mEnd - mBegin <= 4) {
+            android_atomic_add(mEnd - mBegin, mTotal);
+            return;
+        }
+        int middle = (mBegin + mEnd) / 2;
+        TaskGroup group;
+        mPool->post(new SplittingTask(mPool, mTotal, mBegin, middle),
+                ANDROID_PRIORITY_NORMAL, &group);
+        mPool->post(new SplittingTask(mPool, mTotal, middle, mEnd),
+                ANDROID_PRIORITY_NORMAL, &group);
+        group.wait();
+    }
+
+    ThreadPool* mPool;
+    volatile int32_t* mTotal;
+    int mBegin;
+    int mEnd;
+};
+
+class ThreadPoolTest : public testing::Test {
+protected:
+    sp<ThreadPool> mPool;
+
+    virtual void SetUp() {
+        mPool = new ThreadPool(4);
+        ASSERT_EQ(OK, mPool->start());
+    }
+
+    virtual void TearDown() {
+        mPool->stop();
+        mPool.clear();
+    }
+};
+
+
+TEST_F(ThreadPoolTest, Post_WithGroup_RunsAllTasksBeforeWaitReturns) {
+    sp<CountingTask> task = new CountingTask();
+    TaskGroup group;
+
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(OK, mPool->post(task, ANDROID_PRIORITY_NORMAL, &group));
+    }
+    group.wait();
+
+    EXPECT_EQ(100, task->getCount());
+    EXPECT_EQ(0U, group.getPendingCount());
+}
+
+TEST_F(ThreadPoolTest, Post_WhenTasksAreSlow_RunsThemOnSeveralThreads) {
+    sp<SlowTask> task = new SlowTask();
+    TaskGroup group;
+
+    for (int i = 0; i < 8; i++) {
+        mPool->post(task, ANDROID_PRIORITY_NORMAL, &group);
+    }
+    group.wait();
+
+    Mutex::Autolock _l(task->mLock);
+    EXPECT_EQ(8, task->mCount);
+    EXPECT_GT(task->mThreads.size(), 1U)
+            << "the idle threads should take the queued tasks";
+}
+
+TEST_F(ThreadPoolTest, Wait_FromATask_RunsTheTasksItWaitsFor) {
+    volatile int32_t total = 0;
+    TaskGroup group;
+
+    mPool->post(new SplittingTask(mPool.get(), &total, 0, 1000),
+            ANDROID_PRIORITY_NORMAL, &group);
+    group.wait();
+
+    EXPECT_EQ(1000, total)
+            << "nested waits should not run out of threads";
+}
+
+TEST_F(ThreadPoolTest, Stop_RunsTheQueuedTasksThenRefusesNewOnes) {
+    sp<CountingTask> task = new CountingTask();
+
+    for (int i = 0; i < 20; i++) {
+        mPool->post(task);
+    }
+    mPool->stop();
+
+    EXPECT_EQ(20, task->getCount());
+    EXPECT_EQ(INVALID_OPERATION, mPool->post(task));
+}
+
+} // namespace android
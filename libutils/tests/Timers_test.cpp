@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Timers_test"
+
+#include <utils/Timers.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+namespace android {
+
+class TimersTest : public testing::Test {
+};
+
+TEST_F(TimersTest, CoarseClocksFollowTheFineOnes) {
+    // the coarse clocks lag by at most a tick
+    nsecs_t fine = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t coarse = systemTime(SYSTEM_TIME_MONOTONIC_COARSE);
+    EXPECT_NEAR(fine, coarse, ms2ns(100));
+
+    fine = systemTime(SYSTEM_TIME_REALTIME);
+    coarse = systemTime(SYSTEM_TIME_REALTIME_COARSE);
+    EXPECT_NEAR(fine, coarse, ms2ns(100));
+}
+
+TEST_F(TimersTest, CyclesMatchTheMonotonicClock) {
+    EXPECT_GT(systemCyclesFrequency(), 0U);
+
+    nsecs_t t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint64_t c0 = systemCycles();
+    usleep(50000);
+    uint64_t c1 = systemCycles();
+    nsecs_t t1 = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    EXPECT_GE(c1, c0);
+    // within 10% of what the clock saw
+    EXPECT_NEAR(t1 - t0, cyclesToNanoseconds(c1 - c0), (t1 - t0) / 10);
+}
+
+TEST_F(TimersTest, CycleConversionsRoundTrip) {
+    const nsecs_t times[] = { 0, 1, 999, us2ns(1), ms2ns(17), s2ns(1), s2ns(3600 * 24 * 365) };
+    for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        nsecs_t back = cyclesToNanoseconds(nanosecondsToCycles(times[i]));
+        // off by at most a count, which is no more than a microsecond
+        EXPECT_LE(back, times[i]);
+        EXPECT_GE(back, times[i] - us2ns(1));
+    }
+    EXPECT_EQ(systemCyclesFrequency(), nanosecondsToCycles(s2ns(1)));
+    EXPECT_EQ(0, cyclesToNanoseconds(0));
+}
+
+} // namespace android
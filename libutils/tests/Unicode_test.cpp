@@ -15,6 +15,9 @@
  */
 
 #define LOG_TAG "Unicode_test"
+
+#include <string.h>
+
 #include <utils/Log.h>
 #include <utils/Unicode.h>
 
@@ -112,4 +115,48 @@ TEST_F(UnicodeTest, UTF8toUTF16Normal) {
             << "should be NULL terminated";
 }
 
+TEST_F(UnicodeTest, UTF8toUTF16LongASCIIRuns) {
+    // ASCII runs of all lengths around a word, between non-ASCII characters.
+    for (size_t run = 0; run < 20; run++) {
+        uint8_t str[2 + 20 + 2 + 20];
+        size_t len = 0;
+        str[len++] = 0xC4; str[len++] = 0x80; // U+0100
+        for (size_t i = 0; i < run; i++) {
+            str[len++] = 'a' + i;
+        }
+        str[len++] = 0xC4; str[len++] = 0x80; // U+0100
+        for (size_t i = 0; i < run; i++) {
+            str[len++] = 'A' + i;
+        }
+
+        ASSERT_EQ(ssize_t(2 + 2 * run), utf8_to_utf16_length(str, len));
+
+        char16_t output[2 + 2 * 20 + 1];
+        utf8_to_utf16(str, len, output);
+        EXPECT_EQ(0x0100, output[0]);
+        for (size_t i = 0; i < run; i++) {
+            EXPECT_EQ(char16_t('a' + i), output[1 + i]);
+            EXPECT_EQ(char16_t('A' + i), output[2 + run + i]);
+        }
+        EXPECT_EQ(0x0100, output[1 + run]);
+        EXPECT_EQ(0, output[2 + 2 * run]);
+
+        // And back.
+        ASSERT_EQ(ssize_t(len), utf16_to_utf8_length(output, 2 + 2 * run));
+        char roundTrip[sizeof(str) + 1];
+        utf16_to_utf8(output, 2 + 2 * run, roundTrip);
+        EXPECT_EQ(0, memcmp(str, roundTrip, len));
+        EXPECT_EQ('\0', roundTrip[len]);
+
+        // Running out of room in the middle of a run.
+        char16_t truncated[4];
+        char16_t* end = utf8_to_utf16_n(str, len, truncated, 4);
+        const size_t expected = 2 + 2 * run < 4 ? 2 + 2 * run : 4;
+        ASSERT_EQ(ssize_t(expected), end - truncated);
+        for (size_t i = 0; i < expected; i++) {
+            EXPECT_EQ(output[i], truncated[i]);
+        }
+    }
+}
+
 }
@@ -23,6 +23,24 @@
 
 namespace android {
 
+// Counts copies and live instances, and can be moved with memmove.
+struct Counted {
+    static int sCopies;
+    static int sLive;
+
+    Counted() : value(0) { sLive++; }
+    Counted(int value) : value(value) { sLive++; }
+    Counted(const Counted& other) : value(other.value) { sCopies++; sLive++; }
+    ~Counted() { sLive--; }
+
+    int value;
+};
+
+int Counted::sCopies = 0;
+int Counted::sLive = 0;
+
+ANDROID_TRIVIAL_MOVE_TRAIT(Counted)
+
 class VectorTest : public testing::Test {
 protected:
     virtual void SetUp() {
@@ -72,4 +90,71 @@ TEST_F(VectorTest, CopyOnWrite_CopyAndAddElements) {
 }
 
 
+TEST_F(VectorTest, Grow_WhenStorageIsNotShared_MovesItems) {
+    Counted::sCopies = 0;
+    Counted::sLive = 0;
+    {
+        Vector<Counted> vector;
+        for (int i = 0; i < 100; i++) {
+            vector.add(Counted(i));
+        }
+        vector.insertAt(Counted(-1), 0);
+
+        // only the copies into the vector, none when it grows
+        EXPECT_EQ(101, Counted::sCopies);
+        EXPECT_EQ(101, Counted::sLive);
+        EXPECT_EQ(-1, vector[0].value);
+        for (int i = 0; i < 100; i++) {
+            EXPECT_EQ(i, vector[i + 1].value);
+        }
+    }
+    EXPECT_EQ(0, Counted::sLive);
+}
+
+TEST_F(VectorTest, Grow_WhenStorageIsShared_CopiesItems) {
+    Counted::sCopies = 0;
+    Counted::sLive = 0;
+    {
+        Vector<Counted> vector;
+        for (int i = 0; i < 4; i++) {
+            vector.add(Counted(i));
+        }
+        Vector<Counted> other = vector;
+        for (int i = 4; i < 100; i++) {
+            vector.add(Counted(i));
+        }
+
+        EXPECT_EQ(104, Counted::sLive);
+        ASSERT_EQ(4U, other.size());
+        for (int i = 0; i < 4; i++) {
+            EXPECT_EQ(i, other[i].value);
+        }
+        for (int i = 0; i < 100; i++) {
+            EXPECT_EQ(i, vector[i].value);
+        }
+    }
+    EXPECT_EQ(0, Counted::sLive);
+}
+
+TEST_F(VectorTest, Shrink_WhenStorageIsNotShared_DestroysOnlyRemovedItems) {
+    Counted::sLive = 0;
+    {
+        Vector<Counted> vector;
+        for (int i = 0; i < 100; i++) {
+            vector.add(Counted(i));
+        }
+        Counted::sCopies = 0;
+        vector.removeItemsAt(10, 80);
+
+        EXPECT_EQ(0, Counted::sCopies);
+        EXPECT_EQ(20, Counted::sLive);
+        ASSERT_EQ(20U, vector.size());
+        for (int i = 0; i < 10; i++) {
+            EXPECT_EQ(i, vector[i].value);
+            EXPECT_EQ(90 + i, vector[10 + i].value);
+        }
+    }
+    EXPECT_EQ(0, Counted::sLive);
+}
+
 } // namespace android
@@ -5,6 +5,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
 	centraldir.c \
+	extract.c \
 	zipfile.c
 
 LOCAL_STATIC_LIBRARIES := \
@@ -21,6 +22,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
 	centraldir.c \
+	extract.c \
 	zipfile.c
 
 LOCAL_STATIC_LIBRARIES := \
@@ -0,0 +1,178 @@
+#include <zipfile/zipfile.h>
+
+#include "private.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+enum {
+    STORED = 0,
+    DEFLATED = 8,
+
+    // inflated data is written in pieces this big
+    WRITE_CHUNK_SIZE = 256 * 1024,
+    MAX_EXTRACT_THREADS = 16
+};
+
+static int
+write_fully(int fd, const unsigned char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "write failed: %s\n", strerror(errno));
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int
+inflate_to_fd(const Zipentry* entry, int fd, unsigned char* chunk)
+{
+    z_stream zstream;
+    int err = 0;
+    int zerr;
+
+    memset(&zstream, 0, sizeof(zstream));
+    zstream.zalloc = Z_NULL;
+    zstream.zfree = Z_NULL;
+    zstream.opaque = Z_NULL;
+    zstream.next_in = (void*)entry->data;
+    zstream.avail_in = entry->compressedSize;
+    zstream.data_type = Z_UNKNOWN;
+
+    // no zlib header, see uninflate in zipfile.c
+    zerr = inflateInit2(&zstream, -MAX_WBITS);
+    if (zerr != Z_OK) {
+        return -1;
+    }
+
+    do {
+        zstream.next_out = chunk;
+        zstream.avail_out = WRITE_CHUNK_SIZE;
+        zerr = inflate(&zstream, Z_NO_FLUSH);
+        if (zerr != Z_OK && zerr != Z_STREAM_END) {
+            fprintf(stderr, "zerr=%d total_out=%lu\n", zerr, zstream.total_out);
+            err = -1;
+            break;
+        }
+        if (write_fully(fd, chunk, WRITE_CHUNK_SIZE - zstream.avail_out)) {
+            err = -1;
+            break;
+        }
+    } while (zerr != Z_STREAM_END);
+
+    inflateEnd(&zstream);
+    return err;
+}
+
+// chunk is WRITE_CHUNK_SIZE bytes, or NULL for stored entries
+static int
+extract_to_fd(const Zipentry* entry, int fd, unsigned char* chunk)
+{
+    switch (entry->compressionMethod)
+    {
+        case STORED:
+            return write_fully(fd, entry->data, entry->uncompressedSize);
+        case DEFLATED:
+            return inflate_to_fd(entry, fd, chunk);
+        default:
+            return -1;
+    }
+}
+
+int
+extract_zipentry(zipentry_t e, int fd)
+{
+    Zipentry* entry = (Zipentry*)e;
+    unsigned char* chunk = NULL;
+    int err;
+
+    if (entry->compressionMethod == DEFLATED) {
+        chunk = malloc(WRITE_CHUNK_SIZE);
+        if (chunk == NULL) return -1;
+    }
+    err = extract_to_fd(entry, fd, chunk);
+    free(chunk);
+    return err;
+}
+
+typedef struct Extraction {
+    zipentry_t* entries;
+    const int* fds;
+    int count;
+
+    pthread_mutex_t lock;
+    int next;                   // next entry to extract
+    int failures;
+} Extraction;
+
+static void*
+extract_thread(void* arg)
+{
+    Extraction* ex = (Extraction*)arg;
+    unsigned char* chunk = malloc(WRITE_CHUNK_SIZE);
+    const Zipentry* entry;
+    int failures = 0;
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&ex->lock);
+        i = ex->next++;
+        pthread_mutex_unlock(&ex->lock);
+        if (i >= ex->count) {
+            break;
+        }
+        entry = (const Zipentry*)ex->entries[i];
+        if ((entry->compressionMethod == DEFLATED && chunk == NULL)
+                || extract_to_fd(entry, ex->fds[i], chunk) != 0) {
+            failures++;
+        }
+    }
+
+    free(chunk);
+    pthread_mutex_lock(&ex->lock);
+    ex->failures += failures;
+    pthread_mutex_unlock(&ex->lock);
+    return NULL;
+}
+
+int
+extract_zipentries(zipentry_t* entries, const int* fds, int count, int threads)
+{
+    pthread_t tids[MAX_EXTRACT_THREADS];
+    Extraction ex;
+    int started = 0;
+    int i;
+
+    if (threads > MAX_EXTRACT_THREADS) threads = MAX_EXTRACT_THREADS;
+    if (threads > count) threads = count;
+
+    memset(&ex, 0, sizeof(ex));
+    ex.entries = entries;
+    ex.fds = fds;
+    ex.count = count;
+    pthread_mutex_init(&ex.lock, NULL);
+
+    // the calling thread is one of the threads
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, extract_thread, &ex) != 0) {
+            break;
+        }
+        started++;
+    }
+    extract_thread(&ex);
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    pthread_mutex_destroy(&ex.lock);
+    return ex.failures;
+}
@@ -36,6 +36,7 @@ release_zipfile(zipfile_t f)
         free(entry);
         entry = next;
     }
+    free(file->hashTable);
     free(file);
 }
 
@@ -43,12 +44,16 @@ zipentry_t
 lookup_zipentry(zipfile_t f, const char* entryName)
 {
     Zipfile* file = (Zipfile*)f;
-    Zipentry* entry = file->entries;
-    while (entry) {
-        if (0 == memcmp(entryName, entry->fileName, entry->fileNameLength)) {
+    const unsigned int len = strlen(entryName);
+    const unsigned int mask = file->hashSize - 1;
+    unsigned int i = hash_name((const unsigned char*)entryName, len) & mask;
+    Zipentry* entry;
+    while ((entry = file->hashTable[i]) != NULL) {
+        if (entry->fileNameLength == len
+                && 0 == memcmp(entryName, entry->fileName, len)) {
             return entry;
         }
-        entry = entry->next;
+        i = (i + 1) & mask;
     }
     return NULL;
 }
@@ -128,6 +133,96 @@ decompress_zipentry(zipentry_t e, void* buf, int bufsize)
     }
 }
 
+enum {
+    STREAM_CHUNK_SIZE = 32 * 1024
+};
+
+typedef struct Zipstream {
+    const Zipentry* entry;
+    z_stream zstream;
+    int done;
+    unsigned char* chunk;
+} Zipstream;
+
+zipstream_t
+open_zipentry_stream(zipentry_t e)
+{
+    Zipentry* entry = (Zipentry*)e;
+    Zipstream* stream;
+
+    if (entry->compressionMethod != STORED
+            && entry->compressionMethod != DEFLATED) {
+        return NULL;
+    }
+
+    stream = malloc(sizeof(Zipstream));
+    if (stream == NULL) return NULL;
+    memset(stream, 0, sizeof(Zipstream));
+    stream->entry = entry;
+
+    if (entry->compressionMethod == DEFLATED) {
+        stream->chunk = malloc(STREAM_CHUNK_SIZE);
+        if (stream->chunk == NULL) goto fail;
+        stream->zstream.zalloc = Z_NULL;
+        stream->zstream.zfree = Z_NULL;
+        stream->zstream.opaque = Z_NULL;
+        stream->zstream.next_in = (void*)entry->data;
+        stream->zstream.avail_in = entry->compressedSize;
+        stream->zstream.data_type = Z_UNKNOWN;
+        // no zlib header, see uninflate
+        if (inflateInit2(&stream->zstream, -MAX_WBITS) != Z_OK) {
+            free(stream->chunk);
+            goto fail;
+        }
+    }
+    return stream;
+fail:
+    free(stream);
+    return NULL;
+}
+
+ssize_t
+read_zipentry_stream(zipstream_t s, const void** data)
+{
+    Zipstream* stream = (Zipstream*)s;
+    int zerr;
+
+    if (stream->done) {
+        return 0;
+    }
+
+    if (stream->entry->compressionMethod == STORED) {
+        // no copy, the data is right there in the archive
+        stream->done = 1;
+        *data = stream->entry->data;
+        return stream->entry->uncompressedSize;
+    }
+
+    stream->zstream.next_out = stream->chunk;
+    stream->zstream.avail_out = STREAM_CHUNK_SIZE;
+    zerr = inflate(&stream->zstream, Z_NO_FLUSH);
+    if (zerr == Z_STREAM_END) {
+        stream->done = 1;
+    } else if (zerr != Z_OK) {
+        fprintf(stderr, "zerr=%d total_out=%lu\n", zerr,
+                stream->zstream.total_out);
+        return -1;
+    }
+    *data = stream->chunk;
+    return STREAM_CHUNK_SIZE - stream->zstream.avail_out;
+}
+
+void
+close_zipentry_stream(zipstream_t s)
+{
+    Zipstream* stream = (Zipstream*)s;
+    if (stream->entry->compressionMethod == DEFLATED) {
+        inflateEnd(&stream->zstream);
+        free(stream->chunk);
+    }
+    free(stream);
+}
+
 void
 dump_zipfile(FILE* to, zipfile_t file)
 {
@@ -4,6 +4,7 @@
 #include <log/logd.h>
 #include <log/logprint.h>
 #include <log/event_tag_map.h>
+#include <log/logcat_stream.h>
 #include <cutils/sockets.h>
 
 #include <stdio.h>
@@ -16,6 +17,9 @@
 #include <errno.h>
 #include <assert.h>
 #include <ctype.h>
+#include <regex.h>
+#include <pthread.h>
+#include <zlib.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
@@ -32,6 +36,15 @@ static int g_tail_lines = 0;
 
 #define LOG_FILE_DIR    "/dev/log/"
 
+/* entries read from one device per wakeup before moving to the next */
+#define READ_BATCH_ENTRIES  64
+/* entries allocated at a time for the entry pool */
+#define ENTRY_POOL_CHUNK    64
+/* records collected into one frame of the -F stream, at most */
+#define STREAM_FRAME_SIZE   (16*1024)
+/* output queued for the -f writer thread before reading blocks */
+#define WRITER_QUEUE_MAX    (4*1024*1024)
+
 struct queued_entry_t {
     union {
         unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1] __attribute__((aligned(4)));
@@ -52,14 +65,42 @@ static int cmp(queued_entry_t* a, queued_entry_t* b) {
     return a->entry.nsec - b->entry.nsec;
 }
 
+/*
+ * Entries are recycled through a free list instead of going back to the
+ * heap, a full dump reads tens of thousands of them. The pool only ever
+ * grows, by ENTRY_POOL_CHUNK entries at a time.
+ */
+static queued_entry_t* g_freeEntries = NULL;
+
+static queued_entry_t* allocEntry() {
+    if (g_freeEntries == NULL) {
+        queued_entry_t* chunk = new queued_entry_t[ENTRY_POOL_CHUNK];
+        for (int i = 0; i < ENTRY_POOL_CHUNK; i++) {
+            chunk[i].next = g_freeEntries;
+            g_freeEntries = &chunk[i];
+        }
+    }
+    queued_entry_t* entry = g_freeEntries;
+    g_freeEntries = entry->next;
+    entry->next = NULL;
+    return entry;
+}
+
+static void freeEntry(queued_entry_t* entry) {
+    entry->next = g_freeEntries;
+    g_freeEntries = entry;
+}
+
 struct log_device_t {
     char* device;
     bool binary;
     int fd;
     bool printed;
     char label;
+    int index;
 
     queued_entry_t* queue;
+    queued_entry_t* tail;
     log_device_t* next;
 
     log_device_t(char* d, bool b, char l) {
@@ -67,13 +108,20 @@ struct log_device_t {
         binary = b;
         label = l;
         queue = NULL;
+        tail = NULL;
         next = NULL;
         printed = false;
+        index = 0;
     }
 
     void enqueue(queued_entry_t* entry) {
+        // the driver hands entries back in the order they were written,
+        // so nearly everything lands at the tail
         if (this->queue == NULL) {
-            this->queue = entry;
+            this->queue = this->tail = entry;
+        } else if (cmp(entry, this->tail) >= 0) {
+            this->tail->next = entry;
+            this->tail = entry;
         } else {
             queued_entry_t** e = &this->queue;
             while (*e && cmp(entry, *e) >= 0) {
@@ -83,6 +131,15 @@ struct log_device_t {
             *e = entry;
         }
     }
+
+    queued_entry_t* dequeue() {
+        queued_entry_t* entry = this->queue;
+        this->queue = entry->next;
+        if (this->queue == NULL) {
+            this->tail = NULL;
+        }
+        return entry;
+    }
 };
 
 namespace android {
@@ -93,9 +150,20 @@ static const char * g_outputFileName = NULL;
 static int g_logRotateSizeKBytes = 0;                   // 0 means "no log rotation"
 static int g_maxRotatedLogs = DEFAULT_MAX_ROTATED_LOGS; // 0 means "unbounded"
 static int g_outFD = -1;
+static AndroidLogWriteBuffer g_outBuffer;   // collects output for g_outFD
 static off_t g_outByteCount = 0;
 static int g_printBinary = 0;
 static int g_devCount = 0;
+static int g_pidFilter = -1;                // -1 means "any pid"
+static regex_t* g_messageFilter = NULL;
+
+// framed binary stream (-F), see log/logcat_stream.h
+static bool g_printStream = false;
+static bool g_streamNeedsHeader = false;
+static log_device_t* g_streamDevices = NULL;
+static unsigned char g_frame[STREAM_FRAME_SIZE];
+static size_t g_frameLen = 0;
+static uint32_t g_frameCount = 0;
 
 static EventTagMap* g_eventTagMap = NULL;
 
@@ -104,26 +172,173 @@ static int openLogFile (const char *pathname)
     return open(pathname, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
 }
 
-static void rotateLogs()
+/*
+ * With -f, output goes through a writer thread so that slow storage
+ * doesn't hold up draining the log devices. Flushed output buffers are
+ * copied into a queue of chunks, a chunk without data asks the writer to
+ * rotate. Reading stops and waits once WRITER_QUEUE_MAX bytes are queued.
+ */
+struct output_chunk_t {
+    output_chunk_t* next;
+    size_t len;
+    char data[0];
+};
+
+static pthread_mutex_t g_writerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_writerWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_writerSpace = PTHREAD_COND_INITIALIZER;
+static output_chunk_t* g_writerHead = NULL;
+static output_chunk_t* g_writerTail = NULL;
+static size_t g_writerQueued = 0;
+static bool g_writerBusy = false;
+
+static bool g_compressRotated = false;
+static pthread_t g_compressThread;
+static bool g_compressing = false;
+
+static void queueChunk(output_chunk_t* chunk)
 {
-    int err;
+    pthread_mutex_lock(&g_writerLock);
+    while (g_writerQueued > WRITER_QUEUE_MAX) {
+        pthread_cond_wait(&g_writerSpace, &g_writerLock);
+    }
+    chunk->next = NULL;
+    if (g_writerTail) {
+        g_writerTail->next = chunk;
+    } else {
+        g_writerHead = chunk;
+    }
+    g_writerTail = chunk;
+    g_writerQueued += chunk->len;
+    pthread_cond_signal(&g_writerWork);
+    pthread_mutex_unlock(&g_writerLock);
+}
 
-    // Can't rotate logs if we're not outputting to a file
-    if (g_outputFileName == NULL) {
-        return;
+// AndroidLogWriteFunc for g_outBuffer
+static int queueOutput(void* cookie, const char* data, size_t len)
+{
+    output_chunk_t* chunk = (output_chunk_t*) malloc(sizeof(*chunk) + len);
+    if (chunk == NULL) {
+        return -1;
+    }
+    chunk->len = len;
+    memcpy(chunk->data, data, len);
+    queueChunk(chunk);
+    return 0;
+}
+
+// waits until the writer has written everything queued so far
+static void drainOutput()
+{
+    pthread_mutex_lock(&g_writerLock);
+    while (g_writerHead != NULL || g_writerBusy) {
+        pthread_cond_wait(&g_writerSpace, &g_writerLock);
+    }
+    pthread_mutex_unlock(&g_writerLock);
+
+    if (g_compressing) {
+        pthread_join(g_compressThread, NULL);
+        g_compressing = false;
     }
+}
+
+static int writeAll(int fd, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t ret = write(fd, data, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+// gzips a freshly rotated file next to itself and removes the original
+static void* compressLog(void* arg)
+{
+    char* path = (char*) arg;
+    char* gzPath;
+    char buf[64 * 1024];
+    int fd;
+    gzFile gz;
+    int n;
+
+    asprintf(&gzPath, "%s.gz", path);
+    fd = open(path, O_RDONLY);
+    // same permissions as the log files themselves
+    n = open(gzPath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    gz = n < 0 ? NULL : gzdopen(n, "wb");
+    if (gz == NULL && n >= 0) {
+        close(n);
+    }
+    if (fd < 0 || gz == NULL) {
+        // keep the uncompressed file rather than losing it
+        perror("couldn't compress rotated log");
+        if (gz != NULL) {
+            gzclose(gz);
+            unlink(gzPath);
+        }
+    } else {
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            if (gzwrite(gz, buf, n) != n) {
+                n = -1;
+                break;
+            }
+        }
+        if (gzclose(gz) != Z_OK || n < 0) {
+            fprintf(stderr, "couldn't compress rotated log %s\n", path);
+            unlink(gzPath);
+        } else {
+            unlink(path);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(gzPath);
+    free(path);
+    return NULL;
+}
+
+// runs on the writer thread
+static void rotateOutputFile()
+{
+    int err;
+    const char* suffix = g_compressRotated ? ".gz" : "";
 
     close(g_outFD);
 
+    // the previous file has to be compressed before it can move on
+    if (g_compressing) {
+        pthread_join(g_compressThread, NULL);
+        g_compressing = false;
+    }
+
+    // the oldest slot holds one file, whichever form it is in
+    if (*suffix && g_maxRotatedLogs > 1) {
+        char* oldest;
+        asprintf(&oldest, "%s.%d", g_outputFileName, g_maxRotatedLogs);
+        unlink(oldest);
+        free(oldest);
+        asprintf(&oldest, "%s.%d%s", g_outputFileName, g_maxRotatedLogs, suffix);
+        unlink(oldest);
+        free(oldest);
+    }
+
     for (int i = g_maxRotatedLogs ; i > 0 ; i--) {
         char *file0, *file1;
 
-        asprintf(&file1, "%s.%d", g_outputFileName, i);
-
         if (i - 1 == 0) {
+            asprintf(&file1, "%s.%d", g_outputFileName, i);
             asprintf(&file0, "%s", g_outputFileName);
         } else {
-            asprintf(&file0, "%s.%d", g_outputFileName, i - 1);
+            asprintf(&file1, "%s.%d%s", g_outputFileName, i, suffix);
+            asprintf(&file0, "%s.%d%s", g_outputFileName, i - 1, suffix);
         }
 
         err = rename (file0, file1);
@@ -134,6 +349,32 @@ static void rotateLogs()
 
         free(file1);
         free(file0);
+
+        // a file that couldn't be compressed stays plain; rotate it along
+        // with the others instead of letting the next .1 overwrite it
+        if (*suffix && i > 1) {
+            asprintf(&file1, "%s.%d", g_outputFileName, i);
+            asprintf(&file0, "%s.%d", g_outputFileName, i - 1);
+
+            err = rename (file0, file1);
+
+            if (err < 0 && errno != ENOENT) {
+                perror("while rotating log files");
+            }
+
+            free(file1);
+            free(file0);
+        }
+    }
+
+    if (g_compressRotated && g_maxRotatedLogs > 0) {
+        char* rotated;
+        asprintf(&rotated, "%s.1", g_outputFileName);
+        if (pthread_create(&g_compressThread, NULL, compressLog, rotated) == 0) {
+            g_compressing = true;
+        } else {
+            free(rotated);
+        }
     }
 
     g_outFD = openLogFile (g_outputFileName);
@@ -142,52 +383,217 @@ static void rotateLogs()
         perror ("couldn't open output file");
         exit(-1);
     }
+}
 
-    g_outByteCount = 0;
+static void* writerThread(void* arg)
+{
+    pthread_mutex_lock(&g_writerLock);
+    while (true) {
+        while (g_writerHead == NULL) {
+            pthread_cond_wait(&g_writerWork, &g_writerLock);
+        }
+        output_chunk_t* chunk = g_writerHead;
+        g_writerHead = chunk->next;
+        if (g_writerHead == NULL) {
+            g_writerTail = NULL;
+        }
+        g_writerBusy = true;
+        pthread_mutex_unlock(&g_writerLock);
 
+        if (chunk->len == 0) {
+            rotateOutputFile();
+        } else if (writeAll(g_outFD, chunk->data, chunk->len) < 0) {
+            perror("output error");
+            exit(-1);
+        }
+
+        pthread_mutex_lock(&g_writerLock);
+        g_writerQueued -= chunk->len;
+        g_writerBusy = false;
+        free(chunk);
+        pthread_cond_broadcast(&g_writerSpace);
+    }
+    return NULL;
+}
+
+static void rotateLogs()
+{
+    // Can't rotate logs if we're not outputting to a file
+    if (g_outputFileName == NULL) {
+        return;
+    }
+
+    android_log_flushWriteBuffer(&g_outBuffer);
+
+    output_chunk_t* chunk = (output_chunk_t*) malloc(sizeof(*chunk));
+    if (chunk == NULL) {
+        perror("while rotating log files");
+        return;
+    }
+    chunk->len = 0;
+    queueChunk(chunk);
+
+    g_outByteCount = 0;
+    g_streamNeedsHeader = true;
 }
 
 void printBinary(struct logger_entry *buf)
 {
     size_t size = sizeof(logger_entry) + buf->len;
-    int ret;
-    
-    do {
-        ret = write(g_outFD, buf, size);
-    } while (ret < 0 && errno == EINTR);
+
+    if (android_log_writeToBuffer(&g_outBuffer, buf, size) < 0) {
+        perror("output error");
+        exit(-1);
+    }
 }
 
-static void processBuffer(log_device_t* dev, struct logger_entry *buf)
+static void writeOutput(const void* data, size_t size)
+{
+    if (android_log_writeToBuffer(&g_outBuffer, data, size) < 0) {
+        perror("output error");
+        exit(-1);
+    }
+    g_outByteCount += size;
+}
+
+static void writeStreamHeader()
+{
+    struct logcat_stream_header header;
+
+    memcpy(header.magic, LOGCAT_STREAM_MAGIC, sizeof(header.magic));
+    header.version = LOGCAT_STREAM_VERSION;
+    header.buffer_count = g_devCount;
+    writeOutput(&header, sizeof(header));
+
+    for (log_device_t* dev = g_streamDevices; dev; dev = dev->next) {
+        const char* name = strrchr(dev->device, '/');
+        name = name ? name + 1 : dev->device;
+
+        unsigned char len = strlen(name) > 255 ? 255 : strlen(name);
+        writeOutput(&len, 1);
+        writeOutput(name, len);
+    }
+    g_streamNeedsHeader = false;
+}
+
+static void flushFrame()
+{
+    struct logcat_stream_frame frame;
+
+    if (g_frameCount == 0) {
+        return;
+    }
+    if (g_streamNeedsHeader) {
+        writeStreamHeader();
+    }
+
+    frame.size = g_frameLen;
+    frame.count = g_frameCount;
+    writeOutput(&frame, sizeof(frame));
+    writeOutput(g_frame, g_frameLen);
+    g_frameLen = 0;
+    g_frameCount = 0;
+
+    // frames are the unit of rotation, so that every file decodes alone
+    if (g_logRotateSizeKBytes > 0
+        && (g_outByteCount / 1024) >= g_logRotateSizeKBytes
+    ) {
+        rotateLogs();
+    }
+}
+
+static void flushOutput()
+{
+    flushFrame();
+    android_log_flushWriteBuffer(&g_outBuffer);
+}
+
+// pushes out everything before exiting
+static void finishOutput()
+{
+    flushOutput();
+    if (g_outputFileName != NULL) {
+        drainOutput();
+    }
+}
+
+/*
+ * Applies the -P, filterspec and -e filters in increasing order of cost,
+ * before anything gets formatted. Returns false if the entry should be
+ * dropped, otherwise 'entry' has been filled in.
+ */
+static bool filterEntry(log_device_t* dev, struct logger_entry *buf,
+        AndroidLogEntry *entry, char *binaryMsgBuf, size_t binaryMsgBufLen)
 {
-    int bytesWritten = 0;
     int err;
-    AndroidLogEntry entry;
-    char binaryMsgBuf[1024];
+
+    if (g_pidFilter >= 0 && buf->pid != g_pidFilter) {
+        return false;
+    }
 
     if (dev->binary) {
-        err = android_log_processBinaryLogBuffer(buf, &entry, g_eventTagMap,
-                binaryMsgBuf, sizeof(binaryMsgBuf));
+        err = android_log_processBinaryLogBuffer(buf, entry, g_eventTagMap,
+                binaryMsgBuf, binaryMsgBufLen);
         //printf(">>> pri=%d len=%d msg='%s'\n",
-        //    entry.priority, entry.messageLen, entry.message);
+        //    entry->priority, entry->messageLen, entry->message);
     } else {
-        err = android_log_processLogBuffer(buf, &entry);
+        err = android_log_processLogBuffer(buf, entry);
     }
     if (err < 0) {
-        goto error;
+        //fprintf (stderr, "Error processing record\n");
+        return false;
+    }
+
+    if (!android_log_shouldPrintLine(g_logformat, entry->tag, entry->priority)) {
+        return false;
     }
 
-    if (android_log_shouldPrintLine(g_logformat, entry.tag, entry.priority)) {
+    // both kinds of message are NUL terminated, see readBatch()
+    if (g_messageFilter != NULL
+            && regexec(g_messageFilter, entry->message, 0, NULL, 0) != 0) {
+        return false;
+    }
+
+    return true;
+}
+
+static void printStreamEntry(log_device_t* dev, struct logger_entry *buf)
+{
+    AndroidLogEntry entry;
+    char binaryMsgBuf[1024];
+    size_t size = sizeof(struct logger_entry) + buf->len;
+
+    if (!filterEntry(dev, buf, &entry, binaryMsgBuf, sizeof(binaryMsgBuf))) {
+        return;
+    }
+
+    if (g_frameLen + 1 + size > sizeof(g_frame)) {
+        flushFrame();
+    }
+    g_frame[g_frameLen++] = dev->index;
+    memcpy(g_frame + g_frameLen, buf, size);
+    g_frameLen += size;
+    g_frameCount++;
+}
+
+static void processBuffer(log_device_t* dev, struct logger_entry *buf)
+{
+    int bytesWritten = 0;
+    AndroidLogEntry entry;
+    char binaryMsgBuf[1024];
+
+    if (filterEntry(dev, buf, &entry, binaryMsgBuf, sizeof(binaryMsgBuf))) {
         if (false && g_devCount > 1) {
             binaryMsgBuf[0] = dev->label;
             binaryMsgBuf[1] = ' ';
-            bytesWritten = write(g_outFD, binaryMsgBuf, 2);
+            bytesWritten = android_log_writeToBuffer(&g_outBuffer, binaryMsgBuf, 2);
             if (bytesWritten < 0) {
                 perror("output error");
                 exit(-1);
             }
         }
 
-        bytesWritten = android_log_printLogLine(g_logformat, g_outFD, &entry);
+        bytesWritten = android_log_bufferLogLine(g_logformat, &g_outBuffer, &entry);
 
         if (bytesWritten < 0) {
             perror("output error");
@@ -202,27 +608,71 @@ static void processBuffer(log_device_t* dev, struct logger_entry *buf)
     ) {
         rotateLogs();
     }
+}
 
-error:
-    //fprintf (stderr, "Error processing record\n");
-    return;
+/*
+ * The devices with queued entries are merged through a binary min-heap
+ * keyed on the oldest entry of each queue. The heap is rebuilt after
+ * every read pass and stays valid while entries are only removed.
+ */
+struct device_heap_t {
+    log_device_t** devs;
+    int count;
+};
+
+static void heapSiftDown(device_heap_t* heap, int i) {
+    log_device_t** devs = heap->devs;
+    while (true) {
+        int least = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < heap->count && cmp(devs[l]->queue, devs[least]->queue) < 0) {
+            least = l;
+        }
+        if (r < heap->count && cmp(devs[r]->queue, devs[least]->queue) < 0) {
+            least = r;
+        }
+        if (least == i) {
+            break;
+        }
+        log_device_t* tmp = devs[i];
+        devs[i] = devs[least];
+        devs[least] = tmp;
+        i = least;
+    }
 }
 
-static void chooseFirst(log_device_t* dev, log_device_t** firstdev) {
-    for (*firstdev = NULL; dev != NULL; dev = dev->next) {
-        if (dev->queue != NULL && (*firstdev == NULL || cmp(dev->queue, (*firstdev)->queue) < 0)) {
-            *firstdev = dev;
+static void heapBuild(device_heap_t* heap, log_device_t* devices) {
+    heap->count = 0;
+    for (log_device_t* dev = devices; dev; dev = dev->next) {
+        if (dev->queue != NULL) {
+            heap->devs[heap->count++] = dev;
         }
     }
+    for (int i = heap->count / 2 - 1; i >= 0; i--) {
+        heapSiftDown(heap, i);
+    }
+}
+
+static log_device_t* heapFirst(device_heap_t* heap) {
+    return heap->count ? heap->devs[0] : NULL;
+}
+
+// restores the heap after the first device's queue lost its head
+static void heapUpdateFirst(device_heap_t* heap) {
+    if (heap->devs[0]->queue == NULL) {
+        heap->devs[0] = heap->devs[--heap->count];
+    }
+    heapSiftDown(heap, 0);
 }
 
 static void maybePrintStart(log_device_t* dev) {
     if (!dev->printed) {
         dev->printed = true;
-        if (g_devCount > 1 && !g_printBinary) {
+        if (g_devCount > 1 && !g_printBinary && !g_printStream) {
             char buf[1024];
             snprintf(buf, sizeof(buf), "--------- beginning of %s\n", dev->device);
-            if (write(g_outFD, buf, strlen(buf)) < 0) {
+            if (android_log_writeToBuffer(&g_outBuffer, buf, strlen(buf)) < 0) {
                 perror("output error");
                 exit(-1);
             }
@@ -232,36 +682,82 @@ static void maybePrintStart(log_device_t* dev) {
 
 static void skipNextEntry(log_device_t* dev) {
     maybePrintStart(dev);
-    queued_entry_t* entry = dev->queue;
-    dev->queue = entry->next;
-    delete entry;
+    freeEntry(dev->dequeue());
 }
 
 static void printNextEntry(log_device_t* dev) {
     maybePrintStart(dev);
     if (g_printBinary) {
         printBinary(&dev->queue->entry);
+    } else if (g_printStream) {
+        printStreamEntry(dev, &dev->queue->entry);
     } else {
         processBuffer(dev, &dev->queue->entry);
     }
     skipNextEntry(dev);
 }
 
+/*
+ * Reads up to READ_BATCH_ENTRIES entries from a device, returns the number
+ * of entries queued. The device must be in non-blocking mode.
+ */
+static int readBatch(log_device_t* dev)
+{
+    int count = 0;
+
+    while (count < READ_BATCH_ENTRIES) {
+        queued_entry_t* entry = allocEntry();
+        /* NOTE: driver guarantees we read exactly one full entry */
+        int ret = read(dev->fd, entry->buf, LOGGER_ENTRY_MAX_LEN);
+        if (ret < 0) {
+            freeEntry(entry);
+            if (errno == EINTR || errno == EAGAIN) {
+                break;
+            }
+            perror("logcat read");
+            exit(EXIT_FAILURE);
+        }
+        else if (!ret) {
+            fprintf(stderr, "read: Unexpected EOF!\n");
+            exit(EXIT_FAILURE);
+        }
+        else if (entry->entry.len != ret - sizeof(struct logger_entry)) {
+            fprintf(stderr, "read: unexpected length. Expected %d, got %d\n",
+                    entry->entry.len, ret - sizeof(struct logger_entry));
+            exit(EXIT_FAILURE);
+        }
+
+        entry->entry.msg[entry->entry.len] = '\0';
+
+        dev->enqueue(entry);
+        ++count;
+    }
+    return count;
+}
+
 static void readLogLines(log_device_t* devices)
 {
     log_device_t* dev;
     int max = 0;
-    int ret;
     int queued_lines = 0;
     bool sleep = false;
+    device_heap_t heap;
 
     int result;
     fd_set readset;
 
+    heap.devs = new log_device_t*[g_devCount];
+    heap.count = 0;
+    g_streamDevices = devices;
+
     for (dev=devices; dev; dev = dev->next) {
+        dev->index = heap.count++;
         if (dev->fd > max) {
             max = dev->fd;
         }
+        // select() tells us when a device has data, reads in a batch
+        // stop at the first EAGAIN
+        fcntl(dev->fd, F_SETFL, fcntl(dev->fd, F_GETFL) | O_NONBLOCK);
     }
 
     while (1) {
@@ -277,64 +773,37 @@ static void readLogLines(log_device_t* devices)
         if (result >= 0) {
             for (dev=devices; dev; dev = dev->next) {
                 if (FD_ISSET(dev->fd, &readset)) {
-                    queued_entry_t* entry = new queued_entry_t();
-                    /* NOTE: driver guarantees we read exactly one full entry */
-                    ret = read(dev->fd, entry->buf, LOGGER_ENTRY_MAX_LEN);
-                    if (ret < 0) {
-                        if (errno == EINTR) {
-                            delete entry;
-                            goto next;
-                        }
-                        if (errno == EAGAIN) {
-                            delete entry;
-                            break;
-                        }
-                        perror("logcat read");
-                        exit(EXIT_FAILURE);
-                    }
-                    else if (!ret) {
-                        fprintf(stderr, "read: Unexpected EOF!\n");
-                        exit(EXIT_FAILURE);
-                    }
-                    else if (entry->entry.len != ret - sizeof(struct logger_entry)) {
-                        fprintf(stderr, "read: unexpected length. Expected %d, got %d\n",
-                                entry->entry.len, ret - sizeof(struct logger_entry));
-                        exit(EXIT_FAILURE);
-                    }
-
-                    entry->entry.msg[entry->entry.len] = '\0';
-
-                    dev->enqueue(entry);
-                    ++queued_lines;
+                    queued_lines += readBatch(dev);
                 }
             }
 
+            heapBuild(&heap, devices);
+
             if (result == 0) {
                 // we did our short timeout trick and there's nothing new
                 // print everything we have and wait for more data
                 sleep = true;
-                while (true) {
-                    chooseFirst(devices, &dev);
-                    if (dev == NULL) {
-                        break;
-                    }
+                while ((dev = heapFirst(&heap)) != NULL) {
                     if (g_tail_lines == 0 || queued_lines <= g_tail_lines) {
                         printNextEntry(dev);
                     } else {
                         skipNextEntry(dev);
                     }
+                    heapUpdateFirst(&heap);
                     --queued_lines;
                 }
 
                 // the caller requested to just dump the log and exit
                 if (g_nonblock) {
+                    finishOutput();
+                    delete[] heap.devs;
                     return;
                 }
             } else {
                 // print all that aren't the last in their list
                 sleep = false;
                 while (g_tail_lines == 0 || queued_lines > g_tail_lines) {
-                    chooseFirst(devices, &dev);
+                    dev = heapFirst(&heap);
                     if (dev == NULL || dev->queue->next == NULL) {
                         break;
                     }
@@ -343,12 +812,17 @@ static void readLogLines(log_device_t* devices)
                     } else {
                         skipNextEntry(dev);
                     }
+                    heapUpdateFirst(&heap);
                     --queued_lines;
                 }
             }
+
+            // when following the log, don't hold output back between
+            // wakeups; a dump only needs it written by the time we exit
+            if (!g_nonblock) {
+                flushOutput();
+            }
         }
-next:
-        ;
     }
 }
 
@@ -389,6 +863,24 @@ static void setupOutput()
 
         g_outByteCount = statbuf.st_size;
     }
+
+    if (g_outputFileName == NULL) {
+        android_log_initWriteBuffer(&g_outBuffer, g_outFD);
+    } else {
+        pthread_t thread;
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, writerThread, NULL) != 0) {
+            perror("couldn't start writer thread");
+            exit(-1);
+        }
+        pthread_attr_destroy(&attr);
+        android_log_initWriteBufferFunc(&g_outBuffer, queueOutput, NULL);
+    }
+    // when appending to an earlier -F file it already has a header
+    g_streamNeedsHeader = (g_outByteCount == 0);
 }
 
 static void show_help(const char *cmd)
@@ -401,6 +893,7 @@ static void show_help(const char *cmd)
                     "  -f <filename>   Log to file. Default to stdout\n"
                     "  -r [<kbytes>]   Rotate log every kbytes. (16 if unspecified). Requires -f\n"
                     "  -n <count>      Sets max number of rotated logs to <count>, default 4\n"
+                    "  -z              gzip rotated logs. Requires -r\n"
                     "  -v <format>     Sets the log print format, where <format> is one of:\n\n"
                     "                  brief process tag thread raw time threadtime long\n\n"
                     "  -c              clear (flush) the entire log and exit\n"
@@ -410,7 +903,12 @@ static void show_help(const char *cmd)
                     "  -b <buffer>     Request alternate ring buffer, 'main', 'system', 'radio'\n"
                     "                  or 'events'. Multiple -b parameters are allowed and the\n"
                     "                  results are interleaved. The default is -b main -b system.\n"
-                    "  -B              output the log in binary");
+                    "  -B              output the log in binary\n"
+                    "  -F              output a framed binary stream of the filtered log,\n"
+                    "                  see log/logcat_stream.h\n"
+                    "  -P <pid>        only print entries logged by process <pid>\n"
+                    "  -e <regex>      only print entries whose message matches the\n"
+                    "                  extended regular expression <regex>");
 
 
     fprintf(stderr,"\nfilterspecs are a series of \n"
@@ -481,7 +979,7 @@ int main(int argc, char **argv)
     for (;;) {
         int ret;
 
-        ret = getopt(argc, argv, "cdt:gsQf:r::n:v:b:B");
+        ret = getopt(argc, argv, "cdt:gsQf:r::n:zv:b:BFP:e:");
 
         if (ret < 0) {
             break;
@@ -538,6 +1036,32 @@ int main(int argc, char **argv)
                 android::g_printBinary = 1;
             break;
 
+            case 'F':
+                android::g_printStream = true;
+            break;
+
+            case 'P':
+                if (!isdigit(optarg[0])) {
+                    fprintf(stderr,"Invalid parameter to -P\n");
+                    android::show_help(argv[0]);
+                    exit(-1);
+                }
+                android::g_pidFilter = atoi(optarg);
+            break;
+
+            case 'e': {
+                regex_t* re = new regex_t;
+                err = regcomp(re, optarg, REG_EXTENDED | REG_NOSUB);
+                if (err != 0) {
+                    char msg[256];
+                    regerror(err, re, msg, sizeof(msg));
+                    fprintf(stderr,"Invalid parameter to -e: %s\n", msg);
+                    exit(-1);
+                }
+                android::g_messageFilter = re;
+            }
+            break;
+
             case 'f':
                 // redirect output to a file
 
@@ -572,6 +1096,10 @@ int main(int argc, char **argv)
                 android::g_maxRotatedLogs = atoi(optarg);
             break;
 
+            case 'z':
+                android::g_compressRotated = true;
+            break;
+
             case 'v':
                 err = setLogFormat (optarg);
                 if (err < 0) {
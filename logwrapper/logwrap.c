@@ -36,7 +36,16 @@
 #define ARRAY_SIZE(x)   (sizeof(x) / sizeof(*(x)))
 #define MIN(a,b) (((a)<(b))?(a):(b))
 
+/*
+ * fd_mutex is only held while the child is set up and forked, so that a
+ * child never inherits the pty of another thread's child, and while the
+ * SIGINT and SIGQUIT actions are changed.  Several children can then be
+ * logged at once, from different threads.
+ */
 static pthread_mutex_t fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int ignore_int_quit_count;
+static struct sigaction saved_intact;
+static struct sigaction saved_quitact;
 
 #define ERROR(fmt, args...)                                                   \
 do {                                                                          \
@@ -44,14 +53,17 @@ do {                                                                          \
     ALOG(LOG_ERROR, "logwrapper", fmt, ## args);                              \
 } while(0)
 
-#define FATAL_CHILD(fmt, args...)                                             \
-do {                                                                          \
-    ERROR(fmt, ## args);                                                      \
-    _exit(-1);                                                                \
-} while(0)
-
 #define MAX_KLOG_TAG 16
 
+/* The child's output is read this much at a time. */
+#define READ_BUF_SIZE 0x4000
+
+/* Longer lines are logged in pieces this long, which fit in a log entry. */
+#define MAX_LINE_LEN 0x0fff
+
+/* How much of the LOG_FILE output stdio holds before writing it out */
+#define FILE_BUF_SIZE 0x10000
+
 /* This is a simple buffer that holds up to the first beginning_buf->buf_size
  * bytes of output from a command.
  */
@@ -163,7 +175,8 @@ static void do_log_line(struct log_info *log_info, char *line) {
         klog_write(6, log_info->klog_fmt, line);
     }
     if (log_info->log_target & LOG_ALOG) {
-        ALOG(LOG_INFO, log_info->btag, "%s", line);
+        /* The line is the message, there is nothing to format. */
+        __android_log_write(ANDROID_LOG_INFO, log_info->btag, line);
     }
     if (log_info->log_target & LOG_FILE) {
         fprintf(log_info->fp, "%s\n", line);
@@ -297,7 +310,7 @@ static void print_abbr_buf(struct log_info *log_info) {
 static int parent(const char *tag, int parent_read, pid_t pid,
         int *chld_sts, int log_target, bool abbreviated, char *file_path) {
     int status = 0;
-    char buffer[4096];
+    char buffer[READ_BUF_SIZE];
     struct pollfd poll_fds[] = {
         [0] = {
             .fd = parent_read,
@@ -338,13 +351,19 @@ static int parent(const char *tag, int parent_read, pid_t pid,
     }
 
     if (log_target & LOG_FILE) {
-        fd = open(file_path, O_WRONLY | O_CREAT, 0664);
+        fd = open(file_path, O_WRONLY | O_CREAT | O_APPEND, 0664);
         if (fd < 0) {
             ERROR("Cannot log to file %s\n", file_path);
             log_target &= ~LOG_FILE;
         } else {
             lseek(fd, 0, SEEK_END);
             log_info.fp = fdopen(fd, "a");
+            if (!log_info.fp) {
+                close(fd);
+                log_target &= ~LOG_FILE;
+            } else {
+                setvbuf(log_info.fp, NULL, _IOFBF, FILE_BUF_SIZE);
+            }
         }
     }
 
@@ -360,10 +379,22 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
         if (poll_fds[0].revents & POLLIN) {
             sz = read(parent_read, &buffer[b], sizeof(buffer) - 1 - b);
+            if (sz < 0) {
+                /* EIO once the child's side is closed, POLLHUP follows */
+                sz = 0;
+            }
 
             sz += b;
-            // Log one line at a time
-            for (b = 0; b < sz; b++) {
+            // Log one line at a time, from where the last read stopped
+            for (; b < sz; b++) {
+                if (b - a == MAX_LINE_LEN) {
+                    // too long for one entry, log what we have so far
+                    char c = buffer[b];
+                    buffer[b] = '\0';
+                    log_line(&log_info, &buffer[a], b - a);
+                    buffer[b] = c;
+                    a = b;
+                }
                 if (buffer[b] == '\r') {
                     if (abbreviated) {
                         /* The abbreviated logging code uses newline as
@@ -384,12 +415,8 @@ static int parent(const char *tag, int parent_read, pid_t pid,
                 }
             }
 
-            if (a == 0 && b == sizeof(buffer) - 1) {
-                // buffer is full, flush
-                buffer[b] = '\0';
-                log_line(&log_info, &buffer[a], b - a);
-                b = 0;
-            } else if (a != b) {
+            // What is left is at most MAX_LINE_LEN, so a read always fits
+            if (a != b) {
                 // Keep left-overs
                 b -= a;
                 memmove(buffer, &buffer[a], b);
@@ -400,7 +427,8 @@ static int parent(const char *tag, int parent_read, pid_t pid,
             }
         }
 
-        if (poll_fds[0].revents & POLLHUP) {
+        /* Only once everything the child wrote has been read */
+        if ((poll_fds[0].revents & POLLHUP) && !(poll_fds[0].revents & POLLIN)) {
             int ret;
 
             ret = waitpid(pid, &status, WNOHANG);
@@ -464,29 +492,22 @@ err_poll:
     return rc;
 }
 
-static void child(int argc, char* argv[]) {
-    // create null terminated argv_child array
-    char* argv_child[argc + 1];
-    memcpy(argv_child, argv, argc * sizeof(char *));
-    argv_child[argc] = NULL;
-
-    if (execvp(argv_child[0], argv_child)) {
-        FATAL_CHILD("executing %s failed: %s\n", argv_child[0],
-                strerror(errno));
-    }
-}
-
 int android_fork_execvp_ext(int argc, char* argv[], int *status, bool ignore_int_quit,
         int log_target, bool abbreviated, char *file_path) {
     pid_t pid;
     int parent_ptty;
     int child_ptty;
     char *child_devname = NULL;
-    struct sigaction intact;
-    struct sigaction quitact;
     sigset_t blockset;
     sigset_t oldset;
     int rc = 0;
+    /* Set by the vfork()ed child, which shares our memory until it execs. */
+    volatile int exec_errno = 0;
+
+    // create null terminated argv_child array
+    char* argv_child[argc + 1];
+    memcpy(argv_child, argv, argc * sizeof(char *));
+    argv_child[argc] = NULL;
 
     rc = pthread_mutex_lock(&fd_mutex);
     if (rc) {
@@ -501,6 +522,7 @@ int android_fork_execvp_ext(int argc, char* argv[], int *status, bool ignore_int
         rc = -1;
         goto err_open;
     }
+    fcntl(parent_ptty, F_SETFD, FD_CLOEXEC);
 
     if (grantpt(parent_ptty) || unlockpt(parent_ptty) ||
             ((child_devname = (char*)ptsname(parent_ptty)) == 0)) {
@@ -521,42 +543,54 @@ int android_fork_execvp_ext(int argc, char* argv[], int *status, bool ignore_int
     sigaddset(&blockset, SIGQUIT);
     pthread_sigmask(SIG_BLOCK, &blockset, &oldset);
 
-    pid = fork();
+    /*
+     * vfork() saves copying the page tables of a large caller (vold, init)
+     * just to exec.  The child runs in our memory and with our fd_mutex
+     * held, so it only sets up its fds and signal mask and execs: parent's
+     * pty is close-on-exec, and a failed exec is reported from here.
+     */
+    pid = vfork();
     if (pid < 0) {
         close(child_ptty);
         ERROR("Failed to fork\n");
         rc = -1;
         goto err_fork;
     } else if (pid == 0) {
-        pthread_mutex_unlock(&fd_mutex);
-        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
-        close(parent_ptty);
-
         // redirect stdout and stderr
         dup2(child_ptty, 1);
         dup2(child_ptty, 2);
         close(child_ptty);
+        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 
-        child(argc, argv);
+        execvp(argv_child[0], argv_child);
+        exec_errno = errno;
+        _exit(-1);
     } else {
         close(child_ptty);
-        if (ignore_int_quit) {
+        if (exec_errno) {
+            ERROR("executing %s failed: %s\n", argv_child[0],
+                    strerror(exec_errno));
+        }
+        if (ignore_int_quit && ignore_int_quit_count++ == 0) {
             struct sigaction ignact;
 
             memset(&ignact, 0, sizeof(ignact));
             ignact.sa_handler = SIG_IGN;
-            sigaction(SIGINT, &ignact, &intact);
-            sigaction(SIGQUIT, &ignact, &quitact);
+            sigaction(SIGINT, &ignact, &saved_intact);
+            sigaction(SIGQUIT, &ignact, &saved_quitact);
         }
+        pthread_mutex_unlock(&fd_mutex);
 
         rc = parent(argv[0], parent_ptty, pid, status, log_target,
                     abbreviated, file_path);
-    }
 
-    if (ignore_int_quit) {
-        sigaction(SIGINT, &intact, NULL);
-        sigaction(SIGQUIT, &quitact, NULL);
+        pthread_mutex_lock(&fd_mutex);
+        if (ignore_int_quit && --ignore_int_quit_count == 0) {
+            sigaction(SIGINT, &saved_intact, NULL);
+            sigaction(SIGQUIT, &saved_quitact, NULL);
+        }
     }
+
 err_fork:
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 err_child_ptty:
@@ -25,34 +25,54 @@
 #include "mincrypt/sha.h"
 #include "bootimg.h"
 
-static void *load_file(const char *fn, unsigned *_sz)
+static int write_all(int fd, const void *data, unsigned sz)
 {
-    char *data;
-    int sz;
-    int fd;
-
-    data = 0;
-    fd = open(fn, O_RDONLY);
-    if(fd < 0) return 0;
-
-    sz = lseek(fd, 0, SEEK_END);
-    if(sz < 0) goto oops;
+    const char *p = data;
+    while(sz > 0) {
+        ssize_t n = write(fd, p, sz);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        sz -= n;
+    }
+    return 0;
+}
 
-    if(lseek(fd, 0, SEEK_SET) != 0) goto oops;
+static char buffer[1024 * 1024];
 
-    data = (char*) malloc(sz);
-    if(data == 0) goto oops;
+/* copies the file to out, adding its contents to the hash as they
+ * go by, so it never has to be in memory all at once.
+ */
+static int copy_file(int out, const char *fn, SHA_CTX *ctx, unsigned *_sz)
+{
+    unsigned sz = 0;
+    ssize_t n;
+    int fd;
 
-    if(read(fd, data, sz) != sz) goto oops;
+    fd = open(fn, O_RDONLY);
+    if(fd < 0) return -1;
+
+    for(;;) {
+        n = read(fd, buffer, sizeof(buffer));
+        if(n == 0) break;
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            goto oops;
+        }
+        SHA_update(ctx, buffer, n);
+        if(write_all(out, buffer, n)) goto oops;
+        sz += n;
+    }
     close(fd);
 
     if(_sz) *_sz = sz;
-    return data;
+    return 0;
 
 oops:
     close(fd);
-    if(data != 0) free(data);
-    return 0;
+    return -1;
 }
 
 int usage(void)
@@ -85,11 +105,7 @@ int write_padding(int fd, unsigned pagesize, unsigned itemsize)
 
     count = pagesize - (itemsize & pagemask);
 
-    if(write(fd, padding, count) != count) {
-        return -1;
-    } else {
-        return 0;
-    }
+    return write_all(fd, padding, count);
 }
 
 int main(int argc, char **argv)
@@ -97,11 +113,8 @@ int main(int argc, char **argv)
     boot_img_hdr hdr;
 
     char *kernel_fn = 0;
-    void *kernel_data = 0;
     char *ramdisk_fn = 0;
-    void *ramdisk_data = 0;
     char *second_fn = 0;
-    void *second_data = 0;
     char *cmdline = "";
     char *bootimg = 0;
     char *board = "";
@@ -198,71 +211,63 @@ int main(int argc, char **argv)
     }
     strcpy((char*)hdr.cmdline, cmdline);
 
-    kernel_data = load_file(kernel_fn, &hdr.kernel_size);
-    if(kernel_data == 0) {
-        fprintf(stderr,"error: could not load kernel '%s'\n", kernel_fn);
+    fd = open(bootimg, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if(fd < 0) {
+        fprintf(stderr,"error: could not create '%s'\n", bootimg);
         return 1;
     }
 
+    /* the images are copied in a single pass, the header is written
+     * again at the end once their sizes and hash are known.
+     */
+    if(write_all(fd, &hdr, sizeof(hdr))) goto fail;
+    if(write_padding(fd, pagesize, sizeof(hdr))) goto fail;
+
+    /* put a hash of the contents in the header so boot images can be
+     * differentiated based on their first 2k.
+     */
+    SHA_init(&ctx);
+
+    if(copy_file(fd, kernel_fn, &ctx, &hdr.kernel_size)) {
+        fprintf(stderr,"error: could not load kernel '%s'\n", kernel_fn);
+        goto oops;
+    }
+    SHA_update(&ctx, &hdr.kernel_size, sizeof(hdr.kernel_size));
+    if(write_padding(fd, pagesize, hdr.kernel_size)) goto fail;
+
     if(!strcmp(ramdisk_fn,"NONE")) {
-        ramdisk_data = 0;
         hdr.ramdisk_size = 0;
-    } else {
-        ramdisk_data = load_file(ramdisk_fn, &hdr.ramdisk_size);
-        if(ramdisk_data == 0) {
-            fprintf(stderr,"error: could not load ramdisk '%s'\n", ramdisk_fn);
-            return 1;
-        }
+    } else if(copy_file(fd, ramdisk_fn, &ctx, &hdr.ramdisk_size)) {
+        fprintf(stderr,"error: could not load ramdisk '%s'\n", ramdisk_fn);
+        goto oops;
     }
+    SHA_update(&ctx, &hdr.ramdisk_size, sizeof(hdr.ramdisk_size));
+    if(write_padding(fd, pagesize, hdr.ramdisk_size)) goto fail;
 
     if(second_fn) {
-        second_data = load_file(second_fn, &hdr.second_size);
-        if(second_data == 0) {
+        if(copy_file(fd, second_fn, &ctx, &hdr.second_size)) {
             fprintf(stderr,"error: could not load secondstage '%s'\n", second_fn);
-            return 1;
+            goto oops;
         }
+        if(write_padding(fd, pagesize, hdr.second_size)) goto fail;
     }
-
-    /* put a hash of the contents in the header so boot images can be
-     * differentiated based on their first 2k.
-     */
-    SHA_init(&ctx);
-    SHA_update(&ctx, kernel_data, hdr.kernel_size);
-    SHA_update(&ctx, &hdr.kernel_size, sizeof(hdr.kernel_size));
-    SHA_update(&ctx, ramdisk_data, hdr.ramdisk_size);
-    SHA_update(&ctx, &hdr.ramdisk_size, sizeof(hdr.ramdisk_size));
-    SHA_update(&ctx, second_data, hdr.second_size);
     SHA_update(&ctx, &hdr.second_size, sizeof(hdr.second_size));
+
     sha = SHA_final(&ctx);
     memcpy(hdr.id, sha,
            SHA_DIGEST_SIZE > sizeof(hdr.id) ? sizeof(hdr.id) : SHA_DIGEST_SIZE);
 
-    fd = open(bootimg, O_CREAT | O_TRUNC | O_WRONLY, 0644);
-    if(fd < 0) {
-        fprintf(stderr,"error: could not create '%s'\n", bootimg);
-        return 1;
-    }
-
-    if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) goto fail;
-    if(write_padding(fd, pagesize, sizeof(hdr))) goto fail;
-
-    if(write(fd, kernel_data, hdr.kernel_size) != hdr.kernel_size) goto fail;
-    if(write_padding(fd, pagesize, hdr.kernel_size)) goto fail;
-
-    if(write(fd, ramdisk_data, hdr.ramdisk_size) != hdr.ramdisk_size) goto fail;
-    if(write_padding(fd, pagesize, hdr.ramdisk_size)) goto fail;
-
-    if(second_data) {
-        if(write(fd, second_data, hdr.second_size) != hdr.second_size) goto fail;
-        if(write_padding(fd, pagesize, hdr.ramdisk_size)) goto fail;
-    }
+    if(lseek(fd, 0, SEEK_SET) != 0) goto fail;
+    if(write_all(fd, &hdr, sizeof(hdr))) goto fail;
 
+    close(fd);
     return 0;
 
 fail:
-    unlink(bootimg);
-    close(fd);
     fprintf(stderr,"error: failed writing '%s': %s\n", bootimg,
             strerror(errno));
+oops:
+    unlink(bootimg);
+    close(fd);
     return 1;
 }
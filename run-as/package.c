@@ -16,6 +16,7 @@
 */
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -127,8 +128,12 @@ map_file(const char* filename, size_t* filesize)
         goto EXIT;
     }
 
-    /* Memory-map the file now */
-    address = TEMP_FAILURE_RETRY(mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0));
+    /* Memory-map the file now. It is going to be read from the start
+     * until the package is found, so populate the mapping in one go
+     * rather than taking a page fault every 4K.
+     */
+    address = TEMP_FAILURE_RETRY(mmap(NULL, length, PROT_READ,
+                                      MAP_PRIVATE | MAP_POPULATE, fd, 0));
     if (address == MAP_FAILED) {
         address = NULL;
         goto EXIT;
@@ -302,10 +307,13 @@ skip_non_spaces(const char* p, const char* end)
 static const char*
 find_first(const char* p, const char* end, char ch)
 {
-    while (p < end && *p != ch)
-        p++;
+    const char* q;
 
-    return p;
+    if (p >= end)
+        return end;
+
+    q = memchr(p, ch, end - p);
+    return (q != NULL) ? q : end;
 }
 
 /* Check that the non-space string starting at 'p' and eventually
@@ -427,6 +435,7 @@ get_package_info(const char* pkgName, PackageInfo *info)
     size_t       buffer_len;
     const char*  p;
     const char*  buffer_end;
+    size_t       name_len;
     int          result = -1;
 
     info->uid          = 0;
@@ -440,6 +449,7 @@ get_package_info(const char* pkgName, PackageInfo *info)
 
     p          = buffer;
     buffer_end = buffer + buffer_len;
+    name_len   = (pkgName != NULL) ? strlen(pkgName) : 0;
 
     /* expect the following format on each line of the control file:
      *
@@ -462,6 +472,12 @@ get_package_info(const char* pkgName, PackageInfo *info)
         const char*  q;
         int          uid, debugFlag;
 
+        /* most lines are for other packages: reject those with a single
+         * memcmp() before looking at the line any closer. */
+        if (name_len == 0 || (size_t)(end - p) < name_len ||
+            memcmp(p, pkgName, name_len) != 0)
+            goto NEXT_LINE;
+
         /* first field is the package name */
         p = compare_name(p, end, pkgName);
         if (p == NULL)
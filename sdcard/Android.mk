@@ -9,3 +9,14 @@ LOCAL_CFLAGS := -Wall -Wno-unused-parameter
 LOCAL_SHARED_LIBRARIES := libc libcutils
 
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= sdcard_bench.c
+LOCAL_MODULE:= sdcard_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Wall -Wno-unused-parameter
+
+LOCAL_SHARED_LIBRARIES := libc libcutils
+
+include $(BUILD_EXECUTABLE)
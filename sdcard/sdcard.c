@@ -17,6 +17,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -31,6 +33,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/inotify.h>
+#include <sys/syscall.h>
 
 #include <cutils/fs.h>
 #include <cutils/hashmap.h>
@@ -103,8 +106,9 @@
 /* Maximum number of bytes to write in one request. */
 #define MAX_WRITE (256 * 1024)
 
-/* Maximum number of bytes to read in one request. */
-#define MAX_READ (128 * 1024)
+/* Maximum number of bytes to read in one request.  The read buffer shares
+ * its storage with the request buffer, so this costs no extra memory. */
+#define MAX_READ MAX_WRITE
 
 /* Largest possible request.
  * The request size is bounded by the maximum size of a FUSE_WRITE request because it has
@@ -118,6 +122,23 @@
  * or that a reply has already been written. */
 #define NO_STATUS 1
 
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+
+/* Directories with more children than this get a hashed name index. */
+#define CHILD_INDEX_THRESHOLD 64
+
+/* Requests are accounted per opcode; anything above this lands in the last slot. */
+#define STATS_OPCODES 48
+
+/* Latency histogram buckets, bucket n counts requests that took less than
+ * 2^n microseconds; the last bucket is open ended. */
+#define STATS_BUCKETS 20
+
 /* Path to system-provided mapping of package name to appIds */
 static const char* const kPackagesListFile = "/data/system/packages.list";
 
@@ -157,6 +178,8 @@ struct handle {
 
 struct dirhandle {
     DIR *d;
+    /* fuse offset of the entry the next readdir() returns */
+    __u64 next_offset;
 };
 
 struct node {
@@ -170,11 +193,20 @@ struct node {
     uid_t uid;
     gid_t gid;
     mode_t mode;
+    /* fuse->package_generation the state above was derived with */
+    __u32 derived_generation;
 
     struct node *next;          /* per-dir sibling list */
     struct node *child;         /* first contained file by this dir */
     struct node *parent;        /* containing directory */
 
+    /* Index of the children by name, built once a directory has more than
+     * CHILD_INDEX_THRESHOLD of them so that large directories don't turn
+     * every lookup into a walk of the sibling list. */
+    size_t child_count;
+    Hashmap* child_index;
+    bool child_index_dups;      /* some children share a name */
+
     size_t namelen;
     char *name;
     /* If non-null, this is the real name of the file in the underlying storage.
@@ -188,12 +220,23 @@ struct node {
      * position. Used to support things like OBB. */
     char* graft_path;
     size_t graft_pathlen;
+
+    /* Absolute path of the node, filled in on first use by
+     * get_node_path_locked().  Readers may fill it while sharing the lock,
+     * but it is only freed under the exclusive lock, by
+     * invalidate_node_paths_locked() or when the node is destroyed. */
+    char* path;
 };
 
 static int str_hash(void *key) {
     return hashmapHash(key, strlen(key));
 }
 
+/** Test if two string keys are exactly equal */
+static bool str_equals(void *keyA, void *keyB) {
+    return strcmp(keyA, keyB) == 0;
+}
+
 /** Test if two string keys are equal ignoring case */
 static bool str_icase_equals(void *keyA, void *keyB) {
     return strcasecmp(keyA, keyB) == 0;
@@ -209,7 +252,10 @@ static bool int_equals(void *keyA, void *keyB) {
 
 /* Global data structure shared by all fuse handlers. */
 struct fuse {
-    pthread_mutex_t lock;
+    /* Protects the node tree and the package maps.  Handlers that only
+     * resolve nodes and paths take it for reading, so they run in parallel;
+     * creating, renaming and releasing nodes takes it for writing. */
+    pthread_rwlock_t lock;
 
     __u64 next_generation;
     int fd;
@@ -221,6 +267,25 @@ struct fuse {
 
     Hashmap* package_to_appid;
     Hashmap* appid_with_rw;
+
+    /* Negotiated in handle_init() */
+    bool writeback_cache;
+
+    /* Bumped whenever new package maps are swapped in, see
+     * refresh_derived_permissions_locked(). */
+    __u32 package_generation;
+};
+
+/* Counters kept for a single opcode.  Each handler owns its own copy and
+ * only that handler writes it, so no atomics are needed; dumps sum them up. */
+struct op_stats {
+    __u64 count;
+    __u64 errors;
+    __u64 bytes;
+    __u64 total_us;
+    __u64 lock_wait_us;
+    __u64 max_us;
+    __u32 histogram[STATS_BUCKETS];
 };
 
 /* Private data used by a single fuse handler. */
@@ -228,6 +293,16 @@ struct fuse_handler {
     struct fuse* fuse;
     int token;
 
+    /* Time spent waiting for fuse->lock by the request being processed. */
+    __u64 lock_wait_us;
+    struct op_stats stats[STATS_OPCODES];
+
+    /* Pipes used to splice READ replies from the backing file to the fuse
+     * device without copying them through read_buffer.  Both are -1 when
+     * splicing is unavailable and the copying path is used instead. */
+    int splice_data[2];
+    int splice_reply[2];
+
     /* To save memory, we never use the contents of the request buffer and the read
      * buffer at the same time.  This allows us to share the underlying storage. */
     union {
@@ -236,6 +311,49 @@ struct fuse_handler {
     };
 };
 
+/* Handler owning the calling thread, used to charge lock waits to it. */
+static pthread_key_t handler_key;
+
+static __u64 now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__u64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void charge_lock_wait(__u64 start)
+{
+    struct fuse_handler* handler = pthread_getspecific(handler_key);
+    if (handler) {
+        handler->lock_wait_us += now_us() - start;
+    }
+}
+
+/* Take fuse->lock, accounting for the time spent blocked on it.  The
+ * uncontended case stays a single trylock. */
+static void fuse_rdlock(struct fuse* fuse)
+{
+    if (pthread_rwlock_tryrdlock(&fuse->lock)) {
+        __u64 start = now_us();
+        pthread_rwlock_rdlock(&fuse->lock);
+        charge_lock_wait(start);
+    }
+}
+
+static void fuse_wrlock(struct fuse* fuse)
+{
+    if (pthread_rwlock_trywrlock(&fuse->lock)) {
+        __u64 start = now_us();
+        pthread_rwlock_wrlock(&fuse->lock);
+        charge_lock_wait(start);
+    }
+}
+
+static void fuse_unlock(struct fuse* fuse)
+{
+    pthread_rwlock_unlock(&fuse->lock);
+}
+
 static inline void *id_to_ptr(__u64 nid)
 {
     return (void *) (uintptr_t) nid;
@@ -267,6 +385,10 @@ static void release_node_locked(struct node* node)
             memset(node->name, 0xef, node->namelen);
             free(node->name);
             free(node->actual_name);
+            free(node->path);
+            if (node->child_index) {
+                hashmapFree(node->child_index);
+            }
             memset(node, 0xfc, sizeof(*node));
             free(node);
         }
@@ -275,16 +397,60 @@ static void release_node_locked(struct node* node)
     }
 }
 
+static void index_child_locked(struct node *parent, struct node *node) {
+    if (parent->child_index
+            && hashmapPut(parent->child_index, node->name, node) != NULL) {
+        parent->child_index_dups = true;
+    }
+}
+
+static void unindex_child_locked(struct node *parent, struct node *node) {
+    struct node *node2;
+
+    if (!parent->child_index || hashmapGet(parent->child_index, node->name) != node) {
+        return;
+    }
+    hashmapRemove(parent->child_index, node->name);
+    if (parent->child_index_dups) {
+        /* Nodes only share a name after a rename over an existing node;
+         * point the index at the most recent remaining one, which is the
+         * one the sibling list would find first. */
+        for (node2 = parent->child; node2; node2 = node2->next) {
+            if (node2 != node && !strcmp(node2->name, node->name)) {
+                hashmapPut(parent->child_index, node2->name, node2);
+                break;
+            }
+        }
+    }
+}
+
 static void add_node_to_parent_locked(struct node *node, struct node *parent) {
     node->parent = parent;
     node->next = parent->child;
     parent->child = node;
+    parent->child_count++;
+    if (!parent->child_index && parent->child_count > CHILD_INDEX_THRESHOLD) {
+        struct node *node2;
+        parent->child_index = hashmapCreate(parent->child_count * 2, str_hash, str_equals);
+        for (node2 = parent->child; parent->child_index && node2; node2 = node2->next) {
+            /* the list is newest first, and the newest duplicate wins */
+            if (hashmapContainsKey(parent->child_index, node2->name)) {
+                parent->child_index_dups = true;
+            } else {
+                hashmapPut(parent->child_index, node2->name, node2);
+            }
+        }
+    } else {
+        index_child_locked(parent, node);
+    }
     acquire_node_locked(parent);
 }
 
 static void remove_node_from_parent_locked(struct node* node)
 {
     if (node->parent) {
+        unindex_child_locked(node->parent, node);
+        node->parent->child_count--;
         if (node->parent->child == node) {
             node->parent->child = node->parent->child->next;
         } else {
@@ -308,6 +474,16 @@ static void remove_node_from_parent_locked(struct node* node)
 static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize) {
     const char* name;
     size_t namelen;
+    char* cached = node->path;
+    if (cached) {
+        size_t cachedlen = strlen(cached);
+        if (bufsize < cachedlen + 1) {
+            return -1;
+        }
+        memcpy(buf, cached, cachedlen + 1);
+        return cachedlen;
+    }
+
     if (node->graft_path) {
         name = node->graft_path;
         namelen = node->graft_pathlen;
@@ -333,9 +509,27 @@ static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize
     }
 
     memcpy(buf + pathlen, name, namelen + 1); /* include trailing \0 */
+
+    /* Another reader may have raced us to it; the first one wins. */
+    cached = strdup(buf);
+    if (cached && !__sync_bool_compare_and_swap(&node->path, NULL, cached)) {
+        free(cached);
+    }
     return pathlen + namelen;
 }
 
+/* Drops the cached paths of a node and everything below it, after the
+ * node was renamed or moved. */
+static void invalidate_node_paths_locked(struct node* node) {
+    struct node* child;
+
+    free(node->path);
+    node->path = NULL;
+    for (child = node->child; child; child = child->next) {
+        invalidate_node_paths_locked(child);
+    }
+}
+
 /* Finds the absolute path of a file within a given directory.
  * Performs a case-insensitive search for the file and sets the buffer to the path
  * of the first matching file.  If 'search' is zero or if no match is found, sets
@@ -422,6 +616,8 @@ static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
         struct node *node) {
     appid_t appid;
 
+    node->derived_generation = fuse->package_generation;
+
     /* By default, each node inherits from its parent */
     node->perm = PERM_INHERIT;
     node->userid = parent->userid;
@@ -503,6 +699,29 @@ static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
     }
 }
 
+/* Derived permissions are memoized on each node.  Only the ones below
+ * Android/data and Android/obb depend on the package list, but as children
+ * inherit from their parents, any node derived before the package list last
+ * changed is re-derived, top down, the next time it is looked up or stat'ed.
+ * The root is never derived. */
+static void refresh_derived_permissions_locked(struct fuse* fuse, struct node* node) {
+    if (!node->parent || node->derived_generation == fuse->package_generation) {
+        return;
+    }
+    refresh_derived_permissions_locked(fuse, node->parent);
+    derive_permissions_locked(fuse, node->parent, node);
+}
+
+static void refresh_derived_permissions(struct fuse* fuse, struct node* node) {
+    /* racy check first, the generation is only bumped by writers */
+    if (!node->parent || node->derived_generation == fuse->package_generation) {
+        return;
+    }
+    fuse_wrlock(fuse);
+    refresh_derived_permissions_locked(fuse, node);
+    fuse_unlock(fuse);
+}
+
 /* Return if the calling UID holds sdcard_rw. */
 static bool get_caller_has_rw_locked(struct fuse* fuse, const struct fuse_in_header *hdr) {
     /* No additional permissions enforcement */
@@ -656,6 +875,9 @@ static struct node* lookup_node_and_path_by_id_locked(struct fuse* fuse, __u64 n
 
 static struct node *lookup_child_by_name_locked(struct node *node, const char *name)
 {
+    if (node->child_index) {
+        return hashmapGet(node->child_index, (void*) name);
+    }
     for (node = node->child; node; node = node->next) {
         /* use exact string comparison, nodes that differ by case
          * must be considered distinct even if they refer to the same
@@ -683,13 +905,15 @@ static struct node* acquire_or_create_child_locked(
 
 static void fuse_init(struct fuse *fuse, int fd, const char *source_path,
         gid_t write_gid, derive_t derive, bool split_perms) {
-    pthread_mutex_init(&fuse->lock, NULL);
+    pthread_rwlock_init(&fuse->lock, NULL);
 
     fuse->fd = fd;
     fuse->next_generation = 0;
     fuse->derive = derive;
     fuse->split_perms = split_perms;
     fuse->write_gid = write_gid;
+    fuse->writeback_cache = false;
+    fuse->package_generation = 0;
 
     memset(&fuse->root, 0, sizeof(fuse->root));
     fuse->root.nid = FUSE_ROOT_ID; /* 1 */
@@ -763,31 +987,64 @@ static void fuse_reply(struct fuse *fuse, __u64 unique, void *data, int len)
     }
 }
 
+/* Looks up or creates the child node for an entry that exists on disk with
+ * attributes s, takes a lookup reference on it on behalf of the kernel, and
+ * fills in the entry reply. */
+static int fill_entry(struct fuse* fuse, struct fuse_entry_out* out,
+        struct node* parent, const char* name, const char* actual_name,
+        const struct stat* s)
+{
+    struct node* node;
+
+    /* Most lookups find a node that already exists, which only needs a
+     * reference and can be done while sharing the lock with other readers.
+     * References are only dropped by writers, so an atomic increment is
+     * enough here. */
+    fuse_rdlock(fuse);
+    node = lookup_child_by_name_locked(parent, name);
+    if (node) {
+        __sync_fetch_and_add(&node->refcount, 1);
+        TRACE("ACQUIRE %p (%s) shared\n", node, node->name);
+    } else {
+        fuse_unlock(fuse);
+        fuse_wrlock(fuse);
+        node = acquire_or_create_child_locked(fuse, parent, name, actual_name);
+        if (!node) {
+            fuse_unlock(fuse);
+            return -ENOMEM;
+        }
+    }
+    if (node->derived_generation != fuse->package_generation) {
+        /* we hold a reference, so the node stays put while we relock */
+        fuse_unlock(fuse);
+        fuse_wrlock(fuse);
+        refresh_derived_permissions_locked(fuse, node);
+    }
+    memset(out, 0, sizeof(*out));
+    attr_from_stat(&out->attr, s, node);
+    out->attr_valid = 10;
+    out->entry_valid = 10;
+    out->nodeid = node->nid;
+    out->generation = node->gen;
+    fuse_unlock(fuse);
+    return 0;
+}
+
 static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
         struct node* parent, const char* name, const char* actual_name,
         const char* path)
 {
-    struct node* node;
     struct fuse_entry_out out;
     struct stat s;
+    int res;
 
     if (lstat(path, &s) < 0) {
         return -errno;
     }
-
-    pthread_mutex_lock(&fuse->lock);
-    node = acquire_or_create_child_locked(fuse, parent, name, actual_name);
-    if (!node) {
-        pthread_mutex_unlock(&fuse->lock);
-        return -ENOMEM;
+    res = fill_entry(fuse, &out, parent, name, actual_name, &s);
+    if (res < 0) {
+        return res;
     }
-    memset(&out, 0, sizeof(out));
-    attr_from_stat(&out.attr, &s, node);
-    out.attr_valid = 10;
-    out.entry_valid = 10;
-    out.nodeid = node->nid;
-    out.generation = node->gen;
-    pthread_mutex_unlock(&fuse->lock);
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
@@ -816,12 +1073,12 @@ static int handle_lookup(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] LOOKUP %s @ %llx (%s)\n", handler->token, name, hdr->nodeid,
         parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -839,7 +1096,7 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
 {
     struct node* node;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_wrlock(fuse);
     node = lookup_node_by_id_locked(fuse, hdr->nodeid);
     TRACE("[%d] FORGET #%lld @ %llx (%s)\n", handler->token, req->nlookup,
             hdr->nodeid, node ? node->name : "?");
@@ -849,7 +1106,36 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
             release_node_locked(node);
         }
     }
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
+    return NO_STATUS; /* no reply */
+}
+
+static int handle_batch_forget(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header *hdr, const struct fuse_batch_forget_in *req,
+        size_t data_len)
+{
+    const struct fuse_forget_one *forget = (const void *) (req + 1);
+    __u32 count = req->count;
+    __u32 i;
+
+    if (data_len < sizeof(*req)
+            || count > (data_len - sizeof(*req)) / sizeof(*forget)) {
+        ERROR("[%d] BATCH_FORGET: truncated request\n", handler->token);
+        return NO_STATUS; /* no reply */
+    }
+
+    fuse_wrlock(fuse);
+    TRACE("[%d] BATCH_FORGET %u\n", handler->token, count);
+    for (i = 0; i < count; i++) {
+        struct node* node = lookup_node_by_id_locked(fuse, forget[i].nodeid);
+        if (node) {
+            __u64 n = forget[i].nlookup;
+            while (n--) {
+                release_node_locked(node);
+            }
+        }
+    }
+    fuse_unlock(fuse);
     return NO_STATUS; /* no reply */
 }
 
@@ -859,15 +1145,16 @@ static int handle_getattr(struct fuse* fuse, struct fuse_handler* handler,
     struct node* node;
     char path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] GETATTR flags=%x fh=%llx @ %llx (%s)\n", handler->token,
             req->getattr_flags, req->fh, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!node) {
         return -ENOENT;
     }
+    refresh_derived_permissions(fuse, node);
     if (!check_caller_access_to_node(fuse, hdr, node, R_OK, false)) {
         return -EACCES;
     }
@@ -883,12 +1170,12 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
     char path[PATH_MAX];
     struct timespec times[2];
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] SETATTR fh=%llx valid=%x @ %llx (%s)\n", handler->token,
             req->fh, req->valid, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!node) {
         return -ENOENT;
@@ -947,13 +1234,13 @@ static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] MKNOD %s 0%o @ %llx (%s)\n", handler->token,
             name, req->mode, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -978,13 +1265,13 @@ static int handle_mkdir(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] MKDIR %s 0%o @ %llx (%s)\n", handler->token,
             name, req->mode, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -1027,13 +1314,13 @@ static int handle_unlink(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] UNLINK %s @ %llx (%s)\n", handler->token,
             name, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!parent_node || !find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1)) {
@@ -1056,13 +1343,13 @@ static int handle_rmdir(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] RMDIR %s @ %llx (%s)\n", handler->token,
             name, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!parent_node || !find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1)) {
@@ -1092,7 +1379,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
     const char* new_actual_name;
     int res;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_wrlock(fuse);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     old_parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             old_parent_path, sizeof(old_parent_path));
@@ -1121,7 +1408,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto lookup_error;
     }
     acquire_node_locked(child_node);
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     /* Special case for renaming a file where destination is same path
      * differing only by case.  In this case we don't want to look for a case
@@ -1142,20 +1429,24 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto io_error;
     }
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_wrlock(fuse);
+    /* the index is keyed by the name, which may be reallocated */
+    unindex_child_locked(child_node->parent, child_node);
     res = rename_node_locked(child_node, new_name, new_actual_name);
+    index_child_locked(child_node->parent, child_node);
     if (!res) {
         remove_node_from_parent_locked(child_node);
         add_node_to_parent_locked(child_node, new_parent_node);
     }
+    invalidate_node_paths_locked(child_node);
     goto done;
 
 io_error:
-    pthread_mutex_lock(&fuse->lock);
+    fuse_wrlock(fuse);
 done:
     release_node_locked(child_node);
 lookup_error:
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
     return res;
 }
 
@@ -1178,13 +1469,14 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
     char path[PATH_MAX];
     struct fuse_open_out out;
     struct handle *h;
+    int open_flags;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] OPEN 0%o @ %llx (%s)\n", handler->token,
             req->flags, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!node) {
         return -ENOENT;
@@ -1198,7 +1490,16 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
         return -ENOMEM;
     }
     TRACE("[%d] OPEN %s\n", handler->token, path);
-    h->fd = open(path, req->flags);
+    open_flags = req->flags;
+    if (fuse->writeback_cache) {
+        /* With the writeback cache the kernel may need to read pages of
+         * a file opened for writing only, and it handles O_APPEND itself. */
+        if ((open_flags & O_ACCMODE) == O_WRONLY) {
+            open_flags = (open_flags & ~O_ACCMODE) | O_RDWR;
+        }
+        open_flags &= ~O_APPEND;
+    }
+    h->fd = open(path, open_flags);
     if (h->fd < 0) {
         free(h);
         return -errno;
@@ -1210,6 +1511,119 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+static ssize_t sdcard_splice(int fd_in, loff_t* off_in, int fd_out, size_t len)
+{
+#ifdef __NR_splice
+    return syscall(__NR_splice, fd_in, off_in, fd_out, NULL, len, SPLICE_F_MOVE);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void close_splice_pipes(struct fuse_handler* handler)
+{
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (handler->splice_data[i] >= 0) close(handler->splice_data[i]);
+        if (handler->splice_reply[i] >= 0) close(handler->splice_reply[i]);
+        handler->splice_data[i] = -1;
+        handler->splice_reply[i] = -1;
+    }
+}
+
+static void open_splice_pipes(struct fuse_handler* handler)
+{
+    int size = MAX_READ + sizeof(struct fuse_out_header);
+
+    handler->splice_data[0] = handler->splice_data[1] = -1;
+    handler->splice_reply[0] = handler->splice_reply[1] = -1;
+    if (pipe(handler->splice_data) < 0 || pipe(handler->splice_reply) < 0) {
+        close_splice_pipes(handler);
+        return;
+    }
+    /* A whole reply must fit in the pipes, or a READ would come back short
+     * and look like the end of the file. */
+    if (fcntl(handler->splice_data[1], F_SETPIPE_SZ, size) < size
+            || fcntl(handler->splice_reply[1], F_SETPIPE_SZ, size) < size) {
+        close_splice_pipes(handler);
+    }
+}
+
+/* Replies to a READ by splicing the data from fd into the data pipe, then
+ * the reply header followed by that data into the reply pipe, and finally
+ * the complete reply into the fuse device in one go, as the kernel expects.
+ * Returns -ENOSYS when nothing was consumed and the caller should fall back
+ * to copying. */
+static int handle_read_spliced(struct fuse* fuse, struct fuse_handler* handler,
+        int fd, __u64 unique, __u32 size, __u64 offset)
+{
+    struct fuse_out_header hdr;
+    loff_t off = offset;
+    ssize_t len = 0;
+    ssize_t moved;
+    ssize_t res;
+
+    while (len < (ssize_t) size) {
+        res = sdcard_splice(fd, &off, handler->splice_data[1], size - len);
+        if (res == 0) {
+            break;
+        }
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            res = -errno;
+            if (len == 0 && (res == -EINVAL || res == -ENOSYS)) {
+                /* the backing filesystem can't splice */
+                close_splice_pipes(handler);
+                return -ENOSYS;
+            }
+            goto fail;
+        }
+        len += res;
+    }
+
+    hdr.len = sizeof(hdr) + len;
+    hdr.error = 0;
+    hdr.unique = unique;
+    if (write(handler->splice_reply[1], &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        res = -EIO;
+        goto fail;
+    }
+    for (moved = 0; moved < len; moved += res) {
+        res = sdcard_splice(handler->splice_data[0], NULL,
+                handler->splice_reply[1], len - moved);
+        if (res <= 0) {
+            res = -EIO;
+            goto fail;
+        }
+    }
+
+    res = sdcard_splice(handler->splice_reply[0], NULL, fuse->fd, hdr.len);
+    if (res == (ssize_t) hdr.len) {
+        return NO_STATUS;
+    }
+    if (res < 0 && errno == EINVAL) {
+        /* The fuse device doesn't accept splice on this kernel: send what
+         * is already in the pipe the ordinary way and stop splicing. */
+        if (read(handler->splice_reply[0], &hdr, sizeof(hdr)) == sizeof(hdr)
+                && read(handler->splice_reply[0], handler->read_buffer, len) == len) {
+            fuse_reply(fuse, unique, handler->read_buffer, len);
+            close_splice_pipes(handler);
+            return NO_STATUS;
+        }
+    }
+    ERROR("*** SPLICED REPLY FAILED *** %d\n", errno);
+    /* whatever is left in the pipes can't be trusted any more */
+    close_splice_pipes(handler);
+    return NO_STATUS;
+
+fail:
+    close_splice_pipes(handler);
+    return res;
+}
+
 static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_read_in* req)
 {
@@ -1228,6 +1642,12 @@ static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
     if (size > sizeof(handler->read_buffer)) {
         return -EINVAL;
     }
+    if (handler->splice_data[0] >= 0) {
+        res = handle_read_spliced(fuse, handler, h->fd, unique, size, offset);
+        if (res != -ENOSYS) {
+            return res;
+        }
+    }
     res = pread64(h->fd, handler->read_buffer, size, offset);
     if (res < 0) {
         return -errno;
@@ -1263,10 +1683,10 @@ static int handle_statfs(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_statfs_out out;
     int res;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     TRACE("[%d] STATFS\n", handler->token);
     res = get_node_path_locked(&fuse->root, path, sizeof(path));
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
     if (res < 0) {
         return -ENOENT;
     }
@@ -1328,11 +1748,11 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_open_out out;
     struct dirhandle *h;
 
-    pthread_mutex_lock(&fuse->lock);
+    fuse_rdlock(fuse);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] OPENDIR @ %llx (%s)\n", handler->token,
             hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    fuse_unlock(fuse);
 
     if (!node) {
         return -ENOENT;
@@ -1350,6 +1770,7 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
         free(h);
         return -errno;
     }
+    h->next_offset = 0;
     out.fh = ptr_to_id(h);
     out.open_flags = 0;
     out.padding = 0;
@@ -1357,32 +1778,89 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+/* Fills a READDIR or READDIRPLUS reply with as many entries as fit in the
+ * size the kernel asked for.  Entry offsets simply count entries, so a
+ * request at any offset other than the one we stopped at means the caller
+ * rewound or seeked the directory, and we catch up by rewinding too. */
 static int handle_readdir(struct fuse* fuse, struct fuse_handler* handler,
-        const struct fuse_in_header* hdr, const struct fuse_read_in* req)
+        const struct fuse_in_header* hdr, const struct fuse_read_in* req, bool plus)
 {
     char buffer[8192];
-    struct fuse_dirent *fde = (struct fuse_dirent*) buffer;
-    struct dirent *de;
+    size_t size = req->size < sizeof(buffer) ? req->size : sizeof(buffer);
+    size_t used = 0;
     struct dirhandle *h = id_to_ptr(req->fh);
+    struct node* parent_node = NULL;
+    char parent_path[PATH_MAX];
+    char child_path[PATH_MAX];
+
+    TRACE("[%d] READDIR%s %p @ %llu\n", handler->token, plus ? "PLUS" : "",
+            h, req->offset);
+    if (plus) {
+        fuse_rdlock(fuse);
+        parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
+                parent_path, sizeof(parent_path));
+        fuse_unlock(fuse);
+        if (!parent_node) {
+            return -ENOENT;
+        }
+    }
 
-    TRACE("[%d] READDIR %p\n", handler->token, h);
-    if (req->offset == 0) {
+    if (req->offset != h->next_offset) {
         /* rewinddir() might have been called above us, so rewind here too */
         TRACE("[%d] calling rewinddir()\n", handler->token);
         rewinddir(h->d);
+        h->next_offset = 0;
+        while (h->next_offset < req->offset && readdir(h->d)) {
+            h->next_offset++;
+        }
     }
-    de = readdir(h->d);
-    if (!de) {
-        return 0;
+
+    for (;;) {
+        long pos = telldir(h->d);
+        struct dirent *de = readdir(h->d);
+        struct fuse_dirent *fde;
+        size_t namelen, entsize;
+
+        if (!de) {
+            break;
+        }
+        namelen = strlen(de->d_name);
+        entsize = FUSE_DIRENT_ALIGN((plus ? FUSE_NAME_OFFSET_DIRENTPLUS : FUSE_NAME_OFFSET)
+                + namelen);
+        if (used + entsize > size) {
+            /* doesn't fit, return it next time */
+            seekdir(h->d, pos);
+            break;
+        }
+        memset(buffer + used, 0, entsize);
+        if (plus) {
+            struct fuse_direntplus *fdp = (struct fuse_direntplus*) (buffer + used);
+            struct stat s;
+
+            /* A zero nodeid tells the kernel to treat this as a plain entry,
+             * which is what "." and ".." and anything we can't stat or the
+             * caller can't see must be. */
+            if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..")
+                    && snprintf(child_path, sizeof(child_path), "%s/%s",
+                            parent_path, de->d_name) < (int) sizeof(child_path)
+                    && lstat(child_path, &s) == 0
+                    && check_caller_access_to_name(fuse, hdr, parent_node,
+                            de->d_name, R_OK, false)) {
+                fill_entry(fuse, &fdp->entry_out, parent_node, de->d_name, de->d_name, &s);
+            }
+            fde = &fdp->dirent;
+        } else {
+            fde = (struct fuse_dirent*) (buffer + used);
+        }
+        fde->ino = FUSE_UNKNOWN_INO;
+        fde->off = ++h->next_offset;
+        fde->type = de->d_type;
+        fde->namelen = namelen;
+        memcpy(fde->name, de->d_name, namelen);
+        used += entsize;
     }
-    fde->ino = FUSE_UNKNOWN_INO;
-    /* increment the offset so we can detect when rewinddir() seeks back to the beginning */
-    fde->off = req->offset + 1;
-    fde->type = de->d_type;
-    fde->namelen = strlen(de->d_name);
-    memcpy(fde->name, de->d_name, fde->namelen + 1);
-    fuse_reply(fuse, hdr->unique, fde,
-            FUSE_DIRENT_ALIGN(sizeof(struct fuse_dirent) + fde->namelen));
+
+    fuse_reply(fuse, hdr->unique, buffer, used);
     return NO_STATUS;
 }
 
@@ -1397,21 +1875,40 @@ static int handle_releasedir(struct fuse* fuse, struct fuse_handler* handler,
     return 0;
 }
 
+/* INIT flags we make use of when the kernel offers them */
+#define SDCARD_INIT_FLAGS (FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES | FUSE_ASYNC_READ \
+        | FUSE_AUTO_INVAL_DATA | FUSE_ASYNC_DIO | FUSE_WRITEBACK_CACHE \
+        | FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO)
+
+/* Size of fuse_init_out before time_gran was added in 7.23 */
+#define FUSE_COMPAT_22_INIT_OUT_SIZE 24
+
 static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_init_in* req)
 {
     struct fuse_init_out out;
+    size_t out_size;
 
     TRACE("[%d] INIT ver=%d.%d maxread=%d flags=%x\n",
             handler->token, req->major, req->minor, req->max_readahead, req->flags);
+    memset(&out, 0, sizeof(out));
     out.major = FUSE_KERNEL_VERSION;
     out.minor = FUSE_KERNEL_MINOR_VERSION;
-    out.max_readahead = req->max_readahead;
-    out.flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+    if (req->major == FUSE_KERNEL_VERSION && req->minor < out.minor) {
+        out.minor = req->minor;
+    }
+    out.max_readahead = req->max_readahead < MAX_READ ? req->max_readahead : MAX_READ;
+    out.flags = req->flags & SDCARD_INIT_FLAGS;
     out.max_background = 32;
     out.congestion_threshold = 32;
     out.max_write = MAX_WRITE;
-    fuse_reply(fuse, hdr->unique, &out, sizeof(out));
+    out.time_gran = 1;
+
+    fuse->writeback_cache = (out.flags & FUSE_WRITEBACK_CACHE) != 0;
+    out_size = out.minor < 23 ? FUSE_COMPAT_22_INIT_OUT_SIZE : sizeof(out);
+    TRACE("[%d] INIT reply ver=%d.%d flags=%x\n",
+            handler->token, out.major, out.minor, out.flags);
+    fuse_reply(fuse, hdr->unique, &out, out_size);
     return NO_STATUS;
 }
 
@@ -1429,6 +1926,11 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         return handle_forget(fuse, handler, hdr, req);
     }
 
+    case FUSE_BATCH_FORGET: {
+        const struct fuse_batch_forget_in *req = data;
+        return handle_batch_forget(fuse, handler, hdr, req, data_len);
+    }
+
     case FUSE_GETATTR: { /* getattr_in -> attr_out */
         const struct fuse_getattr_in *req = data;
         return handle_getattr(fuse, handler, hdr, req);
@@ -1516,7 +2018,12 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
 
     case FUSE_READDIR: {
         const struct fuse_read_in *req = data;
-        return handle_readdir(fuse, handler, hdr, req);
+        return handle_readdir(fuse, handler, hdr, req, false);
+    }
+
+    case FUSE_READDIRPLUS: {
+        const struct fuse_read_in *req = data;
+        return handle_readdir(fuse, handler, hdr, req, true);
     }
 
     case FUSE_RELEASEDIR: { /* release_in -> */
@@ -1538,9 +2045,46 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
     }
 }
 
+/* Payload size moved by a request, for the per-opcode byte counters. */
+static __u64 request_bytes(const struct fuse_in_header *hdr,
+        const void *data, size_t data_len)
+{
+    if (hdr->opcode == FUSE_READ && data_len >= sizeof(struct fuse_read_in)) {
+        return ((const struct fuse_read_in*) data)->size;
+    }
+    if (hdr->opcode == FUSE_WRITE && data_len >= sizeof(struct fuse_write_in)) {
+        return ((const struct fuse_write_in*) data)->size;
+    }
+    return 0;
+}
+
+static void account_request(struct fuse_handler* handler, __u32 opcode,
+        __u64 bytes, __u64 elapsed_us, int res)
+{
+    struct op_stats* stats = &handler->stats[
+            opcode < STATS_OPCODES ? opcode : STATS_OPCODES - 1];
+    int bucket = 0;
+
+    while (bucket < STATS_BUCKETS - 1 && (elapsed_us >> bucket)) {
+        bucket++;
+    }
+    stats->count++;
+    if (res < 0) {
+        stats->errors++;
+    }
+    stats->bytes += bytes;
+    stats->total_us += elapsed_us;
+    stats->lock_wait_us += handler->lock_wait_us;
+    if (elapsed_us > stats->max_us) {
+        stats->max_us = elapsed_us;
+    }
+    stats->histogram[bucket]++;
+}
+
 static void handle_fuse_requests(struct fuse_handler* handler)
 {
     struct fuse* fuse = handler->fuse;
+    pthread_setspecific(handler_key, handler);
     for (;;) {
         ssize_t len = read(fuse->fd,
                 handler->request_buffer, sizeof(handler->request_buffer));
@@ -1566,11 +2110,17 @@ static void handle_fuse_requests(struct fuse_handler* handler)
         const void *data = handler->request_buffer + sizeof(struct fuse_in_header);
         size_t data_len = len - sizeof(struct fuse_in_header);
         __u64 unique = hdr->unique;
+        __u32 opcode = hdr->opcode;
+        __u64 bytes = request_bytes(hdr, data, data_len);
+        __u64 start = now_us();
+        handler->lock_wait_us = 0;
         int res = handle_fuse_request(fuse, handler, hdr, data, data_len);
 
         /* We do not access the request again after this point because the underlying
          * buffer storage may have been reused while processing the request. */
 
+        account_request(handler, opcode, bytes, now_us() - start, res);
+
         if (res != NO_STATUS) {
             if (res) {
                 TRACE("[%d] ERROR %d\n", handler->token, res);
@@ -1600,16 +2150,59 @@ static bool remove_int_to_null(void *key, void *value, void *context) {
     return true;
 }
 
-static int read_package_list(struct fuse *fuse) {
-    pthread_mutex_lock(&fuse->lock);
+static void free_package_maps(Hashmap* package_to_appid, Hashmap* appid_with_rw) {
+    hashmapForEach(package_to_appid, remove_str_to_int, package_to_appid);
+    hashmapForEach(appid_with_rw, remove_int_to_null, appid_with_rw);
+    hashmapFree(package_to_appid);
+    hashmapFree(appid_with_rw);
+}
+
+/* hashmapForEach() callback: clears *context when key is missing from, or
+ * maps to a different value in, the map the context points to. */
+struct map_compare {
+    Hashmap* other;
+    bool equal;
+};
+
+static bool compare_entry(void *key, void *value, void *context) {
+    struct map_compare* cmp = context;
+    if (!hashmapContainsKey(cmp->other, key) || hashmapGet(cmp->other, key) != value) {
+        cmp->equal = false;
+    }
+    return cmp->equal;
+}
+
+static bool maps_equal(Hashmap* a, Hashmap* b) {
+    struct map_compare cmp = { b, true };
+    if (hashmapSize(a) != hashmapSize(b)) {
+        return false;
+    }
+    hashmapForEach(a, compare_entry, &cmp);
+    return cmp.equal;
+}
 
-    hashmapForEach(fuse->package_to_appid, remove_str_to_int, fuse->package_to_appid);
-    hashmapForEach(fuse->appid_with_rw, remove_int_to_null, fuse->appid_with_rw);
+/* Parses the package list into fresh maps without holding fuse->lock, and
+ * only takes it to swap them in when something actually changed, so that
+ * package installs don't stall FUSE traffic while the file is read.
+ * Returns 1 if the maps were replaced, 0 if they were already up to date. */
+static int read_package_list(struct fuse *fuse) {
+    Hashmap* package_to_appid;
+    Hashmap* appid_with_rw;
 
     FILE* file = fopen(kPackagesListFile, "r");
     if (!file) {
+        /* keep what we have, the file is probably being replaced */
         ERROR("failed to open package list: %s\n", strerror(errno));
-        pthread_mutex_unlock(&fuse->lock);
+        return -1;
+    }
+
+    package_to_appid = hashmapCreate(256, str_hash, str_icase_equals);
+    appid_with_rw = hashmapCreate(128, int_hash, int_equals);
+    if (!package_to_appid || !appid_with_rw) {
+        ERROR("failed to allocate package maps\n");
+        if (package_to_appid) hashmapFree(package_to_appid);
+        if (appid_with_rw) hashmapFree(appid_with_rw);
+        fclose(file);
         return -1;
     }
 
@@ -1621,25 +2214,43 @@ static int read_package_list(struct fuse *fuse) {
 
         if (sscanf(buf, "%s %d %*d %*s %*s %s", package_name, &appid, gids) == 3) {
             char* package_name_dup = strdup(package_name);
-            hashmapPut(fuse->package_to_appid, package_name_dup, (void*) appid);
+            hashmapPut(package_to_appid, package_name_dup, (void*) appid);
 
             char* token = strtok(gids, ",");
             while (token != NULL) {
                 if (strtoul(token, NULL, 10) == fuse->write_gid) {
-                    hashmapPut(fuse->appid_with_rw, (void*) appid, (void*) 1);
+                    hashmapPut(appid_with_rw, (void*) appid, (void*) 1);
                     break;
                 }
                 token = strtok(NULL, ",");
             }
         }
     }
+    fclose(file);
 
     TRACE("read_package_list: found %d packages, %d with write_gid\n",
-            hashmapSize(fuse->package_to_appid),
-            hashmapSize(fuse->appid_with_rw));
-    fclose(file);
-    pthread_mutex_unlock(&fuse->lock);
-    return 0;
+            hashmapSize(package_to_appid),
+            hashmapSize(appid_with_rw));
+
+    /* Only this thread ever replaces the maps, so comparing against the
+     * current ones doesn't need the lock. */
+    if (maps_equal(package_to_appid, fuse->package_to_appid)
+            && maps_equal(appid_with_rw, fuse->appid_with_rw)) {
+        TRACE("read_package_list: unchanged\n");
+        free_package_maps(package_to_appid, appid_with_rw);
+        return 0;
+    }
+
+    fuse_wrlock(fuse);
+    Hashmap* old_package_to_appid = fuse->package_to_appid;
+    Hashmap* old_appid_with_rw = fuse->appid_with_rw;
+    fuse->package_to_appid = package_to_appid;
+    fuse->appid_with_rw = appid_with_rw;
+    fuse->package_generation++;
+    fuse_unlock(fuse);
+
+    free_package_maps(old_package_to_appid, old_appid_with_rw);
+    return 1;
 }
 
 static void watch_package_list(struct fuse* fuse) {
@@ -1704,12 +2315,119 @@ static void watch_package_list(struct fuse* fuse) {
     }
 }
 
-static int ignite_fuse(struct fuse* fuse, int num_threads)
+static const char* const kOpcodeNames[STATS_OPCODES] = {
+    [FUSE_LOOKUP] = "LOOKUP",
+    [FUSE_FORGET] = "FORGET",
+    [FUSE_GETATTR] = "GETATTR",
+    [FUSE_SETATTR] = "SETATTR",
+    [FUSE_MKNOD] = "MKNOD",
+    [FUSE_MKDIR] = "MKDIR",
+    [FUSE_UNLINK] = "UNLINK",
+    [FUSE_RMDIR] = "RMDIR",
+    [FUSE_RENAME] = "RENAME",
+    [FUSE_OPEN] = "OPEN",
+    [FUSE_READ] = "READ",
+    [FUSE_WRITE] = "WRITE",
+    [FUSE_STATFS] = "STATFS",
+    [FUSE_RELEASE] = "RELEASE",
+    [FUSE_FSYNC] = "FSYNC",
+    [FUSE_FLUSH] = "FLUSH",
+    [FUSE_INIT] = "INIT",
+    [FUSE_OPENDIR] = "OPENDIR",
+    [FUSE_READDIR] = "READDIR",
+    [FUSE_RELEASEDIR] = "RELEASEDIR",
+    [FUSE_INTERRUPT] = "INTERRUPT",
+    [FUSE_BATCH_FORGET] = "BATCH_FORGET",
+    [FUSE_READDIRPLUS] = "READDIRPLUS",
+    [STATS_OPCODES - 1] = "OTHER",
+};
+
+/* Sum the per-handler counters and write them to path.  The counters are
+ * read without synchronization, so a dump may be off by a request or two. */
+static void dump_stats(struct fuse_handler* handlers, int num_threads,
+        const char* path)
+{
+    char tmp_path[PATH_MAX];
+    FILE* f;
+    int op, i, b;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    f = fopen(tmp_path, "w");
+    if (!f) {
+        ERROR("cannot write stats to %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "# op count errors bytes total_us lock_wait_us max_us"
+            " histogram(<1us,<2us,<4us,...)\n");
+    for (op = 0; op < STATS_OPCODES; op++) {
+        struct op_stats sum;
+        memset(&sum, 0, sizeof(sum));
+        for (i = 0; i < num_threads; i++) {
+            const struct op_stats* stats = &handlers[i].stats[op];
+            sum.count += stats->count;
+            sum.errors += stats->errors;
+            sum.bytes += stats->bytes;
+            sum.total_us += stats->total_us;
+            sum.lock_wait_us += stats->lock_wait_us;
+            if (stats->max_us > sum.max_us) {
+                sum.max_us = stats->max_us;
+            }
+            for (b = 0; b < STATS_BUCKETS; b++) {
+                sum.histogram[b] += stats->histogram[b];
+            }
+        }
+        if (!sum.count) {
+            continue;
+        }
+
+        if (kOpcodeNames[op]) {
+            fprintf(f, "%s", kOpcodeNames[op]);
+        } else {
+            fprintf(f, "OP_%d", op);
+        }
+        fprintf(f, " %llu %llu %llu %llu %llu %llu",
+                sum.count, sum.errors, sum.bytes, sum.total_us,
+                sum.lock_wait_us, sum.max_us);
+        for (b = 0; b < STATS_BUCKETS; b++) {
+            fprintf(f, "%c%u", b ? ',' : ' ', sum.histogram[b]);
+        }
+        fprintf(f, "\n");
+    }
+
+    if (fclose(f) || rename(tmp_path, path)) {
+        ERROR("cannot write stats to %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+struct stats_dumper {
+    struct fuse_handler* handlers;
+    int num_threads;
+    const char* path;
+    sigset_t sigset;
+};
+
+/* Writes a fresh stats dump every time the daemon receives SIGUSR1. */
+static void* start_stats_dumper(void* data)
+{
+    struct stats_dumper* dumper = data;
+    int sig;
+
+    for (;;) {
+        if (sigwait(&dumper->sigset, &sig) == 0 && sig == SIGUSR1) {
+            dump_stats(dumper->handlers, dumper->num_threads, dumper->path);
+        }
+    }
+    return NULL;
+}
+
+static int ignite_fuse(struct fuse* fuse, int num_threads, const char* stats_path)
 {
     struct fuse_handler* handlers;
     int i;
 
-    handlers = malloc(num_threads * sizeof(struct fuse_handler));
+    handlers = calloc(num_threads, sizeof(struct fuse_handler));
     if (!handlers) {
         ERROR("cannot allocate storage for threads\n");
         return -ENOMEM;
@@ -1718,6 +2436,29 @@ static int ignite_fuse(struct fuse* fuse, int num_threads)
     for (i = 0; i < num_threads; i++) {
         handlers[i].fuse = fuse;
         handlers[i].token = i;
+        open_splice_pipes(&handlers[i]);
+    }
+
+    pthread_key_create(&handler_key, NULL);
+    if (stats_path) {
+        static struct stats_dumper dumper;
+        pthread_t thread;
+        int res;
+
+        dumper.handlers = handlers;
+        dumper.num_threads = num_threads;
+        dumper.path = stats_path;
+        sigemptyset(&dumper.sigset);
+        sigaddset(&dumper.sigset, SIGUSR1);
+
+        /* Block SIGUSR1 before any other thread exists so that every thread
+         * inherits the mask and only the dumper ever sees it. */
+        pthread_sigmask(SIG_BLOCK, &dumper.sigset, NULL);
+        res = pthread_create(&thread, NULL, start_stats_dumper, &dumper);
+        if (res) {
+            ERROR("failed to start stats thread, error=%d\n", res);
+            goto quit;
+        }
     }
 
     /* When deriving permissions, this thread is used to process inotify events,
@@ -1756,13 +2497,14 @@ static int usage()
             "    -d: derive file permissions based on path\n"
             "    -l: derive file permissions based on legacy internal layout\n"
             "    -s: split derived permissions for pics, av\n"
+            "    -S: write per-opcode request stats to this file on SIGUSR1\n"
             "\n", DEFAULT_NUM_THREADS);
     return 1;
 }
 
 static int run(const char* source_path, const char* dest_path, uid_t uid,
         gid_t gid, gid_t write_gid, int num_threads, derive_t derive,
-        bool split_perms) {
+        bool split_perms, const char* stats_path) {
     int fd;
     char opts[256];
     int res;
@@ -1778,8 +2520,8 @@ static int run(const char* source_path, const char* dest_path, uid_t uid,
     }
 
     snprintf(opts, sizeof(opts),
-            "fd=%i,rootmode=40000,default_permissions,allow_other,user_id=%d,group_id=%d",
-            fd, uid, gid);
+            "fd=%i,rootmode=40000,default_permissions,allow_other,user_id=%d,group_id=%d,"
+            "max_read=%d", fd, uid, gid, MAX_READ);
 
     res = mount("/dev/fuse", dest_path, "fuse", MS_NOSUID | MS_NODEV, opts);
     if (res < 0) {
@@ -1808,7 +2550,7 @@ static int run(const char* source_path, const char* dest_path, uid_t uid,
     fuse_init(&fuse, fd, source_path, write_gid, derive, split_perms);
 
     umask(0);
-    res = ignite_fuse(&fuse, num_threads);
+    res = ignite_fuse(&fuse, num_threads, stats_path);
 
     /* we do not attempt to umount the file system here because we are no longer
      * running as the root user */
@@ -1829,11 +2571,12 @@ int main(int argc, char **argv)
     int num_threads = DEFAULT_NUM_THREADS;
     derive_t derive = DERIVE_NONE;
     bool split_perms = false;
+    const char *stats_path = NULL;
     int i;
     struct rlimit rlim;
 
     int opt;
-    while ((opt = getopt(argc, argv, "u:g:w:t:dls")) != -1) {
+    while ((opt = getopt(argc, argv, "u:g:w:t:dlsS:")) != -1) {
         switch (opt) {
             case 'u':
                 uid = strtoul(optarg, NULL, 10);
@@ -1856,6 +2599,9 @@ int main(int argc, char **argv)
             case 's':
                 split_perms = true;
                 break;
+            case 'S':
+                stats_path = optarg;
+                break;
             case '?':
             default:
                 return usage();
@@ -1905,6 +2651,7 @@ int main(int argc, char **argv)
         ERROR("Error setting RLIMIT_NOFILE, errno = %d\n", errno);
     }
 
-    res = run(source_path, dest_path, uid, gid, write_gid, num_threads, derive, split_perms);
+    res = run(source_path, dest_path, uid, gid, write_gid, num_threads, derive, split_perms,
+            stats_path);
     return res < 0 ? 1 : 0;
 }
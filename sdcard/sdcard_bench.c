@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a FUSE request script against the sdcard request handlers
+ * in-process, without a kernel mount, and reports throughput and latency
+ * per opcode.  Replies are written by the handlers to one end of a
+ * socketpair and read back here, so the measured path is the same one
+ * the daemon takes for /dev/fuse, minus the kernel.
+ *
+ * A script is a text file with one operation per line, paths relative to
+ * the source directory:
+ *
+ *     lookup  <path>           LOOKUP of the last component
+ *     getattr <path>           GETATTR
+ *     read    <path> <chunk>   OPEN, READ in <chunk> sized pieces, RELEASE
+ *     readdir <path>           OPENDIR, READDIR until exhausted, RELEASEDIR
+ *
+ * Parent directories are looked up once and then remembered, the way the
+ * kernel dentry cache would.  sdcard_bench -g walks a tree and prints a
+ * script that touches everything in it.
+ */
+
+/* Pull in the handlers themselves; the daemon's main() is renamed away. */
+#define main sdcard_main
+#include "sdcard.c"
+#undef main
+
+#include <sys/socket.h>
+
+#define BENCH_MAX_LINE (PATH_MAX + 64)
+
+struct samples {
+    __u64* us;
+    size_t count;
+    size_t capacity;
+};
+
+struct bench {
+    struct fuse fuse;
+    struct fuse_handler* handler;
+    int reply_fd;
+    __u64 next_unique;
+    Hashmap* nodeids;
+    struct samples samples[STATS_OPCODES];
+    __u8 reply[sizeof(struct fuse_out_header) + MAX_READ];
+};
+
+static void record_sample(struct bench* bench, __u32 opcode, __u64 us)
+{
+    struct samples* s = &bench->samples[
+            opcode < STATS_OPCODES ? opcode : STATS_OPCODES - 1];
+    if (s->count == s->capacity) {
+        size_t capacity = s->capacity ? s->capacity * 2 : 1024;
+        __u64* us_new = realloc(s->us, capacity * sizeof(__u64));
+        if (!us_new) {
+            ERROR("out of memory\n");
+            exit(1);
+        }
+        s->us = us_new;
+        s->capacity = capacity;
+    }
+    s->us[s->count++] = us;
+}
+
+/* Issue one request and wait for its reply.  Returns the reply error (0 or
+ * a negative errno); the payload is left in bench->reply. */
+static int issue(struct bench* bench, __u32 opcode, __u64 nodeid,
+        const void* in, size_t in_len, const void* in2, size_t in2_len,
+        const void** out, size_t* out_len)
+{
+    struct fuse_handler* handler = bench->handler;
+    struct fuse_in_header* hdr = (void*) handler->request_buffer;
+    struct fuse_out_header* reply = (void*) bench->reply;
+    ssize_t len;
+    __u64 start;
+    int res;
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->len = sizeof(*hdr) + in_len + in2_len;
+    hdr->opcode = opcode;
+    hdr->unique = bench->next_unique++;
+    hdr->nodeid = nodeid;
+    hdr->uid = getuid();
+    hdr->gid = getgid();
+    hdr->pid = getpid();
+    memcpy(handler->request_buffer + sizeof(*hdr), in, in_len);
+    memcpy(handler->request_buffer + sizeof(*hdr) + in_len, in2, in2_len);
+
+    start = now_us();
+    res = handle_fuse_request(&bench->fuse, handler, hdr,
+            handler->request_buffer + sizeof(*hdr), in_len + in2_len);
+    if (res != NO_STATUS) {
+        fuse_status(&bench->fuse, bench->next_unique - 1, res);
+    }
+    len = read(bench->reply_fd, bench->reply, sizeof(bench->reply));
+    record_sample(bench, opcode, now_us() - start);
+
+    if (len < (ssize_t) sizeof(*reply)) {
+        ERROR("short reply to opcode %u: %zd\n", opcode, len);
+        exit(1);
+    }
+    if (out) {
+        *out = bench->reply + sizeof(*reply);
+        *out_len = len - sizeof(*reply);
+    }
+    return reply->error;
+}
+
+static int lookup(struct bench* bench, __u64 parent, const char* name, __u64* nodeid)
+{
+    const void* out;
+    size_t out_len;
+    int res = issue(bench, FUSE_LOOKUP, parent, name, strlen(name) + 1, NULL, 0,
+            &out, &out_len);
+    if (res == 0 && out_len >= sizeof(struct fuse_entry_out)) {
+        *nodeid = ((const struct fuse_entry_out*) out)->nodeid;
+    }
+    return res;
+}
+
+/* Map a relative path to a nodeid, looking up components not seen before. */
+static int resolve(struct bench* bench, const char* path, __u64* nodeid)
+{
+    char parent_path[PATH_MAX];
+    const char* name;
+    __u64 parent;
+    void* cached;
+    int res;
+
+    if (!*path || !strcmp(path, ".")) {
+        *nodeid = FUSE_ROOT_ID;
+        return 0;
+    }
+    cached = hashmapGet(bench->nodeids, (void*) path);
+    if (cached) {
+        *nodeid = (__u64) (uintptr_t) cached;
+        return 0;
+    }
+
+    name = strrchr(path, '/');
+    if (name) {
+        snprintf(parent_path, sizeof(parent_path), "%.*s", (int) (name - path), path);
+        name++;
+    } else {
+        parent_path[0] = '\0';
+        name = path;
+    }
+    res = resolve(bench, parent_path, &parent);
+    if (res) {
+        return res;
+    }
+    res = lookup(bench, parent, name, nodeid);
+    if (res == 0) {
+        hashmapPut(bench->nodeids, strdup(path), (void*) (uintptr_t) *nodeid);
+    }
+    return res;
+}
+
+static int do_lookup(struct bench* bench, const char* path)
+{
+    const char* name = strrchr(path, '/');
+    char parent_path[PATH_MAX];
+    __u64 parent, nodeid;
+    int res;
+
+    if (!name) {
+        return resolve(bench, path, &nodeid);
+    }
+    snprintf(parent_path, sizeof(parent_path), "%.*s", (int) (name - path), path);
+    res = resolve(bench, parent_path, &parent);
+    return res ? res : lookup(bench, parent, name + 1, &nodeid);
+}
+
+static int do_getattr(struct bench* bench, const char* path)
+{
+    struct fuse_getattr_in in;
+    __u64 nodeid;
+    int res = resolve(bench, path, &nodeid);
+    if (res) {
+        return res;
+    }
+    memset(&in, 0, sizeof(in));
+    return issue(bench, FUSE_GETATTR, nodeid, &in, sizeof(in), NULL, 0, NULL, NULL);
+}
+
+static int open_node(struct bench* bench, __u32 opcode, const char* path,
+        __u64* nodeid, __u64* fh)
+{
+    struct fuse_open_in in;
+    const void* out;
+    size_t out_len;
+    int res = resolve(bench, path, nodeid);
+    if (res) {
+        return res;
+    }
+    memset(&in, 0, sizeof(in));
+    in.flags = O_RDONLY;
+    res = issue(bench, opcode, *nodeid, &in, sizeof(in), NULL, 0, &out, &out_len);
+    if (res == 0) {
+        *fh = ((const struct fuse_open_out*) out)->fh;
+    }
+    return res;
+}
+
+static void release_node(struct bench* bench, __u32 opcode, __u64 nodeid, __u64 fh)
+{
+    struct fuse_release_in in;
+    memset(&in, 0, sizeof(in));
+    in.fh = fh;
+    issue(bench, opcode, nodeid, &in, sizeof(in), NULL, 0, NULL, NULL);
+}
+
+static int do_read(struct bench* bench, const char* path, __u32 chunk)
+{
+    struct fuse_read_in in;
+    const void* out;
+    size_t out_len;
+    __u64 nodeid, fh;
+    int res;
+
+    if (chunk == 0 || chunk > MAX_READ) {
+        chunk = MAX_READ;
+    }
+    res = open_node(bench, FUSE_OPEN, path, &nodeid, &fh);
+    if (res) {
+        return res;
+    }
+    memset(&in, 0, sizeof(in));
+    in.fh = fh;
+    in.size = chunk;
+    do {
+        res = issue(bench, FUSE_READ, nodeid, &in, sizeof(in), NULL, 0, &out, &out_len);
+        in.offset += out_len;
+    } while (res == 0 && out_len == chunk);
+    release_node(bench, FUSE_RELEASE, nodeid, fh);
+    return res;
+}
+
+static int do_readdir(struct bench* bench, const char* path)
+{
+    struct fuse_read_in in;
+    const void* out;
+    size_t out_len;
+    __u64 nodeid, fh;
+    int res;
+
+    res = open_node(bench, FUSE_OPENDIR, path, &nodeid, &fh);
+    if (res) {
+        return res;
+    }
+    memset(&in, 0, sizeof(in));
+    in.fh = fh;
+    in.size = 4096;
+    for (;;) {
+        const struct fuse_dirent* dirent = NULL;
+        size_t pos = 0;
+
+        res = issue(bench, FUSE_READDIR, nodeid, &in, sizeof(in), NULL, 0, &out, &out_len);
+        if (res || out_len == 0) {
+            break;
+        }
+        while (pos + FUSE_NAME_OFFSET <= out_len) {
+            dirent = (const void*) ((const __u8*) out + pos);
+            pos += FUSE_DIRENT_SIZE(dirent);
+        }
+        if (!dirent) {
+            break;
+        }
+        in.offset = dirent->off;
+    }
+    release_node(bench, FUSE_RELEASEDIR, nodeid, fh);
+    return res;
+}
+
+static int replay(struct bench* bench, FILE* script, __u64* ops)
+{
+    char line[BENCH_MAX_LINE];
+    char op[16], path[PATH_MAX];
+    unsigned chunk;
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), script)) {
+        int n, res;
+
+        lineno++;
+        chunk = 0;
+        n = sscanf(line, "%15s %4095s %u", op, path, &chunk);
+        if (n < 1 || op[0] == '#') {
+            continue;
+        }
+        if (n < 2) {
+            ERROR("line %d: missing path\n", lineno);
+            return -1;
+        }
+
+        if (!strcmp(op, "lookup")) {
+            res = do_lookup(bench, path);
+        } else if (!strcmp(op, "getattr")) {
+            res = do_getattr(bench, path);
+        } else if (!strcmp(op, "read")) {
+            res = do_read(bench, path, chunk);
+        } else if (!strcmp(op, "readdir")) {
+            res = do_readdir(bench, path);
+        } else {
+            ERROR("line %d: unknown operation '%s'\n", lineno, op);
+            return -1;
+        }
+        if (res) {
+            TRACE("line %d: %s %s failed: %d\n", lineno, op, path, res);
+        }
+        (*ops)++;
+    }
+    return 0;
+}
+
+/* Print a script that looks up, lists and reads everything below root/rel. */
+static void generate(const char* root, const char* rel, unsigned chunk)
+{
+    char path[PATH_MAX];
+    DIR* dir;
+    struct dirent* de;
+
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    printf("readdir %s\n", *rel ? rel : ".");
+    while ((de = readdir(dir))) {
+        char child[PATH_MAX];
+        struct stat s;
+
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s%s%s", rel, *rel ? "/" : "", de->d_name);
+        snprintf(path, sizeof(path), "%s/%s", root, child);
+        if (lstat(path, &s) < 0) {
+            continue;
+        }
+        printf("lookup %s\n", child);
+        printf("getattr %s\n", child);
+        if (S_ISDIR(s.st_mode)) {
+            generate(root, child, chunk);
+        } else if (S_ISREG(s.st_mode)) {
+            printf("read %s %u\n", child, chunk);
+        }
+    }
+    closedir(dir);
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    __u64 x = *(const __u64*) a, y = *(const __u64*) b;
+    return x < y ? -1 : x > y;
+}
+
+static __u64 percentile(const struct samples* s, unsigned permille)
+{
+    size_t i = (s->count * permille) / 1000;
+    return s->us[i < s->count ? i : s->count - 1];
+}
+
+static void report(struct bench* bench, __u64 ops, __u64 elapsed_us)
+{
+    __u64 requests = 0;
+    int op;
+
+    printf("%-12s %10s %10s %8s %8s %8s %8s\n",
+            "op", "count", "ops/s", "p50_us", "p99_us", "p999_us", "max_us");
+    for (op = 0; op < STATS_OPCODES; op++) {
+        struct samples* s = &bench->samples[op];
+        if (!s->count) {
+            continue;
+        }
+        qsort(s->us, s->count, sizeof(__u64), compare_u64);
+        requests += s->count;
+        printf("%-12s %10zu %10llu %8llu %8llu %8llu %8llu\n",
+                kOpcodeNames[op] ? kOpcodeNames[op] : "?", s->count,
+                elapsed_us ? s->count * 1000000ULL / elapsed_us : 0,
+                percentile(s, 500), percentile(s, 990), percentile(s, 999),
+                s->us[s->count - 1]);
+    }
+    printf("%llu script ops, %llu requests in %llu us (%llu requests/s)\n",
+            ops, requests, elapsed_us,
+            elapsed_us ? requests * 1000000ULL / elapsed_us : 0);
+}
+
+static int bench_usage()
+{
+    ERROR("usage: sdcard_bench [-n iterations] <source_path> <script>\n"
+            "       sdcard_bench -g [-c chunk] <source_path>\n"
+            "    -n: replay the script this many times (default 1)\n"
+            "    -g: print a script covering everything under source_path\n"
+            "    -c: read chunk size for generated scripts (default %d)\n"
+            "\n", 64 * 1024);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    static struct bench bench;
+    static struct fuse_handler handler;
+    int iterations = 1;
+    unsigned chunk = 64 * 1024;
+    bool gen = false;
+    int sv[2];
+    int bufsize = sizeof(bench.reply) * 2;
+    FILE* script;
+    __u64 ops = 0, start;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:gc:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                gen = true;
+                break;
+            case 'c':
+                chunk = strtoul(optarg, NULL, 10);
+                break;
+            case '?':
+            default:
+                return bench_usage();
+        }
+    }
+
+    if (gen) {
+        if (optind + 1 != argc) {
+            return bench_usage();
+        }
+        generate(argv[optind], "", chunk);
+        return 0;
+    }
+    if (optind + 2 != argc || iterations < 1) {
+        return bench_usage();
+    }
+
+    /* SOCK_SEQPACKET keeps each reply a single message, like /dev/fuse. */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        ERROR("cannot create socketpair: %s\n", strerror(errno));
+        return 1;
+    }
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+    fuse_init(&bench.fuse, sv[0], argv[optind], AID_SDCARD_RW, DERIVE_NONE, false);
+    bench.reply_fd = sv[1];
+    bench.next_unique = 1;
+    bench.nodeids = hashmapCreate(256, str_hash, str_equals);
+
+    /* Splicing into the socketpair would not preserve reply boundaries, so
+     * READ always takes the copying path here. */
+    handler.fuse = &bench.fuse;
+    handler.token = 0;
+    handler.splice_data[0] = handler.splice_data[1] = -1;
+    handler.splice_reply[0] = handler.splice_reply[1] = -1;
+    bench.handler = &handler;
+    pthread_key_create(&handler_key, NULL);
+    pthread_setspecific(handler_key, &handler);
+
+    script = fopen(argv[optind + 1], "r");
+    if (!script) {
+        ERROR("cannot open %s: %s\n", argv[optind + 1], strerror(errno));
+        return 1;
+    }
+
+    start = now_us();
+    for (i = 0; i < iterations; i++) {
+        rewind(script);
+        if (replay(&bench, script, &ops) < 0) {
+            return 1;
+        }
+    }
+    report(&bench, ops, now_us() - start);
+    fclose(script);
+    return 0;
+}
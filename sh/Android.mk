@@ -27,6 +27,7 @@ LOCAL_SRC_FILES:= \
 	output.c \
 	var.c \
 	bltin/echo.c \
+	bltin/test.c \
 	init.c
 
 LOCAL_MODULE:= ash
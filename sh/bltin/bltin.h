@@ -89,6 +89,7 @@ void sh_warnx(const char *, ...);
 void sh_exit(int) __attribute__((__noreturn__));
 
 int echocmd(int, char **);
+int testcmd(int, char **);
 
 
 extern const char *commandname;
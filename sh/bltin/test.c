@@ -0,0 +1,283 @@
+/*
+ * test, [ - evaluate an expression
+ *
+ * Built into the shell so that scripts, which run it for nearly every
+ * if and while, don't fork and exec /system/bin/test each time.
+ *
+ * The grammar is the usual one:
+ *	oexpr	::= aexpr | aexpr "-o" oexpr
+ *	aexpr	::= nexpr | nexpr "-a" aexpr
+ *	nexpr	::= primary | "!" nexpr
+ *	primary	::= "(" oexpr ")" | unary-operator operand
+ *		  | operand binary-operator operand | operand
+ *
+ * with the posix rules for one to four arguments applied first, so that
+ * something like [ "$a" = "!" ] or [ -n ] gives the expected answer.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bltin.h"
+
+static char **t_wp;		/* next argument */
+static char **t_end;		/* end of the arguments */
+
+static int oexpr(void);
+
+static int
+isunary(const char *s)
+{
+	return s[0] == '-' && s[1] != '\0' && s[2] == '\0' &&
+	    strchr("bcdefghknprstuwxzLOGS", s[1]) != NULL;
+}
+
+static int
+isbinary(const char *s)
+{
+	static const char *const ops[] = {
+		"=", "!=", "==", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt",
+		"-ge", "-nt", "-ot", "-ef", NULL
+	};
+	const char *const *op;
+
+	for (op = ops; *op; op++)
+		if (equal(s, *op))
+			return 1;
+	return 0;
+}
+
+static long long
+getn(const char *s)
+{
+	char *end;
+	long long r;
+
+	errno = 0;
+	r = strtoll(s, &end, 10);
+	while (*end == ' ' || *end == '\t')
+		end++;
+	if (errno != 0 || end == s || *end != '\0')
+		error("%s: bad number", s);
+	return r;
+}
+
+static int
+unary(const char *op, const char *arg)
+{
+	struct stat st;
+
+	switch (op[1]) {
+	case 'n':
+		return *arg != '\0';
+	case 'z':
+		return *arg == '\0';
+	case 't':
+		return isatty((int)getn(arg));
+	case 'r':
+		return access(arg, R_OK) == 0;
+	case 'w':
+		return access(arg, W_OK) == 0;
+	case 'x':
+		return access(arg, X_OK) == 0;
+	case 'h':
+	case 'L':
+		return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	}
+
+	if (stat(arg, &st) != 0)
+		return 0;
+	switch (op[1]) {
+	case 'b':
+		return S_ISBLK(st.st_mode);
+	case 'c':
+		return S_ISCHR(st.st_mode);
+	case 'd':
+		return S_ISDIR(st.st_mode);
+	case 'f':
+		return S_ISREG(st.st_mode);
+	case 'p':
+		return S_ISFIFO(st.st_mode);
+	case 'S':
+		return S_ISSOCK(st.st_mode);
+	case 'g':
+		return (st.st_mode & S_ISGID) != 0;
+	case 'u':
+		return (st.st_mode & S_ISUID) != 0;
+	case 'k':
+		return (st.st_mode & S_ISVTX) != 0;
+	case 's':
+		return st.st_size > 0;
+	case 'O':
+		return st.st_uid == geteuid();
+	case 'G':
+		return st.st_gid == getegid();
+	default:	/* 'e' */
+		return 1;
+	}
+}
+
+static int
+binary(const char *a, const char *op, const char *b)
+{
+	struct stat sa, sb;
+
+	if (op[0] != '-') {
+		if (equal(op, "=") || equal(op, "=="))
+			return equal(a, b);
+		if (equal(op, "!="))
+			return !equal(a, b);
+		if (equal(op, "<"))
+			return strcmp(a, b) < 0;
+		return strcmp(a, b) > 0;
+	}
+
+	switch (op[1]) {
+	case 'n':
+		if (op[2] == 't')
+			return stat(a, &sa) == 0 &&
+			    (stat(b, &sb) != 0 || sa.st_mtime > sb.st_mtime);
+		return getn(a) != getn(b);
+	case 'o':
+		return stat(b, &sb) == 0 &&
+		    (stat(a, &sa) != 0 || sa.st_mtime < sb.st_mtime);
+	case 'e':
+		if (op[2] == 'f')
+			return stat(a, &sa) == 0 && stat(b, &sb) == 0 &&
+			    sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+		return getn(a) == getn(b);
+	case 'l':
+		if (op[2] == 't')
+			return getn(a) < getn(b);
+		return getn(a) <= getn(b);
+	default:	/* 'g' */
+		if (op[2] == 't')
+			return getn(a) > getn(b);
+		return getn(a) >= getn(b);
+	}
+}
+
+static int
+primary(void)
+{
+	char *arg;
+	int r;
+
+	if (t_wp >= t_end)
+		error("argument expected");
+	arg = *t_wp++;
+
+	if (equal(arg, "(") && t_wp < t_end) {
+		r = oexpr();
+		if (t_wp >= t_end || !equal(*t_wp, ")"))
+			error("closing paren expected");
+		t_wp++;
+		return r;
+	}
+	if (isunary(arg) && t_wp < t_end)
+		return unary(arg, *t_wp++);
+	if (t_wp + 1 < t_end && isbinary(*t_wp)) {
+		t_wp += 2;
+		return binary(arg, t_wp[-2], t_wp[-1]);
+	}
+	return *arg != '\0';
+}
+
+static int
+nexpr(void)
+{
+	if (t_wp < t_end && equal(*t_wp, "!")) {
+		t_wp++;
+		return !nexpr();
+	}
+	return primary();
+}
+
+static int
+aexpr(void)
+{
+	int r = nexpr();
+
+	if (t_wp < t_end && equal(*t_wp, "-a")) {
+		t_wp++;
+		return aexpr() && r;
+	}
+	return r;
+}
+
+static int
+oexpr(void)
+{
+	int r = aexpr();
+
+	if (t_wp < t_end && equal(*t_wp, "-o")) {
+		t_wp++;
+		return oexpr() || r;
+	}
+	return r;
+}
+
+/* The posix rules for up to four arguments, or -1 for the general case. */
+static int
+posixtest(char **av, int ac)
+{
+	int r;
+
+	switch (ac) {
+	case 0:
+		return 0;
+	case 1:
+		return *av[0] != '\0';
+	case 2:
+		if (equal(av[0], "!"))
+			return *av[1] == '\0';
+		if (isunary(av[0]))
+			return unary(av[0], av[1]);
+		break;
+	case 3:
+		if (isbinary(av[1]))
+			return binary(av[0], av[1], av[2]);
+		if (equal(av[0], "!"))
+			return !posixtest(av + 1, 2);
+		if (equal(av[0], "(") && equal(av[2], ")"))
+			return *av[1] != '\0';
+		break;
+	case 4:
+		if (equal(av[0], "!")) {
+			if ((r = posixtest(av + 1, 3)) >= 0)
+				return !r;
+		} else if (equal(av[0], "(") && equal(av[3], ")")) {
+			return posixtest(av + 1, 2);
+		}
+		break;
+	}
+	return -1;
+}
+
+int
+testcmd(int argc, char **argv)
+{
+	int r;
+
+	if (equal(argv[0], "[")) {
+		if (argc < 2 || !equal(argv[argc - 1], "]"))
+			error("missing ]");
+		argc--;
+	}
+	argv++;
+	argc--;
+
+	if ((r = posixtest(argv, argc)) < 0) {
+		t_wp = argv;
+		t_end = argv + argc;
+		r = oexpr();
+		if (t_wp != t_end)
+			error("%s: unexpected operator", *t_wp);
+	}
+	return !r;
+}
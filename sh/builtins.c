@@ -30,6 +30,8 @@ const struct builtincmd builtincmd[] = {
 	{ "pwd",	pwdcmd },
 	{ "read",	readcmd },
 	{ "setvar",	setvarcmd },
+	{ "test",	testcmd },
+	{ "[",	testcmd },
 	{ "true",	truecmd },
 	{ "type",	typecmd },
 	{ "umask",	umaskcmd },
@@ -43,6 +43,7 @@ int returncmd(int, char **);
 int setcmd(int, char **);
 int setvarcmd(int, char **);
 int shiftcmd(int, char **);
+int testcmd(int, char **);
 int timescmd(int, char **);
 int trapcmd(int, char **);
 int truecmd(int, char **);
@@ -57,6 +57,7 @@ TOOLS := \
 	lsof \
 	du \
 	md5 \
+	perfstat \
 	clear \
 	getenforce \
 	setenforce \
@@ -81,6 +82,7 @@ ALL_TOOLS += \
 	grep
 
 LOCAL_SRC_FILES := \
+	dirwalk.c \
 	dynarray.c \
 	toolbox.c \
 	$(patsubst %,%.c,$(TOOLS)) \
@@ -96,6 +98,8 @@ LOCAL_SHARED_LIBRARIES := \
 	libusbhost \
 	libselinux
 
+LOCAL_STATIC_LIBRARIES := libmincrypt
+
 LOCAL_MODULE := toolbox
 
 # Including this will define $(intermediates).
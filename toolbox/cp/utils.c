@@ -38,8 +38,8 @@ __RCSID("$NetBSD: utils.c,v 1.41 2012/01/04 15:58:37 christos Exp $");
 #endif
 #endif /* not lint */
 
-#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #ifndef ANDROID
@@ -59,11 +59,17 @@ __RCSID("$NetBSD: utils.c,v 1.41 2012/01/04 15:58:37 christos Exp $");
 #include "extern.h"
 
 #ifdef ANDROID
-#define MAXBSIZE 65536
+#ifndef SEEK_DATA
+#define	SEEK_DATA	3
+#define	SEEK_HOLE	4
+#endif
 #endif
 
-#define	MMAP_MAX_SIZE	(8 * 1048576)
-#define	MMAP_MAX_WRITE	(64 * 1024)
+/*
+ * Data is moved in chunks this big, whether by sendfile() or through the
+ * buffer, so that the progress reports keep coming on big files.
+ */
+#define	COPY_CHUNK	(1024 * 1024)
 
 int
 set_utimes(const char *file, struct stat *fs)
@@ -95,27 +101,134 @@ set_utimes(const char *file, struct stat *fs)
 struct finfo {
 	const char *from;
 	const char *to;
-	size_t size;
+	off64_t size;
 };
 
 static void
-progress(const struct finfo *fi, size_t written)
+progress(const struct finfo *fi, off64_t written)
 {
 	int pcent = (int)((100.0 * written) / fi->size);
 
 	pinfo = 0;
-	(void)fprintf(stderr, "%s => %s %zu/%zu bytes %d%% written\n",
-	    fi->from, fi->to, written, fi->size, pcent);
+	(void)fprintf(stderr, "%s => %s %lld/%lld bytes %d%% written\n",
+	    fi->from, fi->to, (long long)written, (long long)fi->size, pcent);
+}
+
+/*
+ * Copies len bytes from the current offset of from_fd to the current
+ * offset of to_fd.  Returns -1 if it fails, with the warning printed.
+ */
+static int
+copy_range(int from_fd, int to_fd, const struct finfo *fi, off64_t len,
+    off64_t *ptotal)
+{
+	static bool no_sendfile;
+	static char *buf;
+	ssize_t rcount, wcount, chunk;
+
+	while (len > 0) {
+		chunk = len > COPY_CHUNK ? COPY_CHUNK : (ssize_t)len;
+
+		if (!no_sendfile) {
+			wcount = sendfile(to_fd, from_fd, NULL, chunk);
+			if (wcount == -1 && (errno == EINVAL ||
+			    errno == ENOSYS) && *ptotal == 0)
+				/* Not between these kinds of files */
+				no_sendfile = true;
+			else if (wcount == -1) {
+				warn("%s", fi->to);
+				return (-1);
+			} else if (wcount == 0)
+				/* The file got shorter */
+				return (0);
+		}
+
+		if (no_sendfile) {
+			if (buf == NULL && (buf = malloc(COPY_CHUNK)) == NULL) {
+				warn("%s", fi->from);
+				return (-1);
+			}
+			if ((rcount = read(from_fd, buf, chunk)) <= 0) {
+				if (rcount < 0) {
+					warn("%s", fi->from);
+					return (-1);
+				}
+				return (0);
+			}
+			for (wcount = 0; wcount < rcount; ) {
+				chunk = write(to_fd, buf + wcount,
+				    rcount - wcount);
+				if (chunk <= 0) {
+					warn("%s", fi->to);
+					return (-1);
+				}
+				wcount += chunk;
+			}
+		}
+
+		len -= wcount;
+		*ptotal += wcount;
+		if (pinfo)
+			progress(fi, *ptotal);
+	}
+	return (0);
+}
+
+/*
+ * Copies the contents of from_fd to to_fd, both at offset 0.  If the
+ * copy is a regular file, the holes of a sparse source are seeked over
+ * rather than written out as zeroes, so the copy is just as sparse.
+ */
+static int
+copy_data(int from_fd, int to_fd, const struct finfo *fi)
+{
+	struct stat sb;
+	off64_t data, hole, pos, ptotal;
+	bool sparse;
+
+	sparse = fstat(to_fd, &sb) == 0 && S_ISREG(sb.st_mode);
+	ptotal = 0;
+	for (pos = 0; pos < fi->size; pos = hole) {
+		data = pos;
+		hole = fi->size;
+		if (sparse) {
+			data = lseek64(from_fd, pos, SEEK_DATA);
+			if (data == -1 && errno == ENXIO)
+				/* Only a hole is left */
+				break;
+			if (data == -1) {
+				/* No SEEK_DATA on this file system */
+				data = pos;
+				sparse = false;
+			} else if ((hole = lseek64(from_fd, data,
+			    SEEK_HOLE)) == -1 || hole > fi->size)
+				hole = fi->size;
+			if (lseek64(from_fd, data, SEEK_SET) == -1) {
+				warn("%s", fi->from);
+				return (1);
+			}
+			if (lseek64(to_fd, data, SEEK_SET) == -1) {
+				warn("%s", fi->to);
+				return (1);
+			}
+		}
+		if (copy_range(from_fd, to_fd, fi, hole - data, &ptotal))
+			return (1);
+	}
+
+	/* Make up for the hole at the end, if any */
+	if (sparse && pos < fi->size && ftruncate64(to_fd, fi->size)) {
+		warn("%s", fi->to);
+		return (1);
+	}
+	return (0);
 }
 
 int
 copy_file(FTSENT *entp, int dne)
 {
-	static char buf[MAXBSIZE];
 	struct stat to_stat, *fs;
-	int ch, checkch, from_fd, rcount, rval, to_fd, tolnk, wcount;
-	char *p;
-	size_t ptotal = 0;
+	int ch, checkch, from_fd, rval, to_fd, tolnk;
 
 	if ((from_fd = open(entp->fts_path, O_RDONLY, 0)) == -1) {
 		warn("%s", entp->fts_path);
@@ -203,76 +316,9 @@ copy_file(FTSENT *entp, int dne)
 
 		fi.from = entp->fts_path;
 		fi.to = to.p_path;
-		fi.size = (size_t)fs->st_size;
+		fi.size = fs->st_size;
 
-		/*
-		 * Mmap and write if less than 8M (the limit is so
-		 * we don't totally trash memory on big files).
-		 * This is really a minor hack, but it wins some CPU back.
-		 */
-		bool use_read;
-
-		use_read = true;
-		if (fs->st_size <= MMAP_MAX_SIZE) {
-			size_t fsize = (size_t)fs->st_size;
-			p = mmap(NULL, fsize, PROT_READ, MAP_FILE|MAP_SHARED,
-			    from_fd, (off_t)0);
-			if (p != MAP_FAILED) {
-				size_t remainder;
-
-				use_read = false;
-
-				(void) madvise(p, (size_t)fs->st_size,
-				     MADV_SEQUENTIAL);
-
-				/*
-				 * Write out the data in small chunks to
-				 * avoid locking the output file for a
-				 * long time if the reading the data from
-				 * the source is slow.
-				 */
-				remainder = fsize;
-				do {
-					ssize_t chunk;
-
-					chunk = (remainder > MMAP_MAX_WRITE) ?
-					    MMAP_MAX_WRITE : remainder;
-					if (write(to_fd, &p[fsize - remainder],
-					    chunk) != chunk) {
-						warn("%s", to.p_path);
-						rval = 1;
-						break;
-					}
-					remainder -= chunk;
-					ptotal += chunk;
-					if (pinfo)
-						progress(&fi, ptotal);
-				} while (remainder > 0);
-
-				if (munmap(p, fsize) < 0) {
-					warn("%s", entp->fts_path);
-					rval = 1;
-				}
-			}
-		}
-
-		if (use_read) {
-			while ((rcount = read(from_fd, buf, MAXBSIZE)) > 0) {
-				wcount = write(to_fd, buf, (size_t)rcount);
-				if (rcount != wcount || wcount == -1) {
-					warn("%s", to.p_path);
-					rval = 1;
-					break;
-				}
-				ptotal += wcount;
-				if (pinfo)
-					progress(&fi, ptotal);
-			}
-			if (rcount < 0) {
-				warn("%s", entp->fts_path);
-				rval = 1;
-			}
-		}
+		rval = copy_data(from_fd, to_fd, &fi);
 	}
 
 #ifndef ANDROID
@@ -56,6 +56,7 @@ __RCSID("$NetBSD: dd.c,v 1.37 2004/01/17 21:00:16 dbj Exp $");
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <malloc.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -108,7 +109,7 @@ IO		in, out;		/* input/output state */
 STAT		st;			/* statistics */
 void		(*cfunc)(void);		/* conversion function */
 uint64_t	cpy_cnt;		/* # of blocks to copy */
-static off_t	pending = 0;		/* pending seek if sparse */
+static off64_t	pending = 0;		/* pending seek if sparse */
 u_int		ddflags;		/* conversion options */
 uint64_t	cbsz;			/* conversion block size */
 u_int		files_cnt = 1;		/* # of files to copy */
@@ -158,7 +159,8 @@ setup(void)
 		in.name = "stdin";
 		in.fd = STDIN_FILENO;
 	} else {
-		in.fd = open(in.name, O_RDONLY, 0);
+		in.fd = open(in.name,
+		    O_RDONLY | (ddflags & C_IDIRECT ? O_DIRECT : 0), 0);
 		if (in.fd < 0) {
 			fprintf(stderr, "%s: cannot open for read: %s\n",
 				in.name, strerror(errno));
@@ -185,7 +187,8 @@ setup(void)
 		out.name = "stdout";
 	} else {
 #define	OFLAGS \
-    (O_CREAT | (ddflags & (C_SEEK | C_NOTRUNC) ? 0 : O_TRUNC))
+    (O_CREAT | (ddflags & (C_SEEK | C_NOTRUNC) ? 0 : O_TRUNC) | \
+    (ddflags & C_ODIRECT ? O_DIRECT : 0))
 		out.fd = open(out.name, O_RDWR | OFLAGS, DEFFILEMODE);
 		/*
 		 * May not have read access, so try again with write only.
@@ -211,17 +214,21 @@ setup(void)
 
 	/*
 	 * Allocate space for the input and output buffers.  If not doing
-	 * record oriented I/O, only need a single buffer.
+	 * record oriented I/O, only need a single buffer.  They're page
+	 * aligned, as O_DIRECT wants, and so that dd_out() can check
+	 * them for zeroes a word at a time.
 	 */
 	if (!(ddflags & (C_BLOCK|C_UNBLOCK))) {
-		if ((in.db = malloc(out.dbsz + in.dbsz - 1)) == NULL) {
+		if ((in.db = memalign(getpagesize(),
+		    out.dbsz + in.dbsz - 1)) == NULL) {
 			exit(1);
 			/* NOTREACHED */
 		}
 		out.db = in.db;
-	} else if ((in.db =
-	    malloc((u_int)(MAX(in.dbsz, cbsz) + cbsz))) == NULL ||
-	    (out.db = malloc((u_int)(out.dbsz + cbsz))) == NULL) {
+	} else if ((in.db = memalign(getpagesize(),
+	    (u_int)(MAX(in.dbsz, cbsz) + cbsz))) == NULL ||
+	    (out.db = memalign(getpagesize(),
+	    (u_int)(out.dbsz + cbsz))) == NULL) {
 		exit(1);
 		/* NOTREACHED */
 	}
@@ -447,6 +454,29 @@ dd_close(void)
 	}
 }
 
+/*
+ * Returns whether the n bytes at p are all zero.  It's called on a lot
+ * of data with conv=sparse, so it looks at a word at a time once p is
+ * aligned.
+ */
+static int
+is_zero(const u_char *p, int64_t n)
+{
+	const u_long *wp;
+
+	for (; n > 0 && ((uintptr_t)p & (sizeof(u_long) - 1)); n--)
+		if (*p++ != 0)
+			return (0);
+	for (wp = (const u_long *)p; n >= (int64_t)sizeof(u_long);
+	    n -= sizeof(u_long))
+		if (*wp++ != 0)
+			return (0);
+	for (p = (const u_char *)wp; n > 0; n--)
+		if (*p++ != 0)
+			return (0);
+	return (1);
+}
+
 void
 dd_out(int force)
 {
@@ -475,14 +505,7 @@ dd_out(int force)
 		for (cnt = n;; cnt -= nw) {
 
 			if (!force && ddflags & C_SPARSE) {
-				int sparse, i;
-				sparse = 1;	/* Is buffer sparse? */
-				for (i = 0; i < cnt; i++)
-					if (outp[i] != 0) {
-						sparse = 0;
-						break;
-					}
-				if (sparse) {
+				if (is_zero(outp, cnt)) {
 					pending += cnt;
 					outp += cnt;
 					nw = 0;
@@ -490,7 +513,7 @@ dd_out(int force)
 				}
 			}
 			if (pending != 0) {
-				if (lseek(out.fd, pending, SEEK_CUR) ==
+				if (lseek64(out.fd, pending, SEEK_CUR) ==
 				    -1) {
 					fprintf(stderr,
 						"%s: seek error creating "
@@ -571,6 +594,15 @@ bwrite(int fd, const void *buf, size_t len)
 
 	(void)sigprocmask(SIG_BLOCK, &infoset, &oset);
 	rv = write(fd, buf, len);
+	if (rv == -1 && errno == EINVAL && ddflags & C_ODIRECT) {
+		/*
+		 * The last block is usually too short for O_DIRECT:
+		 * write it, and whatever follows, through the cache.
+		 */
+		(void)fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		ddflags &= ~C_ODIRECT;
+		rv = write(fd, buf, len);
+	}
 	oerrno = errno;
 	(void)sigprocmask(SIG_SETMASK, &oset, NULL);
 	errno = oerrno;
@@ -1026,6 +1058,8 @@ static void	f_of(char *);
 static void	f_seek(char *);
 static void	f_skip(char *);
 static void	f_progress(char *);
+static void	f_iflag(char *);
+static void	f_oflag(char *);
 
 static const struct arg {
 	const char *name;
@@ -1041,8 +1075,10 @@ static const struct arg {
 	{ "files",	f_files,	C_FILES, C_FILES },
 	{ "ibs",	f_ibs,		C_IBS,	 C_BS|C_IBS },
 	{ "if",		f_if,		C_IF,	 C_IF },
+	{ "iflag",	f_iflag,	0,	 0 },
 	{ "obs",	f_obs,		C_OBS,	 C_BS|C_OBS },
 	{ "of",		f_of,		C_OF,	 C_OF },
+	{ "oflag",	f_oflag,	0,	 0 },
 	{ "progress",	f_progress,	0,	 0 },
 	{ "seek",	f_seek,		C_SEEK,	 C_SEEK },
 	{ "skip",	f_skip,		C_SKIP,	 C_SKIP },
@@ -1159,9 +1195,30 @@ c_arg(const void *a, const void *b)
 static long long strsuftoll(const char* name, const char* arg, int def, unsigned int max)
 {
 	long long result;
+	char suffix;
 	
-	if (sscanf(arg, "%lld", &result) == 0)
+	switch (sscanf(arg, "%lld%c", &result, &suffix)) {
+	case 0:
+	case EOF:
 		result = def;
+		break;
+	case 2:
+		/* The usual multipliers, so that big buffers are easy to ask for */
+		switch (suffix) {
+		case 'w':	result *= 2; break;
+		case 'b':	result *= 512; break;
+		case 'k':
+		case 'K':	result *= 1024; break;
+		case 'm':
+		case 'M':	result *= 1024 * 1024; break;
+		case 'g':
+		case 'G':	result *= 1024 * 1024 * 1024; break;
+		default:
+			errx(EXIT_FAILURE, "%s: illegal numeric value", name);
+			/* NOTREACHED */
+		}
+		break;
+	}
 	return result;
 }
 
@@ -1249,6 +1306,42 @@ f_progress(char *arg)
 		progress = 1;
 }
 
+/*
+ * iflag=direct and oflag=direct open the file with O_DIRECT, to read or
+ * write big images without going through (and flushing) the page cache.
+ * The block size then has to suit the device, say bs=1m.
+ */
+static u_int
+f_openflags(char *arg, u_int direct)
+{
+	char *flag;
+	u_int set = 0;
+
+	while ((flag = strsep(&arg, ",")) != NULL) {
+		if (strcmp(flag, "direct") == 0)
+			set |= direct;
+		else {
+			errx(EXIT_FAILURE, "unknown flag %s", flag);
+			/* NOTREACHED */
+		}
+	}
+	return (set);
+}
+
+static void
+f_iflag(char *arg)
+{
+
+	ddflags |= f_openflags(arg, C_IDIRECT);
+}
+
+static void
+f_oflag(char *arg)
+{
+
+	ddflags |= f_openflags(arg, C_ODIRECT);
+}
+
 #ifdef	NO_CONV
 /* Build a small version (i.e. for a ramdisk root) */
 static void
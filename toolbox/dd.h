@@ -92,3 +92,5 @@ typedef struct {
 #define	C_OSYNC		0x100000
 #define	C_SPARSE	0x200000
 #define	C_FDATASYNC	0x400000
+#define	C_IDIRECT	0x800000
+#define	C_ODIRECT	0x1000000
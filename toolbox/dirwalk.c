@@ -0,0 +1,273 @@
+#include "dirwalk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS  32
+#define MAX_AHEAD    64     /* directories read but not yet asked for */
+#define HASH_SIZE    1024
+
+enum { QUEUED, READING, DONE };
+
+struct dirwalk {
+    int flags;
+    int threads;
+    pthread_t tids[MAX_THREADS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* for the workers: queue or ahead changed */
+    pthread_cond_t done;        /* for dirwalk_read(): a directory was read */
+    int quit;
+    int ahead;
+
+    dirwalk_dir_t *hash[HASH_SIZE];
+    dirwalk_dir_t *queue;
+    dirwalk_dir_t **insert;     /* where the next prefetch goes */
+};
+
+static unsigned
+hash_path(const char *path)
+{
+    unsigned h = 0;
+    while (*path)
+        h = h * 31 + (unsigned char)*path++;
+    return h % HASH_SIZE;
+}
+
+static dirwalk_dir_t **
+lookup(dirwalk_t *w, const char *path)
+{
+    dirwalk_dir_t **pd = &w->hash[hash_path(path)];
+    while (*pd && strcmp((*pd)->path, path))
+        pd = &(*pd)->hash_next;
+    return pd;
+}
+
+static dirwalk_dir_t *
+new_dir(const char *path)
+{
+    dirwalk_dir_t *d = calloc(1, sizeof(*d));
+    if (d == NULL)
+        return NULL;
+    d->path = strdup(path);
+    if (d->path == NULL) {
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+static void
+read_dir(dirwalk_t *w, dirwalk_dir_t *d)
+{
+    struct dirent *de;
+    DIR *dir;
+    int fd, capacity = 0;
+
+    fd = open(d->path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        d->error = errno;
+        return;
+    }
+    dir = fdopendir(fd);
+    if (dir == NULL) {
+        d->error = errno;
+        close(fd);
+        return;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        dirwalk_entry_t *e;
+        const char *name = de->d_name;
+
+        if (name[0] == '.') {
+            if ((w->flags & DIRWALK_NOHIDDEN) || name[1] == 0 ||
+                (name[1] == '.' && name[2] == 0))
+                continue;
+        }
+        if (d->count == capacity) {
+            int n = capacity ? capacity * 2 : 16;
+            e = realloc(d->entries, n * sizeof(*e));
+            if (e == NULL) {
+                d->error = ENOMEM;
+                break;
+            }
+            d->entries = e;
+            capacity = n;
+        }
+        e = &d->entries[d->count];
+        e->name = strdup(name);
+        if (e->name == NULL) {
+            d->error = ENOMEM;
+            break;
+        }
+        e->error = 0;
+        if (!(w->flags & DIRWALK_NOSTAT) &&
+            fstatat(fd, name, &e->st, AT_SYMLINK_NOFOLLOW) < 0)
+            e->error = errno;
+        d->count++;
+    }
+    closedir(dir);
+}
+
+static void *
+worker(void *arg)
+{
+    dirwalk_t *w = arg;
+    dirwalk_dir_t *d;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->quit && (w->queue == NULL || w->ahead >= MAX_AHEAD))
+            pthread_cond_wait(&w->work, &w->lock);
+        if (w->quit)
+            break;
+
+        d = w->queue;
+        w->queue = d->queue_next;
+        if (w->insert == &d->queue_next)
+            w->insert = &w->queue;
+        d->state = READING;
+        w->ahead++;
+        pthread_mutex_unlock(&w->lock);
+
+        read_dir(w, d);
+
+        pthread_mutex_lock(&w->lock);
+        d->state = DONE;
+        pthread_cond_broadcast(&w->done);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+dirwalk_t *
+dirwalk_create(int threads, int flags)
+{
+    dirwalk_t *w = calloc(1, sizeof(*w));
+    int i;
+
+    if (w == NULL)
+        return NULL;
+    w->flags = flags;
+    w->insert = &w->queue;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->done, NULL);
+
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&w->tids[i], NULL, worker, w) != 0)
+            break;
+    }
+    /* Fewer threads (or none) only makes it slower. */
+    w->threads = i;
+    return w;
+}
+
+void
+dirwalk_destroy(dirwalk_t *w)
+{
+    dirwalk_dir_t *d;
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->quit = 1;
+    pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->lock);
+    for (i = 0; i < w->threads; i++)
+        pthread_join(w->tids[i], NULL);
+
+    /* Whatever the tool prefetched but didn't read, after an error. */
+    for (i = 0; i < HASH_SIZE; i++) {
+        while ((d = w->hash[i]) != NULL) {
+            w->hash[i] = d->hash_next;
+            dirwalk_free(d);
+        }
+    }
+    pthread_cond_destroy(&w->done);
+    pthread_cond_destroy(&w->work);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+}
+
+void
+dirwalk_prefetch(dirwalk_t *w, const char *path)
+{
+    dirwalk_dir_t **pd, *d;
+
+    if (w->threads == 0)
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    pd = lookup(w, path);
+    if (*pd == NULL && (d = new_dir(path)) != NULL) {
+        d->state = QUEUED;
+        *pd = d;
+        d->queue_next = *w->insert;
+        *w->insert = d;
+        w->insert = &d->queue_next;
+        pthread_cond_signal(&w->work);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+dirwalk_dir_t *
+dirwalk_read(dirwalk_t *w, const char *path)
+{
+    dirwalk_dir_t **pd, *d = NULL;
+
+    if (w->threads > 0) {
+        pthread_mutex_lock(&w->lock);
+        /* What this directory prefetches is read before its elders. */
+        w->insert = &w->queue;
+        pd = lookup(w, path);
+        d = *pd;
+        if (d != NULL) {
+            if (d->state == QUEUED) {
+                /* Not started yet: quicker to read it here than to wait. */
+                dirwalk_dir_t **pq = &w->queue;
+                while (*pq != d)
+                    pq = &(*pq)->queue_next;
+                *pq = d->queue_next;
+                *pd = d->hash_next;
+                pthread_mutex_unlock(&w->lock);
+                read_dir(w, d);
+                return d;
+            }
+            while (d->state != DONE)
+                pthread_cond_wait(&w->done, &w->lock);
+            *pd = d->hash_next;
+            w->ahead--;
+            pthread_cond_signal(&w->work);
+        }
+        pthread_mutex_unlock(&w->lock);
+        if (d != NULL)
+            return d;
+    }
+
+    d = new_dir(path);
+    if (d != NULL)
+        read_dir(w, d);
+    return d;
+}
+
+void
+dirwalk_free(dirwalk_dir_t *d)
+{
+    int i;
+
+    if (d == NULL)
+        return;
+    for (i = 0; i < d->count; i++)
+        free(d->entries[i].name);
+    free(d->entries);
+    free(d->path);
+    free(d);
+}
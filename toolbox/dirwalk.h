@@ -0,0 +1,62 @@
+#ifndef DIRWALK_H
+#define DIRWALK_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* Directory reads for the tools which walk trees (du, ls -R).
+ *
+ * The tool still walks the tree in its own order, one directory after
+ * the other, so its output doesn't change. But it tells the walker which
+ * directories it is going to read next with dirwalk_prefetch(): a pool
+ * of threads reads those ahead of time, and lstat()s their entries with
+ * fstatat() relative to the directory fd. When the tool gets to them,
+ * dirwalk_read() usually has nothing left to do, which matters on
+ * storage where every stat is a round trip (eMMC, the sdcard FUSE
+ * daemon).
+ */
+
+/* dirwalk_create() flags */
+#define DIRWALK_NOHIDDEN    (1 << 0)    /* leave out the names starting with '.' */
+#define DIRWALK_NOSTAT      (1 << 1)    /* names only, don't lstat the entries */
+
+#define DIRWALK_DEFAULT_THREADS  8
+
+typedef struct {
+    char *name;
+    int error;              /* errno of the lstat, or 0 */
+    struct stat st;
+} dirwalk_entry_t;
+
+typedef struct dirwalk_dir dirwalk_dir_t;
+
+struct dirwalk_dir {
+    char *path;
+    int error;              /* errno of the opendir, or 0 */
+    int count;
+    dirwalk_entry_t *entries;   /* in readdir order, without "." and ".." */
+
+    /* private */
+    int state;
+    dirwalk_dir_t *hash_next;
+    dirwalk_dir_t *queue_next;
+};
+
+typedef struct dirwalk dirwalk_t;
+
+/* With threads <= 0, every directory is read by dirwalk_read() itself. */
+dirwalk_t *dirwalk_create(int threads, int flags);
+void dirwalk_destroy(dirwalk_t *w);
+
+/* Queues path to be read ahead, in the order the calls are made: the
+ * directories prefetched between two dirwalk_read() calls go before
+ * the ones prefetched earlier, as a depth-first walk would use them.
+ * The tool must dirwalk_read() every directory it prefetches.
+ */
+void dirwalk_prefetch(dirwalk_t *w, const char *path);
+
+/* Returns path read (check its error), to give back with dirwalk_free(). */
+dirwalk_dir_t *dirwalk_read(dirwalk_t *w, const char *path);
+void dirwalk_free(dirwalk_dir_t *d);
+
+#endif /* DIRWALK_H */
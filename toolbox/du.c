@@ -60,12 +60,21 @@ __RCSID("$NetBSD: du.c,v 1.33 2008/07/30 22:03:40 dsl Exp $");
 #include <unistd.h>
 #include <limits.h>
 
+#include "dirwalk.h"
+
 int	linkchk(dev_t, ino_t);
 void	prstat(const char *, int64_t);
+static void	du_root(dirwalk_t *, const char *, int);
+static int64_t	du_dir(dirwalk_t *, const char *, const struct stat *, int);
 static void	usage(void);
 
 long blocksize;
 
+/* State of the physical walk, which doesn't use fts. */
+static int depth, listfiles, cflag, xflag, rval;
+static int64_t totalblocks;
+static dev_t rootdev;
+
 #define howmany(x, y)   (((x)+((y)-1))/(y))
 
 int
@@ -73,10 +82,9 @@ du_main(int argc, char *argv[])
 {
 	FTS *fts;
 	FTSENT *p;
-	int64_t totalblocks;
-	int ftsoptions, listfiles;
-	int depth;
-	int Hflag, Lflag, aflag, ch, cflag, dflag, gkmflag, nflag, rval, sflag;
+	dirwalk_t *w;
+	int ftsoptions;
+	int Hflag, Lflag, aflag, ch, dflag, gkmflag, nflag, sflag;
 	const char *noargv[2];
 
 	Hflag = Lflag = aflag = cflag = dflag = gkmflag = sflag = 0;
@@ -130,6 +138,7 @@ du_main(int argc, char *argv[])
 			break;
 		case 'x':
 			ftsoptions |= FTS_XDEV;
+			xflag = 1;
 			break;
 		case '?':
 		default:
@@ -178,6 +187,21 @@ du_main(int argc, char *argv[])
 		blocksize = 512;
 	blocksize /= 512;
 
+	/*
+	 * Physical walks read the directories ahead with a few threads,
+	 * which is in the same order as fts, so the output is unchanged.
+	 */
+	if (!Lflag) {
+		if ((w = dirwalk_create(DIRWALK_DEFAULT_THREADS, 0)) == NULL)
+			err(1, "dirwalk_create");
+		for (; *argv; argv++)
+			du_root(w, *argv, Hflag);
+		dirwalk_destroy(w);
+		if (cflag)
+			prstat("total", totalblocks);
+		exit(rval);
+	}
+
 	if ((fts = fts_open(argv, ftsoptions, NULL)) == NULL)
 		err(1, "fts_open `%s'", *argv);
 
@@ -229,6 +253,118 @@ du_main(int argc, char *argv[])
 	exit(rval);
 }
 
+static char *
+du_path(const char *dir, const char *name)
+{
+	size_t len = strlen(dir);
+	char *path;
+
+	/* Like fts, "dir/" doesn't get a second slash. */
+	if (len > 0 && dir[len - 1] == '/')
+		len--;
+	if ((path = malloc(len + strlen(name) + 2)) == NULL)
+		err(1, "malloc");
+	memcpy(path, dir, len);
+	path[len] = '/';
+	strcpy(path + len + 1, name);
+	return path;
+}
+
+/* The FTS_DEFAULT case above, for a walk without fts. */
+static int64_t
+du_file(const char *path, const struct stat *st, int level)
+{
+	if (st->st_nlink > 1 && linkchk(st->st_dev, st->st_ino))
+		return 0;
+	if (listfiles || !level)
+		prstat(path, st->st_blocks);
+	if (cflag)
+		totalblocks += st->st_blocks;
+	return st->st_blocks;
+}
+
+/*
+ * Returns the blocks of path and everything under it, after printing
+ * them as the FTS_DP case does. Unreadable directories count for
+ * nothing (FTS_DNR), and -x mount points only for themselves.
+ */
+static int64_t
+du_dir(dirwalk_t *w, const char *path, const struct stat *st, int level)
+{
+	dirwalk_dir_t *d;
+	dirwalk_entry_t *e;
+	int64_t blocks = 0;
+	char *child;
+	int i;
+
+	if (!xflag || st->st_dev == rootdev) {
+		if ((d = dirwalk_read(w, path)) == NULL)
+			err(1, "dirwalk_read");
+		if (d->error) {
+			warnx("%s: %s", path, strerror(d->error));
+			rval = 1;
+			dirwalk_free(d);
+			return 0;
+		}
+
+		/* Our subdirectories are the next ones we will read. */
+		for (i = 0, e = d->entries; i < d->count; i++, e++) {
+			if (e->error || !S_ISDIR(e->st.st_mode) ||
+			    (xflag && e->st.st_dev != rootdev))
+				continue;
+			child = du_path(path, e->name);
+			dirwalk_prefetch(w, child);
+			free(child);
+		}
+
+		for (i = 0, e = d->entries; i < d->count; i++, e++) {
+			child = du_path(path, e->name);
+			if (e->error) {
+				warnx("%s: %s", child, strerror(e->error));
+				rval = 1;
+			} else if (S_ISDIR(e->st.st_mode))
+				blocks += du_dir(w, child, &e->st, level + 1);
+			else
+				blocks += du_file(child, &e->st, level + 1);
+			free(child);
+		}
+		dirwalk_free(d);
+	}
+
+	blocks += st->st_blocks;
+	if (cflag)
+		totalblocks += st->st_blocks;
+	if (level <= depth || (!listfiles && !level))
+		prstat(path, blocks);
+	return blocks;
+}
+
+static void
+du_root(dirwalk_t *w, const char *path, int follow)
+{
+	struct stat st;
+	int ret;
+
+	/* As FTS_COMFOLLOW does, a dangling link is itself. */
+	if (follow) {
+		ret = stat(path, &st);
+		if (ret < 0 && errno == ENOENT)
+			ret = lstat(path, &st);
+	} else
+		ret = lstat(path, &st);
+	if (ret < 0) {
+		warn("%s", path);
+		rval = 1;
+		return;
+	}
+
+	rootdev = st.st_dev;
+	if (S_ISDIR(st.st_mode))
+		du_dir(w, path, &st, 0);
+	else
+		du_file(path, &st, 0);
+}
+
 void
 prstat(const char *fname, int64_t blocks)
 {
@@ -7,15 +7,36 @@
 #include <sys/ioctl.h>
 #include <sys/inotify.h>
 #include <sys/limits.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <linux/input.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "getevent.h"
 
-static struct pollfd *ufds;
+/* Entry 0 is the inotify fd. */
+static int *fds;
 static char **device_names;
 static int nfds;
+static int epoll_fd = -1;
+
+/* Events taken per read(), rather than one syscall per event. */
+#define EVENTS_PER_READ 64
+
+/* Buckets of the -L histograms, each twice as wide as the last, in us. */
+#define HISTOGRAM_BUCKETS 24
+
+struct histogram {
+    int count;
+    int64_t min;
+    int64_t max;
+    int64_t total;
+    int buckets[HISTOGRAM_BUCKETS];
+};
+
+static volatile sig_atomic_t interrupted;
 
 enum {
     PRINT_DEVICE_ERRORS     = 1U << 0,
@@ -295,7 +316,7 @@ static int open_device(const char *device, int print_flags)
 {
     int version;
     int fd;
-    struct pollfd *new_ufds;
+    int *new_fds;
     char **new_device_names;
     char name[80];
     char location[80];
@@ -335,12 +356,12 @@ static int open_device(const char *device, int print_flags)
         idstr[0] = '\0';
     }
 
-    new_ufds = realloc(ufds, sizeof(ufds[0]) * (nfds + 1));
-    if(new_ufds == NULL) {
+    new_fds = realloc(fds, sizeof(fds[0]) * (nfds + 1));
+    if(new_fds == NULL) {
         fprintf(stderr, "out of memory\n");
         return -1;
     }
-    ufds = new_ufds;
+    fds = new_fds;
     new_device_names = realloc(device_names, sizeof(device_names[0]) * (nfds + 1));
     if(new_device_names == NULL) {
         fprintf(stderr, "out of memory\n");
@@ -376,8 +397,19 @@ static int open_device(const char *device, int print_flags)
         print_hid_descriptor(id.bustype, id.vendor, id.product);
     }
 
-    ufds[nfds].fd = fd;
-    ufds[nfds].events = POLLIN;
+    if(epoll_fd >= 0) {
+        struct epoll_event eventItem;
+        memset(&eventItem, 0, sizeof(eventItem));
+        eventItem.events = EPOLLIN;
+        eventItem.data.fd = fd;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &eventItem)) {
+            fprintf(stderr, "could not add %s to epoll, %s\n", device, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    fds[nfds] = fd;
     device_names[nfds] = strdup(device);
     nfds++;
 
@@ -393,8 +425,9 @@ int close_device(const char *device, int print_flags)
             if(print_flags & PRINT_DEVICE)
                 printf("remove device %d: %s\n", i, device);
             free(device_names[i]);
+            close(fds[i]);
             memmove(device_names + i, device_names + i + 1, sizeof(device_names[0]) * count);
-            memmove(ufds + i, ufds + i + 1, sizeof(ufds[0]) * count);
+            memmove(fds + i, fds + i + 1, sizeof(fds[0]) * count);
             nfds--;
             return 0;
         }
@@ -472,7 +505,7 @@ static int scan_dir(const char *dirname, int print_flags)
 
 static void usage(int argc, char *argv[])
 {
-    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [device]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [-L] [device]\n", argv[0]);
     fprintf(stderr, "    -t: show time stamps\n");
     fprintf(stderr, "    -n: don't print newlines\n");
     fprintf(stderr, "    -s: print switch states for given bits\n");
@@ -485,6 +518,51 @@ static void usage(int argc, char *argv[])
     fprintf(stderr, "    -q: quiet (clear verbosity mask)\n");
     fprintf(stderr, "    -c: print given number of events then exit\n");
     fprintf(stderr, "    -r: print rate events are received\n");
+    fprintf(stderr, "    -L: don't print events; on exit, print histograms of their latency\n"
+                    "        and of the time between reports\n");
+}
+
+static void histogram_add(struct histogram *h, int64_t us)
+{
+    int bucket = 0;
+
+    if(us < 0)
+        us = 0;
+    while(bucket < HISTOGRAM_BUCKETS - 1 && us >= (1LL << bucket))
+        bucket++;
+    h->buckets[bucket]++;
+    if(h->count == 0 || us < h->min)
+        h->min = us;
+    if(us > h->max)
+        h->max = us;
+    h->total += us;
+    h->count++;
+}
+
+static void histogram_print(const char *name, const struct histogram *h)
+{
+    int i;
+
+    printf("%s: %d", name, h->count);
+    if(h->count == 0) {
+        printf("\n");
+        return;
+    }
+    printf(", min %lld us, avg %lld us, max %lld us\n",
+           h->min, h->total / h->count, h->max);
+    for(i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if(h->buckets[i] == 0)
+            continue;
+        if(i < HISTOGRAM_BUCKETS - 1)
+            printf("  <  %8lld us: %d\n", 1LL << i, h->buckets[i]);
+        else
+            printf("  >= %8lld us: %d\n", 1LL << (i - 1), h->buckets[i]);
+    }
+}
+
+static void on_interrupt(int sig)
+{
+    interrupted = 1;
 }
 
 int getevent_main(int argc, char *argv[])
@@ -494,10 +572,15 @@ int getevent_main(int argc, char *argv[])
     int res;
     int pollres;
     int get_time = 0;
+    int latency = 0;
+    struct histogram latency_histogram;
+    struct histogram interval_histogram;
+    int64_t last_report_time = 0;
     int print_device = 0;
     char *newline = "\n";
     uint16_t get_switch = 0;
-    struct input_event event;
+    struct input_event events[EVENTS_PER_READ];
+    struct epoll_event pending[16];
     int version;
     int print_flags = 0;
     int print_flags_set = 0;
@@ -510,7 +593,7 @@ int getevent_main(int argc, char *argv[])
 
     opterr = 0;
     do {
-        c = getopt(argc, argv, "tns:Sv::dpilqc:rh");
+        c = getopt(argc, argv, "tns:Sv::dpilqc:rLh");
         if (c == EOF)
             break;
         switch (c) {
@@ -566,6 +649,9 @@ int getevent_main(int argc, char *argv[])
         case 'r':
             sync_rate = 1;
             break;
+        case 'L':
+            latency = 1;
+            break;
         case '?':
             fprintf(stderr, "%s: invalid option -%c\n",
                 argv[0], optopt);
@@ -586,9 +672,20 @@ int getevent_main(int argc, char *argv[])
         exit(1);
     }
     nfds = 1;
-    ufds = calloc(1, sizeof(ufds[0]));
-    ufds[0].fd = inotify_init();
-    ufds[0].events = POLLIN;
+    fds = calloc(1, sizeof(fds[0]));
+    fds[0] = inotify_init();
+    if(!dont_block) {
+        struct epoll_event eventItem;
+        epoll_fd = epoll_create(8);
+        if(epoll_fd < 0) {
+            fprintf(stderr, "could not create epoll fd, %s\n", strerror(errno));
+            return 1;
+        }
+        memset(&eventItem, 0, sizeof(eventItem));
+        eventItem.events = EPOLLIN;
+        eventItem.data.fd = fds[0];
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[0], &eventItem);
+    }
     if(device) {
         if(!print_flags_set)
             print_flags |= PRINT_DEVICE_ERRORS;
@@ -600,7 +697,7 @@ int getevent_main(int argc, char *argv[])
         if(!print_flags_set)
             print_flags |= PRINT_DEVICE_ERRORS | PRINT_DEVICE | PRINT_DEVICE_NAME;
         print_device = 1;
-		res = inotify_add_watch(ufds[0].fd, device_path, IN_DELETE | IN_CREATE);
+		res = inotify_add_watch(fds[0], device_path, IN_DELETE | IN_CREATE);
         if(res < 0) {
             fprintf(stderr, "could not add watch for %s, %s\n", device_path, strerror(errno));
             return 1;
@@ -615,7 +712,7 @@ int getevent_main(int argc, char *argv[])
     if(get_switch) {
         for(i = 1; i < nfds; i++) {
             uint16_t sw;
-            res = ioctl(ufds[i].fd, EVIOCGSW(1), &sw);
+            res = ioctl(fds[i], EVIOCGSW(1), &sw);
             if(res < 0) {
                 fprintf(stderr, "could not get switch state, %s\n", strerror(errno));
                 return 1;
@@ -628,39 +725,92 @@ int getevent_main(int argc, char *argv[])
     if(dont_block)
         return 0;
 
-    while(1) {
-        pollres = poll(ufds, nfds, -1);
-        //printf("poll %d, returned %d\n", nfds, pollres);
-        if(ufds[0].revents & POLLIN) {
-            read_notify(device_path, ufds[0].fd, print_flags);
+    if(latency) {
+        memset(&latency_histogram, 0, sizeof(latency_histogram));
+        memset(&interval_histogram, 0, sizeof(interval_histogram));
+        signal(SIGINT, on_interrupt);
+        signal(SIGTERM, on_interrupt);
+    }
+
+    while(!interrupted) {
+        int j;
+        pollres = epoll_wait(epoll_fd, pending, sizeof(pending) / sizeof(pending[0]), -1);
+        if(pollres < 0) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "could not wait for events, %s\n", strerror(errno));
+            return 1;
         }
-        for(i = 1; i < nfds; i++) {
-            if(ufds[i].revents) {
-                if(ufds[i].revents & POLLIN) {
-                    res = read(ufds[i].fd, &event, sizeof(event));
-                    if(res < (int)sizeof(event)) {
-                        fprintf(stderr, "could not get event\n");
-                        return 1;
+        for(j = 0; j < pollres; j++) {
+            int fd = pending[j].data.fd;
+            int count, k;
+            int64_t read_time = 0;
+
+            if(fd == fds[0]) {
+                read_notify(device_path, fd, print_flags);
+                continue;
+            }
+            for(i = 1; i < nfds && fds[i] != fd; i++)
+                ;
+            if(i == nfds) {
+                /* Removed by an earlier inotify event in this batch. */
+                continue;
+            }
+
+            res = read(fd, events, sizeof(events));
+            if(res < (int)sizeof(events[0])) {
+                if(res < 0 && errno == EINTR)
+                    continue;
+                fprintf(stderr, "could not get event\n");
+                return 1;
+            }
+            count = res / sizeof(events[0]);
+            if(latency) {
+                /* Our fds get CLOCK_REALTIME stamps; only other readers switch clocks. */
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                read_time = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+            }
+
+            for(k = 0; k < count; k++) {
+                struct input_event *event = &events[k];
+                if(latency) {
+                    if(event->type == EV_SYN && event->code == SYN_REPORT) {
+                        int64_t now = event->time.tv_sec * 1000000LL + event->time.tv_usec;
+                        histogram_add(&latency_histogram, read_time - now);
+                        if(last_report_time > 0)
+                            histogram_add(&interval_histogram, now - last_report_time);
+                        last_report_time = now;
                     }
+                } else {
                     if(get_time) {
-                        printf("[%8ld.%06ld] ", event.time.tv_sec, event.time.tv_usec);
+                        printf("[%8ld.%06ld] ", event->time.tv_sec, event->time.tv_usec);
                     }
                     if(print_device)
                         printf("%s: ", device_names[i]);
-                    print_event(event.type, event.code, event.value, print_flags);
-                    if(sync_rate && event.type == 0 && event.code == 0) {
-                        int64_t now = event.time.tv_sec * 1000000LL + event.time.tv_usec;
+                    print_event(event->type, event->code, event->value, print_flags);
+                    if(sync_rate && event->type == 0 && event->code == 0) {
+                        int64_t now = event->time.tv_sec * 1000000LL + event->time.tv_usec;
                         if(last_sync_time)
                             printf(" rate %lld", 1000000LL / (now - last_sync_time));
                         last_sync_time = now;
                     }
                     printf("%s", newline);
-                    if(event_count && --event_count == 0)
-                        return 0;
+                }
+                if(event_count && --event_count == 0) {
+                    interrupted = 1;
+                    break;
                 }
             }
+            if(interrupted)
+                break;
         }
     }
 
+    if(latency) {
+        histogram_print("latency", &latency_histogram);
+        histogram_print("interval", &interval_histogram);
+    }
+
     return 0;
 }
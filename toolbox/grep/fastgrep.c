@@ -42,6 +42,7 @@
 #include <sys/cdefs.h>
 __RCSID("$NetBSD: fastgrep.c,v 1.5 2011/04/18 03:27:40 joerg Exp $");
 
+#include <ctype.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -53,6 +54,7 @@ __RCSID("$NetBSD: fastgrep.c,v 1.5 2011/04/18 03:27:40 joerg Exp $");
 
 static inline int	grep_cmp(const unsigned char *, const unsigned char *, size_t);
 static inline void	grep_revstr(unsigned char *, int);
+static void		grep_prefix(fastgrep_t *, const char *);
 
 void
 fgrepcomp(fastgrep_t *fg, const char *pat)
@@ -70,8 +72,14 @@ fgrepcomp(fastgrep_t *fg, const char *pat)
 	/* Preprocess pattern. */
 	for (i = 0; i <= UCHAR_MAX; i++)
 		fg->qsBc[i] = fg->len;
-	for (i = 1; i < fg->len; i++)
+	for (i = 1; i < fg->len; i++) {
 		fg->qsBc[fg->pattern[i]] = fg->len - i;
+		/* grep_cmp() folds case, the shifts have to as well */
+		if (iflag) {
+			fg->qsBc[tolower(fg->pattern[i])] = fg->len - i;
+			fg->qsBc[toupper(fg->pattern[i])] = fg->len - i;
+		}
+	}
 }
 
 /*
@@ -80,6 +88,8 @@ fgrepcomp(fastgrep_t *fg, const char *pat)
 int
 fastcomp(fastgrep_t *fg, const char *pat)
 {
+	const char *special;
+	bool dots;
 	unsigned int i;
 	int firstHalfDot = -1;
 	int firstLastHalfDot = -1;
@@ -94,6 +104,9 @@ fastcomp(fastgrep_t *fg, const char *pat)
 	fg->reversed = false;
 	fg->word = wflag;
 
+	/* Every match contains fg->prefix, even if regexec() has to be used. */
+	grep_prefix(fg, pat);
+
 	/* Remove end-of-line character ('$'). */
 	if (fg->len > 0 && pat[fg->len - 1] == '$') {
 		fg->eol = true;
@@ -125,7 +138,14 @@ fastcomp(fastgrep_t *fg, const char *pat)
 	memcpy(fg->pattern, pat, fg->len);
 	fg->pattern[fg->len] = '\0';
 
-	/* Look for ways to cheat...er...avoid the full regex engine. */
+	/*
+	 * Look for ways to cheat...er...avoid the full regex engine.
+	 * Patterns made of dots only, or of literal characters only, are
+	 * searched for here; anything else (and case folding) is left to
+	 * regexec().
+	 */
+	special = (grepbehave == GREP_EXTENDED) ? "[]\\*^$+?(){}|" : "[]\\*^$";
+	dots = memchr(fg->pattern, '.', fg->len) != NULL;
 	for (i = 0; i < fg->len; i++) {
 		/* Can still cheat? */
 		if (fg->pattern[i] == '.') {
@@ -140,7 +160,8 @@ fastcomp(fastgrep_t *fg, const char *pat)
 				if (firstLastHalfDot < 0)
 					firstLastHalfDot = i;
 			}
-		} else {
+		} else if (dots || iflag ||
+		    strchr(special, fg->pattern[i]) != NULL) {
 			/* Free memory and let others know this is empty. */
 			free(fg->pattern);
 			fg->pattern = NULL;
@@ -251,6 +272,26 @@ grep_search(fastgrep_t *fg, const unsigned char *data, size_t len, regmatch_t *p
 				break;
 			j -= fg->qsBc[data[j - fg->len - 1]];
 		} while (j >= fg->len);
+	} else if (fg->len > 0 && fg->len < 4 && !iflag &&
+	    (grepbehave == GREP_FIXED ||
+	    fg->pattern[0] != '.')) {
+		/*
+		 * Short patterns barely shift, let memchr() find the
+		 * candidates instead: it looks at several bytes at a time.
+		 */
+		const unsigned char *p = data + pmatch->rm_so;
+		const unsigned char *end = data + len - fg->len + 1;
+
+		while (p < end &&
+		    (p = memchr(p, fg->pattern[0], end - p)) != NULL) {
+			if (grep_cmp(fg->pattern, p, fg->len) == -1) {
+				pmatch->rm_so = p - data;
+				pmatch->rm_eo = p - data + fg->len;
+				ret = 0;
+				break;
+			}
+			p++;
+		}
 	} else {
 		/* Quick Search algorithm. */
 		j = pmatch->rm_so;
@@ -280,36 +321,18 @@ grep_search(fastgrep_t *fg, const unsigned char *data, size_t len, regmatch_t *p
 static inline int
 grep_cmp(const unsigned char *pat, const unsigned char *data, size_t len)
 {
-	size_t size;
-	wchar_t *wdata, *wpat;
 	unsigned int i;
 
 	if (iflag) {
-		if ((size = mbstowcs(NULL, (const char *)data, 0)) ==
-		    ((size_t) - 1))
-			return (-1);
-
-		wdata = grep_malloc(size * sizeof(wint_t));
-
-		if (mbstowcs(wdata, (const char *)data, size) ==
-		    ((size_t) - 1))
-			return (-1);
-
-		if ((size = mbstowcs(NULL, (const char *)pat, 0)) ==
-		    ((size_t) - 1))
-			return (-1);
-
-		wpat = grep_malloc(size * sizeof(wint_t));
-
-		if (mbstowcs(wpat, (const char *)pat, size) == ((size_t) - 1))
-			return (-1);
+		/*
+		 * data isn't NUL-terminated (it may be the end of a mapped
+		 * file), so compare bytes rather than converting it.
+		 */
 		for (i = 0; i < len; i++) {
-			if ((towlower(wpat[i]) == towlower(wdata[i])) ||
-			    ((grepbehave != GREP_FIXED) && wpat[i] == L'.'))
+			if ((tolower(pat[i]) == tolower(data[i])) ||
+			    ((grepbehave != GREP_FIXED) && pat[i] == '.'))
 				continue;
-			free(wpat);
-			free(wdata);
-				return (i);
+			return (i);
 		}
 	} else {
 		for (i = 0; i < len; i++) {
@@ -334,3 +357,38 @@ grep_revstr(unsigned char *str, int len)
 		str[len - i - 1] = c;
 	}
 }
+
+/*
+ * Finds the literal string every match of the regular expression pat
+ * starts with, so that lines without it can be skipped without calling
+ * regexec().  There's none if the pattern has an alternation (which may
+ * not contain it) or starts with anything but a literal character.
+ */
+static void
+grep_prefix(fastgrep_t *fg, const char *pat)
+{
+	size_t i, len;
+
+	fg->prefix = NULL;
+	fg->prefixlen = 0;
+
+	if (iflag || strchr(pat, '|') != NULL)
+		return;
+	if (pat[0] == '^')
+		pat++;
+
+	for (len = 0; pat[len] != '\0'; len++)
+		if (strchr(".[]\\*^$+?(){}", pat[len]) != NULL)
+			break;
+
+	/* A quantifier applies to the last character. */
+	i = (pat[len] == '\\') ? len + 1 : len;
+	if (len > 0 && pat[i] != '\0' && strchr("*{?+", pat[i]) != NULL)
+		len--;
+	if (len == 0)
+		return;
+
+	fg->prefix = grep_malloc(len);
+	memcpy(fg->prefix, pat, len);
+	fg->prefixlen = len;
+}
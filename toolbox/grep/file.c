@@ -39,6 +39,7 @@ __RCSID("$NetBSD: file.c,v 1.7 2011/04/18 22:46:48 joerg Exp $");
 
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef ANDROID
@@ -48,6 +49,7 @@ __RCSID("$NetBSD: file.c,v 1.7 2011/04/18 22:46:48 joerg Exp $");
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -83,6 +85,10 @@ grep_refill(struct file *f)
 	bufpos = buffer;
 	bufrem = 0;
 
+	/* All of a mapped file was in the buffer already */
+	if (f->map != NULL)
+		return (0);
+
 #ifndef ANDROID
 	if (filebehave == FILE_GZIP)
 		nr = gzread(gzbufdesc, buffer, MAXBUFSIZ);
@@ -198,9 +204,42 @@ error:
 	return (NULL);
 }
 
+/*
+ * Skips the lines of a mapped file up to the one holding the next
+ * occurrence of lit, which the lines before can't match.  Adds what
+ * was skipped to *off and, if lines isn't NULL, to *lines.  Returns
+ * false, leaving the file as it is, if lit doesn't occur again.
+ */
+bool
+grep_skip(struct file *f, const unsigned char *lit, size_t litlen,
+    off_t *off, int *lines)
+{
+	unsigned char *p, *start;
+
+	if (f->map == NULL || bufrem == 0)
+		return (true);
+
+	if ((p = memmem(bufpos, bufrem, lit, litlen)) == NULL)
+		return (false);
+
+	/* Back up to the start of the line */
+	for (start = p; start > bufpos && start[-1] != line_sep; start--)
+		;
+
+	*off += start - bufpos;
+	if (lines != NULL)
+		for (p = bufpos;
+		    (p = memchr(p, line_sep, start - p)) != NULL; p++)
+			++*lines;
+	bufrem -= start - bufpos;
+	bufpos = start;
+	return (true);
+}
+
 static inline struct file *
 grep_file_init(struct file *f)
 {
+	struct stat st;
 
 #ifndef ANDROID
 	if (filebehave == FILE_GZIP &&
@@ -212,13 +251,33 @@ grep_file_init(struct file *f)
 		goto error;
 #endif
 
+	/*
+	 * Regular files are mapped: then the lines are read in place
+	 * rather than copied into the buffer, and grep_skip() can jump
+	 * straight to the lines which may match.
+	 */
+	if (filebehave == FILE_STDIO && fstat(f->fd, &st) == 0 &&
+	    S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    (uintmax_t)st.st_size <= SIZE_MAX) {
+		f->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		    f->fd, 0);
+		if (f->map == MAP_FAILED)
+			f->map = NULL;
+		else {
+			f->mapsize = st.st_size;
+			madvise(f->map, f->mapsize, MADV_SEQUENTIAL);
+			bufpos = f->map;
+			bufrem = f->mapsize;
+		}
+	}
+
 	/* Fill read buffer, also catches errors early */
-	if (grep_refill(f) != 0)
+	if (f->map == NULL && grep_refill(f) != 0)
 		goto error;
 
 	/* Check for binary stuff, if necessary */
 	if (!nulldataflag && binbehave != BINFILE_TEXT &&
-	    memchr(bufpos, '\0', bufrem) != NULL)
+	    memchr(bufpos, '\0', MIN(bufrem, MAXBUFSIZ)) != NULL)
 		f->binary = true;
 
 	return (f);
@@ -257,6 +316,8 @@ void
 grep_close(struct file *f)
 {
 
+	if (f->map != NULL)
+		munmap(f->map, f->mapsize);
 	close(f->fd);
 
 	/* Reset read buffer and line buffer */
@@ -88,6 +88,8 @@ extern const char		*errstr[];
 struct file {
 	int		 fd;
 	bool		 binary;
+	unsigned char	*map;		/* the whole file, if it's mapped */
+	size_t		 mapsize;
 };
 
 struct str {
@@ -107,6 +109,9 @@ typedef struct {
 	size_t		 len;
 	unsigned char	*pattern;
 	int		 qsBc[UCHAR_MAX + 1];
+	/* literal start of the matches, when pattern is NULL */
+	unsigned char	*prefix;
+	size_t		 prefixlen;
 	/* flags */
 	bool		 bol;
 	bool		 eol;
@@ -159,6 +164,8 @@ void	 clearqueue(void);
 void		 grep_close(struct file *f);
 struct file	*grep_open(const char *path);
 char		*grep_fgetln(struct file *f, size_t *len);
+bool		 grep_skip(struct file *f, const unsigned char *lit, size_t litlen,
+		    off_t *off, int *lines);
 
 /* fastgrep.c */
 int		 fastcomp(fastgrep_t *, const char *);
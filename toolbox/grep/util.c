@@ -59,6 +59,7 @@ static bool	 first, first_global = true;
 static unsigned long long since_printed;
 
 static int	 procline(struct str *l, int);
+static const unsigned char *skip_literal(size_t *);
 
 bool
 file_matching(const char *fname)
@@ -179,6 +180,31 @@ grep_tree(char **argv)
 	return (c);
 }
 
+/*
+ * Returns the literal string which a line must contain to match, if the
+ * lines without it don't have to be looked at at all: not when they're
+ * printed as context or inverted, and not with several patterns.
+ */
+static const unsigned char *
+skip_literal(size_t *len)
+{
+	fastgrep_t *fg;
+
+	if (patterns != 1 || vflag || Aflag || Bflag || iflag)
+		return (NULL);
+
+	fg = &fg_pattern[0];
+	if (fg->pattern != NULL) {
+		if (grepbehave != GREP_FIXED &&
+		    memchr(fg->pattern, '.', fg->len) != NULL)
+			return (NULL);
+		*len = fg->len;
+		return (fg->len > 0 ? fg->pattern : NULL);
+	}
+	*len = fg->prefixlen;
+	return (fg->prefix);
+}
+
 /*
  * Opens a file and processes it.  Each file is processed line-by-line
  * passing the lines to procline().
@@ -189,6 +215,8 @@ procfile(const char *fn)
 	struct file *f;
 	struct stat sb;
 	struct str ln;
+	const unsigned char *lit;
+	size_t litlen;
 	mode_t s;
 	int c, t;
 
@@ -224,9 +252,13 @@ procfile(const char *fn)
 	ln.len = 0;
 	tail = 0;
 	ln.off = -1;
+	lit = skip_literal(&litlen);
 
 	for (first = true, c = 0;  c == 0 || !(lflag || qflag); ) {
 		ln.off += ln.len + 1;
+		if (lit != NULL && !grep_skip(f, lit, litlen, &ln.off,
+		    nflag ? &ln.line_no : NULL))
+			break;
 		if ((ln.dat = grep_fgetln(f, &ln.len)) == NULL || ln.len == 0)
 			break;
 		if (ln.len > 0 && ln.dat[ln.len - 1] == line_sep)
@@ -308,6 +340,13 @@ procline(struct str *l, int nottext)
 				    l->len, &pmatch);
 				r = (r == 0) ? 0 : REG_NOMATCH;
 				st = pmatch.rm_eo;
+			} else if (fg_pattern[i].prefix != NULL &&
+			    memmem(l->dat + pmatch.rm_so,
+			    pmatch.rm_eo - pmatch.rm_so, fg_pattern[i].prefix,
+			    fg_pattern[i].prefixlen) == NULL) {
+				/* Can't match without its literal start */
+				r = REG_NOMATCH;
+				st = pmatch.rm_eo;
 			} else {
 				r = regexec(&r_pattern[i], l->dat, 1,
 				    &pmatch, eflags);
@@ -17,6 +17,7 @@
 #include <linux/kdev_t.h>
 #include <limits.h>
 
+#include "dirwalk.h"
 #include "dynarray.h"
 
 // bits for flags argument
@@ -30,9 +31,14 @@
 #define LIST_MACLABEL       (1 << 7)
 #define LIST_INODE          (1 << 8)
 
+#define LIST_NEEDS_STAT  (LIST_LONG | LIST_SIZE | LIST_CLASSIFY | LIST_MACLABEL | LIST_INODE)
+
 // fwd
 static int listpath(const char *name, int flags);
 
+// reads the directories, and with -R those we will list next
+static dirwalk_t *walker;
+
 static char mode2kind(unsigned mode)
 {
     switch(mode & S_IFMT){
@@ -95,36 +101,29 @@ static void group2str(unsigned gid, char *out)
     }
 }
 
-static int show_total_size(const char *dirname, DIR *d, int flags)
+static int show_total_size(const dirwalk_dir_t *d)
 {
-    struct dirent *de;
     char tmp[1024];
-    struct stat s;
     int sum = 0;
+    int i;
 
     /* run through the directory and sum up the file block sizes */
-    while ((de = readdir(d)) != 0) {
-        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
-            continue;
-        if (de->d_name[0] == '.' && (flags & LIST_ALL) == 0)
-            continue;
-
-        if (strcmp(dirname, "/") == 0)
-            snprintf(tmp, sizeof(tmp), "/%s", de->d_name);
-        else
-            snprintf(tmp, sizeof(tmp), "%s/%s", dirname, de->d_name);
-
-        if (lstat(tmp, &s) < 0) {
-            fprintf(stderr, "stat failed on %s: %s\n", tmp, strerror(errno));
-            rewinddir(d);
+    for (i = 0; i < d->count; i++) {
+        const dirwalk_entry_t *e = &d->entries[i];
+
+        if (e->error) {
+            if (strcmp(d->path, "/") == 0)
+                snprintf(tmp, sizeof(tmp), "/%s", e->name);
+            else
+                snprintf(tmp, sizeof(tmp), "%s/%s", d->path, e->name);
+            fprintf(stderr, "stat failed on %s: %s\n", tmp, strerror(e->error));
             return -1;
         }
 
-        sum += s.st_blocks / 2;
+        sum += e->st.st_blocks / 2;
     }
 
     printf("total %d\n", sum);
-    rewinddir(d);
     return 0;
 }
 
@@ -296,11 +295,13 @@ static int listfile_maclabel(const char *path, struct stat *s, int flags)
     return 0;
 }
 
-static int listfile(const char *dirname, const char *filename, int flags)
+/* statp is the lstat of the file if we have it already, or NULL */
+static int listfile(const char *dirname, const char *filename, struct stat *statp,
+                    int flags)
 {
     struct stat s;
 
-    if ((flags & (LIST_LONG | LIST_SIZE | LIST_CLASSIFY | LIST_MACLABEL | LIST_INODE)) == 0) {
+    if ((flags & LIST_NEEDS_STAT) == 0) {
         printf("%s\n", filename);
         return 0;
     }
@@ -315,7 +316,9 @@ static int listfile(const char *dirname, const char *filename, int flags)
         pathname = filename;
     }
 
-    if(lstat(pathname, &s) < 0) {
+    if (statp != NULL) {
+        s = *statp;
+    } else if(lstat(pathname, &s) < 0) {
         return -1;
     }
 
@@ -332,73 +335,77 @@ static int listfile(const char *dirname, const char *filename, int flags)
     }
 }
 
+static int compare_entries(const void *a, const void *b)
+{
+    const dirwalk_entry_t *e1 = *(const dirwalk_entry_t **)a;
+    const dirwalk_entry_t *e2 = *(const dirwalk_entry_t **)b;
+
+    return strcmp(e1->name, e2->name);
+}
+
 static int listdir(const char *name, int flags)
 {
     char tmp[4096];
-    DIR *d;
-    struct dirent *de;
-    strlist_t  files = STRLIST_INITIALIZER;
-
-    d = opendir(name);
-    if(d == 0) {
-        fprintf(stderr, "opendir failed, %s\n", strerror(errno));
+    dirwalk_dir_t *d;
+    dirwalk_entry_t **sorted;
+    int i;
+
+    d = dirwalk_read(walker, name);
+    if (d == NULL || d->error) {
+        fprintf(stderr, "opendir failed, %s\n", strerror(d ? d->error : ENOMEM));
+        dirwalk_free(d);
         return -1;
     }
 
     if ((flags & LIST_SIZE) != 0) {
-        show_total_size(name, d, flags);
+        show_total_size(d);
     }
 
-    while((de = readdir(d)) != 0){
-        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
-        if(de->d_name[0] == '.' && (flags & LIST_ALL) == 0) continue;
-
-        strlist_append_dup(&files, de->d_name);
+    sorted = malloc(d->count * sizeof(*sorted));
+    if (sorted == NULL && d->count > 0) {
+        fprintf(stderr, "out of memory listing %s\n", name);
+        dirwalk_free(d);
+        return -1;
     }
+    for (i = 0; i < d->count; i++)
+        sorted[i] = &d->entries[i];
+    qsort(sorted, d->count, sizeof(*sorted), compare_entries);
 
-    strlist_sort(&files);
-    STRLIST_FOREACH(&files, filename, listfile(name, filename, flags));
-    strlist_done(&files);
+    for (i = 0; i < d->count; i++) {
+        /* the entries we couldn't lstat are left out, as listfile does */
+        if (sorted[i]->error == 0)
+            listfile(name, sorted[i]->name, &sorted[i]->st, flags);
+    }
+    free(sorted);
 
     if (flags & LIST_RECURSIVE) {
         strlist_t subdirs = STRLIST_INITIALIZER;
 
-        rewinddir(d);
-
-        while ((de = readdir(d)) != 0) {
-            struct stat s;
-            int err;
-
-            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
-                continue;
-            if (de->d_name[0] == '.' && (flags & LIST_ALL) == 0)
-                continue;
+        for (i = 0; i < d->count; i++) {
+            const dirwalk_entry_t *e = &d->entries[i];
 
             if (!strcmp(name, "/"))
-                snprintf(tmp, sizeof(tmp), "/%s", de->d_name);
+                snprintf(tmp, sizeof(tmp), "/%s", e->name);
             else
-                snprintf(tmp, sizeof(tmp), "%s/%s", name, de->d_name);
-
-            /*
-             * If the name ends in a '/', use stat() so we treat it like a
-             * directory even if it's a symlink.
-             */
-            if (tmp[strlen(tmp)-1] == '/')
-                err = stat(tmp, &s);
-            else
-                err = lstat(tmp, &s);
+                snprintf(tmp, sizeof(tmp), "%s/%s", name, e->name);
 
-            if (err < 0) {
-                perror(tmp);
-                closedir(d);
+            if (e->error) {
+                fprintf(stderr, "%s: %s\n", tmp, strerror(e->error));
+                strlist_done(&subdirs);
+                dirwalk_free(d);
                 return -1;
             }
 
-            if (S_ISDIR(s.st_mode)) {
+            if (S_ISDIR(e->st.st_mode)) {
                 strlist_append_dup(&subdirs, tmp);
             }
         }
+        dirwalk_free(d);
+        d = NULL;
+
+        /* the walker reads them while we list the first ones */
         strlist_sort(&subdirs);
+        STRLIST_FOREACH(&subdirs, path, dirwalk_prefetch(walker, path));
         STRLIST_FOREACH(&subdirs, path, {
             printf("\n%s:\n", path);
             listdir(path, flags);
@@ -406,7 +413,7 @@ static int listdir(const char *name, int flags)
         strlist_done(&subdirs);
     }
 
-    closedir(d);
+    dirwalk_free(d);
     return 0;
 }
 
@@ -435,7 +442,25 @@ static int listpath(const char *name, int flags)
         return listdir(name, flags);
     } else {
         /* yeah this calls stat() again*/
-        return listfile(NULL, name, flags);
+        return listfile(NULL, name, NULL, flags);
+    }
+}
+
+static void start_walker(int flags)
+{
+    int wflags = 0;
+
+    if ((flags & LIST_ALL) == 0)
+        wflags |= DIRWALK_NOHIDDEN;
+    if ((flags & (LIST_NEEDS_STAT | LIST_RECURSIVE)) == 0)
+        wflags |= DIRWALK_NOSTAT;
+
+    /* a single directory doesn't make it worth starting threads */
+    walker = dirwalk_create((flags & LIST_RECURSIVE) ? DIRWALK_DEFAULT_THREADS : 0,
+                            wflags);
+    if (walker == NULL) {
+        fprintf(stderr, "%s: out of memory\n", "ls");
+        exit(1);
     }
 }
 
@@ -477,6 +502,7 @@ int ls_main(int argc, char **argv)
         }
 
         if (files.count > 0) {
+            start_walker(flags);
             STRLIST_FOREACH(&files, path, {
                 if (listpath(path, flags) != 0) {
                     err = EXIT_FAILURE;
@@ -488,5 +514,6 @@ int ls_main(int argc, char **argv)
     }
 
     // list working directory if no files or directories were specified
+    start_walker(flags);
     return listpath(".", flags);
 }
@@ -1,77 +1,265 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <md5.h>
 
+#include <mincrypt/sha.h>
+#include <mincrypt/sha256.h>
+
 /* When this was written, bionic's md5.h did not define this. */
 #ifndef MD5_DIGEST_LENGTH
 #define MD5_DIGEST_LENGTH 16
 #endif
 
+#define MAX_DIGEST_LENGTH SHA256_DIGEST_SIZE
+
+/* Reads this big let the kernel's readahead keep the flash busy. */
+#define READ_SIZE (256 * 1024)
+
+/* Past this there is nothing left to gain on flash. */
+#define MAX_THREADS 8
+
+typedef union {
+    MD5_CTX md5;
+    SHA_CTX sha;
+} hash_ctx;
+
+typedef struct {
+    const char *name;
+    int size;
+    void (*init)(hash_ctx *ctx);
+    void (*update)(hash_ctx *ctx, const void *data, int len);
+    void (*final)(hash_ctx *ctx, unsigned char *digest);
+} hash_algo;
+
+/* Note that bionic's MD5_* functions return void. */
+static void md5_init(hash_ctx *ctx) { MD5_Init(&ctx->md5); }
+static void md5_update(hash_ctx *ctx, const void *data, int len) { MD5_Update(&ctx->md5, data, len); }
+static void md5_final(hash_ctx *ctx, unsigned char *digest) { MD5_Final(digest, &ctx->md5); }
+
+static void sha1_init(hash_ctx *ctx) { SHA_init(&ctx->sha); }
+static void sha1_update(hash_ctx *ctx, const void *data, int len) { SHA_update(&ctx->sha, data, len); }
+static void sha1_final(hash_ctx *ctx, unsigned char *digest) { memcpy(digest, SHA_final(&ctx->sha), SHA_DIGEST_SIZE); }
+
+static void sha256_init(hash_ctx *ctx) { SHA256_init(&ctx->sha); }
+static void sha256_update(hash_ctx *ctx, const void *data, int len) { SHA256_update(&ctx->sha, data, len); }
+static void sha256_final(hash_ctx *ctx, unsigned char *digest) { memcpy(digest, SHA256_final(&ctx->sha), SHA256_DIGEST_SIZE); }
+
+static const hash_algo algos[] = {
+    { "md5", MD5_DIGEST_LENGTH, md5_init, md5_update, md5_final },
+    { "sha1", SHA_DIGEST_SIZE, sha1_init, sha1_update, sha1_final },
+    { "sha256", SHA256_DIGEST_SIZE, sha256_init, sha256_update, sha256_final },
+};
+
+typedef struct {
+    unsigned char digest[MAX_DIGEST_LENGTH];
+    const char *failed;     /* "open", "read" or "close" if one did */
+    int error;
+    int done;
+} result;
+
+typedef struct {
+    const hash_algo *algo;
+    char **paths;
+    result *results;
+    int count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* a result is done */
+    int next;               /* next file to hash */
+} hash_job;
+
 static int usage()
 {
-    fprintf(stderr,"md5 file ...\n");
+    fprintf(stderr,"md5 [-a md5|sha1|sha256] [-j threads] file ...\n");
     return -1;
 }
 
-static int do_md5(const char *path)
+static void hash_file(const hash_algo *algo, const char *path, char *buf,
+                      result *r)
 {
-    unsigned int i;
     int fd;
-    MD5_CTX md5_ctx;
-    unsigned char md5[MD5_DIGEST_LENGTH];
+    hash_ctx ctx;
 
     fd = open(path, O_RDONLY);
     if (fd < 0) {
-        fprintf(stderr,"could not open %s, %s\n", path, strerror(errno));
-        return -1;
+        r->failed = "open";
+        r->error = errno;
+        return;
     }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-    /* Note that bionic's MD5_* functions return void. */
-    MD5_Init(&md5_ctx);
+    algo->init(&ctx);
 
     while (1) {
-        char buf[4096];
         ssize_t rlen;
-        rlen = read(fd, buf, sizeof(buf));
+        rlen = read(fd, buf, READ_SIZE);
         if (rlen == 0)
             break;
         else if (rlen < 0) {
+            if (errno == EINTR)
+                continue;
+            r->failed = "read";
+            r->error = errno;
             (void)close(fd);
-            fprintf(stderr,"could not read %s, %s\n", path, strerror(errno));
-            return -1;
+            return;
         }
-        MD5_Update(&md5_ctx, buf, rlen);
+        algo->update(&ctx, buf, rlen);
     }
     if (close(fd)) {
-        fprintf(stderr,"could not close %s, %s\n", path, strerror(errno));
-        return -1;
+        r->failed = "close";
+        r->error = errno;
+        return;
     }
 
-    MD5_Final(md5, &md5_ctx);
+    algo->final(&ctx, r->digest);
+}
 
-    for (i = 0; i < (int)sizeof(md5); i++)
-        printf("%02x", md5[i]);
+static int print_result(const hash_algo *algo, const char *path,
+                        const result *r)
+{
+    int i;
+
+    if (r->failed) {
+        fprintf(stderr,"could not %s %s, %s\n", r->failed, path,
+                strerror(r->error));
+        return -1;
+    }
+
+    for (i = 0; i < algo->size; i++)
+        printf("%02x", r->digest[i]);
     printf("  %s\n", path);
 
     return 0;
 }
 
-int md5_main(int argc, char *argv[])
+static void *hash_thread(void *arg)
+{
+    hash_job *job = arg;
+    char *buf = malloc(READ_SIZE);
+    result r;
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->count)
+            break;
+
+        memset(&r, 0, sizeof(r));
+        if (buf == NULL) {
+            r.failed = "read";
+            r.error = ENOMEM;
+        } else {
+            hash_file(job->algo, job->paths[i], buf, &r);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->results[i] = r;
+        job->results[i].done = 1;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/*
+ * The files are hashed by a pool of threads, but printed in the order
+ * they were given in, as soon as each one and those before it are done.
+ */
+static int hash_files(const hash_algo *algo, char **paths, int count,
+                      int threads)
 {
+    pthread_t tids[MAX_THREADS];
+    hash_job job;
+    int started = 0;
     int i, ret = 0;
 
-    if (argc < 2)
-        return usage();
+    if (threads > count)
+        threads = count;
+
+    memset(&job, 0, sizeof(job));
+    job.algo = algo;
+    job.paths = paths;
+    job.count = count;
+    job.results = calloc(count, sizeof(result));
+    if (job.results == NULL) {
+        fprintf(stderr,"md5: out of memory\n");
+        return 1;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
 
-    /* loop over the file args */
-    for (i = 1; i < argc; i++) {
-        if (do_md5(argv[i]))
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, hash_thread, &job) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        hash_thread(&job);
+
+    for (i = 0; i < count; i++) {
+        pthread_mutex_lock(&job.lock);
+        while (!job.results[i].done)
+            pthread_cond_wait(&job.cond, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+        if (print_result(algo, paths[i], &job.results[i]))
             ret = 1;
     }
 
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+    free(job.results);
     return ret;
 }
+
+int md5_main(int argc, char *argv[])
+{
+    const hash_algo *algo = &algos[0];
+    int threads;
+    int c;
+    unsigned int i;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    while ((c = getopt(argc, argv, "a:j:")) != -1) {
+        switch (c) {
+        case 'a':
+            for (i = 0; i < sizeof(algos) / sizeof(algos[0]); i++) {
+                if (!strcmp(optarg, algos[i].name))
+                    break;
+            }
+            if (i == sizeof(algos) / sizeof(algos[0])) {
+                fprintf(stderr,"md5: unknown algorithm %s\n", optarg);
+                return usage();
+            }
+            algo = &algos[i];
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads > MAX_THREADS)
+                threads = MAX_THREADS;
+            break;
+        default:
+            return usage();
+        }
+    }
+
+    if (optind >= argc)
+        return usage();
+
+    return hash_files(algo, argv + optind, argc - optind, threads);
+}
@@ -0,0 +1,305 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cutils/atomic.h>
+#include <cutils/perfstat.h>
+
+typedef struct {
+    char name[PERFSTAT_NAME_MAX];
+    uint32_t type;
+    int64_t value;
+    int64_t sum;
+    int64_t buckets[PERFSTAT_BUCKETS];
+} stat_copy;
+
+typedef struct {
+    char name[PERFSTAT_NAME_MAX + 4];
+    int pid;
+    stat_copy *stats;
+    int count;
+} area_copy;
+
+typedef struct {
+    area_copy *areas;
+    int count;
+} snapshot;
+
+static int usage()
+{
+    fprintf(stderr,"perfstat [-d seconds] [name ...]\n");
+    return -1;
+}
+
+/* 64-bit loads can tear on 32-bit cpus, so read until two agree. */
+static int64_t read64(const volatile int64_t *p)
+{
+    int64_t v;
+
+    do {
+        v = *p;
+    } while (v != *p);
+    return v;
+}
+
+static int wanted(const char *name, int argc, char **argv)
+{
+    int i;
+
+    if (argc == 0)
+        return 1;
+    for (i = 0; i < argc; i++)
+        if (!strcmp(name, argv[i]))
+            return 1;
+    return 0;
+}
+
+/*
+ * Copies out what the area's writer has published.  The writer never
+ * takes anything back, so all that can change under us are the values.
+ */
+static int copy_area(const struct perfstat_area *area, area_copy *copy)
+{
+    const char *base = (const char *) area;
+    int32_t used;
+    int i, j;
+
+    if ((uint32_t) android_atomic_acquire_load((volatile const int32_t *) &area->magic) != PERFSTAT_MAGIC ||
+        area->version != PERFSTAT_VERSION)
+        return -1;
+
+    used = android_atomic_acquire_load(&area->used);
+    if (used < 1 || used > PERFSTAT_AREA_SIZE / PERFSTAT_SLOT_SIZE)
+        return -1;
+
+    memcpy(copy->name, area->name, sizeof(copy->name));
+    copy->name[sizeof(copy->name) - 1] = 0;
+    copy->pid = area->pid;
+    copy->stats = calloc(used, sizeof(stat_copy));
+    copy->count = 0;
+    if (!copy->stats)
+        return -1;
+
+    for (i = 1; i < used; ) {
+        const struct perfstat *stat = (const struct perfstat *) (base + i * PERFSTAT_SLOT_SIZE);
+        stat_copy *s = &copy->stats[copy->count];
+        uint32_t slots = stat->slots;
+
+        if (slots < 1 || slots > (uint32_t) (used - i))
+            break;
+        memcpy(s->name, stat->name, sizeof(s->name));
+        s->name[sizeof(s->name) - 1] = 0;
+        s->type = stat->type;
+        s->value = read64(&stat->value);
+        if (s->type == PERFSTAT_HISTOGRAM && slots == PERFSTAT_HISTOGRAM_SLOTS) {
+            s->sum = read64(&stat->sum);
+            for (j = 0; j < PERFSTAT_BUCKETS; j++)
+                s->buckets[j] = read64(&perfstat_buckets(stat)[j]);
+        } else if (s->type == PERFSTAT_HISTOGRAM) {
+            break;
+        }
+        copy->count++;
+        i += slots;
+    }
+    return 0;
+}
+
+static int take_snapshot(snapshot *snap, int argc, char **argv)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    DIR *d;
+
+    snap->areas = NULL;
+    snap->count = 0;
+
+    d = opendir(PERFSTAT_DIR);
+    if (!d) {
+        fprintf(stderr, "could not open %s: %s\n", PERFSTAT_DIR, strerror(errno));
+        return -1;
+    }
+    while ((de = readdir(d))) {
+        area_copy *areas;
+        void *map;
+        int fd;
+
+        if (de->d_name[0] == '.' || !wanted(de->d_name, argc, argv))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", PERFSTAT_DIR, de->d_name);
+        fd = open(path, O_RDONLY | O_NOFOLLOW);
+        if (fd < 0)
+            continue;
+        if (fstat(fd, &st) < 0 || st.st_size < PERFSTAT_AREA_SIZE) {
+            close(fd);
+            continue;
+        }
+        map = mmap(NULL, PERFSTAT_AREA_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+            continue;
+
+        areas = realloc(snap->areas, (snap->count + 1) * sizeof(area_copy));
+        if (areas) {
+            snap->areas = areas;
+            if (!copy_area(map, &areas[snap->count]))
+                snap->count++;
+        }
+        munmap(map, PERFSTAT_AREA_SIZE);
+    }
+    closedir(d);
+    return 0;
+}
+
+static void free_snapshot(snapshot *snap)
+{
+    int i;
+
+    for (i = 0; i < snap->count; i++)
+        free(snap->areas[i].stats);
+    free(snap->areas);
+}
+
+static const area_copy *find_area(const snapshot *snap, const area_copy *area)
+{
+    int i;
+
+    for (i = 0; i < snap->count; i++)
+        if (snap->areas[i].pid == area->pid && !strcmp(snap->areas[i].name, area->name))
+            return &snap->areas[i];
+    return NULL;
+}
+
+static const stat_copy *find_stat(const area_copy *area, const stat_copy *stat)
+{
+    int i;
+
+    if (!area)
+        return NULL;
+    for (i = 0; i < area->count; i++)
+        if (area->stats[i].type == stat->type && !strcmp(area->stats[i].name, stat->name))
+            return &area->stats[i];
+    return NULL;
+}
+
+/* Prints the upper bound of the bucket that holds the given permille of samples. */
+static void print_percentile(const char *label, const int64_t *buckets, int64_t n, int permille)
+{
+    int64_t want = (n * permille + 999) / 1000;
+    int64_t seen = 0;
+    int i;
+
+    for (i = 0; i < PERFSTAT_BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= want) {
+            printf(" %s<=%lld", label, i ? (1LL << i) - 1 : 0LL);
+            return;
+        }
+    }
+    printf(" %s>%lld", label, (1LL << (PERFSTAT_BUCKETS - 2)) - 1);
+}
+
+static void print_stat(const stat_copy *stat, const stat_copy *before, double seconds)
+{
+    int64_t value = stat->value - (before ? before->value : 0);
+    int64_t buckets[PERFSTAT_BUCKETS];
+    int64_t sum;
+    int i;
+
+    if (stat->type != PERFSTAT_HISTOGRAM) {
+        if (seconds > 0)
+            printf("  %-40s %12lld %12.1f/s\n", stat->name, (long long) value, value / seconds);
+        else
+            printf("  %-40s %12lld\n", stat->name, (long long) value);
+        return;
+    }
+
+    sum = stat->sum - (before ? before->sum : 0);
+    for (i = 0; i < PERFSTAT_BUCKETS; i++)
+        buckets[i] = stat->buckets[i] - (before ? before->buckets[i] : 0);
+
+    printf("  %-40s n=%lld", stat->name, (long long) value);
+    if (seconds > 0)
+        printf(" (%.1f/s)", value / seconds);
+    if (value > 0) {
+        printf(" avg=%lld", (long long) (sum / value));
+        print_percentile("p50", buckets, value, 500);
+        print_percentile("p90", buckets, value, 900);
+        print_percentile("p99", buckets, value, 990);
+    }
+    printf("\n");
+}
+
+static void print_snapshot(const snapshot *snap, const snapshot *before, double seconds)
+{
+    int i, j;
+
+    for (i = 0; i < snap->count; i++) {
+        const area_copy *area = &snap->areas[i];
+        const area_copy *prev = before ? find_area(before, area) : NULL;
+        int dead = kill(area->pid, 0) < 0 && errno == ESRCH;
+
+        printf("%s (pid %d%s)\n", area->name, area->pid, dead ? ", dead" : "");
+        for (j = 0; j < area->count; j++)
+            print_stat(&area->stats[j], find_stat(prev, &area->stats[j]), seconds);
+    }
+}
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int perfstat_main(int argc, char *argv[])
+{
+    snapshot first, second;
+    int delay = 0;
+    double start;
+    int c;
+
+    while ((c = getopt(argc, argv, "d:h")) != -1) {
+        switch (c) {
+        case 'd':
+            delay = atoi(optarg);
+            if (delay <= 0)
+                return usage();
+            break;
+        default:
+            return usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (take_snapshot(&first, argc, argv) < 0)
+        return 1;
+    if (delay == 0) {
+        print_snapshot(&first, NULL, 0);
+        free_snapshot(&first);
+        return 0;
+    }
+
+    start = now();
+    sleep(delay);
+    if (take_snapshot(&second, argc, argv) < 0) {
+        free_snapshot(&first);
+        return 1;
+    }
+    print_snapshot(&second, &first, now() - start);
+    free_snapshot(&first);
+    free_snapshot(&second);
+    return 0;
+}
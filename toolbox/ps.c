@@ -31,6 +31,118 @@ static char *nexttok(char **strp)
 
 static int display_flags = 0;
 
+/*
+ * "ps -o field,field,..." prints the fields asked for, tab-separated with
+ * a header line, and only reads the /proc files those fields come from.
+ */
+#define NEED_STAT    1
+#define NEED_OWNER   2
+#define NEED_CMDLINE 4
+#define NEED_LABEL   8
+#define NEED_POLICY  16
+
+enum {
+    F_USER, F_UID, F_PID, F_TID, F_PPID, F_VSIZE, F_RSS, F_CPU, F_PRIO,
+    F_NICE, F_RTPRI, F_SCHED, F_PCY, F_WCHAN, F_PC, F_STATE, F_UTIME,
+    F_STIME, F_COMM, F_CMDLINE, F_NAME, F_LABEL
+};
+
+static const struct {
+    const char *name;
+    int needs;
+} fields[] = {
+    [F_USER]    = { "user",    NEED_OWNER },
+    [F_UID]     = { "uid",     NEED_OWNER },
+    [F_PID]     = { "pid",     0 },
+    [F_TID]     = { "tid",     0 },
+    [F_PPID]    = { "ppid",    NEED_STAT },
+    [F_VSIZE]   = { "vsize",   NEED_STAT },
+    [F_RSS]     = { "rss",     NEED_STAT },
+    [F_CPU]     = { "cpu",     NEED_STAT },
+    [F_PRIO]    = { "prio",    NEED_STAT },
+    [F_NICE]    = { "nice",    NEED_STAT },
+    [F_RTPRI]   = { "rtpri",   NEED_STAT },
+    [F_SCHED]   = { "sched",   NEED_STAT },
+    [F_PCY]     = { "pcy",     NEED_POLICY },
+    [F_WCHAN]   = { "wchan",   NEED_STAT },
+    [F_PC]      = { "pc",      NEED_STAT },
+    [F_STATE]   = { "state",   NEED_STAT },
+    [F_UTIME]   = { "utime",   NEED_STAT },
+    [F_STIME]   = { "stime",   NEED_STAT },
+    [F_COMM]    = { "comm",    NEED_STAT },
+    [F_CMDLINE] = { "cmdline", NEED_CMDLINE },
+    [F_NAME]    = { "name",    NEED_STAT | NEED_CMDLINE },
+    [F_LABEL]   = { "label",   NEED_LABEL },
+};
+
+#define MAX_FIELDS 32
+
+static int out_fields[MAX_FIELDS];
+static int num_out_fields = 0;
+static int needs = NEED_STAT | NEED_OWNER | NEED_CMDLINE;
+
+static int parse_fields(char *list)
+{
+    char *field;
+    unsigned i;
+
+    while ((field = strsep(&list, ",")) != 0) {
+        for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            if (!strcmp(field, fields[i].name))
+                break;
+        }
+        if (i == sizeof(fields) / sizeof(fields[0])) {
+            fprintf(stderr, "ps: unknown field '%s'\n", field);
+            return -1;
+        }
+        if (num_out_fields == MAX_FIELDS) {
+            fprintf(stderr, "ps: too many fields\n");
+            return -1;
+        }
+        out_fields[num_out_fields++] = i;
+    }
+    return 0;
+}
+
+static void print_field(int field, const char *user, uid_t uid, int pid, int tid,
+                        int ppid, unsigned vss, unsigned rss, int psr, int prio,
+                        int nice, int rtprio, int sched, unsigned wchan, unsigned eip,
+                        const char *state, unsigned utime, unsigned stime,
+                        const char *name, const char *cmdline, const char *label)
+{
+    SchedPolicy p;
+
+    switch (field) {
+    case F_USER:    fputs(user, stdout); break;
+    case F_UID:     printf("%d", (int)uid); break;
+    case F_PID:     printf("%d", pid); break;
+    case F_TID:     printf("%d", tid); break;
+    case F_PPID:    printf("%d", ppid); break;
+    case F_VSIZE:   printf("%u", vss / 1024); break;
+    case F_RSS:     printf("%u", rss * 4); break;
+    case F_CPU:     printf("%d", psr); break;
+    case F_PRIO:    printf("%d", prio); break;
+    case F_NICE:    printf("%d", nice); break;
+    case F_RTPRI:   printf("%d", rtprio); break;
+    case F_SCHED:   printf("%d", sched); break;
+    case F_PCY:
+        if (get_sched_policy(tid, &p) < 0)
+            fputs("un", stdout);
+        else
+            printf("%.2s", get_sched_policy_name(p));
+        break;
+    case F_WCHAN:   printf("%08x", wchan); break;
+    case F_PC:      printf("%08x", eip); break;
+    case F_STATE:   fputs(state, stdout); break;
+    case F_UTIME:   printf("%u", utime); break;
+    case F_STIME:   printf("%u", stime); break;
+    case F_COMM:    fputs(name, stdout); break;
+    case F_CMDLINE: fputs(cmdline, stdout); break;
+    case F_NAME:    fputs(cmdline[0] ? cmdline : name, stdout); break;
+    case F_LABEL:   fputs(label, stdout); break;
+    }
+}
+
 static int ps_line(int pid, int tid, char *namefilter)
 {
     char statline[1024];
@@ -40,14 +152,16 @@ static int ps_line(int pid, int tid, char *namefilter)
     struct stat stats;
     int fd, r;
     char *ptr, *name, *state;
-    int ppid, tty;
-    unsigned wchan, rss, vss, eip;
-    unsigned utime, stime;
-    int prio, nice, rtprio, sched, psr;
+    int ppid = 0, tty;
+    unsigned wchan = 0, rss = 0, vss = 0, eip = 0;
+    unsigned utime = 0, stime = 0;
+    int prio = 0, nice = 0, rtprio = 0, sched = 0, psr = 0;
     struct passwd *pw;
+    int i;
     
     sprintf(statline, "/proc/%d", pid);
-    stat(statline, &stats);
+    if (needs & NEED_OWNER)
+        stat(statline, &stats);
 
     if(tid) {
         sprintf(statline, "/proc/%d/task/%d/stat", pid, tid);
@@ -57,16 +171,25 @@ static int ps_line(int pid, int tid, char *namefilter)
         sprintf(statline, "/proc/%d/stat", pid);
         sprintf(cmdline, "/proc/%d/cmdline", pid);
         snprintf(macline, sizeof(macline), "/proc/%d/attr/current", pid);
-        fd = open(cmdline, O_RDONLY);
-        if(fd == 0) {
+        if (!(needs & NEED_CMDLINE)) {
             r = 0;
         } else {
-            r = read(fd, cmdline, 1023);
-            close(fd);
-            if(r < 0) r = 0;
+            fd = open(cmdline, O_RDONLY);
+            if(fd == 0) {
+                r = 0;
+            } else {
+                r = read(fd, cmdline, 1023);
+                close(fd);
+                if(r < 0) r = 0;
+            }
         }
         cmdline[r] = 0;
     }
+
+    if (!(needs & NEED_STAT)) {
+        name = state = "";
+        goto skip_stat;
+    }
     
     fd = open(statline, O_RDONLY);
     if(fd == 0) return -1;
@@ -131,6 +254,38 @@ static int ps_line(int pid, int tid, char *namefilter)
     sched = atoi(nexttok(&ptr)); // scheduling policy
     
     tty = atoi(nexttok(&ptr));
+
+skip_stat:
+    if (num_out_fields) {
+        if (!namefilter || !strncmp(name, namefilter, strlen(namefilter))) {
+            if (needs & NEED_OWNER) {
+                pw = getpwuid(stats.st_uid);
+                if (pw == 0) {
+                    sprintf(user, "%d", (int)stats.st_uid);
+                } else {
+                    strcpy(user, pw->pw_name);
+                }
+            }
+            if (needs & NEED_LABEL) {
+                fd = open(macline, O_RDONLY);
+                strcpy(macline, "-");
+                if (fd >= 0) {
+                    r = read(fd, macline, sizeof(macline)-1);
+                    close(fd);
+                    if (r > 0)
+                        macline[r] = 0;
+                }
+            }
+            for (i = 0; i < num_out_fields; i++) {
+                if (i) putchar('\t');
+                print_field(out_fields[i], user, stats.st_uid, pid, tid ? tid : pid,
+                            ppid, vss, rss, psr, prio, nice, rtprio, sched, wchan, eip,
+                            state, utime, stime, name, cmdline, macline);
+            }
+            putchar('\n');
+        }
+        return 0;
+    }
     
     if(tid != 0) {
         ppid = pid;
@@ -207,6 +362,7 @@ int ps_main(int argc, char **argv)
     char *namefilter = 0;
     int pidfilter = 0;
     int threads = 0;
+    int i;
     
     d = opendir("/proc");
     if(d == 0) return -1;
@@ -224,6 +380,11 @@ int ps_main(int argc, char **argv)
             display_flags |= SHOW_PRIO;
         } else if(!strcmp(argv[1],"-c")) {
             display_flags |= SHOW_CPU;
+        } else if(!strcmp(argv[1],"-o") && argc > 2) {
+            if (parse_fields(argv[2]) < 0)
+                return -1;
+            argc--;
+            argv++;
         }  else if(isdigit(argv[1][0])){
             pidfilter = atoi(argv[1]);
         } else {
@@ -233,7 +394,17 @@ int ps_main(int argc, char **argv)
         argv++;
     }
 
-    if (display_flags & SHOW_MACLABEL) {
+    // the output is a lot of small writes
+    setvbuf(stdout, 0, _IOFBF, 64 * 1024);
+
+    if (num_out_fields) {
+        needs = namefilter ? NEED_STAT : 0;
+        for (i = 0; i < num_out_fields; i++) {
+            needs |= fields[out_fields[i]].needs;
+            printf("%s%s", i ? "\t" : "", fields[out_fields[i]].name);
+        }
+        printf("\n");
+    } else if (display_flags & SHOW_MACLABEL) {
         printf("LABEL                          USER     PID   PPID  NAME\n");
     } else {
         printf("USER     PID   PPID  VSIZE  RSS   %s%s %s WCHAN    PC         NAME\n",
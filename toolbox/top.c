@@ -31,11 +31,13 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -52,6 +54,8 @@ struct cpu_info {
 
 struct proc_info {
     struct proc_info *next;
+    struct proc_info *hash_next;
+    int stat_fd;
     pid_t pid;
     pid_t tid;
     uid_t uid;
@@ -85,6 +89,16 @@ static int num_old_procs, num_new_procs;
 static struct proc_info *free_procs;
 static int num_used_procs, num_free_procs;
 
+/* The previous snapshot, hashed by tid. */
+#define HASH_SIZE 1024
+static struct proc_info *old_hash[HASH_SIZE];
+
+/* The stat files stay open from one refresh to the next, as many of them
+ * as the fd limit allows, and so do /proc and /proc/stat. */
+static int num_stat_fds, max_stat_fds;
+static DIR *proc_dir;
+static int proc_stat_fd;
+
 static int max_procs, delay, iterations, threads;
 
 static struct cpu_info old_cpu, new_cpu;
@@ -92,13 +106,16 @@ static struct cpu_info old_cpu, new_cpu;
 static struct proc_info *alloc_proc(void);
 static void free_proc(struct proc_info *proc);
 static void read_procs(void);
-static int read_stat(char *filename, struct proc_info *proc);
+static int read_stat(char *filename, struct proc_info *proc, struct proc_info *old_proc);
+static void read_proc_info(pid_t pid, struct proc_info *proc, const char *tname,
+                           struct proc_info *old_proc);
 static void read_policy(int pid, struct proc_info *proc);
 static void add_proc(int proc_num, struct proc_info *proc);
 static int read_cmdline(char *filename, struct proc_info *proc);
 static int read_status(char *filename, struct proc_info *proc);
 static void print_procs(void);
 static struct proc_info *find_old_proc(pid_t pid, pid_t tid);
+static void hash_old_procs(void);
 static void free_old_procs(void);
 static int (*proc_cmp)(const void *a, const void *b);
 static int proc_cpu_cmp(const void *a, const void *b);
@@ -109,6 +126,7 @@ static int numcmp(long long a, long long b);
 static void usage(char *cmd);
 
 int top_main(int argc, char *argv[]) {
+    struct rlimit rl;
     int i;
 
     num_used_procs = num_free_procs = 0;
@@ -179,10 +197,21 @@ int top_main(int argc, char *argv[]) {
     num_new_procs = num_old_procs = 0;
     new_procs = old_procs = NULL;
 
+    /* Leave some fds for everything else. */
+    num_stat_fds = max_stat_fds = 0;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur > 64)
+        max_stat_fds = rl.rlim_cur - 64;
+
+    proc_dir = opendir("/proc");
+    if (!proc_dir) die("Could not open /proc.\n");
+    proc_stat_fd = open("/proc/stat", O_RDONLY);
+    if (proc_stat_fd < 0) die("Could not open /proc/stat.\n");
+
     read_procs();
     while ((iterations == -1) || (iterations-- > 0)) {
         old_procs = new_procs;
         num_old_procs = num_new_procs;
+        hash_old_procs();
         memcpy(&old_cpu, &new_cpu, sizeof(old_cpu));
         sleep(delay);
         read_procs();
@@ -207,10 +236,16 @@ static struct proc_info *alloc_proc(void) {
 
     num_used_procs++;
 
+    proc->stat_fd = -1;
     return proc;
 }
 
 static void free_proc(struct proc_info *proc) {
+    if (proc->stat_fd >= 0) {
+        close(proc->stat_fd);
+        num_stat_fds--;
+    }
+
     proc->next = free_procs;
     free_procs = proc;
 
@@ -221,29 +256,28 @@ static void free_proc(struct proc_info *proc) {
 #define MAX_LINE 256
 
 static void read_procs(void) {
-    DIR *proc_dir, *task_dir;
+    DIR *task_dir;
     struct dirent *pid_dir, *tid_dir;
     char filename[64];
-    FILE *file;
+    char buf[MAX_LINE];
     int proc_num;
-    struct proc_info *proc;
+    struct proc_info *proc, *old_proc;
     pid_t pid, tid;
+    ssize_t len;
 
     int i;
 
-    proc_dir = opendir("/proc");
-    if (!proc_dir) die("Could not open /proc.\n");
-
     new_procs = calloc(INIT_PROCS * (threads ? THREAD_MULT : 1), sizeof(struct proc_info *));
     num_new_procs = INIT_PROCS * (threads ? THREAD_MULT : 1);
 
-    file = fopen("/proc/stat", "r");
-    if (!file) die("Could not open /proc/stat.\n");
-    fscanf(file, "cpu  %lu %lu %lu %lu %lu %lu %lu", &new_cpu.utime, &new_cpu.ntime, &new_cpu.stime,
+    len = pread(proc_stat_fd, buf, MAX_LINE - 1, 0);
+    if (len < 0) die("Could not read /proc/stat.\n");
+    buf[len] = '\0';
+    sscanf(buf, "cpu  %lu %lu %lu %lu %lu %lu %lu", &new_cpu.utime, &new_cpu.ntime, &new_cpu.stime,
             &new_cpu.itime, &new_cpu.iowtime, &new_cpu.irqtime, &new_cpu.sirqtime);
-    fclose(file);
 
     proc_num = 0;
+    rewinddir(proc_dir);
     while ((pid_dir = readdir(proc_dir))) {
         if (!isdigit(pid_dir->d_name[0]))
             continue;
@@ -252,36 +286,42 @@ static void read_procs(void) {
         
         struct proc_info cur_proc;
         
-        if (!threads) {
-            proc = alloc_proc();
-
-            proc->pid = proc->tid = pid;
+        /* In both modes, the process (or its main thread) comes first. */
+        old_proc = find_old_proc(pid, pid);
+        proc = alloc_proc();
+        proc->pid = proc->tid = pid;
 
+        if (!threads) {
             sprintf(filename, "/proc/%d/stat", pid);
-            read_stat(filename, proc);
+            read_stat(filename, proc, old_proc);
 
-            sprintf(filename, "/proc/%d/cmdline", pid);
-            read_cmdline(filename, proc);
-
-            sprintf(filename, "/proc/%d/status", pid);
-            read_status(filename, proc);
+            read_proc_info(pid, proc, proc->tname, old_proc);
 
             read_policy(pid, proc);
 
             proc->num_threads = 0;
         } else {
-            sprintf(filename, "/proc/%d/cmdline", pid);
-            read_cmdline(filename, &cur_proc);
+            sprintf(filename, "/proc/%d/task/%d/stat", pid, pid);
+            read_stat(filename, proc, old_proc);
+
+            read_proc_info(pid, &cur_proc, proc->tname, old_proc);
 
-            sprintf(filename, "/proc/%d/status", pid);
-            read_status(filename, &cur_proc);
-            
-            proc = NULL;
+            read_policy(pid, proc);
+
+            strcpy(proc->name, cur_proc.name);
+            proc->uid = cur_proc.uid;
+            proc->gid = cur_proc.gid;
+
+            add_proc(proc_num++, proc);
         }
 
         sprintf(filename, "/proc/%d/task", pid);
         task_dir = opendir(filename);
-        if (!task_dir) continue;
+        if (!task_dir) {
+            if (!threads)
+                free_proc(proc);
+            continue;
+        }
 
         while ((tid_dir = readdir(task_dir))) {
             if (!isdigit(tid_dir->d_name[0]))
@@ -289,13 +329,15 @@ static void read_procs(void) {
 
             if (threads) {
                 tid = atoi(tid_dir->d_name);
+                if (tid == pid)
+                    continue;
 
                 proc = alloc_proc();
 
                 proc->pid = pid; proc->tid = tid;
 
                 sprintf(filename, "/proc/%d/task/%d/stat", pid, tid);
-                read_stat(filename, proc);
+                read_stat(filename, proc, find_old_proc(pid, tid));
 
                 read_policy(tid, proc);
 
@@ -317,19 +359,58 @@ static void read_procs(void) {
 
     for (i = proc_num; i < num_new_procs; i++)
         new_procs[i] = NULL;
+}
 
-    closedir(proc_dir);
+/*
+ * Takes the name, uid and gid of the process from the previous snapshot,
+ * unless it wasn't there or its name has changed since (as it does after
+ * an exec, or once zygote has specialized a new app), in which case they
+ * are read again.
+ */
+static void read_proc_info(pid_t pid, struct proc_info *proc, const char *tname,
+                           struct proc_info *old_proc) {
+    char filename[64];
+
+    if (old_proc && !strcmp(old_proc->tname, tname)) {
+        strcpy(proc->name, old_proc->name);
+        proc->uid = old_proc->uid;
+        proc->gid = old_proc->gid;
+        return;
+    }
+
+    sprintf(filename, "/proc/%d/cmdline", pid);
+    read_cmdline(filename, proc);
+
+    sprintf(filename, "/proc/%d/status", pid);
+    read_status(filename, proc);
 }
 
-static int read_stat(char *filename, struct proc_info *proc) {
-    FILE *file;
+static int read_stat(char *filename, struct proc_info *proc, struct proc_info *old_proc) {
     char buf[MAX_LINE], *open_paren, *close_paren;
-    int res, idx;
-
-    file = fopen(filename, "r");
-    if (!file) return 1;
-    fgets(buf, MAX_LINE, file);
-    fclose(file);
+    ssize_t len;
+    int fd;
+
+    /*
+     * Reuse the fd of the previous snapshot: it still refers to the same
+     * thread, so if that's gone pread fails, even if the tid was reused.
+     */
+    if (old_proc && old_proc->stat_fd >= 0) {
+        fd = old_proc->stat_fd;
+        old_proc->stat_fd = -1;
+    } else {
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) return 1;
+        num_stat_fds++;
+    }
+    len = pread(fd, buf, MAX_LINE - 1, 0);
+    if (len <= 0 || num_stat_fds > max_stat_fds) {
+        close(fd);
+        num_stat_fds--;
+    } else {
+        proc->stat_fd = fd;
+    }
+    if (len <= 0) return 1;
+    buf[len] = '\0';
 
     /* Split at first '(' and last ')' to get process name. */
     open_paren = strchr(buf, '(');
@@ -486,15 +567,29 @@ static void print_procs(void) {
 }
 
 static struct proc_info *find_old_proc(pid_t pid, pid_t tid) {
-    int i;
+    struct proc_info *proc;
 
-    for (i = 0; i < num_old_procs; i++)
-        if (old_procs[i] && (old_procs[i]->pid == pid) && (old_procs[i]->tid == tid))
-            return old_procs[i];
+    for (proc = old_hash[tid & (HASH_SIZE - 1)]; proc; proc = proc->hash_next)
+        if ((proc->pid == pid) && (proc->tid == tid))
+            return proc;
 
     return NULL;
 }
 
+static void hash_old_procs(void) {
+    struct proc_info *proc;
+    int i;
+
+    memset(old_hash, 0, sizeof(old_hash));
+    for (i = 0; i < num_old_procs; i++) {
+        proc = old_procs[i];
+        if (proc) {
+            proc->hash_next = old_hash[proc->tid & (HASH_SIZE - 1)];
+            old_hash[proc->tid & (HASH_SIZE - 1)] = proc;
+        }
+    }
+}
+
 static void free_old_procs(void) {
     int i;
 